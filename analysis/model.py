@@ -42,8 +42,17 @@ import time
 import os
 import random
 import argparse
+import struct
+from sklearn.ensemble import GradientBoostingClassifier, RandomForestClassifier
 from pull_data import Pull
 
+# tree ensemble file format, read by src/ensemble.c (see src/include/ensemble.h)
+ENSEMBLE_MAGIC = 'JOYE'
+ENSEMBLE_VERSION = 1
+ENSEMBLE_BOOSTED = 0
+ENSEMBLE_FOREST = 1
+ENSEMBLE_LEAF = 0xffffffff
+
 def learn_param(data, labels, param_file):
     logreg = LogRegClassifier(standardize=False)
     logreg.train(data, labels)
@@ -55,6 +64,51 @@ def learn_param(data, labels, param_file):
     A.extend(w)
     np.savetxt(param_file,A)
 
+def learn_ensemble(data, labels, ensemble_file, forest, num_trees):
+    if forest:
+        model = RandomForestClassifier(n_estimators=num_trees)
+    else:
+        model = GradientBoostingClassifier(n_estimators=num_trees)
+    model.fit(data, labels)
+
+    positive = list(model.classes_).index(1)
+    if forest:
+        trees = [(e.tree_, None) for e in model.estimators_]
+        base = 0.0
+    else:
+        trees = [(e.tree_, model.learning_rate) for e in model.estimators_[:,0]]
+        # the initial estimate of a binary GradientBoostingClassifier is
+        # the log odds of the positive class
+        p = float(sum(1 for l in labels if l == 1)) / len(labels)
+        base = math.log(p / (1.0 - p))
+
+    sizes = []
+    nodes = []
+    for tree, scale in trees:
+        sizes.append(tree.node_count)
+        for n in range(tree.node_count):
+            if tree.children_left[n] == -1:
+                if scale is None:
+                    counts = tree.value[n][0]
+                    value = counts[positive] / float(sum(counts))
+                else:
+                    value = tree.value[n][0][0] * scale
+                nodes.append(struct.pack('<IfII', ENSEMBLE_LEAF, value, 0, 0))
+            else:
+                nodes.append(struct.pack('<IfII', tree.feature[n], tree.threshold[n],
+                                         tree.children_left[n], tree.children_right[n]))
+
+    f = open(ensemble_file, 'wb')
+    f.write(struct.pack('<4sIIIIIf', ENSEMBLE_MAGIC, ENSEMBLE_VERSION,
+                        ENSEMBLE_FOREST if forest else ENSEMBLE_BOOSTED,
+                        len(data[0]), len(sizes), len(nodes), base))
+    f.write(struct.pack('<%dI' % len(sizes), *sizes))
+    f.write(''.join(nodes))
+    f.close()
+
+    print 'trees:\t' + str(len(sizes))
+    print 'nodes:\t' + str(len(nodes))
+
 def main():
     parser = argparse.ArgumentParser(description="Generate Model Parameters for LAUI", add_help=True)
     
@@ -66,6 +120,9 @@ def main():
     parser.add_argument('-d', '--dist', action="store_true", default=False, help="Parse Byte Distribution Information")
     parser.add_argument('-s', '--ssl', action="store_true", default=False, help="Parse SSL/TLS Information")
     parser.add_argument('-o', '--output', action="store", default="params.txt", help="Output file for parameters")
+    parser.add_argument('-g', '--boosted', action="store_true", default=False, help="Learn gradient boosted trees (joy ensemble file)")
+    parser.add_argument('-f', '--forest', action="store_true", default=False, help="Learn a random forest (joy ensemble file)")
+    parser.add_argument('-T', '--trees', action="store", type=int, default=100, help="Number of trees of an ensemble")
 
     args = parser.parse_args()
 
@@ -96,6 +153,10 @@ def main():
         print 'Enter some data types to learn on (-m, -l, -t, -d, -s)'
         return
 
+    if (args.boosted or args.forest) and (types[:3] != [0,1,2] or 4 in types):
+        print 'Ensembles use the features that joy computes: -m -l -t, and optionally -d'
+        return
+
     param_file = args.output
     if not args.pos_dir.endswith('/'):
         args.pos_dir += '/'
@@ -143,7 +204,10 @@ def main():
     print 'Total Features:\t%i' % (num_params)
     print
 
-    learn_param(data, labels, args.output)
+    if args.boosted or args.forest:
+        learn_ensemble(data, labels, args.output, args.forest, args.trees)
+    else:
+        learn_param(data, labels, args.output)
 
 
 if __name__ == "__main__":
@@ -97,6 +97,8 @@ class FlowIteratorFromFile(DictStreamIteratorFromFile):
                     self.f = gzip.open(self.pcap_loader.temp_json['file'], 'r')
                 elif ft.is_bz2():
                     self.f = bz2.BZ2File(self.pcap_loader.temp_json['file'], 'r')
+                elif ft.is_zst():
+                    self.f = ft.zst_open()
                 else:
                     self.f = open(self.pcap_loader.temp_json['file'], 'r')
             else:
@@ -105,6 +107,8 @@ class FlowIteratorFromFile(DictStreamIteratorFromFile):
                     self.f = gzip.open(self.file_name, 'r')
                 elif ft.is_bz2():
                     self.f = bz2.BZ2File(self.file_name, 'r')
+                elif ft.is_zst():
+                    self.f = ft.zst_open()
                 else:
                     self.f = open(self.file_name, 'r')
 
@@ -41,6 +41,7 @@ import pickle
 import copy
 import re
 import fnmatch
+import subprocess
 
 
 """
@@ -94,6 +95,8 @@ class DictStreamIteratorFromFile(DictStreamIterator):
                 self.f = gzip.open(self.file_name, 'r')
             elif ft.is_bz2():
                 self.f = bz2.BZ2File(self.file_name, 'r')
+            elif ft.is_zst():
+                self.f = ft.zst_open()
             else:
                 self.f = open(self.file_name, 'r')
 
@@ -708,3 +711,20 @@ class SleuthFileType(object):
                 return True
 
         return False
+
+    def is_zst(self):
+        magic = "\x28\xb5\x2f\xfd"
+
+        with open(self.filename) as f:
+            data = f.read(len(magic))
+
+            if data.startswith(magic):
+                return True
+
+        return False
+
+    def zst_open(self):
+        # joy writes zstd output as a sequence of frames, which the zstd
+        # tool reads as one stream
+        return subprocess.Popen(['zstd', '-dcq', self.filename],
+                                stdout=subprocess.PIPE).stdout
@@ -273,7 +273,7 @@ void acsm_free(acsm_context_t *ctx)
     unsigned        i;
     acsm_pattern_t *p, *op;
 
-    for (i = 0; i <= ctx->num_state; i++) {
+    for (i = 0; ctx->state_table && i <= ctx->num_state; i++) {
         if (ctx->state_table[i].match_list) {
             p = ctx->state_table[i].match_list;
             
@@ -50,6 +50,7 @@
 #include <ctype.h>
 #include <stdlib.h>
 #include <string.h> 
+#include <stdint.h>
 #include <unistd.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -254,17 +255,98 @@ static joy_status_e anon_subnet_add_from_string (char *addr) {
     return failure;
 }
 
+/*
+ * The subnet set is compiled into a table indexed by the top 16 bits
+ * of an address.  Each /16 block is outside the set, inside it, or
+ * partly covered by longer prefixes; only the last case searches the
+ * sorted, merged address ranges of those prefixes.
+ */
+#define ANON_BLOCK_OUT     0
+#define ANON_BLOCK_IN      1
+#define ANON_BLOCK_PARTIAL 2
+
+static unsigned char anon_block[65536];
+
+typedef struct {
+    uint32_t lo;   /* host byte order */
+    uint32_t hi;
+} anon_range_t;
+
+static anon_range_t anon_range[MAX_ANON_SUBNETS];
+static unsigned int num_ranges = 0;
+
+static int anon_range_cmp (const void *a, const void *b) {
+    const anon_range_t *x = a, *y = b;
+
+    return (x->lo > y->lo) - (x->lo < y->lo);
+}
+
+/* rebuilds the lookup tables from the anonymization list */
+static void anon_subnet_compile (void) {
+    unsigned int i, j, n = 0;
+    uint32_t lo, hi;
+
+    memset(anon_block, ANON_BLOCK_OUT, sizeof(anon_block));
+    for (i=0; i < num_subnets; i++) {
+        lo = ntohl(anon_subnet[i].addr.s_addr);
+        hi = lo | ~ntohl(anon_subnet[i].mask.s_addr);
+        if ((hi - lo) >= 0xffff) {
+            /* covers whole /16 blocks */
+            memset(anon_block + (lo >> 16), ANON_BLOCK_IN, (hi >> 16) - (lo >> 16) + 1);
+        } else {
+            anon_range[n].lo = lo;
+            anon_range[n].hi = hi;
+            n++;
+        }
+    }
+
+    /* merge the longer prefixes into disjoint ranges */
+    qsort(anon_range, n, sizeof(anon_range_t), anon_range_cmp);
+    num_ranges = 0;
+    for (i=0; i < n; i++) {
+        if (anon_block[anon_range[i].lo >> 16] == ANON_BLOCK_IN) {
+            continue;
+        }
+        if (num_ranges > 0 && anon_range[i].lo <= anon_range[num_ranges-1].hi) {
+            if (anon_range[i].hi > anon_range[num_ranges-1].hi) {
+                anon_range[num_ranges-1].hi = anon_range[i].hi;
+            }
+            continue;
+        }
+        anon_range[num_ranges++] = anon_range[i];
+    }
+    for (j=0; j < num_ranges; j++) {
+        anon_block[anon_range[j].lo >> 16] = ANON_BLOCK_PARTIAL;
+    }
+}
+
 /* finds address in anonymization list */
 static unsigned int addr_is_in_set (const struct in_addr *a) {
-    int i;
+    uint32_t x = ntohl(a->s_addr);
+    unsigned int lo = 0, hi = num_ranges;
+
+    switch (anon_block[x >> 16]) {
+    case ANON_BLOCK_OUT:
+        return 0;
+    case ANON_BLOCK_IN:
+        return 1;
+    default:
+        break;
+    }
+    while (lo < hi) {
+        unsigned int mid = (lo + hi) / 2;
 
-    for (i=0; i < num_subnets; i++) {
-        if ((a->s_addr & anon_subnet[i].mask.s_addr) == anon_subnet[i].addr.s_addr) {
+        if (x < anon_range[mid].lo) {
+            hi = mid;
+        } else if (x > anon_range[mid].hi) {
+            lo = mid + 1;
+        } else {
             return 1;
-        } 
+        }
     }
     return 0;
 }
+
 /* determines number of bits in the subnet mask */
 static unsigned int bits_in_mask (void *a, unsigned int bytes) {
     unsigned int n = 0;
@@ -364,6 +446,7 @@ joy_status_e anon_init (const char *pathname, FILE *logfile) {
                 }
             }
         }
+        anon_subnet_compile();
         anon_print_subnets(anon_info);
         fprintf(anon_info, "configured %d subnets for anonymization\n", num_subnets);
         free(line);
@@ -373,24 +456,46 @@ joy_status_e anon_init (const char *pathname, FILE *logfile) {
     return s;
 }
 
-/** buffer used for anonymized data */
-static char hexout[33];
+/* renders the anonymized form of an address into hexout */
+static void addr_render_anon_hexstring (const struct in_addr *a, char *hexout) {
+    static const char hex[] = "0123456789abcdef";
+    unsigned char pt[16] = { 0, };
+    unsigned char c[16];
+    unsigned int i;
+
+    memcpy(pt, a, sizeof(struct in_addr));
+    AES_encrypt(pt, c, &key.enc_key);
+    for (i=0; i < 16; i++) {
+        hexout[2*i] = hex[c[i] >> 4];
+        hexout[2*i+1] = hex[c[i] & 0x0f];
+    }
+    hexout[32] = 0;
+}
 
 /**
- * \fn char *addr_get_anon_hexstring (const struct in_addr *a)
+ * \fn char *addr_get_anon_hexstring (const struct in_addr *a, anon_addr_cache_t *cache, char *hexout)
  * \param a address to be anonymized
+ * \param cache cache of recently anonymized addresses, or NULL
+ * \param hexout buffer of ANON_HEXSTRING_LEN bytes for the anonymized output
  * \return pointer to the anonymized output
  */
-char *addr_get_anon_hexstring (const struct in_addr *a) {
-    unsigned char pt[16] = { 0, };
-    unsigned char c[16];
+char *addr_get_anon_hexstring (const struct in_addr *a, anon_addr_cache_t *cache, char *hexout) {
+    anon_addr_cache_entry_t *e;
+
+    if (cache == NULL) {
+        addr_render_anon_hexstring(a, hexout);
+        return hexout;
+    }
+
+    /* direct mapped; a Fibonacci hash spreads out neighboring addresses */
+    e = &cache->entry[((uint32_t)a->s_addr * 2654435761u) >> (32 - ANON_ADDR_CACHE_BITS)];
+    if (!e->valid || e->addr.s_addr != a->s_addr) {
+        addr_render_anon_hexstring(a, e->hex);
+        e->addr = *a;
+        e->valid = 1;
+    }
+    memcpy(hexout, e->hex, ANON_HEXSTRING_LEN);
 
-    memcpy(pt, a, sizeof(struct in_addr));
-    AES_encrypt(pt, c, &key.enc_key);
-    snprintf(hexout, 33, "%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x", 
-               c[0], c[1], c[2], c[3], c[4], c[5], c[6], c[7], 
-               c[8], c[9], c[10], c[11], c[12], c[13], c[14], c[15]);
- 
     return hexout;
 }
 
@@ -411,27 +516,79 @@ unsigned int ipv4_addr_needs_anonymization (const struct in_addr *a) {
  * \fn int anon_unit_test ()
  * \param none
  * \return ok
+ * \return failure
  */
 int anon_unit_test () {
+    static const char *subnets[] = {
+        "10.0.0.0/8", "64.104.192.128/25", "64.104.192.0/26", "64.104.193.0/24", NULL
+    };
+    static const struct {
+        const char *addr;
+        unsigned int in_set;
+    } lookups[] = {
+        { "10.1.2.3", 1 },
+        { "11.0.0.0", 0 },
+        { "64.104.192.129", 1 },
+        { "64.104.192.64", 0 },
+        { "64.104.192.63", 1 },
+        { "64.104.193.255", 1 },
+        { "64.104.194.0", 0 },
+        { NULL, 0 }
+    };
+    static const unsigned char test_key[16] = {
+        0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+        0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f
+    };
+    struct anon_aes_128_ipv4_key saved_key = key;
+    unsigned int saved_num_subnets = num_subnets;
+    anon_addr_cache_t *cache = NULL;
+    char hex1[ANON_HEXSTRING_LEN], hex2[ANON_HEXSTRING_LEN];
+    char buf[80];
     struct in_addr inp;
-    extern FILE *anon_info;
-
-    anon_init("internal.net", stderr);
-
-#ifndef WIN32
-    if (inet_aton("64.104.192.129", &inp) == 0) {
-#else
-    if (inet_pton(AF_INET, "64.104.192.129", &inp) == 0) {
-#endif 
-        fprintf(anon_info, "error: could not convert address\n");
-    }  
-    if (ipv4_addr_needs_anonymization(&inp) != 1) {
-        fprintf(anon_info, "error in anon_unit_test\n");
+    unsigned int i;
+    int num_fails = 0;
+
+    /* subnet lookups, including prefixes longer than /16 */
+    for (i=0; subnets[i] != NULL; i++) {
+        strncpy(buf, subnets[i], sizeof(buf) - 1);
+        buf[sizeof(buf) - 1] = 0;
+        if (anon_subnet_add_from_string(buf) != ok) {
+            fprintf(stderr, "error: could not add subnet %s\n", subnets[i]);
+            num_fails++;
+        }
+    }
+    anon_subnet_compile();
+    for (i=0; lookups[i].addr != NULL; i++) {
+        inet_pton(AF_INET, lookups[i].addr, &inp);
+        if (addr_is_in_set(&inp) != lookups[i].in_set) {
+            fprintf(stderr, "error: lookup of %s returned %u\n", lookups[i].addr, !lookups[i].in_set);
+            num_fails++;
+        }
+    }
+    num_subnets = saved_num_subnets;
+    anon_subnet_compile();
+
+    /* cached output matches direct output, also after a collision */
+    AES_set_encrypt_key(test_key, 128, &key.enc_key);
+    cache = calloc(1, sizeof(anon_addr_cache_t));
+    if (cache == NULL) {
+        num_fails++;
     } else {
-        fprintf(anon_info, "passed\n");
+        for (i=0; i < 4 * ANON_ADDR_CACHE_SIZE; i++) {
+            inp.s_addr = htonl(0x0a000000 + (i % (2 * ANON_ADDR_CACHE_SIZE)) * 7919);
+            addr_get_anon_hexstring(&inp, cache, hex1);
+            addr_get_anon_hexstring(&inp, NULL, hex2);
+            if (strlen(hex1) != 32 || strcmp(hex1, hex2) != 0) {
+                fprintf(stderr, "error: cached anonymized address differs\n");
+                num_fails++;
+                break;
+            }
+        }
+        free(cache);
     }
+    key = saved_key;
 
-    return ok;
+    return num_fails ? failure : ok;
 }
 
 /* END address anonymization  */
@@ -565,15 +722,7 @@ joy_status_e anon_http_init (const char *pathname, FILE *logfile, enum anon_mode
  * \return none
  */
 void zprintf_nbytes (zfile f, char *s, size_t len) {
-    char tmp[1024];
-  
-    if (len >= 1024) {
-        fprintf(stderr, "error: string longer than fixed buffer (length: %zu)\n", len);
-        return;
-    }
-    memcpy(tmp, s, len);
-    tmp[len] = 0;
-    zprintf(f, "%s", tmp);
+    zwrite(f, s, len);
 }
 
 /**
@@ -584,18 +733,11 @@ void zprintf_nbytes (zfile f, char *s, size_t len) {
  * \return none
  */
 void zprintf_anon_nbytes (zfile f, char *s, size_t len) {
-    char tmp[1024];
-    unsigned int i;
+    size_t i;
 
-    if (len >= 1024) {
-        fprintf(stderr, "error: string longer than fixed buffer (length: %zu)\n", len);
-        return;
-    }
     for (i=0; i<len; i++) {
-        tmp[i] = '*';
+        zputc(f, '*');
     }
-    tmp[len] = 0;
-    zprintf(f, "%s", tmp);
 }
 
 /**
@@ -620,7 +762,7 @@ void anon_print_uri(zfile f, struct matches *matches, char *text) {
     unsigned int i;
 
     if (matches->count == 0) {
-        zprintf(f, "%s", text);
+        zputs(f, text);
         return;
     }
 
@@ -672,7 +814,7 @@ void anon_print_string (zfile f, struct matches *matches, char *text,
     char hex[33];
 
     if (matches->count == 0) {
-        zprintf(f, "%s", text);
+        zputs(f, text);
         return;
     }
 
@@ -705,7 +847,7 @@ void anon_print_string (zfile f, struct matches *matches, char *text,
             zprintf_nbytes(f, text + matches->stop[i] + 1, matches->start[i+1] - matches->stop[i] - 1);
         } else {
             /* nonmatching */
-            zprintf(f, "%s", text + matches->stop[i] + 1); 
+            zputs(f, text + matches->stop[i] + 1);
         }
     }
 }
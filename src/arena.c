@@ -0,0 +1,391 @@
+/*
+ *
+ * Copyright (c) 2018 Cisco Systems, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ *
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file arena.c
+ *
+ * \brief Bump allocator for per-flow protocol parser state
+ *
+ * The protocol parsers keep many small, variable-length objects per flow
+ * (extensions, algorithm lists, payloads, options) that all live exactly
+ * as long as the flow.  Allocating them from an arena makes allocation a
+ * pointer bump and deletion a single call that hands the arena's chunks
+ * back to a shared pool, from which the next flows take them again.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "pthread.h"
+#include "arena.h"
+#include "config.h"
+#include "err.h"
+
+/*
+ * External objects, defined in joy.c
+ */
+extern FILE *info;
+
+/** alignment of every allocation */
+#define JOY_ARENA_ALIGN 8
+
+#define JOY_ARENA_ROUND(n) (((n) + (JOY_ARENA_ALIGN - 1)) & ~(size_t)(JOY_ARENA_ALIGN - 1))
+
+struct joy_arena_chunk_ {
+    joy_arena_chunk_t *next;
+    size_t size;           /**< bytes in data */
+    size_t used;           /**< bytes of data handed out */
+    unsigned char data[];
+};
+
+/** bytes available in a pooled chunk */
+#define JOY_ARENA_CHUNK_DATA (JOY_ARENA_CHUNK_SIZE - sizeof(joy_arena_chunk_t))
+
+/*
+ * Chunks released by arenas, shared by all threads; the lock is taken
+ * once per chunk acquired and once per arena released, never per
+ * allocation
+ */
+static joy_arena_chunk_t *joy_arena_pool = NULL;
+static unsigned int joy_arena_pool_len = 0;
+static pthread_mutex_t joy_arena_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * \brief Get a chunk with room for at least \p len bytes: a pooled
+ * chunk if that is large enough, or else a chunk of exactly that size.
+ */
+static joy_arena_chunk_t *joy_arena_chunk_get (size_t len) {
+    joy_arena_chunk_t *c = NULL;
+
+    if (len <= JOY_ARENA_CHUNK_DATA) {
+        pthread_mutex_lock(&joy_arena_pool_lock);
+        c = joy_arena_pool;
+        if (c) {
+            joy_arena_pool = c->next;
+            joy_arena_pool_len--;
+        }
+        pthread_mutex_unlock(&joy_arena_pool_lock);
+
+        if (c == NULL) {
+            c = malloc(JOY_ARENA_CHUNK_SIZE);
+        }
+        len = JOY_ARENA_CHUNK_DATA;
+    } else {
+        c = malloc(sizeof(joy_arena_chunk_t) + len);
+    }
+    if (c == NULL) {
+        joy_log_err("malloc failed");
+        return NULL;
+    }
+    c->next = NULL;
+    c->size = len;
+    c->used = 0;
+
+    return c;
+}
+
+/**
+ * \brief Return the chunks of a list, up to but not including \p stop,
+ * to the pool; chunks that are not pool-sized, or that do not fit in the
+ * pool, are freed.
+ */
+static void joy_arena_chunks_put (joy_arena_chunk_t *c, joy_arena_chunk_t *stop) {
+    joy_arena_chunk_t *spill = NULL;
+    joy_arena_chunk_t *next = NULL;
+
+    if (c == stop) {
+        return;
+    }
+
+    pthread_mutex_lock(&joy_arena_pool_lock);
+    for (; c != stop; c = next) {
+        next = c->next;
+        if (c->size == JOY_ARENA_CHUNK_DATA && joy_arena_pool_len < JOY_ARENA_POOL_MAX) {
+            c->next = joy_arena_pool;
+            joy_arena_pool = c;
+            joy_arena_pool_len++;
+        } else {
+            c->next = spill;
+            spill = c;
+        }
+    }
+    pthread_mutex_unlock(&joy_arena_pool_lock);
+
+    for (c = spill; c != NULL; c = next) {
+        next = c->next;
+        free(c);
+    }
+}
+
+/**
+ * \brief Allocate \p len bytes from an arena.
+ *
+ * The memory is not initialized, and lives until the arena is released
+ * or rewound past it.
+ *
+ * \param arena The arena
+ * \param len Number of bytes
+ *
+ * \return Pointer to the memory, aligned for any parser structure, or
+ * NULL if no memory is available
+ */
+void *joy_arena_alloc (joy_arena_t *arena, size_t len) {
+    joy_arena_chunk_t *c = arena->current;
+    joy_arena_chunk_t *n = NULL;
+    size_t need = len ? JOY_ARENA_ROUND(len) : JOY_ARENA_ALIGN;
+    void *p = NULL;
+
+    if (c && c->size - c->used >= need) {
+        p = c->data + c->used;
+        c->used += need;
+        return p;
+    }
+
+    n = joy_arena_chunk_get(need);
+    if (n == NULL) {
+        return NULL;
+    }
+    n->used = need;
+    n->next = arena->chunks;
+    arena->chunks = n;
+
+    /* keep bumping from whichever chunk has more room left */
+    if (c == NULL || n->size - n->used > c->size - c->used) {
+        arena->current = n;
+    }
+
+    return n->data;
+}
+
+/**
+ * \brief Allocate \p len zeroed bytes from an arena.
+ *
+ * \param arena The arena
+ * \param len Number of bytes
+ *
+ * \return Pointer to the memory, or NULL if no memory is available
+ */
+void *joy_arena_calloc (joy_arena_t *arena, size_t len) {
+    void *p = joy_arena_alloc(arena, len);
+
+    if (p) {
+        memset(p, 0, len);
+    }
+    return p;
+}
+
+/**
+ * \brief Resize an allocation made from an arena.
+ *
+ * The most recent allocation is resized in place when its chunk has
+ * room; otherwise the contents are copied to a new allocation, and the
+ * old one is only reclaimed when the arena is released.  Callers that
+ * grow a buffer repeatedly should grow it geometrically.
+ *
+ * \param arena The arena
+ * \param ptr The allocation, or NULL
+ * \param old_len Its size in bytes
+ * \param new_len The size wanted
+ *
+ * \return Pointer to the resized allocation, or NULL if no memory is
+ * available (in which case \p ptr is unchanged)
+ */
+void *joy_arena_realloc (joy_arena_t *arena, void *ptr, size_t old_len, size_t new_len) {
+    joy_arena_chunk_t *c = arena->current;
+    size_t old_need = JOY_ARENA_ROUND(old_len);
+    size_t new_need = JOY_ARENA_ROUND(new_len);
+    void *p = NULL;
+
+    if (ptr == NULL) {
+        return joy_arena_alloc(arena, new_len);
+    }
+
+    if (c && old_need && (unsigned char *)ptr + old_need == c->data + c->used &&
+        c->used - old_need + new_need <= c->size) {
+        c->used = c->used - old_need + new_need;
+        return ptr;
+    }
+
+    if (new_len <= old_len) {
+        return ptr;
+    }
+    p = joy_arena_alloc(arena, new_len);
+    if (p) {
+        memcpy(p, ptr, old_len);
+    }
+    return p;
+}
+
+/**
+ * \brief Record the current position of an arena.
+ *
+ * \param arena The arena
+ * \param mark Set to the position
+ */
+void joy_arena_mark (const joy_arena_t *arena, joy_arena_mark_t *mark) {
+    mark->chunks = arena->chunks;
+    mark->current = arena->current;
+    mark->used = arena->current ? arena->current->used : 0;
+}
+
+/**
+ * \brief Discard everything allocated from an arena since \p mark was
+ * recorded, e.g. the partial result of a failed parse.
+ *
+ * \param arena The arena
+ * \param mark A position recorded by joy_arena_mark(), with no rewind to
+ * an earlier position since
+ */
+void joy_arena_rewind (joy_arena_t *arena, const joy_arena_mark_t *mark) {
+    joy_arena_chunks_put(arena->chunks, mark->chunks);
+    arena->chunks = mark->chunks;
+    arena->current = mark->current;
+    if (arena->current) {
+        arena->current->used = mark->used;
+    }
+}
+
+/**
+ * \brief Release everything allocated from an arena, leaving it empty.
+ *
+ * \param arena The arena
+ */
+void joy_arena_release (joy_arena_t *arena) {
+    joy_arena_chunks_put(arena->chunks, NULL);
+    arena->chunks = NULL;
+    arena->current = NULL;
+}
+
+/**
+ * \brief Free the chunks held in the pool.
+ */
+void joy_arena_pool_cleanup (void) {
+    joy_arena_chunk_t *c = NULL;
+
+    pthread_mutex_lock(&joy_arena_pool_lock);
+    c = joy_arena_pool;
+    joy_arena_pool = NULL;
+    joy_arena_pool_len = 0;
+    pthread_mutex_unlock(&joy_arena_pool_lock);
+
+    while (c) {
+        joy_arena_chunk_t *next = c->next;
+
+        free(c);
+        c = next;
+    }
+}
+
+/**
+ * \brief Unit test for the arena allocator
+ *
+ * \return none
+ */
+void joy_arena_unit_test (void) {
+    joy_arena_t arena;
+    joy_arena_mark_t mark;
+    unsigned char *a = NULL, *b = NULL, *big = NULL;
+    unsigned int pooled = 0;
+    unsigned int i;
+    int num_fails = 0;
+
+    fprintf(info, "\n******************************\n");
+    fprintf(info, "Arena Unit Test starting...\n");
+
+    memset(&arena, 0, sizeof(arena));
+
+    /* Small allocations are aligned and do not overlap */
+    a = joy_arena_calloc(&arena, 3);
+    b = joy_arena_alloc(&arena, 5);
+    if (a == NULL || b == NULL || ((uintptr_t)a | (uintptr_t)b) % JOY_ARENA_ALIGN ||
+        b < a + 3 || a[0] || a[2]) {
+        fprintf(info, "error: small allocations\n");
+        num_fails++;
+    }
+
+    /* The latest allocation grows in place, an older one moves */
+    memcpy(b, "abcde", 5);
+    if (joy_arena_realloc(&arena, b, 5, 200) != b) {
+        fprintf(info, "error: realloc of the last allocation moved it\n");
+        num_fails++;
+    }
+    a = joy_arena_realloc(&arena, a, 3, 16);
+    b = joy_arena_realloc(&arena, b, 200, 400);
+    if (a == NULL || b == NULL || memcmp(b, "abcde", 5)) {
+        fprintf(info, "error: realloc lost the contents\n");
+        num_fails++;
+    }
+
+    /* A large allocation gets its own chunk, and small ones continue */
+    big = joy_arena_alloc(&arena, 3 * JOY_ARENA_CHUNK_SIZE);
+    a = joy_arena_alloc(&arena, 8);
+    if (big == NULL || a == NULL || (a >= big && a < big + 3 * JOY_ARENA_CHUNK_SIZE) ||
+        arena.current->size != JOY_ARENA_CHUNK_DATA) {
+        fprintf(info, "error: large allocation\n");
+        num_fails++;
+    }
+
+    /* Rewinding discards what was allocated since the mark */
+    joy_arena_mark(&arena, &mark);
+    for (i = 0; i < 1000; i++) {
+        joy_arena_alloc(&arena, 100);
+    }
+    joy_arena_rewind(&arena, &mark);
+    if (arena.chunks != mark.chunks || arena.current->used != mark.used) {
+        fprintf(info, "error: rewind\n");
+        num_fails++;
+    }
+    if (joy_arena_alloc(&arena, 8) != (void *)(arena.current->data + mark.used)) {
+        fprintf(info, "error: allocation after rewind\n");
+        num_fails++;
+    }
+
+    /* Releasing returns the pool-sized chunks to the pool */
+    pooled = joy_arena_pool_len;
+    joy_arena_release(&arena);
+    if (arena.chunks != NULL || joy_arena_pool_len <= pooled) {
+        fprintf(info, "error: release\n");
+        num_fails++;
+    }
+
+    if (num_fails) {
+        fprintf(info, "Finished - failures: %d\n", num_fails);
+    } else {
+        fprintf(info, "Finished - success\n");
+    }
+    fprintf(info, "******************************\n\n");
+}
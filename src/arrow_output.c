@@ -0,0 +1,1119 @@
+/*
+ *
+ * Copyright (c) 2018 Cisco Systems, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ *
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file arrow_output.c
+ *
+ * \brief Columnar output of records, as Arrow IPC record batches
+ *
+ * The Arrow IPC streaming format is a sequence of messages: a schema,
+ * then record batches.  Each message is a FlatBuffers-encoded header
+ * followed by a body that holds the buffers of the columns (validity
+ * bitmaps, offsets and values), each padded to 8 bytes.  The few
+ * FlatBuffers tables that the schema and the batches need are built
+ * here directly, by a minimal builder, so that there is no dependency
+ * on the Arrow or FlatBuffers libraries.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "arrow_output.h"
+#include "config.h"
+#include "err.h"
+
+/*
+ * External objects, defined in joy.c
+ */
+extern FILE *info;
+
+/*
+ * FlatBuffers builder
+ *
+ * A FlatBuffer is built back to front: the children of a table are
+ * written before (at higher addresses than) the table that refers to
+ * them.  The data occupies the last used bytes of buf, and an object
+ * is referred to by the value of used just after it was written,
+ * which stays valid as the buffer grows.
+ */
+#define FB_MAX_FIELDS 8
+
+typedef struct fb_builder_ {
+    unsigned char *buf;
+    size_t size;
+    size_t used;
+    size_t minalign;
+    size_t table;                 /* used at the start of the open table */
+    size_t field[FB_MAX_FIELDS];  /* reference of each field of the open table, 0 if absent */
+    unsigned int num_fields;
+    int failed;
+} fb_builder_t;
+
+static int fb_grow (fb_builder_t *b, size_t len) {
+    unsigned char *buf;
+    size_t size = b->size ? b->size : 1024;
+
+    if (b->failed) {
+        return -1;
+    }
+    while (size - b->used < len) {
+        size *= 2;
+    }
+    if (size != b->size) {
+        buf = malloc(size);
+        if (buf == NULL) {
+            b->failed = 1;
+            return -1;
+        }
+        if (b->used) {
+            memcpy(buf + size - b->used, b->buf + b->size - b->used, b->used);
+        }
+        free(b->buf);
+        b->buf = buf;
+        b->size = size;
+    }
+    return 0;
+}
+
+static void fb_pad (fb_builder_t *b, size_t len) {
+    if (fb_grow(b, len) == 0) {
+        b->used += len;
+        memset(b->buf + b->size - b->used, 0, len);
+    }
+}
+
+/* aligns, so that an element of size align can follow additional bytes */
+static void fb_prep (fb_builder_t *b, size_t align, size_t additional) {
+    if (align > b->minalign) {
+        b->minalign = align;
+    }
+    fb_pad(b, (~(b->used + additional) + 1) & (align - 1));
+}
+
+/* writes a little-endian scalar of len bytes */
+static size_t fb_push (fb_builder_t *b, uint64_t value, size_t len) {
+    unsigned char *p;
+    size_t i;
+
+    fb_prep(b, len, 0);
+    if (fb_grow(b, len) == 0) {
+        b->used += len;
+        p = b->buf + b->size - b->used;
+        for (i = 0; i < len; i++) {
+            p[i] = (unsigned char)(value >> (8 * i));
+        }
+    }
+    return b->used;
+}
+
+/* writes a reference to the object ref */
+static size_t fb_push_ref (fb_builder_t *b, size_t ref) {
+    fb_prep(b, 4, 0);
+    return fb_push(b, b->used + 4 - ref, 4);
+}
+
+static size_t fb_string (fb_builder_t *b, const char *s) {
+    size_t len = strlen(s);
+
+    fb_prep(b, 4, len + 1);
+    fb_pad(b, 1);
+    if (fb_grow(b, len) == 0) {
+        b->used += len;
+        memcpy(b->buf + b->size - b->used, s, len);
+    }
+    return fb_push(b, len, 4);
+}
+
+/* a vector of references; refs are written in order */
+static size_t fb_ref_vector (fb_builder_t *b, const size_t *refs, unsigned int n) {
+    unsigned int i;
+
+    fb_prep(b, 4, 4 * n);
+    for (i = n; i > 0; i--) {
+        fb_push_ref(b, refs[i - 1]);
+    }
+    return fb_push(b, n, 4);
+}
+
+/* a vector of structs of two int64s, such as FieldNode and Buffer */
+static size_t fb_pair_vector (fb_builder_t *b, const int64_t *pairs, unsigned int n) {
+    unsigned int i;
+
+    fb_prep(b, 4, 16 * n);
+    fb_prep(b, 8, 16 * n);
+    for (i = n; i > 0; i--) {
+        fb_push(b, pairs[2 * i - 1], 8);
+        fb_push(b, pairs[2 * i - 2], 8);
+    }
+    return fb_push(b, n, 4);
+}
+
+static void fb_start_table (fb_builder_t *b) {
+    memset(b->field, 0, sizeof(b->field));
+    b->num_fields = 0;
+    b->table = b->used;
+}
+
+static void fb_field (fb_builder_t *b, unsigned int id, size_t ref) {
+    b->field[id] = ref;
+    if (id >= b->num_fields) {
+        b->num_fields = id + 1;
+    }
+}
+
+static void fb_add_scalar (fb_builder_t *b, unsigned int id, uint64_t value, size_t len) {
+    fb_field(b, id, fb_push(b, value, len));
+}
+
+static void fb_add_ref (fb_builder_t *b, unsigned int id, size_t ref) {
+    fb_field(b, id, fb_push_ref(b, ref));
+}
+
+/* writes the vtable of the open table, and returns the table */
+static size_t fb_end_table (fb_builder_t *b) {
+    size_t table = fb_push(b, 0, 4);
+    size_t vtable;
+    unsigned int i;
+
+    for (i = b->num_fields; i > 0; i--) {
+        fb_push(b, b->field[i - 1] ? table - b->field[i - 1] : 0, 2);
+    }
+    fb_push(b, table - b->table, 2);
+    vtable = fb_push(b, 4 + 2 * b->num_fields, 2);
+    if (!b->failed) {
+        /* the table starts with the distance back to its vtable */
+        unsigned char *p = b->buf + b->size - table;
+        uint32_t d = (uint32_t)(vtable - table);
+
+        p[0] = d;
+        p[1] = d >> 8;
+        p[2] = d >> 16;
+        p[3] = d >> 24;
+    }
+    return table;
+}
+
+/* writes the reference to the root table, and returns the buffer size */
+static size_t fb_finish (fb_builder_t *b, size_t root) {
+    fb_prep(b, b->minalign, 4);
+    fb_push_ref(b, root);
+    return b->used;
+}
+
+static const unsigned char *fb_data (const fb_builder_t *b) {
+    return b->buf + b->size - b->used;
+}
+
+static void fb_reset (fb_builder_t *b) {
+    b->used = 0;
+    b->minalign = 1;
+    b->failed = 0;
+}
+
+/*
+ * Arrow metadata (Schema.fbs, Message.fbs)
+ */
+enum arrow_fb_type {
+    arrow_fb_int = 2,
+    arrow_fb_floating_point = 3,
+    arrow_fb_utf8 = 5,
+    arrow_fb_timestamp = 10,
+    arrow_fb_list = 12,
+    arrow_fb_struct = 13
+};
+
+enum arrow_fb_header {
+    arrow_fb_schema = 1,
+    arrow_fb_record_batch = 3
+};
+
+#define ARROW_METADATA_V5 4
+#define ARROW_PRECISION_DOUBLE 2
+#define ARROW_UNIT_MICROSECOND 2
+#define ARROW_MAX_DEPTH 8
+
+/* the width of the values of a fixed-width column, 0 for the others */
+static size_t arrow_width (arrow_type_e type) {
+    switch (type) {
+    case arrow_uint8:
+        return 1;
+    case arrow_uint16:
+        return 2;
+    case arrow_uint32:
+        return 4;
+    case arrow_uint64:
+    case arrow_float64:
+    case arrow_timestamp:
+        return 8;
+    default:
+        return 0;
+    }
+}
+
+/* the Type table of a field; sets *type_type to its kind */
+static size_t arrow_fb_type_table (fb_builder_t *b, arrow_type_e type, unsigned int *type_type) {
+    fb_start_table(b);
+    switch (type) {
+    case arrow_uint8:
+    case arrow_uint16:
+    case arrow_uint32:
+    case arrow_uint64:
+        *type_type = arrow_fb_int;
+        fb_add_scalar(b, 0, 8 * arrow_width(type), 4);   /* bitWidth */
+        fb_add_scalar(b, 1, 0, 1);                       /* is_signed */
+        break;
+    case arrow_float64:
+        *type_type = arrow_fb_floating_point;
+        fb_add_scalar(b, 0, ARROW_PRECISION_DOUBLE, 2);
+        break;
+    case arrow_timestamp:
+        *type_type = arrow_fb_timestamp;
+        fb_add_scalar(b, 0, ARROW_UNIT_MICROSECOND, 2);
+        break;
+    case arrow_utf8:
+        *type_type = arrow_fb_utf8;
+        break;
+    case arrow_list:
+        *type_type = arrow_fb_list;
+        break;
+    case arrow_struct:
+        *type_type = arrow_fb_struct;
+        break;
+    }
+    return fb_end_table(b);
+}
+
+static size_t arrow_fb_field(fb_builder_t *b, const arrow_field_t *field, unsigned int depth);
+
+/* the vector of the Field tables of the children of field */
+static size_t arrow_fb_children (fb_builder_t *b, const arrow_field_t *field, unsigned int depth) {
+    size_t *refs;
+    size_t vector;
+    unsigned int i;
+
+    refs = calloc(field->num_children + 1, sizeof(size_t));
+    if (refs == NULL || depth > ARROW_MAX_DEPTH) {
+        free(refs);
+        b->failed = 1;
+        return 0;
+    }
+    for (i = 0; i < field->num_children; i++) {
+        refs[i] = arrow_fb_field(b, &field->children[i], depth + 1);
+    }
+    vector = fb_ref_vector(b, refs, field->num_children);
+    free(refs);
+    return vector;
+}
+
+/* the Field table of a field, and of its children */
+static size_t arrow_fb_field (fb_builder_t *b, const arrow_field_t *field, unsigned int depth) {
+    size_t name, type, children;
+    unsigned int type_type = 0;
+
+    children = arrow_fb_children(b, field, depth);
+    name = fb_string(b, field->name);
+    type = arrow_fb_type_table(b, field->type, &type_type);
+
+    fb_start_table(b);
+    fb_add_ref(b, 0, name);
+    fb_add_scalar(b, 1, 1, 1);                     /* nullable */
+    fb_add_scalar(b, 2, type_type, 1);
+    fb_add_ref(b, 3, type);
+    fb_add_ref(b, 5, children);
+    return fb_end_table(b);
+}
+
+/* a Message table around the header, and the whole buffer */
+static size_t arrow_fb_message (fb_builder_t *b, unsigned int header_type,
+                                size_t header, int64_t body_len) {
+    fb_start_table(b);
+    fb_add_scalar(b, 3, body_len, 8);
+    fb_add_ref(b, 2, header);
+    fb_add_scalar(b, 0, ARROW_METADATA_V5, 2);
+    fb_add_scalar(b, 1, header_type, 1);
+    return fb_finish(b, fb_end_table(b));
+}
+
+static int arrow_host_is_big_endian (void) {
+    const uint16_t one = 1;
+
+    return *(const unsigned char *)&one == 0;
+}
+
+static size_t arrow_fb_schema_message (fb_builder_t *b, const arrow_field_t *schema) {
+    size_t fields, table;
+
+    fields = arrow_fb_children(b, schema, 0);
+    fb_start_table(b);
+    fb_add_ref(b, 1, fields);
+    fb_add_scalar(b, 0, arrow_host_is_big_endian(), 2);   /* endianness */
+    table = fb_end_table(b);
+    return arrow_fb_message(b, arrow_fb_schema, table, 0);
+}
+
+/*
+ * Columns
+ */
+#define arrow_pad8(n) (((n) + 7) & ~(size_t)7)
+
+static int arrow_reserve (void **p, size_t *size, size_t need) {
+    size_t new_size = *size ? *size : 64;
+    void *tmp;
+
+    if (need <= *size) {
+        return 0;
+    }
+    while (new_size < need) {
+        new_size *= 2;
+    }
+    tmp = realloc(*p, new_size);
+    if (tmp == NULL) {
+        return -1;
+    }
+    *p = tmp;
+    *size = new_size;
+    return 0;
+}
+
+static void arrow_column_free (arrow_column_t *c) {
+    unsigned int i;
+
+    if (c->children != NULL) {
+        for (i = 0; i < c->field->num_children; i++) {
+            arrow_column_free(&c->children[i]);
+        }
+    }
+    free(c->children);
+    free(c->valid);
+    free(c->data);
+    free(c->offsets);
+}
+
+static void arrow_column_reset (arrow_column_t *c) {
+    unsigned int i;
+
+    c->length = 0;
+    c->null_count = 0;
+    c->data_len = 0;
+    c->failed = 0;
+    if (c->offsets != NULL) {
+        c->offsets[0] = 0;
+    }
+    for (i = 0; c->children != NULL && i < c->field->num_children; i++) {
+        arrow_column_reset(&c->children[i]);
+    }
+}
+
+static int arrow_column_init (arrow_column_t *c, const arrow_field_t *field, unsigned int depth) {
+    unsigned int i;
+
+    memset(c, 0, sizeof(arrow_column_t));
+    c->field = field;
+    if (depth > ARROW_MAX_DEPTH ||
+        (field->type == arrow_list && field->num_children != 1) ||
+        (field->type != arrow_list && field->type != arrow_struct && field->num_children != 0)) {
+        joy_log_err("unsupported arrow field %s", field->name);
+        return failure;
+    }
+    if (field->type == arrow_utf8 || field->type == arrow_list) {
+        if (arrow_reserve((void **)&c->offsets, &c->offsets_size, sizeof(int32_t)) != 0) {
+            return failure;
+        }
+        c->offsets[0] = 0;
+    }
+    if (field->num_children) {
+        c->children = calloc(field->num_children, sizeof(arrow_column_t));
+        if (c->children == NULL) {
+            return failure;
+        }
+        for (i = 0; i < field->num_children; i++) {
+            if (arrow_column_init(&c->children[i], &field->children[i], depth + 1) != ok) {
+                return failure;
+            }
+        }
+    }
+    return ok;
+}
+
+/* makes room for one more value, and records whether it is valid */
+static int arrow_column_next (arrow_column_t *c, int valid) {
+    size_t n = c->length;
+
+    if (arrow_reserve((void **)&c->valid, &c->valid_size, n / 8 + 1) != 0 ||
+        (c->offsets != NULL &&
+         arrow_reserve((void **)&c->offsets, &c->offsets_size, (n + 2) * sizeof(int32_t)) != 0)) {
+        c->failed = 1;
+        return -1;
+    }
+    if (n % 8 == 0) {
+        c->valid[n / 8] = 0;
+    }
+    if (valid) {
+        c->valid[n / 8] |= 1 << (n % 8);
+    } else {
+        c->null_count++;
+    }
+    return 0;
+}
+
+/* appends the bytes of one value of a fixed-width or utf8 column */
+static void arrow_column_put (arrow_column_t *c, const void *value, size_t len) {
+    if (arrow_reserve((void **)&c->data, &c->data_size, c->data_len + len) != 0) {
+        c->failed = 1;
+        return;
+    }
+    memcpy(c->data + c->data_len, value, len);
+    c->data_len += len;
+}
+
+/**
+ * \fn void arrow_append_null (arrow_column_t *c)
+ * \brief Append a null to the column \p c; the members of a struct
+ *        column get a null each too.
+ * \param c column
+ * \return none
+ */
+void arrow_append_null (arrow_column_t *c) {
+    static const unsigned char zero[8] = { 0 };
+    unsigned int i;
+
+    if (arrow_column_next(c, 0) != 0) {
+        return;
+    }
+    switch (c->field->type) {
+    case arrow_utf8:
+        c->offsets[c->length + 1] = (int32_t)c->data_len;
+        break;
+    case arrow_list:
+        c->offsets[c->length + 1] = c->offsets[c->length];
+        break;
+    case arrow_struct:
+        for (i = 0; i < c->field->num_children; i++) {
+            arrow_append_null(&c->children[i]);
+        }
+        break;
+    default:
+        arrow_column_put(c, zero, arrow_width(c->field->type));
+        break;
+    }
+    c->length++;
+}
+
+/**
+ * \fn void arrow_append_uint (arrow_column_t *c, uint64_t value)
+ * \brief Append an integer to the unsigned integer column \p c.
+ * \param c column
+ * \param value the value, truncated to the width of the column
+ * \return none
+ */
+void arrow_append_uint (arrow_column_t *c, uint64_t value) {
+    uint8_t v8 = (uint8_t)value;
+    uint16_t v16 = (uint16_t)value;
+    uint32_t v32 = (uint32_t)value;
+
+    if (arrow_column_next(c, 1) != 0) {
+        return;
+    }
+    switch (c->field->type) {
+    case arrow_uint8:
+        arrow_column_put(c, &v8, sizeof(v8));
+        break;
+    case arrow_uint16:
+        arrow_column_put(c, &v16, sizeof(v16));
+        break;
+    case arrow_uint32:
+        arrow_column_put(c, &v32, sizeof(v32));
+        break;
+    default:
+        arrow_column_put(c, &value, sizeof(value));
+        break;
+    }
+    c->length++;
+}
+
+/**
+ * \fn void arrow_append_double (arrow_column_t *c, double value)
+ * \brief Append a value to the float64 column \p c.
+ * \param c column
+ * \param value the value
+ * \return none
+ */
+void arrow_append_double (arrow_column_t *c, double value) {
+    if (arrow_column_next(c, 1) == 0) {
+        arrow_column_put(c, &value, sizeof(value));
+        c->length++;
+    }
+}
+
+/**
+ * \fn void arrow_append_timeval (arrow_column_t *c, const struct timeval *ts)
+ * \brief Append a time to the timestamp column \p c.
+ * \param c column
+ * \param ts the time
+ * \return none
+ */
+void arrow_append_timeval (arrow_column_t *c, const struct timeval *ts) {
+    int64_t us = (int64_t)ts->tv_sec * 1000000 + ts->tv_usec;
+
+    if (arrow_column_next(c, 1) == 0) {
+        arrow_column_put(c, &us, sizeof(us));
+        c->length++;
+    }
+}
+
+/**
+ * \fn void arrow_append_string (arrow_column_t *c, const char *s, size_t len)
+ * \brief Append a string to the utf8 column \p c.
+ * \param c column
+ * \param s the string, which must be valid UTF-8
+ * \param len its length in bytes
+ * \return none
+ */
+void arrow_append_string (arrow_column_t *c, const char *s, size_t len) {
+    if (arrow_column_next(c, 1) == 0) {
+        arrow_column_put(c, s, len);
+        c->offsets[c->length + 1] = (int32_t)c->data_len;
+        c->length++;
+    }
+}
+
+/**
+ * \fn void arrow_append_json_members (arrow_column_t *c, const char *s, size_t len)
+ * \brief Append to the utf8 column \p c the JSON object whose members
+ *        are \p s, as the JSON output writes them (a list of members
+ *        with a comma before or after each), or a null if there are none.
+ * \param c column
+ * \param s the members
+ * \param len their length in bytes
+ * \return none
+ */
+void arrow_append_json_members (arrow_column_t *c, const char *s, size_t len) {
+    if (len && s[0] == ',') {
+        s++;
+        len--;
+    }
+    if (len && s[len - 1] == ',') {
+        len--;
+    }
+    if (len == 0) {
+        arrow_append_null(c);
+        return;
+    }
+    if (arrow_column_next(c, 1) == 0) {
+        arrow_column_put(c, "{", 1);
+        arrow_column_put(c, s, len);
+        arrow_column_put(c, "}", 1);
+        c->offsets[c->length + 1] = (int32_t)c->data_len;
+        c->length++;
+    }
+}
+
+/**
+ * \fn void arrow_end_list (arrow_column_t *c)
+ * \brief Append a list to the list column \p c: the items appended to
+ *        its child since the previous list.
+ * \param c column
+ * \return none
+ */
+void arrow_end_list (arrow_column_t *c) {
+    if (arrow_column_next(c, 1) == 0) {
+        c->offsets[c->length + 1] = (int32_t)c->children[0].length;
+        c->length++;
+    }
+}
+
+/**
+ * \fn void arrow_end_struct (arrow_column_t *c)
+ * \brief Append a struct to the struct column \p c, once a value has
+ *        been appended to each of its members.  For the root of a
+ *        batch, this completes a row.
+ * \param c column
+ * \return none
+ */
+void arrow_end_struct (arrow_column_t *c) {
+    if (arrow_column_next(c, 1) == 0) {
+        c->length++;
+    }
+}
+
+/**
+ * \fn arrow_batch_t *arrow_batch_new (const arrow_field_t *schema)
+ * \brief Allocate an empty batch with the columns of \p schema.
+ * \param schema a struct field, whose members are the columns
+ * \return the batch, or NULL on failure
+ */
+arrow_batch_t *arrow_batch_new (const arrow_field_t *schema) {
+    arrow_batch_t *b;
+
+    if (schema->type != arrow_struct) {
+        return NULL;
+    }
+    b = calloc(1, sizeof(arrow_batch_t));
+    if (b == NULL) {
+        return NULL;
+    }
+    if (arrow_column_init(&b->root, schema, 0) != ok) {
+        arrow_batch_free(b);
+        return NULL;
+    }
+    return b;
+}
+
+/**
+ * \fn void arrow_batch_free (arrow_batch_t *b)
+ * \brief Free the batch \p b.
+ * \param b batch, or NULL
+ * \return none
+ */
+void arrow_batch_free (arrow_batch_t *b) {
+    if (b != NULL) {
+        arrow_column_free(&b->root);
+        free(b);
+    }
+}
+
+/**
+ * \fn void arrow_batch_reset (arrow_batch_t *b)
+ * \brief Empty the batch \p b, keeping its memory.
+ * \param b batch
+ * \return none
+ */
+void arrow_batch_reset (arrow_batch_t *b) {
+    arrow_column_reset(&b->root);
+}
+
+/*
+ * Record batches
+ */
+
+/* the field nodes and buffers of a record batch, in depth-first order */
+typedef struct arrow_layout_ {
+    int64_t *nodes;               /* length, null_count pairs */
+    unsigned int num_nodes;
+    int64_t *buffers;             /* offset, length pairs */
+    unsigned int num_buffers;
+    int64_t body_len;
+    int failed;
+} arrow_layout_t;
+
+static void arrow_layout_buffer (arrow_layout_t *l, size_t len) {
+    l->buffers[2 * l->num_buffers] = l->body_len;
+    l->buffers[2 * l->num_buffers + 1] = len;
+    l->num_buffers++;
+    l->body_len += arrow_pad8(len);
+}
+
+/* counts the nodes and buffers of c, and checks that it is complete */
+static void arrow_layout_count (const arrow_column_t *c, size_t length,
+                                unsigned int *num_nodes, unsigned int *num_buffers, int *failed) {
+    unsigned int i;
+
+    if (c->failed || c->length != length) {
+        *failed = 1;
+    }
+    (*num_nodes)++;
+    switch (c->field->type) {
+    case arrow_utf8:
+        *num_buffers += 3;
+        break;
+    case arrow_list:
+        *num_buffers += 2;
+        arrow_layout_count(&c->children[0], c->offsets[c->length], num_nodes, num_buffers, failed);
+        break;
+    case arrow_struct:
+        *num_buffers += 1;
+        for (i = 0; i < c->field->num_children; i++) {
+            arrow_layout_count(&c->children[i], length, num_nodes, num_buffers, failed);
+        }
+        break;
+    default:
+        *num_buffers += 2;
+        break;
+    }
+}
+
+static void arrow_layout_column (arrow_layout_t *l, const arrow_column_t *c) {
+    unsigned int i;
+
+    l->nodes[2 * l->num_nodes] = c->length;
+    l->nodes[2 * l->num_nodes + 1] = c->null_count;
+    l->num_nodes++;
+    arrow_layout_buffer(l, c->null_count ? (c->length + 7) / 8 : 0);
+    switch (c->field->type) {
+    case arrow_utf8:
+        arrow_layout_buffer(l, (c->length + 1) * sizeof(int32_t));
+        arrow_layout_buffer(l, c->data_len);
+        break;
+    case arrow_list:
+        arrow_layout_buffer(l, (c->length + 1) * sizeof(int32_t));
+        arrow_layout_column(l, &c->children[0]);
+        break;
+    case arrow_struct:
+        for (i = 0; i < c->field->num_children; i++) {
+            arrow_layout_column(l, &c->children[i]);
+        }
+        break;
+    default:
+        arrow_layout_buffer(l, c->data_len);
+        break;
+    }
+}
+
+static void arrow_write_padded (zfile f, const void *data, size_t len) {
+    static const char zero[8] = { 0 };
+
+    if (len) {
+        zwrite(f, data, len);
+        zwrite(f, zero, arrow_pad8(len) - len);
+    }
+}
+
+/* writes the buffers of c, in the order of arrow_layout_column() */
+static void arrow_write_column (zfile f, const arrow_column_t *c) {
+    unsigned int i;
+
+    if (c->null_count) {
+        arrow_write_padded(f, c->valid, (c->length + 7) / 8);
+    }
+    switch (c->field->type) {
+    case arrow_utf8:
+        arrow_write_padded(f, c->offsets, (c->length + 1) * sizeof(int32_t));
+        arrow_write_padded(f, c->data, c->data_len);
+        break;
+    case arrow_list:
+        arrow_write_padded(f, c->offsets, (c->length + 1) * sizeof(int32_t));
+        arrow_write_column(f, &c->children[0]);
+        break;
+    case arrow_struct:
+        for (i = 0; i < c->field->num_children; i++) {
+            arrow_write_column(f, &c->children[i]);
+        }
+        break;
+    default:
+        arrow_write_padded(f, c->data, c->data_len);
+        break;
+    }
+}
+
+/* writes an encapsulated message: marker, length, metadata, padding */
+static void arrow_write_message (zfile f, const fb_builder_t *b) {
+    static const char zero[8] = { 0 };
+    uint32_t marker = 0xffffffff;
+    uint32_t len = (uint32_t)arrow_pad8(b->used);
+    unsigned char prefix[8];
+    unsigned int i;
+
+    for (i = 0; i < 4; i++) {
+        prefix[i] = (unsigned char)(marker >> (8 * i));
+        prefix[4 + i] = (unsigned char)(len >> (8 * i));
+    }
+    zwrite(f, prefix, sizeof(prefix));
+    zwrite(f, fb_data(b), b->used);
+    zwrite(f, zero, len - b->used);
+}
+
+/**
+ * \fn int arrow_batch_write (arrow_batch_t *b, zfile f)
+ * \brief Write the rows of \p b to \p f as a record batch, and empty \p b.
+ *
+ * If \p f has started a new file (it was just opened, or rotated)
+ * since the last batch, the schema is written first.  Nothing is
+ * written for an empty batch.  \p f is marked binary (zbinary()), as
+ * dropping output up to a newline, as an asynchronous zfile that falls
+ * behind does, would corrupt the stream.
+ *
+ * \param b batch
+ * \param f output file
+ * \return ok, or failure if a value could not be stored, in which
+ *         case the rows are dropped
+ */
+int arrow_batch_write (arrow_batch_t *b, zfile f) {
+    const arrow_column_t *root = &b->root;
+    fb_builder_t fb;
+    arrow_layout_t l;
+    size_t nodes, buffers, header;
+    unsigned int i;
+    int failed = 0;
+    int rc = ok;
+
+    if (root->length == 0) {
+        return ok;
+    }
+    zbinary(f);
+    memset(&fb, 0, sizeof(fb));
+    memset(&l, 0, sizeof(l));
+
+    /* the root is not a column of its own */
+    for (i = 0; i < root->field->num_children; i++) {
+        arrow_layout_count(&root->children[i], root->length, &l.num_nodes, &l.num_buffers, &failed);
+    }
+    l.nodes = malloc(2 * l.num_nodes * sizeof(int64_t));
+    l.buffers = malloc(2 * l.num_buffers * sizeof(int64_t));
+    if (failed || root->failed || l.nodes == NULL || l.buffers == NULL) {
+        joy_log_err("could not build an arrow record batch of %lu rows", (unsigned long)root->length);
+        rc = failure;
+        goto done;
+    }
+    l.num_nodes = l.num_buffers = 0;
+    for (i = 0; i < root->field->num_children; i++) {
+        arrow_layout_column(&l, &root->children[i]);
+    }
+
+    if (b->file_id != f->id) {
+        fb_reset(&fb);
+        arrow_fb_schema_message(&fb, root->field);
+        if (fb.failed) {
+            rc = failure;
+            goto done;
+        }
+        arrow_write_message(f, &fb);
+        b->file_id = f->id;
+    }
+
+    fb_reset(&fb);
+    buffers = fb_pair_vector(&fb, l.buffers, l.num_buffers);
+    nodes = fb_pair_vector(&fb, l.nodes, l.num_nodes);
+    fb_start_table(&fb);
+    fb_add_scalar(&fb, 0, root->length, 8);
+    fb_add_ref(&fb, 1, nodes);
+    fb_add_ref(&fb, 2, buffers);
+    header = fb_end_table(&fb);
+    arrow_fb_message(&fb, arrow_fb_record_batch, header, l.body_len);
+    if (fb.failed) {
+        rc = failure;
+        goto done;
+    }
+    arrow_write_message(f, &fb);
+    for (i = 0; i < root->field->num_children; i++) {
+        arrow_write_column(f, &root->children[i]);
+    }
+
+ done:
+    free(fb.buf);
+    free(l.nodes);
+    free(l.buffers);
+    arrow_batch_reset(b);
+    return rc;
+}
+
+/* reads a little-endian integer of len bytes */
+static uint64_t arrow_test_get (const unsigned char *p, size_t len) {
+    uint64_t value = 0;
+
+    while (len--) {
+        value = (value << 8) | p[len];
+    }
+    return value;
+}
+
+/* the position of field id of the table at pos, or 0 if it is absent */
+static size_t arrow_test_field (const unsigned char *fb, size_t pos, unsigned int id) {
+    size_t vtable = pos - (int32_t)arrow_test_get(fb + pos, 4);
+
+    if (4 + 2 * id >= arrow_test_get(fb + vtable, 2)) {
+        return 0;
+    }
+    id = (unsigned int)arrow_test_get(fb + vtable + 4 + 2 * id, 2);
+    return id ? pos + id : 0;
+}
+
+/*
+ * checks the message at the start of data: its header type, the number
+ * of rows of a record batch, and the length of its body; returns the
+ * length of the message, or 0 if it is not as expected
+ */
+static size_t arrow_test_message (const unsigned char *data, size_t len,
+                                  unsigned int header_type, uint64_t rows) {
+    const unsigned char *fb = data + 8;
+    size_t msg, pos, header, meta_len, body_len = 0;
+
+    if (len < 8 || arrow_test_get(data, 4) != 0xffffffff) {
+        return 0;
+    }
+    meta_len = (size_t)arrow_test_get(data + 4, 4);
+    if (meta_len % 8 || 8 + meta_len > len) {
+        return 0;
+    }
+    msg = (size_t)arrow_test_get(fb, 4);
+    pos = arrow_test_field(fb, msg, 1);
+    if (pos == 0 || fb[pos] != header_type) {
+        return 0;
+    }
+    pos = arrow_test_field(fb, msg, 3);
+    if (pos) {
+        body_len = (size_t)arrow_test_get(fb + pos, 8);
+    }
+    if (header_type == arrow_fb_record_batch) {
+        pos = arrow_test_field(fb, msg, 2);
+        header = pos + (size_t)arrow_test_get(fb + pos, 4);
+        pos = arrow_test_field(fb, header, 0);
+        if (pos == 0 || arrow_test_get(fb + pos, 8) != rows) {
+            return 0;
+        }
+    }
+    if (8 + meta_len + body_len > len) {
+        return 0;
+    }
+    return 8 + meta_len + body_len;
+}
+
+static const arrow_field_t arrow_test_item = { "item", arrow_uint16, 0, NULL };
+
+static const arrow_field_t arrow_test_members[] = {
+    { "ttl", arrow_uint8, 0, NULL },
+    { "id", arrow_list, 1, &arrow_test_item }
+};
+
+static const arrow_field_t arrow_test_columns[] = {
+    { "sa", arrow_utf8, 0, NULL },
+    { "bytes", arrow_uint64, 0, NULL },
+    { "time", arrow_timestamp, 0, NULL },
+    { "entropy", arrow_float64, 0, NULL },
+    { "ip", arrow_struct, 2, arrow_test_members }
+};
+
+static const arrow_field_t arrow_test_schema = { "flow", arrow_struct, 5, arrow_test_columns };
+
+static void arrow_test_row (arrow_batch_t *b, unsigned int i) {
+    struct timeval ts;
+    arrow_column_t *ip = arrow_column(b, 4);
+
+    ts.tv_sec = 1514764800 + i;
+    ts.tv_usec = i;
+    arrow_append_string(arrow_column(b, 0), "10.0.0.1", 8);
+    arrow_append_uint(arrow_column(b, 1), 1000 * i);
+    arrow_append_timeval(arrow_column(b, 2), &ts);
+    if (i % 2) {
+        arrow_append_double(arrow_column(b, 3), 7.5);
+        arrow_append_uint(&ip->children[0], 64);
+        arrow_append_uint(&ip->children[1].children[0], i);
+        arrow_append_uint(&ip->children[1].children[0], i + 1);
+        arrow_end_list(&ip->children[1]);
+        arrow_end_struct(ip);
+    } else {
+        arrow_append_null(arrow_column(b, 3));
+        arrow_append_null(ip);
+    }
+    arrow_end_struct(&b->root);
+}
+
+/**
+ * \fn void arrow_unit_test (void)
+ * \brief Writes record batches to a buffer and checks their messages.
+ * \return none
+ */
+void arrow_unit_test (void) {
+    arrow_batch_t *b;
+    arrow_column_t *c;
+    FILE *fp;
+    zfile f;
+    size_t len, n;
+    unsigned int i;
+    int num_fails = 0;
+
+    fprintf(info, "\n******************************\n");
+    fprintf(info, "Arrow Output Unit Test starting...\n");
+
+    b = arrow_batch_new(&arrow_test_schema);
+    fp = tmpfile();
+    if (b == NULL || fp == NULL || (f = zattach(fp, "w")) == NULL) {
+        fprintf(info, "Finished - could not start\n");
+        arrow_batch_free(b);
+        if (fp != NULL) {
+            fclose(fp);
+        }
+        return;
+    }
+
+    /* the first batch in a file comes with the schema */
+    for (i = 0; i < 10; i++) {
+        arrow_test_row(b, i);
+    }
+    if (arrow_batch_write(b, f) != ok || arrow_batch_rows(b) != 0 || !f->binary) {
+        joy_log_err("could not write the first batch");
+        num_fails++;
+    }
+    len = f->len;
+    n = arrow_test_message((unsigned char *)f->buf, len, arrow_fb_schema, 0);
+    if (n == 0 || arrow_test_message((unsigned char *)f->buf + n, len - n,
+                                     arrow_fb_record_batch, 10) != len - n) {
+        joy_log_err("schema and first batch not as expected");
+        num_fails++;
+    }
+
+    /* the next one does not */
+    for (i = 0; i < 3; i++) {
+        arrow_test_row(b, i);
+    }
+    arrow_batch_write(b, f);
+    if (arrow_test_message((unsigned char *)f->buf + len, f->len - len,
+                           arrow_fb_record_batch, 3) != f->len - len) {
+        joy_log_err("second batch not as expected");
+        num_fails++;
+    }
+
+    /* a row missing a value is refused */
+    arrow_test_row(b, 0);
+    arrow_append_uint(arrow_column(b, 1), 1);
+    arrow_end_struct(&b->root);
+    len = f->len;
+    if (arrow_batch_write(b, f) == ok || f->len != len || arrow_batch_rows(b) != 0) {
+        joy_log_err("incomplete batch was written");
+        num_fails++;
+    }
+
+    /* JSON members are written as an object, and none as a null */
+    c = arrow_column(b, 0);
+    arrow_append_json_members(c, ",\"a\":1,\"b\":2", 12);
+    arrow_append_json_members(c, "\"c\":3,", 6);
+    arrow_append_json_members(c, ",", 1);
+    if (c->length != 3 || c->null_count != 1 || c->data_len != 20 ||
+        memcmp(c->data, "{\"a\":1,\"b\":2}{\"c\":3}", 20) != 0) {
+        joy_log_err("JSON members not written as expected");
+        num_fails++;
+    }
+    arrow_batch_reset(b);
+
+    zclose(f);
+    arrow_batch_free(b);
+
+    if (num_fails) {
+        fprintf(info, "Finished - failures: %d\n", num_fails);
+    } else {
+        fprintf(info, "Finished - success\n");
+    }
+    fprintf(info, "******************************\n\n");
+}
@@ -0,0 +1,1102 @@
+/*
+ *
+ * Copyright (c) 2018 Cisco Systems, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ *
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file cbor_output.c
+ *
+ * \brief Compact binary output of flow records, as CBOR (RFC 8949)
+ *
+ * The writers append to a zfile, like the JSON formatters in
+ * output.c; the reader and cbor_to_json() are used by joy-convert to
+ * turn the records back into JSON.  Nothing here depends on the rest
+ * of joy, so that joy-convert can be built from output.c and this
+ * file alone.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cbor_output.h"
+
+#ifdef WIN32
+#include "ws2tcpip.h"
+#else
+#include <arpa/inet.h>
+#endif
+
+/* deepest nesting of arrays, maps and tags that is accepted */
+#define CBOR_MAX_DEPTH 16
+
+/**
+ * \fn void cbor_put_double (zfile f, double value)
+ * \brief Append a double, as a float64, to \p f.
+ * \param f output file
+ * \param value the value
+ * \return none
+ */
+void cbor_put_double (zfile f, double value) {
+    unsigned char *p = (unsigned char *)zreserve(f, 9);
+    uint64_t bits;
+    int i;
+
+    memcpy(&bits, &value, sizeof(bits));
+    p[0] = (CBOR_SIMPLE << 5) | 27;
+    for (i = 8; i > 0; i--) {
+        p[i] = (unsigned char)bits;
+        bits >>= 8;
+    }
+    f->len += 9;
+}
+
+/**
+ * \fn void cbor_put_text (zfile f, const char *s, size_t len)
+ * \brief Append a text string to \p f.
+ * \param f output file
+ * \param s the text, which should be UTF-8
+ * \param len its length in bytes
+ * \return none
+ */
+void cbor_put_text (zfile f, const char *s, size_t len) {
+    cbor_put_head(f, CBOR_TEXT, len);
+    zwrite(f, s, len);
+}
+
+/**
+ * \fn void cbor_put_bytes (zfile f, const unsigned char *data, size_t len)
+ * \brief Append a byte string to \p f.
+ * \param f output file
+ * \param data the bytes
+ * \param len the number of bytes
+ * \return none
+ */
+void cbor_put_bytes (zfile f, const unsigned char *data, size_t len) {
+    cbor_put_head(f, CBOR_BYTES, len);
+    zwrite(f, data, len);
+}
+
+/*
+ * Reading
+ */
+
+/**
+ * \fn void cbor_reader_init (cbor_reader_t *r, const void *data, size_t len)
+ * \brief Start reading the CBOR in \p data.
+ * \param r reader
+ * \param data the input
+ * \param len its length
+ * \return none
+ */
+void cbor_reader_init (cbor_reader_t *r, const void *data, size_t len) {
+    r->p = data;
+    r->end = r->p + len;
+    r->failed = 0;
+}
+
+static int cbor_fail (cbor_reader_t *r, int failed) {
+    if (!r->failed) {
+        r->failed = failed;
+    }
+    return -1;
+}
+
+/**
+ * \fn int cbor_get_head (cbor_reader_t *r, unsigned int *major, uint64_t *value)
+ * \brief Read the head of the next item.
+ * \param r reader
+ * \param major set to the major type
+ * \param value set to the integer value or length, or for major type
+ *        7 to the simple value or the bits of the float; 0 for an
+ *        indefinite length
+ * \return the additional information (CBOR_INDEFINITE for an
+ *         indefinite length or a break), or -1 on failure
+ */
+int cbor_get_head (cbor_reader_t *r, unsigned int *major, uint64_t *value) {
+    unsigned int info, n, i;
+
+    if (r->failed) {
+        return -1;
+    }
+    if (r->p >= r->end) {
+        return cbor_fail(r, CBOR_TRUNCATED);
+    }
+    *major = *r->p >> 5;
+    info = *r->p & 0x1f;
+    r->p++;
+    if (info < 24) {
+        *value = info;
+        return info;
+    }
+    if (info == CBOR_INDEFINITE) {
+        if (*major == CBOR_UINT || *major == CBOR_NINT || *major == CBOR_TAG) {
+            return cbor_fail(r, CBOR_INVALID);
+        }
+        *value = 0;
+        return info;
+    }
+    if (info > 27) {
+        return cbor_fail(r, CBOR_INVALID);
+    }
+    n = 1 << (info - 24);
+    if ((size_t)(r->end - r->p) < n) {
+        return cbor_fail(r, CBOR_TRUNCATED);
+    }
+    *value = 0;
+    for (i = 0; i < n; i++) {
+        *value = (*value << 8) | r->p[i];
+    }
+    r->p += n;
+    return info;
+}
+
+/**
+ * \fn int cbor_get_uint (cbor_reader_t *r, uint64_t *value)
+ * \brief Read an unsigned integer.
+ * \param r reader
+ * \param value set to the integer
+ * \return 0 on success, -1 if the next item is not an unsigned integer
+ */
+int cbor_get_uint (cbor_reader_t *r, uint64_t *value) {
+    unsigned int major;
+
+    if (cbor_get_head(r, &major, value) < 0) {
+        return -1;
+    }
+    return major == CBOR_UINT ? 0 : cbor_fail(r, CBOR_INVALID);
+}
+
+/**
+ * \fn int cbor_get_double (cbor_reader_t *r, double *value)
+ * \brief Read a float64 or float32.
+ * \param r reader
+ * \param value set to the value
+ * \return 0 on success, -1 if the next item is not such a float
+ */
+int cbor_get_double (cbor_reader_t *r, double *value) {
+    unsigned int major;
+    uint64_t bits;
+    int info;
+
+    info = cbor_get_head(r, &major, &bits);
+    if (info < 0) {
+        return -1;
+    }
+    if (major == CBOR_SIMPLE && info == 27) {
+        memcpy(value, &bits, sizeof(*value));
+    } else if (major == CBOR_SIMPLE && info == 26) {
+        uint32_t b = (uint32_t)bits;
+        float tmp;
+
+        memcpy(&tmp, &b, sizeof(tmp));
+        *value = tmp;
+    } else {
+        return cbor_fail(r, CBOR_INVALID);
+    }
+    return 0;
+}
+
+/**
+ * \fn int cbor_get_string (cbor_reader_t *r, unsigned int major, const char **s, size_t *len)
+ * \brief Read a byte or text string of definite length.
+ * \param r reader
+ * \param major CBOR_BYTES or CBOR_TEXT
+ * \param s set to the string, which is not NULL-terminated
+ * \param len set to its length
+ * \return 0 on success, -1 if the next item is not such a string
+ */
+int cbor_get_string (cbor_reader_t *r, unsigned int major, const char **s, size_t *len) {
+    unsigned int m;
+    uint64_t n;
+    int info;
+
+    info = cbor_get_head(r, &m, &n);
+    if (info < 0) {
+        return -1;
+    }
+    if (m != major || info == CBOR_INDEFINITE) {
+        return cbor_fail(r, CBOR_INVALID);
+    }
+    if ((uint64_t)(r->end - r->p) < n) {
+        return cbor_fail(r, CBOR_TRUNCATED);
+    }
+    *s = (const char *)r->p;
+    *len = (size_t)n;
+    r->p += n;
+    return 0;
+}
+
+/* true if the next byte is a break */
+static int cbor_at_break (const cbor_reader_t *r) {
+    return r->p < r->end && *r->p == 0xff;
+}
+
+static int cbor_skip_depth (cbor_reader_t *r, unsigned int depth) {
+    unsigned int major;
+    uint64_t value, i;
+    const char *s;
+    size_t len;
+    int info;
+
+    if (depth > CBOR_MAX_DEPTH) {
+        return cbor_fail(r, CBOR_INVALID);
+    }
+    info = cbor_get_head(r, &major, &value);
+    if (info < 0) {
+        return -1;
+    }
+    switch (major) {
+    case CBOR_BYTES:
+    case CBOR_TEXT:
+        if (info != CBOR_INDEFINITE) {
+            if ((uint64_t)(r->end - r->p) < value) {
+                return cbor_fail(r, CBOR_TRUNCATED);
+            }
+            r->p += value;
+            return 0;
+        }
+        /* chunks, each a definite string of the same type */
+        while (!cbor_at_break(r)) {
+            if (cbor_get_string(r, major, &s, &len) != 0) {
+                return -1;
+            }
+        }
+        break;
+    case CBOR_ARRAY:
+    case CBOR_MAP:
+        if (info != CBOR_INDEFINITE) {
+            if (major == CBOR_MAP) {
+                value *= 2;
+            }
+            for (i = 0; i < value; i++) {
+                if (cbor_skip_depth(r, depth + 1) != 0) {
+                    return -1;
+                }
+            }
+            return 0;
+        }
+        while (!cbor_at_break(r)) {
+            if (cbor_skip_depth(r, depth + 1) != 0 ||
+                (major == CBOR_MAP && cbor_skip_depth(r, depth + 1) != 0)) {
+                return -1;
+            }
+        }
+        break;
+    case CBOR_TAG:
+        return cbor_skip_depth(r, depth + 1);
+    case CBOR_SIMPLE:
+        if (info == CBOR_INDEFINITE) {
+            /* a break outside of an indefinite length item */
+            return cbor_fail(r, CBOR_INVALID);
+        }
+        return 0;
+    default:
+        return 0;
+    }
+
+    /* the break that ends an indefinite length item */
+    if (r->p >= r->end) {
+        return cbor_fail(r, CBOR_TRUNCATED);
+    }
+    r->p++;
+    return 0;
+}
+
+/**
+ * \fn int cbor_skip (cbor_reader_t *r)
+ * \brief Skip over the next item, with everything inside it.
+ * \param r reader
+ * \return 0 on success, -1 on failure
+ */
+int cbor_skip (cbor_reader_t *r) {
+    return cbor_skip_depth(r, 0);
+}
+
+/**
+ * \fn long cbor_item_size (const void *data, size_t len)
+ * \brief Find out how long the item at the start of \p data is.
+ * \param data the input
+ * \param len its length
+ * \return the length of the item, 0 if it does not end within \p len
+ *         bytes, or -1 if it is not well-formed
+ */
+long cbor_item_size (const void *data, size_t len) {
+    cbor_reader_t r;
+
+    cbor_reader_init(&r, data, len);
+    if (cbor_skip(&r) != 0) {
+        return r.failed == CBOR_TRUNCATED ? 0 : -1;
+    }
+    return (long)(r.p - (const unsigned char *)data);
+}
+
+/*
+ * Conversion to JSON
+ */
+
+/* where each field of a flow record is, NULL if absent */
+typedef struct cbor_flow_ {
+    const unsigned char *at[cbor_flow_max];
+    const unsigned char *end;
+    int failed;
+} cbor_flow_t;
+
+/* positions r at the value of key, if the record has one */
+static int cbor_flow_get (cbor_flow_t *flow, cbor_flow_key_e key, cbor_reader_t *r) {
+    if (flow->at[key] == NULL) {
+        return 0;
+    }
+    r->p = flow->at[key];
+    r->end = flow->end;
+    r->failed = 0;
+    return 1;
+}
+
+static void cbor_json_uint (cbor_flow_t *flow, cbor_flow_key_e key, const char *name, zfile out) {
+    cbor_reader_t r;
+    uint64_t value;
+
+    if (cbor_flow_get(flow, key, &r)) {
+        if (cbor_get_uint(&r, &value) != 0) {
+            flow->failed = 1;
+            return;
+        }
+        zputs(out, name);
+        zprint_uint(out, value);
+    }
+}
+
+static void cbor_json_double (cbor_flow_t *flow, cbor_flow_key_e key, const char *name, zfile out) {
+    cbor_reader_t r;
+    double value;
+
+    if (cbor_flow_get(flow, key, &r)) {
+        if (cbor_get_double(&r, &value) != 0) {
+            flow->failed = 1;
+            return;
+        }
+        zprintf(out, "%s%f", name, value);
+    }
+}
+
+/* JSON text that is carried verbatim */
+static void cbor_json_text (cbor_flow_t *flow, cbor_flow_key_e key, zfile out) {
+    cbor_reader_t r;
+    const char *s;
+    size_t len;
+
+    if (cbor_flow_get(flow, key, &r)) {
+        if (cbor_get_string(&r, CBOR_TEXT, &s, &len) != 0) {
+            flow->failed = 1;
+            return;
+        }
+        zwrite(out, s, len);
+    }
+}
+
+/* a value written by an emitter: maps, arrays, strings and integers */
+static int cbor_json_value (cbor_reader_t *r, zfile out, unsigned int depth) {
+    unsigned int major;
+    uint64_t value, i;
+    const char *s;
+    size_t len;
+    int info;
+
+    if (depth > CBOR_MAX_DEPTH) {
+        return cbor_fail(r, CBOR_INVALID);
+    }
+    if (r->p < r->end && ((*r->p >> 5) == CBOR_TEXT || (*r->p >> 5) == CBOR_BYTES)) {
+        major = *r->p >> 5;
+        if (cbor_get_string(r, major, &s, &len) != 0) {
+            return -1;
+        }
+        zputc(out, '"');
+        if (major == CBOR_TEXT) {
+            zwrite(out, s, len);
+        } else {
+            zprint_hex(out, (const unsigned char *)s, len);
+        }
+        zputc(out, '"');
+        return 0;
+    }
+    info = cbor_get_head(r, &major, &value);
+    if (info < 0) {
+        return -1;
+    }
+    switch (major) {
+    case CBOR_UINT:
+        zprint_uint(out, value);
+        return 0;
+    case CBOR_NINT:
+        if (value > INT64_MAX) {
+            return cbor_fail(r, CBOR_INVALID);
+        }
+        zprint_int(out, -(int64_t)value - 1);
+        return 0;
+    case CBOR_ARRAY:
+    case CBOR_MAP:
+        zputc(out, major == CBOR_MAP ? '{' : '[');
+        for (i = 0; info == CBOR_INDEFINITE ? !cbor_at_break(r) : i < value; i++) {
+            if (i) {
+                zputc(out, ',');
+            }
+            if (major == CBOR_MAP) {
+                if (cbor_get_string(r, CBOR_TEXT, &s, &len) != 0) {
+                    return -1;
+                }
+                zputc(out, '"');
+                zwrite(out, s, len);
+                zwrite(out, "\":", 2);
+            }
+            if (cbor_json_value(r, out, depth + 1) != 0) {
+                return -1;
+            }
+        }
+        if (info == CBOR_INDEFINITE) {
+            if (r->p >= r->end) {
+                return cbor_fail(r, CBOR_TRUNCATED);
+            }
+            r->p++;
+        }
+        zputc(out, major == CBOR_MAP ? '}' : ']');
+        return 0;
+    default:
+        return cbor_fail(r, CBOR_INVALID);
+    }
+}
+
+/* a map of members of the flow object, each written with a comma before it */
+static int cbor_json_members (cbor_reader_t *r, zfile out) {
+    unsigned int major;
+    uint64_t n, i;
+    const char *s;
+    size_t len;
+    int info;
+
+    info = cbor_get_head(r, &major, &n);
+    if (info < 0 || major != CBOR_MAP) {
+        return -1;
+    }
+    for (i = 0; info == CBOR_INDEFINITE ? !cbor_at_break(r) : i < n; i++) {
+        if (cbor_get_string(r, CBOR_TEXT, &s, &len) != 0) {
+            return -1;
+        }
+        zwrite(out, ",\"", 2);
+        zwrite(out, s, len);
+        zwrite(out, "\":", 2);
+        if (cbor_json_value(r, out, 1) != 0) {
+            return -1;
+        }
+    }
+    if (info == CBOR_INDEFINITE) {
+        if (r->p >= r->end) {
+            return cbor_fail(r, CBOR_TRUNCATED);
+        }
+        r->p++;
+    }
+    return 0;
+}
+
+/*
+ * the members of the flow object written by an emitter: an array of
+ * maps of members and of JSON text, or JSON text alone (version 1)
+ */
+static void cbor_json_parts (cbor_flow_t *flow, cbor_flow_key_e key, zfile out) {
+    cbor_reader_t r;
+    unsigned int major;
+    uint64_t n, i;
+    int info;
+
+    if (!cbor_flow_get(flow, key, &r)) {
+        return;
+    }
+    if (r.p < r.end && (*r.p >> 5) == CBOR_TEXT) {
+        cbor_json_text(flow, key, out);
+        return;
+    }
+    info = cbor_get_head(&r, &major, &n);
+    if (info < 0 || major != CBOR_ARRAY) {
+        flow->failed = 1;
+        return;
+    }
+    for (i = 0; info == CBOR_INDEFINITE ? !cbor_at_break(&r) : i < n; i++) {
+        if (r.p < r.end && (*r.p >> 5) == CBOR_TEXT) {
+            const char *s;
+            size_t len;
+
+            if (cbor_get_string(&r, CBOR_TEXT, &s, &len) != 0) {
+                flow->failed = 1;
+                return;
+            }
+            zwrite(out, s, len);
+            continue;
+        }
+        /* a map of members, each preceded by a comma */
+        if (cbor_json_members(&r, out) != 0) {
+            flow->failed = 1;
+            return;
+        }
+    }
+}
+
+static void cbor_json_addr (cbor_flow_t *flow, cbor_flow_key_e key, const char *name, zfile out) {
+    cbor_reader_t r;
+    struct in_addr addr;
+    uint64_t value;
+    const char *s;
+    size_t len;
+
+    zputs(out, name);
+    zputc(out, '"');
+    if (!cbor_flow_get(flow, key, &r)) {
+        flow->failed = 1;
+    } else if (r.p < r.end && (*r.p >> 5) == CBOR_TEXT) {
+        if (cbor_get_string(&r, CBOR_TEXT, &s, &len) != 0) {
+            flow->failed = 1;
+        } else {
+            zwrite(out, s, len);
+        }
+    } else if (cbor_get_uint(&r, &value) != 0 || value > 0xffffffff) {
+        flow->failed = 1;
+    } else {
+        addr.s_addr = htonl((uint32_t)value);
+        zprint_ipv4(out, &addr);
+    }
+    zputc(out, '"');
+}
+
+static void cbor_json_time (cbor_flow_t *flow, cbor_flow_key_e key, const char *name, zfile out) {
+    cbor_reader_t r;
+    struct timeval ts;
+    unsigned int major;
+    uint64_t n, sec, usec;
+
+    if (!cbor_flow_get(flow, key, &r) ||
+        cbor_get_head(&r, &major, &n) < 0 || major != CBOR_ARRAY || n != 2 ||
+        cbor_get_uint(&r, &sec) != 0 || cbor_get_uint(&r, &usec) != 0) {
+        flow->failed = 1;
+        return;
+    }
+    ts.tv_sec = (time_t)sec;
+    ts.tv_usec = (long)usec;
+    zputs(out, name);
+    zprint_timeval(out, &ts);
+}
+
+/* an array of unsigned integers, or a byte string of small ones */
+static void cbor_json_values (cbor_reader_t *r, zfile out, int *failed) {
+    unsigned int major;
+    uint64_t n, i, value;
+    const char *s;
+    size_t len;
+    int info;
+
+    zputc(out, '[');
+    if (r->p < r->end && (*r->p >> 5) == CBOR_BYTES) {
+        if (cbor_get_string(r, CBOR_BYTES, &s, &len) != 0) {
+            *failed = 1;
+            len = 0;
+        }
+        for (i = 0; i < len; i++) {
+            if (i) {
+                zputc(out, ',');
+            }
+            zprint_uint(out, (unsigned char)s[i]);
+        }
+    } else {
+        info = cbor_get_head(r, &major, &n);
+        if (info < 0 || info == CBOR_INDEFINITE || major != CBOR_ARRAY) {
+            *failed = 1;
+            n = 0;
+        }
+        for (i = 0; i < n; i++) {
+            if (cbor_get_uint(r, &value) != 0) {
+                *failed = 1;
+                break;
+            }
+            if (i) {
+                zputc(out, ',');
+            }
+            zprint_uint(out, value);
+        }
+    }
+    zputc(out, ']');
+}
+
+static void cbor_json_byte_dist (cbor_flow_t *flow, cbor_flow_key_e key, const char *name, zfile out) {
+    cbor_reader_t r;
+
+    if (cbor_flow_get(flow, key, &r)) {
+        zputs(out, name);
+        cbor_json_values(&r, out, &flow->failed);
+    }
+}
+
+static void cbor_json_packets (cbor_flow_t *flow, zfile out) {
+    cbor_reader_t r;
+    unsigned int major;
+    uint64_t n = 0, i, len, dir, ipt;
+    int info;
+
+    zputs(out, ",\"packets\":[");
+    if (cbor_flow_get(flow, cbor_flow_packets, &r)) {
+        info = cbor_get_head(&r, &major, &n);
+        if (info < 0 || info == CBOR_INDEFINITE || major != CBOR_ARRAY || n % 3) {
+            flow->failed = 1;
+            n = 0;
+        }
+    }
+    for (i = 0; i < n; i += 3) {
+        if (cbor_get_uint(&r, &len) != 0 || cbor_get_uint(&r, &dir) != 0 ||
+            cbor_get_uint(&r, &ipt) != 0 || len > 0xffff) {
+            flow->failed = 1;
+            break;
+        }
+        if (i) {
+            zputc(out, ',');
+        }
+        if (len < 32768) {
+            zputs(out, "{\"b\":");
+            zprint_uint(out, len);
+        } else {
+            zputs(out, "{\"rep\":");
+            zprint_uint(out, 65536 - len);
+        }
+        zputs(out, dir ? ",\"dir\":\">\",\"ipt\":" : ",\"dir\":\"<\",\"ipt\":");
+        zprint_uint(out, ipt);
+        zputc(out, '}');
+    }
+    zputc(out, ']');
+}
+
+/* the ttl and ids of one direction */
+static void cbor_json_ip_dir (cbor_reader_t *r, const char *name, zfile out, int *failed) {
+    unsigned int major;
+    uint64_t ttl, n;
+
+    if (cbor_get_uint(r, &ttl) != 0) {
+        *failed = 1;
+        return;
+    }
+    zputs(out, name);
+    zprint_uint(out, ttl);
+    if (r->p < r->end && *r->p == ((CBOR_ARRAY << 5) | 0)) {
+        /* no ids */
+        cbor_get_head(r, &major, &n);
+    } else {
+        zputs(out, ",\"id\":");
+        cbor_json_values(r, out, failed);
+    }
+    zputc(out, '}');
+}
+
+static void cbor_json_ip (cbor_flow_t *flow, zfile out) {
+    cbor_reader_t r;
+    unsigned int major;
+    uint64_t n;
+    int info;
+
+    if (!cbor_flow_get(flow, cbor_flow_ip, &r)) {
+        flow->failed = 1;
+        return;
+    }
+    info = cbor_get_head(&r, &major, &n);
+    if (info < 0 || major != CBOR_ARRAY || (n != 2 && n != 4)) {
+        flow->failed = 1;
+        return;
+    }
+    zputs(out, ",\"ip\":{");
+    cbor_json_ip_dir(&r, "\"out\":{\"ttl\":", out, &flow->failed);
+    if (n == 4) {
+        cbor_json_ip_dir(&r, ",\"in\":{\"ttl\":", out, &flow->failed);
+    }
+    zputc(out, '}');
+}
+
+/* a flow record map, read by r, in the format of flow_record_print_json() */
+static int cbor_flow_to_json (cbor_reader_t *r, unsigned int info, uint64_t num_pairs, zfile out) {
+    cbor_flow_t flow;
+    uint64_t key, version = 0, i;
+    cbor_reader_t v;
+
+    memset(&flow, 0, sizeof(flow));
+    flow.end = r->end;
+    for (i = 0; info == CBOR_INDEFINITE ? !cbor_at_break(r) : i < num_pairs; i++) {
+        if (cbor_get_uint(r, &key) != 0) {
+            return -1;
+        }
+        if (key < cbor_flow_max) {
+            flow.at[key] = r->p;
+        }
+        /* fields unknown to this version are skipped */
+        if (cbor_skip(r) != 0) {
+            return -1;
+        }
+    }
+    if (!cbor_flow_get(&flow, cbor_flow_version, &v) || cbor_get_uint(&v, &version) != 0 ||
+        version == 0 || version > CBOR_FLOW_VERSION) {
+        return -1;
+    }
+
+    zputc(out, '{');
+    cbor_json_addr(&flow, cbor_flow_sa, "\"sa\":", out);
+    cbor_json_addr(&flow, cbor_flow_da, ",\"da\":", out);
+    cbor_json_uint(&flow, cbor_flow_pr, ",\"pr\":", out);
+    if (flow.at[cbor_flow_sp] != NULL) {
+        cbor_json_uint(&flow, cbor_flow_sp, ",\"sp\":", out);
+        cbor_json_uint(&flow, cbor_flow_dp, ",\"dp\":", out);
+        zputc(out, ',');
+    } else {
+        zputs(out, ",\"sp\":null,\"dp\":null,");
+    }
+    cbor_json_text(&flow, cbor_flow_labels, out);
+    cbor_json_uint(&flow, cbor_flow_bytes_out, "\"bytes_out\":", out);
+    cbor_json_uint(&flow, cbor_flow_num_pkts_out, ",\"num_pkts_out\":", out);
+    cbor_json_uint(&flow, cbor_flow_bytes_in, ",\"bytes_in\":", out);
+    cbor_json_uint(&flow, cbor_flow_num_pkts_in, ",\"num_pkts_in\":", out);
+    cbor_json_time(&flow, cbor_flow_time_start, ",\"time_start\":", out);
+    cbor_json_time(&flow, cbor_flow_time_end, ",\"time_end\":", out);
+    cbor_json_uint(&flow, cbor_flow_sample_rate, ",\"sample_rate\":", out);
+    cbor_json_packets(&flow, out);
+    cbor_json_byte_dist(&flow, cbor_flow_byte_dist, ",\"byte_dist\":", out);
+    cbor_json_double(&flow, cbor_flow_byte_dist_mean, ",\"byte_dist_mean\":", out);
+    cbor_json_double(&flow, cbor_flow_byte_dist_std, ",\"byte_dist_std\":", out);
+    cbor_json_byte_dist(&flow, cbor_flow_compact_byte_dist, ",\"compact_byte_dist\":", out);
+    cbor_json_double(&flow, cbor_flow_entropy, ",\"entropy\":", out);
+    cbor_json_double(&flow, cbor_flow_total_entropy, ",\"total_entropy\":", out);
+    cbor_json_double(&flow, cbor_flow_p_malware, ",\"p_malware\":", out);
+    cbor_json_ip(&flow, out);
+    cbor_json_parts(&flow, cbor_flow_json, out);
+    if (cbor_flow_get(&flow, cbor_flow_expire_type, &v)) {
+        if (cbor_get_uint(&v, &key) != 0 || key > 0x7f) {
+            flow.failed = 1;
+        } else {
+            zprintf(out, ",\"expire_type\":\"%c\"", (char)key);
+        }
+    }
+    zputs(out, "}\n");
+
+    return flow.failed ? -1 : 0;
+}
+
+/**
+ * \fn int cbor_to_json (const void *data, size_t len, zfile out)
+ * \brief Write the record in \p data (one item, as found by
+ *        cbor_item_size()) to \p out as a line of JSON.
+ * \param data the item
+ * \param len its length
+ * \param out where the JSON goes
+ * \return 0 on success, -1 if the item is not a record; some of the
+ *         JSON may have been written even so
+ */
+int cbor_to_json (const void *data, size_t len, zfile out) {
+    const unsigned char *start;
+    cbor_reader_t r;
+    unsigned int major;
+    uint64_t value;
+    const char *s;
+    size_t n;
+    int info;
+
+    cbor_reader_init(&r, data, len);
+    do {
+        start = r.p;
+        info = cbor_get_head(&r, &major, &value);
+        if (info < 0) {
+            return -1;
+        }
+    } while (major == CBOR_TAG);
+
+    if (major == CBOR_TEXT) {
+        /* a line of JSON, kept as it was */
+        r.p = start;
+        if (cbor_get_string(&r, CBOR_TEXT, &s, &n) != 0) {
+            return -1;
+        }
+        zwrite(out, s, n);
+        return 0;
+    }
+    if (major != CBOR_MAP) {
+        return -1;
+    }
+    return cbor_flow_to_json(&r, info, value, out);
+}
+
+/*
+ * checks that the output of f is the JSON expected, then clears both
+ */
+static int cbor_test_expect (zfile f, zfile json, const char *expected, const char *what) {
+    const char *data, *text;
+    size_t len, text_len;
+    int rc = 0;
+
+    data = zmemory(f, &len);
+    if (data == NULL || cbor_item_size(data, len) != (long)len) {
+        fprintf(stderr, "cbor_unit_test: %s is not one item\n", what);
+        rc = 1;
+    } else if (cbor_to_json(data, len, json) != 0) {
+        fprintf(stderr, "cbor_unit_test: %s could not be converted\n", what);
+        rc = 1;
+    } else {
+        text = zmemory(json, &text_len);
+        if (text == NULL || text_len != strlen(expected) || memcmp(text, expected, text_len) != 0) {
+            fprintf(stderr, "cbor_unit_test: %s: got %.*s, expected %s\n",
+                    what, (int)text_len, text, expected);
+            rc = 1;
+        }
+    }
+    zmemory_clear(f);
+    zmemory_clear(json);
+    return rc;
+}
+
+/**
+ * \fn int cbor_unit_test (void)
+ * \brief check the writers against the reader, and the conversion of
+ *        records to JSON
+ * \return number of failures
+ */
+int cbor_unit_test (void) {
+    static const uint64_t values[] = {
+        0, 1, 23, 24, 255, 256, 65535, 65536, 4294967295U, 4294967296ULL,
+        18446744073709551615ULL
+    };
+    static const unsigned char heads[] = { 1, 1, 1, 2, 2, 3, 3, 5, 5, 9, 9 };
+    static const unsigned char bytes[] = { 0, 1, 255 };
+    static const unsigned char broken[] = { 0x1c };
+    const char *data, *s;
+    cbor_reader_t r;
+    uint64_t value;
+    double d;
+    size_t len, n;
+    unsigned int i;
+    int num_fails = 0;
+    zfile f, json;
+
+    f = zopen_memory();
+    json = zopen_memory();
+    if (f == NULL || json == NULL) {
+        fprintf(stderr, "cbor_unit_test: could not open a memory zfile\n");
+        if (f != NULL) {
+            zclose(f);
+        }
+        return 1;
+    }
+
+    /* each integer is written in the shortest form, and read back */
+    for (i = 0; i < sizeof(values)/sizeof(values[0]); i++) {
+        cbor_put_uint(f, values[i]);
+        data = zmemory(f, &len);
+        cbor_reader_init(&r, data, len);
+        if (len != heads[i] || cbor_get_uint(&r, &value) != 0 || value != values[i] ||
+            cbor_item_size(data, len - 1) != 0) {
+            fprintf(stderr, "cbor_unit_test: integer %llu took %u bytes\n",
+                    (unsigned long long)values[i], (unsigned int)len);
+            num_fails++;
+        }
+        zmemory_clear(f);
+    }
+
+    cbor_put_double(f, -1.5);
+    cbor_put_text(f, "joy", 3);
+    cbor_put_bytes(f, bytes, sizeof(bytes));
+    cbor_put_indefinite(f, CBOR_ARRAY);
+    cbor_put_simple(f, 22);
+    cbor_put_simple(f, CBOR_INDEFINITE);
+    data = zmemory(f, &len);
+    cbor_reader_init(&r, data, len);
+    if (cbor_get_double(&r, &d) != 0 || d != -1.5 ||
+        cbor_get_string(&r, CBOR_TEXT, &s, &n) != 0 || n != 3 || memcmp(s, "joy", 3) != 0 ||
+        cbor_get_string(&r, CBOR_BYTES, &s, &n) != 0 || n != 3 || memcmp(s, bytes, 3) != 0 ||
+        cbor_skip(&r) != 0 || r.p != r.end) {
+        fprintf(stderr, "cbor_unit_test: values were not read back\n");
+        num_fails++;
+    }
+    if (cbor_item_size(broken, sizeof(broken)) != -1) {
+        fprintf(stderr, "cbor_unit_test: malformed item was accepted\n");
+        num_fails++;
+    }
+    zmemory_clear(f);
+
+    /* a line of JSON */
+    cbor_put_head(f, CBOR_TAG, CBOR_SELF_DESCRIBE);
+    cbor_put_text(f, "{\"version\":\"test\"}\n", 19);
+    num_fails += cbor_test_expect(f, json, "{\"version\":\"test\"}\n", "JSON line");
+
+    /* a unidirectional ICMP flow */
+    cbor_put_head(f, CBOR_TAG, CBOR_SELF_DESCRIBE);
+    cbor_put_indefinite(f, CBOR_MAP);
+    cbor_put_uint(f, cbor_flow_version);
+    cbor_put_uint(f, CBOR_FLOW_VERSION);
+    cbor_put_uint(f, cbor_flow_sa);
+    cbor_put_uint(f, 0x0a000001);
+    cbor_put_uint(f, cbor_flow_da);
+    cbor_put_text(f, "a0b1", 4);
+    cbor_put_uint(f, cbor_flow_pr);
+    cbor_put_uint(f, 1);
+    cbor_put_uint(f, cbor_flow_bytes_out);
+    cbor_put_uint(f, 84);
+    cbor_put_uint(f, cbor_flow_num_pkts_out);
+    cbor_put_uint(f, 1);
+    cbor_put_uint(f, cbor_flow_time_start);
+    cbor_put_head(f, CBOR_ARRAY, 2);
+    cbor_put_uint(f, 1514764800);
+    cbor_put_uint(f, 42);
+    cbor_put_uint(f, cbor_flow_time_end);
+    cbor_put_head(f, CBOR_ARRAY, 2);
+    cbor_put_uint(f, 1514764800);
+    cbor_put_uint(f, 42);
+    cbor_put_uint(f, cbor_flow_packets);
+    cbor_put_head(f, CBOR_ARRAY, 0);
+    cbor_put_uint(f, cbor_flow_ip);
+    cbor_put_head(f, CBOR_ARRAY, 2);
+    cbor_put_uint(f, 64);
+    cbor_put_head(f, CBOR_ARRAY, 0);
+    cbor_put_uint(f, cbor_flow_json);
+    cbor_put_indefinite(f, CBOR_ARRAY);
+    cbor_put_text(f, ",\"ppi\":[]", 9);
+    cbor_put_indefinite(f, CBOR_MAP);
+    cbor_put_text(f, "dns", 3);
+    cbor_put_head(f, CBOR_ARRAY, 1);
+    cbor_put_head(f, CBOR_MAP, 3);
+    cbor_put_text(f, "rn", 2);
+    cbor_put_text(f, "joy", 3);
+    cbor_put_text(f, "malformed", 9);
+    cbor_put_head(f, CBOR_NINT, 0);
+    cbor_put_text(f, "id", 2);
+    cbor_put_bytes(f, bytes, sizeof(bytes));
+    cbor_put_text(f, "ttl", 3);
+    cbor_put_uint(f, 60);
+    cbor_put_simple(f, CBOR_INDEFINITE);
+    cbor_put_simple(f, CBOR_INDEFINITE);
+    cbor_put_uint(f, 99);          /* a field from a later version */
+    cbor_put_text(f, "ignored", 7);
+    cbor_put_simple(f, CBOR_INDEFINITE);
+    num_fails += cbor_test_expect(f, json,
+        "{\"sa\":\"10.0.0.1\",\"da\":\"a0b1\",\"pr\":1,\"sp\":null,\"dp\":null,"
+        "\"bytes_out\":84,\"num_pkts_out\":1,\"time_start\":1514764800.000042,"
+        "\"time_end\":1514764800.000042,\"packets\":[],\"ip\":{\"out\":{\"ttl\":64}},"
+        "\"ppi\":[],\"dns\":[{\"rn\":\"joy\",\"malformed\":-1,\"id\":\"0001ff\"}],\"ttl\":60}\n",
+        "ICMP flow");
+
+    /* a bidirectional TCP flow, with every field */
+    cbor_put_head(f, CBOR_MAP, 23);
+    cbor_put_uint(f, cbor_flow_version);
+    cbor_put_uint(f, 1);           /* the rest is JSON text in version 1 */
+    cbor_put_uint(f, cbor_flow_sa);
+    cbor_put_uint(f, 0xc0a80001);
+    cbor_put_uint(f, cbor_flow_da);
+    cbor_put_uint(f, 0x08080808);
+    cbor_put_uint(f, cbor_flow_pr);
+    cbor_put_uint(f, 6);
+    cbor_put_uint(f, cbor_flow_sp);
+    cbor_put_uint(f, 49152);
+    cbor_put_uint(f, cbor_flow_dp);
+    cbor_put_uint(f, 443);
+    cbor_put_uint(f, cbor_flow_labels);
+    cbor_put_text(f, "\"sa_labels\": [ \"lan\" ],", 23);
+    cbor_put_uint(f, cbor_flow_bytes_out);
+    cbor_put_uint(f, 100);
+    cbor_put_uint(f, cbor_flow_num_pkts_out);
+    cbor_put_uint(f, 2);
+    cbor_put_uint(f, cbor_flow_bytes_in);
+    cbor_put_uint(f, 200);
+    cbor_put_uint(f, cbor_flow_num_pkts_in);
+    cbor_put_uint(f, 3);
+    cbor_put_uint(f, cbor_flow_time_start);
+    cbor_put_head(f, CBOR_ARRAY, 2);
+    cbor_put_uint(f, 1);
+    cbor_put_uint(f, 0);
+    cbor_put_uint(f, cbor_flow_time_end);
+    cbor_put_head(f, CBOR_ARRAY, 2);
+    cbor_put_uint(f, 2);
+    cbor_put_uint(f, 500000);
+    cbor_put_uint(f, cbor_flow_packets);
+    cbor_put_head(f, CBOR_ARRAY, 6);
+    cbor_put_uint(f, 100);
+    cbor_put_uint(f, 0);
+    cbor_put_uint(f, 0);
+    cbor_put_uint(f, 65535);
+    cbor_put_uint(f, 1);
+    cbor_put_uint(f, 1500);
+    cbor_put_uint(f, cbor_flow_byte_dist);
+    cbor_put_bytes(f, bytes, sizeof(bytes));
+    cbor_put_uint(f, cbor_flow_byte_dist_mean);
+    cbor_put_double(f, 0.25);
+    cbor_put_uint(f, cbor_flow_byte_dist_std);
+    cbor_put_double(f, 1.0);
+    cbor_put_uint(f, cbor_flow_entropy);
+    cbor_put_double(f, 2.5);
+    cbor_put_uint(f, cbor_flow_total_entropy);
+    cbor_put_double(f, 750.0);
+    cbor_put_uint(f, cbor_flow_p_malware);
+    cbor_put_double(f, 0.125);
+    cbor_put_uint(f, cbor_flow_ip);
+    cbor_put_head(f, CBOR_ARRAY, 4);
+    cbor_put_uint(f, 64);
+    cbor_put_head(f, CBOR_ARRAY, 2);
+    cbor_put_uint(f, 1);
+    cbor_put_uint(f, 2);
+    cbor_put_uint(f, 128);
+    cbor_put_head(f, CBOR_ARRAY, 0);
+    cbor_put_uint(f, cbor_flow_json);
+    cbor_put_text(f, ",\"tcp\":{}", 9);
+    cbor_put_uint(f, cbor_flow_expire_type);
+    cbor_put_uint(f, 'i');
+    num_fails += cbor_test_expect(f, json,
+        "{\"sa\":\"192.168.0.1\",\"da\":\"8.8.8.8\",\"pr\":6,\"sp\":49152,\"dp\":443,"
+        "\"sa_labels\": [ \"lan\" ],\"bytes_out\":100,\"num_pkts_out\":2,\"bytes_in\":200,"
+        "\"num_pkts_in\":3,\"time_start\":1.000000,\"time_end\":2.500000,"
+        "\"packets\":[{\"b\":100,\"dir\":\"<\",\"ipt\":0},{\"rep\":1,\"dir\":\">\",\"ipt\":1500}],"
+        "\"byte_dist\":[0,1,255],\"byte_dist_mean\":0.250000,\"byte_dist_std\":1.000000,"
+        "\"entropy\":2.500000,\"total_entropy\":750.000000,\"p_malware\":0.125000,"
+        "\"ip\":{\"out\":{\"ttl\":64,\"id\":[1,2]},\"in\":{\"ttl\":128}},\"tcp\":{},"
+        "\"expire_type\":\"i\"}\n",
+        "TCP flow");
+
+    /* a record without a version is refused */
+    cbor_put_head(f, CBOR_MAP, 1);
+    cbor_put_uint(f, cbor_flow_pr);
+    cbor_put_uint(f, 6);
+    data = zmemory(f, &len);
+    if (cbor_to_json(data, len, json) == 0) {
+        fprintf(stderr, "cbor_unit_test: record without a version was accepted\n");
+        num_fails++;
+    }
+
+    zclose(f);
+    zclose(json);
+
+    return num_fails;
+}
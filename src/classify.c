@@ -51,9 +51,17 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <math.h>
+#include <time.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+#endif
 #include "classify.h"
 #include "p2f.h"
 #include "utils.h"
+#include "snapshot.h"
+#include "ensemble.h"
 
 /** finds the minimum value between to inputs */
 #ifndef WIN32
@@ -63,9 +71,9 @@
        _a < _b ? _a : _b; })
 #endif
 
+/** built-in parameters, used until update_params() loads a parameter file */
 //bias (1) + w (207) 
-//const float parameters_splt[NUM_PARAMETERS_SPLT_LOGREG] = { 
-float parameters_splt[NUM_PARAMETERS_SPLT_LOGREG] = {
+static const float default_parameters_splt[NUM_PARAMETERS_SPLT_LOGREG] = {
    1.870162393265777379e+00, -4.795306993214020408e-05, -1.734180056229888626e-04, -6.750871045910851378e-04,
    5.175991233904169049e-04,  3.526042198693187802e-07, -2.903366739676974950e-07, -1.415422572109461820e-06,
   -1.771571627605233568e+00,  1.620550564201104216e+00, -4.612754771764762118e-01,  3.239944708329216994e+00,
@@ -121,8 +129,7 @@ float parameters_splt[NUM_PARAMETERS_SPLT_LOGREG] = {
 };
 
 //bias (1) + w (207)
-//const float parameters_bd[NUM_PARAMETERS_BD_LOGREG] = {
-float parameters_bd[NUM_PARAMETERS_BD_LOGREG] = {
+static const float default_parameters_bd[NUM_PARAMETERS_BD_LOGREG] = {
  -2.953121634313102817e-01, -9.305965891856329863e-05, -1.604178587753208403e-04, -8.663508397764218205e-05,
   3.181501593122275080e-05,  4.869393011205743958e-08, -2.904473357729938132e-09, -1.074435511920153463e-08,
  -2.170603991277066491e+00,  6.744305938858414784e-01,  3.953560850413735395e-01,  1.361925254316559641e+00,
@@ -241,6 +248,15 @@ float parameters_bd[NUM_PARAMETERS_BD_LOGREG] = {
   0.000000000000000000e+00,  0.000000000000000000e+00,  0.000000000000000000e+00,  0.000000000000000000e+00
 };
 
+/** parameters loaded by update_params(); NULL until then */
+static joy_snapshot_t classifier_params;
+
+/** tree ensemble loaded by update_ensemble(); while set, it replaces the logistic regression */
+static joy_snapshot_t classifier_ensemble;
+
+/** the ensemble is given the features after the bias */
+#define ENSEMBLE_MAX_FEATURES (NUM_PARAMETERS_BD_LOGREG - 1)
+
 /**
  * \fn void merge_splt_arrays (const uint16_t *pkt_len, const struct timeval *pkt_time,
          const uint16_t *pkt_len_twin, const struct timeval *pkt_time_twin,
@@ -331,81 +347,175 @@ void merge_splt_arrays (const uint16_t *pkt_len, const struct timeval *pkt_time,
     merged_times[0] = joy_timeval_to_milliseconds(start_m);
 }
 
-/* transform lens array to Markov chain */
-static void get_mc_rep_lens (uint16_t *lens, float *length_mc, uint16_t num_packets) {
-    float row_sum;
-    int prev_packet_size = 0;
-    int cur_packet_size = 0;
-    int i, j;
+/*
+ * Markov chains are built from at most MC_BINS_MAX bins per state, so
+ * one counter array fits both the length and the time chains
+ */
+#define MC_BINS_MAX (MC_BINS_LEN > MC_BINS_TIME ? MC_BINS_LEN : MC_BINS_TIME)
 
-    for (i = 0; i < MC_BINS_LEN*MC_BINS_LEN; i++) { // init to 0
-        length_mc[i] = 0.0;
-    }
+/**
+ * \brief Write the Markov chain representation of \p values into \p x.
+ *
+ * Each value is binned once; the transition counts are then normalized
+ * per row.  Entry k of the chain is stored at x[k * stride].
+ *
+ * \param values packet lengths or inter-arrival times
+ * \param num_packets number of entries in \p values
+ * \param bin_size width of a bin
+ * \param num_bins number of bins (states) of the chain
+ * \param x destination of the num_bins * num_bins chain entries
+ * \param stride distance between consecutive entries in \p x
+ * \return none
+ */
+static __inline void get_mc_rep (const uint16_t *values, uint32_t num_packets,
+                                 unsigned int bin_size, unsigned int num_bins,
+                                 float *x, unsigned int stride) {
+    unsigned int counts[MC_BINS_MAX*MC_BINS_MAX];
+    unsigned int prev, cur, row_sum;
+    unsigned int i, j;
 
-    if (num_packets == 0) {
-        // nothing to do
-    } else if (num_packets == 1) {
-        cur_packet_size = (int)min(lens[0]/(float)MC_BIN_SIZE_LEN,(uint16_t)MC_BINS_LEN-1);
-        length_mc[cur_packet_size + cur_packet_size*MC_BINS_LEN] = 1.0;
-    } else {
+    memset(counts, 0, sizeof(counts));
+
+    if (num_packets == 1) {
+        cur = min(values[0] / bin_size, num_bins - 1);
+        counts[cur*num_bins + cur] = 1;
+    } else if (num_packets > 1) {
+        prev = min(values[0] / bin_size, num_bins - 1);
         for (i = 1; i < num_packets; i++) {
-            prev_packet_size = (int)min((uint16_t)(lens[i-1]/(float)MC_BIN_SIZE_LEN),(uint16_t)MC_BINS_LEN-1);
-            cur_packet_size = (int)min((uint16_t)(lens[i]/(float)MC_BIN_SIZE_LEN),(uint16_t)MC_BINS_LEN-1);
-            length_mc[prev_packet_size*MC_BINS_LEN + cur_packet_size] += 1.0;
+            cur = min(values[i] / bin_size, num_bins - 1);
+            counts[prev*num_bins + cur]++;
+            prev = cur;
         }
-        // normalize rows of Markov chain
-        for (i = 0; i < MC_BINS_LEN; i++) {
-            // find sum
-            row_sum = 0.0;
-            for (j = 0; j < MC_BINS_LEN; j++) {
-                row_sum += length_mc[i*MC_BINS_LEN+j];
-            }
-            if (row_sum != 0.0) {
-                for (j = 0; j < MC_BINS_LEN; j++) {
-                    length_mc[i*MC_BINS_LEN+j] /= row_sum;
-                }
-            }
+    }
+
+    // normalize rows of Markov chain
+    for (i = 0; i < num_bins; i++) {
+        row_sum = 0;
+        for (j = 0; j < num_bins; j++) {
+            row_sum += counts[i*num_bins + j];
+        }
+        for (j = 0; j < num_bins; j++) {
+            x[(i*num_bins + j) * stride] = counts[i*num_bins + j] ? (float)counts[i*num_bins + j] / (float)row_sum : 0.0;
         }
     }
 }
 
-/* transform times array to Markov chain */
-void get_mc_rep_times (uint16_t *times, float *time_mc, uint16_t num_packets) {
-    float row_sum;
-    int prev_packet_time = 0;
-    int cur_packet_time = 0;
-    int i, j;
-
-    for (i = 0; i < MC_BINS_TIME*MC_BINS_TIME; i++) { // init to 0
-        time_mc[i] = 0.0;
-    }
-    if (num_packets == 0) {
-        // nothing to do
-    } else if (num_packets == 1) {
-        cur_packet_time = (int)min(times[0]/(float)MC_BIN_SIZE_TIME,(uint16_t)MC_BINS_TIME-1);
-        time_mc[cur_packet_time + cur_packet_time*MC_BINS_TIME] = 1.0;
-    } else {
-        for (i = 1; i < num_packets; i++) {
-            prev_packet_time = (int)min((uint16_t)(times[i-1]/(float)MC_BIN_SIZE_TIME),(uint16_t)MC_BINS_TIME-1);
-            cur_packet_time = (int)min((uint16_t)(times[i]/(float)MC_BIN_SIZE_TIME),(uint16_t)MC_BINS_TIME-1);
-            time_mc[prev_packet_time*MC_BINS_TIME + cur_packet_time] += 1.0;
+/**
+ * \brief Write the byte distribution of a flow into \p x.
+ *
+ * Entry i is (bd[i] + bd_t[i]) / num_bytes, stored at x[i * stride].
+ * The SSE2 version rounds exactly as the scalar one does: the counts
+ * are converted to float in two exact halves, and divps rounds like
+ * divss.
+ *
+ * \param bd byte counts of the flow
+ * \param bd_t byte counts of the twin, or NULL
+ * \param num_bytes number of bytes of the flow and its twin
+ * \param x destination of the NUM_BD_VALUES entries
+ * \param stride distance between consecutive entries in \p x
+ * \return none
+ */
+static void get_bd_rep (const uint32_t *bd, const uint32_t *bd_t, float num_bytes,
+                        float *x, unsigned int stride) {
+    float rep[NUM_BD_VALUES];
+    unsigned int i;
+
+#ifdef __SSE2__
+    const __m128i low_mask = _mm_set1_epi32(0xffff);
+    const __m128 high_scale = _mm_set1_ps(65536.0);
+    const __m128 divisor = _mm_set1_ps(num_bytes);
+
+    for (i = 0; i < NUM_BD_VALUES; i += 4) {
+        __m128i count = _mm_loadu_si128((const __m128i *)(bd + i));
+        __m128 high, low;
+
+        if (bd_t != NULL) {
+            count = _mm_add_epi32(count, _mm_loadu_si128((const __m128i *)(bd_t + i)));
         }
-        // normalize rows of Markov chain
-        for (i = 0; i < MC_BINS_TIME; i++) {
-            // find sum
-            row_sum = 0.0;
-            for (j = 0; j < MC_BINS_TIME; j++) {
-                row_sum += time_mc[i*MC_BINS_TIME+j];
-            }
-            if (row_sum != 0.0) {
-                for (j = 0; j < MC_BINS_TIME; j++) {
-                    time_mc[i*MC_BINS_TIME+j] /= row_sum;
-                }
-            }
+        high = _mm_cvtepi32_ps(_mm_srli_epi32(count, 16));
+        low = _mm_cvtepi32_ps(_mm_and_si128(count, low_mask));
+        _mm_storeu_ps(rep + i, _mm_div_ps(_mm_add_ps(_mm_mul_ps(high, high_scale), low), divisor));
+    }
+#else
+    for (i = 0; i < NUM_BD_VALUES; i++) {
+        rep[i] = (bd_t != NULL ? bd[i]+bd_t[i] : bd[i])/num_bytes;
+    }
+#endif
+
+    for (i = 0; i < NUM_BD_VALUES; i++) {
+        x[i*stride] = rep[i];
+    }
+}
+
+/**
+ * \brief Write the classifier features of one flow into \p x.
+ *
+ * Feature i is stored at x[i * stride], so a single flow can use a
+ * plain vector (stride 1) and a batch can keep one column per flow.
+ * The byte distribution features are only written when \p use_bd is
+ * set.  Nothing is allocated.
+ *
+ * \return none
+ */
+static void classify_features (float *x, unsigned int stride,
+       const unsigned short *pkt_len, const struct timeval *pkt_time,
+       const unsigned short *pkt_len_twin, const struct timeval *pkt_time_twin,
+       struct timeval start_time, struct timeval start_time_twin, uint32_t max_num_pkt_len,
+       uint16_t sp, uint16_t dp, uint32_t op, uint32_t ip, uint32_t np_o, uint32_t np_i,
+       uint32_t ob, uint32_t ib, uint16_t use_bd, const uint32_t *bd, const uint32_t *bd_t) {
+
+    uint16_t merged_lens[2*MAX_NUM_PKT_LEN];
+    uint16_t merged_times[2*MAX_NUM_PKT_LEN];
+    uint32_t op_n, ip_n, i;
+    float duration = 0.0;
+
+    if (max_num_pkt_len > MAX_NUM_PKT_LEN) {
+        max_num_pkt_len = MAX_NUM_PKT_LEN;
+    }
+    op_n = min(np_o, max_num_pkt_len);
+    ip_n = min(np_i, max_num_pkt_len);
+
+    // fill out meta data
+    x[0] = 1.0;              // bias
+    x[1*stride] = (float)dp; // destination port
+    x[2*stride] = (float)sp; // source port
+    x[3*stride] = (float)ip; // inbound packets
+    x[4*stride] = (float)op; // outbound packets
+    x[5*stride] = (float)ib; // inbound bytes
+    x[6*stride] = (float)ob; // outbound bytes
+
+    // find the raw features
+    merge_splt_arrays(pkt_len, pkt_time, pkt_len_twin, pkt_time_twin, start_time, start_time_twin, op_n, ip_n,
+                      merged_lens, merged_times, max_num_pkt_len, op_n+ip_n);
+
+    // find new duration
+    for (i = 0; i < op_n+ip_n; i++) {
+        duration += (float)merged_times[i];
+    }
+    x[7*stride] = duration;
+
+    // Markov chain representations of the lengths and the times
+    get_mc_rep(merged_lens, op_n+ip_n, MC_BIN_SIZE_LEN, MC_BINS_LEN, x + 8*stride, stride);
+    get_mc_rep(merged_times, op_n+ip_n, MC_BIN_SIZE_TIME, MC_BINS_TIME,
+               x + (8+MC_BINS_LEN*MC_BINS_LEN)*stride, stride);
+
+    // fill out byte distribution features
+    if (use_bd) {
+        x += (8+MC_BINS_LEN*MC_BINS_LEN+MC_BINS_TIME*MC_BINS_TIME)*stride;
+        if (pkt_len_twin != NULL) {
+            get_bd_rep(bd, bd_t, (float)(ob+ib), x, stride);
+        } else {
+            get_bd_rep(bd, NULL, (float)(ob), x, stride);
         }
     }
 }
 
+/* logistic function of a linear score */
+static float classify_logistic (float score) {
+    score = min(-score,500.0); // check b/c overflow
+    return 1.0/(1.0+exp(score));
+}
+
 /**
  * \fn float classify (const unsigned short *pkt_len, const struct timeval *pkt_time,
         const unsigned short *pkt_len_twin, const struct timeval *pkt_time_twin,
@@ -438,137 +548,436 @@ float classify (const unsigned short *pkt_len, const struct timeval *pkt_time,
 	       uint16_t sp, uint16_t dp, uint32_t op, uint32_t ip, uint32_t np_o, uint32_t np_i,
 	       uint32_t ob, uint32_t ib, uint16_t use_bd, const uint32_t *bd, const uint32_t *bd_t) {
 
-    float features[NUM_PARAMETERS_BD_LOGREG] = {1.0};
-    float mc_lens[MC_BINS_LEN*MC_BINS_LEN];
-    float mc_times[MC_BINS_TIME*MC_BINS_TIME];
-    uint32_t i;
+    float features[NUM_PARAMETERS_BD_LOGREG];
+    const classifier_params_t *params = joy_snapshot_get(&classifier_params);
+    const ensemble_t *ensemble = joy_snapshot_get(&classifier_ensemble);
+    const float *parameters;
+    uint32_t num_parameters, i;
     float score = 0.0;
 
-    uint32_t op_n = min(np_o, max_num_pkt_len);
-    uint32_t ip_n = min(np_i, max_num_pkt_len);
-    uint16_t *merged_lens = NULL;
-    uint16_t *merged_times = NULL;
+    use_bd = (ob+ib > 100 && use_bd);
+    if (ensemble != NULL) {
+        if (!use_bd) {
+            memset(features + NUM_PARAMETERS_SPLT_LOGREG, 0,
+                   sizeof(features) - NUM_PARAMETERS_SPLT_LOGREG * sizeof(float));
+        }
+        classify_features(features, 1, pkt_len, pkt_time, pkt_len_twin, pkt_time_twin,
+                          start_time, start_time_twin, max_num_pkt_len, sp, dp, op, ip,
+                          np_o, np_i, ob, ib, use_bd, bd, bd_t);
+        return ensemble_score(ensemble, features + 1);
+    }
 
-    for (i = 1; i < NUM_PARAMETERS_BD_LOGREG; i++) {
-        features[i] = 0.0;
+    if (use_bd) {
+        parameters = params ? params->bd : default_parameters_bd;
+        num_parameters = NUM_PARAMETERS_BD_LOGREG;
+    } else {
+        parameters = params ? params->splt : default_parameters_splt;
+        num_parameters = NUM_PARAMETERS_SPLT_LOGREG;
     }
 
-    merged_lens = calloc(1, sizeof(uint16_t)*(op_n + ip_n));
-    merged_times = calloc(1, sizeof(uint16_t)*(op_n + ip_n));
-    if (!merged_lens || !merged_times) {
-	free(merged_lens);
-	free(merged_times);
-	return(score);
+    classify_features(features, 1, pkt_len, pkt_time, pkt_len_twin, pkt_time_twin,
+                      start_time, start_time_twin, max_num_pkt_len, sp, dp, op, ip,
+                      np_o, np_i, ob, ib, use_bd, bd, bd_t);
+
+    for (i = 0; i < num_parameters; i++) {
+        score += features[i]*parameters[i];
     }
 
-    // fill out meta data
-    features[1] = (float)dp; // destination port
-    features[2] = (float)sp; // source port
-    features[3] = (float)ip; // inbound packets
-    features[4] = (float)op; // outbound packets
-    features[5] = (float)ib; // inbound bytes
-    features[6] = (float)ob; // outbound bytes
-    features[7] = 0.0;// skipping 7 until we process the pkt_time arrays
+    return classify_logistic(score);
+}
 
-    // find the raw features
-    merge_splt_arrays(pkt_len, pkt_time, pkt_len_twin, pkt_time_twin, start_time, start_time_twin, op_n, ip_n,
-		                    merged_lens, merged_times, max_num_pkt_len, op_n+ip_n);
+/**
+ * \fn void classifier_batch_reset (classifier_batch_t *batch)
+ * \brief empty a classifier batch
+ * \param batch batch to empty
+ * \return none
+ */
+void classifier_batch_reset (classifier_batch_t *batch) {
+    batch->num_flows = 0;
+    batch->next = 0;
+    batch->num_splt = 0;
+    batch->num_bd = 0;
+}
 
-    // find new duration
-    for (i = 0; i < op_n+ip_n; i++) {
-        features[7] += (float)merged_times[i];
-    }
+/**
+ * \fn joy_status_e classifier_batch_add (classifier_batch_t *batch, const void *flow, ...)
+ * \brief queue a flow for classification by classifier_batch_score()
+ *
+ * The features of the flow are extracted into the column of the batch
+ * matrix of its model.  The arguments after \p flow are those of
+ * classify().
+ *
+ * \param batch batch to add the flow to
+ * \param flow handle by which classifier_batch_get() finds the score
+ * \return ok, or failure if the batch is full
+ */
+joy_status_e classifier_batch_add (classifier_batch_t *batch, const void *flow,
+       const unsigned short *pkt_len, const struct timeval *pkt_time,
+       const unsigned short *pkt_len_twin, const struct timeval *pkt_time_twin,
+       struct timeval start_time, struct timeval start_time_twin, uint32_t max_num_pkt_len,
+       uint16_t sp, uint16_t dp, uint32_t op, uint32_t ip, uint32_t np_o, uint32_t np_i,
+       uint32_t ob, uint32_t ib, uint16_t use_bd, const uint32_t *bd, const uint32_t *bd_t) {
 
-    // get the Markov chain representation for the lengths
-    get_mc_rep_lens(merged_lens, mc_lens, op_n+ip_n);
+    unsigned int n = batch->num_flows;
+    unsigned int column;
+    float *x;
 
-    // get the Markov chain representation for the times
-    get_mc_rep_times(merged_times, mc_times, op_n+ip_n);
+    if (n >= CLASSIFIER_BATCH_SIZE) {
+        return failure;
+    }
 
-    // fill out lens/times in feature vector
-    for (i = 0; i < MC_BINS_LEN*MC_BINS_LEN; i++) {
-        features[i+8] = mc_lens[i]; // lengths
+    use_bd = (ob+ib > 100 && use_bd);
+    if (use_bd) {
+        column = batch->num_bd++;
+        x = batch->bd + CLASSIFIER_COLUMN(column, NUM_PARAMETERS_BD_LOGREG);
+    } else {
+        column = batch->num_splt++;
+        x = batch->splt + CLASSIFIER_COLUMN(column, NUM_PARAMETERS_SPLT_LOGREG);
     }
-    for (i = 0; i < MC_BINS_TIME*MC_BINS_TIME; i++) {
-        features[i+8+MC_BINS_LEN*MC_BINS_LEN] = mc_times[i]; // times
+    classify_features(x, CLASSIFIER_LANES, pkt_len, pkt_time, pkt_len_twin, pkt_time_twin,
+                      start_time, start_time_twin, max_num_pkt_len, sp, dp, op, ip,
+                      np_o, np_i, ob, ib, use_bd, bd, bd_t);
+
+    batch->flow[n] = flow;
+    batch->column[n] = column;
+    batch->use_bd[n] = use_bd;
+    batch->num_flows = n + 1;
+
+    return ok;
+}
+
+/*
+ * score[j] = sum over i of w[i] * x[i][j], for the first num_flows
+ * columns of x.  The sum for each flow is taken in the same order as
+ * classify() does, so the scores do not depend on the batching.
+ */
+static void classifier_batch_dot (const float *x, const float *w, unsigned int num_parameters,
+                                  unsigned int num_flows, float *score) {
+    unsigned int block_size = num_parameters*CLASSIFIER_LANES;
+    unsigned int i, j;
+
+#ifdef __SSE__
+    for (j = 0; j < num_flows; j += CLASSIFIER_LANES) {
+        _mm_storeu_ps(score + j, _mm_setzero_ps());
     }
+    for (i = 0; i < num_parameters; i++) {
+        const float *feature = x + i*CLASSIFIER_LANES;
+        __m128 wi = _mm_set1_ps(w[i]);
 
-    // fill out byte distribution features
-    if (ob+ib > 100 && use_bd) {
-        for (i = 0; i < NUM_BD_VALUES; i++) {
-            if (pkt_len_twin != NULL) {
-                features[i+8+MC_BINS_LEN*MC_BINS_LEN+MC_BINS_TIME*MC_BINS_TIME] = (bd[i]+bd_t[i])/((float)(ob+ib));
-            } else {
-                features[i+8+MC_BINS_LEN*MC_BINS_LEN+MC_BINS_TIME*MC_BINS_TIME] = bd[i]/((float)(ob));
-            }
+        for (j = 0; j < num_flows; j += CLASSIFIER_LANES) {
+            __m128 s = _mm_loadu_ps(score + j);
+            s = _mm_add_ps(s, _mm_mul_ps(_mm_loadu_ps(feature), wi));
+            _mm_storeu_ps(score + j, s);
+            feature += block_size;
         }
     }
+#else
+    for (j = 0; j < num_flows; j++) {
+        score[j] = 0.0;
+    }
+    for (i = 0; i < num_parameters; i++) {
+        for (j = 0; j < num_flows; j++) {
+            score[j] += x[(j/CLASSIFIER_LANES)*block_size + i*CLASSIFIER_LANES + j%CLASSIFIER_LANES]*w[i];
+        }
+    }
+#endif
+}
+
+/*
+ * Score each flow of a batch with a tree ensemble.  The trees read
+ * features in no particular order, so each column is first copied
+ * into a plain vector, with zeros for byte distribution features that
+ * the flow does not have.
+ */
+static void classifier_batch_score_ensemble (classifier_batch_t *batch, const ensemble_t *ensemble) {
+    float x[NUM_PARAMETERS_BD_LOGREG];
+    const float *column;
+    unsigned int num_features;
+    unsigned int i, j;
 
-    if (ob+ib > 100 && use_bd) {
-        score = parameters_bd[0];
-        for (i = 1; i < NUM_PARAMETERS_BD_LOGREG; i++) {
-            score += features[i]*parameters_bd[i];
+    memset(x, 0, sizeof(x));
+    for (j = 0; j < batch->num_flows; j++) {
+        if (batch->use_bd[j]) {
+            num_features = NUM_PARAMETERS_BD_LOGREG;
+            column = batch->bd + CLASSIFIER_COLUMN(batch->column[j], NUM_PARAMETERS_BD_LOGREG);
+        } else {
+            num_features = NUM_PARAMETERS_SPLT_LOGREG;
+            column = batch->splt + CLASSIFIER_COLUMN(batch->column[j], NUM_PARAMETERS_SPLT_LOGREG);
+            memset(x + NUM_PARAMETERS_SPLT_LOGREG, 0,
+                   sizeof(x) - NUM_PARAMETERS_SPLT_LOGREG * sizeof(float));
         }
-    } else {
-        for (i = 0; i < NUM_PARAMETERS_SPLT_LOGREG; i++) {
-            score += features[i]*parameters_splt[i];
+        for (i = 0; i < num_features; i++) {
+            x[i] = column[i*CLASSIFIER_LANES];
         }
+        if (batch->use_bd[j]) {
+            batch->bd_score[batch->column[j]] = ensemble_score(ensemble, x + 1);
+        } else {
+            batch->splt_score[batch->column[j]] = ensemble_score(ensemble, x + 1);
+        }
+    }
+}
+
+/**
+ * \fn void classifier_batch_score (classifier_batch_t *batch)
+ * \brief score all of the flows in a batch
+ *
+ * Each model is applied to its whole feature matrix at once, a
+ * feature at a time across the flows, four flows to an SSE vector.
+ * If a tree ensemble is loaded, it scores the flows instead.
+ *
+ * \param batch batch to score
+ * \return none
+ */
+void classifier_batch_score (classifier_batch_t *batch) {
+    const classifier_params_t *params = joy_snapshot_get(&classifier_params);
+    const ensemble_t *ensemble = joy_snapshot_get(&classifier_ensemble);
+    unsigned int j;
+
+    if (ensemble != NULL) {
+        classifier_batch_score_ensemble(batch, ensemble);
+        return;
     }
 
-    score = min(-score,500.0); // check b/c overflow
-  
-    free(merged_lens);
-    free(merged_times);
+    classifier_batch_dot(batch->splt, params ? params->splt : default_parameters_splt,
+                         NUM_PARAMETERS_SPLT_LOGREG, batch->num_splt, batch->splt_score);
+    classifier_batch_dot(batch->bd, params ? params->bd : default_parameters_bd,
+                         NUM_PARAMETERS_BD_LOGREG, batch->num_bd, batch->bd_score);
 
-    return 1.0/(1.0+exp(score));
+    for (j = 0; j < batch->num_splt; j++) {
+        batch->splt_score[j] = classify_logistic(batch->splt_score[j]);
+    }
+    for (j = 0; j < batch->num_bd; j++) {
+        batch->bd_score[j] = classify_logistic(batch->bd_score[j]);
+    }
 }
 
 /**
- * \fn void update_params (char *splt_params, char *bd_params)
+ * \fn joy_status_e classifier_batch_get (classifier_batch_t *batch, const void *flow, float *score)
+ * \brief take the score of the next flow of a scored batch
+ *
+ * Scores are handed out in the order the flows were added.
+ *
+ * \param batch scored batch
+ * \param flow handle the flow was added with
+ * \param score receives the score
+ * \return ok, or failure if \p flow is not the next flow of the batch
+ */
+joy_status_e classifier_batch_get (classifier_batch_t *batch, const void *flow, float *score) {
+    unsigned int n = batch->next;
+
+    if (n >= batch->num_flows || batch->flow[n] != flow) {
+        return failure;
+    }
+    if (batch->use_bd[n]) {
+        *score = batch->bd_score[batch->column[n]];
+    } else {
+        *score = batch->splt_score[batch->column[n]];
+    }
+    batch->next = n + 1;
+
+    return ok;
+}
+
+/**
+ * \fn void update_params (classifier_type_codes_t param_type, char *param_file)
  * \brief if a user supplies new parameter files, update parameters splt/bd
+ *
+ * The parameters in use are never modified; a copy with the new values
+ * is published in their place, so classify() needs no lock.  Calls
+ * must not run concurrently.
+ *
  * \param param_type type of new parameters to update
- * \param params file name with new parameters
- * \reutrn none
+ * \param param_file file name with new parameters
+ * \return none
  */
 void update_params (classifier_type_codes_t param_type, char *param_file) {
+    const classifier_params_t *current = joy_snapshot_get(&classifier_params);
+    classifier_params_t *params = NULL;
+    float *dest = NULL;
     float param;
     FILE *fp;
     int count = 0;
+    int max = 0;
 
     switch (param_type) {
         case (SPLT_PARAM_TYPE):
-            count = 0;
-            fp = fopen(param_file,"r");
-            if (fp != NULL) {
-                while (fscanf(fp, "%f", &param) != EOF) {
-                    parameters_splt[count] = param;
-                    count++;
-                    if (count >= NUM_PARAMETERS_SPLT_LOGREG) {
-	                break;
-                    }
-                }
-                fclose(fp);
-            }
+            max = NUM_PARAMETERS_SPLT_LOGREG;
             break;
-       
         case (BD_PARAM_TYPE):
-            count = 0;
-            fp = fopen(param_file,"r");
-            if (fp != NULL) {
-                while (fscanf(fp, "%f", &param) != EOF) {
-                    parameters_bd[count] = param;
-                    count++;
-                    if (count >= NUM_PARAMETERS_BD_LOGREG) {
-                        break;
-                    }
-                }
-                fclose(fp);
-            }
+            max = NUM_PARAMETERS_BD_LOGREG;
             break;
-    
         default:
             joy_log_err("error: unknown paramerter type (%d)", param_type);
-            break;
+            return;
+    }
+
+    fp = fopen(param_file,"r");
+    if (fp == NULL) {
+        return;
+    }
+
+    params = malloc(sizeof(classifier_params_t));
+    if (params == NULL) {
+        joy_log_err("could not allocate memory for classifier parameters");
+        fclose(fp);
+        return;
+    }
+    if (current != NULL) {
+        memcpy(params, current, sizeof(classifier_params_t));
+    } else {
+        memcpy(params->splt, default_parameters_splt, sizeof(params->splt));
+        memcpy(params->bd, default_parameters_bd, sizeof(params->bd));
     }
+
+    dest = (param_type == SPLT_PARAM_TYPE) ? params->splt : params->bd;
+    while (count < max && fscanf(fp, "%f", &param) == 1) {
+        dest[count++] = param;
+    }
+    fclose(fp);
+
+    joy_snapshot_publish(&classifier_params, params, free);
+}
+
+
+/**
+ * \fn joy_status_e update_ensemble (const char *ensemble_file)
+ * \brief load a tree ensemble, which then scores flows in place of the
+ *        logistic regression
+ *
+ * The ensemble in use is replaced by publishing the new one, so that
+ * classify() needs no lock.  Calls must not run concurrently.
+ *
+ * \param ensemble_file file in the format described in ensemble.h
+ * \return ok, or failure if the file could not be loaded, in which
+ *         case the ensemble in use is kept
+ */
+joy_status_e update_ensemble (const char *ensemble_file) {
+    ensemble_t *ensemble = ensemble_load(ensemble_file, ENSEMBLE_MAX_FEATURES);
+
+    if (ensemble == NULL) {
+        return failure;
+    }
+    joy_snapshot_publish(&classifier_ensemble, ensemble, ensemble_free);
+
+    return ok;
+}
+
+/*
+ * Fill out the packet arrays of a synthetic flow; the values depend on
+ * seed so that the flows of a test batch differ
+ */
+static void classify_test_flow (unsigned int seed, unsigned short *lens, struct timeval *times,
+                                uint32_t *bd, unsigned int num_pkts) {
+    unsigned int i;
+
+    for (i = 0; i < num_pkts; i++) {
+        lens[i] = (seed * 131 + i * 977) % 1600;
+        times[i].tv_sec = 1500000000 + i / 4;
+        times[i].tv_usec = ((seed * 7919 + i * 104729) % 250000) + (i % 4) * 250000;
+    }
+    for (i = 0; i < NUM_BD_VALUES; i++) {
+        bd[i] = (seed + i * i) % 97;
+    }
+    /* a count that float cannot represent exactly */
+    bd[NUM_BD_VALUES-1] = 0x87654321 + seed;
 }
 
+/**
+ * \fn void classify_unit_test (void)
+ * \brief check that batch and single flow classification agree
+ *
+ * Also reports the cost per flow of both ways of classifying.
+ *
+ * \return none
+ */
+void classify_unit_test (void) {
+    static classifier_batch_t batch;
+    static unsigned short lens[CLASSIFIER_BATCH_SIZE][MAX_NUM_PKT_LEN];
+    static unsigned short lens_t[CLASSIFIER_BATCH_SIZE][MAX_NUM_PKT_LEN];
+    static struct timeval times[CLASSIFIER_BATCH_SIZE][MAX_NUM_PKT_LEN];
+    static struct timeval times_t[CLASSIFIER_BATCH_SIZE][MAX_NUM_PKT_LEN];
+    static uint32_t bd[CLASSIFIER_BATCH_SIZE][NUM_BD_VALUES];
+    static uint32_t bd_t[CLASSIFIER_BATCH_SIZE][NUM_BD_VALUES];
+    float expected[CLASSIFIER_BATCH_SIZE];
+    float score;
+    uint32_t np[CLASSIFIER_BATCH_SIZE], np_t[CLASSIFIER_BATCH_SIZE];
+    uint32_t ob[CLASSIFIER_BATCH_SIZE], ib[CLASSIFIER_BATCH_SIZE];
+    clock_t start, single_ticks, batch_ticks;
+    unsigned int rounds = 200;
+    unsigned int i, r;
+    int num_fails = 0;
+
+    fprintf(info, "\n******************************\n");
+    fprintf(info, "Classify Unit Test starting...\n");
+
+    for (i = 0; i < CLASSIFIER_BATCH_SIZE; i++) {
+        classify_test_flow(i, lens[i], times[i], bd[i], MAX_NUM_PKT_LEN);
+        classify_test_flow(i + 1000, lens_t[i], times_t[i], bd_t[i], MAX_NUM_PKT_LEN);
+        np[i] = i % 60;
+        np_t[i] = i % 3 ? np[i] + 3 : 0;
+        ob[i] = i % 4 ? 1000 * i + 200 : 40;
+        ib[i] = i % 3 ? 500 * i : 0;
+    }
+
+/* flow i: a third are unidirectional, and a quarter are too small for the bd model */
+#define CLASSIFY_TEST_ARGS(i) \
+        lens[i], times[i], (i) % 3 ? lens_t[i] : NULL, (i) % 3 ? times_t[i] : NULL, \
+        times[i][0], times_t[i][0], NUM_PKT_LEN, 443, 1024 + (i), np[i], np_t[i], np[i], np_t[i], \
+        ob[i], ib[i], 1, bd[i], (i) % 3 ? bd_t[i] : NULL
+
+    start = clock();
+    for (r = 0; r < rounds; r++) {
+        for (i = 0; i < CLASSIFIER_BATCH_SIZE; i++) {
+            expected[i] = classify(CLASSIFY_TEST_ARGS(i));
+        }
+    }
+    single_ticks = clock() - start;
+
+    start = clock();
+    for (r = 0; r < rounds; r++) {
+        classifier_batch_reset(&batch);
+        for (i = 0; i < CLASSIFIER_BATCH_SIZE; i++) {
+            if (classifier_batch_add(&batch, &expected[i], CLASSIFY_TEST_ARGS(i)) != ok) {
+                fprintf(info, "error: could not add flow %u to the batch\n", i);
+                num_fails++;
+            }
+        }
+        classifier_batch_score(&batch);
+    }
+    batch_ticks = clock() - start;
+
+    if (batch.num_splt == 0 || batch.num_bd == 0) {
+        fprintf(info, "error: the batch does not use both models\n");
+        num_fails++;
+    }
+    if (classifier_batch_add(&batch, lens, CLASSIFY_TEST_ARGS(0)) != failure) {
+        fprintf(info, "error: added a flow to a full batch\n");
+        num_fails++;
+    }
+    if (classifier_batch_get(&batch, &expected[1], &score) != failure) {
+        fprintf(info, "error: got a score out of order\n");
+        num_fails++;
+    }
+    for (i = 0; i < CLASSIFIER_BATCH_SIZE; i++) {
+        if (classifier_batch_get(&batch, &expected[i], &score) != ok) {
+            fprintf(info, "error: no score for flow %u\n", i);
+            num_fails++;
+        } else if (score != expected[i]) {
+            fprintf(info, "error: flow %u scored %f in a batch and %f alone\n", i, score, expected[i]);
+            num_fails++;
+        }
+    }
+#undef CLASSIFY_TEST_ARGS
+
+    fprintf(info, "per flow: %.0f ns alone, %.0f ns in batches of %u\n",
+            1e9 * single_ticks / CLOCKS_PER_SEC / (rounds * CLASSIFIER_BATCH_SIZE),
+            1e9 * batch_ticks / CLOCKS_PER_SEC / (rounds * CLASSIFIER_BATCH_SIZE),
+            CLASSIFIER_BATCH_SIZE);
+
+    if (num_fails) {
+        fprintf(info, "Finished - failures: %d\n", num_fails);
+    } else {
+        fprintf(info, "Finished - success\n");
+    }
+    fprintf(info, "******************************\n\n");
+}
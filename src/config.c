@@ -50,6 +50,8 @@
 #include "radix_trie.h"
 #include "hdr_dsc.h" 
 #include "p2f.h"
+#include "cbor_output.h"
+#include "upload.h"
 
 #ifdef WIN32
 #include "unistd.h"
@@ -178,6 +180,18 @@ static int config_parse_command (struct configuration *config,
     } else if (match(command, "keyfile")) {
         parse_check(parse_string(&config->upload_key, arg, num));
 
+    } else if (match(command, "upload_workers")) {
+        parse_check(parse_int(&config->upload_workers, arg, num, 1, UPLOAD_MAX_WORKERS));
+
+    } else if (match(command, "upload_retries")) {
+        parse_check(parse_int(&config->upload_retries, arg, num, 0, 1000));
+
+    } else if (match(command, "upload_bwlimit")) {
+        parse_check(parse_int(&config->upload_bwlimit, arg, num, 0, 10000000));
+
+    } else if (match(command, "upload_queue")) {
+        parse_check(parse_string(&config->upload_queue, arg, num));
+
     } else if (match(command, "URLmodel")) {
         parse_check(parse_string(&config->params_url, arg, num));
 
@@ -187,6 +201,9 @@ static int config_parse_command (struct configuration *config,
     } else if (match(command, "model")) {
         parse_check(parse_string(&config->params_file, arg, num));
 
+    } else if (match(command, "ensemble")) {
+        parse_check(parse_string(&config->ensemble_file, arg, num));
+
     } else if (match(command, "label")) {
         parse_check(parse_string_multiple(config->subnet, arg, num, config->num_subnets++, MAX_NUM_FLAGS));
 
@@ -220,6 +237,9 @@ static int config_parse_command (struct configuration *config,
     } else if (match(command, "bpf")) {
         parse_check(parse_string(&config->bpf_filter_exp, arg, num));
 
+    } else if (match(command, "http_headers")) {
+        parse_check(parse_string(&config->http_headers, arg, num));
+
     } else if (match(command, "verbosity")) {
         parse_check(parse_int(&config->verbosity, arg, num, 0, 5));
 
@@ -232,6 +252,27 @@ static int config_parse_command (struct configuration *config,
     } else if (match(command, "count")) {
         parse_check(parse_int(&config->max_records, arg, num, 1, INT_MAX));
 
+    } else if (match(command, "async_output")) {
+        parse_check(parse_int(&config->async_output, arg, num, 0, ZFILE_ASYNC_MAX_BUFFERS));
+
+    } else if (match(command, "compress_level")) {
+        parse_check(parse_int(&config->compress_level, arg, num, 0, 22));
+
+    } else if (match(command, "compress_threads")) {
+        parse_check(parse_int(&config->compress_threads, arg, num, 0, ZFILE_MAX_THREADS));
+
+    } else if (match(command, "arrow_output")) {
+        parse_check(parse_bool(&config->arrow_output, arg, num));
+
+    } else if (match(command, "cbor_output")) {
+        parse_check(parse_bool(&config->cbor_output, arg, num));
+
+    } else if (match(command, "shm_output")) {
+        parse_check(parse_string(&config->shm_output, arg, num));
+
+    } else if (match(command, "shm_size")) {
+        parse_check(parse_int(&config->shm_size, arg, num, 1, 4096));
+
     } else if (match(command, "idp")) {
         parse_check(parse_int(&config->idp, arg, num, 0, MAX_IDP));
 
@@ -280,6 +321,25 @@ static int config_parse_command (struct configuration *config,
     } else if (match(command, "show_interfaces")) {
         parse_check(parse_bool(&config->show_interfaces, arg, num));
 
+    } else if (match(command, "sample_rate")) {
+        parse_check(parse_int(&config->sample_rate, arg, num, 1, MAX_SAMPLE_RATE));
+
+    } else if (match(command, "adaptive_sample")) {
+        parse_check(parse_bool(&config->adaptive_sample, arg, num));
+
+    } else if (match(command, "inspect_bytes")) {
+        parse_check(parse_int(&config->inspect_bytes, arg, num, 0, INT_MAX));
+
+    } else if (match(command, "inspect_pkts")) {
+        parse_check(parse_int(&config->inspect_pkts, arg, num, 0, INT_MAX));
+
+    } else if (match(command, "fingerprint_hash")) {
+        parse_check(parse_int(&config->fingerprint_hash, arg, num,
+                              fingerprint_hash_off, fingerprint_hash_only));
+
+    } else if (match(command, "fingerprint_match")) {
+        parse_check(parse_int(&config->fingerprint_match, arg, num, 0, 100));
+
     }
 
     config_all_features_bool(feature_list);
@@ -301,6 +361,9 @@ void config_set_defaults (struct configuration *config) {
     config->verbosity = 4;
     config->show_config = 0;
     config->show_interfaces = 0;
+    config->sample_rate = 1;
+    config->fingerprint_match = 100;
+    config->upload_retries = UPLOAD_DEFAULT_RETRIES;
 }
 
 #define MAX_FILEPATH 128
@@ -506,8 +569,19 @@ void config_print (FILE *f, const struct configuration *c) {
     fprintf(f, "outputdir = %s\n", val(c->outputdir));
     fprintf(f, "username = %s\n", val(c->username));
     fprintf(f, "count = %u\n", c->max_records); 
+    fprintf(f, "async_output = %u\n", c->async_output);
+    fprintf(f, "compress_level = %u\n", c->compress_level);
+    fprintf(f, "compress_threads = %u\n", c->compress_threads);
+    fprintf(f, "arrow_output = %u\n", c->arrow_output);
+    fprintf(f, "cbor_output = %u\n", c->cbor_output);
+    fprintf(f, "shm_output = %s\n", val(c->shm_output));
+    fprintf(f, "shm_size = %u\n", c->shm_size);
     fprintf(f, "upload = %s\n", val(c->upload_servername));
     fprintf(f, "keyfile = %s\n", val(c->upload_key));
+    fprintf(f, "upload_workers = %u\n", c->upload_workers);
+    fprintf(f, "upload_retries = %u\n", c->upload_retries);
+    fprintf(f, "upload_bwlimit = %u\n", c->upload_bwlimit);
+    fprintf(f, "upload_queue = %s\n", val(c->upload_queue));
     for (i=0; i<c->num_subnets; i++) {
         fprintf(f, "label=%s\n", c->subnet[i]);
     }
@@ -522,11 +596,19 @@ void config_print (FILE *f, const struct configuration *c) {
     fprintf(f, "entropy = %u\n", c->report_entropy);
     fprintf(f, "hd = %u\n", c->report_hd);
     fprintf(f, "classify = %u\n", c->include_classifier);
+    fprintf(f, "ensemble = %s\n", val(c->ensemble_file));
     fprintf(f, "idp = %u\n", c->idp);
     fprintf(f, "exe = %u\n", c->report_exe);
     fprintf(f, "anon = %s\n", val(c->anon_addrs_file));
     fprintf(f, "useranon = %s\n", val(c->anon_http_file));
     fprintf(f, "bpf = %s\n", val(c->bpf_filter_exp));
+    fprintf(f, "http_headers = %s\n", val(c->http_headers));
+    fprintf(f, "sample_rate = %u\n", c->sample_rate);
+    fprintf(f, "adaptive_sample = %u\n", c->adaptive_sample);
+    fprintf(f, "inspect_bytes = %u\n", c->inspect_bytes);
+    fprintf(f, "inspect_pkts = %u\n", c->inspect_pkts);
+    fprintf(f, "fingerprint_hash = %u\n", c->fingerprint_hash);
+    fprintf(f, "fingerprint_match = %u\n", c->fingerprint_match);
 
     config_print_all_features_bool(feature_list);
 
@@ -536,13 +618,8 @@ void config_print (FILE *f, const struct configuration *c) {
     anon_print_subnets(f);
 }
 
-/**
- * \fn void config_print_json (zfile f, const struct configuration *c)
- * \param f file to print configuration to
- * \param c pointer to the configuration structure
- * \return none
- */
-void config_print_json (zfile f, const struct configuration *c) {
+/* prints the configuration as one line of JSON */
+static void config_print_json_line (zfile f, const struct configuration *c) {
     unsigned int i;
 
     zprintf(f, "{\"version\":\"%s\",", VERSION);
@@ -553,8 +630,19 @@ void config_print_json (zfile f, const struct configuration *c) {
     zprintf(f, "\"username\":\"%s\",", val(c->username));
     zprintf(f, "\"info\":\"%s\",", val(c->logfile));
     zprintf(f, "\"count\":%u,", c->max_records); 
+    zprintf(f, "\"async_output\":%u,", c->async_output);
+    zprintf(f, "\"compress_level\":%u,", c->compress_level);
+    zprintf(f, "\"compress_threads\":%u,", c->compress_threads);
+    zprintf(f, "\"arrow_output\":%u,", c->arrow_output);
+    zprintf(f, "\"cbor_output\":%u,", c->cbor_output);
+    zprintf(f, "\"shm_output\":\"%s\",", val(c->shm_output));
+    zprintf(f, "\"shm_size\":%u,", c->shm_size);
     zprintf(f, "\"upload\":\"%s\",", val(c->upload_servername));
     zprintf(f, "\"keyfile\":\"%s\",", val(c->upload_key));
+    zprintf(f, "\"upload_workers\":%u,", c->upload_workers);
+    zprintf(f, "\"upload_retries\":%u,", c->upload_retries);
+    zprintf(f, "\"upload_bwlimit\":%u,", c->upload_bwlimit);
+    zprintf(f, "\"upload_queue\":\"%s\",", val(c->upload_queue));
     for (i=0; i<c->num_subnets; i++) {
         zprintf(f, "\"label\":\"%s\",", c->subnet[i]);
     }
@@ -569,11 +657,19 @@ void config_print_json (zfile f, const struct configuration *c) {
     zprintf(f, "\"entropy\":%u,", c->report_entropy);
     zprintf(f, "\"hd\":%u,", c->report_hd);
     zprintf(f, "\"classify\":%u,", c->include_classifier);
+    zprintf(f, "\"ensemble\":\"%s\",", val(c->ensemble_file));
     zprintf(f, "\"idp\":%u,", c->idp);
     zprintf(f, "\"exe\":%u,", c->report_exe);
     zprintf(f, "\"anon\":\"%s\",", val(c->anon_addrs_file));
     zprintf(f, "\"useranon\":\"%s\",", val(c->anon_http_file));
     zprintf(f, "\"bpf\":\"%s\",", val(c->bpf_filter_exp));
+    zprintf(f, "\"http_headers\":\"%s\",", val(c->http_headers));
+    zprintf(f, "\"sample_rate\":%u,", c->sample_rate);
+    zprintf(f, "\"adaptive_sample\":%u,", c->adaptive_sample);
+    zprintf(f, "\"inspect_bytes\":%u,", c->inspect_bytes);
+    zprintf(f, "\"inspect_pkts\":%u,", c->inspect_pkts);
+    zprintf(f, "\"fingerprint_hash\":%u,", c->fingerprint_hash);
+    zprintf(f, "\"fingerprint_match\":%u,", c->fingerprint_match);
     zprintf(f, "\"verbosity\":%u,", c->verbosity);
 
     config_print_json_all_features_bool(feature_list);
@@ -581,3 +677,40 @@ void config_print_json (zfile f, const struct configuration *c) {
     zprintf(f, "\"end-config\":1}\n");  
 }
 
+/**
+ * \fn void config_print_json (zfile f, const struct configuration *c)
+ * \param f file to print configuration to
+ * \param c pointer to the configuration structure
+ * \return none
+ */
+void config_print_json (zfile f, const struct configuration *c) {
+    zfile json;
+    const char *line;
+    size_t len;
+
+    if (c->arrow_output) {
+        /* the output is an Arrow stream, which has no room for it */
+        return;
+    }
+    if (!c->cbor_output) {
+        config_print_json_line(f, c);
+        zrecord(f);
+        return;
+    }
+
+    /* in CBOR output, the line of JSON is carried as a text string */
+    json = zopen_memory();
+    if (json == NULL) {
+        return;
+    }
+    config_print_json_line(json, c);
+    line = zmemory(json, &len);
+    if (line != NULL) {
+        zbinary(f);
+        cbor_put_head(f, CBOR_TAG, CBOR_SELF_DESCRIBE);
+        cbor_put_text(f, line, len);
+        zrecord(f);
+    }
+    zclose(json);
+}
+
@@ -127,10 +127,11 @@ static const char *dhcp_option_message_types[] = {
  * \brief Initialize the memory of DHCP struct.
  *
  * \param dhcp_handle contains dhcp structure to initialize
+ * \param arena arena of the flow record, backing the data of the structure
  *
  * \return none
  */
-void dhcp_init(dhcp_t **dhcp_handle)
+void dhcp_init(dhcp_t **dhcp_handle, joy_arena_t *arena)
 {
     if (*dhcp_handle != NULL) {
         dhcp_delete(dhcp_handle);
@@ -142,6 +143,7 @@ void dhcp_init(dhcp_t **dhcp_handle)
         joy_log_err("malloc failed");
         return;
     }
+    (*dhcp_handle)->arena = arena;
 }
 
 /**
@@ -153,32 +155,12 @@ void dhcp_init(dhcp_t **dhcp_handle)
  */
 void dhcp_delete(dhcp_t **dhcp_handle)
 {
-    int i = 0;
     dhcp_t *dhcp = *dhcp_handle;
 
     if (dhcp == NULL) {
         return;
     }
 
-    for (i = 0; i < dhcp->message_count; i++) {
-        int k = 0;
-
-        if (dhcp->messages[i].sname) {
-            free(dhcp->messages[i].sname);
-        }
-
-        if (dhcp->messages[i].file) {
-            free(dhcp->messages[i].file);
-        }
-
-        for (k = 0; k < dhcp->messages[i].options_count; k++) {
-            /* Free up memory in the options */
-            if (dhcp->messages[i].options[k].value) {
-                free(dhcp->messages[i].options[k].value);
-            }
-        }
-    }
-
     /* Free the memory and set to NULL */
     free(dhcp);
     *dhcp_handle = NULL;
@@ -255,13 +237,15 @@ static int dhcp_option_value_to_string(dhcp_option_t *opt,
  * If the value at \p data_ptr has a string representation, use that.
  * Otherwise, allocate memory to store the data and copy in.
  *
+ * \param arena arena to allocate the option data from
  * \param opt dhcp_option
  * \param opt_len length of the option data
  * \param data_ptr pointer to the option data
  *
  * \return none
  */
-static void dhcp_get_option_value(dhcp_option_t *opt,
+static void dhcp_get_option_value(joy_arena_t *arena,
+                                  dhcp_option_t *opt,
                                   unsigned char opt_len,
                                   const unsigned char *data_ptr) {
     /*
@@ -270,7 +254,7 @@ static void dhcp_get_option_value(dhcp_option_t *opt,
      */
     if (!dhcp_option_value_to_string(opt, data_ptr)) {
         /* Allocate memory for the option data */
-        opt->value = calloc(1, opt_len);
+        opt->value = joy_arena_alloc(arena, opt_len);
 	if (!opt->value) {
 	    joy_log_err("malloc failed");
 	    return;
@@ -353,7 +337,7 @@ void dhcp_update(dhcp_t *dhcp,
 
     if (*ptr != 0) {
         /* Server host name exists so alloc and copy it */
-        msg->sname = calloc(1, MAX_DHCP_SNAME);
+        msg->sname = joy_arena_alloc(dhcp->arena, MAX_DHCP_SNAME);
 	if (!msg->sname) {
 	    joy_log_err("malloc failed");
 	    return;
@@ -366,7 +350,7 @@ void dhcp_update(dhcp_t *dhcp,
 
     if (*ptr != 0) {
         /* Boot file name exists so alloc and copy it */
-        msg->file = calloc(1, MAX_DHCP_FILE);
+        msg->file = joy_arena_alloc(dhcp->arena, MAX_DHCP_FILE);
 	if (!msg->file) {
 	    joy_log_err("malloc failed");
 	    return;
@@ -412,7 +396,7 @@ void dhcp_update(dhcp_t *dhcp,
         ptr += 1;
 
         if (opt_len != 0) {
-            dhcp_get_option_value(&msg->options[index], opt_len, ptr);
+            dhcp_get_option_value(dhcp->arena, &msg->options[index], opt_len, ptr);
 
             ptr += opt_len;
             msg->options_length += opt_len;
@@ -481,6 +465,7 @@ void dhcp_print_json(const dhcp_t *d1,
 
     if (d1->message_count) {
         char ipv4_addr[INET_ADDRSTRLEN];
+        char anon_hex[ANON_HEXSTRING_LEN];
         zprintf(f, ",\"dhcp\":[");
         for (i = 0; i < d1->message_count; i++) {
             const dhcp_message_t *msg = &d1->messages[i];
@@ -495,25 +480,25 @@ void dhcp_print_json(const dhcp_t *d1,
             zprintf(f, ",\"flags\":\"%u\"", msg->flags);
 
             if (ipv4_addr_needs_anonymization(&msg->ciaddr)) {
-                zprintf(f, ",\"ciaddr\":\"%s\"", addr_get_anon_hexstring(&msg->ciaddr));
+                zprintf(f, ",\"ciaddr\":\"%s\"", addr_get_anon_hexstring(&msg->ciaddr, NULL, anon_hex));
             } else {
                 inet_ntop(AF_INET, &msg->ciaddr, ipv4_addr, INET_ADDRSTRLEN);
                 zprintf(f, ",\"ciaddr\":\"%s\"", ipv4_addr);
             }
             if (ipv4_addr_needs_anonymization(&msg->yiaddr)) {
-                zprintf(f, ",\"yiaddr\":\"%s\"", addr_get_anon_hexstring(&msg->yiaddr));
+                zprintf(f, ",\"yiaddr\":\"%s\"", addr_get_anon_hexstring(&msg->yiaddr, NULL, anon_hex));
             } else {
                 inet_ntop(AF_INET, &msg->yiaddr, ipv4_addr, INET_ADDRSTRLEN);
                 zprintf(f, ",\"yiaddr\":\"%s\"", ipv4_addr);
             }
             if (ipv4_addr_needs_anonymization(&msg->siaddr)) {
-                zprintf(f, ",\"siaddr\":\"%s\"", addr_get_anon_hexstring(&msg->siaddr));
+                zprintf(f, ",\"siaddr\":\"%s\"", addr_get_anon_hexstring(&msg->siaddr, NULL, anon_hex));
             } else {
                 inet_ntop(AF_INET, &msg->siaddr, ipv4_addr, INET_ADDRSTRLEN);
                 zprintf(f, ",\"siaddr\":\"%s\"", ipv4_addr);
             }
             if (ipv4_addr_needs_anonymization(&msg->giaddr)) {
-                zprintf(f, ",\"giaddr\":\"%s\"", addr_get_anon_hexstring(&msg->giaddr));
+                zprintf(f, ",\"giaddr\":\"%s\"", addr_get_anon_hexstring(&msg->giaddr, NULL, anon_hex));
             } else {
                 inet_ntop(AF_INET, &msg->giaddr, ipv4_addr, INET_ADDRSTRLEN);
                 zprintf(f, ",\"giaddr\":\"%s\"", ipv4_addr);
@@ -544,6 +529,9 @@ void dhcp_print_json(const dhcp_t *d1,
     }
 }
 
+/* the JSON of dhcp is carried as text in CBOR output */
+define_print_text(dhcp)
+
 /**
  * \brief Skip over the L1/L2/L3 header of packet containing DHCP data.
  *
@@ -755,6 +743,7 @@ static int dhcp_test_message_equality(dhcp_message_t *m1,
  */
 static int dhcp_test_vanilla_parsing() {
     dhcp_t *d = NULL;
+    joy_arena_t arena;
     pcap_t *pcap_handle = NULL;
     struct pcap_pkthdr header;
     const unsigned char *pkt_ptr = NULL;
@@ -768,8 +757,9 @@ static int dhcp_test_vanilla_parsing() {
     unsigned char kat_chaddr[] = {0x08, 0x00, 0x27, 0x83, 0xf4, 0x42, 0x00, 0x00,
                                   0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
 
-    dhcp_init(&d);
-    dhcp_init(&known_dhcp);
+    memset(&arena, 0, sizeof(arena));
+    dhcp_init(&d, &arena);
+    dhcp_init(&known_dhcp, &arena);
 
     /*
      * Known answers
@@ -792,7 +782,7 @@ static int dhcp_test_vanilla_parsing() {
     msg->giaddr.s_addr = ntohl(0x00000000);
     memcpy(msg->chaddr, kat_chaddr, MAX_DHCP_CHADDR);
 
-    msg->file = calloc(1, MAX_DHCP_FILE);
+    msg->file = joy_arena_calloc(known_dhcp->arena, MAX_DHCP_FILE);
     if (!msg->file) {
 	joy_log_err("malloc failed");
 	num_fails++;
@@ -820,7 +810,7 @@ static int dhcp_test_vanilla_parsing() {
         msg->options[0].len = opt_len;
         msg->options_length += 1;
 
-        dhcp_get_option_value(&msg->options[0], opt_len, opt_val_0);
+        dhcp_get_option_value(known_dhcp->arena, &msg->options[0], opt_len, opt_val_0);
 
         msg->options_length += opt_len;
         msg->options_count += 1;
@@ -833,7 +823,7 @@ static int dhcp_test_vanilla_parsing() {
         msg->options[1].len = opt_len;
         msg->options_length += 1;
 
-        dhcp_get_option_value(&msg->options[1], opt_len, opt_val_1);
+        dhcp_get_option_value(known_dhcp->arena, &msg->options[1], opt_len, opt_val_1);
 
         msg->options_length += opt_len;
         msg->options_count += 1;
@@ -846,7 +836,7 @@ static int dhcp_test_vanilla_parsing() {
         msg->options[2].len = opt_len;
         msg->options_length += 1;
 
-        dhcp_get_option_value(&msg->options[2], opt_len, opt_val_2);
+        dhcp_get_option_value(known_dhcp->arena, &msg->options[2], opt_len, opt_val_2);
 
         msg->options_length += opt_len;
         msg->options_count += 1;
@@ -859,7 +849,7 @@ static int dhcp_test_vanilla_parsing() {
         msg->options[3].len = opt_len;
         msg->options_length += 1;
 
-        dhcp_get_option_value(&msg->options[3], opt_len, opt_val_3);
+        dhcp_get_option_value(known_dhcp->arena, &msg->options[3], opt_len, opt_val_3);
 
         msg->options_length += opt_len;
         msg->options_count += 1;
@@ -872,7 +862,7 @@ static int dhcp_test_vanilla_parsing() {
         msg->options[4].len = opt_len;
         msg->options_length += 1;
 
-        dhcp_get_option_value(&msg->options[4], opt_len, opt_val_4);
+        dhcp_get_option_value(known_dhcp->arena, &msg->options[4], opt_len, opt_val_4);
 
         msg->options_length += opt_len;
         msg->options_count += 1;
@@ -885,7 +875,7 @@ static int dhcp_test_vanilla_parsing() {
         msg->options[5].len = opt_len;
         msg->options_length += 1;
 
-        dhcp_get_option_value(&msg->options[5], opt_len, opt_val_5);
+        dhcp_get_option_value(known_dhcp->arena, &msg->options[5], opt_len, opt_val_5);
 
         msg->options_length += opt_len;
         msg->options_count += 1;
@@ -898,7 +888,7 @@ static int dhcp_test_vanilla_parsing() {
         msg->options[6].len = opt_len;
         msg->options_length += 1;
 
-        dhcp_get_option_value(&msg->options[6], opt_len, opt_val_6);
+        dhcp_get_option_value(known_dhcp->arena, &msg->options[6], opt_len, opt_val_6);
 
         msg->options_length += opt_len;
         msg->options_count += 1;
@@ -936,6 +926,7 @@ end:
     }
     dhcp_delete(&d);
     dhcp_delete(&known_dhcp);
+    joy_arena_release(&arena);
 
     return num_fails;
 }
@@ -409,8 +409,12 @@ static inline char printable(char c) {
     return '*';
 }
 
-static enum dns_err dns_header_parse_name (const dns_hdr *hdr, char **name, int *len, 
-                                           char *outname, unsigned int outname_len) {
+/** limit on the number of offsets followed in one name */
+#define MAX_DNS_NAME_JUMPS 64
+
+static enum dns_err dns_header_parse_name_r (const dns_hdr *hdr, char **name, int *len, 
+                                             char *outname, unsigned int outname_len,
+                                             unsigned int jumps) {
     char *terminus = outname + outname_len;
     char *c = *name;
     unsigned char jump;
@@ -449,6 +453,9 @@ static enum dns_err dns_header_parse_name (const dns_hdr *hdr, char **name, int
                     return dns_ok;  /* got NULL label       */
                 }
                 jump = *c + 1;
+                if (jump > terminus - outname - 1) {
+                    return dns_err_label_too_long;  /* no room for label and NULL */
+                }
                 /* 
                  * make (printable) copy of string
                  */
@@ -467,13 +474,17 @@ static enum dns_err dns_header_parse_name (const dns_hdr *hdr, char **name, int
         } else if (char_is_offset(*c)) {
             uint16_t *offset;
 
+            if (jumps >= MAX_DNS_NAME_JUMPS) {
+                return dns_err_offset_too_long;  /* offset loop */
+            }
             err = uint16_parse(&offset, name, len);
             if (err != dns_ok) {
                 return dns_err_offset_too_long;
             }
             offsetname = (const void *)((char *)hdr + (ntohs(*offset) & 0x3FFF));
             offsetlen -= (ntohs(*offset) & 0x3FFF);
-            return dns_header_parse_name(hdr, (void *)&offsetname, &offsetlen, outname, outname_len);
+            return dns_header_parse_name_r(hdr, (void *)&offsetname, &offsetlen,
+                                           outname, outname_len, jumps + 1);
         } else {
             return dns_err_label_malformed;
         }
@@ -481,38 +492,193 @@ static enum dns_err dns_header_parse_name (const dns_hdr *hdr, char **name, int
     return dns_err_unterminated;
 }
 
+static enum dns_err dns_header_parse_name (const dns_hdr *hdr, char **name, int *len, 
+                                           char *outname, unsigned int outname_len) {
+    return dns_header_parse_name_r(hdr, name, len, outname, outname_len, 0);
+}
+
 /*
- * dns_rdata_print(rh, rr, r, len, output) prints the RDATA field at
- * location *r
- *
- * note: if this function returns a value other than dns_ok, then it
- * has not printed any output; this fact is important to ensure
- * correct JSON formatting
+ * A DNS message is parsed when it arrives, into a dns_message and its
+ * dns_answers; these hold just what the JSON output needs.  Names are
+ * kept once per flow, in the name pool of the dns_t.
+ */
+
+/** no name, as an offset into the name pool */
+#define DNS_NO_NAME UINT32_MAX
+
+/** initial number of slots in the table of names */
+#define DNS_NAME_BUCKETS_MIN 16
+
+/** what an answer holds */
+enum dns_answer_kind {
+    dns_answer_a     = 0, /*!< IPv4 address        */
+    dns_answer_soa   = 1, /*!< name                */
+    dns_answer_ptr   = 2, /*!< name                */
+    dns_answer_cname = 3, /*!< name                */
+    dns_answer_txt   = 4, /*!< not yet implemented */
+    dns_answer_other = 5  /*!< type, class and rdlength only */
+};
+
+/** one answer resource record */
+struct dns_answer {
+    uint8_t kind;
+    uint32_t ttl;
+    union {
+        struct in_addr addr;
+        uint32_t name;
+        struct {
+            uint16_t type;
+            uint16_t class;
+            uint16_t rdlength;       /*!< as on the wire */
+        } other;
+    } u;
+};
+
+/** where the parsing of a message stopped */
+enum dns_message_status {
+    dns_msg_ok           = 0,
+    dns_msg_bad_qdcount  = 1,
+    dns_msg_bad_qname    = 2,
+    dns_msg_bad_question = 3,
+    dns_msg_bad_rr_name  = 4,
+    dns_msg_bad_rr       = 5,
+    dns_msg_bad_rdata    = 6
+};
+
+/** one DNS message */
+struct dns_message {
+    char qr;                  /*!< 'q' for query, 'r' for response */
+    uint8_t rcode;
+    uint8_t status;           /*!< enum dns_message_status */
+    uint8_t err;              /*!< enum dns_err, if malformed */
+    int len;                  /*!< bytes left, if malformed */
+    uint16_t count;           /*!< qdcount or ancount, if malformed */
+    char data[4];             /*!< data at the bad rr name */
+    uint32_t qname;           /*!< question name, or DNS_NO_NAME */
+    uint16_t qtype;           /*!< question type, in host order */
+    unsigned int rr_first;    /*!< index of first answer in dns_t */
+    unsigned int rr_count;    /*!< number of answers */
+};
+
+/* grow an array, allocated from arena, to hold at least need elements */
+static int dns_grow (joy_arena_t *arena, void **array, unsigned int *size,
+                     unsigned int need, size_t elem_size) {
+    unsigned int new_size = *size ? *size : 4;
+    void *tmp;
+
+    if (need <= *size) {
+        return 0;
+    }
+    while (new_size < need) {
+        new_size *= 2;
+    }
+    tmp = joy_arena_realloc(arena, *array, *size * elem_size, new_size * elem_size);
+    if (tmp == NULL) {
+        joy_log_err("realloc failed");
+        return 1;
+    }
+    *array = tmp;
+    *size = new_size;
+    return 0;
+}
+
+/* FNV-1a hash of a name */
+static uint32_t dns_name_hash (const char *name) {
+    uint32_t h = 2166136261u;
+
+    while (*name) {
+        h ^= (unsigned char)*name++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/*
+ * double the table of name offsets, which is open addressed and kept
+ * at most half full; the old table is left in the arena
+ */
+static int dns_name_table_grow (dns_t *dns) {
+    unsigned int n = dns->name_buckets ? dns->name_buckets * 2 : DNS_NAME_BUCKETS_MIN;
+    uint32_t *t = joy_arena_alloc(dns->arena, n * sizeof(uint32_t));
+    unsigned int i, b;
+
+    if (t == NULL) {
+        joy_log_err("malloc failed");
+        return 1;
+    }
+    for (i = 0; i < n; i++) {
+        t[i] = DNS_NO_NAME;
+    }
+    for (i = 0; i < dns->name_buckets; i++) {
+        if (dns->name_table[i] == DNS_NO_NAME) {
+            continue;
+        }
+        b = dns_name_hash(dns->names + dns->name_table[i]) & (n - 1);
+        while (t[b] != DNS_NO_NAME) {
+            b = (b + 1) & (n - 1);
+        }
+        t[b] = dns->name_table[i];
+    }
+    dns->name_table = t;
+    dns->name_buckets = n;
+    return 0;
+}
+
+/* add a name to the pool, or find it there */
+static uint32_t dns_name_intern (dns_t *dns, const char *name) {
+    size_t len = strlen(name) + 1;
+    uint32_t offset;
+    unsigned int b;
+
+    if ((dns->name_count + 1) * 2 > dns->name_buckets && dns_name_table_grow(dns)) {
+        return DNS_NO_NAME;
+    }
+    b = dns_name_hash(name) & (dns->name_buckets - 1);
+    while (dns->name_table[b] != DNS_NO_NAME) {
+        if (strcmp(dns->names + dns->name_table[b], name) == 0) {
+            return dns->name_table[b];
+        }
+        b = (b + 1) & (dns->name_buckets - 1);
+    }
+
+    if (dns_grow(dns->arena, (void **)&dns->names, &dns->names_size, dns->names_len + len, 1)) {
+        return DNS_NO_NAME;
+    }
+    offset = dns->names_len;
+    memcpy(dns->names + offset, name, len);
+    dns->names_len += len;
+    dns->name_table[b] = offset;
+    dns->name_count++;
+    return offset;
+}
+
+static const char *dns_name_get (const dns_t *dns, uint32_t name) {
+    return (name == DNS_NO_NAME) ? "" : dns->names + name;
+}
+
+/*
+ * dns_rdata_parse(dns, rh, rr, r, len, a) parses the RDATA field at
+ * location *r into the answer a
  */
 static enum dns_err
-dns_rdata_print (const dns_hdr *rh, const dns_rr *rr, char **r, int *len, zfile output) {
+dns_rdata_parse (dns_t *dns, const dns_hdr *rh, const dns_rr *rr, char **r, int *len,
+                 struct dns_answer *a) {
     enum dns_err err;
     uint16_t class = ntohs(rr->class);
     uint16_t type = ntohs(rr->type);
     char name[256];
-    char ipv4_addr[INET_ADDRSTRLEN];
 
     if (class == class_IN) {    
         if (type == type_A) {
-            const struct in_addr *addr;;
+            const struct in_addr *addr;
       
             err = dns_addr_parse(&addr, r, len, ntohs(rr->rdlength));
             if (err != dns_ok) {
                 return err;
             }
-            if (ipv4_addr_needs_anonymization(addr)) {
-                zprintf(output, "\"a\":\"%s\"", addr_get_anon_hexstring(addr));
-            } else {
-                inet_ntop(AF_INET, addr, ipv4_addr, INET_ADDRSTRLEN);
-                zprintf(output, "\"a\":\"%s\"", ipv4_addr);
-            }
+            a->kind = dns_answer_a;
+            memcpy(&a->u.addr, addr, sizeof(struct in_addr));
         } else if (type == type_SOA  || type == type_PTR || type == type_CNAME) {
-            char *typename;
 
             err = dns_header_parse_name(rh, r, len, name, sizeof(name)); /* note: does not check rdlength */
             if (err != dns_ok) { 
@@ -520,81 +686,132 @@ dns_rdata_print (const dns_hdr *rh, const dns_rr *rr, char **r, int *len, zfile
             }
 
             if (type == type_SOA) {
-                typename = "soa";
+                a->kind = dns_answer_soa;
             } else if (type == type_PTR) {
-                typename = "ptr";
+                a->kind = dns_answer_ptr;
             } else {
-                typename = "cname";
+                a->kind = dns_answer_cname;
             }
-            zprintf(output, "\"%s\":\"%s\"", typename, name + 1);
+            a->u.name = dns_name_intern(dns, name + 1);
       
         } else if (type == type_TXT) {
-            zprintf(output, "\"txt\":\"%s\"", "NYI");
+            a->kind = dns_answer_txt;
 
         } else {
             err = data_advance(r, len, ntohs(rr->rdlength));
             if (err != dns_ok) {
                 return err;
             }
-            zprintf(output, "\"type\":\"%x\",\"class\":\"%x\",\"rdlength\":%u", type, class, rr->rdlength);
-      
             /*
              * several DNS types are not explicitly supported here, and more
              * types may be added in the future, if deemed important.  see
              * http://www.iana.org/assignments/dns-parameters/dns-parameters.xhtml#dns-parameters-4
              */
+            a->kind = dns_answer_other;
+            a->u.other.type = type;
+            a->u.other.class = class;
+            a->u.other.rdlength = rr->rdlength;
         }
     } else {
         err = data_advance(r, len, ntohs(rr->rdlength));
         if (err != dns_ok) {
             return err;
         }
-        zprintf(output, "\"type\":\"%x\",\"class\":\"%x\",\"rdlength\":%u", type, class, rr->rdlength);
+        a->kind = dns_answer_other;
+        a->u.other.type = type;
+        a->u.other.class = class;
+        a->u.other.rdlength = rr->rdlength;
     }
     return dns_ok;
 }
 
-#if 0
-static joy_status_e process_dns (const struct pcap_pkthdr *h, const void *start, int len, flow_record_t *r) {
-    // const char *name = start + 13;
-    // unsigned char rcode = *((unsigned char *)(start + 3)) & 0x0f;
-    // unsigned char qr = *((unsigned char *)(start + 2)) >> 7;
+/*
+ * dns_rdata_print(dns, a, e) prints an answer
+ */
+static void dns_rdata_print (const dns_t *dns, const struct dns_answer *a, emitter_t *e) {
+    char ipv4_addr[INET_ADDRSTRLEN];
+    char anon_hex[ANON_HEXSTRING_LEN];
+    char hex[16];
+    const char *name;
+
+    switch (a->kind) {
+    case dns_answer_a:
+        if (ipv4_addr_needs_anonymization(&a->u.addr)) {
+            addr_get_anon_hexstring(&a->u.addr, NULL, anon_hex);
+            emit_string(e, "a", anon_hex, strlen(anon_hex));
+        } else {
+            inet_ntop(AF_INET, &a->u.addr, ipv4_addr, INET_ADDRSTRLEN);
+            emit_string(e, "a", ipv4_addr, strlen(ipv4_addr));
+        }
+        break;
+    case dns_answer_soa:
+        name = dns_name_get(dns, a->u.name);
+        emit_string(e, "soa", name, strlen(name));
+        break;
+    case dns_answer_ptr:
+        name = dns_name_get(dns, a->u.name);
+        emit_string(e, "ptr", name, strlen(name));
+        break;
+    case dns_answer_cname:
+        name = dns_name_get(dns, a->u.name);
+        emit_string(e, "cname", name, strlen(name));
+        break;
+    case dns_answer_txt:
+        emit_string(e, "txt", "NYI", 3);
+        break;
+    default:
+        emit_string(e, "type", hex, snprintf(hex, sizeof(hex), "%x", a->u.other.type));
+        emit_string(e, "class", hex, snprintf(hex, sizeof(hex), "%x", a->u.other.class));
+        emit_uint(e, "rdlength", a->u.other.rdlength);
+        break;
+    }
+}
 
-    if (r->op >= NUM_PKT_LEN) {
-        return failure;  /* no more room */
-    }  
+/* add the next answer of the message m */
+static struct dns_answer *dns_answer_add (dns_t *dns, struct dns_message *m) {
+    struct dns_answer *a;
 
-    if (len < 13) {
-        return failure;  /* not long enough to be a proper DNS packet */
+    if (dns_grow(dns->arena, (void **)&dns->rr, &dns->rr_size, dns->rr_count + 1, sizeof(struct dns_answer))) {
+        return NULL;
     }
+    a = &dns->rr[dns->rr_count++];
+    memset(a, 0, sizeof(struct dns_answer));
+    m->rr_count++;
+    return a;
+}
 
-    // printf("dns len: %u name: %s qr: %u rcode: %u\n", len-14, name, qr, rcode);
-    if (!r->dns.dns_name[r->op]) {
-        r->dns.dns_name[r->op] = malloc(len);
-        if (r->dns.dns_name[r->op] == NULL) {
-            return failure;
-        }
-        // strncpy(r->dns_name[r->op], name, len-13);
-        memcpy(r->dns.dns_name[r->op], start, len);
-        // dns_query_to_string(r->dns_name[r->op] + 13, len-13);
+/*
+ * dns_avail(len, r, end) returns len, limited to the bytes left before end
+ *
+ * note: len is not reduced when rdata is read, so it can run past the
+ * end of the message; reads are held to the message with this limit
+ */
+static inline int dns_avail (int len, const char *r, const char *end) {
+    if (len < 0 || r > end) {
+        return 0;
     }
-    return ok;
+    return (end - r < len) ? (int)(end - r) : len;
 }
-#endif
 
-
-static void dns_print_packet (char *dns_name, unsigned int pkt_len, zfile output) {
+/*
+ * dns_parse_packet(dns, pkt, pkt_len, m) parses a DNS message into m
+ *
+ * note: a malformed message is kept, along with the point at which
+ * parsing stopped, since that is reported
+ */
+static void dns_parse_packet (dns_t *dns, const char *pkt, unsigned int pkt_len,
+                              struct dns_message *m) {
     char name[256];
     enum dns_err err;
     char *r;
+    const char *end = pkt + pkt_len;
     const dns_hdr *rh;
     const dns_question *question;
     const dns_rr *rr;
     int len = 0;
-    char qr;
+    int avail, n;
     uint16_t qdcount, ancount;
     int rdlength;
-    unsigned comma = 0;
   
     /*
      * DNS packet format:
@@ -606,120 +823,200 @@ static void dns_print_packet (char *dns_name, unsigned int pkt_len, zfile output
      *                struct dns_rr
      *                rr_data   
      */
-    zprintf(output, "{");
+    memset(m, 0, sizeof(struct dns_message));
+    m->qname = DNS_NO_NAME;
+    m->rr_first = dns->rr_count;
 
-    if (pkt_len < sizeof(dns_hdr)) {
-      zprintf(output, "\"malformed\":%d", len);
-      return;
-    }
-    
     len = pkt_len;
-    r = dns_name;
+    r = (char *)pkt;
     rh = (const dns_hdr*)r;
     if (rh->qr == 0) {
-        qr = 'q';
+        m->qr = 'q';
     } else {
-        qr = 'r';
+        m->qr = 'r';
     }
+    m->rcode = rh->rcode;
     /* check length > 12 ! */
     len -= 12;
     r += 12;
   
     qdcount = ntohs(rh->qdcount);
     if (qdcount > 1) {
-        err = dns_err_too_many;
-        zprintf(output, "\"malformed\":%d", len);
-        zprintf_debug(output, "qdcount=%u; err=%u\"}", qdcount, err);
-      return;
+        m->status = dns_msg_bad_qdcount;
+        m->err = dns_err_too_many;
+        m->count = qdcount;
+        m->len = len;
+        return;
     }
     while (qdcount-- > 0) {
         /* parse question name and struct */
-        err = dns_header_parse_name(rh, &r, &len, name, sizeof(name));
+        avail = n = dns_avail(len, r, end);
+        err = dns_header_parse_name(rh, &r, &n, name, sizeof(name));
+        len -= avail - n;
         if (err != dns_ok) { 
-            zprintf(output, "\"malformed\":%d", len);
-            zprintf_debug(output, "question name err=%u; len=%u\"}]}", err, len);
+            m->status = dns_msg_bad_qname;
+            m->err = err;
+            m->len = len;
             return;
         }
-        err = dns_question_parse(&question, &r, &len);
+        avail = n = dns_avail(len, r, end);
+        err = dns_question_parse(&question, &r, &n);
+        len -= avail - n;
         if (err != dns_ok) {
-            zprintf(output, "\"malformed\":%d", len);
-            zprintf_debug(output, "question err=%u; len=%u\"]}]", err, len);
+            m->status = dns_msg_bad_question;
+            m->err = err;
+            m->len = len;
             return;
         }
-        zprintf(output, "\"%cn\":\"%s\",", qr, name + 1);
+        m->qname = dns_name_intern(dns, name + 1);
+        m->qtype = ntohs(question->qtype);
     }
-    zprintf(output, "\"rc\":%u,\"rr\":[", rh->rcode);
 
     ancount = ntohs(rh->ancount); 
-    comma = 0;
     while (ancount-- > 0) {
-        if (comma++) {
-            zprintf(output, ",");
-        }
-        zprintf(output, "{");
+        struct dns_answer *a;
+
         /* parse rr name, struct, and rdata */
-        err = dns_header_parse_name(rh, &r, &len, name, sizeof(name));
+        avail = n = dns_avail(len, r, end);
+        err = dns_header_parse_name(rh, &r, &n, name, sizeof(name));
+        len -= avail - n;
         if (err != dns_ok) { 
-            char *d = r;
-            zprintf(output, "\"malformed\":%d", len);
-            zprintf_debug(output, "rr name ancount=%u; err=%u; len=%u; data=0x%02x%02x%02x%02x\"}]}", ancount, err, len, d[0], d[1], d[2], d[3]);
+            int i;
+
+            m->status = dns_msg_bad_rr_name;
+            m->err = err;
+            m->len = len;
+            m->count = ancount;
+            for (i = 0; i < sizeof(m->data); i++) {
+                m->data[i] = (r >= pkt && r + i < end) ? r[i] : 0;
+            }
             return;
         }
-        // zprintf(output, "\"name\":\"%s\"", name);
-        err = dns_rr_parse(&rr, &r, &len, &rdlength);
+        avail = n = dns_avail(len, r, end);
+        err = dns_rr_parse(&rr, &r, &n, &rdlength);
+        len -= avail - n;
         if (err) {
-            zprintf(output, "\"malformed\":%d", len);
-            zprintf_debug(output, "rr ancount=%u; err=%u; len=%u\"}]}", ancount, err, len);
+            m->status = dns_msg_bad_rr;
+            m->err = err;
+            m->len = len;
+            m->count = ancount;
+            return;
+        }
+        a = dns_answer_add(dns, m);
+        if (a == NULL) {
             return;
         }
-        err = dns_rdata_print(rh, rr, &r, &rdlength, output);
+        avail = n = dns_avail(rdlength, r, end);
+        err = dns_rdata_parse(dns, rh, rr, &r, &n, a);
+        rdlength -= avail - n;
         if (err) {
-            zprintf(output, "\"malformed\":%d}]}", len);
+            /* the answer slot is not reported */
+            dns->rr_count--;
+            m->rr_count--;
+            m->status = dns_msg_bad_rdata;
+            m->err = err;
+            m->len = len;
             return;
         }
         len -= rdlength;
-        zprintf(output, ",\"ttl\":%u}", ntohl(rr->ttl));
+        a->ttl = ntohl(rr->ttl);
     }
-    zprintf(output, "]}");
-    return;
 }
 
-static void dns_printf (char * const dns_name[], const unsigned short pkt_len[], 
-                char * const twin_dns_name[], const unsigned short twin_pkt_len[], 
-                unsigned int count, zfile output) {
-    unsigned int i, j;
+/* the length at which parsing stopped, and the reason */
+static void dns_print_malformed (const struct dns_message *m, emitter_t *e) {
+    char debug[128];
+    int n = 0;
+
+    emit_int(e, "malformed", m->len);
+    switch (m->status) {
+    case dns_msg_bad_qdcount:
+        n = snprintf(debug, sizeof(debug), "qdcount=%u; err=%u", m->count, m->err);
+        break;
+    case dns_msg_bad_qname:
+        n = snprintf(debug, sizeof(debug), "question name err=%u; len=%u", m->err, m->len);
+        break;
+    case dns_msg_bad_question:
+        n = snprintf(debug, sizeof(debug), "question err=%u; len=%u", m->err, m->len);
+        break;
+    case dns_msg_bad_rr_name:
+        n = snprintf(debug, sizeof(debug), "rr name ancount=%u; err=%u; len=%u; data=0x%02x%02x%02x%02x",
+                     m->count, m->err, m->len, m->data[0], m->data[1], m->data[2], m->data[3]);
+        break;
+    case dns_msg_bad_rr:
+        n = snprintf(debug, sizeof(debug), "rr ancount=%u; err=%u; len=%u", m->count, m->err, m->len);
+        break;
+    default:
+        break;
+    }
+    if (n > 0) {
+        emit_string(e, "DEBUG", debug, (size_t)n < sizeof(debug) ? (size_t)n : sizeof(debug) - 1);
+    }
+}
 
-    zprintf(output, ",\"dns\":[");
+static void dns_print_packet (const dns_t *dns, const struct dns_message *m, emitter_t *e) {
+    char key[] = "?n";
+    const char *name;
+    unsigned int i;
+
+    emit_map_begin(e, NULL);
+
+    switch (m->status) {
+    case dns_msg_bad_qdcount:
+    case dns_msg_bad_qname:
+    case dns_msg_bad_question:
+        dns_print_malformed(m, e);
+        emit_map_end(e);
+        return;
+    default:
+        break;
+    }
+
+    if (m->qname != DNS_NO_NAME) {
+        key[0] = m->qr;
+        name = dns_name_get(dns, m->qname);
+        emit_string(e, key, name, strlen(name));
+    }
+    emit_uint(e, "rc", m->rcode);
+    emit_array_begin(e, "rr");
+
+    for (i = 0; i < m->rr_count; i++) {
+        const struct dns_answer *a = &dns->rr[m->rr_first + i];
+
+        emit_map_begin(e, NULL);
+        dns_rdata_print(dns, a, e);
+        emit_uint(e, "ttl", a->ttl);
+        emit_map_end(e);
+    }
+
+    if (m->status != dns_msg_ok) {
+        /* the answer at which parsing stopped */
+        emit_map_begin(e, NULL);
+        dns_print_malformed(m, e);
+        emit_map_end(e);
+    }
+    emit_array_end(e);
+    emit_map_end(e);
+}
+
+static void dns_printf (const dns_t *dns, const dns_t *twin, unsigned int count, emitter_t *e) {
+    unsigned int i;
+
+    emit_array_begin(e, "dns");
   
-    if (twin_dns_name) { /* bidirectional flow */
-        // dns_hdr *qh;
-    
-        i = j = 0;
-        while ((i < count) && (j < count)) {
-            if (dns_name[i]) {
-                // qh = (dns_hdr *)dns_name[i];
-            }
-            if (twin_dns_name[i]) {
-                if (i || j) {
-                    zprintf(output, ",");
-                }
-                dns_print_packet(twin_dns_name[i], twin_pkt_len[i], output);
-            } 
-            i++;
+    if (twin) { /* bidirectional flow */
+        /* queries are not printed, since the responses repeat the question */
+        for (i = 0; i < count && i < twin->pkt_count; i++) {
+            dns_print_packet(twin, &twin->msg[i], e);
         }
     
     } else { /* unidirectional flow, with no twin */
     
         for (i=0; i<count; i++) {
-            if (i) {
-                zprintf(output, ",");
-            }
-            if (dns_name[i]) {
-                dns_print_packet(dns_name[i], pkt_len[i], output);
-            }
+            dns_print_packet(dns, &dns->msg[i], e);
         }
     }
-    zprintf(output, "]");
+    emit_array_end(e);
 }
 
 /*
@@ -742,6 +1039,25 @@ void dns_unit_test () {
     char name2[MAX_DNS_NAME_LEN];
     void *c = &name;
     int len = 15;
+    /* response for www.orwell.ru: a CNAME, then an A record */
+    const unsigned char response[] = {
+        0x12, 0x34, 0x81, 0x80, 0x00, 0x01, 0x00, 0x02, 0x00, 0x00, 0x00, 0x00,
+        0x03, 0x77, 0x77, 0x77, 0x06, 0x6F, 0x72, 0x77, 0x65, 0x6C, 0x6C, 0x02,
+        0x72, 0x75, 0x00, 0x00, 0x01, 0x00, 0x01,
+        0xc0, 0x0c, 0x00, 0x05, 0x00, 0x01, 0x00, 0x00, 0x00, 0x3c, 0x00, 0x02,
+        0xc0, 0x10,
+        0xc0, 0x10, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00, 0x0e, 0x10, 0x00, 0x04,
+        0x0a, 0x01, 0x02, 0x03
+    };
+    const unsigned char loop[] = {
+        0x12, 0x34, 0x81, 0x80, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0xc0, 0x0c
+    };
+    dns_t *dns = NULL;
+    joy_arena_t arena;
+    uint32_t offset[100];
+    unsigned int i;
+    int num_fails = 0;
 
     assert(sizeof(dns_hdr) == 12);
     assert(sizeof(dns_question) == 4);
@@ -750,6 +1066,57 @@ void dns_unit_test () {
     err = dns_header_parse_name(&hdr, (char**)&c, &len, name2, sizeof(name2));
   
     printf("name: %s\tlen: %u\terr: %u\n", name2, len, err);
+
+    memset(&arena, 0, sizeof(arena));
+    dns_init(&dns, &arena);
+    if (dns == NULL) {
+        return;
+    }
+    dns_update(dns, NULL, response, sizeof(response), 1);
+    dns_update(dns, NULL, response, sizeof(response), 1);
+    dns_update(dns, NULL, loop, sizeof(loop), 1);
+
+    if (dns->pkt_count != 3 || dns->rr_count != 4) {
+        printf("error: dns messages not parsed\n");
+        num_fails++;
+    } else {
+        const struct dns_message *m = &dns->msg[0];
+
+        if (m->status != dns_msg_ok || m->qr != 'r' || m->rr_count != 2 ||
+            strcmp(dns_name_get(dns, m->qname), "www.orwell.ru") || m->qtype != type_A ||
+            dns->rr[1].kind != dns_answer_a || dns->rr[1].ttl != 3600) {
+            printf("error: dns response not parsed\n");
+            num_fails++;
+        }
+        if (strcmp(dns_name_get(dns, dns->rr[0].u.name), "orwell.ru") ||
+            dns->msg[1].qname != m->qname || dns->name_count != 2) {
+            printf("error: dns names not interned\n");
+            num_fails++;
+        }
+        if (dns->msg[2].status != dns_msg_bad_qname) {
+            printf("error: dns offset loop not caught\n");
+            num_fails++;
+        }
+    }
+
+    /* enough names to grow the name table; each is found again */
+    for (i = 0; i < 100; i++) {
+        snprintf(name2, sizeof(name2), "host%u.example", i);
+        offset[i] = dns_name_intern(dns, name2);
+    }
+    for (i = 0; i < 100; i++) {
+        snprintf(name2, sizeof(name2), "host%u.example", i);
+        if (offset[i] == DNS_NO_NAME || dns_name_intern(dns, name2) != offset[i] ||
+            strcmp(dns_name_get(dns, offset[i]), name2)) {
+            printf("error: dns name %s not found again\n", name2);
+            num_fails++;
+            break;
+        }
+    }
+    dns_delete(&dns);
+    joy_arena_release(&arena);
+
+    printf("dns unit test: %s\n", num_fails ? "failed" : "passed");
 }
 
 
@@ -757,10 +1124,11 @@ void dns_unit_test () {
  * \brief Initialize the memory of DNS struct.
  *
  * \param dns_handle contains dns structure to initialize
+ * \param arena arena of the flow record, backing the messages and names
  *
  * \return none
  */
-void dns_init (dns_t **dns_handle) {
+void dns_init (dns_t **dns_handle, joy_arena_t *arena) {
     if (*dns_handle != NULL) {
         dns_delete(dns_handle);
     }
@@ -771,6 +1139,7 @@ void dns_init (dns_t **dns_handle) {
         joy_log_err("malloc failed");
         return;
     }
+    (*dns_handle)->arena = arena;
 }
 
 /**
@@ -781,19 +1150,12 @@ void dns_init (dns_t **dns_handle) {
  * \return none
  */
 void dns_delete (dns_t **dns_handle) {
-    unsigned int i;
     dns_t *dns = *dns_handle;
 
     if (dns == NULL) {
         return;
     }
 
-    for (i=0; i<dns->pkt_count; i++) {
-        if (dns->dns_name[i]) {
-            free(dns->dns_name[i]);
-        }
-    }
-
     /* Free the memory and set to NULL */
     free(dns);
     *dns_handle = NULL;
@@ -813,9 +1175,6 @@ void dns_delete (dns_t **dns_handle) {
  * \return none
  */
 void dns_update (dns_t *dns, const struct pcap_pkthdr *header, const void *start, unsigned int len, unsigned int report_dns) {
-    // const char *name = start + 13;
-    // unsigned char rcode = *((unsigned char *)(start + 3)) & 0x0f;
-    // unsigned char qr = *((unsigned char *)(start + 2)) >> 7;
 
     if (report_dns == 0) {
         return;  /* we are not configured to report DNS information */
@@ -829,48 +1188,46 @@ void dns_update (dns_t *dns, const struct pcap_pkthdr *header, const void *start
         return;  /* not long enough to be a proper DNS packet */
     }
 
-    // printf("dns len: %u name: %s qr: %u rcode: %u\n", len-14, name, qr, rcode);
-    if (!dns->dns_name[dns->pkt_count]) {
-        dns->dns_name[dns->pkt_count] = malloc(len);
-        if (dns->dns_name[dns->pkt_count] == NULL) {
-            return; /* failure */
-        }
-        // strncpy(r->dns_name[dns->pkt_count], name, len-13);
-        memcpy(dns->dns_name[dns->pkt_count], start, len);
-        dns->pkt_len[dns->pkt_count] = len;
-        dns->pkt_count++;
-        // dns_query_to_string(r->dns_name[dns->pkt_count] + 13, len-13);
+    if (dns_grow(dns->arena, (void **)&dns->msg, &dns->msg_size, dns->pkt_count + 1, sizeof(struct dns_message))) {
+        return; /* failure */
     }
+    dns_parse_packet(dns, start, len, &dns->msg[dns->pkt_count]);
+    dns->pkt_count++;
 
     return;  /* ok */
 }
 
 /**
- * \fn void dns_print_json (const dns_t *dns1, const dns_t *dns2, zfile f)
+ * \fn void dns_print (const dns_t *dns1, const dns_t *dns2, emitter_t *e)
  * \param dns1 pointer to DNS structure
  * \param dn2 pointer to DNS structure
- * \param f output file
+ * \param e emitter that the output goes to
  * \return none
  */
-void dns_print_json (const dns_t *dns1, const dns_t *dns2, zfile f) {
+void dns_print (const dns_t *dns1, const dns_t *dns2, emitter_t *e) {
     unsigned int count;
-    char * const *twin_dns_name = NULL;
-    const unsigned short *twin_pkt_len = NULL;
   
     count = dns1->pkt_count > MAX_NUM_DNS_PKT ? MAX_NUM_DNS_PKT : dns1->pkt_count;
     if (dns2) {
         count = dns2->pkt_count > count ? dns2->pkt_count : count;
-        twin_dns_name = dns2->dns_name;
-        twin_pkt_len = dns2->pkt_len;
     }
 
     if (count == 0) {
         return;  /* no DNS data to report */
     }
  
-    dns_printf(dns1->dns_name, dns1->pkt_len, twin_dns_name, twin_pkt_len, count, f);  
+    dns_printf(dns1, dns2, count, e);  
 }
 
+/**
+ * \fn void dns_print_json (const dns_t *dns1, const dns_t *dns2, zfile f)
+ * \param dns1 pointer to DNS structure
+ * \param dn2 pointer to DNS structure
+ * \param f output file
+ * \return none
+ */
+define_print_json(dns)
+
 
 /*
  * END of dns feature functions
@@ -0,0 +1,435 @@
+/*
+ *
+ * Copyright (c) 2018 Cisco Systems, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ *
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file emitter.c
+ *
+ * \brief Format-agnostic output of the feature modules, as JSON or
+ *        as CBOR
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "emitter.h"
+#include "cbor_output.h"
+
+/**
+ * \fn void emit_open (emitter_t *e, zfile f, emit_format_e format, zfile text)
+ * \brief Start writing to \p f; in CBOR, this starts the array of
+ *        parts, which emit_close() ends.
+ * \param e emitter
+ * \param f output file
+ * \param format emit_json or emit_cbor
+ * \param text memory zfile (see zopen_memory()) used by a CBOR
+ *        emitter for JSON text and strings; NULL for JSON
+ * \return none
+ */
+void emit_open (emitter_t *e, zfile f, emit_format_e format, zfile text) {
+    memset(e, 0, sizeof(emitter_t));
+    e->f = f;
+    e->text = text;
+    e->format = format;
+    if (format == emit_cbor) {
+        zmemory_clear(text);
+        cbor_put_indefinite(f, CBOR_ARRAY);
+    }
+}
+
+/* CBOR: end the map part that is open, if any */
+static void emit_end_part (emitter_t *e) {
+    if (e->in_map) {
+        cbor_put_simple(e->f, CBOR_INDEFINITE);
+        e->in_map = 0;
+    }
+}
+
+/* CBOR: write the JSON text waiting in e->text as a part */
+static void emit_flush_text (emitter_t *e) {
+    const char *s;
+    size_t len;
+
+    s = zmemory(e->text, &len);
+    if (s != NULL && len) {
+        emit_end_part(e);
+        cbor_put_text(e->f, s, len);
+        zmemory_clear(e->text);
+    }
+}
+
+/**
+ * \fn void emit_close (emitter_t *e)
+ * \brief Finish the output of \p e.
+ * \param e emitter
+ * \return none
+ */
+void emit_close (emitter_t *e) {
+    if (e->format == emit_cbor) {
+        emit_flush_text(e);
+        emit_end_part(e);
+        cbor_put_simple(e->f, CBOR_INDEFINITE);
+    }
+}
+
+/**
+ * \fn zfile emit_text (emitter_t *e)
+ * \brief Return the zfile that JSON text is written to, for output
+ *        that has not been converted to the emitter.  The text must
+ *        be a sequence of members of the flow object, each preceded
+ *        by a comma, and may only be written at the top level.
+ * \param e emitter
+ * \return the zfile
+ */
+zfile emit_text (emitter_t *e) {
+    if (e->format == emit_json) {
+        return e->f;
+    }
+    emit_end_part(e);
+    return e->text;
+}
+
+/* the separator and key that come before a value */
+static void emit_item (emitter_t *e, const char *key, size_t len) {
+    unsigned int d = e->depth < EMIT_MAX_DEPTH ? e->depth : EMIT_MAX_DEPTH;
+
+    if (e->keyed) {
+        e->keyed = 0;
+        return;
+    }
+    if (e->format == emit_json) {
+        if (d && e->first[d]) {
+            e->first[d] = 0;
+        } else {
+            zputc(e->f, ',');
+        }
+        if (key != NULL) {
+            zputc(e->f, '"');
+            zwrite(e->f, key, len);
+            zwrite(e->f, "\":", 2);
+        }
+    } else {
+        if (e->depth == 0) {
+            emit_flush_text(e);
+            if (!e->in_map) {
+                cbor_put_indefinite(e->f, CBOR_MAP);
+                e->in_map = 1;
+            }
+        }
+        if (key != NULL) {
+            cbor_put_text(e->f, key, len);
+        }
+    }
+}
+
+/**
+ * \fn void emit_key (emitter_t *e, const char *key, size_t len)
+ * \brief Write a key that is not NULL-terminated; the value that
+ *        follows is written with a NULL key.
+ * \param e emitter
+ * \param key the key
+ * \param len its length
+ * \return none
+ */
+void emit_key (emitter_t *e, const char *key, size_t len) {
+    emit_item(e, key, len);
+    e->keyed = 1;
+}
+
+static void emit_begin (emitter_t *e, const char *key, unsigned int major) {
+    emit_item(e, key, key ? strlen(key) : 0);
+    if (e->format == emit_json) {
+        zputc(e->f, major == CBOR_MAP ? '{' : '[');
+    } else {
+        cbor_put_indefinite(e->f, major);
+    }
+    e->depth++;
+    if (e->depth <= EMIT_MAX_DEPTH) {
+        e->first[e->depth] = 1;
+    }
+}
+
+static void emit_end (emitter_t *e, unsigned int major) {
+    e->depth--;
+    if (e->format == emit_json) {
+        zputc(e->f, major == CBOR_MAP ? '}' : ']');
+    } else {
+        cbor_put_simple(e->f, CBOR_INDEFINITE);
+    }
+}
+
+/**
+ * \fn void emit_map_begin (emitter_t *e, const char *key)
+ * \brief Start a map, as the member \p key of the map that holds it,
+ *        or as an element of an array if \p key is NULL.
+ * \param e emitter
+ * \param key the key, or NULL
+ * \return none
+ */
+void emit_map_begin (emitter_t *e, const char *key) {
+    emit_begin(e, key, CBOR_MAP);
+}
+
+/**
+ * \fn void emit_map_end (emitter_t *e)
+ * \brief End the map started by emit_map_begin().
+ * \param e emitter
+ * \return none
+ */
+void emit_map_end (emitter_t *e) {
+    emit_end(e, CBOR_MAP);
+}
+
+/**
+ * \fn void emit_array_begin (emitter_t *e, const char *key)
+ * \brief Start an array; see emit_map_begin().
+ * \param e emitter
+ * \param key the key, or NULL
+ * \return none
+ */
+void emit_array_begin (emitter_t *e, const char *key) {
+    emit_begin(e, key, CBOR_ARRAY);
+}
+
+/**
+ * \fn void emit_array_end (emitter_t *e)
+ * \brief End the array started by emit_array_begin().
+ * \param e emitter
+ * \return none
+ */
+void emit_array_end (emitter_t *e) {
+    emit_end(e, CBOR_ARRAY);
+}
+
+/**
+ * \fn void emit_uint (emitter_t *e, const char *key, uint64_t value)
+ * \brief Write an unsigned integer.
+ * \param e emitter
+ * \param key the key, or NULL in an array
+ * \param value the value
+ * \return none
+ */
+void emit_uint (emitter_t *e, const char *key, uint64_t value) {
+    emit_item(e, key, key ? strlen(key) : 0);
+    if (e->format == emit_json) {
+        zprint_uint(e->f, value);
+    } else {
+        cbor_put_uint(e->f, value);
+    }
+}
+
+/**
+ * \fn void emit_int (emitter_t *e, const char *key, int64_t value)
+ * \brief Write a signed integer.
+ * \param e emitter
+ * \param key the key, or NULL in an array
+ * \param value the value
+ * \return none
+ */
+void emit_int (emitter_t *e, const char *key, int64_t value) {
+    emit_item(e, key, key ? strlen(key) : 0);
+    if (e->format == emit_json) {
+        zprint_int(e->f, value);
+    } else if (value < 0) {
+        cbor_put_head(e->f, CBOR_NINT, (uint64_t)(-(value + 1)));
+    } else {
+        cbor_put_uint(e->f, (uint64_t)value);
+    }
+}
+
+/**
+ * \fn void emit_string (emitter_t *e, const char *key, const char *s, size_t len)
+ * \brief Write a string, as it is; the caller makes it fit for JSON.
+ * \param e emitter
+ * \param key the key, or NULL in an array
+ * \param s the string
+ * \param len its length
+ * \return none
+ */
+void emit_string (emitter_t *e, const char *key, const char *s, size_t len) {
+    emit_item(e, key, key ? strlen(key) : 0);
+    if (e->format == emit_json) {
+        zputc(e->f, '"');
+        zwrite(e->f, s, len);
+        zputc(e->f, '"');
+    } else {
+        cbor_put_text(e->f, s, len);
+    }
+}
+
+/**
+ * \fn void emit_hex (emitter_t *e, const char *key, const unsigned char *data, size_t len)
+ * \brief Write bytes: a hex string in JSON, a byte string in CBOR.
+ * \param e emitter
+ * \param key the key, or NULL in an array
+ * \param data the bytes
+ * \param len their number
+ * \return none
+ */
+void emit_hex (emitter_t *e, const char *key, const unsigned char *data, size_t len) {
+    emit_item(e, key, key ? strlen(key) : 0);
+    if (e->format == emit_json) {
+        zputc(e->f, '"');
+        zprint_hex(e->f, data, len);
+        zputc(e->f, '"');
+    } else {
+        cbor_put_bytes(e->f, data, len);
+    }
+}
+
+/**
+ * \fn zfile emit_string_begin (emitter_t *e, const char *key)
+ * \brief Start a string that is written piece by piece, for writers
+ *        that print to a zfile; emit_string_end() ends it.
+ * \param e emitter
+ * \param key the key, or NULL in an array
+ * \return the zfile that the string is written to
+ */
+zfile emit_string_begin (emitter_t *e, const char *key) {
+    emit_item(e, key, key ? strlen(key) : 0);
+    if (e->format == emit_json) {
+        zputc(e->f, '"');
+        return e->f;
+    }
+    return e->text;
+}
+
+/**
+ * \fn void emit_string_end (emitter_t *e)
+ * \brief End the string started by emit_string_begin().
+ * \param e emitter
+ * \return none
+ */
+void emit_string_end (emitter_t *e) {
+    const char *s;
+    size_t len;
+
+    if (e->format == emit_json) {
+        zputc(e->f, '"');
+        return;
+    }
+    s = zmemory(e->text, &len);
+    cbor_put_text(e->f, s, len);
+    zmemory_clear(e->text);
+}
+
+/* the members that emitter_unit_test() writes */
+static void emitter_test_members (emitter_t *e) {
+    static const unsigned char bytes[] = { 0x0a, 0xff };
+
+    zputs(emit_text(e), ",\"tcp\":{}");
+    emit_map_begin(e, "m");
+    emit_uint(e, "u", 24);
+    emit_int(e, "i", -2);
+    emit_key(e, "kx", 1);
+    emit_hex(e, NULL, bytes, sizeof(bytes));
+    emit_array_begin(e, "a");
+    emit_string(e, NULL, "s", 1);
+    emit_map_begin(e, NULL);
+    emit_map_end(e);
+    emit_array_end(e);
+    zputs(emit_string_begin(e, "p"), "ab");
+    emit_string_end(e);
+    emit_map_end(e);
+    emit_array_begin(e, "b");
+    emit_array_end(e);
+    zputs(emit_text(e), ",\"x\":1");
+}
+
+/**
+ * \fn int emitter_unit_test (void)
+ * \brief check the JSON and the CBOR written for the same members
+ * \return number of failures
+ */
+int emitter_unit_test (void) {
+    static const char json[] =
+        ",\"tcp\":{},\"m\":{\"u\":24,\"i\":-2,\"k\":\"0aff\",\"a\":[\"s\",{}],\"p\":\"ab\"},"
+        "\"b\":[],\"x\":1";
+    static const unsigned char cbor[] = {
+        0x9f,                                         /* the parts */
+        0x69, ',', '"', 't', 'c', 'p', '"', ':', '{', '}',
+        0xbf,                                         /* a map part */
+        0x61, 'm', 0xbf,
+        0x61, 'u', 0x18, 24,
+        0x61, 'i', 0x21,
+        0x61, 'k', 0x42, 0x0a, 0xff,
+        0x61, 'a', 0x9f, 0x61, 's', 0xbf, 0xff, 0xff,
+        0x61, 'p', 0x62, 'a', 'b',
+        0xff,
+        0x61, 'b', 0x9f, 0xff,
+        0xff,
+        0x66, ',', '"', 'x', '"', ':', '1',
+        0xff
+    };
+    emitter_t e;
+    zfile f, text;
+    const char *data;
+    size_t len;
+    int num_fails = 0;
+
+    f = zopen_memory();
+    text = zopen_memory();
+    if (f == NULL || text == NULL) {
+        fprintf(stderr, "emitter_unit_test: could not open a memory zfile\n");
+        if (f != NULL) {
+            zclose(f);
+        }
+        return 1;
+    }
+
+    emit_open(&e, f, emit_json, NULL);
+    emitter_test_members(&e);
+    emit_close(&e);
+    data = zmemory(f, &len);
+    if (len != strlen(json) || memcmp(data, json, len) != 0) {
+        fprintf(stderr, "emitter_unit_test: got JSON %.*s, expected %s\n", (int)len, data, json);
+        num_fails++;
+    }
+    zmemory_clear(f);
+
+    emit_open(&e, f, emit_cbor, text);
+    emitter_test_members(&e);
+    emit_close(&e);
+    data = zmemory(f, &len);
+    if (len != sizeof(cbor) || memcmp(data, cbor, len) != 0) {
+        fprintf(stderr, "emitter_unit_test: CBOR differs (%u bytes, expected %u)\n",
+                (unsigned int)len, (unsigned int)sizeof(cbor));
+        num_fails++;
+    }
+
+    zclose(f);
+    zclose(text);
+
+    return num_fails;
+}
@@ -0,0 +1,454 @@
+/*
+ *
+ * Copyright (c) 2018 Cisco Systems, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ *
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file ensemble.c
+ *
+ * \brief Tree ensemble (gradient boosted trees, random forest) inference
+ *
+ * Models trained offline (see analysis/model.py) are loaded from the
+ * compact binary format described in ensemble.h.  On loading, each
+ * tree is checked and laid out breadth first in one array of fixed
+ * size nodes, and its leaves are turned into nodes that lead back to
+ * themselves.  A flow then walks every tree for exactly the depth of
+ * that tree, choosing each child by indexing with the result of the
+ * comparison, so the walk has no data-dependent branches.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "ensemble.h"
+#include "config.h"
+#include "err.h"
+
+/*
+ * External objects, defined in joy.c
+ */
+extern FILE *info;
+
+#define ENSEMBLE_HEADER_LEN 28
+#define ENSEMBLE_NODE_LEN 16
+
+/** limit on the number of trees and of nodes in an ensemble */
+#define ENSEMBLE_MAX_NODES (1 << 24)
+
+/** marks a node that has not been reached yet while loading a tree */
+#define ENSEMBLE_UNSET 0xffffffff
+
+static uint32_t ensemble_get_u32 (const unsigned char *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static float ensemble_get_float (const unsigned char *p) {
+    uint32_t u = ensemble_get_u32(p);
+    float f;
+
+    memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+/*
+ * Lay out the tree of num_nodes file nodes at src into dst, breadth
+ * first, with node indices offset by base.  Checks that every child
+ * index is in the tree, that every node is reached exactly once, and
+ * that features are below num_features.  The scratch arrays hold
+ * num_nodes entries each.  Returns the depth of the tree, or -1 if
+ * it is malformed.
+ */
+static int ensemble_layout_tree (const unsigned char *src, uint32_t num_nodes,
+                                 uint32_t num_features, ensemble_node_t *dst, uint32_t base,
+                                 uint32_t *order, uint32_t *new_index, uint32_t *level) {
+    uint32_t head = 0, tail = 1;
+    uint32_t depth = 0;
+    uint32_t i, k, c;
+
+    for (i = 0; i < num_nodes; i++) {
+        new_index[i] = ENSEMBLE_UNSET;
+    }
+    order[0] = 0;
+    new_index[0] = 0;
+    level[0] = 0;
+
+    while (head < tail) {
+        const unsigned char *p;
+
+        k = order[head++];
+        p = src + k * ENSEMBLE_NODE_LEN;
+        if (ensemble_get_u32(p) == ENSEMBLE_LEAF) {
+            continue;
+        }
+        if (ensemble_get_u32(p) >= num_features) {
+            return -1;
+        }
+        for (i = 0; i < 2; i++) {
+            c = ensemble_get_u32(p + 8 + 4*i);
+            if (c >= num_nodes || new_index[c] != ENSEMBLE_UNSET) {
+                return -1;   /* outside of the tree, or reached twice */
+            }
+            level[c] = level[k] + 1;
+            if (level[c] > ENSEMBLE_MAX_DEPTH) {
+                return -1;
+            }
+            if (level[c] > depth) {
+                depth = level[c];
+            }
+            new_index[c] = tail;
+            order[tail++] = c;
+        }
+    }
+    if (tail != num_nodes) {
+        return -1;           /* some nodes cannot be reached */
+    }
+
+    for (i = 0; i < num_nodes; i++) {
+        const unsigned char *p = src + order[i] * ENSEMBLE_NODE_LEN;
+        ensemble_node_t *n = &dst[i];
+
+        n->threshold = ensemble_get_float(p + 4);
+        if (ensemble_get_u32(p) == ENSEMBLE_LEAF) {
+            n->feature = 0;
+            n->child[0] = n->child[1] = base + i;
+        } else {
+            n->feature = ensemble_get_u32(p);
+            n->child[0] = base + new_index[ensemble_get_u32(p + 8)];
+            n->child[1] = base + new_index[ensemble_get_u32(p + 12)];
+        }
+    }
+
+    return depth;
+}
+
+/**
+ * \fn ensemble_t *ensemble_parse (const unsigned char *buf, size_t len, uint32_t max_features)
+ * \brief load an ensemble from the contents of an ensemble file
+ * \param buf contents of the file
+ * \param len length of the file
+ * \param max_features number of features that the caller can provide
+ * \return the ensemble, to be freed with ensemble_free(), or NULL if
+ *         the contents are malformed
+ */
+ensemble_t *ensemble_parse (const unsigned char *buf, size_t len, uint32_t max_features) {
+    ensemble_t *e = NULL;
+    uint32_t *scratch = NULL;
+    const unsigned char *src;
+    uint32_t type, num_features, num_trees, num_nodes;
+    uint32_t t, size, base;
+    int depth;
+
+    if (len < ENSEMBLE_HEADER_LEN || memcmp(buf, ENSEMBLE_MAGIC, 4) != 0 ||
+        ensemble_get_u32(buf + 4) != ENSEMBLE_VERSION) {
+        joy_log_err("not an ensemble file of version %d", ENSEMBLE_VERSION);
+        return NULL;
+    }
+    type = ensemble_get_u32(buf + 8);
+    num_features = ensemble_get_u32(buf + 12);
+    num_trees = ensemble_get_u32(buf + 16);
+    num_nodes = ensemble_get_u32(buf + 20);
+    if (type > ENSEMBLE_FOREST || num_features == 0 || num_features > max_features ||
+        num_trees == 0 || num_nodes > ENSEMBLE_MAX_NODES || num_trees > num_nodes ||
+        len != ENSEMBLE_HEADER_LEN + 4 * (size_t)num_trees + ENSEMBLE_NODE_LEN * (size_t)num_nodes) {
+        joy_log_err("malformed ensemble header (type %u, %u features, %u trees, %u nodes, %lu bytes)",
+                    type, num_features, num_trees, num_nodes, (unsigned long)len);
+        return NULL;
+    }
+
+    e = malloc(sizeof(ensemble_t) + num_nodes * sizeof(ensemble_node_t) + 2 * num_trees * sizeof(uint32_t));
+    scratch = malloc(3 * num_nodes * sizeof(uint32_t));
+    if (e == NULL || scratch == NULL) {
+        joy_log_err("could not allocate memory for an ensemble of %u nodes", num_nodes);
+        free(e);
+        free(scratch);
+        return NULL;
+    }
+    e->type = (ensemble_type_e)type;
+    e->num_features = num_features;
+    e->num_trees = num_trees;
+    e->num_nodes = num_nodes;
+    e->base_score = ensemble_get_float(buf + 24);
+    e->node = (ensemble_node_t *)(e + 1);
+    e->root = (uint32_t *)(e->node + num_nodes);
+    e->depth = e->root + num_trees;
+
+    src = buf + ENSEMBLE_HEADER_LEN + 4 * num_trees;
+    base = 0;
+    for (t = 0; t < num_trees; t++) {
+        size = ensemble_get_u32(buf + ENSEMBLE_HEADER_LEN + 4*t);
+        if (size == 0 || size > num_nodes - base) {
+            depth = -1;
+        } else {
+            depth = ensemble_layout_tree(src + base * ENSEMBLE_NODE_LEN, size, num_features,
+                                         e->node + base, base,
+                                         scratch, scratch + num_nodes, scratch + 2*num_nodes);
+        }
+        if (depth < 0) {
+            joy_log_err("malformed tree %u in ensemble", t);
+            free(e);
+            free(scratch);
+            return NULL;
+        }
+        e->root[t] = base;
+        e->depth[t] = depth;
+        base += size;
+    }
+    free(scratch);
+
+    if (base != num_nodes) {
+        joy_log_err("ensemble trees hold %u of its %u nodes", base, num_nodes);
+        free(e);
+        return NULL;
+    }
+
+    return e;
+}
+
+/**
+ * \fn ensemble_t *ensemble_load (const char *filename, uint32_t max_features)
+ * \brief load an ensemble from a file
+ * \param filename name of the ensemble file
+ * \param max_features number of features that the caller can provide
+ * \return the ensemble, to be freed with ensemble_free(), or NULL
+ */
+ensemble_t *ensemble_load (const char *filename, uint32_t max_features) {
+    ensemble_t *e = NULL;
+    unsigned char *buf = NULL;
+    long len;
+    FILE *fp;
+
+    fp = fopen(filename, "rb");
+    if (fp == NULL) {
+        joy_log_err("could not open ensemble file %s", filename);
+        return NULL;
+    }
+    if (fseek(fp, 0, SEEK_END) != 0 || (len = ftell(fp)) < 0 || fseek(fp, 0, SEEK_SET) != 0) {
+        joy_log_err("could not find the length of ensemble file %s", filename);
+        fclose(fp);
+        return NULL;
+    }
+    buf = malloc(len ? len : 1);
+    if (buf == NULL) {
+        joy_log_err("could not allocate memory for ensemble file %s", filename);
+    } else if (fread(buf, 1, len, fp) != (size_t)len) {
+        joy_log_err("could not read ensemble file %s", filename);
+    } else {
+        e = ensemble_parse(buf, len, max_features);
+    }
+    free(buf);
+    fclose(fp);
+
+    return e;
+}
+
+/**
+ * \fn void ensemble_free (void *ensemble)
+ * \brief free an ensemble; usable as a joy_snapshot_free_fn
+ * \param ensemble the ensemble_t to free
+ * \return none
+ */
+void ensemble_free (void *ensemble) {
+    free(ensemble);
+}
+
+/**
+ * \fn float ensemble_score (const ensemble_t *e, const float *x)
+ * \brief score a flow
+ * \param e the ensemble
+ * \param x the e->num_features features of the flow
+ * \return the probability of the positive class
+ */
+float ensemble_score (const ensemble_t *e, const float *x) {
+    const ensemble_node_t *node = e->node;
+    float sum = 0.0;
+    uint32_t t, d, n;
+
+    for (t = 0; t < e->num_trees; t++) {
+        n = e->root[t];
+        for (d = e->depth[t]; d > 0; d--) {
+            n = node[n].child[x[node[n].feature] > node[n].threshold];
+        }
+        sum += node[n].threshold;
+    }
+
+    if (e->type == ENSEMBLE_FOREST) {
+        return sum / e->num_trees;
+    }
+
+    sum = -(e->base_score + sum);
+    if (sum > 500.0) {
+        sum = 500.0; // check b/c overflow
+    }
+    return 1.0/(1.0+exp(sum));
+}
+
+/* append a little-endian 32 bit value to a test ensemble file */
+static unsigned char *ensemble_put_u32 (unsigned char *p, uint32_t v) {
+    p[0] = v & 0xff;
+    p[1] = (v >> 8) & 0xff;
+    p[2] = (v >> 16) & 0xff;
+    p[3] = (v >> 24) & 0xff;
+    return p + 4;
+}
+
+static unsigned char *ensemble_put_float (unsigned char *p, float f) {
+    uint32_t u;
+
+    memcpy(&u, &f, sizeof(u));
+    return ensemble_put_u32(p, u);
+}
+
+static unsigned char *ensemble_put_node (unsigned char *p, uint32_t feature, float threshold,
+                                         uint32_t left, uint32_t right) {
+    p = ensemble_put_u32(p, feature);
+    p = ensemble_put_float(p, threshold);
+    p = ensemble_put_u32(p, left);
+    return ensemble_put_u32(p, right);
+}
+
+/*
+ * Write a test ensemble of two trees over three features:
+ *
+ *   tree 0: x[0] <= 10 ? -1.0 : (x[2] <= 0.5 ? 0.5 : 2.0)
+ *   tree 1: 0.25
+ *
+ * The nodes of tree 0 are not in breadth first order.  Returns the
+ * length of the file.
+ */
+static size_t ensemble_test_file (unsigned char *buf, ensemble_type_e type) {
+    unsigned char *p = buf;
+
+    memcpy(p, ENSEMBLE_MAGIC, 4);
+    p = ensemble_put_u32(p + 4, ENSEMBLE_VERSION);
+    p = ensemble_put_u32(p, type);
+    p = ensemble_put_u32(p, 3);
+    p = ensemble_put_u32(p, 2);
+    p = ensemble_put_u32(p, 6);
+    p = ensemble_put_float(p, 0.125);
+    p = ensemble_put_u32(p, 5);
+    p = ensemble_put_u32(p, 1);
+    p = ensemble_put_node(p, 0, 10.0, 4, 2);
+    p = ensemble_put_node(p, ENSEMBLE_LEAF, 2.0, 0, 0);
+    p = ensemble_put_node(p, 2, 0.5, 3, 1);
+    p = ensemble_put_node(p, ENSEMBLE_LEAF, 0.5, 0, 0);
+    p = ensemble_put_node(p, ENSEMBLE_LEAF, -1.0, 0, 0);
+    p = ensemble_put_node(p, ENSEMBLE_LEAF, 0.25, 0, 0);
+
+    return p - buf;
+}
+
+/**
+ * \fn void ensemble_unit_test (void)
+ * \brief check loading and scoring of ensembles
+ * \return none
+ */
+void ensemble_unit_test (void) {
+    unsigned char buf[256];
+    const float x[][3] = { { 5.0, 0.0, 9.0 }, { 10.0, 0.0, 9.0 }, { 11.0, 0.0, 0.5 }, { 11.0, 0.0, 0.75 } };
+    const float leaf[] = { -1.0, -1.0, 0.5, 2.0 };
+    ensemble_t *e;
+    size_t len;
+    float expected;
+    unsigned int i;
+    int num_fails = 0;
+
+    fprintf(info, "\n******************************\n");
+    fprintf(info, "Ensemble Unit Test starting...\n");
+
+    len = ensemble_test_file(buf, ENSEMBLE_BOOSTED);
+    e = ensemble_parse(buf, len, 3);
+    if (e == NULL) {
+        fprintf(info, "error: could not load a boosted ensemble\n");
+        num_fails++;
+    } else {
+        if (e->depth[0] != 2 || e->depth[1] != 0 || e->root[1] != 5) {
+            fprintf(info, "error: tree layout\n");
+            num_fails++;
+        }
+        for (i = 0; i < sizeof(x)/sizeof(x[0]); i++) {
+            expected = 1.0/(1.0+exp(-(0.125 + leaf[i] + 0.25)));
+            if (fabs(ensemble_score(e, x[i]) - expected) > 1e-6) {
+                fprintf(info, "error: boosted score of flow %u is %f, expected %f\n",
+                        i, ensemble_score(e, x[i]), expected);
+                num_fails++;
+            }
+        }
+        ensemble_free(e);
+    }
+
+    len = ensemble_test_file(buf, ENSEMBLE_FOREST);
+    e = ensemble_parse(buf, len, 3);
+    if (e == NULL) {
+        fprintf(info, "error: could not load a random forest\n");
+        num_fails++;
+    } else {
+        for (i = 0; i < sizeof(x)/sizeof(x[0]); i++) {
+            if (ensemble_score(e, x[i]) != (leaf[i] + 0.25f) / 2) {
+                fprintf(info, "error: forest score of flow %u\n", i);
+                num_fails++;
+            }
+        }
+        ensemble_free(e);
+    }
+
+    /* malformed files are rejected */
+    if (ensemble_parse(buf, len, 2) != NULL) {
+        fprintf(info, "error: accepted an ensemble with too many features\n");
+        num_fails++;
+    }
+    if (ensemble_parse(buf, len - 1, 3) != NULL) {
+        fprintf(info, "error: accepted a truncated ensemble\n");
+        num_fails++;
+    }
+    len = ensemble_test_file(buf, ENSEMBLE_BOOSTED);
+    ensemble_put_node(buf + ENSEMBLE_HEADER_LEN + 8 + 2 * ENSEMBLE_NODE_LEN, 2, 0.5, 3, 0);
+    if (ensemble_parse(buf, len, 3) != NULL) {
+        fprintf(info, "error: accepted a tree with a cycle\n");
+        num_fails++;
+    }
+    len = ensemble_test_file(buf, ENSEMBLE_BOOSTED);
+    ensemble_put_node(buf + ENSEMBLE_HEADER_LEN + 8 + 2 * ENSEMBLE_NODE_LEN, ENSEMBLE_LEAF, 0.5, 0, 0);
+    if (ensemble_parse(buf, len, 3) != NULL) {
+        fprintf(info, "error: accepted a tree with unreachable nodes\n");
+        num_fails++;
+    }
+
+    if (num_fails) {
+        fprintf(info, "Finished - failures: %d\n", num_fails);
+    } else {
+        fprintf(info, "Finished - success\n");
+    }
+    fprintf(info, "******************************\n\n");
+}
@@ -54,10 +54,11 @@ extern FILE *info;
  * \brief Initialize the memory of Example struct.
  *
  * \param example_handle contains example structure to init
+ * \param arena arena of the flow record (unused)
  *
  * \return none
  */
-__inline void example_init (struct example **example_handle) {
+__inline void example_init (struct example **example_handle, joy_arena_t *arena) {
     if (*example_handle != NULL) {
         example_delete(example_handle);
     }
@@ -112,6 +113,9 @@ void example_print_json (const struct example *x1, const struct example *x2, zfi
     }
 }
 
+/* the JSON of example is carried as text in CBOR output */
+define_print_text(example)
+
 /**
  * \brief Delete the memory of Example struct.
  *
@@ -138,9 +142,11 @@ void example_delete (struct example **example_handle) {
  */
 void example_unit_test () {
     struct example *example = NULL;
+    joy_arena_t arena;
     const struct pcap_pkthdr *header = NULL; 
 
-    example_init(&example);
+    memset(&arena, 0, sizeof(arena));
+    example_init(&example, &arena);
     example_update(example, header, NULL, 1, 1);
     example_update(example, header, NULL, 2, 1);
     example_update(example, header, NULL, 3, 1);
@@ -152,5 +158,6 @@ void example_unit_test () {
     example_update(example, header, NULL, 9, 1);
 
     example_delete(&example);
+    joy_arena_release(&arena);
 } 
 
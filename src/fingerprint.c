@@ -45,66 +45,623 @@
 #include <stdio.h>
 #include <string.h>
 #include "fingerprint.h"
+#include "config.h"
+#include "err.h"
 
-int fingerprint_copy(fingerprint_t *dest_fp,
-                     fingerprint_t *src_fp) {
+/*
+ * External objects, defined in joy.c
+ */
+extern FILE *info;
+
+#define FINGERPRINT_DB_MIN_BUCKETS 64
+#define FINGERPRINT_DB_POSTING_BUCKETS 4096
+
+/** An interned label */
+struct fingerprint_label {
+    struct fingerprint_label *next;
+    uint32_t hash;
+    char str[];
+};
+
+/** The entries whose fingerprint contains a given 16-bit value */
+struct fingerprint_posting {
+    struct fingerprint_posting *next;
+    uint16_t value;
+    uint32_t count;
+    uint32_t size;
+    uint32_t *ids;
+};
+
+/* FNV-1a */
+static uint32_t fingerprint_hash (const unsigned char *data, size_t len) {
+    uint32_t h = 2166136261u;
+    size_t i;
 
-    if (dest_fp == NULL) {
-        fprintf(stderr, "api-error: dest_fp is null");
+    for (i = 0; i < len; i++) {
+        h ^= data[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static uint16_t fingerprint_value (const unsigned char *data, unsigned int i) {
+    return (uint16_t)((data[2 * i] << 8) | data[2 * i + 1]);
+}
+
+static int fingerprint_value_cmp (const void *a, const void *b) {
+    return (int)*(const uint16_t *)a - (int)*(const uint16_t *)b;
+}
+
+/*
+ * Sort the 16-bit values of a fingerprint into values[] and drop the
+ * repeats; returns the number of distinct values
+ */
+static unsigned int fingerprint_distinct_values (const unsigned char *data,
+                                                 uint16_t len,
+                                                 uint16_t *values) {
+    unsigned int n = len / 2;
+    unsigned int i, k = 0;
+
+    for (i = 0; i < n; i++) {
+        values[i] = fingerprint_value(data, i);
+    }
+    qsort(values, n, sizeof(uint16_t), fingerprint_value_cmp);
+    for (i = 0; i < n; i++) {
+        if (k == 0 || values[k - 1] != values[i]) {
+            values[k++] = values[i];
+        }
+    }
+    return k;
+}
+
+static int fingerprint_grow (void **array, uint32_t *size, uint32_t need, size_t elem_size) {
+    uint32_t new_size = *size ? *size : 4;
+    void *tmp = NULL;
+
+    if (need <= *size) {
+        return 0;
+    }
+    while (new_size < need) {
+        new_size *= 2;
+    }
+    tmp = realloc(*array, (size_t)new_size * elem_size);
+    if (tmp == NULL) {
+        joy_log_err("realloc failed");
         return 1;
     }
+    *array = tmp;
+    *size = new_size;
+    return 0;
+}
 
-    if (src_fp == NULL) {
-        fprintf(stderr, "api-error: src_fp is null");
+/* make room for a count per entry, with the new counts zeroed */
+static int fingerprint_scratch_grow (fingerprint_scratch_t *scratch, uint32_t need) {
+    uint32_t size = scratch->size;
+    uint32_t touched_size = scratch->size;
+
+    if (fingerprint_grow((void **)&scratch->touched, &touched_size, need, sizeof(uint32_t)) ||
+        fingerprint_grow((void **)&scratch->shared, &size, need, sizeof(uint16_t))) {
         return 1;
     }
+    if (size > scratch->size) {
+        memset(scratch->shared + scratch->size, 0, (size - scratch->size) * sizeof(uint16_t));
+    }
+    scratch->size = size;
+    return 0;
+}
+
+/**
+ * \brief Initialize an empty fingerprint database.
+ *
+ * \param db Database to initialize.
+ *
+ * \return
+ */
+void fingerprint_db_init (fingerprint_db_t *db) {
+    memset(db, 0, sizeof(fingerprint_db_t));
+}
+
+/**
+ * \brief Free all of the memory held by a fingerprint database.
+ *
+ * \param db Database to free; it is left empty.
+ *
+ * \return
+ */
+void fingerprint_db_free (fingerprint_db_t *db) {
+    uint32_t i = 0;
+
+    if (db == NULL) {
+        return;
+    }
+
+    for (i = 0; i < db->fingerprint_count; i++) {
+        free(db->entries[i]->labels);
+        free(db->entries[i]);
+    }
+    for (i = 0; i < db->num_label_buckets; i++) {
+        struct fingerprint_label *l = db->labels[i];
 
-    memcpy(dest_fp, src_fp, sizeof(fingerprint_t));
+        while (l) {
+            struct fingerprint_label *next = l->next;
+            free(l);
+            l = next;
+        }
+    }
+    for (i = 0; i < db->num_posting_buckets; i++) {
+        struct fingerprint_posting *p = db->postings[i];
+
+        while (p) {
+            struct fingerprint_posting *next = p->next;
+            free(p->ids);
+            free(p);
+            p = next;
+        }
+    }
+    free(db->buckets);
+    free(db->entries);
+    free(db->labels);
+    free(db->postings);
+    fingerprint_db_init(db);
+}
+
+/*
+ * Double the number of buckets in a chained table once it holds as
+ * many items as buckets; next_of() gives the chain link and hash_of()
+ * the stored hash of an item
+ */
+#define FINGERPRINT_TABLE_GROW(type, table, num_buckets, count)             \
+    do {                                                                    \
+        if ((count) >= (num_buckets)) {                                     \
+            uint32_t n = (num_buckets) ? (num_buckets) * 2 : FINGERPRINT_DB_MIN_BUCKETS; \
+            type **t = calloc(n, sizeof(type *));                           \
+            uint32_t b;                                                     \
+            if (t == NULL) {                                                \
+                joy_log_err("malloc failed");                               \
+                break;                                                      \
+            }                                                               \
+            for (b = 0; b < (num_buckets); b++) {                           \
+                type *e = (table)[b];                                       \
+                while (e) {                                                 \
+                    type *next = e->next;                                   \
+                    e->next = t[e->hash & (n - 1)];                         \
+                    t[e->hash & (n - 1)] = e;                               \
+                    e = next;                                               \
+                }                                                           \
+            }                                                               \
+            free(table);                                                    \
+            (table) = t;                                                    \
+            (num_buckets) = n;                                              \
+        }                                                                   \
+    } while (0)
+
+/* find or add an interned copy of a label */
+static const char *fingerprint_db_intern_label (fingerprint_db_t *db, const char *label) {
+    size_t len = 0;
+    uint32_t hash = 0;
+    struct fingerprint_label *l = NULL;
+
+    if (label == NULL) {
+        joy_log_err("api-error: fingerprint without a label");
+        return NULL;
+    }
+    len = strnlen(label, MAX_FINGERPRINT_LABEL_LEN - 1);
+    hash = fingerprint_hash((const unsigned char *)label, len);
+
+    if (db->num_label_buckets) {
+        for (l = db->labels[hash & (db->num_label_buckets - 1)]; l; l = l->next) {
+            if (l->hash == hash && strncmp(l->str, label, len) == 0 && l->str[len] == '\0') {
+                return l->str;
+            }
+        }
+    }
+
+    FINGERPRINT_TABLE_GROW(struct fingerprint_label, db->labels, db->num_label_buckets, db->label_count);
+    if (db->num_label_buckets == 0) {
+        return NULL;
+    }
+
+    l = malloc(sizeof(struct fingerprint_label) + len + 1);
+    if (l == NULL) {
+        joy_log_err("malloc failed");
+        return NULL;
+    }
+    l->hash = hash;
+    memcpy(l->str, label, len);
+    l->str[len] = '\0';
+    l->next = db->labels[hash & (db->num_label_buckets - 1)];
+    db->labels[hash & (db->num_label_buckets - 1)] = l;
+    db->label_count++;
+
+    return l->str;
+}
+
+static struct fingerprint_posting *fingerprint_db_posting (const fingerprint_db_t *db, uint16_t value) {
+    struct fingerprint_posting *p = NULL;
 
+    if (db->num_posting_buckets == 0) {
+        return NULL;
+    }
+    for (p = db->postings[value % db->num_posting_buckets]; p; p = p->next) {
+        if (p->value == value) {
+            return p;
+        }
+    }
+    return NULL;
+}
+
+/* record that the entry id contains each of the values */
+static int fingerprint_db_index (fingerprint_db_t *db, uint32_t id,
+                                 const uint16_t *values, unsigned int num_values) {
+    unsigned int i = 0;
+
+    if (db->postings == NULL) {
+        db->postings = calloc(FINGERPRINT_DB_POSTING_BUCKETS, sizeof(struct fingerprint_posting *));
+        if (db->postings == NULL) {
+            joy_log_err("malloc failed");
+            return 1;
+        }
+        db->num_posting_buckets = FINGERPRINT_DB_POSTING_BUCKETS;
+    }
+
+    for (i = 0; i < num_values; i++) {
+        struct fingerprint_posting *p = fingerprint_db_posting(db, values[i]);
+
+        if (p == NULL) {
+            p = calloc(1, sizeof(struct fingerprint_posting));
+            if (p == NULL) {
+                joy_log_err("malloc failed");
+                return 1;
+            }
+            p->value = values[i];
+            p->next = db->postings[values[i] % db->num_posting_buckets];
+            db->postings[values[i] % db->num_posting_buckets] = p;
+        }
+        if (fingerprint_grow((void **)&p->ids, &p->size, p->count + 1, sizeof(uint32_t))) {
+            return 1;
+        }
+        p->ids[p->count++] = id;
+    }
     return 0;
 }
 
+/*
+ * @brief Add a labelled fingerprint to the database.
+ *
+ * If the fingerprint is already in the database, the label is added to
+ * that entry, unless it is there already.
+ *
+ * @param db Database to add to.
+ * @param fingerprint Fingerprint data, 16-bit values in network byte order.
+ * @param fingerprint_len Length of the data in bytes.
+ * @param label Label for the fingerprint, such as a library version.
+ *
+ * return Database fingerprint, NULL on error
+ */
+fingerprint_t *fingerprint_db_add (fingerprint_db_t *db,
+                                   const unsigned char *fingerprint,
+                                   uint16_t fingerprint_len,
+                                   const char *label) {
+    fingerprint_t *fp = NULL;
+    const char *interned = NULL;
+    uint16_t values[MAX_FINGERPRINT_LEN / 2];
+    unsigned int num_values = 0;
+    uint32_t i = 0;
+
+    if (db == NULL || fingerprint_len > MAX_FINGERPRINT_LEN || fingerprint_len % 2) {
+        joy_log_err("api-error: bad fingerprint");
+        return NULL;
+    }
+
+    interned = fingerprint_db_intern_label(db, label);
+    if (interned == NULL) {
+        return NULL;
+    }
+
+    fp = fingerprint_db_match_exact(db, fingerprint, fingerprint_len);
+    if (fp == NULL) {
+        if (db->fingerprint_count >= db->num_buckets) {
+            /* entries[] is sized along with the buckets */
+            uint32_t n = db->num_buckets ? db->num_buckets * 2 : FINGERPRINT_DB_MIN_BUCKETS;
+            fingerprint_t **entries = realloc(db->entries, n * sizeof(fingerprint_t *));
+
+            if (entries == NULL) {
+                joy_log_err("realloc failed");
+                return NULL;
+            }
+            db->entries = entries;
+
+            FINGERPRINT_TABLE_GROW(fingerprint_t, db->buckets, db->num_buckets, db->fingerprint_count);
+            if (db->fingerprint_count >= db->num_buckets) {
+                return NULL;
+            }
+        }
+
+        fp = calloc(1, sizeof(fingerprint_t) + fingerprint_len);
+        if (fp == NULL) {
+            joy_log_err("malloc failed");
+            return NULL;
+        }
+        memcpy(fp->fingerprint, fingerprint, fingerprint_len);
+        fp->fingerprint_len = fingerprint_len;
+        fp->hash = fingerprint_hash(fingerprint, fingerprint_len);
+        fp->id = db->fingerprint_count;
+
+        num_values = fingerprint_distinct_values(fingerprint, fingerprint_len, values);
+        fp->num_values = num_values;
+        if (fingerprint_db_index(db, fp->id, values, num_values)) {
+            free(fp);
+            return NULL;
+        }
+
+        fp->next = db->buckets[fp->hash & (db->num_buckets - 1)];
+        db->buckets[fp->hash & (db->num_buckets - 1)] = fp;
+        db->entries[db->fingerprint_count++] = fp;
+    }
+
+    for (i = 0; i < fp->label_count; i++) {
+        if (fp->labels[i] == interned) {
+            return fp;
+        }
+    }
+    if (fp->label_count == UINT16_MAX) {
+        joy_log_warn("fingerprint is at max label capacity");
+        return fp;
+    } else {
+        uint32_t label_size = fp->label_size;
+
+        if (fingerprint_grow((void **)&fp->labels, &label_size,
+                             fp->label_count + 1, sizeof(const char *))) {
+            return fp;
+        }
+        fp->label_size = label_size > UINT16_MAX ? UINT16_MAX : label_size;
+    }
+    fp->labels[fp->label_count++] = interned;
+
+    return fp;
+}
 /*
  * @brief Find an exact fingerprint match in the database.
  *
- * Use the \p in_fingerprint to search the known fingerprint database for a match.
+ * Use the \p fingerprint to search the known fingerprint database for a match.
  * If match is found then return a pointer to the database fingerprint that was
- * matched successfully.
- * If a match is found then copy the known data, such as library versions, into the
- * label fields of \p in_fingerprint.
+ * matched successfully; its labels hold the known data, such as library versions.
  *
  * @param db Database of known fingerprints that will be searched.
- * @param in_fingerprint The input fingerprint.
+ * @param fingerprint The input fingerprint.
+ * @param fingerprint_len Length of the input fingerprint in bytes.
  *
  * return Database fingerprint if match, NULL otherwise
  */
-fingerprint_t *fingerprint_db_match_exact(fingerprint_db_t *db,
-                                          fingerprint_t *in_fingerprint) {
-    fingerprint_t *fp_match = NULL;
-    uint16_t db_count = 0;
-    size_t i = 0;
-    int match = -1;
+fingerprint_t *fingerprint_db_match_exact (const fingerprint_db_t *db,
+                                           const unsigned char *fingerprint,
+                                           uint16_t fingerprint_len) {
+    fingerprint_t *fp = NULL;
+    uint32_t hash = 0;
 
-    if (db == NULL) {
+    if (db == NULL || db->num_buckets == 0) {
       return NULL;
     }
 
-    db_count = db->fingerprint_count;
-
-    /* Iterate through the db->fingerprints */
-    for (i = 0; i < db_count; i++) {
-        /* Optimize by comparing fingerprint length first */
-        if (in_fingerprint->fingerprint_len == db->fingerprints[i].fingerprint_len) {
-            /* Compare the memory of the 2 fingerprints */
-            match = memcmp(in_fingerprint->fingerprint, db->fingerprints[i].fingerprint,
-                           in_fingerprint->fingerprint_len);
-            if (match == 0) {
-                fp_match = &db->fingerprints[i];
-                return fp_match;
-            }
+    hash = fingerprint_hash(fingerprint, fingerprint_len);
+    for (fp = db->buckets[hash & (db->num_buckets - 1)]; fp; fp = fp->next) {
+        if (fp->hash == hash && fp->fingerprint_len == fingerprint_len &&
+            memcmp(fp->fingerprint, fingerprint, fingerprint_len) == 0) {
+            return fp;
         }
     }
 
     /* No fingerprints were matched */
     return NULL;
 }
+
+/*
+ * @brief Find the closest fingerprint in the database.
+ *
+ * Fingerprints are compared as sets of 16-bit values; the similarity of
+ * two fingerprints is the number of values they share, as a percentage
+ * of the larger set.  Only the entries sharing a value with the input
+ * are looked at, through the per-value index.
+ *
+ * @param db Database of known fingerprints that will be searched.
+ * @param scratch Working space, grown to the size of the database as needed.
+ * @param fingerprint The input fingerprint.
+ * @param fingerprint_len Length of the input fingerprint in bytes.
+ * @param percent Required similarity, 0 to 100.
+ *
+ * return Most similar database fingerprint at or above \p percent, NULL otherwise
+ */
+fingerprint_t *fingerprint_db_match_partial (const fingerprint_db_t *db,
+                                             fingerprint_scratch_t *scratch,
+                                             const unsigned char *fingerprint,
+                                             uint16_t fingerprint_len,
+                                             unsigned int percent) {
+    uint16_t values[MAX_FINGERPRINT_LEN / 2];
+    unsigned int num_values = 0;
+    uint16_t *shared = NULL;
+    uint32_t *touched = NULL;
+    uint32_t num_touched = 0;
+    fingerprint_t *best = NULL;
+    unsigned int best_shared = 0, best_total = 1;
+    unsigned int i, k;
+
+    if (db == NULL || scratch == NULL || db->fingerprint_count == 0 ||
+        fingerprint_len > MAX_FINGERPRINT_LEN || fingerprint_len % 2) {
+        return NULL;
+    }
+
+    best = fingerprint_db_match_exact(db, fingerprint, fingerprint_len);
+    if (best != NULL) {
+        return best;
+    }
+
+    num_values = fingerprint_distinct_values(fingerprint, fingerprint_len, values);
+    if (num_values == 0) {
+        return NULL;
+    }
+
+    if (fingerprint_scratch_grow(scratch, db->fingerprint_count)) {
+        return NULL;
+    }
+    shared = scratch->shared;
+    touched = scratch->touched;
+
+    for (i = 0; i < num_values; i++) {
+        const struct fingerprint_posting *p = fingerprint_db_posting(db, values[i]);
+
+        if (p == NULL) {
+            continue;
+        }
+        for (k = 0; k < p->count; k++) {
+            if (shared[p->ids[k]]++ == 0) {
+                touched[num_touched++] = p->ids[k];
+            }
+        }
+    }
+
+    for (i = 0; i < num_touched; i++) {
+        const fingerprint_t *fp = db->entries[touched[i]];
+        unsigned int total = fp->num_values > num_values ? fp->num_values : num_values;
+        unsigned int n = shared[touched[i]];
+
+        if (n * 100 < percent * total) {
+            continue;
+        }
+        /* better ratio, or the same ratio and an earlier entry */
+        if (best == NULL || n * best_total > best_shared * total ||
+            (n * best_total == best_shared * total && fp->id < best->id)) {
+            best = db->entries[touched[i]];
+            best_shared = n;
+            best_total = total;
+        }
+    }
+
+    /* leave the counts zeroed for the next lookup */
+    for (i = 0; i < num_touched; i++) {
+        shared[touched[i]] = 0;
+    }
+
+    return best;
+}
+
+/**
+ * \brief Free the memory held by a scratch; it is left empty, and can
+ * be used again.
+ *
+ * \param scratch Scratch to free.
+ *
+ * \return
+ */
+void fingerprint_scratch_free (fingerprint_scratch_t *scratch) {
+    if (scratch == NULL) {
+        return;
+    }
+    free(scratch->shared);
+    free(scratch->touched);
+    scratch->shared = NULL;
+    scratch->touched = NULL;
+    scratch->size = 0;
+}
+
+/**
+ * \brief Run the fingerprint database unit tests.
+ *
+ * \return
+ */
+void fingerprint_unit_test (void) {
+    fingerprint_db_t db;
+    fingerprint_scratch_t scratch;
+    unsigned char fp[MAX_FINGERPRINT_LEN];
+    fingerprint_t *a = NULL, *b = NULL;
+    char label[32];
+    unsigned int i, k;
+    int num_fails = 0;
+
+    fprintf(info, "\n******************************\n");
+    fprintf(info, "Fingerprint Unit Test starting...\n");
+
+    fingerprint_db_init(&db);
+    memset(&scratch, 0, sizeof(scratch));
+
+    /* Many fingerprints of 20 values each, 8 of them shared by all */
+    for (i = 0; i < 5000; i++) {
+        for (k = 0; k < 20; k++) {
+            uint16_t v = (k < 8) ? (uint16_t)(0xc000 + k) : (uint16_t)(i * 12 + k);
+
+            fp[2 * k] = v >> 8;
+            fp[2 * k + 1] = v & 0xff;
+        }
+        snprintf(label, sizeof(label), "lib-%u", i % 100);
+        if (fingerprint_db_add(&db, fp, 40, label) == NULL) {
+            num_fails++;
+            break;
+        }
+    }
+    if (db.fingerprint_count != 5000 || db.label_count != 100) {
+        fprintf(info, "error: %u fingerprints, %u labels\n", db.fingerprint_count, db.label_count);
+        num_fails++;
+    }
+
+    /* Exact match; a second label is added once */
+    a = fingerprint_db_add(&db, fp, 40, "other");
+    fingerprint_db_add(&db, fp, 40, "other");
+    b = fingerprint_db_match_exact(&db, fp, 40);
+    if (a == NULL || a != b || b->label_count != 2 ||
+        strcmp(b->labels[0], "lib-99") || strcmp(b->labels[1], "other")) {
+        fprintf(info, "error: exact match failed\n");
+        num_fails++;
+    }
+    if (fingerprint_db_match_exact(&db, fp, 38) != NULL) {
+        fprintf(info, "error: matched a prefix\n");
+        num_fails++;
+    }
+
+    /* Same values, other order: a partial match at 100 percent */
+    for (k = 0; k < 4; k++) {
+        unsigned char t = fp[k];
+        fp[k] = fp[k + 4];
+        fp[k + 4] = t;
+    }
+    if (fingerprint_db_match_exact(&db, fp, 40) != NULL ||
+        fingerprint_db_match_partial(&db, &scratch, fp, 40, 100) != b) {
+        fprintf(info, "error: reordered fingerprint not matched\n");
+        num_fails++;
+    }
+
+    /* Replace two values: 18 of 20 shared */
+    fp[38] = 0xff;
+    fp[36] = 0xff;
+    if (fingerprint_db_match_partial(&db, &scratch, fp, 40, 90) != b ||
+        fingerprint_db_match_partial(&db, &scratch, fp, 40, 95) != NULL) {
+        fprintf(info, "error: partial match failed\n");
+        num_fails++;
+    }
+
+    /* The counts of the scratch are zeroed after each lookup */
+    for (i = 0; i < scratch.size; i++) {
+        if (scratch.shared[i]) {
+            fprintf(info, "error: scratch count %u left at %u\n", i, scratch.shared[i]);
+            num_fails++;
+            break;
+        }
+    }
+
+    if (fingerprint_db_add(&db, fp, 40, NULL) != NULL) {
+        fprintf(info, "error: added a fingerprint without a label\n");
+        num_fails++;
+    }
+
+    fingerprint_scratch_free(&scratch);
+    fingerprint_db_free(&db);
+    if (db.fingerprint_count || fingerprint_db_match_exact(&db, fp, 40)) {
+        fprintf(info, "error: database not emptied\n");
+        num_fails++;
+    }
+
+    if (num_fails) {
+        fprintf(info, "Finished - failures: %d\n", num_fails);
+    } else {
+        fprintf(info, "Finished - success\n");
+    }
+    fprintf(info, "******************************\n\n");
+}
@@ -42,11 +42,14 @@
 #include <ctype.h>
 #include <string.h> 
 #include <stdlib.h>   
+#include <limits.h>
+#include <openssl/md5.h>
 #include "http.h"
 #include "p2f.h"
 #include "anon.h"
 #include "str_match.h"
 #include "err.h"
+#include "config.h"
 
 /** user name match structure */
 extern str_match_ctx usernames_ctx;
@@ -59,28 +62,55 @@ extern str_match_ctx usernames_ctx;
  * bytes of that field may contain the file "magic number" that can
  * identify its type
  */
-#define MAGIC 16
+#define MAGIC HTTP_BODY_MAGIC
 
 #define PARSE_FAIL (-1)
 
+/** initial size of the per-flow buffer that holds message headers */
+#define HTTP_TEXT_INIT 1024
+
+/**
+ * \brief The http data of one packet, as seen by the parser.
+ *
+ * The parser works on the packet data in place.  It looks at no more
+ * than the first \p visible bytes, and treats the data as if those were
+ * followed by zeros up to \p length bytes; \p hdr_end is the end of the
+ * header (CRLFCRLF), or \p visible if there is none.
+ */
+struct http_scan {
+    const unsigned char *data;
+    unsigned int visible;
+    unsigned int length;
+    unsigned int hdr_end;
+};
+
 /*
  * declarations of functions that are internal to this file
  */
+static void http_scan_init(struct http_scan *s,
+                           const unsigned char *data,
+                           unsigned int data_len);
 static int http_parse_message(struct http_message *message,
-                              char *data,
-                              unsigned int length);
-static unsigned int memcpy_up_to_crlfcrlf_plus_magic(char *dst, const char *src, unsigned int length);
-static void http_print_message(zfile f, const struct http_message *msg);
+                              const struct http_scan *s,
+                              unsigned int *span);
+static int http_text_append(http_t *http,
+                             struct http_message *message,
+                             const struct http_scan *s,
+                             unsigned int span);
+static void http_get_header_hash(const http_t *http, struct http_message *msg);
+static void http_print_message(emitter_t *e, const char *key, const http_t *http, const struct http_message *msg);
+static int http_header_selected(const char *name, unsigned int len);
 
 /**
  *
  * \brief Initialize the memory of HTTP struct.
  *
  * \param http_handle contains http structure to initialize
+ * \param arena arena of the flow record, backing the header text
  *
  * \return none
  */
-void http_init (http_t **http_handle) {
+void http_init (http_t **http_handle, joy_arena_t *arena) {
     if (*http_handle != NULL) {
         http_delete(http_handle);
     }
@@ -91,11 +121,16 @@ void http_init (http_t **http_handle) {
         joy_log_err("malloc failed");
         return;
     }
+    (*http_handle)->arena = arena;
 }
 
 /**
  * \brief Parse, process, and record HTTP \p data.
  *
+ * The message is parsed in place; only the bytes of the header that
+ * hold the tokens that are reported are copied, once, into the text
+ * buffer of \p http, which lives in the arena of the flow record.
+ *
  * \param http HTTP structure pointer
  * \param header PCAP packet header pointer
  * \param data Beginning of the HTTP payload data.
@@ -112,10 +147,8 @@ void http_update(http_t *http,
                  unsigned int report_http) {
 
     struct http_message *message = NULL;
-    char *raw_header = NULL;
-    unsigned int tmp_len = 0;
-    int success = 0;
-    int rc = 0;
+    struct http_scan scan;
+    unsigned int span = 0;
 
     if (!report_http || data_len == 0) {
         return;
@@ -132,59 +165,43 @@ void http_update(http_t *http,
 
     /* Get the current message datastore */
     message = &http->messages[http->num_messages];
-  
-    /*
-     * Leave room for null termination in the data buffer
-     */
-    tmp_len = (data_len + MAGIC) < HTTP_MAX_LEN ? (data_len + MAGIC) : HTTP_MAX_LEN;
-
-    /* Temporary buffer for holding header */
-    raw_header = calloc(HTTP_MAX_LEN, sizeof(char));
-    if (raw_header == NULL) {
-        joy_log_err("calloc failed");
-        return;
-    }
-
-    /* Copy the header plus magic */
-    rc = memcpy_up_to_crlfcrlf_plus_magic(raw_header, data, tmp_len);
-    if (rc == 0) {
-        /* No data to parse */
-        goto end;
-    }
+    memset(message, 0, sizeof(struct http_message));
 
     /*
      * Sift through the header.
      */
-    rc = http_parse_message(message, raw_header, tmp_len);
-    if (rc != PARSE_FAIL) {
-        /* Parsing was a success */
-        success = 1;
+    http_scan_init(&scan, data, data_len);
+    if (http_parse_message(message, &scan, &span) == PARSE_FAIL) {
+        memset(message, 0, sizeof(struct http_message));
+        return;
     }
 
-end:
-    if (raw_header) {
-        free(raw_header);
-        raw_header = NULL;
+    /* Keep the part of the header that the tokens refer to */
+    if (http_text_append(http, message, &scan, span)) {
+        memset(message, 0, sizeof(struct http_message));
+        return;
     }
 
-    if (success) {
-        /* Increment message count */
-        http->num_messages++;
+    if (glb_config->fingerprint_hash && message->header.line_type == HTTP_LINE_REQUEST) {
+        http_get_header_hash(http, message);
     }
+
+    /* Increment message count */
+    http->num_messages++;
 } 
 
 /**
- * \brief Print the HTTP struct to JSON output file \p f.
+ * \brief Print the HTTP struct through the emitter \p e.
  *
  * \param h1 pointer to HTTP structure
  * \param h2 pointer to twin HTTP structure
- * \param f destination file for the output
+ * \param e emitter that the output goes to
  *
  * \return none
  */
-void http_print_json(const http_t *h1,
-                     const http_t *h2,
-                     zfile f) {
+void http_print(const http_t *h1,
+                const http_t *h2,
+                emitter_t *e) {
 
     unsigned int total_messages = 0;
     int i = 0;
@@ -219,101 +236,39 @@ void http_print_json(const http_t *h1,
     }
 
     /* Start http array */
-    zprintf(f, ",\"http\":[");
+    emit_array_begin(e, "http");
 
     for (i = 0; i < total_messages; i++) {
-        int comma = 0;
-
-        zprintf(f, "{");
+        emit_map_begin(e, NULL);
 
         if (h1->num_messages > i) {
-            const struct http_message *msg = &h1->messages[i];
-
-            zprintf(f, "\"out\":");
-
-            http_print_message(f, msg);
-
-            comma = 1;
+            http_print_message(e, "out", h1, &h1->messages[i]);
         }
 
         if (h2) {
             /* Twin */
             if (h2->num_messages > i) {
-                const struct http_message *msg = &h2->messages[i];
-
-                if (comma) {
-                    zprintf(f, ",\"in\":");
-                } else {
-                    zprintf(f, "\"in\":");
-                }
-
-                http_print_message(f, msg);
+                http_print_message(e, "in", h2, &h2->messages[i]);
             }
         }
 
-        if (i == total_messages - 1) {
-            zprintf(f, "}");
-        } else {
-            zprintf(f, "},");
-        }
-
+        emit_map_end(e);
     }
 
     /* End http array */
-    zprintf(f, "]");
+    emit_array_end(e);
 }
 
-void http_free_message(struct http_message *msg) {
-    int k = 0;
-
-    if (msg == NULL) {
-        return;
-    }
-
-    if (msg->header.line_type == HTTP_LINE_STATUS) {
-        struct http_header_status_line *line = &msg->header.line.status;
-
-        if (line->version) {
-            free(line->version);
-        }
-        if (line->code) {
-            free(line->code);
-        }
-        if (line->reason) {
-            free(line->reason);
-        }
-    }
-    else if (msg->header.line_type == HTTP_LINE_REQUEST) {
-        struct http_header_request_line *line = &msg->header.line.request;
-
-        if (line->method) {
-            free(line->method);
-        }
-        if (line->uri) {
-            free(line->uri);
-        }
-        if (line->version) {
-            free(line->version);
-        }
-    }
-
-    for (k = 0; k < msg->header.num_elements; k++) {
-        struct http_header_element *elem = &msg->header.elements[k];
-
-        if (elem->name) {
-            free(elem->name);
-        }
-        if (elem->value) {
-            free(elem->value);
-        }
-    }
-
-    if (msg->body) {
-        free(msg->body);
-    }
-
-    memset(msg, 0, sizeof(struct http_message));
-}
+/**
+ * \brief Print the HTTP struct to JSON output file \p f.
+ *
+ * \param h1 pointer to HTTP structure
+ * \param h2 pointer to twin HTTP structure
+ * \param f destination file for the output
+ *
+ * \return none
+ */
+define_print_json(http)
 
 /**
  * \fn void http_delete (http_data_t *data)
@@ -322,18 +277,11 @@ void http_free_message(struct http_message *msg) {
  */
 void http_delete (struct http **http_handle) {
     struct http *http = *http_handle;
-    struct http_message *msg = NULL;
-    int i = 0;
 
     if (http == NULL) {
         return;
     }
 
-    for (i = 0; i < http->num_messages; i++) {
-        msg = &http->messages[i];
-        http_free_message(msg);
-    }
-
     /* Free the memory and set to NULL */
     free(http);
     *http_handle = NULL;
@@ -429,67 +377,124 @@ enum parse_state {
     second_lf = 4
 };
 
-static unsigned int memcpy_up_to_crlfcrlf_plus_magic (char *dst, const char *src, unsigned int length) {
-    unsigned int i;
-    enum parse_state state = non_crlf;
-    unsigned int body_bytes = 0; 
+/**
+ * \brief Map a header byte to a printable one.
+ *
+ * Characters below SPACE (32) and above DEL (127), inclusive, are
+ * suppressed, and so are the quote and backslash, to avoid JSON
+ * confusion; CR and LF are kept only if \p keep_crlf is set.
+ */
+static inline unsigned char http_printable (unsigned char c, int keep_crlf) {
+    if (keep_crlf && (c == '\r' || c == '\n')) {
+        return c;
+    }
+    if (c < 32 || c > 126 || c == '"' || c == '\\') {
+        return '.';
+    }
+    return c;
+}
 
-    for (i=0; i<length; ++i) {
-        /* reached the end of the src without finding crlfcrlf */
-        if (i == (length - MAGIC)) {
-           break;
-        }
+/**
+ * \brief Get byte \p i of the data that is being parsed.
+ */
+static inline unsigned char http_scan_byte (const struct http_scan *s, unsigned int i) {
+    return (i < s->visible) ? s->data[i] : 0;
+}
 
-        /* copy the byte to destination */
-        *(dst+i) = *(src+i);
+/**
+ * \brief Find the next CR in the data, starting at byte \p i.
+ *
+ * \return The index of the CR, or s->length if there is none
+ */
+static inline unsigned int http_scan_next_cr (const struct http_scan *s, unsigned int i) {
+    const unsigned char *cr = NULL;
 
-        /*  found a CRLFCRLF; copy magic bytes of body then return */
-        if (state == second_lf) {
-            if (body_bytes < MAGIC) {
-                // printf("body_bytes: %u\tMAGIC: %u\ti: %u\tlength: %u\n", body_bytes, MAGIC, i, length);
-                ++body_bytes;
-            } else {
+    if (i < s->visible) {
+        cr = memchr(s->data + i, '\r', s->visible - i);
+    }
+    return cr ? (unsigned int)(cr - s->data) : s->length;
+}
+
+/**
+ * \brief Set up the parser view of \p data.
+ *
+ * Up to HTTP_MAX_LEN bytes are considered, less MAGIC bytes of room;
+ * once a CRLFCRLF is found, only MAGIC bytes of the body follow it.
+ * The search for the CRLFCRLF skips from one CR to the next.
+ *
+ * \param s The view to set up
+ * \param data Beginning of the HTTP payload data
+ * \param data_len Length in bytes of the \p data
+ *
+ * \return none
+ */
+static void http_scan_init (struct http_scan *s,
+                            const unsigned char *data,
+                            unsigned int data_len) {
+    enum parse_state state = non_crlf;
+    unsigned int limit, i;
+
+    s->data = data;
+    s->length = (data_len + MAGIC) < HTTP_MAX_LEN ? (data_len + MAGIC) : HTTP_MAX_LEN;
+    limit = s->length - MAGIC;
+    s->visible = limit;
+    s->hdr_end = limit;
+
+    for (i = 0; i < limit; i++) {
+        if (state == non_crlf) {
+            /* nothing but a CR changes the lexer state */
+            const unsigned char *cr = memchr(data + i, '\r', limit - i);
+            if (cr == NULL) {
                 break;
             }
+            i = (unsigned int)(cr - data);
         }
 
-        /* still parsing HTTP headers */
-        else {
-            /*
-             * make string printable, by suppressing characters below SPACE
-             * (32) and above DEL (127), inclusive, except for \r and \n
-             */
-            if ((*(dst+i) < 32 || *(dst+i) > 126) && *(dst+i) != '\r' && *(dst+i) != '\n') {
-                *(dst+i) = '.';
-            }
-            /* avoid JSON confusion */
-            if ((*(dst+i) == '"') || (*(dst+i) == '\\')) {
-                *(dst+i) = '.';
+        /* advance lexer state */
+        if (data[i] == '\r') {
+            if (state == non_crlf) {
+                state = first_cr;
+            } else if (state == first_lf) {
+                state = second_cr;
             }
-
-            /* advance lexer state  */
-            if (*(src+i) == '\r') {
-                if (state == non_crlf) {
-                    state = first_cr;
-                } else if (state == first_lf) {
-                    state = second_cr;
-                } 
-            } else if (*(src+i) == '\n') {
-                if (state == first_cr) {
-                    state = first_lf;
-                } else if (state == second_cr) {
-                    state = second_lf;
-                }
-            } else {
-                if (state != second_lf) {
-                    state = non_crlf;
+        } else if (data[i] == '\n') {
+            if (state == first_cr) {
+                state = first_lf;
+            } else if (state == second_cr) {
+                /* found a CRLFCRLF; keep the magic bytes of the body */
+                s->hdr_end = i + 1;
+                if (i + MAGIC + 2 < limit) {
+                    s->visible = i + MAGIC + 2;
                 }
+                break;
             }
+        } else {
+            state = non_crlf;
         }
+    }
+}
+
+/**
+ * \brief Make a token slice.
+ *
+ * \param s The data being parsed
+ * \param start Offset of the first byte of the token
+ * \param end Offset of the byte that terminates the token
+ *
+ * \return The token
+ */
+static struct http_slice http_token (const struct http_scan *s,
+                                     unsigned int start,
+                                     unsigned int end) {
+    struct http_slice t;
 
+    if (end > s->visible) {
+        end = s->visible;
     }
-  
-    return i;
+    t.off = (uint16_t)start;
+    t.len = (end > start) ? (uint16_t)(end - start) : 0;
+
+    return t;
 }
 
 /****************************
@@ -512,53 +517,62 @@ enum header_state {
     got_value   = 2
 };
 
-static enum http_type http_get_next_line (char **saveptr,
-                                  unsigned int *length, char **token1, char **token2) {
+static enum http_type http_get_next_line (const struct http_scan *s,
+                                          unsigned int *pos,
+                                          struct http_slice *token1,
+                                          struct http_slice *token2,
+                                          int *have_token2) {
     unsigned int i;
     enum parse_state state = non_crlf;
     enum header_state header_state = got_nothing;
-    char *src = *saveptr;
-
-    if (src == NULL) {
-        return http_done;
-    }
+    unsigned int start = *pos;
+    unsigned int name_end = UINT_MAX;
+    unsigned int value_start = 0;
+
+    *have_token2 = 0;
+    for (i = start; i < s->length; i++) {
+        unsigned char c;
+
+        if (state == non_crlf && header_state == got_value) {
+            /* in the middle of a value; only a CR changes the state */
+            i = http_scan_next_cr(s, i);
+            if (i >= s->length) {
+                break;
+            }
+        }
+        c = http_scan_byte(s, i);
 
-    *token1 = src;
-    *token2 = NULL;
-    for (i=0; i < *length; i++) {
-      
         /* advance lexer state  */
-        if (src[i] == '\r') {
+        if (c == '\r') {
             if (state == non_crlf) {
                       state = first_cr;
             } else if (state == first_lf) {
                       state = second_cr;
             } 
-            src[i] = '.';  /* make printable, as a precaution */    
 
-        } else if (src[i] == '\n') {
+        } else if (c == '\n') {
             if (state == first_cr) {
                       state = first_lf;
             } else if (state == second_cr) {
                       state = second_lf;
             }
-            src[i] = '.';  /* make printable, as a precaution */    
 
-        } else if (src[i] == ':') {
+        } else if (c == ':') {
             if (header_state == got_nothing) {
-                      src[i] = 0;      /* NULL terminate token */
+                      name_end = i;    /* end of token */
                       header_state = got_header;
             }
             state = non_crlf;
-        } else if (src[i] == ' ') {
+        } else if (c == ' ') {
             ;     /* ignore whitespace */
         } else {
 
             if (state == first_lf) {
                 if (header_state == got_value) {
-                    src[i-2] = 0;    /* NULL terminate token */
-                    *length = *length - i;
-                    *saveptr = &src[i];
+                    *token1 = http_token(s, start, name_end);
+                    *token2 = http_token(s, value_start, i - 2);
+                    *have_token2 = 1;
+                    *pos = i;
                     return http_header;
                 } else {
                     /* Missing the complete name/value pair */
@@ -567,26 +581,27 @@ static enum http_type http_get_next_line (char **saveptr,
             }
 
             if (header_state == got_header) {
-                      *token2 = &src[i];        
+                      value_start = i;
                       header_state = got_value;
             }
             state = non_crlf;
         }
 
         if (state == second_lf) {
-            src[i-3] = 0;   /* NULL terminate token */
             /* 
-             * move past the last lf token to set the pointer
-             * at the beginning of the body and set the length
-             * to be just of the remaining body bytes, if any.
+             * move past the last lf token to set the position
+             * at the beginning of the body
              */
-            *length = *length - i - 1;
-            *saveptr = &src[i+1];
+            *token1 = http_token(s, start, (name_end < i - 3) ? name_end : i - 3);
+            if (header_state == got_value) {
+                *token2 = http_token(s, value_start, i - 3);
+                *have_token2 = 1;
+            }
+            *pos = i + 1;
             return http_done;
         }
     }
   
-    *saveptr = NULL;
     return http_malformed;
 }
 
@@ -599,42 +614,47 @@ enum start_line_state {
     got_third = 5
 };
 
-static enum http_type http_get_start_line (char **saveptr,
-                                   unsigned int *length, char **token1, 
-                                   char **token2, char **token3) {
+static enum http_type http_get_start_line (const struct http_scan *s,
+                                           unsigned int *pos,
+                                           struct http_slice *token1, 
+                                           struct http_slice *token2,
+                                           struct http_slice *token3) {
     unsigned int i;
     enum parse_state state = non_crlf;
     enum start_line_state start_state = got_none;
     char last_char = 0;
     enum http_type line_type = http_request_line;
-    char *src = *saveptr;
+    unsigned int start = *pos;
+    unsigned int token1_end = 0, token2_start = 0, token2_end = 0, token3_start = 0;
 
-    if (src == NULL) {
-        return http_done;
-    }
+    for (i = start; i < s->length; i++) {
+        unsigned char c;
 
-    *token1 = src;
-    *token2 = *token3 = NULL;
-    for (i=0; i < *length; i++) {
+        if (state == non_crlf && start_state == started_third) {
+            /* in the last token; only a CR changes the state */
+            i = http_scan_next_cr(s, i);
+            if (i >= s->length) {
+                break;
+            }
+        }
+        c = http_scan_byte(s, i);
       
         /* advance lexer state  */
-        if (src[i] == '\r') {
+        if (c == '\r') {
             if (state == non_crlf) {
                       state = first_cr;
             } else if (state == first_lf) {
                       state = second_cr;
             } 
-            src[i] = '.';  /* make printable, as a precaution */    
 
-        } else if (src[i] == '\n') {
+        } else if (c == '\n') {
             if (state == first_cr) {
                       state = first_lf;
             } else if (state == second_cr) {
                       state = second_lf;
             } 
-            src[i] = '.';  /* make printable, as a precaution */    
       
-        } else if (src[i] == ' ') {
+        } else if (c == ' ') {
             if (start_state == got_none) {
                       start_state = got_first;
             } else if (start_state == started_second) {
@@ -644,10 +664,11 @@ static enum http_type http_get_start_line (char **saveptr,
         } else {
 
             if (state == first_lf) {
-                      src[i-2] = 0;      /* NULL terminate token */
-                      *length = *length - i;
-                      *saveptr = &src[i];
+                      *pos = i;
                       if (start_state == started_third) {
+                          *token1 = http_token(s, start, token1_end);
+                          *token2 = http_token(s, token2_start, token2_end);
+                          *token3 = http_token(s, token3_start, i - 2);
                           return line_type;  
                       } else {
                           return http_malformed;
@@ -658,56 +679,70 @@ static enum http_type http_get_start_line (char **saveptr,
                       /*
                        * check for string "HTTP", which indicates a status line (not a response line)
                        */
-                      if (last_char == 0 && src[i] == 'H') {
+                      if (last_char == 0 && c == 'H') {
                           last_char = 'H';
-                      } else if ((last_char == 'H' || last_char == 'T') && src[i] == 'T') {
+                      } else if ((last_char == 'H' || last_char == 'T') && c == 'T') {
                           last_char = 'T';
-                      } else if (last_char == 'T' && src[i] == 'P') {
+                      } else if (last_char == 'T' && c == 'P') {
                           line_type = http_status_line;
                       }
             } else if (start_state == got_first) {
-                      src[i-1] = 0;      /* NULL terminate token */
-                      *token2 = &src[i];        
+                      token1_end = i - 1;      /* end of token */
+                      token2_start = i;
                       start_state = started_second;
             } else if (start_state == got_second) {
-                      src[i-1] = 0;      /* NULL terminate token */
-                      *token3 = &src[i];
+                      token2_end = i - 1;      /* end of token */
+                      token3_start = i;
                       start_state = started_third;
             }
             state = non_crlf;
         }
 
         if (state == second_lf) {
-            src[i-3] = 0;        /* NULL terminate token */
-            *length = *length - i;
-            *saveptr = &src[i];
+            *pos = i;
             return http_done;
         }
     }
   
-    *saveptr = NULL;
     return http_malformed;
 }
 
-static int http_header_select (char *h) {
-  return 1;
+/**
+ * \brief Grow the end of the header span to cover a token.
+ */
+static inline void http_span_add (unsigned int *span, const struct http_slice *t) {
+    if ((unsigned int)t->off + t->len > *span) {
+        *span = t->off + t->len;
+    }
 }
 
 #define PRINT_USERNAMES 1
 #define MAX_STRLEN 2048
 
+/**
+ * \brief Parse an http message header into token slices.
+ *
+ * \param msg The message to fill in
+ * \param s The data to parse
+ * \param span Set to the number of header bytes that the tokens cover
+ *
+ * \return 0 on success, PARSE_FAIL otherwise
+ */
 static int http_parse_message(struct http_message *msg,
-                             char *data,
-                             unsigned int length) {
+                              const struct http_scan *s,
+                              unsigned int *span) {
 
     struct http_header *hdr = NULL;
-    char *token1, *token2, *token3, *saveptr = NULL;
+    struct http_slice token1, token2, token3;
     enum http_type type = http_done;
-    unsigned int str_len = 0;
+    unsigned int pos = 0;
+    unsigned int scanned = 0;
+    int have_value = 0;
     int i = 0;
-    int rc = 0;
 
-    if (length < 4) {
+    *span = 0;
+
+    if (s->length < 4) {
         return PARSE_FAIL;
     }
 
@@ -715,16 +750,13 @@ static int http_parse_message(struct http_message *msg,
         return PARSE_FAIL;
     }
 
-    /*
-     * Parse start-line, and get request/status lines.
-     */
-    saveptr = data;
-
     /* Easy access to the header storage */
     hdr = &msg->header;
 
-    /* Try to get the start line of (header) data */
-    type = http_get_start_line(&saveptr, &length, &token1, &token2, &token3);
+    /*
+     * Parse start-line, and get request/status lines.
+     */
+    type = http_get_start_line(s, &pos, &token1, &token2, &token3);
 
     if (type == http_malformed) {
         return PARSE_FAIL;
@@ -732,227 +764,308 @@ static int http_parse_message(struct http_message *msg,
 
     if (type == http_request_line) {
         hdr->line_type = HTTP_LINE_REQUEST;
-
-        str_len = strnlen(token1, MAX_STRLEN);
-        hdr->line.request.method = calloc(str_len + 1, sizeof(char));
-        if (hdr->line.request.method == NULL) {
-            joy_log_err("calloc failed");
-            rc = PARSE_FAIL;
-            goto end;
-        }
-        strncpy(hdr->line.request.method, token1, str_len);
-
-        str_len = strnlen(token2, MAX_STRLEN);
-        hdr->line.request.uri = calloc(str_len + 1, sizeof(char));
-        if (hdr->line.request.uri == NULL) {
-            joy_log_err("calloc failed");
-            rc = PARSE_FAIL;
-            goto end;
-        }
-        strncpy(hdr->line.request.uri, token2, str_len);
-
-        str_len = strnlen(token3, MAX_STRLEN);
-        hdr->line.request.version = calloc(str_len + 1, sizeof(char));
-        if (hdr->line.request.version == NULL) {
-            joy_log_err("calloc failed");
-            rc = PARSE_FAIL;
-            goto end;
-        }
-        strncpy(hdr->line.request.version, token3, str_len);
-
+        hdr->line.request.method = token1;
+        hdr->line.request.uri = token2;
+        hdr->line.request.version = token3;
     } else if (type == http_status_line) {
         hdr->line_type = HTTP_LINE_STATUS;
-
-        str_len = strnlen(token1, MAX_STRLEN);
-        hdr->line.status.version = calloc(str_len + 1, sizeof(char));
-        if (hdr->line.status.version == NULL) {
-            joy_log_err("calloc failed");
-            rc = PARSE_FAIL;
-            goto end;
-        }
-        strncpy(hdr->line.status.version, token1, str_len);
-
-        str_len = strnlen(token2, MAX_STRLEN);
-        hdr->line.status.code = calloc(str_len + 1, sizeof(char));
-        if (hdr->line.status.code == NULL) {
-            joy_log_err("calloc failed");
-            rc = PARSE_FAIL;
-            goto end;
-        }
-        strncpy(hdr->line.status.code, token2, str_len);
-
-        str_len = strnlen(token3, MAX_STRLEN);
-        hdr->line.status.reason = calloc(str_len + 1, sizeof(char));
-        if (hdr->line.status.reason == NULL) {
-            joy_log_err("calloc failed");
-            rc = PARSE_FAIL;
-            goto end;
-        }
-        strncpy(hdr->line.status.reason, token3, str_len);
+        hdr->line.status.version = token1;
+        hdr->line.status.code = token2;
+        hdr->line.status.reason = token3;
+    }
+    if (type != http_done) {
+        http_span_add(span, &token1);
+        http_span_add(span, &token2);
+        http_span_add(span, &token3);
     }
 
+    /* the start line lexer stops on, rather than after, the final LF */
+    scanned = pos + 1;
+
     if (type != http_done) {
         /*
          * Get the header elements
          */
         for (i = 0; i < HTTP_MAX_HEADER_ELEMENTS; i++) {
-            type = http_get_next_line(&saveptr, &length, &token1, &token2);
+            type = http_get_next_line(s, &pos, &token1, &token2, &have_value);
 
-            if (! (type == http_header || (type == http_done && token1 && token2))) {
+            if (! (type == http_header || (type == http_done && have_value))) {
                 if (type == http_malformed) {
-                    rc = PARSE_FAIL;
-                    goto end;
+                    return PARSE_FAIL;
                 }
                 break;
             }
 
-            if (http_header_select(token1)) {
-                struct http_header_element *elem = &hdr->elements[hdr->num_elements];
-
-                str_len = strnlen(token1, MAX_STRLEN);
-                if (str_len == 0) {
-                    if (type == http_done) {
-                        break;
-                    } else {
-                        continue;
-                    }
+            if (token1.len == 0) {
+                if (type == http_done) {
+                    break;
+                } else {
+                    continue;
                 }
+            }
 
-                elem->name = calloc(str_len + 1, sizeof(char));
-                if (elem->name == NULL) {
-                    joy_log_err("calloc failed");
-                    rc = 1;
-                    goto end;
-                }
-                strncpy(elem->name, token1, str_len);
-
-                str_len = strnlen(token2, MAX_STRLEN);
-                elem->value = calloc(str_len + 1, sizeof(char));
-                if (elem->value == NULL) {
-                    joy_log_err("calloc failed");
-                    /* Don't want a dangling name */
-                    free(elem->name); elem->name = NULL;
-                    rc = 1;
-                    goto end;
-                }
-                strncpy(elem->value, token2, str_len);
+            hdr->elements[hdr->num_elements].name = token1;
+            hdr->elements[hdr->num_elements].value = token2;
+            http_span_add(span, &token1);
+            http_span_add(span, &token2);
 
-                /* Increment number of header elements */
-                hdr->num_elements++;
-            }
+            /* Increment number of header elements */
+            hdr->num_elements++;
 
             /* End of headers */
             if (type == http_done) break;
         }
+        scanned = pos;
     }
 
     /*
-     * Copy the initial "MAGIC" bytes of the HTTP body
+     * Copy the initial "MAGIC" bytes of the HTTP body; the bytes
+     * up to the end of the header are made printable
      */
-    if (type == http_done && (MAGIC != 0) && (length >= MAGIC)) {
-        msg->body = calloc(MAGIC, sizeof(char));
-        if (msg->body == NULL) {
-            joy_log_err("calloc failed");
-            rc = 1;
-            goto end;
+    if (type == http_done && (MAGIC != 0) && (s->length - pos >= MAGIC)) {
+        for (i = 0; i < MAGIC; i++) {
+            unsigned int k = pos + i;
+
+            if (k < scanned) {
+                msg->body[i] = http_printable(http_scan_byte(s, k), 0);
+            } else if (k < s->hdr_end) {
+                msg->body[i] = http_printable(http_scan_byte(s, k), 1);
+            } else {
+                msg->body[i] = http_scan_byte(s, k);
+            }
         }
-
-        memcpy(msg->body, saveptr, MAGIC);
         msg->body_length = MAGIC;
     }
 
-end:
-    if (rc == PARSE_FAIL) {
-        /* 
-         * Failed to properly parse the message.
-         * Free any memory that was allocated.
-         */
-        http_free_message(msg);
+    return 0;
+}
+
+/**
+ * \brief Copy the header bytes covered by the tokens of a message into
+ * the text buffer, in printable form.
+ *
+ * \param http HTTP structure pointer
+ * \param msg The message
+ * \param s The parsed data
+ * \param span Number of bytes to copy
+ *
+ * \return 0 on success, 1 on failure
+ */
+static int http_text_append(http_t *http,
+                             struct http_message *msg,
+                             const struct http_scan *s,
+                             unsigned int span) {
+    unsigned int i;
+
+    if (http->text_len + span > http->text_size) {
+        uint32_t size = http->text_size ? http->text_size : HTTP_TEXT_INIT;
+        char *text = NULL;
+
+        while (size < http->text_len + span) {
+            size *= 2;
+        }
+        text = joy_arena_realloc(http->arena, http->text, http->text_size, size);
+        if (text == NULL) {
+            joy_log_err("realloc failed");
+            return 1;
+        }
+        http->text = text;
+        http->text_size = size;
     }
 
-    return rc;
+    for (i = 0; i < span; i++) {
+        http->text[http->text_len + i] = http_printable(http_scan_byte(s, i), 0);
+    }
+    msg->base = http->text_len;
+    http->text_len += span;
+
+    return 0;
 }
 
-static void http_print_message(zfile f,
+/**
+ * \brief Hash the header names of a request, in the order that they
+ * were sent and joined by ',', as a fingerprint of the client.
+ *
+ * \param http HTTP structure pointer
+ * \param msg The message, whose header is already in the text buffer
+ *
+ * \return none
+ */
+static void http_get_header_hash(const http_t *http,
+                                 struct http_message *msg) {
+    const char *base = http->text + msg->base;
+    MD5_CTX ctx;
+    int i = 0;
+
+    MD5_Init(&ctx);
+    for (i = 0; i < msg->header.num_elements; i++) {
+        const struct http_slice *name = &msg->header.elements[i].name;
+
+        if (i) {
+            MD5_Update(&ctx, ",", 1);
+        }
+        MD5_Update(&ctx, base + name->off, name->len);
+    }
+    MD5_Final(msg->header_hash, &ctx);
+    msg->have_header_hash = 1;
+}
+
+/** arguments for emit_string() of a token */
+#define SLICE(base, t) (base) + (t).off, (t).len
+
+/* one member of the req/resp array: an object holding key and a token */
+static void http_print_slice(emitter_t *e,
+                             const char *key,
+                             const char *s,
+                             size_t len) {
+    emit_map_begin(e, NULL);
+    emit_string(e, key, s, len);
+    emit_map_end(e);
+}
+
+#if PRINT_USERNAMES
+/* the (anonymized) usernames found in the URI, as zprintf_usernames() */
+static void http_print_usernames(emitter_t *e,
+                                 const struct matches *matches,
+                                 char *text) {
+    unsigned int i;
+    char tmp[1024];
+    char hex[33];
+
+    emit_array_begin(e, "usernames");
+    for (i = 0; i < matches->count; i++) {
+        size_t len = matches->stop[i] - matches->start[i] + 1;
+        if (len >= 1024) {
+            break; /* error state */
+        }
+        if ((matches->start[i] == 0 || is_special(text + matches->start[i] - 1)) &&
+            is_special(text + matches->stop[i] + 1)) {
+            memcpy(tmp, text + matches->start[i], len);
+            tmp[len] = 0;
+            if (anon_string(tmp, len, hex, sizeof(hex)) == ok) {
+                emit_string(e, NULL, hex, strlen(hex));
+            }
+        }
+    }
+    emit_array_end(e);
+}
+#endif
+
+static void http_print_message(emitter_t *e,
+                               const char *key,
+                               const http_t *http,
                                const struct http_message *msg) {
 
+    const char *base = http->text + msg->base;
     struct matches matches;
-    int comma = 0;
     int i = 0;
 
     /*
      * Start req/resp array
      */
-    zprintf(f, "[");
+    emit_array_begin(e, key);
 
     if (msg->header.line_type == HTTP_LINE_STATUS) {
         const struct http_header_status_line *line = &msg->header.line.status;
 
-        zprintf(f, "{\"version\":\"%s\"},"
-                "{\"code\":\"%s\"},"
-                "{\"reason\":\"%s\"}",
-                line->version, line->code, line->reason);
-
-        comma = 1;
+        http_print_slice(e, "version", SLICE(base, line->version));
+        http_print_slice(e, "code", SLICE(base, line->code));
+        http_print_slice(e, "reason", SLICE(base, line->reason));
     }
     else if (msg->header.line_type == HTTP_LINE_REQUEST) {
         const struct http_header_request_line *line = &msg->header.line.request;
+        char uri[MAX_STRLEN + 1];
 
-        zprintf(f, "{\"method\":\"%s\"},", line->method);
-        zprintf(f, "{\"uri\":\"");
+        http_print_slice(e, "method", SLICE(base, line->method));
         if (usernames_ctx) {
+            memcpy(uri, base + line->uri.off, line->uri.len);
+            uri[line->uri.len] = 0;
             str_match_ctx_find_all_longest(usernames_ctx,
-                                           (unsigned char*)line->uri,
-                                           strlen(line->uri), &matches);
-            anon_print_uri_pseudonym(f, &matches, line->uri);
+                                           (unsigned char*)uri,
+                                           line->uri.len, &matches);
+            emit_map_begin(e, NULL);
+            anon_print_uri_pseudonym(emit_string_begin(e, "uri"), &matches, uri);
+            emit_string_end(e);
+            emit_map_end(e);
         } else {
-            zprintf(f, "%s", line->uri);
+            http_print_slice(e, "uri", SLICE(base, line->uri));
         }
-        zprintf(f, "\"},");
-        zprintf(f, "{\"version\":\"%s\"}", line->version);
+        http_print_slice(e, "version", SLICE(base, line->version));
 
 #if PRINT_USERNAMES
         /*
          * Print out (anonymized) usernames found in URI
          */
         if (usernames_ctx) {
-            zprintf(f, ",{");
-            zprintf_usernames(f, &matches, line->uri, is_special, anon_string);
-            zprintf(f, "}");
+            emit_map_begin(e, NULL);
+            http_print_usernames(e, &matches, uri);
+            emit_map_end(e);
         }
 #endif
-        comma = 1;
+    }
+
+    if (msg->have_header_hash) {
+        emit_map_begin(e, NULL);
+        emit_hex(e, "header_hash", msg->header_hash, sizeof(msg->header_hash));
+        emit_map_end(e);
     }
 
     for (i = 0; i < msg->header.num_elements; i++) {
         const struct http_header_element *elem = &msg->header.elements[i];
 
-        if (elem->name && elem->value) {
-            if (comma) {
-                zprintf(f, ",{\"%s\":\"%s\"}", elem->name, elem->value);
-            } else {
-                zprintf(f, "{\"%s\":\"%s\"}", elem->name, elem->value);
-            }
+        /* the headers are kept as slices, and only the selected ones printed */
+        if (!http_header_selected(base + elem->name.off, elem->name.len)) {
+            continue;
         }
 
-        comma = 1;
+        emit_map_begin(e, NULL);
+        emit_key(e, SLICE(base, elem->name));
+        emit_string(e, NULL, SLICE(base, elem->value));
+        emit_map_end(e);
     }
 
     /*
      * Print out the body
      */
-    if (msg->body) {
-        if (comma) {
-            zprintf(f, ",{\"body\":");
-        } else {
-            zprintf(f, "{\"body\":");
-        }
-        zprintf_raw_as_hex(f, (unsigned char*)msg->body, msg->body_length);
-        zprintf(f, "}");
+    if (msg->body_length) {
+        emit_map_begin(e, NULL);
+        emit_hex(e, "body", msg->body, msg->body_length);
+        emit_map_end(e);
     }
 
     /* End req/resp array */
-    zprintf(f, "]");
+    emit_array_end(e);
+}
+
+/**
+ * \brief Check whether a header is one of those that the http_headers
+ * option selects for output (a comma-separated list of names, matched
+ * without regard to case); all headers are, if it is not set.
+ *
+ * \param name The header name
+ * \param len Its length
+ *
+ * \return 1 if the header is selected, 0 otherwise
+ */
+static int http_header_selected(const char *name, unsigned int len) {
+    const char *list = glb_config->http_headers;
+    unsigned int i = 0;
+
+    if (list == NULL) {
+        return 1;
+    }
+
+    while (1) {
+        for (i = 0; i < len && tolower((unsigned char)list[i]) == tolower((unsigned char)name[i]); i++);
+        if (i == len && (list[i] == ',' || list[i] == '\0')) {
+            return 1;
+        }
+        list = strchr(list, ',');
+        if (list == NULL) {
+            return 0;
+        }
+        list++;
+    }
 }
 
 /**
@@ -962,18 +1075,116 @@ static void http_print_message(zfile f,
  */
 void http_unit_test()
 {
-#if 0
     int num_fails = 0;
+    http_t *http = NULL;
+    joy_arena_t arena;
+    const struct http_message *msg = NULL;
+    const char *base = NULL;
+    const char *request = "GET /a%20b HTTP/1.1\r\n"
+                          "Host: example.com\r\n"
+                          "User-Agent: \"quoted\"\r\n"
+                          "\r\n"
+                          "0123456789abcdefXYZ";
+    const char *response = "HTTP/1.1 404 Not Found\r\nServer: test\r\n\r\n";
+    const char *malformed = "GET / HTTP/1.1\r\nNoColon\r\nHost: x\r\n\r\n";
+    /* md5 of "Host,User-Agent" */
+    const unsigned char header_hash[16] = { 0x73, 0xfa, 0x0a, 0x49, 0xd3, 0x79, 0x05, 0x24,
+                                            0x5f, 0x0d, 0xfa, 0x2d, 0x5f, 0x2f, 0x76, 0x4b };
+    unsigned int fingerprint_hash = glb_config->fingerprint_hash;
+    zfile out = NULL;
+    emitter_t e;
+    const char *printed = NULL;
+    size_t printed_len = 0;
+    char buf[512] = { 0 };
 
     fprintf(info, "\n******************************\n");
     fprintf(info, "HTTP Unit Test starting...\n");
 
+    memset(&arena, 0, sizeof(arena));
+    http_init(&http, &arena);
+    if (http == NULL) {
+        fprintf(info, "error: could not allocate http_t\n");
+        return;
+    }
+
+    glb_config->fingerprint_hash = fingerprint_hash_add;
+    http_update(http, NULL, request, strlen(request), 1);
+    http_update(http, NULL, response, strlen(response), 1);
+    http_update(http, NULL, malformed, strlen(malformed), 1);
+    glb_config->fingerprint_hash = fingerprint_hash;
+
+    if (http->num_messages != 2) {
+        fprintf(info, "error: expected 2 messages, got %u\n", http->num_messages);
+        num_fails++;
+        goto end;
+    }
+
+    msg = &http->messages[0];
+    base = http->text + msg->base;
+    if (msg->header.line_type != HTTP_LINE_REQUEST ||
+        msg->header.line.request.uri.len != 6 ||
+        strncmp(base + msg->header.line.request.uri.off, "/a%20b", 6) != 0) {
+        fprintf(info, "error: request line not parsed\n");
+        num_fails++;
+    }
+    if (msg->header.num_elements != 2 ||
+        msg->header.elements[1].value.len != 8 ||
+        strncmp(base + msg->header.elements[1].value.off, ".quoted.", 8) != 0) {
+        fprintf(info, "error: request headers not parsed\n");
+        num_fails++;
+    }
+    if (msg->body_length != HTTP_BODY_MAGIC || memcmp(msg->body, "0123456789abcdef", HTTP_BODY_MAGIC)) {
+        fprintf(info, "error: request body not captured\n");
+        num_fails++;
+    }
+    if (!msg->have_header_hash || memcmp(msg->header_hash, header_hash, sizeof(header_hash))) {
+        fprintf(info, "error: request header hash does not match\n");
+        num_fails++;
+    }
+
+    msg = &http->messages[1];
+    base = http->text + msg->base;
+    if (msg->header.line_type != HTTP_LINE_STATUS ||
+        strncmp(base + msg->header.line.status.code.off, "404", msg->header.line.status.code.len) != 0 ||
+        msg->header.line.status.reason.len != 9) {
+        fprintf(info, "error: status line not parsed\n");
+        num_fails++;
+    }
+    if (msg->have_header_hash) {
+        fprintf(info, "error: response has a header hash\n");
+        num_fails++;
+    }
+
+    /* only the headers named by http_headers are printed */
+    out = zopen_memory();
+    if (out != NULL) {
+        char *http_headers = glb_config->http_headers;
+
+        glb_config->http_headers = "accept,user-agent";
+        emit_open(&e, out, emit_json, NULL);
+        http_print_message(&e, "out", http, &http->messages[0]);
+        emit_close(&e);
+        glb_config->http_headers = http_headers;
+        printed = zmemory(out, &printed_len);
+        if (printed != NULL && printed_len < sizeof(buf)) {
+            memcpy(buf, printed, printed_len);
+            buf[printed_len] = '\0';
+        }
+        if (strstr(buf, "\"User-Agent\"") == NULL || strstr(buf, "\"Host\"") != NULL) {
+            fprintf(info, "error: headers not selected\n");
+            num_fails++;
+        }
+        zclose(out);
+    }
+
+end:
+    http_delete(&http);
+    joy_arena_release(&arena);
+
     if (num_fails) {
         fprintf(info, "Finished - # of failures: %d\n", num_fails);
     } else {
         fprintf(info, "Finished - success\n");
     }
     fprintf(info, "******************************\n\n");
-#endif
 }
-
@@ -59,44 +59,18 @@
 
 
 /**
- * \fn static void vector_delete(vector_t **s_handle)
+ * \fn static void vector_init(joy_arena_t *arena, vector_t **s_handle)
  *
- * \brief Delete the memory of vector structure.
- *
- * \param s_handle Contains vector structure to delete.
- *
- * \return
- */
-static void vector_delete(vector_t **s_handle) {
-    vector_t *vector = *s_handle;
-
-    if (vector == NULL) {
-        return;
-    }
-    if (vector->bytes != NULL) {
-        free(vector->bytes);
-    }
-
-    free(vector);
-    *s_handle = NULL;
-}
-
-/**
- * \fn void ike_vector_init(ike_vector_t **s_handle)
- *
- * \brief Initialize the memory of vector structure.
+ * \brief Allocate an empty vector structure from the arena.
  *
+ * \param arena Arena to allocate from.
  * \param s_handle Contains vector structure to initialize.
  *
  * \return
  */
-static void vector_init(vector_t **s_handle) {
-
-    if (*s_handle != NULL) {
-        vector_delete(s_handle);
-    }
+static void vector_init(joy_arena_t *arena, vector_t **s_handle) {
 
-    *s_handle = calloc(1, sizeof(vector_t));
+    *s_handle = joy_arena_calloc(arena, sizeof(vector_t));
     if (*s_handle == NULL) {
         /* Allocation failed */
         joy_log_err("malloc failed");
@@ -105,66 +79,70 @@ static void vector_init(vector_t **s_handle) {
 }
 
 /**
- * \fn static void vector_set(vector_t *vector, const char *data, unsigned int len)
+ * \fn static void vector_set(joy_arena_t *arena, vector_t *vector, const char *data, unsigned int len)
  *
- * \brief Set the contents of vector structure to the specified data, freeing the previous
- * vector contents. The free occurs after the copy, so behavior is still
- * defined in the case that the previous vector contents overlap in memory with
- * the new vector contents.
+ * \brief Set the contents of vector structure to the specified data. The
+ * vector memory is reused when it is large enough, and the data may overlap
+ * the previous vector contents.
  *
+ * \param arena Arena to allocate from.
  * \param vector Pointer to the vector structure to be set.
  * \param data Pointer to byte array to be copied.
  * \param len Length of the byte array to be copied.
  *
  * \return
  */
-static void vector_set(vector_t *vector,
+static void vector_set(joy_arena_t *arena,
+                       vector_t *vector,
                        const char *data,
                        unsigned int len) {
     unsigned char *tmpptr = NULL;
 
-    tmpptr = malloc(len);
-    if (tmpptr == NULL) {
-        joy_log_err("malloc failed");
-        return;
-    }
-    memcpy(tmpptr, data, len);
-    if (vector->bytes != NULL) {
-        free(vector->bytes);
+    if (len > vector->size) {
+        tmpptr = joy_arena_alloc(arena, len);
+        if (tmpptr == NULL) {
+            joy_log_err("malloc failed");
+            return;
+        }
+        memcpy(tmpptr, data, len);
+        vector->bytes = tmpptr;
+        vector->size = len;
+    } else if (len > 0) {
+        memmove(vector->bytes, data, len);
     }
-    vector->bytes = tmpptr;
     vector->len = len;
 }
 
 /**
- * \fn static void vector_append(vector_t *vector, const char *data, unsigned int len)
+ * \fn static void vector_append(joy_arena_t *arena, vector_t *vector, const char *data, unsigned int len)
  *
  * \brief Append the specified data to the current contents of the vector
  * structure. If the vector structure is empty, this is equivalent to
  * vector_set.
  *
+ * \param arena Arena to allocate from.
  * \param vector Pointer to the vector structure to be appended to.
  * \param data Pointer to byte array to be appended.
  * \param len Length of the byte array to be appended.
  *
  * \return
  */
-static void vector_append(vector_t *vector,
+static void vector_append(joy_arena_t *arena,
+                          vector_t *vector,
                           const char *data,
                           unsigned int len) {
     unsigned char *tmpptr = NULL;
 
-    tmpptr = malloc(vector->len + len);
-    if (tmpptr == NULL) {
-        joy_log_err("malloc failed");
-        return;
-    }
-    memcpy(tmpptr, vector->bytes, vector->len);
-    memcpy(tmpptr + vector->len, data, len);
-    if (vector->bytes != NULL) {
-        free(vector->bytes);
+    if (vector->len + len > vector->size) {
+        tmpptr = joy_arena_realloc(arena, vector->bytes, vector->size, vector->len + len);
+        if (tmpptr == NULL) {
+            joy_log_err("malloc failed");
+            return;
+        }
+        vector->bytes = tmpptr;
+        vector->size = vector->len + len;
     }
-    vector->bytes = tmpptr;
+    memcpy(vector->bytes + vector->len, data, len);
     vector->len += len;
 }
 
@@ -2216,43 +2194,19 @@ print_hex:
     zprintf(f, "}");
 }
 
-/*
- * \fn static void ike_attribute_delete(ike_attribute_t **s_handle)
- *
- * \brief Delete attribute structure and free all associated memory.
- *
- * \param s_handle Contains attribute structure to delete.
- *
- * \return
- */
-static void ike_attribute_delete(ike_attribute_t **s_handle) {
-    ike_attribute_t *s = *s_handle;
-
-    if (s == NULL) {
-        return;
-    }
-    vector_delete(&s->data);
-
-    free(s);
-    *s_handle = NULL;
-}
-
 /**
- * \fn void ike_attribute_init(ike_attribute_t **s_handle)
+ * \fn void ike_attribute_init(joy_arena_t *arena, ike_attribute_t **s_handle)
  *
  * \brief Initialize the memory of attribute structure.
  *
+ * \param arena Arena to allocate from.
  * \param s_handle Contains attribute structure to initialize.
  *
  * \return
  */
-static void ike_attribute_init(ike_attribute_t **s_handle) {
-    
-    if (*s_handle != NULL) {
-        ike_attribute_delete(s_handle);
-    }
+static void ike_attribute_init(joy_arena_t *arena, ike_attribute_t **s_handle) {
 
-    *s_handle = calloc(1, sizeof(ike_attribute_t));
+    *s_handle = joy_arena_calloc(arena, sizeof(ike_attribute_t));
     if (*s_handle == NULL) {
         joy_log_err("malloc failed");
         return;
@@ -2260,17 +2214,18 @@ static void ike_attribute_init(ike_attribute_t **s_handle) {
 }
 
 /**
- * \fn static unsigned int ike_attribute_unmarshal(ike_attribute_t *s, const char *data, unsigned int len)
+ * \fn static unsigned int ike_attribute_unmarshal(joy_arena_t *arena, ike_attribute_t *s, const char *data, unsigned int len)
  *
  * \brief Unmarshal data into attribute structure (IKEv1 or IKEv2).
  *
+ * \param arena Arena to allocate from.
  * \param s Pointer to attribute structure.
  * \param data Pointer to data buffer.
  * \param len Length of data in bytes.
  *
  * \return Number of bytes unmarshalled from the data buffer, or 0 on failure.
  */
-static unsigned int ike_attribute_unmarshal(ike_attribute_t *s, const char *data, unsigned int len) {
+static unsigned int ike_attribute_unmarshal(joy_arena_t *arena, ike_attribute_t *s, const char *data, unsigned int len) {
     unsigned int offset = 0;
     unsigned int length;
 
@@ -2281,7 +2236,7 @@ static unsigned int ike_attribute_unmarshal(ike_attribute_t *s, const char *data
 
     s->encoding = (data[offset]&0x80) >> 7; // first bit determines TLV (0) or TV (1) encoding
     s->type = (raw_to_uint16(data+offset) & 0x7fff); offset+=2;
-    vector_init(&s->data);
+    vector_init(arena, &s->data);
 
     if (s->encoding == 0) {
         // TLV format
@@ -2290,14 +2245,14 @@ static unsigned int ike_attribute_unmarshal(ike_attribute_t *s, const char *data
             joy_log_err("length %u > len-offset %u", length, len-offset)
             return 0;
         }
-        vector_set(s->data, data+offset, length); offset+=length;
+        vector_set(arena, s->data, data+offset, length); offset+=length;
     } else {
         // TV format
         if (len-offset < 2) {
             joy_log_err("len-offset %u < 2", len-offset);
             return 0;
         }
-        vector_set(s->data, data+offset, 2); offset+=2;
+        vector_set(arena, s->data, data+offset, 2); offset+=2;
     }
 
     return offset;
@@ -2393,46 +2348,19 @@ static void ike_transform_v1_print_json(ike_transform_t *s, zfile f) {
     zprintf(f, "}");
 }
 
-/*
- * \fn static void ike_transform_delete(ike_transform_t **s_handle)
- *
- * \brief Delete transform structure and free all associated memory.
- *
- * \param s_handle Contains transform structure to delete.
- *
- * \return
- */
-static void ike_transform_delete(ike_transform_t **s_handle) {
-    ike_transform_t *s = *s_handle;
-    int i;
-
-    if (s == NULL) {
-        return;
-    }
-    for (i = 0; i < s->num_attributes; i++) {
-        ike_attribute_delete(&s->attributes[i]);
-    }
-
-    free(s);
-    *s_handle = NULL;
-}
-
 /**
- * \fn void ike_transform_init(ike_transform_t **s_handle)
+ * \fn void ike_transform_init(joy_arena_t *arena, ike_transform_t **s_handle)
  *
  * \brief Initialize the memory of transform structure.
  *
+ * \param arena Arena to allocate from.
  * \param s_handle Contains transform structure to initialize.
  *
  * \return
  */
-static void ike_transform_init(ike_transform_t **s_handle) {
+static void ike_transform_init(joy_arena_t *arena, ike_transform_t **s_handle) {
 
-    if (*s_handle != NULL) {
-        ike_transform_delete(s_handle);
-    }
-
-    *s_handle = calloc(1, sizeof(ike_transform_t));
+    *s_handle = joy_arena_calloc(arena, sizeof(ike_transform_t));
     if (*s_handle == NULL) {
         joy_log_err("malloc failed");
         return;
@@ -2440,17 +2368,18 @@ static void ike_transform_init(ike_transform_t **s_handle) {
 }
 
 /**
- * \fn static unsigned int ike_transform_unmarshal(ike_transform_t *s, const char *data, unsigned int len)
+ * \fn static unsigned int ike_transform_unmarshal(joy_arena_t *arena, ike_transform_t *s, const char *data, unsigned int len)
  *
  * \brief Unmarshal data into transform structure (IKEv2 only).
  *
+ * \param arena Arena to allocate from.
  * \param s Pointer to transform structure.
  * \param data Pointer to data buffer.
  * \param len Length of data in bytes.
  *
  * \return Number of bytes unmarshalled from the data buffer, or 0 on failure.
  */
-static unsigned int ike_transform_unmarshal(ike_transform_t *s, const char *data, unsigned int len) {
+static unsigned int ike_transform_unmarshal(joy_arena_t *arena, ike_transform_t *s, const char *data, unsigned int len) {
     unsigned int offset = 0;
     unsigned int length;
 
@@ -2473,8 +2402,8 @@ static unsigned int ike_transform_unmarshal(ike_transform_t *s, const char *data
     /* parse attributes */
     s->num_attributes = 0;
     while(offset < s->length && s->num_attributes < IKE_MAX_ATTRIBUTES) {
-        ike_attribute_init(&s->attributes[s->num_attributes]);
-        length = ike_attribute_unmarshal(s->attributes[s->num_attributes], data+offset, len-offset);
+        ike_attribute_init(arena, &s->attributes[s->num_attributes]);
+        length = ike_attribute_unmarshal(arena, s->attributes[s->num_attributes], data+offset, len-offset);
         if (length == 0) {
             joy_log_err("unable to unmarshal attribute");
             return 0;
@@ -2494,17 +2423,18 @@ static unsigned int ike_transform_unmarshal(ike_transform_t *s, const char *data
 }
  
 /**
- * \fn static unsigned int ike_transform_v1_unmarshal(ike_transform_t *s, const char *data, unsigned int len)
+ * \fn static unsigned int ike_transform_v1_unmarshal(joy_arena_t *arena, ike_transform_t *s, const char *data, unsigned int len)
  *
  * \brief Unmarshal data into transform structure (IKEv1 only).
  *
+ * \param arena Arena to allocate from.
  * \param s Pointer to transform structure.
  * \param data Pointer to data buffer.
  * \param len Length of data in bytes.
  *
  * \return Number of bytes unmarshalled from the data buffer, or 0 on failure.
  */
-static unsigned int ike_transform_v1_unmarshal(ike_transform_t *s, const char *data, unsigned int len) {
+static unsigned int ike_transform_v1_unmarshal(joy_arena_t *arena, ike_transform_t *s, const char *data, unsigned int len) {
     unsigned int offset = 0;
     unsigned int length;
 
@@ -2528,8 +2458,8 @@ static unsigned int ike_transform_v1_unmarshal(ike_transform_t *s, const char *d
     /* parse attributes */
     s->num_attributes = 0;
     while(offset < s->length && s->num_attributes < IKE_MAX_ATTRIBUTES) {
-        ike_attribute_init(&s->attributes[s->num_attributes]);
-        length = ike_attribute_unmarshal(s->attributes[s->num_attributes], data+offset, len-offset);
+        ike_attribute_init(arena, &s->attributes[s->num_attributes]);
+        length = ike_attribute_unmarshal(arena, s->attributes[s->num_attributes], data+offset, len-offset);
         if (length == 0) {
             joy_log_err("unable to unmarshal attribute");
             return 0;
@@ -2638,47 +2568,19 @@ static void ike_proposal_v1_print_json(ike_proposal_t *s, zfile f) {
     zprintf(f, "}");
 }
 
-/*
- * \fn static void ike_proposal_delete(ike_proposal_t **s_handle)
- *
- * \brief Delete proposal structure and free all associated memory.
- *
- * \param s_handle Contains proposal structure to delete.
- *
- * \return
- */
-static void ike_proposal_delete(ike_proposal_t **s_handle) {
-    ike_proposal_t *s = *s_handle;
-    int i;
-
-    if (s == NULL) {
-        return;
-    }
-    vector_delete(&s->spi);
-    for (i = 0; i < s->num_transforms; i++) {
-        ike_transform_delete(&s->transforms[i]);
-    }
-    
-    free(s);
-    *s_handle = NULL;
-}
-
 /**
- * \fn void ike_proposal_init(ike_proposal_t **s_handle)
+ * \fn void ike_proposal_init(joy_arena_t *arena, ike_proposal_t **s_handle)
  *
  * \brief Initialize the memory of proposal structure.
  *
+ * \param arena Arena to allocate from.
  * \param s_handle Contains proposal structure to initialize.
  *
  * \return
  */
-static void ike_proposal_init(ike_proposal_t **s_handle) {
+static void ike_proposal_init(joy_arena_t *arena, ike_proposal_t **s_handle) {
 
-    if (*s_handle != NULL) {
-        ike_proposal_delete(s_handle);
-    }
-
-    *s_handle = calloc(1, sizeof(ike_proposal_t));
+    *s_handle = joy_arena_calloc(arena, sizeof(ike_proposal_t));
     if (*s_handle == NULL) {
         joy_log_err("malloc failed");
         return;
@@ -2686,17 +2588,18 @@ static void ike_proposal_init(ike_proposal_t **s_handle) {
 }
 
 /**
- * \fn static unsigned int ike_proposal_unmarshal(ike_proposal_t *s, const char *data, unsigned int len)
+ * \fn static unsigned int ike_proposal_unmarshal(joy_arena_t *arena, ike_proposal_t *s, const char *data, unsigned int len)
  *
  * \brief Unmarshal data into proposal structure (IKEv2 only).
  *
+ * \param arena Arena to allocate from.
  * \param s Pointer to proposal structure.
  * \param data Pointer to data buffer.
  * \param len Length of data in bytes.
  *
  * \return Number of bytes unmarshalled from the data buffer, or 0 on failure.
  */
-static unsigned int ike_proposal_unmarshal(ike_proposal_t *s, const char *data, unsigned int len) {
+static unsigned int ike_proposal_unmarshal(joy_arena_t *arena, ike_proposal_t *s, const char *data, unsigned int len) {
     unsigned int offset = 0;
     unsigned int length;
     unsigned int spi_size;
@@ -2723,8 +2626,8 @@ static unsigned int ike_proposal_unmarshal(ike_proposal_t *s, const char *data,
     if (spi_size > len-offset) {
         return 0;
     }
-    vector_init(&s->spi);
-    vector_set(s->spi, data+offset, spi_size);
+    vector_init(arena, &s->spi);
+    vector_set(arena, s->spi, data+offset, spi_size);
     offset += spi_size;
     
     if (num_transforms > IKE_MAX_TRANSFORMS) {
@@ -2735,8 +2638,8 @@ static unsigned int ike_proposal_unmarshal(ike_proposal_t *s, const char *data,
     s->num_transforms = 0;
     last_transform = 3;
     while(offset < len && s->num_transforms < num_transforms && last_transform == 3) {
-        ike_transform_init(&s->transforms[s->num_transforms]);
-        length = ike_transform_unmarshal(s->transforms[s->num_transforms], data+offset, len-offset);
+        ike_transform_init(arena, &s->transforms[s->num_transforms]);
+        length = ike_transform_unmarshal(arena, s->transforms[s->num_transforms], data+offset, len-offset);
         if (length == 0) {
             return 0;
         }
@@ -2754,17 +2657,18 @@ static unsigned int ike_proposal_unmarshal(ike_proposal_t *s, const char *data,
 }
 
 /**
- * \fn static unsigned int ike_proposal_v1_unmarshal(ike_proposal_t *s, const char *data, unsigned int len)
+ * \fn static unsigned int ike_proposal_v1_unmarshal(joy_arena_t *arena, ike_proposal_t *s, const char *data, unsigned int len)
  *
  * \brief Unmarshal data into proposal structure (IKEv1 only).
  *
+ * \param arena Arena to allocate from.
  * \param s Pointer to proposal structure.
  * \param data Pointer to data buffer.
  * \param len Length of data in bytes.
  *
  * \return Number of bytes unmarshalled from the data buffer, or 0 on failure.
  */
-static unsigned int ike_proposal_v1_unmarshal(ike_proposal_t *s, const char *data, unsigned int len) {
+static unsigned int ike_proposal_v1_unmarshal(joy_arena_t *arena, ike_proposal_t *s, const char *data, unsigned int len) {
     unsigned int offset = 0;
     unsigned int length;
     unsigned int spi_size;
@@ -2794,8 +2698,8 @@ static unsigned int ike_proposal_v1_unmarshal(ike_proposal_t *s, const char *dat
         joy_log_err("spi_size %u > len-offset %u", spi_size, len-offset);
         return 0;
     }
-    vector_init(&s->spi);
-    vector_set(s->spi, data+offset, spi_size);
+    vector_init(arena, &s->spi);
+    vector_set(arena, s->spi, data+offset, spi_size);
     offset += spi_size;
 
     if (num_transforms > IKE_MAX_TRANSFORMS) {
@@ -2807,8 +2711,8 @@ static unsigned int ike_proposal_v1_unmarshal(ike_proposal_t *s, const char *dat
     s->num_transforms = 0;
     last_transform = 3;
     while(offset < len && s->num_transforms < num_transforms && last_transform == 3) {
-        ike_transform_init(&s->transforms[s->num_transforms]);
-        length = ike_transform_v1_unmarshal(s->transforms[s->num_transforms], data+offset, len-offset);
+        ike_transform_init(arena, &s->transforms[s->num_transforms]);
+        length = ike_transform_v1_unmarshal(arena, s->transforms[s->num_transforms], data+offset, len-offset);
         if (length == 0) {
             joy_log_err("unable to unmarshal transform");
             return 0;
@@ -2923,50 +2827,19 @@ static void ike_sa_v1_print_json(ike_sa_t *s, zfile f) {
     zprintf(f, "}");
 }
 
-/*
- * \fn static void ike_sa_delete(ike_sa_t **s_handle)
- *
- * \brief Delete security association structure and free all associated memory.
- *
- * \param s_handle Contains security association structure to delete.
- *
- * \return
- */
-static void ike_sa_delete(ike_sa_t **s_handle) {
-    ike_sa_t *s = *s_handle;
-    int i;
-
-    if (s == NULL) {
-        return;
-    }
-    vector_delete(&s->secrecy_level_v1);
-    vector_delete(&s->secrecy_category_v1);
-    vector_delete(&s->integrity_level_v1);
-    vector_delete(&s->integrity_category_v1);
-    for (i = 0; i < s->num_proposals; i++) {
-        ike_proposal_delete(&s->proposals[i]);
-    }
-
-    free(s);
-    *s_handle = NULL;
-}
-
 /**
- * \fn void ike_sa_init(ike_sa_t **s_handle)
+ * \fn void ike_sa_init(joy_arena_t *arena, ike_sa_t **s_handle)
  *
  * \brief Initialize the memory of security association structure.
  *
+ * \param arena Arena to allocate from.
  * \param s_handle Contains security association structure to initialize.
  *
  * \return
  */
-static void ike_sa_init(ike_sa_t **s_handle) {
-
-    if (*s_handle != NULL) {
-        ike_sa_delete(s_handle);
-    }
+static void ike_sa_init(joy_arena_t *arena, ike_sa_t **s_handle) {
 
-    *s_handle = calloc(1, sizeof(ike_sa_t));
+    *s_handle = joy_arena_calloc(arena, sizeof(ike_sa_t));
     if (*s_handle == NULL) {
         joy_log_err("malloc failed");
         return;
@@ -2974,17 +2847,18 @@ static void ike_sa_init(ike_sa_t **s_handle) {
 }
 
 /**
- * \fn static unsigned int ike_sa_unmarshal(ike_sa_t *s, const char *data, unsigned int len)
+ * \fn static unsigned int ike_sa_unmarshal(joy_arena_t *arena, ike_sa_t *s, const char *data, unsigned int len)
  *
  * \brief Unmarshal data into security association structure (IKEv2 only).
  *
+ * \param arena Arena to allocate from.
  * \param s Pointer to security association structure.
  * \param data Pointer to data buffer.
  * \param len Length of data in bytes.
  *
  * \return Number of bytes unmarshalled from the data buffer, or 0 on failure.
  */
-static unsigned int ike_sa_unmarshal(ike_sa_t *s, const char *data, unsigned int len) {
+static unsigned int ike_sa_unmarshal(joy_arena_t *arena, ike_sa_t *s, const char *data, unsigned int len) {
     unsigned int offset = 0;
     unsigned int length;
     unsigned int last_proposal;
@@ -2993,8 +2867,8 @@ static unsigned int ike_sa_unmarshal(ike_sa_t *s, const char *data, unsigned int
     s->num_proposals = 0;
     last_proposal = 2;
     while(offset < len && s->num_proposals < IKE_MAX_PROPOSALS && last_proposal == 2) {
-        ike_proposal_init(&s->proposals[s->num_proposals]);
-        length = ike_proposal_unmarshal(s->proposals[s->num_proposals], data+offset, len-offset);
+        ike_proposal_init(arena, &s->proposals[s->num_proposals]);
+        length = ike_proposal_unmarshal(arena, s->proposals[s->num_proposals], data+offset, len-offset);
         if (length == 0) {
             return 0;
         }
@@ -3008,17 +2882,18 @@ static unsigned int ike_sa_unmarshal(ike_sa_t *s, const char *data, unsigned int
 }
 
 /**
- * \fn static unsigned int ike_sa_v1_unmarshal(ike_sa_t *s, const char *data, unsigned int len)
+ * \fn static unsigned int ike_sa_v1_unmarshal(joy_arena_t *arena, ike_sa_t *s, const char *data, unsigned int len)
  *
  * \brief Unmarshal data into security association structure (IKEv1 only).
  *
+ * \param arena Arena to allocate from.
  * \param s Pointer to security association structure.
  * \param data Pointer to data buffer.
  * \param len Length of data in bytes.
  *
  * \return Number of bytes unmarshalled from the data buffer, or 0 on failure.
  */
-static unsigned int ike_sa_v1_unmarshal(ike_sa_t *s, const char *data, unsigned int len) {
+static unsigned int ike_sa_v1_unmarshal(joy_arena_t *arena, ike_sa_t *s, const char *data, unsigned int len) {
     unsigned int offset = 0;
     unsigned int length;
     unsigned int last_proposal;
@@ -3047,28 +2922,28 @@ static unsigned int ike_sa_v1_unmarshal(ike_sa_t *s, const char *data, unsigned
         if (s->situation_v1 & IKE_SIT_SECRECY_V1) {
             length = raw_to_uint16(data+offset); offset+=2;
             offset += 2; /* reserved */
-            vector_init(&s->secrecy_level_v1);
-            vector_set(s->secrecy_level_v1, data+offset, length);
+            vector_init(arena, &s->secrecy_level_v1);
+            vector_set(arena, s->secrecy_level_v1, data+offset, length);
             offset += length;
 
             length = raw_to_uint16(data+offset); offset+=2;
             offset += 2; /* reserved */
-            vector_init(&s->secrecy_category_v1);
-            vector_set(s->secrecy_category_v1, data+offset, (length+7)/8); /* length is in bits for bitmap */
+            vector_init(arena, &s->secrecy_category_v1);
+            vector_set(arena, s->secrecy_category_v1, data+offset, (length+7)/8); /* length is in bits for bitmap */
         }
 
         /* SIT_INTEGRITY */
         if (s->situation_v1 & IKE_SIT_INTEGRITY_V1) {
             length = raw_to_uint16(data+offset); offset+=2;
             offset += 2; /* reserved */
-            vector_init(&s->integrity_level_v1);
-            vector_set(s->integrity_level_v1, data+offset, length);
+            vector_init(arena, &s->integrity_level_v1);
+            vector_set(arena, s->integrity_level_v1, data+offset, length);
             offset += length;
 
             length = raw_to_uint16(data+offset); offset+=2;
             offset += 2; /* reserved */
-            vector_init(&s->integrity_category_v1);
-            vector_set(s->integrity_category_v1, data+offset, (length+7)/8); /* length is in bits for bitmap */
+            vector_init(arena, &s->integrity_category_v1);
+            vector_set(arena, s->integrity_category_v1, data+offset, (length+7)/8); /* length is in bits for bitmap */
         }
     } else {
         joy_log_err("DOI %u not supported", s->doi_v1);
@@ -3079,8 +2954,8 @@ static unsigned int ike_sa_v1_unmarshal(ike_sa_t *s, const char *data, unsigned
     s->num_proposals = 0;
     last_proposal = 2;
     while(offset < len && s->num_proposals < IKE_MAX_PROPOSALS && last_proposal == 2) {
-        ike_proposal_init(&s->proposals[s->num_proposals]);
-        length = ike_proposal_v1_unmarshal(s->proposals[s->num_proposals], data+offset, len-offset);
+        ike_proposal_init(arena, &s->proposals[s->num_proposals]);
+        length = ike_proposal_v1_unmarshal(arena, s->proposals[s->num_proposals], data+offset, len-offset);
         if (length == 0) {
             joy_log_err("unable to parse proposal");
             return 0;
@@ -3138,43 +3013,19 @@ static void ike_ke_v1_print_json(ike_ke_t *s, zfile f) {
     zprintf_raw_as_hex(f, s->data->bytes, s->data->len);
 }
 
-/*
- * \fn static void ike_ke_delete(ike_ke_t **s_handle)
- *
- * \brief Delete key exchange structure and free all associated memory.
- *
- * \param s_handle Contains key exchange structure to delete.
- *
- * \return
- */
-static void ike_ke_delete(ike_ke_t **s_handle) {
-    ike_ke_t *s = *s_handle;
-
-    if (s == NULL) {
-        return;
-    }
-    vector_delete(&s->data);
-
-    free(s);
-    *s_handle = NULL;
-}
-
 /**
- * \fn void ike_ke_init(ike_ke_t **s_handle)
+ * \fn void ike_ke_init(joy_arena_t *arena, ike_ke_t **s_handle)
  *
  * \brief Initialize the memory of key exchange structure.
  *
+ * \param arena Arena to allocate from.
  * \param s_handle Contains key exchange structure to initialize.
  *
  * \return
  */
-static void ike_ke_init(ike_ke_t **s_handle) {
-
-    if (*s_handle != NULL) {
-        ike_ke_delete(s_handle);
-    }
+static void ike_ke_init(joy_arena_t *arena, ike_ke_t **s_handle) {
 
-    *s_handle = calloc(1, sizeof(ike_ke_t));
+    *s_handle = joy_arena_calloc(arena, sizeof(ike_ke_t));
     if (*s_handle == NULL) {
         joy_log_err("malloc failed");
         return;
@@ -3182,17 +3033,18 @@ static void ike_ke_init(ike_ke_t **s_handle) {
 }
 
 /**
- * \fn static unsigned int ike_ke_unmarshal(ike_ke_t *s, const char *data, unsigned int len)
+ * \fn static unsigned int ike_ke_unmarshal(joy_arena_t *arena, ike_ke_t *s, const char *data, unsigned int len)
  *
  * \brief Unmarshal data into key exchange structure (IKEv2 only).
  *
+ * \param arena Arena to allocate from.
  * \param s Pointer to key exchange structure.
  * \param data Pointer to data buffer.
  * \param len Length of data in bytes.
  *
  * \return Number of bytes unmarshalled from the data buffer, or 0 on failure.
  */
-static unsigned int ike_ke_unmarshal(ike_ke_t *s, const char *data, unsigned int len) {
+static unsigned int ike_ke_unmarshal(joy_arena_t *arena, ike_ke_t *s, const char *data, unsigned int len) {
     unsigned int offset = 0;
 
     if (len < 4) {
@@ -3202,29 +3054,30 @@ static unsigned int ike_ke_unmarshal(ike_ke_t *s, const char *data, unsigned int
     s->group = raw_to_uint16(data+offset); offset+=2;
     offset+=2; /* reserved */
 
-    vector_init(&s->data);
-    vector_set(s->data, data+offset, len-offset);
+    vector_init(arena, &s->data);
+    vector_set(arena, s->data, data+offset, len-offset);
     offset += len-offset;
 
     return offset;
 }
 
 /**
- * \fn static unsigned int ike_ke_v1_unmarshal(ike_ke_t *s, const char *data, unsigned int len)
+ * \fn static unsigned int ike_ke_v1_unmarshal(joy_arena_t *arena, ike_ke_t *s, const char *data, unsigned int len)
  *
  * \brief Unmarshal data into key exchange structure (IKEv1 only).
  *
+ * \param arena Arena to allocate from.
  * \param s Pointer to key exchange structure.
  * \param data Pointer to data buffer.
  * \param len Length of data in bytes.
  *
  * \return Number of bytes unmarshalled from the data buffer, or 0 on failure.
  */
-static unsigned int ike_ke_v1_unmarshal(ike_ke_t *s, const char *data, unsigned int len) {
+static unsigned int ike_ke_v1_unmarshal(joy_arena_t *arena, ike_ke_t *s, const char *data, unsigned int len) {
     unsigned int offset = 0;
 
-    vector_init(&s->data);
-    vector_set(s->data, data+offset, len-offset);
+    vector_init(arena, &s->data);
+    vector_set(arena, s->data, data+offset, len-offset);
     offset += len-offset;
 
     return offset;
@@ -3288,43 +3141,19 @@ static void ike_id_v1_print_json(ike_id_t *s, zfile f) {
     zprintf(f, "}");
 }
 
-/*
- * \fn static void ike_id_delete(ike_id_t **s_handle)
- *
- * \brief Delete identity structure and free all associated memory.
- *
- * \param s_handle Contains identity structure to delete.
- *
- * \return
- */
-static void ike_id_delete(ike_id_t **s_handle) {
-    ike_id_t *s = *s_handle;
-
-    if (s == NULL) {
-        return;
-    }
-    vector_delete(&s->data);
-
-    free(s);
-    *s_handle = NULL;
-}
-
 /**
- * \fn void ike_id_init(ike_id_t **s_handle)
+ * \fn void ike_id_init(joy_arena_t *arena, ike_id_t **s_handle)
  *
  * \brief Initialize the memory of identity structure.
  *
+ * \param arena Arena to allocate from.
  * \param s_handle Contains identity structure to initialize.
  *
  * \return
  */
-static void ike_id_init(ike_id_t **s_handle) {
+static void ike_id_init(joy_arena_t *arena, ike_id_t **s_handle) {
 
-    if (*s_handle != NULL) {
-        ike_id_delete(s_handle);
-    }
-
-    *s_handle = calloc(1, sizeof(ike_id_t));
+    *s_handle = joy_arena_calloc(arena, sizeof(ike_id_t));
     if (*s_handle == NULL) {
         joy_log_err("malloc failed");
         return;
@@ -3332,17 +3161,18 @@ static void ike_id_init(ike_id_t **s_handle) {
 }
 
 /**
- * \fn static unsigned int ike_id_unmarshal(ike_id_t *s, const char *data, unsigned int len)
+ * \fn static unsigned int ike_id_unmarshal(joy_arena_t *arena, ike_id_t *s, const char *data, unsigned int len)
  *
  * \brief Unmarshal data into identity structure (IKEv1 or IKEv2).
  *
+ * \param arena Arena to allocate from.
  * \param s Pointer to identity structure.
  * \param data Pointer to data buffer.
  * \param len Length of data in bytes.
  *
  * \return Number of bytes unmarshalled from the data buffer, or 0 on failure.
  */
-static unsigned int ike_id_unmarshal(ike_id_t *s, const char *data, unsigned int len) {
+static unsigned int ike_id_unmarshal(joy_arena_t *arena, ike_id_t *s, const char *data, unsigned int len) {
     unsigned int offset = 0;
 
     if (len < 4) {
@@ -3352,8 +3182,8 @@ static unsigned int ike_id_unmarshal(ike_id_t *s, const char *data, unsigned int
     s->type = data[offset]; offset++;
     offset+=3; /* reserved */
 
-    vector_init(&s->data);
-    vector_set(s->data, data+offset, len-offset);
+    vector_init(arena, &s->data);
+    vector_set(arena, s->data, data+offset, len-offset);
     offset += len-offset;
 
     return offset;
@@ -3388,43 +3218,19 @@ static void ike_cert_print_json(ike_cert_t *s, zfile f) {
     zprintf(f, "}");
 }
 
-/*
- * \fn static void ike_cert_delete(ike_cert_t **s_handle)
- *
- * \brief Delete certificate structure and free all associated memory.
- *
- * \param s_handle Contains certificate structure to delete.
- *
- * \return
- */
-static void ike_cert_delete(ike_cert_t **s_handle) {
-    ike_cert_t *s = *s_handle;
-
-    if (s == NULL) {
-        return;
-    }
-    vector_delete(&s->data);
-
-    free(s);
-    *s_handle = NULL;
-}
-
 /**
- * \fn void ike_cert_init(ike_cert_t **s_handle)
+ * \fn void ike_cert_init(joy_arena_t *arena, ike_cert_t **s_handle)
  *
  * \brief Initialize the memory of certificate structure.
  *
+ * \param arena Arena to allocate from.
  * \param s_handle Contains certificate structure to initialize.
  *
  * \return
  */
-static void ike_cert_init(ike_cert_t **s_handle) {
-
-    if (*s_handle != NULL) {
-        ike_cert_delete(s_handle);
-    }
+static void ike_cert_init(joy_arena_t *arena, ike_cert_t **s_handle) {
 
-    *s_handle = calloc(1, sizeof(ike_cert_t));
+    *s_handle = joy_arena_calloc(arena, sizeof(ike_cert_t));
     if (*s_handle == NULL) {
         joy_log_err("malloc failed");
         return;
@@ -3432,17 +3238,18 @@ static void ike_cert_init(ike_cert_t **s_handle) {
 }
 
 /**
- * \fn static unsigned int ike_cert_unmarshal(ike_cert_t *s, const char *data, unsigned int len)
+ * \fn static unsigned int ike_cert_unmarshal(joy_arena_t *arena, ike_cert_t *s, const char *data, unsigned int len)
  *
  * \brief Unmarshal data into certificate structure (IKEv1 or IKEv2).
  *
+ * \param arena Arena to allocate from.
  * \param s Pointer to certificate structure.
  * \param data Pointer to data buffer.
  * \param len Length of data in bytes.
  *
  * \return Number of bytes unmarshalled from the data buffer, or 0 on failure.
  */
-static unsigned int ike_cert_unmarshal(ike_cert_t *s, const char *data, unsigned int len) {
+static unsigned int ike_cert_unmarshal(joy_arena_t *arena, ike_cert_t *s, const char *data, unsigned int len) {
     unsigned int offset = 0;
 
     if (len < 1) {
@@ -3451,8 +3258,8 @@ static unsigned int ike_cert_unmarshal(ike_cert_t *s, const char *data, unsigned
 
     s->encoding = data[offset]; offset++;
 
-    vector_init(&s->data);
-    vector_set(s->data, data+offset, len-offset);
+    vector_init(arena, &s->data);
+    vector_set(arena, s->data, data+offset, len-offset);
     offset += len-offset;
 
     return offset;
@@ -3487,43 +3294,19 @@ static void ike_cr_print_json(ike_cr_t *s, zfile f) {
     zprintf(f, "}");
 }
 
-/*
- * \fn static void ike_cr_delete(ike_cr_t **s_handle)
- *
- * \brief Delete certificate request structure and free all associated memory.
- *
- * \param s_handle Contains certificate request structure to delete.
- *
- * \return
- */
-static void ike_cr_delete(ike_cr_t **s_handle) {
-    ike_cr_t *s = *s_handle;
-
-    if (s == NULL) {
-        return;
-    }
-    vector_delete(&s->data);
-
-    free(s);
-    *s_handle = NULL;
-}
-
 /**
- * \fn void ike_cr_init(ike_cr_t **s_handle)
+ * \fn void ike_cr_init(joy_arena_t *arena, ike_cr_t **s_handle)
  *
  * \brief Initialize the memory of certificate request structure.
  *
+ * \param arena Arena to allocate from.
  * \param s_handle Contains certificate request structure to initialize.
  *
  * \return
  */
-static void ike_cr_init(ike_cr_t **s_handle) {
-
-    if (*s_handle != NULL) {
-        ike_cr_delete(s_handle);
-    }
+static void ike_cr_init(joy_arena_t *arena, ike_cr_t **s_handle) {
 
-    *s_handle = calloc(1, sizeof(ike_cr_t));
+    *s_handle = joy_arena_calloc(arena, sizeof(ike_cr_t));
     if (*s_handle == NULL) {
         joy_log_err("malloc failed");
         return;
@@ -3531,17 +3314,18 @@ static void ike_cr_init(ike_cr_t **s_handle) {
 }
 
 /**
- * \fn static unsigned int ike_cr_unmarshal(ike_cr_t *s, const char *data, unsigned int len)
+ * \fn static unsigned int ike_cr_unmarshal(joy_arena_t *arena, ike_cr_t *s, const char *data, unsigned int len)
  *
  * \brief Unmarshal data into certificate request structure (IKEv1 or IKEv2).
  *
+ * \param arena Arena to allocate from.
  * \param s Pointer to certificate request structure.
  * \param data Pointer to data buffer.
  * \param len Length of data in bytes.
  *
  * \return Number of bytes unmarshalled from the data buffer, or 0 on failure.
  */
-static unsigned int ike_cr_unmarshal(ike_cr_t *s, const char *data, unsigned int len) {
+static unsigned int ike_cr_unmarshal(joy_arena_t *arena, ike_cr_t *s, const char *data, unsigned int len) {
     unsigned int offset = 0;
 
     if (len < 1) {
@@ -3550,8 +3334,8 @@ static unsigned int ike_cr_unmarshal(ike_cr_t *s, const char *data, unsigned int
 
     s->encoding = data[offset]; offset++;
 
-    vector_init(&s->data);
-    vector_set(s->data, data+offset, len-offset);
+    vector_init(arena, &s->data);
+    vector_set(arena, s->data, data+offset, len-offset);
     offset += len-offset;
 
     return offset;
@@ -3587,42 +3371,18 @@ static void ike_auth_print_json(ike_auth_t *s, zfile f) {
 }
 
 /**
- * \fn static void ike_auth_delete(ike_auth_t **s_handle)
- *
- * \brief Delete authentication structure and free all associated memory.
- *
- * \param s_handle Contains authentication structure to delete.
- *
- * \return
- */
-static void ike_auth_delete(ike_auth_t **s_handle) {
-    ike_auth_t *s = *s_handle;
-
-    if (s == NULL) {
-        return;
-    }
-    vector_delete(&s->data);
-
-    free(s);
-    *s_handle = NULL;
-}
-
-/**
- * \fn void ike_auth_init(ike_auth_t **s_handle)
+ * \fn void ike_auth_init(joy_arena_t *arena, ike_auth_t **s_handle)
  *
  * \brief Initialize the memory of authentication structure.
  *
+ * \param arena Arena to allocate from.
  * \param s_handle Contains authentication structure to initialize.
  *
  * \return
  */
-static void ike_auth_init(ike_auth_t **s_handle) {
-
-    if (*s_handle != NULL) {
-        ike_auth_delete(s_handle);
-    }
+static void ike_auth_init(joy_arena_t *arena, ike_auth_t **s_handle) {
 
-    *s_handle = calloc(1, sizeof(ike_auth_t));
+    *s_handle = joy_arena_calloc(arena, sizeof(ike_auth_t));
     if (*s_handle == NULL) {
         joy_log_err("malloc failed");
         return;
@@ -3630,17 +3390,18 @@ static void ike_auth_init(ike_auth_t **s_handle) {
 }
 
 /**
- * \fn static unsigned int ike_auth_unmarshal(ike_auth_t *s, const char *data, unsigned int len)
+ * \fn static unsigned int ike_auth_unmarshal(joy_arena_t *arena, ike_auth_t *s, const char *data, unsigned int len)
  *
  * \brief Unmarshal data into authentication structure (IKEv2 only).
  *
+ * \param arena Arena to allocate from.
  * \param s Pointer to authentication structure.
  * \param data Pointer to data buffer.
  * \param len Length of data in bytes.
  *
  * \return Number of bytes unmarshalled from the data buffer, or 0 on failure.
  */
-static unsigned int ike_auth_unmarshal(ike_auth_t *s, const char *data, unsigned int len) {
+static unsigned int ike_auth_unmarshal(joy_arena_t *arena, ike_auth_t *s, const char *data, unsigned int len) {
     unsigned int offset = 0;
 
     if (len < 4) {
@@ -3650,8 +3411,8 @@ static unsigned int ike_auth_unmarshal(ike_auth_t *s, const char *data, unsigned
     s->method = data[offset]; offset++;
     offset+=3; /* reserved */
 
-    vector_init(&s->data);
-    vector_set(s->data, data+offset, len-offset);
+    vector_init(arena, &s->data);
+    vector_set(arena, s->data, data+offset, len-offset);
     offset += len-offset;
 
     return offset;
@@ -3673,42 +3434,18 @@ static void ike_hash_v1_print_json(ike_hash_t *s, zfile f) {
 }
 
 /**
- * \fn static void ike_hash_delete(ike_hash_t **s_handle)
- *
- * \brief Delete hash structure and free all associated memory.
- *
- * \param s_handle Contains hash structure to delete.
- *
- * \return
- */
-static void ike_hash_delete(ike_hash_t **s_handle) {
-    ike_hash_t *s = *s_handle;
-
-    if (s == NULL) {
-        return;
-    }
-    vector_delete(&s->data);
-
-    free(s);
-    *s_handle = NULL;
-}
-
-/**
- * \fn void ike_hash_init(ike_hash_t **s_handle)
+ * \fn void ike_hash_init(joy_arena_t *arena, ike_hash_t **s_handle)
  *
  * \brief Initialize the memory of hash structure.
  *
+ * \param arena Arena to allocate from.
  * \param s_handle Contains hash structure to initialize.
  *
  * \return
  */
-static void ike_hash_init(ike_hash_t **s_handle) {
-
-    if (*s_handle != NULL) {
-        ike_hash_delete(s_handle);
-    }
+static void ike_hash_init(joy_arena_t *arena, ike_hash_t **s_handle) {
 
-    *s_handle = calloc(1, sizeof(ike_hash_t));
+    *s_handle = joy_arena_calloc(arena, sizeof(ike_hash_t));
     if (*s_handle == NULL) {
         joy_log_err("malloc failed");
         return;
@@ -3716,21 +3453,22 @@ static void ike_hash_init(ike_hash_t **s_handle) {
 }
 
 /**
- * \fn static unsigned int ike_hash_v1_unmarshal(ike_hash_t *s, const char *data, unsigned int len)
+ * \fn static unsigned int ike_hash_v1_unmarshal(joy_arena_t *arena, ike_hash_t *s, const char *data, unsigned int len)
  *
  * \brief Unmarshal data into hash structure (IKEv1 only).
  *
+ * \param arena Arena to allocate from.
  * \param s Pointer to hash structure.
  * \param data Pointer to data buffer.
  * \param len Length of data in bytes.
  *
  * \return Number of bytes unmarshalled from the data buffer, or 0 on failure.
  */
-static unsigned int ike_hash_v1_unmarshal(ike_hash_t *s, const char *data, unsigned int len) {
+static unsigned int ike_hash_v1_unmarshal(joy_arena_t *arena, ike_hash_t *s, const char *data, unsigned int len) {
     unsigned int offset = 0;
 
-    vector_init(&s->data);
-    vector_set(s->data, data+offset, len-offset);
+    vector_init(arena, &s->data);
+    vector_set(arena, s->data, data+offset, len-offset);
     offset += len-offset;
 
     return offset;
@@ -3862,44 +3600,19 @@ static void ike_notify_v1_print_json(ike_notify_t *s, zfile f) {
     zprintf(f, "}");
 }
 
-/*
- * \fn static void ike_notify_delete(ike_notify_t **s_handle)
- *
- * \brief Delete notify structure and free all associated memory.
- *
- * \param s_handle Contains notify structure to delete.
- *
- * \return
- */
-static void ike_notify_delete(ike_notify_t **s_handle) {
-    ike_notify_t *s = *s_handle;
-
-    if (s == NULL) {
-        return;
-    }
-    vector_delete(&s->spi);
-    vector_delete(&s->data);
-
-    free(s);
-    *s_handle = NULL;
-}
-
 /**
- * \fn void ike_notify_init(ike_notify_t **s_handle)
+ * \fn void ike_notify_init(joy_arena_t *arena, ike_notify_t **s_handle)
  *
  * \brief Initialize the memory of notify structure.
  *
+ * \param arena Arena to allocate from.
  * \param s_handle Contains notify structure to initialize.
  *
  * \return
  */
-static void ike_notify_init(ike_notify_t **s_handle) {
-
-    if (*s_handle != NULL) {
-        ike_notify_delete(s_handle);
-    }
+static void ike_notify_init(joy_arena_t *arena, ike_notify_t **s_handle) {
 
-    *s_handle = calloc(1, sizeof(ike_notify_t));
+    *s_handle = joy_arena_calloc(arena, sizeof(ike_notify_t));
     if (*s_handle == NULL) {
         joy_log_err("malloc failed");
         return;
@@ -3907,17 +3620,18 @@ static void ike_notify_init(ike_notify_t **s_handle) {
 }
 
 /**
- * \fn static unsigned int ike_notify_unmarshal(ike_notify_t *s, const char *data, unsigned int len)
+ * \fn static unsigned int ike_notify_unmarshal(joy_arena_t *arena, ike_notify_t *s, const char *data, unsigned int len)
  *
  * \brief Unmarshal data into notify structure (IKEv2 only).
  *
+ * \param arena Arena to allocate from.
  * \param s Pointer to notify structure.
  * \param data Pointer to data buffer.
  * \param len Length of data in bytes.
  *
  * \return Number of bytes unmarshalled from the data buffer, or 0 on failure.
  */
-static unsigned int ike_notify_unmarshal(ike_notify_t *s, const char *data, unsigned int len) {
+static unsigned int ike_notify_unmarshal(joy_arena_t *arena, ike_notify_t *s, const char *data, unsigned int len) {
     unsigned int offset = 0;
     unsigned int spi_size;
 
@@ -3933,29 +3647,30 @@ static unsigned int ike_notify_unmarshal(ike_notify_t *s, const char *data, unsi
         return 0;
     }
 
-    vector_init(&s->spi);
-    vector_set(s->spi, data+offset, spi_size);
+    vector_init(arena, &s->spi);
+    vector_set(arena, s->spi, data+offset, spi_size);
     offset += spi_size;
 
-    vector_init(&s->data);
-    vector_set(s->data, data+offset, len-offset);
+    vector_init(arena, &s->data);
+    vector_set(arena, s->data, data+offset, len-offset);
     offset += len-offset;
 
     return offset;
 }
 
 /**
- * \fn static unsigned int ike_notify_v1_unmarshal(ike_notify_t *s, const char *data, unsigned int len)
+ * \fn static unsigned int ike_notify_v1_unmarshal(joy_arena_t *arena, ike_notify_t *s, const char *data, unsigned int len)
  *
  * \brief Unmarshal data into notify structure (IKEv1 only).
  *
+ * \param arena Arena to allocate from.
  * \param s Pointer to notify structure.
  * \param data Pointer to data buffer.
  * \param len Length of data in bytes.
  *
  * \return Number of bytes unmarshalled from the data buffer, or 0 on failure.
  */
-static unsigned int ike_notify_v1_unmarshal(ike_notify_t *s, const char *data, unsigned int len) {
+static unsigned int ike_notify_v1_unmarshal(joy_arena_t *arena, ike_notify_t *s, const char *data, unsigned int len) {
     unsigned int offset = 0;
     unsigned int spi_size;
 
@@ -3974,12 +3689,12 @@ static unsigned int ike_notify_v1_unmarshal(ike_notify_t *s, const char *data, u
         return 0;
     }
 
-    vector_init(&s->spi);
-    vector_set(s->spi, data+offset, spi_size);
+    vector_init(arena, &s->spi);
+    vector_set(arena, s->spi, data+offset, spi_size);
     offset += spi_size;
 
-    vector_init(&s->data);
-    vector_set(s->data, data+offset, len-offset);
+    vector_init(arena, &s->data);
+    vector_set(arena, s->data, data+offset, len-offset);
     offset += len-offset;
 
     return offset;
@@ -4000,43 +3715,19 @@ static void ike_nonce_print_json(ike_nonce_t *s, zfile f) {
     zprintf_raw_as_hex(f, s->data->bytes, s->data->len);
 }
 
-/*
- * \fn static void ike_nonce_delete(ike_nonce_t **s_handle)
- *
- * \brief Delete nonce structure and free all associated memory.
- *
- * \param s_handle Contains nonce structure to delete.
- *
- * \return
- */
-static void ike_nonce_delete(ike_nonce_t **s_handle) {
-    ike_nonce_t *s = *s_handle;
-
-    if (s == NULL) {
-        return;
-    }
-    vector_delete(&s->data);
-
-    free(s);
-    *s_handle = NULL;
-}
-
 /**
- * \fn void ike_nonce_init(ike_nonce_t **s_handle)
+ * \fn void ike_nonce_init(joy_arena_t *arena, ike_nonce_t **s_handle)
  *
  * \brief Initialize the memory of nonce structure.
  *
+ * \param arena Arena to allocate from.
  * \param s_handle Contains nonce structure to initialize.
  *
  * \return
  */
-static void ike_nonce_init(ike_nonce_t **s_handle) {
-
-    if (*s_handle != NULL) {
-        ike_nonce_delete(s_handle);
-    }
+static void ike_nonce_init(joy_arena_t *arena, ike_nonce_t **s_handle) {
 
-    *s_handle = calloc(1, sizeof(ike_nonce_t));
+    *s_handle = joy_arena_calloc(arena, sizeof(ike_nonce_t));
     if (*s_handle == NULL) {
         joy_log_err("malloc failed");
         return;
@@ -4044,10 +3735,11 @@ static void ike_nonce_init(ike_nonce_t **s_handle) {
 }
 
 /**
- * \fn static unsigned int ike_nonce_unmarshal(ike_nonce_t *s, const char *data, unsigned int len)
+ * \fn static unsigned int ike_nonce_unmarshal(joy_arena_t *arena, ike_nonce_t *s, const char *data, unsigned int len)
  *
  * \brief Unmarshal data into nonce structure (IKEv1 or IKEv2).
  *
+ * \param arena Arena to allocate from.
  * \param s Pointer to nonce structure.
  * \param data Pointer to data buffer.
  * \param len Length of data in bytes.
@@ -4055,11 +3747,11 @@ static void ike_nonce_init(ike_nonce_t **s_handle) {
  * \return Number of bytes unmarshalled from the data buffer, or 0 on failure.
  *
  */
-static unsigned int ike_nonce_unmarshal(ike_nonce_t *s, const char *data, unsigned int len) {
+static unsigned int ike_nonce_unmarshal(joy_arena_t *arena, ike_nonce_t *s, const char *data, unsigned int len) {
     unsigned int offset = 0;
 
-    vector_init(&s->data);
-    vector_set(s->data, data+offset, len-offset);
+    vector_init(arena, &s->data);
+    vector_set(arena, s->data, data+offset, len-offset);
     offset += len-offset;
 
     return offset;
@@ -4106,43 +3798,19 @@ static void ike_vendor_id_print_json(ike_vendor_id_t *s, zfile f) {
     }
 }
 
-/*
- * \fn static void ike_vendor_id_delete(ike_vendor_id_t **s_handle)
- *
- * \brief Delete vendor ID structure and free all associated memory.
- *
- * \param s_handle Contains vendor ID structure to delete.
- *
- * \return
- */
-static void ike_vendor_id_delete(ike_vendor_id_t **s_handle) {
-    ike_vendor_id_t *s = *s_handle;
-
-    if (s == NULL) {
-        return;
-    }
-    vector_delete(&s->data);
-
-    free(s);
-    *s_handle = NULL;
-}
-
 /**
- * \fn void ike_vendor_id_init(ike_vendor_id_t **s_handle)
+ * \fn void ike_vendor_id_init(joy_arena_t *arena, ike_vendor_id_t **s_handle)
  *
  * \brief Initialize the memory of vendor ID structure.
  *
+ * \param arena Arena to allocate from.
  * \param s_handle Contains vendor ID structure to initialize.
  *
  * \return
  */
-static void ike_vendor_id_init(ike_vendor_id_t **s_handle) {
-
-    if (*s_handle != NULL) {
-        ike_vendor_id_delete(s_handle);
-    }
+static void ike_vendor_id_init(joy_arena_t *arena, ike_vendor_id_t **s_handle) {
 
-    *s_handle = calloc(1, sizeof(ike_vendor_id_t));
+    *s_handle = joy_arena_calloc(arena, sizeof(ike_vendor_id_t));
     if (*s_handle == NULL) {
         joy_log_err("malloc failed");
         return;
@@ -4150,21 +3818,22 @@ static void ike_vendor_id_init(ike_vendor_id_t **s_handle) {
 }
 
 /**
- * \fn static unsigned int ike_vendor_id_unmarshal(ike_vendor_id_t *s, const char *data, unsigned int len)
+ * \fn static unsigned int ike_vendor_id_unmarshal(joy_arena_t *arena, ike_vendor_id_t *s, const char *data, unsigned int len)
  *
  * \brief Unmarshal data into vendor ID structure (IKEv1 or IKEv2).
  *
+ * \param arena Arena to allocate from.
  * \param s Pointer to vendor ID structure.
  * \param data Pointer to data buffer.
  * \param len Length of data in bytes.
  *
  * \return Number of bytes unmarshalled from the data buffer, or 0 on failure.
  */
-static unsigned int ike_vendor_id_unmarshal(ike_vendor_id_t *s, const char *data, unsigned int len) {
+static unsigned int ike_vendor_id_unmarshal(joy_arena_t *arena, ike_vendor_id_t *s, const char *data, unsigned int len) {
     unsigned int offset = 0;
 
-    vector_init(&s->data);
-    vector_set(s->data, data+offset, len-offset);
+    vector_init(arena, &s->data);
+    vector_set(arena, s->data, data+offset, len-offset);
     offset += len-offset;
 
     return offset;
@@ -4251,91 +3920,24 @@ static void ike_payload_print_json(ike_payload_t *s, zfile f) {
     zprintf(f, "}");
 }
 
-/*
- * \fn static void ike_payload_delete(ike_payload_t **s_handle)
- *
- * \brief Delete payload structure and free all associated memory.
- *
- * \param s_handle Contains payload structure to delete.
- *
- * \return
- */
-static void ike_payload_delete(ike_payload_t **s_handle) {
-    ike_payload_t *s = *s_handle;
-
-    if (s == NULL) {
-        return;
-    }
-
-    /* delete payload body */
-    switch(s->type) {
-        case IKE_SECURITY_ASSOCIATION_V2:
-        case IKE_SECURITY_ASSOCIATION_V1:
-            ike_sa_delete(&s->body->sa);
-            break;
-        case IKE_KEY_EXCHANGE_V2:
-        case IKE_KEY_EXCHANGE_V1:
-            ike_ke_delete(&s->body->ke);
-            break;
-        case IKE_IDENTIFICATION_INITIATOR_V2:
-        case IKE_IDENTIFICATION_RESPONDER_V2:
-        case IKE_IDENTIFICATION_V1:
-            ike_id_delete(&s->body->id);
-            break;
-        case IKE_CERTIFICATE_V2:
-        case IKE_CERTIFICATE_V1:
-            ike_cert_delete(&s->body->cert);
-            break;
-        case IKE_CERTIFICATE_REQUEST_V2:
-        case IKE_CERTIFICATE_REQUEST_V1:
-            ike_cr_delete(&s->body->cr);
-            break;
-        case IKE_AUTHENTICATION_V2:
-        case IKE_HASH_V1:
-            ike_hash_delete(&s->body->hash);
-            break;
-        case IKE_NONCE_V2:
-        case IKE_NONCE_V1:
-            ike_nonce_delete(&s->body->nonce);
-            break;
-        case IKE_NOTIFY_V2:
-        case IKE_NOTIFICATION_V1:
-            ike_notify_delete(&s->body->notify);
-            break;
-        case IKE_VENDOR_ID_V2:
-        case IKE_VENDOR_ID_V1:
-            ike_vendor_id_delete(&s->body->vendor_id);
-            break;
-        default:
-            break;
-    }
-
-    free(s->body);
-    free(s);
-    *s_handle = NULL;
-}
-
 /**
- * \fn void ike_payload_init(ike_payload_t **s_handle)
+ * \fn void ike_payload_init(joy_arena_t *arena, ike_payload_t **s_handle)
  *
  * \brief Initialize the memory of payload structure.
  *
+ * \param arena Arena to allocate from.
  * \param s_handle Contains payload structure to initialize.
  *
  * \return
  */
-static void ike_payload_init(ike_payload_t **s_handle) {
+static void ike_payload_init(joy_arena_t *arena, ike_payload_t **s_handle) {
 
-    if (*s_handle != NULL) {
-        ike_payload_delete(s_handle);
-    }
-
-    *s_handle = calloc(1, sizeof(ike_payload_t));
+    *s_handle = joy_arena_calloc(arena, sizeof(ike_payload_t));
     if (*s_handle == NULL) {
         joy_log_err("malloc failed");
         return;
     }
-    (*s_handle)->body = calloc(1, sizeof(union ike_payload_body));
+    (*s_handle)->body = joy_arena_calloc(arena, sizeof(union ike_payload_body));
     if ((*s_handle)->body == NULL) {
         joy_log_err("malloc failed");
         return;
@@ -4343,17 +3945,18 @@ static void ike_payload_init(ike_payload_t **s_handle) {
 }
 
 /**
- * \fn static unsigned int ike_payload_unmarshal(ike_payload_t *s, const char *data, unsigned int len)
+ * \fn static unsigned int ike_payload_unmarshal(joy_arena_t *arena, ike_payload_t *s, const char *data, unsigned int len)
  *
  * \brief Unmarshal data into payload structure (IKEv1 or IKEv2).
  *
+ * \param arena Arena to allocate from.
  * \param s Pointer to payload structure.
  * \param data Pointer to data buffer.
  * \param len Length of data in bytes.
  *
  * \return Number of bytes unmarshalled from the data buffer, or 0 on failure.
  */
-static unsigned int ike_payload_unmarshal(ike_payload_t *s, const char *data, unsigned int len) {
+static unsigned int ike_payload_unmarshal(joy_arena_t *arena, ike_payload_t *s, const char *data, unsigned int len) {
     unsigned int offset = 0;
     unsigned int length;
 
@@ -4372,62 +3975,62 @@ static unsigned int ike_payload_unmarshal(ike_payload_t *s, const char *data, un
     /* parse payload body */
     switch(s->type) {
         case IKE_SECURITY_ASSOCIATION_V2:
-            ike_sa_init(&s->body->sa);
-            length = ike_sa_unmarshal(s->body->sa, data+offset, length);
+            ike_sa_init(arena, &s->body->sa);
+            length = ike_sa_unmarshal(arena, s->body->sa, data+offset, length);
             break;
         case IKE_SECURITY_ASSOCIATION_V1:
-            ike_sa_init(&s->body->sa);
-            length = ike_sa_v1_unmarshal(s->body->sa, data+offset, length);
+            ike_sa_init(arena, &s->body->sa);
+            length = ike_sa_v1_unmarshal(arena, s->body->sa, data+offset, length);
             break;
         case IKE_KEY_EXCHANGE_V2:
-            ike_ke_init(&s->body->ke);
-            length = ike_ke_unmarshal(s->body->ke, data+offset, length);
+            ike_ke_init(arena, &s->body->ke);
+            length = ike_ke_unmarshal(arena, s->body->ke, data+offset, length);
             break;
         case IKE_KEY_EXCHANGE_V1:
-            ike_ke_init(&s->body->ke);
-            length = ike_ke_v1_unmarshal(s->body->ke, data+offset, length);
+            ike_ke_init(arena, &s->body->ke);
+            length = ike_ke_v1_unmarshal(arena, s->body->ke, data+offset, length);
             break;
         case IKE_IDENTIFICATION_INITIATOR_V2:
         case IKE_IDENTIFICATION_RESPONDER_V2:
         case IKE_IDENTIFICATION_V1:
-            ike_id_init(&s->body->id);
-            length = ike_id_unmarshal(s->body->id, data+offset, length);
+            ike_id_init(arena, &s->body->id);
+            length = ike_id_unmarshal(arena, s->body->id, data+offset, length);
             break;
         case IKE_CERTIFICATE_V2:
         case IKE_CERTIFICATE_V1:
-            ike_cert_init(&s->body->cert);
-            length = ike_cert_unmarshal(s->body->cert, data+offset, length);
+            ike_cert_init(arena, &s->body->cert);
+            length = ike_cert_unmarshal(arena, s->body->cert, data+offset, length);
             break;
         case IKE_CERTIFICATE_REQUEST_V2:
         case IKE_CERTIFICATE_REQUEST_V1:
-            ike_cr_init(&s->body->cr);
-            length = ike_cr_unmarshal(s->body->cr, data+offset, length);
+            ike_cr_init(arena, &s->body->cr);
+            length = ike_cr_unmarshal(arena, s->body->cr, data+offset, length);
             break;
         case IKE_AUTHENTICATION_V2:
-            ike_auth_init(&s->body->auth);
-            length = ike_auth_unmarshal(s->body->auth, data+offset, length);
+            ike_auth_init(arena, &s->body->auth);
+            length = ike_auth_unmarshal(arena, s->body->auth, data+offset, length);
             break;
         case IKE_HASH_V1:
-            ike_hash_init(&s->body->hash);
-            length = ike_hash_v1_unmarshal(s->body->hash, data+offset, length);
+            ike_hash_init(arena, &s->body->hash);
+            length = ike_hash_v1_unmarshal(arena, s->body->hash, data+offset, length);
             break;
         case IKE_NONCE_V2:
         case IKE_NONCE_V1:
-            ike_nonce_init(&s->body->nonce);
-            length = ike_nonce_unmarshal(s->body->nonce, data+offset, length);
+            ike_nonce_init(arena, &s->body->nonce);
+            length = ike_nonce_unmarshal(arena, s->body->nonce, data+offset, length);
             break;
         case IKE_NOTIFY_V2:
-            ike_notify_init(&s->body->notify);
-            length = ike_notify_unmarshal(s->body->notify, data+offset, length);
+            ike_notify_init(arena, &s->body->notify);
+            length = ike_notify_unmarshal(arena, s->body->notify, data+offset, length);
             break;
         case IKE_NOTIFICATION_V1:
-            ike_notify_init(&s->body->notify);
-            length = ike_notify_v1_unmarshal(s->body->notify, data+offset, length);
+            ike_notify_init(arena, &s->body->notify);
+            length = ike_notify_v1_unmarshal(arena, s->body->notify, data+offset, length);
             break;
         case IKE_VENDOR_ID_V2:
         case IKE_VENDOR_ID_V1:
-            ike_vendor_id_init(&s->body->vendor_id);
-            length = ike_vendor_id_unmarshal(s->body->vendor_id, data+offset, length);
+            ike_vendor_id_init(arena, &s->body->vendor_id);
+            length = ike_vendor_id_unmarshal(arena, s->body->vendor_id, data+offset, length);
             break;
         default:
             break;
@@ -4490,42 +4093,19 @@ static void ike_header_print_json(ike_header_t *s, zfile f) {
     zprintf(f, "}");
 }
 
-/*
- * \fn static void ike_header_delete(ike_header_t **s_handle)
- *
- * \brief Delete header structure and free all associated memory.
- *
- * \param s_handle Contains header structure to delete.
- *
- * \return
- */
-static void ike_header_delete(ike_header_t **s_handle) {
-    ike_header_t *s = *s_handle;
-
-    if (s == NULL) {
-        return;
-    }
-
-    free(s);
-    *s_handle = NULL;
-}
-
 /**
- * \fn void ike_header_init(ike_header_t **s_handle)
+ * \fn void ike_header_init(joy_arena_t *arena, ike_header_t **s_handle)
  *
  * \brief Initialize the memory of header structure.
  *
+ * \param arena Arena to allocate from.
  * \param s_handle Contains header structure to initialize.
  *
  * \return
  */
-static void ike_header_init(ike_header_t **s_handle) {
+static void ike_header_init(joy_arena_t *arena, ike_header_t **s_handle) {
 
-    if (*s_handle != NULL) {
-        ike_header_delete(s_handle);
-    }
-
-    *s_handle = calloc(1, sizeof(ike_header_t));
+    *s_handle = joy_arena_calloc(arena, sizeof(ike_header_t));
     if (*s_handle == NULL) {
         joy_log_err("malloc failed");
         return;
@@ -4533,17 +4113,18 @@ static void ike_header_init(ike_header_t **s_handle) {
 }
 
 /**
- * \fn static unsigned int ike_header_unmarshal(ike_header_t *s, const char *data, unsigned int len)
+ * \fn static unsigned int ike_header_unmarshal(joy_arena_t *arena, ike_header_t *s, const char *data, unsigned int len)
  *
  * \brief Unmarshal data into header structure (IKEv1 or IKEv2).
  *
+ * \param arena Arena to allocate from.
  * \param s Pointer to header structure.
  * \param data Pointer to data buffer.
  * \param len Length of data in bytes.
  *
  * \return Number of bytes unmarshalled from the data buffer, or 0 on failure.
  */
-static unsigned int ike_header_unmarshal(ike_header_t *s, const char *data, unsigned int len) {
+static unsigned int ike_header_unmarshal(joy_arena_t *arena, ike_header_t *s, const char *data, unsigned int len) {
     unsigned int offset = 0;
 
     if (s == NULL || data == NULL) {
@@ -4596,47 +4177,19 @@ static void ike_message_print_json(const ike_message_t *s, zfile f) {
     zprintf(f, "}");
 }
 
-/*
- * \fn static void ike_message_delete(ike_message_t **s_handle)
- *
- * \brief Delete message structure and free all associated memory.
- *
- * \param s_handle Contains message structure to delete.
- *
- * \return
- */
-static void ike_message_delete(ike_message_t **s_handle) {
-    ike_message_t *s = *s_handle;
-    int i;
-
-    if (s == NULL) {
-        return;
-    }
-    ike_header_delete(&s->header);
-    for (i = 0; i < s->num_payloads; i++) {
-        ike_payload_delete(&s->payloads[i]);
-    }
-    
-    free(s);
-    *s_handle = NULL;
-}
-
 /**
- * \fn void ike_message_init(ike_message_t **s_handle)
+ * \fn void ike_message_init(joy_arena_t *arena, ike_message_t **s_handle)
  *
  * \brief Initialize the memory of message structure.
  *
+ * \param arena Arena to allocate from.
  * \param s_handle Contains message structure to initialize.
  *
  * \return
  */
-static void ike_message_init(ike_message_t **s_handle) {
+static void ike_message_init(joy_arena_t *arena, ike_message_t **s_handle) {
 
-    if (*s_handle != NULL) {
-        ike_message_delete(s_handle);
-    }
-
-    *s_handle = calloc(1, sizeof(ike_message_t));
+    *s_handle = joy_arena_calloc(arena, sizeof(ike_message_t));
     if (*s_handle == NULL) {
         joy_log_err("malloc failed");
         return;
@@ -4644,24 +4197,25 @@ static void ike_message_init(ike_message_t **s_handle) {
 }
 
 /**
- * \fn static unsigned int ike_message_unmarshal(ike_message_t *s, const char *data, unsigned int len)
+ * \fn static unsigned int ike_message_unmarshal(joy_arena_t *arena, ike_message_t *s, const char *data, unsigned int len)
  *
  * \brief Unmarshal data into message structure (IKEv1 or IKEv2).
  *
+ * \param arena Arena to allocate from.
  * \param s Pointer to message structure.
  * \param data Pointer to data buffer.
  * \param len Length of data in bytes.
  *
  * \return Number of bytes unmarshalled from the data buffer, or 0 on failure.
  */
-static unsigned int ike_message_unmarshal(ike_message_t *s, const char *data, unsigned int len) {
+static unsigned int ike_message_unmarshal(joy_arena_t *arena, ike_message_t *s, const char *data, unsigned int len) {
     unsigned int offset = 0;
     unsigned int length;
     uint8_t next_payload;
 
     /* parse header */
-    ike_header_init(&s->header);
-    length = ike_header_unmarshal(s->header, data+offset, len-offset);
+    ike_header_init(arena, &s->header);
+    length = ike_header_unmarshal(arena, s->header, data+offset, len-offset);
     if (length == 0) {
         joy_log_err("unable to unmarshal header");
         return 0;
@@ -4681,9 +4235,9 @@ static unsigned int ike_message_unmarshal(ike_message_t *s, const char *data, un
     next_payload = s->header->next_payload;
     s->num_payloads = 0;
     while(offset < s->header->length && s->num_payloads < IKE_MAX_PAYLOADS && next_payload != IKE_NO_NEXT_PAYLOAD) {
-        ike_payload_init(&s->payloads[s->num_payloads]);
+        ike_payload_init(arena, &s->payloads[s->num_payloads]);
         s->payloads[s->num_payloads]->type = next_payload;
-        length = ike_payload_unmarshal(s->payloads[s->num_payloads], data+offset, len-offset);
+        length = ike_payload_unmarshal(arena, s->payloads[s->num_payloads], data+offset, len-offset);
         if (length == 0) {
             joy_log_err("unable to unmarshal payload");
             return 0;
@@ -4934,15 +4488,16 @@ static void ike_process(ike_t *init,
  */
 
 /**
- * \fn void ike_init(ike_t **ike_handle)
+ * \fn void ike_init(ike_t **ike_handle, joy_arena_t *arena)
  *
  * \brief Initialize the memory of IKE structure.
  *
  * \param ike_handle Contains IKE structure to initialize.
+ * \param arena arena of the flow record, backing the data of the structure
  *
  * \return
  */
-void ike_init(ike_t **ike_handle) {
+void ike_init(ike_t **ike_handle, joy_arena_t *arena) {
 
     if (*ike_handle != NULL) {
         ike_delete(ike_handle);
@@ -4953,7 +4508,7 @@ void ike_init(ike_t **ike_handle) {
         joy_log_err("malloc failed");
         return;
     }
-    vector_init(&(*ike_handle)->buffer);
+    (*ike_handle)->arena = arena;
 }
 
 /**
@@ -4979,6 +4534,7 @@ void ike_update(ike_t *ike,
         unsigned int len,
         unsigned int report_ike) {
     unsigned int length;
+    joy_arena_mark_t mark;
     const char *data_ptr = (const char *)data;
 
     if (len == 0) {
@@ -5004,16 +4560,20 @@ void ike_update(ike_t *ike,
     if (report_ike) {
 
     /* append application-layer data to buffer (to deal with IP fragmentation) */
-    vector_append(ike->buffer, data_ptr, len);
-    data_ptr = (const char *)ike->buffer->bytes;
-    len = ike->buffer->len;
+    vector_append(ike->arena, &ike->buffer, data_ptr, len);
+    data_ptr = (const char *)ike->buffer.bytes;
+    len = ike->buffer.len;
 
     while (len > 0 && ike->num_messages < IKE_MAX_MESSAGES) { /* parse all messages in the buffer */
-        ike_message_init(&ike->messages[ike->num_messages]);
-        length = ike_message_unmarshal(ike->messages[ike->num_messages], data_ptr, len);
+        /* a message that fails to parse is discarded by rewinding the arena */
+        joy_arena_mark(ike->arena, &mark);
+        ike_message_init(ike->arena, &ike->messages[ike->num_messages]);
+        length = ike_message_unmarshal(ike->arena, ike->messages[ike->num_messages], data_ptr, len);
         if (length == 0) {
             /* unable to parse message */
             joy_log_err("unable to parse message");
+            joy_arena_rewind(ike->arena, &mark);
+            ike->messages[ike->num_messages] = NULL;
             break;
         }
 
@@ -5024,7 +4584,7 @@ void ike_update(ike_t *ike,
     }
 
     /* update buffer */
-    vector_set(ike->buffer, data_ptr, len);
+    vector_set(ike->arena, &ike->buffer, data_ptr, len);
 
     } /* report_ike */
 }
@@ -5090,6 +4650,9 @@ void ike_print_json(const ike_t *data,
     zprintf(f, "}");
 }
 
+/* the JSON of ike is carried as text in CBOR output */
+define_print_text(ike)
+
 /**
  * \fn void ike_delete (const ike_t **ike_handle)
  *
@@ -5101,16 +4664,11 @@ void ike_print_json(const ike_t *data,
  */
 void ike_delete(ike_t **ike_handle) {
     ike_t *ike= *ike_handle;
-    int i;
 
     if (ike == NULL) {
         return;
     }
-    for (i = 0; i < ike->num_messages; i++) {
-        ike_message_delete(&ike->messages[i]);
-    }
 
-    vector_delete(&ike->buffer);
     free(ike);
     *ike_handle = NULL;
 }
@@ -5124,6 +4682,7 @@ void ike_delete(ike_t **ike_handle) {
  */
 static int ike_test_v1_handshake() {
     ike_t *init = NULL, *resp = NULL;
+    joy_arena_t arena;
     int num_fails = 0;
 
     /* input data */
@@ -5325,7 +4884,8 @@ static int ike_test_v1_handshake() {
         0xa3, 0x80, 0xbe, 0x24, 0x12, 0xe2, 0xc0, 0xd4
     };
 
-    ike_init(&init);
+    memset(&arena, 0, sizeof(arena));
+    ike_init(&init, &arena);
     ike_update(init, NULL, init_main_sa, sizeof(init_main_sa), 1);
     ike_update(init, NULL, init_main_notify, sizeof(init_main_notify), 1);
     ike_update(init, NULL, init_main_ke, sizeof(init_main_ke), 1);
@@ -5333,7 +4893,7 @@ static int ike_test_v1_handshake() {
     ike_update(init, NULL, init_main_hash, sizeof(init_main_hash), 1);
     ike_update(init, NULL, init_main_hash_2, sizeof(init_main_hash_2), 1);
 
-    ike_init(&resp);
+    ike_init(&resp, &arena);
     ike_update(resp, NULL, resp_main_sa, sizeof(resp_main_sa), 1);
     ike_update(resp, NULL, resp_main_sa_2, sizeof(resp_main_sa_2), 1);
     ike_update(resp, NULL, resp_main_ke, sizeof(resp_main_ke), 1);
@@ -5369,6 +4929,7 @@ static int ike_test_v1_handshake() {
 
     ike_delete(&init);
     ike_delete(&resp);
+    joy_arena_release(&arena);
     return num_fails;
 }
 
@@ -5381,6 +4942,7 @@ static int ike_test_v1_handshake() {
  */
 static int ike_test_v2_handshake() {
     ike_t *init = NULL, *resp = NULL;
+    joy_arena_t arena;
     int num_fails = 0;
 
     /* input data */
@@ -5518,12 +5080,13 @@ static int ike_test_v2_handshake() {
         0x68, 0x6f, 0x60, 0xca
     };
 
-    ike_init(&init);
+    memset(&arena, 0, sizeof(arena));
+    ike_init(&init, &arena);
     ike_update(init, NULL, init_sa, sizeof(init_sa), 1);
     ike_update(init, NULL, init_auth, sizeof(init_auth), 1);
     ike_update(init, NULL, init_info, sizeof(init_info), 1);
 
-    ike_init(&resp);
+    ike_init(&resp, &arena);
     ike_update(resp, NULL, resp_sa, sizeof(resp_sa), 1);
     ike_update(resp, NULL, resp_auth, sizeof(resp_auth), 1);
     ike_update(resp, NULL, resp_info, sizeof(resp_info), 1);
@@ -5557,6 +5120,7 @@ static int ike_test_v2_handshake() {
 
     ike_delete(&init);
     ike_delete(&resp);
+    joy_arena_release(&arena);
     return num_fails;
 }
 
@@ -97,8 +97,30 @@ joy_status_e anon_init(const char *pathname, FILE *logfile);
 /** \brief prints the subnets that have been anonymized to output file */
 int anon_print_subnets(FILE *f);
 
-/** \brief converts an address into an anonymized string */
-char *addr_get_anon_hexstring(const struct in_addr *a);
+/** length of an anonymized address string, including the terminating null */
+#define ANON_HEXSTRING_LEN 33
+
+/** number of entries in an anonymized address cache, as a power of two */
+#define ANON_ADDR_CACHE_BITS 10
+#define ANON_ADDR_CACHE_SIZE (1 << ANON_ADDR_CACHE_BITS)
+
+/** cache entry holding the anonymized string of an address */
+typedef struct {
+  struct in_addr addr;
+  unsigned char valid;
+  char hex[ANON_HEXSTRING_LEN];
+} anon_addr_cache_entry_t;
+
+/** direct mapped cache of anonymized addresses; one per thread of output */
+typedef struct {
+  anon_addr_cache_entry_t entry[ANON_ADDR_CACHE_SIZE];
+} anon_addr_cache_t;
+
+/**
+ * \brief converts an address into an anonymized string, written to
+ * hexout (ANON_HEXSTRING_LEN bytes); cache may be NULL
+ */
+char *addr_get_anon_hexstring(const struct in_addr *a, anon_addr_cache_t *cache, char *hexout);
 
 /** \brief determines if address is to be anonymized */
 unsigned int ipv4_addr_needs_anonymization(const struct in_addr *a);
@@ -0,0 +1,91 @@
+/*
+ *
+ * Copyright (c) 2018 Cisco Systems, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ *
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file arena.h
+ *
+ * \brief Bump allocator for per-flow protocol parser state (header)
+ */
+
+#ifndef JOY_ARENA_H
+#define JOY_ARENA_H
+
+#include <stddef.h>
+
+/** size of the pooled chunks that arenas allocate from */
+#define JOY_ARENA_CHUNK_SIZE 4096
+
+/** most chunks kept in the pool for reuse */
+#define JOY_ARENA_POOL_MAX 1024
+
+typedef struct joy_arena_chunk_ joy_arena_chunk_t;
+
+/**
+ * \brief An arena owns every allocation made from it; they are all
+ * released together by joy_arena_release().  A zeroed joy_arena_t is
+ * a valid, empty arena.
+ */
+typedef struct joy_arena_ {
+    joy_arena_chunk_t *chunks;  /**< every chunk, the most recently acquired first */
+    joy_arena_chunk_t *current; /**< chunk that allocations are taken from */
+} joy_arena_t;
+
+/**
+ * \brief A position in an arena, to discard everything allocated after it.
+ */
+typedef struct joy_arena_mark_ {
+    joy_arena_chunk_t *chunks;
+    joy_arena_chunk_t *current;
+    size_t used;
+} joy_arena_mark_t;
+
+void *joy_arena_alloc(joy_arena_t *arena, size_t len);
+
+void *joy_arena_calloc(joy_arena_t *arena, size_t len);
+
+void *joy_arena_realloc(joy_arena_t *arena, void *ptr, size_t old_len, size_t new_len);
+
+void joy_arena_mark(const joy_arena_t *arena, joy_arena_mark_t *mark);
+
+void joy_arena_rewind(joy_arena_t *arena, const joy_arena_mark_t *mark);
+
+void joy_arena_release(joy_arena_t *arena);
+
+void joy_arena_pool_cleanup(void);
+
+void joy_arena_unit_test(void);
+
+#endif /* JOY_ARENA_H */
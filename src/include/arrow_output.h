@@ -0,0 +1,140 @@
+/*
+ *
+ * Copyright (c) 2018 Cisco Systems, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ *
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file arrow_output.h
+ *
+ * \brief Columnar output of records, as Arrow IPC record batches
+ *
+ * Values are appended to columns, one row at a time, and a batch of
+ * rows is written out with arrow_batch_write() as one record batch of
+ * the Arrow IPC streaming format, preceded by the schema whenever the
+ * output has moved on to a new file.  The output can be read with
+ * pyarrow.ipc.open_stream() (after decompression), and by anything
+ * else that reads Arrow streams.
+ */
+
+#ifndef ARROW_OUTPUT_H
+#define ARROW_OUTPUT_H
+
+#include <stdint.h>
+#include "output.h"
+
+/** the column types that can be written */
+typedef enum arrow_type_ {
+    arrow_uint8 = 0,
+    arrow_uint16 = 1,
+    arrow_uint32 = 2,
+    arrow_uint64 = 3,
+    arrow_float64 = 4,
+    arrow_timestamp = 5,          /**< microseconds since the epoch, no time zone */
+    arrow_utf8 = 6,
+    arrow_list = 7,               /**< one child: the type of the items */
+    arrow_struct = 8              /**< one child per member */
+} arrow_type_e;
+
+/** description of a column, and of its children */
+typedef struct arrow_field_ {
+    const char *name;
+    arrow_type_e type;
+    unsigned int num_children;
+    const struct arrow_field_ *children;
+} arrow_field_t;
+
+/** the values of a column in the batch being built */
+typedef struct arrow_column_ {
+    const arrow_field_t *field;
+    size_t length;                /**< number of values */
+    size_t null_count;
+    unsigned char *valid;         /**< validity bitmap */
+    size_t valid_size;
+    unsigned char *data;          /**< fixed-width values, or utf8 bytes */
+    size_t data_len;
+    size_t data_size;
+    int32_t *offsets;             /**< utf8 and list: length + 1 offsets */
+    size_t offsets_size;
+    int failed;                   /**< a value could not be stored */
+    struct arrow_column_ *children;
+} arrow_column_t;
+
+/** a batch of rows, with a column for each field of the schema */
+typedef struct arrow_batch_ {
+    arrow_column_t root;          /**< struct column whose children are the columns */
+    unsigned long file_id;        /**< id of the zfile the schema was last written to */
+} arrow_batch_t;
+
+arrow_batch_t *arrow_batch_new(const arrow_field_t *schema);
+
+void arrow_batch_free(arrow_batch_t *b);
+
+void arrow_batch_reset(arrow_batch_t *b);
+
+int arrow_batch_write(arrow_batch_t *b, zfile f);
+
+void arrow_append_null(arrow_column_t *c);
+
+void arrow_append_uint(arrow_column_t *c, uint64_t value);
+
+void arrow_append_double(arrow_column_t *c, double value);
+
+void arrow_append_timeval(arrow_column_t *c, const struct timeval *ts);
+
+void arrow_append_string(arrow_column_t *c, const char *s, size_t len);
+
+void arrow_append_json_members(arrow_column_t *c, const char *s, size_t len);
+
+void arrow_end_list(arrow_column_t *c);
+
+void arrow_end_struct(arrow_column_t *c);
+
+void arrow_unit_test(void);
+
+/**
+ * \brief The i-th column of \p b.
+ */
+static __inline arrow_column_t *arrow_column (arrow_batch_t *b, unsigned int i) {
+    return &b->root.children[i];
+}
+
+/**
+ * \brief Number of rows in \p b; a row is complete once arrow_end_struct()
+ *        has been called on the root of \p b.
+ */
+static __inline size_t arrow_batch_rows (const arrow_batch_t *b) {
+    return b->root.length;
+}
+
+#endif /* ARROW_OUTPUT_H */
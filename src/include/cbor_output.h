@@ -0,0 +1,209 @@
+/*
+ *
+ * Copyright (c) 2018 Cisco Systems, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ *
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file cbor_output.h
+ *
+ * \brief Compact binary output of flow records, as CBOR (RFC 8949)
+ *
+ * Each record is one CBOR data item, prefixed with the self-describe
+ * tag, so that the output is a CBOR sequence (RFC 8742) that can be
+ * cut at any record boundary.  Flow records are maps whose keys are
+ * the small integers of cbor_flow_key_e (version CBOR_FLOW_VERSION of
+ * the schema); their values are integers, doubles, byte strings and
+ * arrays instead of decimal text.  The feature modules that print
+ * through an emitter (see emitter.h) are written as CBOR maps; output
+ * that only exists as JSON is carried as text strings holding that
+ * JSON verbatim.  A top level text string holds a whole line of JSON,
+ * such as the configuration.
+ *
+ * cbor_to_json() turns an item back into exactly the JSON that joy
+ * would have written; joy-convert does that for a whole file.
+ */
+
+#ifndef CBOR_OUTPUT_H
+#define CBOR_OUTPUT_H
+
+#include <stdint.h>
+#include "output.h"
+
+/** major types */
+#define CBOR_UINT   0
+#define CBOR_NINT   1
+#define CBOR_BYTES  2
+#define CBOR_TEXT   3
+#define CBOR_ARRAY  4
+#define CBOR_MAP    5
+#define CBOR_TAG    6
+#define CBOR_SIMPLE 7
+
+/** additional information of an indefinite length item, or a break */
+#define CBOR_INDEFINITE 31
+
+/** the self-describe tag, d9 d9 f7, that starts every record */
+#define CBOR_SELF_DESCRIBE 55799
+
+/** the version of the flow record schema written by this joy */
+#define CBOR_FLOW_VERSION 2
+
+/**
+ * keys of the flow record map, in the order in which they are written
+ * (which is the order of the JSON output); fields that JSON would
+ * omit are omitted
+ */
+typedef enum cbor_flow_key_ {
+    cbor_flow_version = 0,        /**< CBOR_FLOW_VERSION */
+    cbor_flow_sa = 1,             /**< the address as a number (10.0.0.1 is 0x0a000001), or anonymized text */
+    cbor_flow_da = 2,             /**< same as sa */
+    cbor_flow_pr = 3,
+    cbor_flow_sp = 4,             /**< only for TCP and UDP */
+    cbor_flow_dp = 5,
+    cbor_flow_labels = 6,         /**< JSON text of the subnet labels */
+    cbor_flow_bytes_out = 7,
+    cbor_flow_num_pkts_out = 8,
+    cbor_flow_bytes_in = 9,       /**< only for bidirectional flows */
+    cbor_flow_num_pkts_in = 10,
+    cbor_flow_time_start = 11,    /**< [seconds, microseconds] */
+    cbor_flow_time_end = 12,
+    cbor_flow_sample_rate = 13,
+    cbor_flow_packets = 14,       /**< [length, direction (0 out, 1 in), ipt in ms, ...] */
+    cbor_flow_byte_dist = 15,     /**< byte string, one byte per value */
+    cbor_flow_byte_dist_mean = 16,
+    cbor_flow_byte_dist_std = 17,
+    cbor_flow_compact_byte_dist = 18,
+    cbor_flow_entropy = 19,
+    cbor_flow_total_entropy = 20,
+    cbor_flow_p_malware = 21,
+    cbor_flow_ip = 22,            /**< [ttl out, [ids out], ttl in, [ids in]] */
+    cbor_flow_json = 23,          /**< tcp, the feature modules and the rest: an array of maps of
+                                       members and of JSON text (version 1: JSON text) */
+    cbor_flow_expire_type = 24,   /**< the expiration type character */
+    cbor_flow_max = 25
+} cbor_flow_key_e;
+
+/** a position in CBOR input */
+typedef struct cbor_reader_ {
+    const unsigned char *p;
+    const unsigned char *end;
+    int failed;                   /**< CBOR_TRUNCATED, CBOR_INVALID, or 0 */
+} cbor_reader_t;
+
+/** the input ended in the middle of an item */
+#define CBOR_TRUNCATED 1
+
+/** the input is not well-formed, or not what was expected */
+#define CBOR_INVALID 2
+
+void cbor_put_double(zfile f, double value);
+
+void cbor_put_text(zfile f, const char *s, size_t len);
+
+void cbor_put_bytes(zfile f, const unsigned char *data, size_t len);
+
+void cbor_reader_init(cbor_reader_t *r, const void *data, size_t len);
+
+int cbor_get_head(cbor_reader_t *r, unsigned int *major, uint64_t *value);
+
+int cbor_get_uint(cbor_reader_t *r, uint64_t *value);
+
+int cbor_get_double(cbor_reader_t *r, double *value);
+
+int cbor_get_string(cbor_reader_t *r, unsigned int major, const char **s, size_t *len);
+
+int cbor_skip(cbor_reader_t *r);
+
+long cbor_item_size(const void *data, size_t len);
+
+int cbor_to_json(const void *data, size_t len, zfile out);
+
+int cbor_unit_test(void);
+
+/**
+ * \brief Append the head of an item of type \p major to \p f: the
+ *        value of an integer, or the length of a string or array.
+ */
+static __inline void cbor_put_head (zfile f, unsigned int major, uint64_t value) {
+    unsigned char *p = (unsigned char *)zreserve(f, 9);
+    unsigned int n, i;
+
+    major <<= 5;
+    if (value < 24) {
+        p[0] = (unsigned char)(major | value);
+        f->len++;
+        return;
+    } else if (value <= 0xff) {
+        p[0] = (unsigned char)(major | 24);
+        n = 1;
+    } else if (value <= 0xffff) {
+        p[0] = (unsigned char)(major | 25);
+        n = 2;
+    } else if (value <= 0xffffffff) {
+        p[0] = (unsigned char)(major | 26);
+        n = 4;
+    } else {
+        p[0] = (unsigned char)(major | 27);
+        n = 8;
+    }
+    for (i = n; i > 0; i--) {
+        p[i] = (unsigned char)value;
+        value >>= 8;
+    }
+    f->len += n + 1;
+}
+
+/**
+ * \brief Append an unsigned integer to \p f.
+ */
+static __inline void cbor_put_uint (zfile f, uint64_t value) {
+    cbor_put_head(f, CBOR_UINT, value);
+}
+
+/**
+ * \brief Append a simple value (such as 22, null) or a break (31) to \p f.
+ */
+static __inline void cbor_put_simple (zfile f, unsigned int value) {
+    zputc(f, (char)((CBOR_SIMPLE << 5) | value));
+}
+
+/**
+ * \brief Start a map, or an array, of indefinite length, which is
+ *        ended with cbor_put_simple(f, CBOR_INDEFINITE).
+ */
+static __inline void cbor_put_indefinite (zfile f, unsigned int major) {
+    zputc(f, (char)((major << 5) | CBOR_INDEFINITE));
+}
+
+#endif /* CBOR_OUTPUT_H */
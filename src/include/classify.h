@@ -46,6 +46,7 @@
 #ifdef WIN32
 #include "win_types.h"
 #endif
+#include "err.h"
 
 /* constants */
 #define NUM_PARAMETERS_SPLT_LOGREG 208
@@ -63,8 +64,42 @@ typedef enum {
     BD_PARAM_TYPE = 1
 } classifier_type_codes_t;
 
-extern float parameters_bd[NUM_PARAMETERS_BD_LOGREG];
-extern float parameters_splt[NUM_PARAMETERS_SPLT_LOGREG];
+/** Logistic regression parameters of the classifier */
+typedef struct classifier_params_ {
+    float splt[NUM_PARAMETERS_SPLT_LOGREG];
+    float bd[NUM_PARAMETERS_BD_LOGREG];
+} classifier_params_t;
+
+/** number of flows that a classifier batch scores together */
+#define CLASSIFIER_BATCH_SIZE 64
+
+/** number of flows whose features are interleaved in a batch matrix */
+#define CLASSIFIER_LANES 4
+
+/** offset of the first feature of column \p c of a matrix of \p n features */
+#define CLASSIFIER_COLUMN(c, n) \
+    (((c) / CLASSIFIER_LANES) * (n) * CLASSIFIER_LANES + (c) % CLASSIFIER_LANES)
+
+/**
+ * Flows queued for classification.  The features of each model form
+ * a matrix with one column per flow, stored in blocks of
+ * CLASSIFIER_LANES columns: within a block, feature i of every flow
+ * comes before feature i+1 of any, so a block can be scored with one
+ * vector operation per feature.
+ */
+typedef struct classifier_batch_ {
+    unsigned int num_flows;                  /*!< flows in the batch */
+    unsigned int next;                       /*!< next flow to take a score */
+    unsigned int num_splt;                   /*!< columns of the splt matrix in use */
+    unsigned int num_bd;                     /*!< columns of the bd matrix in use */
+    const void *flow[CLASSIFIER_BATCH_SIZE]; /*!< handle of each flow */
+    uint16_t column[CLASSIFIER_BATCH_SIZE];  /*!< column of each flow in its matrix */
+    uint8_t use_bd[CLASSIFIER_BATCH_SIZE];   /*!< flow is scored with the bd model */
+    float splt_score[CLASSIFIER_BATCH_SIZE];
+    float bd_score[CLASSIFIER_BATCH_SIZE];
+    float splt[NUM_PARAMETERS_SPLT_LOGREG * CLASSIFIER_BATCH_SIZE];
+    float bd[NUM_PARAMETERS_BD_LOGREG * CLASSIFIER_BATCH_SIZE];
+} classifier_batch_t;
 
 /* Classifier functions */
 float classify(const unsigned short *pkt_len, const struct timeval *pkt_time,
@@ -80,7 +115,24 @@ void merge_splt_arrays(const uint16_t *pkt_len, const struct timeval *pkt_time,
        uint16_t *merged_lens, uint16_t *merged_times,
        uint32_t max_num_pkt_len, uint32_t max_merged_num_pkts);
 
+void classifier_batch_reset(classifier_batch_t *batch);
+
+joy_status_e classifier_batch_add(classifier_batch_t *batch, const void *flow,
+       const unsigned short *pkt_len, const struct timeval *pkt_time,
+       const unsigned short *pkt_len_twin, const struct timeval *pkt_time_twin,
+       struct timeval start_time, struct timeval start_time_twin, uint32_t max_num_pkt_len,
+       uint16_t sp, uint16_t dp, uint32_t op, uint32_t ip, uint32_t np_o, uint32_t np_i,
+       uint32_t ob, uint32_t ib, uint16_t use_bd, const uint32_t *bd, const uint32_t *bd_t);
+
+void classifier_batch_score(classifier_batch_t *batch);
+
+joy_status_e classifier_batch_get(classifier_batch_t *batch, const void *flow, float *score);
+
 void update_params(classifier_type_codes_t param_type, char *param_file);
 
+joy_status_e update_ensemble(const char *ensemble_file);
+
+void classify_unit_test(void);
+
 #endif /* CLASSIFY_H */
 
@@ -50,6 +50,7 @@
 
 #include "output.h"
 #include "radix_trie.h"
+#include "snapshot.h"
 #include "feature.h"
 
 /** maximum line length */
@@ -66,6 +67,13 @@ enum SALT_algorithm {
   rle = 4
 };
 
+/** values of the fingerprint_hash option */
+enum fingerprint_hash_mode {
+  fingerprint_hash_off = 0,  /*!< no client fingerprint hashes */
+  fingerprint_hash_add = 1,  /*!< report hashes alongside the fields they cover */
+  fingerprint_hash_only = 2  /*!< report hashes in place of the fields they cover */
+};
+
 /** structure for the configuration parameters */
 struct configuration {
     unsigned int bidir;
@@ -82,6 +90,16 @@ struct configuration {
     unsigned int type;           /*!< 1=SPLT, 2=SALT */
     unsigned int retain_local;
     uint32_t max_records;
+    unsigned int async_output;   /*!< output buffers queued to a writer thread, 0 = write inline */
+    unsigned int compress_level; /*!< output compression level, 0 = library default */
+    unsigned int compress_threads; /*!< threads compressing output blocks, 0 = one stream */
+    unsigned int arrow_output;   /*!< write flow records as Arrow record batches instead of JSON */
+    unsigned int cbor_output;    /*!< write flow records as CBOR items instead of JSON */
+    char *shm_output;            /*!< shared memory ring that records are published to */
+    unsigned int shm_size;       /*!< size of that ring in megabytes, 0 = default */
+    unsigned int upload_workers; /*!< concurrent uploads, 0 = default */
+    unsigned int upload_retries; /*!< attempts after the first to upload a file */
+    unsigned int upload_bwlimit; /*!< kilobytes per second per upload, 0 = no limit */
     unsigned int nfv9_capture_port;
     unsigned int ipfix_collect_port;
     unsigned int ipfix_collect_online;
@@ -92,6 +110,12 @@ struct configuration {
     unsigned int verbosity;
     unsigned int show_config;
     unsigned int show_interfaces;
+    unsigned int sample_rate;    /*!< keep 1-in-N flows, by flow key hash */
+    unsigned int adaptive_sample; /*!< raise sample_rate when capture drops */
+    unsigned int inspect_bytes;  /*!< payload bytes inspected per flow direction, 0 = all */
+    unsigned int inspect_pkts;   /*!< payload packets inspected per flow direction, 0 = all */
+    unsigned int fingerprint_hash; /*!< enum fingerprint_hash_mode */
+    unsigned int fingerprint_match; /*!< percent of a TLS client fingerprint to match, 0 = off */
     enum SALT_algorithm salt_algo;
 
   
@@ -107,17 +131,20 @@ struct configuration {
     char *anon_http_file;
     char *upload_servername;
     char *upload_key;
+    char *upload_queue;          /*!< journal of the files waiting to be uploaded */
     char *params_url;
     char *params_file;
+    char *ensemble_file;         /*!< tree ensemble that replaces the SPLT/BD classifier */
     char *label_url;
     char *bpf_filter_exp;
+    char *http_headers;          /*!< comma-separated HTTP headers to report, NULL = all */
     char *subnet[MAX_NUM_FLAGS]; /*!< max defined in radix_trie.h    */
     char *ipfix_export_remote_host;
     char *ipfix_export_template;
     char *aux_resource_path;
     unsigned int num_subnets;    /*!< counts entries in subnet array */
     unsigned short compact_bd_mapping[COMPACT_BD_MAP_MAX];
-    radix_trie_t rt;
+    joy_snapshot_t labels;       /*!< radix_trie of the labeled subnets */
 };
 
 
@@ -48,7 +48,9 @@
 #include <stdint.h>
 #include <pcap.h>
 #include "output.h"
+#include "emitter.h"
 #include "utils.h"
+#include "arena.h"
 
 #ifdef WIN32
 # include <Winsock2.h>
@@ -103,9 +105,10 @@ typedef struct dhcp_ {
     joy_role_e role;
     dhcp_message_t messages[MAX_DHCP_LEN];
     uint16_t message_count;
+    joy_arena_t *arena; /* backs sname, file and option values */
 } dhcp_t;
 
-void dhcp_init(dhcp_t **dhcp_handle);
+void dhcp_init(dhcp_t **dhcp_handle, joy_arena_t *arena);
 
 void dhcp_update(dhcp_t *dhcp,
                  const struct pcap_pkthdr *header,
@@ -117,6 +120,10 @@ void dhcp_print_json(const dhcp_t *d1,
                      const dhcp_t *d2,
                      zfile f);
 
+void dhcp_print(const dhcp_t *d1,
+                const dhcp_t *d2,
+                emitter_t *e);
+
 void dhcp_delete(dhcp_t **dhcp_handle);
 
 void dhcp_unit_test();
@@ -43,6 +43,8 @@
 
 #include <pcap.h>
 #include "output.h"
+#include "emitter.h"
+#include "arena.h"
 
 /** usage string */
 #define dns_usage "  dns=1                      report DNS response information\n"
@@ -59,15 +61,28 @@
 /** maximum DNS name length */
 #define MAX_DNS_NAME_LEN 256
 
-/** DNS structure */
+struct dns_message;
+struct dns_answer;
+
+/** DNS structure: messages are parsed on arrival, names are kept once */
 typedef struct dns_ {
-  unsigned int pkt_count;                      /*!< packet count       */
-  char *dns_name[MAX_NUM_DNS_PKT];             /*!< DNS packets        */
-  unsigned short int pkt_len[MAX_NUM_DNS_PKT]; /*!< DNS packet lengths */
+  unsigned int pkt_count;                      /*!< message count      */
+  struct dns_message *msg;                     /*!< parsed messages    */
+  unsigned int msg_size;                       /*!< messages allocated */
+  struct dns_answer *rr;                       /*!< answers of all messages */
+  unsigned int rr_count;                       /*!< answers in use     */
+  unsigned int rr_size;                        /*!< answers allocated  */
+  char *names;                                 /*!< name pool, NUL separated */
+  unsigned int names_len;                      /*!< bytes in use       */
+  unsigned int names_size;                     /*!< bytes allocated    */
+  uint32_t *name_table;                        /*!< pool offsets, by hash of the name */
+  unsigned int name_buckets;                   /*!< slots in name_table */
+  unsigned int name_count;                     /*!< names in the pool  */
+  joy_arena_t *arena;                          /*!< arena of the flow record */
 } dns_t;
 
 /** initialize DNS structure */
-void dns_init(dns_t **dns_handle);
+void dns_init(dns_t **dns_handle, joy_arena_t *arena);
 
 /** DNS structure update */
 void dns_update(dns_t *dns, 
@@ -79,6 +94,9 @@ void dns_update(dns_t *dns,
 /** print DNS data out in JSON format */
 void dns_print_json(const dns_t *dns1, const dns_t *dns2, zfile f);
 
+/** print a DNS entry through an emitter */
+void dns_print(const dns_t *dns1, const dns_t *dns2, emitter_t *e);
+
 /** remove a DNS entry */
 void dns_delete(dns_t **dns_handle);
 
@@ -0,0 +1,112 @@
+/*
+ *
+ * Copyright (c) 2018 Cisco Systems, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ *
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file emitter.h
+ *
+ * \brief Format-agnostic output of the feature modules
+ *
+ * A feature module that prints through an emitter describes its
+ * output as maps, arrays, strings, byte strings and integers, and the
+ * emitter writes them either as JSON or as CBOR.  The JSON is that
+ * of the JSON output: byte strings become lowercase hex strings and
+ * strings are written as they are.  Members written at the top level
+ * belong to the flow object, so in JSON each one is preceded by a
+ * comma.
+ *
+ * In CBOR, the top level is an array of parts, each either a map of
+ * top level members or a text string of JSON that was written to
+ * emit_text() by a module that only prints JSON; see cbor_flow_json
+ * in cbor_output.h.
+ */
+
+#ifndef EMITTER_H
+#define EMITTER_H
+
+#include <stdint.h>
+#include "output.h"
+
+/** deepest nesting of maps and arrays that is tracked */
+#define EMIT_MAX_DEPTH 16
+
+/** the format written by an emitter */
+typedef enum emit_format_ {
+    emit_json = 0,
+    emit_cbor = 1
+} emit_format_e;
+
+/** an emitter; see emit_open() */
+typedef struct emitter_ {
+    zfile f;                      /**< where the output goes */
+    zfile text;                   /**< CBOR: JSON text and strings being built */
+    emit_format_e format;
+    unsigned int depth;           /**< maps and arrays open */
+    unsigned int keyed;           /**< the key of the next value is written */
+    unsigned int in_map;          /**< CBOR: a map part is open */
+    unsigned char first[EMIT_MAX_DEPTH + 1];  /**< JSON: the container is empty so far */
+} emitter_t;
+
+void emit_open(emitter_t *e, zfile f, emit_format_e format, zfile text);
+
+void emit_close(emitter_t *e);
+
+zfile emit_text(emitter_t *e);
+
+void emit_key(emitter_t *e, const char *key, size_t len);
+
+void emit_map_begin(emitter_t *e, const char *key);
+
+void emit_map_end(emitter_t *e);
+
+void emit_array_begin(emitter_t *e, const char *key);
+
+void emit_array_end(emitter_t *e);
+
+void emit_uint(emitter_t *e, const char *key, uint64_t value);
+
+void emit_int(emitter_t *e, const char *key, int64_t value);
+
+void emit_string(emitter_t *e, const char *key, const char *s, size_t len);
+
+void emit_hex(emitter_t *e, const char *key, const unsigned char *data, size_t len);
+
+zfile emit_string_begin(emitter_t *e, const char *key);
+
+void emit_string_end(emitter_t *e);
+
+int emitter_unit_test(void);
+
+#endif /* EMITTER_H */
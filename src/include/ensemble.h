@@ -0,0 +1,130 @@
+/*
+ *
+ * Copyright (c) 2018 Cisco Systems, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ *
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file ensemble.h
+ *
+ * \brief Tree ensemble (gradient boosted trees, random forest) inference (header)
+ */
+
+#ifndef ENSEMBLE_H
+#define ENSEMBLE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Ensemble file format
+ *
+ * All fields are little-endian.
+ *
+ *   offset  size  field
+ *        0     4  magic "JOYE"
+ *        4     4  version (ENSEMBLE_VERSION)
+ *        8     4  type (ensemble_type_e)
+ *       12     4  number of features
+ *       16     4  number of trees, T
+ *       20     4  number of nodes, N
+ *       24     4  base score (float)
+ *       28    4T  number of nodes of each tree
+ *   28+4T    16N  nodes, tree after tree, the root of each tree first
+ *
+ * A node is four 4-byte fields: feature, threshold, left, right.  A
+ * node whose feature is ENSEMBLE_LEAF is a leaf, and its threshold
+ * holds its value.  Otherwise, a flow goes to the left child (an index
+ * into the nodes of the same tree) when its value of the feature is
+ * less than or equal to the threshold, as in scikit-learn, and to the
+ * right child when it is greater.
+ *
+ * Feature i is the (i+1)th entry of the classifier feature vector,
+ * which is the column order of analysis/model.py.
+ *
+ * The score of a gradient boosted model is the logistic function of
+ * the base score plus the values of the leaves that the flow reaches;
+ * the score of a random forest is the mean of those values.
+ */
+
+#define ENSEMBLE_MAGIC "JOYE"
+#define ENSEMBLE_VERSION 1
+#define ENSEMBLE_LEAF 0xffffffff
+
+/** maximum depth of a tree */
+#define ENSEMBLE_MAX_DEPTH 64
+
+/** how the values of the leaves are combined into a score */
+typedef enum ensemble_type_ {
+    ENSEMBLE_BOOSTED = 0,
+    ENSEMBLE_FOREST = 1
+} ensemble_type_e;
+
+/**
+ * A node of a loaded tree.  The children of a leaf are the leaf
+ * itself, so a walk can take the same number of steps in every tree
+ * without testing for leaves.
+ */
+typedef struct ensemble_node_ {
+    uint32_t feature;          /*!< feature compared by this node */
+    float threshold;           /*!< split point, or value of a leaf */
+    uint32_t child[2];         /*!< next node for <= threshold, > threshold */
+} ensemble_node_t;
+
+/**
+ * A loaded ensemble.  The nodes of each tree are stored in breadth
+ * first order, so that the top levels of a tree share cache lines.
+ * The whole ensemble is one allocation.
+ */
+typedef struct ensemble_ {
+    ensemble_type_e type;
+    uint32_t num_features;
+    uint32_t num_trees;
+    uint32_t num_nodes;
+    float base_score;
+    uint32_t *root;            /*!< first node of each tree */
+    uint32_t *depth;           /*!< number of steps from the root to the deepest leaf */
+    ensemble_node_t *node;
+} ensemble_t;
+
+ensemble_t *ensemble_parse(const unsigned char *buf, size_t len, uint32_t max_features);
+
+ensemble_t *ensemble_load(const char *filename, uint32_t max_features);
+
+void ensemble_free(void *ensemble);
+
+float ensemble_score(const ensemble_t *e, const float *x);
+
+void ensemble_unit_test(void);
+
+#endif /* ENSEMBLE_H */
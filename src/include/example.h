@@ -63,7 +63,7 @@ typedef struct example {
 declare_feature(example);
 
 /** initialization function */
-void example_init(struct example **example_handle);
+void example_init(struct example **example_handle, joy_arena_t *arena);
 
 /** update example */
 void example_update(struct example *example, 
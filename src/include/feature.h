@@ -61,7 +61,9 @@
  * 
  *   2) implenting functions that match the function declarations made
  *      by the declare_feature(F) macro below, in a separate C file
- *      (preferably one named F.c),
+ *      (preferably one named F.c); of the two print functions, one
+ *      is written and the other defined with define_print_json(F)
+ *      or define_print_text(F),
  * 
  *   3) define the macro F_usage to be a constant, printable C string
  *      that describes the usage of the feature, in the header file,
@@ -104,6 +106,8 @@
 #include "err.h"
 #include "output.h"
 #include "map.h"
+#include "arena.h"
+#include "emitter.h"
 
 
 /** The feature_list macro defines all of the features that will be
@@ -129,12 +133,15 @@
 //#define set_config_all_features(flist) MAP(set_config_feature, flist)
 
 
-/** The function feature_init(ptr) is invoked on a pointer to a data
+/** The function feature_init(ptr, arena) is invoked on a pointer to a data
  * feature, it initializes an instance of the feature, possibly 
- * performing memory allocation as a side effect
+ * performing memory allocation as a side effect; anything the feature
+ * keeps until the flow record is deleted should come from "arena", the
+ * arena of the flow record, which flow_record_delete() releases after
+ * all of the features have been deleted
  * This function is called in flow_record_init() in p2f.c.
  */
-#define declare_init(F) void F##_init(F##_t **f)
+#define declare_init(F) void F##_init(F##_t **f, joy_arena_t *arena)
 
 /** \brief \verbatim
  * The function feature_update(feature, header, data, data_len, report_feature)
@@ -175,6 +182,44 @@ void F##_print_json(const F##_t *F,      \
 		    zfile f);
 
 
+/** \brief \verbatim
+ * The function feature_print_func(feature, twin_feature, emitter)
+ * prints the data feature through an emitter (see emitter.h), which
+ * writes it as JSON or as CBOR.  The twin_feature pointer is as for
+ * feature_print_json_func().
+ *
+ * A feature implements one of the two print functions and defines
+ * the other with define_print_json(F) or define_print_text(F).
+ *
+ * This function is called in flow_record_print_cbor() in the file
+ * p2f.c.
+ * \endverbatim
+ */
+#define declare_print(F)                 \
+void F##_print(const F##_t *F,           \
+	       const F##_t *twin_F,      \
+	       emitter_t *e);
+
+/** The macro define_print_json(F) defines F_print_json() for a
+ * feature that prints through an emitter
+ */
+#define define_print_json(F)                                             \
+void F##_print_json(const F##_t *F, const F##_t *twin_F, zfile f) {      \
+    emitter_t e;                                                         \
+    emit_open(&e, f, emit_json, NULL);                                   \
+    F##_print(F, twin_F, &e);                                            \
+    emit_close(&e);                                                      \
+}
+
+/** The macro define_print_text(F) defines F_print() for a feature
+ * that only prints JSON; its JSON is carried as text
+ */
+#define define_print_text(F)                                             \
+void F##_print(const F##_t *F, const F##_t *twin_F, emitter_t *e) {      \
+    F##_print_json(F, twin_F, emit_text(e));                             \
+}
+
+
 /** \brief \verbatim
  * The function feature_delete_func(ptr), when invoked on a feature_ptr,
  * frees any and all memory that is allocated by feature_init().  It
@@ -206,6 +251,7 @@ void F##_print_json(const F##_t *F,      \
   declare_init(F);            \
   declare_update(F);          \
   declare_print_json(F);      \
+  declare_print(F);           \
   declare_delete(F);          \
   declare_unit_test(F); 
 
@@ -226,7 +272,7 @@ void F##_print_json(const F##_t *F,      \
  */
 #define update_feature(f) \
     if (f##_filter(record) && (glb_config->report_##f)) { \
-        if (record->f == NULL) f##_init(&record->f); \
+        if (record->f == NULL) f##_init(&record->f, &record->arena); \
         f##_update(record->f, header, payload, size_payload, glb_config->report_##f); \
     }
 
@@ -236,7 +282,7 @@ void F##_print_json(const F##_t *F,      \
 #if 0
 #define update_ip_feature(f) \
     if (f##_filter(key) && (glb_config->report_##f)) { \
-        if (record->f == NULL) f##_init(&record->f); \
+        if (record->f == NULL) f##_init(&record->f, &record->arena); \
         f##_update(record->f, header, ip, ip_hdr_len, glb_config->report_##f); \
     }
 #endif
@@ -246,7 +292,7 @@ void F##_print_json(const F##_t *F,      \
  */
 #define update_tcp_feature(f) \
     if (f##_filter(record) && (glb_config->report_##f)) { \
-        if (record->f == NULL) f##_init(&record->f); \
+        if (record->f == NULL) f##_init(&record->f, &record->arena); \
         f##_update(record->f, header, transport_start, transport_len, glb_config->report_##f); \
     }
 
@@ -254,6 +300,10 @@ void F##_print_json(const F##_t *F,      \
  */
 #define print_feature(f) if (rec->f != NULL) f##_print_json(rec->f, (rec->twin ? rec->twin->f : NULL), ctx->output);
 
+/** The macro emit_feature(f) prints the feature through the emitter e
+ */
+#define emit_feature(f) if (rec->f != NULL) f##_print(rec->f, (rec->twin ? rec->twin->f : NULL), e);
+
 
 /** The macro init_feature(f) initializes the element f in the
  * structure record
@@ -314,6 +364,11 @@ void F##_print_json(const F##_t *F,      \
  */
 #define print_all_features(feature_list) MAP(print_feature, feature_list)
 
+/** The macro emit_all_features(list) invokes emit_feature() for each
+ * feature in the list
+ */
+#define emit_all_features(feature_list) MAP(emit_feature, feature_list)
+
 /** The macro delete_all_features(list) invokes feature_print_json() for each
  * feature in list
  */
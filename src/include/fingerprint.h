@@ -46,29 +46,76 @@
 #include <stdint.h>
 
 #define MAX_FINGERPRINT_LEN 1024
-#define MAX_FINGERPRINT_LABELS 64
 #define MAX_FINGERPRINT_LABEL_LEN 64
-#define MAX_FINGERPRINT_DESCRIPTION 64
-#define MAX_FINGERPRINT_DB 100
 
+/*
+ * A fingerprint is a sequence of 16-bit values (network byte order),
+ * such as the ciphersuites and extensions offered in a TLS client hello.
+ * Entries are allocated to fit, and their labels point into a table of
+ * interned strings owned by the database.
+ */
 typedef struct fingerprint {
-    char description[MAX_FINGERPRINT_DESCRIPTION]; /**< Description */
-    char labels[MAX_FINGERPRINT_LABELS][MAX_FINGERPRINT_LABEL_LEN]; /**< Labels */
-    uint8_t label_count; /**< Number of labels */
-    unsigned char fingerprint[MAX_FINGERPRINT_LEN]; /* Fingerprint data */
+    struct fingerprint *next; /**< Next entry in the hash bucket */
+    uint32_t hash; /**< Hash of the fingerprint data */
+    uint32_t id; /**< Index of the entry in the database */
+    const char **labels; /**< Labels, interned */
+    uint16_t label_count; /**< Number of labels */
+    uint16_t label_size; /**< Number of labels allocated */
+    uint16_t num_values; /**< Number of distinct 16-bit values */
     uint16_t fingerprint_len; /**< Length of the fingerprint in bytes */
+    unsigned char fingerprint[]; /**< Fingerprint data */
 } fingerprint_t;
 
+struct fingerprint_label;
+struct fingerprint_posting;
+
 typedef struct fingerprint_db {
-    fingerprint_t fingerprints[MAX_FINGERPRINT_DB]; /**< Fingerprints */
-    uint16_t fingerprint_count; /**< Number of fingerprints */
+    fingerprint_t **buckets; /**< Entries, by hash of the fingerprint */
+    fingerprint_t **entries; /**< Entries, by id */
+    uint32_t num_buckets; /**< Number of hash buckets (a power of two) */
+    uint32_t fingerprint_count; /**< Number of fingerprints */
+    struct fingerprint_label **labels; /**< Interned labels, by hash */
+    uint32_t num_label_buckets; /**< Number of label buckets (a power of two) */
+    uint32_t label_count; /**< Number of interned labels */
+    struct fingerprint_posting **postings; /**< Entries containing each 16-bit value */
+    uint32_t num_posting_buckets; /**< Number of posting buckets */
 } fingerprint_db_t;
 
-int fingerprint_copy(fingerprint_t *dest_fp,
-                     fingerprint_t *src_fp);
+/*
+ * Working space of fingerprint_db_match_partial(): a count for each
+ * database entry, which is left zeroed between lookups, so that a
+ * lookup allocates only when the database has grown.  A scratch is
+ * used by one thread at a time, and is reused across lookups.
+ */
+typedef struct fingerprint_scratch {
+    struct fingerprint_scratch *next; /**< Free list link, for the caller */
+    uint16_t *shared; /**< Values shared with the input, by entry id */
+    uint32_t *touched; /**< Ids of the entries with shared values */
+    uint32_t size; /**< Number of entries allocated */
+} fingerprint_scratch_t;
+
+void fingerprint_db_init(fingerprint_db_t *db);
+
+void fingerprint_db_free(fingerprint_db_t *db);
+
+fingerprint_t *fingerprint_db_add(fingerprint_db_t *db,
+                                  const unsigned char *fingerprint,
+                                  uint16_t fingerprint_len,
+                                  const char *label);
+
+fingerprint_t *fingerprint_db_match_exact(const fingerprint_db_t *db,
+                                          const unsigned char *fingerprint,
+                                          uint16_t fingerprint_len);
+
+fingerprint_t *fingerprint_db_match_partial(const fingerprint_db_t *db,
+                                            fingerprint_scratch_t *scratch,
+                                            const unsigned char *fingerprint,
+                                            uint16_t fingerprint_len,
+                                            unsigned int percent);
+
+void fingerprint_scratch_free(fingerprint_scratch_t *scratch);
 
-fingerprint_t *fingerprint_db_match_exact(fingerprint_db_t *db,
-                                          fingerprint_t *in_fingerprint);
+void fingerprint_unit_test(void);
 
 #endif /* FINGERPRINT_H */
 
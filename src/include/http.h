@@ -46,6 +46,8 @@
 #include <stdint.h>
 #include <pcap.h>
 #include "output.h"
+#include "emitter.h"
+#include "arena.h"
 
 #define http_usage "  http=1                     report http information\n"
 
@@ -60,21 +62,30 @@ enum http_line_type {
     HTTP_LINE_STATUS    = 2,
 };
 
+/**
+ * \brief A token of an http message, as an offset and length into the
+ * copy of the message header that is kept in the http text buffer.
+ */
+struct http_slice {
+    uint16_t off;
+    uint16_t len;
+};
+
 struct http_header_status_line {
-    char *version;
-    char *code;
-    char *reason;
+    struct http_slice version;
+    struct http_slice code;
+    struct http_slice reason;
 };
 
 struct http_header_request_line {
-    char *method;
-    char *uri;
-    char *version;
+    struct http_slice method;
+    struct http_slice uri;
+    struct http_slice version;
 };
 
 struct http_header_element {
-    char *name;
-    char *value;
+    struct http_slice name;
+    struct http_slice value;
 };
 
 #define HTTP_MAX_HEADER_ELEMENTS 32
@@ -89,10 +100,16 @@ struct http_header {
     uint8_t num_elements;
 };
 
+/** number of bytes of the message body that are kept */
+#define HTTP_BODY_MAGIC 16
+
 struct http_message {
     struct http_header header;
-    char *body;
+    uint32_t base;                           /*!< offset of the header copy in the text */
+    unsigned char body[HTTP_BODY_MAGIC];
     uint32_t body_length;
+    unsigned char header_hash[16];           /*!< MD5 of the request header names, in order */
+    uint8_t have_header_hash;
 };
 
 #define HTTP_MAX_MESSAGES 16
@@ -101,10 +118,14 @@ struct http_message {
 typedef struct http {
     uint16_t num_messages;
     struct http_message messages[HTTP_MAX_MESSAGES];
+    char *text;                              /*!< header bytes of all messages */
+    uint32_t text_len;
+    uint32_t text_size;
+    joy_arena_t *arena;                      /*!< arena of the flow record, backs text */
 } http_t;
 
 /** initialize http data structure */
-void http_init(http_t **http_handle);
+void http_init(http_t **http_handle, joy_arena_t *arena);
 
 /** update http data structure */
 void http_update(http_t *http,
@@ -118,6 +139,11 @@ void  http_print_json(const http_t *h1,
                       const http_t *h2,
                       zfile f);
 
+/** print out an HTTP data structure through an emitter */
+void http_print(const http_t *h1,
+                const http_t *h2,
+                emitter_t *e);
+
 
 /** remove an http data structure */
 void http_delete(http_t **http_handle);
@@ -49,6 +49,7 @@
 #include "output.h"
 #include "feature.h"
 #include "utils.h"      /* for joy_role_e */
+#include "arena.h"
 
 #define ike_usage "  ike=1                      report IKE information\n"
 
@@ -73,6 +74,7 @@
  */
 typedef struct vector_ {
     unsigned int len;
+    unsigned int size; /* bytes allocated */
     unsigned char *bytes;
 } vector_t;
 
@@ -203,12 +205,13 @@ typedef struct ike_ {
     joy_role_e role;
     unsigned int num_messages;
     ike_message_t *messages[IKE_MAX_MESSAGES];
-    vector_t *buffer;
+    vector_t buffer;
+    joy_arena_t *arena; /* backs the messages and the buffer */
 } ike_t;
 
 declare_feature(ike);
 
-void ike_init(ike_t **ike_handle);
+void ike_init(ike_t **ike_handle, joy_arena_t *arena);
 
 void ike_update(ike_t *ike,
                 const struct pcap_pkthdr *header,
@@ -89,6 +89,8 @@
 #define JOY_PREMPTIVE_TMO_ON       (1 << 15)
 #define JOY_IPFIX_SIMPLE_EXPORT_ON (1 << 16)
 #define JOY_IPFIX_IDP_EXPORT_ON    (1 << 17)
+#define JOY_ASYNC_OUTPUT_ON        (1 << 18)
+#define JOY_ADAPTIVE_SAMPLE_ON     (1 << 19)
 
 
 /* structure used to initialize joy through the API Library */
@@ -276,6 +278,27 @@ extern void joy_process_packet (unsigned char *ctx_idx,
 				const struct pcap_pkthdr *header, 
 				const unsigned char *packet);
 
+/*
+ * Function: joy_update_capture_drops
+ *
+ * Description: This function tells the Joy library how many packets
+ *      the capture of the application has dropped so far, such as
+ *      the ps_drop counter of pcap_stats(). With JOY_ADAPTIVE_SAMPLE_ON,
+ *      joy_print_flow_data doubles the flow sampling rate of the
+ *      context while this count grows, and relaxes it once it stops
+ *      growing; the library cannot see the capture itself, so without
+ *      these reports the rate is never raised.
+ *
+ * Parameters:
+ *      index - index of the context to use
+ *      num_drops - cumulative count of packets dropped by the capture
+ *
+ * Returns:
+ *      none
+ *
+ */
+extern void joy_update_capture_drops (unsigned int index, unsigned long int num_drops);
+
 /*
  * Function: joy_print_flow_data
  *
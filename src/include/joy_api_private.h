@@ -46,6 +46,10 @@
 
 #include "output.h"
 #include "ipfix.h"
+#include "anon.h"
+#include "snapshot.h"
+#include "classify.h"
+#include "arrow_output.h"
 
 #ifdef JOY_USE_VPP_OPT
 #include "vppinfra/vec.h"
@@ -92,10 +96,20 @@ struct joy_ctx_data  {
     flocap_stats_t stats;
     flocap_stats_t last_stats;
     struct timeval last_stats_output_time;
+    unsigned int sample_rate;                 /* effective flow sampling rate */
+    unsigned long int sample_last_drops;      /* capture drops at last adaptation */
+    unsigned long int capture_drops;          /* capture drops reported by the application */
+    struct timeval sample_last_change;        /* time of last rate change */
+    unsigned long int sample_records[MAX_SAMPLE_SHIFT + 1];  /* records by log2 of their sampling rate */
     ipfix_message_t *export_message;
     flow_record_t *flow_record_chrono_first;
     flow_record_t *flow_record_chrono_last;
     flow_record_list flow_record_list_array[FLOW_RECORD_LIST_LEN];
+    anon_addr_cache_t anon_cache;             /* anonymized addresses of this context */
+    joy_snapshot_reader_t snapshot_reader;    /* quiescent points of this context */
+    classifier_batch_t classifier_batch;      /* flows being classified for printing */
+    arrow_batch_t *flow_batch;                /* flows being written as Arrow columns */
+    zfile json_scratch;                       /* JSON captured for the CBOR output */
     unsigned long int reserved_info;
     unsigned long int reserved_ctx;
 #ifdef JOY_USE_VPP_OPT
@@ -0,0 +1,107 @@
+/*
+ *
+ * Copyright (c) 2018 Cisco Systems, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ *
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file merge.h
+ *
+ * \brief Time-ordered merge of the flow records of several outputs,
+ *        such as those of the contexts of the library, or of the files
+ *        that one output was rotated into (header)
+ *
+ * Each source hands over its records, as JSON text, in the order it
+ * wrote them.  The merge always takes the next record from the source
+ * that is furthest behind, so that the sources are read at the same
+ * pace, and holds the records in a heap ordered by time_start until
+ * they can no longer be overtaken: joy writes a flow only when it
+ * expires, so a source is out of time order by up to about the
+ * timeouts of its flows.  A record is written once a record that
+ * starts more than lag seconds after it has been read, or earlier when
+ * the records held exceed the memory allowed.
+ *
+ * With stitching, the parts of a flow that were written separately
+ * (because of the active timeout, or by different contexts) are joined
+ * into one record, as the FlowStitchIterator of sleuth does: counts of
+ * bytes and packets, and the byte distribution, are added up, time_end
+ * is the latest of the parts, and other members are taken from the
+ * first part that has them.  A part continues a flow if it has the
+ * same addresses, ports and protocol, either way round, and starts
+ * within lag seconds of the end of the flow.  A stitched flow is held
+ * until nothing can continue it any more.
+ *
+ * Records without a time_start, such as the configuration line at the
+ * start of each output, are written as soon as they are read.
+ */
+
+#ifndef MERGE_H
+#define MERGE_H
+
+#include <stddef.h>
+
+/**
+ * \brief gives the next record of a source, without its newline; the
+ * record stays valid until the next call, and the function returns 1,
+ * 0 at the end of the source, or -1 if it could not be read
+ */
+typedef int (*merge_read_func)(void *source, const char **rec, size_t *len);
+
+/** \brief takes the next record of the merged output; returns 0, or -1 on failure */
+typedef int (*merge_write_func)(void *arg, const char *rec, size_t len);
+
+/** counters kept by a merge */
+typedef struct merge_stats_ {
+    unsigned long records_in;     /**< records read from the sources */
+    unsigned long records_out;    /**< records written */
+    unsigned long untimed;        /**< records without a time_start, written as read */
+    unsigned long stitched;       /**< parts joined to a flow written before them */
+    unsigned long late;           /**< records written after one that starts later */
+    unsigned long failed_sources; /**< sources that could not be read to their end */
+} merge_stats_t;
+
+typedef struct merge_ merge_t;
+
+merge_t *merge_new(double lag, size_t max_held, int stitch);
+
+int merge_add_source(merge_t *m, merge_read_func read, void *source);
+
+int merge_run(merge_t *m, merge_write_func write, void *arg);
+
+void merge_get_stats(const merge_t *m, merge_stats_t *stats);
+
+void merge_free(merge_t *m);
+
+int merge_unit_test(void);
+
+#endif /* MERGE_H */
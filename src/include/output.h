@@ -37,22 +37,73 @@
 /**
  * \file output.h
  *
- * \brief this header defines macros for a compile-time option that can
- * automatically compress file output using zlib; it is used for
- * automatic JSON compression (but could be used for other purposes as
- * well)
+ * \brief this header defines the buffered writer used for the JSON
+ * output, along with a compile-time option that can automatically
+ * compress that output using zlib or bzip2; it is used for automatic
+ * JSON compression (but could be used for other purposes as well)
+ *
+ * Output is rendered into a large buffer owned by the zfile, and
+ * handed to the (compressing) file underneath only in whole blocks,
+ * so the compressor sees a few large writes instead of one small
+ * write per field.  Besides zprintf(), the writer has hand-rolled
+ * formatters for the values that dominate flow records (integers,
+ * timestamps, addresses, hex strings), which append straight into
+ * the buffer without going through the printf machinery.
+ *
+ * With zasync(), filled buffers are instead queued to a writer thread
+ * that owns the file, so compression and disk I/O happen off the
+ * thread that produces the records.  The queue is bounded; when the
+ * writer falls behind, whole records are dropped and counted rather
+ * than making the producer wait.
+ *
+ * With compression threads (zconfigure()), the output is instead cut
+ * into independently compressed blocks - concatenated gzip members,
+ * or zstd frames - that a pool of workers compresses in parallel, and
+ * that the writer thread puts out in order.  Concatenated members and
+ * frames are still one valid file to zcat, zstdcat and sleuth.  Each
+ * gzip member also records its own compressed size in its header, in
+ * an extra subfield 'J' 'B' of four bytes (little-endian), as BGZF
+ * does; joy-query depends on this field to find the members without
+ * decompressing them, and so to decompress them in parallel, so it is
+ * part of the format.  zstd frames carry their size already.  The
+ * tools that write joy output compress it with zcodec_compress(), and
+ * read it back with zblock_size(), so the format is defined here only.
+ *
+ * zreader_open() reads output back, plain or compressed, for the
+ * tools that process it; zread_block() hands out its blocks still
+ * compressed, for a reader that decompresses them in parallel.
+ *
+ * A zfile from zopen_memory() keeps its output in memory, which is
+ * how JSON rendered by code that only knows how to write to a zfile
+ * is captured, to be carried inside another output format.
+ *
+ * After zpublish(), the files opened also publish their records,
+ * before compression, to a shared memory ring (see shm_output.h);
+ * zrecord() marks where a record ends, and so where a message of the
+ * ring may end.
  *
  */
 #ifndef OUTPUT_H
 #define OUTPUT_H
 
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#ifdef WIN32
+#include "ws2tcpip.h"
+#else
+#include <sys/time.h>
+#include <netinet/in.h>
+#endif
 
 /**
  * \brief Set the variable COMPRESSED_OUTPUT to 1 to use zlib to
  * automatically compress the JSON output, or set it to 0 to have
  * normal output.  When compressed output is used, zless can be used
  * to read the files, and gunzip can be used to convert them to normal
- * files.  
+ * files.  Define USE_ZSTD (or USE_BZIP2) to compress with zstd (or
+ * bzip2) instead of zlib.
  *
  */
 #ifndef COMPRESSED_OUTPUT
@@ -60,56 +111,180 @@
 #endif
 
 #if (COMPRESSED_OUTPUT == 0)
-/** normal output */
-typedef FILE *zfile;
+    /** normal output */
+    typedef FILE *zfile_raw;
+    #define zsuffix              ""
 
-#define zopen(fname, ...)    (fopen(fname, __VA_ARGS__))
-#define zattach(fd, ...)     (fd)
-#define zprintf(output, ...) (fprintf(output, __VA_ARGS__))
-#define zflush(FILEp)        (fflush(FILEp))
-#define zclose(output)       (fclose(output))
-#define zsuffix              ""
+#elif defined(USE_ZSTD)
+    /** zstd compressed output, always written in blocks */
+    #include <zstd.h>
+    typedef FILE *zfile_raw;
+    #define zsuffix              ".zst"
 
-#else
-
-#ifdef USE_BZIP2
+#elif defined(USE_BZIP2)
     /** bzip2 compressed output */
     #include <bzlib.h>
-    int BZ2_bzprintf(BZFILE *b, const char * format, ...);
-
-    typedef BZFILE *zfile;
-
-    #define zopen(fname, ...)    (BZ2_bzopen(fname, __VA_ARGS__))
-
-    #ifdef WIN32
-        #define zattach(FILEp, ...)  (BZ2_bzdopen(_fileno(FILEp), __VA_ARGS__))
-    #else
-        #define zattach(FILEp, ...)  (BZ2_bzdopen(fileno(FILEp), __VA_ARGS__))
-    #endif
-    #define zprintf              BZ2_bzprintf
-    #define zflush(FILEp)        (BZ2_bzflush(FILEp))
-    #define zclose(output)       (BZ2_bzclose(output))
+    typedef BZFILE *zfile_raw;
     #define zsuffix              ".bz2"
 
 #else
     /** gzip compressed output */
     #include <zlib.h>
-    typedef gzFile zfile;
+    typedef gzFile zfile_raw;
+    #define zsuffix              ".gz"
+#endif
 
-    #define zopen(fname, ...)    (gzopen(fname, __VA_ARGS__))
+/** size of the block handed to the underlying file in one write */
+#define ZFILE_BUFFER_SIZE (256 * 1024)
 
-    #ifdef WIN32
-        #define zattach(FILEp, ...)  (gzdopen(_fileno(FILEp), __VA_ARGS__))
-    #else
-        #define zattach(FILEp, ...)  (gzdopen(fileno(FILEp), __VA_ARGS__))
-    #endif
+/** largest number of buffers that zasync() queues to the writer */
+#define ZFILE_ASYNC_MAX_BUFFERS 64
 
-    #define zprintf(output, ...) (gzprintf(output, __VA_ARGS__))
-    #define zflush(FILEp)        (gzflush(FILEp))
-    #define zclose(output)       (gzclose(output))
-    #define zsuffix              ".gz"
-#endif
+/** number of buffers used when asynchronous output is just switched on */
+#define ZFILE_ASYNC_DEFAULT_BUFFERS 8
 
+/** largest number of compression threads */
+#define ZFILE_MAX_THREADS 16
+
+/** buffered output file */
+typedef struct zfile_ {
+    zfile_raw raw;                /**< underlying (compressed) file */
+    FILE *fp;                     /**< underlying file, when writing compressed blocks */
+    struct zfile_codec_ *codec;   /**< block compressor, NULL when streaming */
+    size_t len;                   /**< bytes pending in buf */
+    char *buf;                    /**< pending output, ZFILE_BUFFER_SIZE bytes */
+    char *fname;                  /**< name of the open file, NULL if attached */
+    unsigned long id;             /**< changes whenever output starts in a new file */
+    unsigned int binary;          /**< not newline-delimited, so records are never dropped */
+    struct zfile_memory_ *memory; /**< output kept in memory, NULL if written to a file */
+    struct shm_ring_ *shm;        /**< ring the records are published to, or NULL */
+    size_t record_start;          /**< where the record being written starts in buf */
+    struct zfile_async_ *async;   /**< writer thread, NULL if synchronous */
+} *zfile;
+
+/** compressor of independent blocks, as zfiles write them */
+typedef struct zfile_codec_ *zcodec;
+
+/** output of joy being read back, decompressed as it is read */
+typedef struct zreader_ *zreader;
+
+/** called with the name of each file that zrotate() has closed */
+typedef void (*zfile_closed_func)(const char *fname);
+
+/** counters kept by an asynchronous zfile */
+typedef struct zfile_stats_ {
+    unsigned long blocks_written;   /**< buffers written by the writer thread */
+    unsigned long bytes_written;    /**< bytes written by the writer thread */
+    unsigned long write_errors;     /**< failed writes, opens and closes */
+    unsigned long queue_depth;      /**< buffers waiting for the writer now */
+    unsigned long queue_depth_max;  /**< most buffers ever waiting */
+    unsigned long records_dropped;  /**< records dropped because the queue was full */
+    unsigned long bytes_dropped;    /**< bytes of those records */
+    unsigned long stalls;           /**< times the producer had to wait anyway */
+} zfile_stats_t;
+
+void zconfigure(int level, unsigned int threads);
+
+zfile zopen(const char *fname, const char *mode);
+
+zfile zattach(FILE *fp, const char *mode);
+
+zfile zopen_memory(void);
+
+const char *zmemory(zfile f, size_t *len);
+
+void zmemory_clear(zfile f);
+
+void zbinary(zfile f);
+
+void zpublish(struct shm_ring_ *ring);
+
+void zrecord(zfile f);
+
+int zprintf(zfile f, const char *format, ...)
+#ifdef __GNUC__
+    __attribute__ ((format (printf, 2, 3)))
 #endif
+    ;
+
+int zwrite(zfile f, const void *data, size_t len);
+
+int zdrain(zfile f);
+
+int zflush(zfile f);
+
+int zclose(zfile f);
+
+int zrotate(zfile f, const char *fname, zfile_closed_func closed);
+
+int zasync(zfile f, unsigned int num_buffers);
+
+void zstats(zfile f, zfile_stats_t *stats);
+
+zcodec zcodec_new(int level);
+
+size_t zcodec_bound(size_t len);
+
+size_t zcodec_compress(zcodec c, const char *in, size_t len, char *out, size_t size);
+
+void zcodec_free(zcodec c);
+
+int zblock_size(const char *data, size_t len, size_t *size, size_t *expected);
+
+zreader zreader_open(const char *fname);
+
+const char *zreader_name(zreader r);
+
+int zreader_failed(zreader r);
+
+int zread_block(zreader r, const char **block, size_t *size, size_t *expected);
+
+long zread(zreader r, char *buf, size_t len);
+
+void zreader_close(zreader r);
+
+void zprint_uint(zfile f, uint64_t value);
+
+void zprint_int(zfile f, int64_t value);
+
+void zprint_timeval(zfile f, const struct timeval *ts);
+
+void zprint_ipv4(zfile f, const struct in_addr *addr);
+
+void zprint_hex(zfile f, const unsigned char *data, size_t len);
+
+void zprint_json_string(zfile f, const char *s, size_t len);
+
+int output_unit_test(void);
+
+/**
+ * \brief Make room for \p len more bytes in the buffer of \p f.
+ *
+ * \param f Output file
+ * \param len Number of bytes about to be appended (at most ZFILE_BUFFER_SIZE/2)
+ *
+ * \return pointer to where the bytes go
+ */
+static __inline char *zreserve (zfile f, size_t len) {
+    if (f->len + len > ZFILE_BUFFER_SIZE) {
+        zdrain(f);
+    }
+    return f->buf + f->len;
+}
+
+/**
+ * \brief Append one character to \p f.
+ */
+static __inline void zputc (zfile f, char c) {
+    *zreserve(f, 1) = c;
+    f->len++;
+}
+
+/**
+ * \brief Append a NULL-terminated string to \p f, verbatim.
+ */
+static __inline void zputs (zfile f, const char *s) {
+    zwrite(f, s, strlen(s));
+}
 
 #endif  /* OUTPUT_H */
@@ -116,6 +116,15 @@ extern FILE *info;
 #define MAX_NUM_PKT_LEN 200
 #define MAX_IDP 1500
 
+/*
+ * upper bound on the flow sampling rate (1-in-N flows), both for the
+ * configured value and for the value reached in adaptive mode
+ */
+#define MAX_SAMPLE_RATE 65536
+
+/** log2 of MAX_SAMPLE_RATE */
+#define MAX_SAMPLE_SHIFT 16
+
 typedef struct flow_record_ {
     flow_key_t key;                       /*!< identifies flow by 5-tuple          */
     uint16_t app;                         /*!< application protocol prediction     */
@@ -147,7 +156,11 @@ typedef struct flow_record_ {
     unsigned long uptime_seconds;         /*!< executable uptime associated with flow    */
     unsigned char exp_type;
     unsigned char first_switched_found;   /*!< hack to make sure we only correct once */
+    unsigned int sample_rate;             /*!< flow sampling rate when record was created */
+    unsigned int inspected_bytes;         /*!< payload bytes given to deep inspection */
+    unsigned int inspected_pkts;          /*!< payload packets given to deep inspection */
   
+    joy_arena_t arena;                    /*!< backs the state of all of the features */
     define_all_features(feature_list)     /*!< define all features listed in feature.h */
   
     struct flow_record_ *twin;             /*!< other half of bidirectional flow    */
@@ -278,6 +291,7 @@ typedef struct flocap_stats_ {
   unsigned long int num_records_in_table;
   unsigned long int num_records_output;
   unsigned long int malloc_fail;
+  unsigned long int num_packets_unsampled;
 } flocap_stats_t;
 
 //#define flocap_stats_init(c) flocap_stats_t stats = {  0, 0, 0, 0 };
@@ -298,6 +312,8 @@ typedef struct flocap_stats_ {
 
 #define flocap_stats_incr_malloc_fail(c) (c->stats.malloc_fail++)
 
+#define flocap_stats_incr_packets_unsampled(c) (c->stats.num_packets_unsampled++)
+
 #define flocap_stats_format "packets: %lu\tcurrent records: %lu\toutput records: %lu"
 
 
@@ -305,6 +321,20 @@ void flocap_stats_output(joy_ctx_data *ctx, FILE *f);
 
 void flocap_stats_timer_init(joy_ctx_data *ctx);
 
+/**
+ * \brief The function flow_key_is_sampled(ctx, key) returns nonzero if
+ * packets with flow key \p key should be processed under the current
+ * flow sampling rate, and zero if they should be skipped.  The decision
+ * is a function of a hash of the flow key that is identical for both
+ * directions of a flow, so that twins are kept or skipped together, and
+ * it is made before any flow_record is allocated.
+ */
+unsigned int flow_key_is_sampled(joy_ctx_data *ctx, const flow_key_t *key);
+
+unsigned int flow_sampling_get_rate(const joy_ctx_data *ctx);
+
+void flow_sampling_update(joy_ctx_data *ctx, unsigned long int num_drops);
+
 /**
 * \brief the function flow_key_set_process_info(key, data) finds the flow record
 * associated with key, if there is one, and then sets the process info of
@@ -312,11 +342,6 @@ void flocap_stats_timer_init(joy_ctx_data *ctx);
 */
 int flow_key_set_process_info(joy_ctx_data *ctx, const flow_key_t *key, const host_flow_t *data);
 
-/** Main entry point for the uploader thread */
-void *uploader_main(void* ptr);
-
-int upload_file(char *filename);
-
 void p2f_unit_test();
 
 /** print a buffer as hexadecimal */
@@ -66,7 +66,7 @@ typedef struct payload {
 declare_feature(payload);
 
 /** initialization function */
-void payload_init(struct payload **payload_handle);
+void payload_init(struct payload **payload_handle, joy_arena_t *arena);
 
 /** update payload */
 void payload_update(struct payload *payload, 
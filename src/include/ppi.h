@@ -83,7 +83,7 @@ void tcp_opt_print_json(zfile f,
 declare_feature(ppi);
 
 /** initialization function */
-void ppi_init(struct ppi **ppi_handle);
+void ppi_init(struct ppi **ppi_handle, joy_arena_t *arena);
 
 /** update ppi */
 void ppi_update(struct ppi *ppi, 
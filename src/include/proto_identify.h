@@ -67,4 +67,6 @@ const struct pi_container *proto_identify_tcp(const char *tcp_data,
 const struct pi_container *proto_identify_udp(const char *udp_data,
                                               unsigned int len);
 
+void proto_identify_unit_test(void);
+
 #endif /* JOY_PROTO_IDENTIFY_H */
@@ -0,0 +1,116 @@
+/*
+ *
+ * Copyright (c) 2018 Cisco Systems, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ *
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file query.h
+ *
+ * \brief Filtering and selection of JSON flow records, with the
+ *        --where, --select and --groupby expressions of sleuth
+ *        (header)
+ *
+ * A record is scanned once, as text: only the members that the query
+ * refers to are looked into, and everything else is skipped over
+ * without being decoded.  Selected values are copied out verbatim.
+ *
+ * A field list, as given to --select and --groupby, names members
+ * separated by commas; name{...} selects members of an object, and
+ * name[...] members of the objects in a list (name[] is the whole
+ * list).  For example, "da,dp,tls{scs,cs},packets[b]".
+ *
+ * A --where expression combines tests with "," (and) and "|" (or),
+ * which binds more tightly, and with parentheses.  A test is a field,
+ * one of = ~ (not equal) < >, and a value: a number, or a pattern
+ * in which * and ? are wildcards.  "field=*" is true if the field is
+ * present, and "field~*" if it is absent.  A test on a list is true if
+ * it holds for any element of the list.
+ */
+
+#ifndef QUERY_H
+#define QUERY_H
+
+#include <stddef.h>
+
+/** largest number of distinct top-level members that a query can name */
+#define QUERY_MAX_KEYS 64
+
+/** results of query_record() */
+enum query_result_e {
+    query_malformed = -1,         /**< the record is not a JSON object */
+    query_skipped = 0,            /**< it does not match, or nothing in it was selected */
+    query_matched = 1,            /**< it matches, and the output was appended */
+    query_header = 2              /**< it is the configuration line at the start of the output */
+};
+
+/** a growing buffer of text */
+typedef struct query_buf_ {
+    char *data;
+    size_t len;
+    size_t size;
+} query_buf_t;
+
+typedef struct query_ query_t;
+
+/** iterates over the members of an object, or the elements of an array */
+typedef struct query_iter_ {
+    const char *p;                /**< just after the last member or element */
+    const char *end;              /**< end of the text */
+    int first;                    /**< nothing has been returned yet */
+} query_iter_t;
+
+query_t *query_new(const char *where, const char *select, const char *groupby,
+                   char *err, size_t err_len);
+
+void query_free(query_t *q);
+
+int query_grouped(const query_t *q);
+
+int query_record(const query_t *q, const char *rec, size_t len,
+                 query_buf_t *out, query_buf_t *group);
+
+int query_buf_append(query_buf_t *b, const void *data, size_t len);
+
+void query_buf_free(query_buf_t *b);
+
+void query_iter_init(query_iter_t *it, const char *v, const char *end);
+
+int query_next_member(query_iter_t *it, const char **key, size_t *key_len,
+                      const char **value, const char **value_end);
+
+int query_next_element(query_iter_t *it, const char **value, const char **value_end);
+
+int query_unit_test(void);
+
+#endif /* QUERY_H */
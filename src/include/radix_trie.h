@@ -39,11 +39,12 @@
  *
  * \brief interface to radix_trie implementation for fast address lookup
  *
- ** This implementation is designed to quickly search over addresses
- *  (currently IPv4 only) and determine if an address matches one or
- *  more subnets that have been inserted into the trie.  Each subnet is
+ ** This implementation is designed to quickly search over IPv4 and
+ *  IPv6 addresses and determine if an address matches one or more
+ *  subnets that have been inserted into the trie.  Each subnet is
  *  associated with a label, and there can be up to MAX_NUM_FLAGS
- *  labels (as they are interally represented as bit flags).  
+ *  labels (as they are interally represented as bit flags).  Once all
+ *  subnets are added, radix_trie_compile() builds the lookup tables.
  *
  */
 
@@ -96,6 +97,17 @@ joy_status_e radix_trie_add_subnets_from_file(struct radix_trie *rt,
 joy_status_e radix_trie_add_subnet(struct radix_trie *trie, 
 			  struct in_addr addr, unsigned int netmasklen, attr_flags flags);
 
+/** inserts an IPv6 subnet into the radix_trie, and associates that
+ * subnet with the flags
+ */
+joy_status_e radix_trie_add_subnet6(struct radix_trie *trie,
+			  const struct in6_addr *addr, unsigned int netmasklen, attr_flags flags);
+
+/** builds the lookup tables of the radix_trie from its subnets; until
+ * then, and after further subnets are added, lookups scan all subnets
+ */
+joy_status_e radix_trie_compile(struct radix_trie *rt);
+
 /** writes a json-encoded form of the labels associated with the flags */
 void attr_flags_json_print_labels(const struct radix_trie *rt, 
 			  attr_flags f, char *prefix, zfile file);
@@ -109,6 +121,13 @@ void attr_flags_json_print_labels(const struct radix_trie *rt,
  */
 attr_flags radix_trie_lookup_addr(struct radix_trie *trie, struct in_addr addr);
 
+/** looks up num addresses at once, storing the flags of addr[i] in flags[i] */
+void radix_trie_lookup_addrs(const struct radix_trie *trie, const struct in_addr *addr,
+			  attr_flags *flags, unsigned int num);
+
+/** returns the bitwise-OR of the flags of all subnets that contain the IPv6 address */
+attr_flags radix_trie_lookup_addr6(struct radix_trie *trie, const struct in6_addr *addr);
+
 /** adds a labeled flag with the name "label" to a radix_trie */
 attr_flags radix_trie_add_attr_label(struct radix_trie *rt, const char *label);
 
@@ -89,7 +89,7 @@ __inline void salt_init(struct salt *salt) {
 #endif
 
 /** initialization function */
-void salt_init(struct salt **salt_handle);
+void salt_init(struct salt **salt_handle, joy_arena_t *arena);
 
 /** update salt */
 void salt_update(struct salt *salt, 
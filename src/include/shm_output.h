@@ -0,0 +1,144 @@
+/*
+ *
+ * Copyright (c) 2018 Cisco Systems, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ *
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file shm_output.h
+ *
+ * \brief Publication of records into a named shared memory ring, for
+ *        consumers on the same host
+ *
+ * The writer (joy) appends messages to a ring buffer in a POSIX
+ * shared memory object, and never waits for readers: when the ring is
+ * full, the oldest messages are overwritten.  Each message holds one
+ * or more whole records, in the format of the output - JSON lines, or
+ * CBOR items (see cbor_output.h).
+ *
+ * Any number of readers can attach with shm_reader_open().  Each has
+ * a cursor of its own, and a slot in the ring in which it accounts for
+ * the messages it has read, and for those it lost by falling behind,
+ * so that the lag of every reader can be watched.  The reader side
+ * does not depend on the rest of joy; it can be linked from libjoy,
+ * or from libjoyshm.a alone.
+ */
+
+#ifndef SHM_OUTPUT_H
+#define SHM_OUTPUT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/** "JOYR", at the start of every ring */
+#define SHM_RING_MAGIC 0x4a4f5952
+
+/** version of the layout of the ring */
+#define SHM_RING_VERSION 1
+
+/** largest number of readers that are accounted for at once */
+#define SHM_RING_MAX_READERS 16
+
+/** default size of the data area, in bytes */
+#define SHM_RING_DEFAULT_SIZE (64 * 1024 * 1024)
+
+/** the format of the records in the messages */
+typedef enum shm_format_ {
+    shm_format_json = 0,
+    shm_format_cbor = 1
+} shm_format_e;
+
+/** the accounting of one reader, kept in the ring */
+typedef struct shm_reader_slot_ {
+    uint64_t pid;                 /**< process of the reader, 0 if the slot is free */
+    uint64_t cursor;              /**< position of the next message it will read */
+    uint64_t messages;            /**< messages it has read */
+    uint64_t overflows;           /**< times the writer overtook it */
+    uint64_t messages_lost;       /**< messages overwritten before it read them */
+} shm_reader_slot_t;
+
+/** the start of the shared memory object; the data area follows it */
+typedef struct shm_ring_header_ {
+    uint32_t magic;               /**< SHM_RING_MAGIC, once the ring is ready */
+    uint32_t version;             /**< SHM_RING_VERSION */
+    uint64_t size;                /**< bytes in the data area, a power of two */
+    uint32_t format;              /**< shm_format_e */
+    uint32_t closed;              /**< set when the writer has gone */
+    uint64_t head;                /**< position after the last message published */
+    uint64_t tail;                /**< position of the oldest message not overwritten */
+    uint64_t messages;            /**< messages published */
+    uint64_t bytes;               /**< bytes of records published */
+    uint64_t oversize;            /**< messages too large for the ring, not published */
+    shm_reader_slot_t readers[SHM_RING_MAX_READERS];
+} shm_ring_header_t;
+
+/** the writer of a ring */
+typedef struct shm_ring_ shm_ring_t;
+
+/** a reader of a ring */
+typedef struct shm_reader_ shm_reader_t;
+
+/** what a reader has seen, from its slot and the ring header */
+typedef struct shm_reader_stats_ {
+    uint64_t messages;            /**< messages read */
+    uint64_t overflows;           /**< times the writer overtook the reader */
+    uint64_t messages_lost;       /**< messages overwritten before they were read */
+    uint64_t lag;                 /**< bytes published but not yet read */
+    uint64_t published;           /**< messages published by the writer */
+} shm_reader_stats_t;
+
+shm_ring_t *shm_ring_create(const char *name, size_t size, shm_format_e format);
+
+void shm_ring_write(shm_ring_t *r, const void *data, size_t len);
+
+void shm_ring_commit(shm_ring_t *r);
+
+void shm_ring_abort(shm_ring_t *r);
+
+void shm_ring_close(shm_ring_t *r);
+
+shm_reader_t *shm_reader_open(const char *name, int from_oldest);
+
+int shm_reader_next(shm_reader_t *r, void *buf, size_t size, size_t *len);
+
+shm_format_e shm_reader_format(const shm_reader_t *r);
+
+int shm_reader_closed(const shm_reader_t *r);
+
+void shm_reader_stats(const shm_reader_t *r, shm_reader_stats_t *stats);
+
+void shm_reader_close(shm_reader_t *r);
+
+int shm_unit_test(void);
+
+#endif /* SHM_OUTPUT_H */
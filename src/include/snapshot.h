@@ -0,0 +1,114 @@
+/*
+ *
+ * Copyright (c) 2018 Cisco Systems, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ *
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file snapshot.h
+ *
+ * \brief Immutable snapshots of reloadable data, published without locks (header)
+ */
+
+#ifndef JOY_SNAPSHOT_H
+#define JOY_SNAPSHOT_H
+
+#ifdef WIN32
+#include <windows.h>
+#endif
+
+/** function that frees the data of a snapshot */
+typedef void (*joy_snapshot_free_fn)(void *data);
+
+/**
+ * \brief A published pointer to read-only data.  Readers load it with
+ * joy_snapshot_get(); a writer builds a new copy of the data and
+ * replaces the old one with joy_snapshot_publish().  A zeroed
+ * joy_snapshot_t holds no data.
+ */
+typedef struct joy_snapshot_ {
+    void *data;                 /**< current data; load with joy_snapshot_get() */
+    long version;               /**< number of times data has been published */
+} joy_snapshot_t;
+
+/**
+ * \brief A thread, or context, that reads snapshots.  The data it
+ * loads stays valid until it calls joy_snapshot_quiescent(), which it
+ * does at points where it holds no snapshot data.
+ */
+typedef struct joy_snapshot_reader_ {
+    long epoch;                 /**< epoch seen at the last quiescent point */
+    struct joy_snapshot_reader_ *next;
+} joy_snapshot_reader_t;
+
+/** epoch advanced by each publish */
+extern long joy_snapshot_epoch;
+
+#ifdef WIN32
+#define joy_snapshot_load_ptr(p) InterlockedCompareExchangePointer((PVOID volatile *)(p), NULL, NULL)
+#define joy_snapshot_load_long(p) InterlockedCompareExchange((LONG volatile *)(p), 0, 0)
+#define joy_snapshot_store_long(p, v) InterlockedExchange((LONG volatile *)(p), (v))
+#else
+#define joy_snapshot_load_ptr(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define joy_snapshot_load_long(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define joy_snapshot_store_long(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#endif
+
+/**
+ * \brief Returns the current data of the snapshot, or NULL.
+ */
+static __inline void *joy_snapshot_get (const joy_snapshot_t *s) {
+    return joy_snapshot_load_ptr(&s->data);
+}
+
+/**
+ * \brief Reports that the reader holds no snapshot data, so that data
+ * retired before this point can be freed.
+ */
+static __inline void joy_snapshot_quiescent (joy_snapshot_reader_t *r) {
+    joy_snapshot_store_long(&r->epoch, joy_snapshot_load_long(&joy_snapshot_epoch));
+}
+
+void joy_snapshot_register(joy_snapshot_reader_t *r);
+
+void joy_snapshot_unregister(joy_snapshot_reader_t *r);
+
+long joy_snapshot_publish(joy_snapshot_t *s, void *data, joy_snapshot_free_fn free_fn);
+
+unsigned int joy_snapshot_reclaim(void);
+
+void joy_snapshot_cleanup(void);
+
+void joy_snapshot_unit_test(void);
+
+#endif /* JOY_SNAPSHOT_H */
@@ -49,6 +49,7 @@
 #include "output.h"
 #include "feature.h"
 #include "utils.h"      /* for joy_role_e */
+#include "arena.h"
 
 #define ssh_usage "  ssh=1                      report ssh information\n"
 
@@ -62,9 +63,20 @@
 #define MAX_SSH_PACKET_LEN 35000 /* RFC 4253, Section 6.1. */
 #define MAX_SSH_PAYLOAD_LEN 32768 /* RFC 4253, Section 6.1. */
 
+/*
+ * A vector contains a pointer to a string of bytes of a specified length.
+ * The bytes are allocated from the arena of the ssh structure that owns the
+ * vector, and are released along with it.
+ */
+struct vector {
+    unsigned int len;
+    unsigned int size; /* bytes allocated */
+    char *bytes;
+};
+
 struct ssh_msg {
     unsigned char msg_code;
-    struct vector *data;
+    struct vector data;
 };
 
 typedef struct ssh {
@@ -72,35 +84,39 @@ typedef struct ssh {
     char protocol[MAX_SSH_STRING_LEN];
     unsigned char cookie[16];
     char *kex_algo;
-    struct vector *buffer;
-    struct vector *kex_algos;
-    struct vector *s_host_key_algos;
-    struct vector *c_encryption_algos;
-    struct vector *s_encryption_algos;
-    struct vector *c_mac_algos;
-    struct vector *s_mac_algos;
-    struct vector *c_comp_algos;
-    struct vector *s_comp_algos;
-    struct vector *c_languages;
-    struct vector *s_languages;
-    struct vector *s_gex_p;
-    struct vector *s_gex_g;
-    struct vector *c_kex;
-    struct vector *s_kex;
-    struct vector *s_hostkey;
-    struct vector *s_signature;
-    struct vector *s_hostkey_type;
-    struct vector *s_signature_type;
+    struct vector buffer;
+    struct vector kex_algos;
+    struct vector s_host_key_algos;
+    struct vector c_encryption_algos;
+    struct vector s_encryption_algos;
+    struct vector c_mac_algos;
+    struct vector s_mac_algos;
+    struct vector c_comp_algos;
+    struct vector s_comp_algos;
+    struct vector c_languages;
+    struct vector s_languages;
+    struct vector s_gex_p;
+    struct vector s_gex_g;
+    struct vector c_kex;
+    struct vector s_kex;
+    struct vector s_hostkey;
+    struct vector s_signature;
+    struct vector s_hostkey_type;
+    struct vector s_signature_type;
     unsigned kex_msgs_len;
     struct ssh_msg kex_msgs[MAX_SSH_KEX_MESSAGES];
     unsigned int c_gex_min,c_gex_n,c_gex_max;
     int newkeys;
     int unencrypted;
+    unsigned char hassh[16];        /* MD5 of the client algorithm lists */
+    unsigned char hassh_server[16]; /* MD5 of the server algorithm lists */
+    int have_hassh;
+    joy_arena_t *arena;             /* backs kex_algo and the vectors */
 } ssh_t;
 
 declare_feature(ssh);
 
-void ssh_init(struct ssh **ssh_handle);
+void ssh_init(struct ssh **ssh_handle, joy_arena_t *arena);
 
 void ssh_update(struct ssh *ssh,
                 const struct pcap_pkthdr *header,
@@ -43,6 +43,7 @@
 #define STR_MATCH_H
 
 #include <string.h>
+#include <stdint.h>
 #include "acsm.h"
 #include "err.h"
 #define MATCH_ARRAY_LEN 32
@@ -53,11 +54,31 @@ struct matches {
     unsigned int count;
 };
 
-typedef acsm_context_t *str_match_ctx;
+/*
+ * A string matching context holds the Aho-Corasick automaton for a
+ * pattern set, compiled into a dense DFA: every (state, byte class)
+ * pair has a next state, so matching needs no fail transitions.  Bytes
+ * that do not occur in any pattern share byte class 0, which keeps the
+ * table small.  A compiled context is read-only, so any number of
+ * threads may search it at the same time.
+ */
+typedef struct str_match_ctx_ {
+    acsm_context_t *acsm;            /**< pattern set, until compiled */
+    unsigned int no_case;            /**< fold ASCII case when matching */
+    unsigned int num_states;         /**< number of DFA states */
+    unsigned int num_classes;        /**< number of byte classes */
+    unsigned char byte_class[256];   /**< byte to byte class */
+    unsigned char first_byte[256];   /**< nonzero if a pattern starts with byte */
+    uint32_t *next_state;            /**< num_states * num_classes transitions */
+    uint32_t *match_index;           /**< per state offset into match_len */
+    size_t *match_len;               /**< lengths of the patterns ending in a state */
+} *str_match_ctx;
 
-#define str_match_ctx_alloc() acsm_alloc(NO_CASE)
+/** allocate an empty string matching context */
+str_match_ctx str_match_ctx_alloc(void);
 
-#define str_match_ctx_free(ctx) acsm_free(ctx)
+/** free a string matching context */
+void str_match_ctx_free(str_match_ctx ctx);
 
 typedef joy_status_e (*string_transform)(const char *input, 
 				unsigned int inlen, 
@@ -73,4 +94,7 @@ void str_match_ctx_find_all_longest(const str_match_ctx ctx,
 /** initialize a string matching context from data in a file */
 int str_match_ctx_init_from_file(str_match_ctx ctx, const char *filename, string_transform transform);
 
+/** unit test for the string matching functions */
+int str_match_unit_test(void);
+
 #endif /* STR_MATCH_H */
@@ -45,8 +45,10 @@
 
 #include <pcap.h>
 #include "output.h"
+#include "emitter.h"
 #include "utils.h"
 #include "fingerprint.h"
+#include "arena.h"
 
 /** usage string for tls */
 #define tls_usage "  tls=1                      report TLS data (ciphersuites, record lengths and times, ...)\n"
@@ -163,6 +165,7 @@ typedef struct tls_item_entry_ {
 } tls_item_entry_t;
 
 typedef struct tls_certificate_ {
+    unsigned int refcount; /**< Flows and cache entries holding this certificate */
     uint16_t length;
     unsigned char *serial_number; /**< Serial Number */
     uint8_t serial_number_length; /**< Length of the serial number in bytes */
@@ -205,7 +208,7 @@ typedef struct tls_ {
     unsigned char sid_len; /**< Session ID length */
     unsigned char sid[MAX_SID_LEN]; /**< Session ID */
     unsigned char random[32]; /**< Random field from hello */
-    tls_certificate_t certificates[MAX_CERTIFICATES]; /**< X.509 certificates */
+    tls_certificate_t *certificates[MAX_CERTIFICATES]; /**< X.509 certificates, shared through the certificate cache */
     unsigned char num_certificates; /**< Number of certificates */
     unsigned char *sni; /**< SNI a.k.a Server name indication */
     uint16_t sni_length; /**< Length of SNI */
@@ -214,6 +217,9 @@ typedef struct tls_ {
     unsigned char done_handshake; /**< Flag indicating the hanshake phase has completed */
     uint16_t seg_offset;
     fingerprint_t *tls_fingerprint;
+    unsigned char ja3[16]; /**< MD5 of the JA3 string of the ClientHello */
+    unsigned char have_ja3; /**< Flag indicating ja3 has been computed */
+    joy_arena_t *arena; /**< Backs the sni and the extension data */
 } tls_t;
 
 
@@ -308,7 +314,7 @@ typedef enum tls_content_type_ {
  */
 
 /** initialize TLS structure */
-void tls_init(tls_t **tls_handle);
+void tls_init(tls_t **tls_handle, joy_arena_t *arena);
 
 /** free data associated with TLS record */
 void tls_delete(tls_t **tls_handle);
@@ -323,11 +329,20 @@ void tls_update(tls_t *r,
 /** print out the TLS information to the destination file */
 void tls_print_json(const tls_t *data, const tls_t *data_twin, zfile f);
 
+void tls_print(const tls_t *data, const tls_t *data_twin, emitter_t *e);
+
 void tls_unit_test();
 
-#if 0
+/** report the certificate cache hit, miss and entry counts */
+void tls_certificate_cache_stats(unsigned long *hits,
+                                 unsigned long *misses,
+                                 unsigned int *entries);
+
+/** empty the certificate cache */
+void tls_certificate_cache_cleanup(void);
+
+/** load tls_fingerprint.json, for labeling TLS clients */
 int tls_load_fingerprints(void);
-#endif
 
 #endif /* TLS_H */
 
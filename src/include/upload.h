@@ -0,0 +1,150 @@
+/*
+ *
+ * Copyright (c) 2018 Cisco Systems, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ *
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file upload.h
+ *
+ * \brief Upload of the rotated output files to a storage server
+ *        (header)
+ *
+ * Every file handed to upload_file() is appended to a queue, which is
+ * kept in a journal on disk, so that files still waiting when joy
+ * stops are picked up again when it starts.  A pool of workers takes
+ * files off the queue and sends them with a transport, several at a
+ * time.  A transfer that fails is retried after a delay that doubles
+ * with each attempt, until the file is given up on; the file itself is
+ * then kept.
+ *
+ * The transport is chosen by the prefix of the destination:
+ *
+ *   user@server:path         scp (the default, when there is no prefix)
+ *   scp:user@server:path     scp
+ *   rsync:[user@server:]path rsync, which resumes partial transfers
+ *   dir:path                 a copy into a local directory, which is
+ *                            renamed into place once it is complete
+ *
+ * Other transports can be added with upload_register_transport().
+ */
+
+#ifndef UPLOAD_H
+#define UPLOAD_H
+
+#ifndef WIN32
+#include <sys/types.h>
+#endif
+
+/** largest number of concurrent transfers */
+#define UPLOAD_MAX_WORKERS 16
+
+/** number of concurrent transfers when not configured */
+#define UPLOAD_DEFAULT_WORKERS 2
+
+/** number of retries of a file when not configured */
+#define UPLOAD_DEFAULT_RETRIES 5
+
+/** seconds before the first retry of a file */
+#define UPLOAD_RETRY_DELAY 10
+
+/** longest delay between two attempts, in seconds */
+#define UPLOAD_MAX_RETRY_DELAY 600
+
+/** name of the queue journal, in the output directory, when not configured */
+#define UPLOAD_QUEUE_FILE "joy-upload.queue"
+
+/** how the uploader works */
+typedef struct upload_options_ {
+    const char *destination;      /**< "[transport:]target" the files are sent to */
+    const char *key;              /**< SSH identity file, or NULL */
+    const char *queue_file;       /**< journal of the queue, or NULL to keep it in memory */
+    unsigned int workers;         /**< concurrent transfers */
+    unsigned int retries;         /**< attempts after the first, before a file is given up on */
+    unsigned int retry_delay;     /**< seconds before the first retry, doubled after each */
+    unsigned int max_retry_delay; /**< longest delay between two attempts */
+    unsigned long bwlimit;        /**< bytes per second per transfer, 0 for no limit */
+    unsigned int retain;          /**< keep the local file once it is uploaded */
+} upload_options_t;
+
+/** one transfer, as seen by a transport */
+typedef struct upload_transfer_ {
+    const char *filename;         /**< local file to send */
+    const char *target;           /**< destination, without the transport prefix */
+    const char *key;              /**< SSH identity file, or NULL */
+    unsigned long bwlimit;        /**< bytes per second, 0 for no limit */
+    volatile int stop;            /**< set when the uploader is stopping */
+#ifndef WIN32
+    volatile pid_t child;         /**< command running the transfer, or 0 */
+#endif
+} upload_transfer_t;
+
+/**
+ * \brief A way of sending files.
+ *
+ * send() returns 0 once the whole file has arrived, and anything else
+ * if it has to be tried again.  It should give up soon after
+ * transfer->stop is set.  A transfer that runs a command can hand the
+ * arguments to upload_run_command(), which also takes care of stop.
+ */
+typedef struct upload_transport_ {
+    const char *name;             /**< prefix of the destinations it handles */
+    int (*send)(upload_transfer_t *transfer);
+} upload_transport_t;
+
+/** counters kept by the uploader */
+typedef struct upload_stats_ {
+    unsigned long queue_depth;      /**< files waiting, including those waiting for a retry */
+    unsigned long active;           /**< transfers in progress */
+    unsigned long files_uploaded;   /**< files sent */
+    unsigned long bytes_uploaded;   /**< bytes of those files */
+    unsigned long retries;          /**< failed attempts that were retried */
+    unsigned long failures;         /**< files given up on */
+    double transfer_seconds;        /**< time taken by the transfers that succeeded */
+} upload_stats_t;
+
+int upload_register_transport(const upload_transport_t *transport);
+
+int upload_start(const upload_options_t *options);
+
+int upload_file(const char *filename);
+
+void upload_stats(upload_stats_t *stats);
+
+void upload_stop(void);
+
+int upload_run_command(upload_transfer_t *transfer, char *const argv[]);
+
+void upload_unit_test(void);
+
+#endif /* UPLOAD_H */
@@ -89,6 +89,8 @@ pcap_t* joy_utils_open_test_pcap(const char *filename);
 
 JSON_Value* joy_utils_open_resource_parson(const char *filename);
 
+JSON_Value* joy_utils_open_optional_resource_parson(const char *filename, int *missing);
+
 void joy_utils_convert_to_json_string (char *s, unsigned int len);
 
 void joy_log_timestamp ( char *log_ts);
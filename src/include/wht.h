@@ -50,6 +50,8 @@
 
 #include <stdio.h> 
 #include "output.h"
+#include "emitter.h"
+#include "arena.h"
 #include <pcap.h>
 
 /** inclusion string */
@@ -65,7 +67,7 @@ typedef struct wht_ {
 } wht_t;
 
 /** initializes a walsh-hadamard structure */
-void wht_init(wht_t **wht_handle);
+void wht_init(wht_t **wht_handle, joy_arena_t *arena);
 
 /** updates the contents of walsh-hadamard structure */
 void wht_update(wht_t *wht, 
@@ -77,6 +79,9 @@ void wht_update(wht_t *wht,
 /** prints out the walsh-hadamard structure in JSON format */
 void wht_print_json(const wht_t *w1, const wht_t *w2, zfile f);
 
+/** print the walsh-hadamard transform through an emitter */
+void wht_print(const wht_t *w1, const wht_t *w2, emitter_t *e);
+
 /** clear out the walsh-hadamard structure */
 void wht_delete(wht_t **wht_handle);
 
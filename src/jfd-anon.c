@@ -36,39 +36,129 @@
 
 /**
  * \file jfd-anon.c
- * 
+ *
  * \brief json flow data anonymization tool
- * 
+ *
  ** \verbatim
   jfd-anon [ -c | -r ] datafile [ -k <keyfile> ] [ -u <userfile> ] [ -s <subnetfile> ]
+           [ -j <threads> ] [ -o <outfile> ] [ -z ]
      datafile is the data to be (de)anonymized
      <keyfile> is the key to be used in (de)anonymization
      <userfile> is the set of usernames to be anonymized
      <subnetfile> is the set of subnets to be anonymized
+     <threads> is the number of threads that (de)anonymize the data
+     <outfile> is where the output goes, instead of standard output
+     -z compresses the output
  \endverbatim
+ *
+ * The data is cut into chunks of a few megabytes, each ending at the
+ * end of a line, that a pool of threads (de)anonymizes line by line;
+ * the main thread only reads the data and writes the output of each
+ * chunk in turn, so that the output is in the order of the input.
+ *
+ * The compiled username matcher, the subnets and the key are only read
+ * once they are initialized, so the threads share them; each thread
+ * has its own cache of anonymized addresses, and each chunk its own
+ * output.  With -z, the threads compress the output of each chunk too,
+ * into a block of its own, with the block codec that joy writes its
+ * output with (zcodec_compress()), so joy-query reads it in parallel.  Data compressed as joy
+ * compresses it is read directly.
  */
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <ctype.h>
-#include <unistd.h>  
+#include <unistd.h>
+#include <pthread.h>
 #include "anon.h"
 #include "radix_trie.h"
 
 #ifdef WIN32
 #include "Ws2tcpip.h"
-
-size_t getline(char **lineptr, size_t *n, FILE *stream);
-
 #else
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #endif
 
+/* bytes of data read into a chunk, which grows to hold longer lines */
+#define ANON_CHUNK_SIZE (4 * 1024 * 1024)
+
+/* largest number of threads */
+#define ANON_MAX_THREADS 64
+
 extern str_match_ctx  usernames_ctx;
 
-static char *address_string_anonymize (char *addr_string) {
+enum type {
+    null_type = 0,
+    addresses = 1,
+    strings   = 2
+};
+
+/* what is done to each line; set before the threads start */
+static enum anon_mode mode = mode_anonymize;
+static enum type type = null_type;
+static int compress_output = 0;
+
+/* a piece of the data, on its way through the pool */
+typedef struct chunk_ {
+    int busy;                     /* queued for, or being worked on by, the pool */
+    int failed;                   /* the output could not be made */
+    char *data;                   /* whole lines */
+    size_t len;
+    size_t size;
+    unsigned int first_line;      /* number of the first line, from 0 */
+    zfile out;                    /* output, kept in memory */
+    char *packed;                 /* output, compressed */
+    size_t packed_len;
+    size_t packed_size;
+} chunk_t;
+
+struct pipeline_;
+
+/* a thread of the pool */
+typedef struct worker_ {
+    pthread_t thread;
+    struct pipeline_ *pl;
+    anon_addr_cache_t cache;
+    char hex[ANON_HEXSTRING_LEN];
+    struct matches matches;
+    zcodec codec;                 /* compressor of the output, with -z */
+} worker_t;
+
+typedef struct pipeline_ {
+    unsigned int num_workers;
+    unsigned int num_started;     /* workers whose thread is running */
+    worker_t *workers;
+    unsigned int window;          /* number of chunks */
+    chunk_t *chunks;
+    chunk_t **queue;              /* chunks waiting for the pool */
+    unsigned int queue_head;
+    unsigned int queue_len;
+    int stop;
+    pthread_mutex_t lock;
+    pthread_cond_t work;          /* a chunk was queued */
+    pthread_cond_t done;          /* a chunk is no longer busy */
+} pipeline_t;
+
+/* an input file, decompressed as it is read */
+typedef struct input_ {
+    zreader r;
+    const char *name;
+    int eof;
+    int failed;                   /* an error was reported, and nothing more is read */
+    char *carry;                  /* read after the last newline of a chunk */
+    size_t carry_len;
+    size_t carry_size;
+} input_t;
+
+/*
+ * -------------------------------------------------------
+ * (De)anonymization of a line
+ * -------------------------------------------------------
+ */
+
+static char *address_string_anonymize (worker_t *w, char *addr_string) {
     struct in_addr addr;
     int l;
 
@@ -85,97 +175,486 @@ static char *address_string_anonymize (char *addr_string) {
         return NULL;
     }
     if (ipv4_addr_needs_anonymization(&addr)) {
-        return addr_get_anon_hexstring(&addr);
+        return addr_get_anon_hexstring(&addr, &w->cache, w->hex);
     }
     return addr_string;
 }
 
-static void anon_addresses (char *line) {
-    char *addr;
-    char addr_string[256];
+/*
+ * finds the next "sa" or "da" string value in line, both as joy writes
+ * it and as pretty printed JSON has it; returns the key, and sets
+ * value and len to the string between the quotes
+ */
+static char *next_address (char *line, char *last, char **value, size_t *len) {
+    char *key, *p, *q;
 
-    addr = strstr(line, "\"sa\":");
-    if (addr) {
-        sscanf(addr + 7, "%[a-fA-F0-9.]", addr_string);
-        printf("\t\t\t\"sa\": \"%s\",\n", address_string_anonymize(addr_string));
-        //      printf("%s", addr);
-    } else {
-        addr = strstr(line, "\"da\":");
-        if (addr) {
-            sscanf(addr + 7, "%[a-fA-F0-9.]", addr_string);
-            printf("\t\t\t\"da\": \"%s\",\n", address_string_anonymize(addr_string));
-            //      printf("%s", addr);
-        } else {
-            printf("%s", line);
+    for (p = line; p < last && (key = memchr(p, '"', last - p)) != NULL; p = key + 1) {
+        if (last - key < 6 || (key[1] != 's' && key[1] != 'd') ||
+            key[2] != 'a' || key[3] != '"' || key[4] != ':') {
+            continue;
+        }
+        q = key + 5;
+        while (q < last && (*q == ' ' || *q == '\t')) {
+            q++;
+        }
+        if (q == last || *q != '"') {
+            continue;
+        }
+        *value = ++q;
+        while (q < last && (isxdigit((unsigned char)*q) || *q == '.')) {
+            q++;
         }
-    }   
+        if (q == last || *q != '"') {
+            continue;
+        }
+        *len = q - *value;
+        return key;
+    }
+    return NULL;
 }
 
-static void check_anon_addresses (char *line) {
-    char *addr;
+/* writes line with its addresses anonymized, or reports those that need it */
+static void anon_addresses (worker_t *w, zfile out, char *line, size_t len) {
+    char *last = line + len;
+    char *done = line;
+    char *key, *value, *anon;
     char addr_string[256];
-    char *retval;
-
-    addr = strstr(line, "\"sa\":");
-    if (addr) {
-        sscanf(addr + 7, "%[a-fA-F0-9.]", addr_string);
-    
-        retval =  address_string_anonymize(addr_string);
-        if (retval && retval != addr_string) {
-            printf("sa needs anonymization: %s\t%s\n", addr_string, retval);
+    size_t n;
+
+    while ((key = next_address(done, last, &value, &n)) != NULL) {
+        done = value + n;
+        if (n >= sizeof(addr_string)) {
+            continue;
         }
-    } else {
-        addr = strstr(line, "\"da\":");
-        if (addr) {
-            sscanf(addr + 7, "%[a-fA-F0-9.]", addr_string);
-            retval =  address_string_anonymize(addr_string);
-            if (retval && retval != addr_string) {
-	              printf("da needs anonymization: %s\t%s\n", addr_string, retval);
+        memcpy(addr_string, value, n);
+        addr_string[n] = '\0';
+        anon = address_string_anonymize(w, addr_string);
+        if (mode == mode_anonymize) {
+            if (anon && anon != addr_string) {
+                zwrite(out, line, value - line);
+                zputs(out, anon);
+                len -= done - line;
+                line = done;
             }
-        }   
+        } else if (anon && anon != addr_string) {
+            zprintf(out, "%ca needs anonymization: %s\t%s\n", key[1], addr_string, anon);
+        }
+    }
+    if (mode == mode_anonymize) {
+        zwrite(out, line, len);
     }
 }
 
-static void matches_print (struct matches *matches, char *text) {
+static void matches_print (zfile out, struct matches *matches, char *text) {
     unsigned int i;
-    char tmp[1024];
 
-    // printf("matches->count: %d\n", matches->count);
     for (i=0; i < matches->count; i++) {
         size_t len = matches->stop[i] - matches->start[i] + 1;
-        if (len >= 1024) {
-            return;
+
+        zprintf(out, "\tmatch %d: ", i);
+        zwrite(out, text + matches->start[i], len);
+        zputc(out, '\n');
+    }
+}
+
+/* writes the NULL-terminated line with its usernames (de)anonymized, or reports them */
+static void anon_usernames (worker_t *w, zfile out, char *line, size_t len, unsigned int linenum) {
+    str_match_ctx_find_all_longest(usernames_ctx, (unsigned char *)line, len, &w->matches);
+    if (mode == mode_anonymize) {
+        anon_print_string(out, &w->matches, line, email_special_chars, anon_string);
+    } else if (mode == mode_check) {
+        if (w->matches.count > 0) {
+            zprintf(out, "username match(es) at line %u:\n", linenum);
+            matches_print(out, &w->matches, line);
         }
-        memcpy(tmp, text + matches->start[i], len);
-        tmp[len] = '\0';
-        printf("\tmatch %d: %s\n", i, tmp);
+    } else if (mode == mode_deanonymize) {
+        anon_print_string(out, &w->matches, line, email_special_chars, deanon_string);
     }
 }
 
+/*
+ * -------------------------------------------------------
+ * The pool
+ * -------------------------------------------------------
+ */
+
+/* compresses the output of c into one block, as joy writes them */
+static int compress_chunk (worker_t *w, chunk_t *c, const char *data, size_t len) {
+    size_t bound = zcodec_bound(len);
+
+    if (c->packed_size < bound) {
+        free(c->packed);
+        c->packed = malloc(bound);
+        c->packed_size = c->packed ? bound : 0;
+        if (c->packed == NULL) {
+            return -1;
+        }
+    }
+    c->packed_len = zcodec_compress(w->codec, data, len, c->packed, bound);
+    return c->packed_len ? 0 : -1;
+}
+
+/* (de)anonymizes, or checks, every line of c */
+static void process_chunk (worker_t *w, chunk_t *c) {
+    char *line = c->data, *last = c->data + c->len, *nl;
+    unsigned int linenum = c->first_line;
+    const char *data;
+    size_t len;
+    char save;
+
+    zmemory_clear(c->out);
+    while (line < last) {
+        nl = memchr(line, '\n', last - line);
+        nl = nl ? nl + 1 : last;
+
+        /* the string functions want the line NULL-terminated */
+        save = *nl;
+        *nl = '\0';
+        if (type == addresses) {
+            anon_addresses(w, c->out, line, nl - line);
+        } else {
+            anon_usernames(w, c->out, line, nl - line, linenum);
+        }
+        *nl = save;
+        line = nl;
+        linenum++;
+    }
+
+    data = zmemory(c->out, &len);
+    c->failed = (data == NULL);
+    if (data != NULL && compress_output) {
+        c->failed = (compress_chunk(w, c, data, len) != 0);
+    }
+}
+
+static void *worker_main (void *arg) {
+    worker_t *w = arg;
+    pipeline_t *pl = w->pl;
+    chunk_t *c;
+
+    for (;;) {
+        pthread_mutex_lock(&pl->lock);
+        while (pl->queue_len == 0 && !pl->stop) {
+            pthread_cond_wait(&pl->work, &pl->lock);
+        }
+        if (pl->queue_len == 0) {
+            pthread_mutex_unlock(&pl->lock);
+            return NULL;
+        }
+        c = pl->queue[pl->queue_head];
+        pl->queue_head = (pl->queue_head + 1) % pl->window;
+        pl->queue_len--;
+        pthread_mutex_unlock(&pl->lock);
+
+        process_chunk(w, c);
+
+        pthread_mutex_lock(&pl->lock);
+        c->busy = 0;
+        pthread_cond_broadcast(&pl->done);
+        pthread_mutex_unlock(&pl->lock);
+    }
+}
+
+/* hands a chunk to the pool */
+static void submit (pipeline_t *pl, chunk_t *c) {
+    pthread_mutex_lock(&pl->lock);
+    c->busy = 1;
+    pl->queue[(pl->queue_head + pl->queue_len) % pl->window] = c;
+    pl->queue_len++;
+    pthread_cond_signal(&pl->work);
+    pthread_mutex_unlock(&pl->lock);
+}
+
+/* waits until the pool is done with a chunk */
+static void wait_chunk (pipeline_t *pl, chunk_t *c) {
+    pthread_mutex_lock(&pl->lock);
+    while (c->busy) {
+        pthread_cond_wait(&pl->done, &pl->lock);
+    }
+    pthread_mutex_unlock(&pl->lock);
+}
+
+static int worker_init (worker_t *w) {
+    if (compress_output) {
+        w->codec = zcodec_new(0);
+        if (w->codec == NULL) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int pipeline_start (pipeline_t *pl, unsigned int num_workers) {
+    unsigned int i;
+
+    pl->num_workers = num_workers;
+    pl->window = 2 * num_workers + 2;
+    pl->chunks = calloc(pl->window, sizeof(chunk_t));
+    pl->queue = calloc(pl->window, sizeof(chunk_t *));
+    pl->workers = calloc(num_workers, sizeof(worker_t));
+    if (pl->chunks == NULL || pl->queue == NULL || pl->workers == NULL) {
+        return -1;
+    }
+    for (i = 0; i < pl->window; i++) {
+        pl->chunks[i].out = zopen_memory();
+        if (pl->chunks[i].out == NULL) {
+            return -1;
+        }
+    }
+    pthread_mutex_init(&pl->lock, NULL);
+    pthread_cond_init(&pl->work, NULL);
+    pthread_cond_init(&pl->done, NULL);
+    for (i = 0; i < num_workers; i++) {
+        worker_t *w = &pl->workers[i];
+
+        w->pl = pl;
+        if (worker_init(w) != 0 || pthread_create(&w->thread, NULL, worker_main, w) != 0) {
+            return -1;
+        }
+        pl->num_started++;
+    }
+    return 0;
+}
+
+static void pipeline_stop (pipeline_t *pl) {
+    unsigned int i;
+
+    if (pl->workers != NULL) {
+        pthread_mutex_lock(&pl->lock);
+        pl->stop = 1;
+        pthread_cond_broadcast(&pl->work);
+        pthread_mutex_unlock(&pl->lock);
+        for (i = 0; i < pl->num_started; i++) {
+            pthread_join(pl->workers[i].thread, NULL);
+        }
+        for (i = 0; i < pl->num_workers; i++) {
+            zcodec_free(pl->workers[i].codec);
+        }
+    }
+    for (i = 0; pl->chunks != NULL && i < pl->window; i++) {
+        if (pl->chunks[i].out != NULL) {
+            zclose(pl->chunks[i].out);
+        }
+        free(pl->chunks[i].data);
+        free(pl->chunks[i].packed);
+    }
+    free(pl->workers);
+    free(pl->chunks);
+    free(pl->queue);
+}
+
+/*
+ * -------------------------------------------------------
+ * Input
+ * -------------------------------------------------------
+ */
+
+/* opens fname, or standard input if fname is NULL */
+static int input_open (input_t *in, const char *fname) {
+    memset(in, 0, sizeof(*in));
+    in->r = zreader_open(fname);
+    if (in->r == NULL) {
+        return -1;
+    }
+    in->name = zreader_name(in->r);
+    return 0;
+}
+
+static void input_close (input_t *in) {
+    zreader_close(in->r);
+    in->r = NULL;
+    free(in->carry);
+}
+
+/*
+ * fills c with the next whole lines of the input, the first of which
+ * starts with what was carried over from the chunk before; returns 1,
+ * 0 at the end of the input, or -1 on failure
+ */
+static int input_next (input_t *in, chunk_t *c) {
+    size_t len;
+    char *last;
+    long n;
+
+    if (c->size < in->carry_len + ANON_CHUNK_SIZE + 1) {
+        free(c->data);
+        c->size = in->carry_len + ANON_CHUNK_SIZE + 1;
+        c->data = malloc(c->size);
+        if (c->data == NULL) {
+            c->size = 0;
+            fprintf(stderr, "error: %s could not be read: out of memory\n", in->name);
+            return -1;
+        }
+    }
+    if (in->carry_len) {
+        memcpy(c->data, in->carry, in->carry_len);
+    }
+    len = in->carry_len;
+    in->carry_len = 0;
+
+    for (;;) {
+        /* one byte is kept for the NULL after the last line */
+        while (len < c->size - 1 && !in->eof) {
+            n = zread(in->r, c->data + len, c->size - 1 - len);
+            if (n < 0) {
+                /* the whole lines read before the error are still used */
+                in->failed = 1;
+                n = 0;
+            }
+            if (n == 0) {
+                in->eof = 1;
+            }
+            len += n;
+        }
+        for (last = c->data + len; last > c->data && last[-1] != '\n'; last--) {
+            ;
+        }
+        if (last > c->data || in->eof) {
+            break;
+        }
+
+        /* a line longer than the chunk */
+        last = realloc(c->data, 2 * c->size);
+        if (last == NULL) {
+            fprintf(stderr, "error: %s could not be read: out of memory\n", in->name);
+            return -1;
+        }
+        c->data = last;
+        c->size *= 2;
+    }
+
+    if (in->eof && !in->failed) {
+        /* the last line may not end in a newline */
+        last = c->data + len;
+    }
+    c->len = last - c->data;
+
+    /* unless it was cut short by an error, the rest starts the next chunk */
+    if (len > c->len && !in->failed) {
+        if (in->carry_size < len - c->len) {
+            free(in->carry);
+            in->carry_size = len - c->len + ANON_CHUNK_SIZE / 4;
+            in->carry = malloc(in->carry_size);
+            if (in->carry == NULL) {
+                in->carry_size = 0;
+                fprintf(stderr, "error: %s could not be read: out of memory\n", in->name);
+                return -1;
+            }
+        }
+        in->carry_len = len - c->len;
+        memcpy(in->carry, last, in->carry_len);
+    }
+    return c->len > 0;
+}
+
+/* writes the output of a chunk */
+static int emit (chunk_t *c, FILE *out) {
+    const char *data;
+    size_t len;
+
+    if (c->failed) {
+        fprintf(stderr, "error: out of memory\n");
+        return -1;
+    }
+    if (compress_output) {
+        data = c->packed;
+        len = c->packed_len;
+    } else {
+        data = zmemory(c->out, &len);
+    }
+    if (len && fwrite(data, 1, len, out) != len) {
+        fprintf(stderr, "error: could not write output\n");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * \brief (De)anonymize, or check, every line of one input.
+ *
+ * \param pl the pipeline
+ * \param fname name of the input, or NULL for standard input
+ * \param out where the output goes
+ *
+ * \return 0 on success, or -1 if the input could not be read to its end
+ */
+static int anon_file (pipeline_t *pl, const char *fname, FILE *out) {
+    unsigned long next_read = 0, next_emit = 0;
+    unsigned int linenum = 0;
+    int eof = 0, rc = 0;
+    const char *p;
+    chunk_t *c;
+    input_t in;
+
+    if (input_open(&in, fname) != 0) {
+        return -1;
+    }
+
+    for (;;) {
+        /* read ahead, as far as there are chunks */
+        while (!eof && next_read - next_emit < pl->window) {
+            c = &pl->chunks[next_read % pl->window];
+            switch (input_next(&in, c)) {
+            case 1:
+                c->first_line = linenum;
+                if (type == strings && mode == mode_check) {
+                    /* only the report of usernames needs line numbers */
+                    for (p = c->data; (p = memchr(p, '\n', c->data + c->len - p)) != NULL; p++) {
+                        linenum++;
+                    }
+                }
+                submit(pl, c);
+                next_read++;
+                break;
+            case -1:
+                rc = -1;
+                /* fall through */
+            default:
+                eof = 1;
+            }
+        }
+        if (next_emit == next_read) {
+            break;
+        }
+        c = &pl->chunks[next_emit++ % pl->window];
+        wait_chunk(pl, c);
+        if (rc == 0 && emit(c, out) != 0) {
+            rc = -1;
+            eof = 1;
+        }
+    }
+
+    if (in.failed) {
+        rc = -1;
+    }
+    input_close(&in);
+    return rc;
+}
 
 static int usage (char *name) {
-    fprintf(stderr, "usage:\n%s [-c|-r] [<dfile>][-u <ufile>][-s <sfile>][-k <kfile>]\n", name);
+    fprintf(stderr, "usage:\n%s [-c|-r] [<dfile>][-u <ufile>][-s <sfile>][-k <kfile>]"
+            "[-j <threads>][-o <ofile>][-z]\n", name);
     fprintf(stderr, "where:\n"
 	        "   <dfile> contains the data to be (de)anonymized; if omitted,\n"
-	        "   the data will be read from stdin\n\n"
+	        "   the data will be read from stdin; it may be compressed as joy\n"
+	        "   compresses its output\n\n"
 	        "   <ufile> contains the set of usernames to be (de)anonymized,\n"
 	        "   one username per line of the file\n\n"
 	        "   <sfile> contains the set of subnets to be anonymized, one\n"
 	        "   subnet per line in CIDR (W.X.Y.Z/M) notation\n\n"
 	        "   <kfile> contains the key to be used in (de)anonymization; if\n"
-	        "   omitted, the file %s will be used\n\n" 
+	        "   omitted, the file %s will be used\n\n"
+	        "   <threads> is the number of threads that (de)anonymize the data;\n"
+	        "   it is the number of CPUs by default\n\n"
+	        "   <ofile> is where the output is written; if omitted, it is\n"
+	        "   written to stdout\n\n"
 	        "   -r causes anonymization to be removed\n\n"
-	        "   -c checks to see if anonymization is needed (but does not perform it)\n\n",
+	        "   -c checks to see if anonymization is needed (but does not perform it)\n\n"
+	        "   -z compresses the output (in blocks, as joy does with compress_threads)\n\n",
 	        ANON_KEYFILE_DEFAULT);
     return 1;
 }
 
-enum type {
-    null_type = 0,
-    addresses = 1,
-    strings   = 2
-};
-
 /*
  * getopt() external variables
  */
@@ -193,24 +672,21 @@ extern int optind, opterr, optopt;
  \return 0 success
  */
 int main (int argc, char *argv[]) {
-    ssize_t bytes_read;
-    size_t len;
-    char *line = NULL;  
     joy_status_e err;
     char *keyfile = ANON_KEYFILE_DEFAULT;
     char *userfile = NULL;
     char *subnetfile = NULL;
     char *datafile = NULL;
-    FILE *input;
-    enum anon_mode mode = mode_anonymize;
-    enum type type = null_type;
-    int opt;
-    unsigned int linenum = 0;
+    char *outfile = NULL;
+    long num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    FILE *output = stdout;
+    pipeline_t pl;
+    int opt, rc;
 
     /*
      * obtain options from command line
      */
-    while ((opt = getopt(argc, argv, "crk:u:s:")) != -1) {
+    while ((opt = getopt(argc, argv, "crk:u:s:j:o:z")) != -1) {
         switch (opt) {
             case 'c':
                 mode = mode_check;
@@ -229,7 +705,19 @@ int main (int argc, char *argv[]) {
                 subnetfile = optarg;
                 type = addresses;
                 break;
-            default: 
+            case 'j':
+                num_threads = atol(optarg);
+                if (num_threads < 1) {
+                    return usage(argv[0]);
+                }
+                break;
+            case 'o':
+                outfile = optarg;
+                break;
+            case 'z':
+                compress_output = 1;
+                break;
+            default:
                 return usage(argv[0]);
         }
     }
@@ -245,6 +733,18 @@ int main (int argc, char *argv[]) {
     if (optind < argc) {
         datafile = argv[optind];
     }
+    if (num_threads < 1) {
+        num_threads = 1;
+    }
+    if (num_threads > ANON_MAX_THREADS) {
+        num_threads = ANON_MAX_THREADS;
+    }
+#if !defined(USE_ZSTD) && !defined(USE_GZIP)
+    if (compress_output) {
+        fprintf(stderr, "error: this jfd-anon compresses with neither gzip nor zstd\n");
+        return EXIT_FAILURE;
+    }
+#endif
 
     if (subnetfile) {
         err = anon_init(subnetfile, stderr);
@@ -264,88 +764,26 @@ int main (int argc, char *argv[]) {
         }
     }
 
-    if (datafile) {
-        input = fopen(datafile, "r");
-        if (input == NULL) {
-            fprintf(stderr, "error: could not read from file %s\n", datafile);
+    if (outfile) {
+        output = fopen(outfile, "wb");
+        if (output == NULL) {
+            fprintf(stderr, "error: could not write to file %s\n", outfile);
             return EXIT_FAILURE;
         }
-    } else {
-        input = stdin;
     }
 
-    //  printf("mode: %u\n", mode);
-
-    /*
-     * read and then process each line of input
-     */
-    while ((bytes_read = getline(&line, &len, input)) != -1) {
-  
-#if 0
-        unsigned int i;
-        char *text;
-        char lhs[256];
-
-        /* remove leading whitespace */
-        i = 0;
-        text = line;
-        while (isblank(*text) && (i < len)) { 
-            text++;
-            i++;
-        } 
-
-#if 0
-        if (*text == '{') {
-            printf("{");
-        } else if (*text == '}') {
-            printf("}");
-        }
-#endif
-
-        if (sscanf(text, "%[\"a-zA-Z_{}]", lhs) > 0) {
-            printf("lhs: %s\n", lhs);
-            if (strncmp(lhs, "flow", 5) == 0) {
-	              printf("found flow\n");
-            }
-        }
-
-#else 
-
-        if (type == addresses) {
-            if (mode == mode_anonymize) {
-	              anon_addresses(line);
-            } else {
-	              /* mode == check */
-	              check_anon_addresses(line);
-            }
-        } else if (type == strings) {
-            struct matches matches;
-
-            if (mode == mode_anonymize) {
-	              str_match_ctx_find_all_longest(usernames_ctx, (unsigned char *)line, strlen(line), &matches);      	
-	              anon_print_string(stdout, &matches, line, email_special_chars, anon_string);
-      
-            } else if (mode == mode_check) {
-	              str_match_ctx_find_all_longest(usernames_ctx, (unsigned char *)line, strlen(line), &matches);      
-	              if (matches.count > 0) {
-	                  printf("username match(es) at line %u:\n", linenum);
-	                  matches_print(&matches, line);
-	              }
-
-            } else if (mode == mode_deanonymize) {
-	              str_match_ctx_find_all_longest(usernames_ctx, (unsigned char *)line, strlen(line), &matches);      
-	              anon_print_string(stdout, &matches, line, email_special_chars, deanon_string);	
-
-            }
-        }
-#endif    
-
-        linenum++;
+    memset(&pl, 0, sizeof(pl));
+    if (pipeline_start(&pl, (unsigned int)num_threads) != 0) {
+        fprintf(stderr, "error: could not start %ld threads\n", num_threads);
+        pipeline_stop(&pl);
+        return EXIT_FAILURE;
+    }
+    rc = anon_file(&pl, datafile, output);
+    pipeline_stop(&pl);
 
+    if (fflush(output) != 0 || (output != stdout && fclose(output) != 0)) {
+        fprintf(stderr, "error: could not write output\n");
+        rc = -1;
     }
-      
-    free(line);
- 
-    return 0;
+    return rc ? EXIT_FAILURE : 0;
 }
-
@@ -64,6 +64,10 @@
 
 
 
+/* the tool is single threaded, so one cache and output buffer suffice */
+static anon_addr_cache_t anon_cache;
+static char anon_hex[ANON_HEXSTRING_LEN];
+
 static char *addr_string_anonymize (char *addr_string) {
     struct in_addr addr;
     int l;
@@ -80,7 +84,7 @@ static char *addr_string_anonymize (char *addr_string) {
 #endif
         return NULL;
     }
-    return addr_get_anon_hexstring(&addr);
+    return addr_get_anon_hexstring(&addr, &anon_cache, anon_hex);
 }
 
 
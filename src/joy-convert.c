@@ -0,0 +1,302 @@
+/*
+ *      
+ * Copyright (c) 2016 Cisco Systems, Inc.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * 
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ * 
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file joy-convert.c
+ *
+ * \brief converts the CBOR output of joy (cbor_output=1) back into
+ *        JSON lines, exactly as joy would have written them
+ *
+ ** \verbatim
+  joy-convert [ <file> ... ]
+     <file> is CBOR output of joy, compressed as joy compresses it;
+     standard input is read when no file is given
+ \endverbatim
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "output.h"
+#include "cbor_output.h"
+
+#if defined(USE_ZSTD)
+#include <zstd.h>
+#elif defined(USE_BZIP2)
+#include <bzlib.h>
+#elif defined(USE_GZIP)
+#include <zlib.h>
+#endif
+
+/* size of the blocks read from the input */
+#define CONVERT_READ_SIZE (256 * 1024)
+
+/* an input file, decompressed as it is read */
+typedef struct input_ {
+#if defined(USE_ZSTD)
+    FILE *fp;
+    ZSTD_DCtx *dctx;
+    ZSTD_inBuffer in;
+    char *inbuf;
+#elif defined(USE_BZIP2)
+    BZFILE *bz;
+#elif defined(USE_GZIP)
+    gzFile gz;
+#else
+    FILE *fp;
+#endif
+} input_t;
+
+/* opens fname, or standard input if fname is NULL */
+static int input_open (input_t *in, const char *fname) {
+    memset(in, 0, sizeof(*in));
+#if defined(USE_ZSTD)
+    in->fp = fname ? fopen(fname, "rb") : stdin;
+    in->dctx = ZSTD_createDCtx();
+    in->inbuf = malloc(ZSTD_DStreamInSize());
+    if (in->fp == NULL || in->dctx == NULL || in->inbuf == NULL) {
+        return -1;
+    }
+    in->in.src = in->inbuf;
+#elif defined(USE_BZIP2)
+    in->bz = fname ? BZ2_bzopen(fname, "rb") : BZ2_bzdopen(fileno(stdin), "rb");
+    if (in->bz == NULL) {
+        return -1;
+    }
+#elif defined(USE_GZIP)
+    /* gzread() also reads files that are not compressed */
+    in->gz = fname ? gzopen(fname, "rb") : gzdopen(fileno(stdin), "rb");
+    if (in->gz == NULL) {
+        return -1;
+    }
+#else
+    in->fp = fname ? fopen(fname, "rb") : stdin;
+    if (in->fp == NULL) {
+        return -1;
+    }
+#endif
+    return 0;
+}
+
+/* reads up to len decompressed bytes; returns 0 at the end, -1 on error */
+static long input_read (input_t *in, char *buf, size_t len) {
+#if defined(USE_ZSTD)
+    ZSTD_outBuffer out = { buf, len, 0 };
+    size_t rc;
+
+    while (out.pos == 0) {
+        if (in->in.pos == in->in.size) {
+            in->in.size = fread(in->inbuf, 1, ZSTD_DStreamInSize(), in->fp);
+            in->in.pos = 0;
+            if (in->in.size == 0) {
+                return ferror(in->fp) ? -1 : 0;
+            }
+        }
+        rc = ZSTD_decompressStream(in->dctx, &out, &in->in);
+        if (ZSTD_isError(rc)) {
+            fprintf(stderr, "error: %s\n", ZSTD_getErrorName(rc));
+            return -1;
+        }
+    }
+    return (long)out.pos;
+#elif defined(USE_BZIP2)
+    return BZ2_bzread(in->bz, buf, (int)len);
+#elif defined(USE_GZIP)
+    return gzread(in->gz, buf, (unsigned int)len);
+#else
+    size_t n = fread(buf, 1, len, in->fp);
+
+    return (n == 0 && ferror(in->fp)) ? -1 : (long)n;
+#endif
+}
+
+static void input_close (input_t *in) {
+#if defined(USE_ZSTD)
+    if (in->fp != NULL && in->fp != stdin) {
+        fclose(in->fp);
+    }
+    ZSTD_freeDCtx(in->dctx);
+    free(in->inbuf);
+#elif defined(USE_BZIP2)
+    BZ2_bzclose(in->bz);
+#elif defined(USE_GZIP)
+    gzclose(in->gz);
+#else
+    if (in->fp != stdin) {
+        fclose(in->fp);
+    }
+#endif
+}
+
+/**
+ * \brief Convert every record of one input to JSON lines.
+ *
+ * \param fname name of the input, or NULL for standard input
+ * \param out where the JSON goes
+ * \param json scratch output, that each record is rendered into
+ *
+ * \return the number of records that could not be converted, or -1 if
+ *         the input could not be read to its end
+ */
+static long convert (const char *fname, zfile out, zfile json) {
+    const char *name = fname ? fname : "standard input";
+    char *buf, *tmp;
+    size_t size = 2 * CONVERT_READ_SIZE, len = 0, off;
+    unsigned long offset = 0;
+    const char *line;
+    size_t line_len;
+    long n, num_fails = 0;
+    int eof = 0;
+    input_t in;
+
+    if (input_open(&in, fname) != 0) {
+        fprintf(stderr, "error: could not open %s\n", name);
+        return -1;
+    }
+    buf = malloc(size);
+    if (buf == NULL) {
+        input_close(&in);
+        return -1;
+    }
+
+    while (!eof) {
+        /* make room for another block; records can be larger than one */
+        if (size - len < CONVERT_READ_SIZE) {
+            tmp = realloc(buf, size * 2);
+            if (tmp == NULL) {
+                num_fails = -1;
+                break;
+            }
+            buf = tmp;
+            size *= 2;
+        }
+        n = input_read(&in, buf + len, CONVERT_READ_SIZE);
+        if (n < 0) {
+            fprintf(stderr, "error: could not read %s\n", name);
+            num_fails = -1;
+            break;
+        }
+        eof = (n == 0);
+        len += n;
+
+        /* convert every complete record */
+        off = 0;
+        while (off < len) {
+            n = cbor_item_size(buf + off, len - off);
+            if (n == 0) {
+                break;
+            }
+            if (n < 0) {
+                fprintf(stderr, "error: %s is not CBOR at offset %lu\n", name, offset + off);
+                eof = 1;
+                num_fails = -1;
+                break;
+            }
+            zmemory_clear(json);
+            if (cbor_to_json(buf + off, n, json) == 0) {
+                line = zmemory(json, &line_len);
+                zwrite(out, line, line_len);
+            } else {
+                fprintf(stderr, "warning: could not convert record at offset %lu of %s\n",
+                        offset + off, name);
+                num_fails++;
+            }
+            off += n;
+        }
+        memmove(buf, buf + off, len - off);
+        len -= off;
+        offset += off;
+    }
+    if (num_fails >= 0 && len) {
+        fprintf(stderr, "error: %s ends in the middle of a record\n", name);
+        num_fails = -1;
+    }
+
+    free(buf);
+    input_close(&in);
+    return num_fails;
+}
+
+static int usage (char *name) {
+    fprintf(stderr, "usage:\n%s [ <file> ... ]\n", name);
+    fprintf(stderr, "where:\n"
+                "   <file> contains the CBOR output of joy (cbor_output=1), which is\n"
+                "   written to standard output as JSON lines; standard input is\n"
+                "   converted if no file is given\n\n");
+    return 1;
+}
+
+/**
+ \fn int main (int argc, char *argv[])
+ \brief main entry point for joy-convert
+ \param argc command line argument count
+ \param argv command line arguments
+ \return 1 usage
+ \return EXIT_FAILURE some records could not be converted
+ \return 0 success
+ */
+int main (int argc, char *argv[]) {
+    zfile out, json;
+    int i, rc = 0;
+    long num_fails;
+
+    if (argc > 1 && argv[1][0] == '-' && argv[1][1] != '\0') {
+        return usage(argv[0]);
+    }
+
+    out = zattach(stdout, "w");
+    json = zopen_memory();
+    if (out == NULL || json == NULL) {
+        fprintf(stderr, "error: could not allocate output\n");
+        return EXIT_FAILURE;
+    }
+
+    i = 1;
+    do {
+        const char *fname = NULL;
+
+        if (i < argc && strcmp(argv[i], "-") != 0) {
+            fname = argv[i];
+        }
+        num_fails = convert(fname, out, json);
+        if (num_fails != 0) {
+            rc = EXIT_FAILURE;
+        }
+    } while (++i < argc);
+
+    zclose(json);
+    zclose(out);
+    return rc;
+}
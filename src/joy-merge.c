@@ -0,0 +1,698 @@
+/*
+ *
+ * Copyright (c) 2018 Cisco Systems, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ *
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file joy-merge.c
+ *
+ * \brief merges several outputs of joy into one, in order of
+ *        time_start, optionally joining the parts of each flow
+ *
+ ** \verbatim
+  joy-merge [ --lag <seconds> ] [ --stitch ] [ --memory <MB> ]
+            [ -j <threads> ] [ -o <outfile> ] <file> ...
+     <file> is JSON or CBOR output of joy, compressed as joy compresses it,
+     such as the output of each context, or each file that one output
+     was rotated into
+ \endverbatim
+ *
+ * The files are read at the same pace, record by record, by the merge
+ * of merge.c, which runs on the main thread.  Each file is
+ * decompressed, and turned from CBOR into JSON, ahead of the merge by
+ * a pool of threads, a chunk at a time: every file has two chunks, one
+ * that the merge takes records from and one that the pool fills
+ * meanwhile, so that at most two chunks of each file are in memory,
+ * however long the files are.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "output.h"
+#include "cbor_output.h"
+#include "merge.h"
+
+/* bytes of JSON in a chunk, which grows to hold longer records */
+#define MERGE_CHUNK_SIZE (512 * 1024)
+
+/* bytes read at once after the last record of a chunk */
+#define MERGE_READ_SIZE (128 * 1024)
+
+/* largest number of threads */
+#define MERGE_MAX_THREADS 64
+
+/* seconds that a file may be out of time order by, unless --lag is given */
+#define MERGE_DEFAULT_LAG 60.0
+
+/* megabytes of records held for reordering, unless --memory is given */
+#define MERGE_DEFAULT_MEMORY 512
+
+/* whole records of a file, as JSON lines */
+typedef struct chunk_ {
+    int full;                     /* filled, and not given back by the merge yet */
+    char *data;
+    size_t len;
+    size_t size;
+} chunk_t;
+
+/* an input file, decompressed as it is read */
+typedef struct input_ {
+    zreader r;
+    const char *name;
+    int eof;
+    int failed;                   /* an error was reported, and nothing more is read */
+    char *carry;                  /* read after the last record of a chunk */
+    size_t carry_len;
+    size_t carry_size;
+} input_t;
+
+struct pool_;
+
+/* one of the files that are merged */
+typedef struct source_ {
+    struct pool_ *pool;
+    const char *fname;            /* NULL for standard input */
+    input_t in;
+    int opened;
+    int started;                  /* the format is known */
+    int cbor;
+    chunk_t chunks[2];
+    unsigned int next_fill;       /* chunk that the pool fills next */
+    int queued;                   /* queued for, or being filled by, the pool */
+    unsigned int cur;             /* chunk that the merge takes records from */
+    int reading;                  /* the merge has taken chunk cur */
+    size_t pos;                   /* next record in chunk cur */
+} source_t;
+
+/* a thread of the pool */
+typedef struct worker_ {
+    pthread_t thread;
+    struct pool_ *pool;
+    zfile json;                   /* a CBOR record, turned into JSON */
+} worker_t;
+
+typedef struct pool_ {
+    unsigned int num_workers;
+    unsigned int num_started;     /* workers whose thread is running */
+    worker_t *workers;
+    source_t **queue;             /* sources waiting for the pool */
+    unsigned int queue_size;
+    unsigned int queue_head;
+    unsigned int queue_len;
+    int stop;
+    pthread_mutex_t lock;
+    pthread_cond_t work;          /* a source was queued */
+    pthread_cond_t done;          /* a chunk was filled */
+} pool_t;
+
+/*
+ * -------------------------------------------------------
+ * Input
+ * -------------------------------------------------------
+ */
+
+/* opens fname, or standard input if fname is NULL */
+static int input_open (input_t *in, const char *fname) {
+    memset(in, 0, sizeof(*in));
+    in->r = zreader_open(fname);
+    if (in->r == NULL) {
+        return -1;
+    }
+    in->name = zreader_name(in->r);
+    return 0;
+}
+
+static void input_close (input_t *in) {
+    zreader_close(in->r);
+    in->r = NULL;
+    free(in->carry);
+}
+
+
+/* makes room for len more bytes in c */
+static int chunk_reserve (chunk_t *c, size_t len) {
+    char *data;
+    size_t size;
+
+    if (c->size - c->len >= len) {
+        return 0;
+    }
+    size = c->size ? 2 * c->size : MERGE_CHUNK_SIZE + MERGE_CHUNK_SIZE / 4;
+    while (size - c->len < len) {
+        size *= 2;
+    }
+    data = realloc(c->data, size);
+    if (data == NULL) {
+        return -1;
+    }
+    c->data = data;
+    c->size = size;
+    return 0;
+}
+
+/* makes room for len more bytes after what was read but not used yet */
+static int carry_reserve (input_t *in, size_t len) {
+    char *carry;
+    size_t size;
+
+    if (in->carry_size - in->carry_len >= len) {
+        return 0;
+    }
+    size = in->carry_len + len;
+    carry = realloc(in->carry, size);
+    if (carry == NULL) {
+        return -1;
+    }
+    in->carry = carry;
+    in->carry_size = size;
+    return 0;
+}
+
+/* reads more of the file after what is not used yet; returns how much, or -1 */
+static long carry_read (input_t *in) {
+    long n;
+
+    if (carry_reserve(in, MERGE_READ_SIZE) != 0) {
+        fprintf(stderr, "error: %s could not be read: out of memory\n", in->name);
+        in->failed = 1;
+        return -1;
+    }
+    n = zread(in->r, in->carry + in->carry_len, in->carry_size - in->carry_len);
+    if (n < 0) {
+        in->failed = 1;
+        return -1;
+    }
+    if (n == 0) {
+        in->eof = 1;
+    }
+    in->carry_len += n;
+    return n;
+}
+
+/* fills c with the next whole lines of JSON */
+static void fill_json (input_t *in, chunk_t *c) {
+    char *last;
+    long n;
+
+    if (chunk_reserve(c, in->carry_len + MERGE_CHUNK_SIZE) != 0) {
+        fprintf(stderr, "error: %s could not be read: out of memory\n", in->name);
+        in->failed = 1;
+        return;
+    }
+    memcpy(c->data, in->carry, in->carry_len);
+    c->len = in->carry_len;
+    in->carry_len = 0;
+
+    for (;;) {
+        while (c->len < c->size && !in->eof) {
+            n = zread(in->r, c->data + c->len, c->size - c->len);
+            if (n < 0) {
+                /* the whole lines read before the error are still merged */
+                in->failed = 1;
+                n = 0;
+            }
+            if (n == 0) {
+                in->eof = 1;
+            }
+            c->len += n;
+        }
+        for (last = c->data + c->len; last > c->data && last[-1] != '\n'; last--) {
+            ;
+        }
+        if (last > c->data || in->eof) {
+            break;
+        }
+
+        /* a line longer than the chunk */
+        if (chunk_reserve(c, c->size) != 0) {
+            fprintf(stderr, "error: %s could not be read: out of memory\n", in->name);
+            in->failed = 1;
+            c->len = 0;
+            return;
+        }
+    }
+
+    if (in->eof && !in->failed) {
+        /* the last line may not end in a newline */
+        return;
+    }
+    if (in->failed) {
+        c->len = last - c->data;
+        return;
+    }
+
+    /* the rest starts the next chunk */
+    if (carry_reserve(in, c->data + c->len - last) != 0) {
+        fprintf(stderr, "error: %s could not be read: out of memory\n", in->name);
+        in->failed = 1;
+    } else {
+        in->carry_len = c->data + c->len - last;
+        memcpy(in->carry, last, in->carry_len);
+    }
+    c->len = last - c->data;
+}
+
+/* fills c with the next records of CBOR, turned into lines of JSON */
+static void fill_cbor (worker_t *w, input_t *in, chunk_t *c) {
+    const char *json;
+    size_t json_len, off = 0;
+    long n;
+
+    c->len = 0;
+    while (c->len < MERGE_CHUNK_SIZE) {
+        n = cbor_item_size(in->carry + off, in->carry_len - off);
+        if (n > 0) {
+            zmemory_clear(w->json);
+            if (cbor_to_json(in->carry + off, n, w->json) != 0) {
+                fprintf(stderr, "error: %s is not valid CBOR\n", in->name);
+                in->failed = 1;
+                break;
+            }
+            json = zmemory(w->json, &json_len);
+            if (chunk_reserve(c, json_len) != 0) {
+                fprintf(stderr, "error: %s could not be read: out of memory\n", in->name);
+                in->failed = 1;
+                break;
+            }
+            memcpy(c->data + c->len, json, json_len);
+            c->len += json_len;
+            off += n;
+            continue;
+        }
+        if (n < 0) {
+            fprintf(stderr, "error: %s is not valid CBOR\n", in->name);
+            in->failed = 1;
+            break;
+        }
+
+        /* the next record is not all read yet */
+        if (in->eof) {
+            if (off < in->carry_len) {
+                fprintf(stderr, "error: %s ends in the middle of a record\n", in->name);
+                in->failed = 1;
+            }
+            break;
+        }
+        memmove(in->carry, in->carry + off, in->carry_len - off);
+        in->carry_len -= off;
+        off = 0;
+        if (carry_read(in) < 0) {
+            break;
+        }
+    }
+    memmove(in->carry, in->carry + off, in->carry_len - off);
+    in->carry_len -= off;
+}
+
+/* fills c with the next records of s, as lines of JSON; none at the end */
+static void source_fill (worker_t *w, source_t *s, chunk_t *c) {
+    input_t *in = &s->in;
+    const unsigned char *b;
+
+    c->len = 0;
+    if (!s->opened) {
+        if (s->started) {
+            return;
+        }
+        s->opened = 1;
+        if (input_open(in, s->fname) != 0) {
+            in->failed = 1;
+        }
+    }
+
+    if (!s->started && !in->failed) {
+        /* enough of the file to tell the format */
+        while (in->carry_len < 4 && !in->eof && carry_read(in) >= 0) {
+            ;
+        }
+        b = (const unsigned char *)in->carry;
+        if (in->carry_len >= 4 && b[0] == 0xff && b[1] == 0xff && b[2] == 0xff && b[3] == 0xff) {
+            fprintf(stderr, "error: %s is Arrow output, which joy-merge does not read\n", in->name);
+            in->failed = 1;
+        }
+        s->cbor = (in->carry_len >= 3 && b[0] == 0xd9 && b[1] == 0xd9 && b[2] == 0xf7);
+    }
+    s->started = 1;
+
+    if (!in->failed && !(in->eof && in->carry_len == 0)) {
+        if (s->cbor) {
+            fill_cbor(w, in, c);
+        } else {
+            fill_json(in, c);
+        }
+    }
+
+    /* the file is closed as soon as it is all read */
+    if (in->failed || (in->eof && in->carry_len == 0)) {
+        input_close(in);
+        in->carry = NULL;
+        in->carry_len = in->carry_size = 0;
+        s->opened = 0;
+    }
+}
+
+/*
+ * -------------------------------------------------------
+ * The pool of threads
+ * -------------------------------------------------------
+ */
+
+/* queues s for the pool, unless it is already; the lock is held */
+static void enqueue (pool_t *p, source_t *s) {
+    if (s->queued) {
+        return;
+    }
+    s->queued = 1;
+    p->queue[(p->queue_head + p->queue_len) % p->queue_size] = s;
+    p->queue_len++;
+    pthread_cond_signal(&p->work);
+}
+
+/* fills the chunks of queued sources, as long as the merge has given them back */
+static void *worker_main (void *arg) {
+    worker_t *w = arg;
+    pool_t *p = w->pool;
+    source_t *s;
+    chunk_t *c;
+
+    pthread_mutex_lock(&p->lock);
+    for (;;) {
+        while (p->queue_len == 0 && !p->stop) {
+            pthread_cond_wait(&p->work, &p->lock);
+        }
+        if (p->stop) {
+            break;
+        }
+        s = p->queue[p->queue_head];
+        p->queue_head = (p->queue_head + 1) % p->queue_size;
+        p->queue_len--;
+
+        for (;;) {
+            c = &s->chunks[s->next_fill];
+            if (c->full || p->stop) {
+                s->queued = 0;
+                break;
+            }
+            pthread_mutex_unlock(&p->lock);
+            source_fill(w, s, c);
+            pthread_mutex_lock(&p->lock);
+            c->full = 1;
+            s->next_fill ^= 1;
+            pthread_cond_broadcast(&p->done);
+        }
+    }
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+static int pool_start (pool_t *p, unsigned int num_workers, unsigned int num_sources) {
+    unsigned int i;
+
+    p->num_workers = num_workers;
+    p->queue_size = num_sources;
+    p->queue = calloc(num_sources, sizeof(source_t *));
+    p->workers = calloc(num_workers, sizeof(worker_t));
+    if (p->queue == NULL || p->workers == NULL) {
+        return -1;
+    }
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->work, NULL);
+    pthread_cond_init(&p->done, NULL);
+    for (i = 0; i < num_workers; i++) {
+        worker_t *w = &p->workers[i];
+
+        w->pool = p;
+        w->json = zopen_memory();
+        if (w->json == NULL || pthread_create(&w->thread, NULL, worker_main, w) != 0) {
+            return -1;
+        }
+        p->num_started++;
+    }
+    return 0;
+}
+
+static void pool_stop (pool_t *p) {
+    unsigned int i;
+
+    if (p->workers != NULL) {
+        pthread_mutex_lock(&p->lock);
+        p->stop = 1;
+        pthread_cond_broadcast(&p->work);
+        pthread_mutex_unlock(&p->lock);
+        for (i = 0; i < p->num_started; i++) {
+            pthread_join(p->workers[i].thread, NULL);
+        }
+        for (i = 0; i < p->num_workers; i++) {
+            if (p->workers[i].json != NULL) {
+                zclose(p->workers[i].json);
+            }
+        }
+    }
+    free(p->workers);
+    free(p->queue);
+}
+
+/*
+ * -------------------------------------------------------
+ * The merge
+ * -------------------------------------------------------
+ */
+
+/* gives the merge the next record of a source, from the chunks the pool fills */
+static int source_read (void *arg, const char **rec, size_t *len) {
+    source_t *s = arg;
+    pool_t *p = s->pool;
+    chunk_t *c;
+    const char *nl;
+
+    for (;;) {
+        c = &s->chunks[s->cur];
+        if (s->reading && s->pos < c->len) {
+            *rec = c->data + s->pos;
+            nl = memchr(*rec, '\n', c->len - s->pos);
+            *len = nl ? (size_t)(nl - *rec) : c->len - s->pos;
+            s->pos += *len + 1;
+            return 1;
+        }
+
+        /* give the chunk back to be filled again, and take the other one */
+        pthread_mutex_lock(&p->lock);
+        if (s->reading) {
+            c->full = 0;
+            s->cur ^= 1;
+            enqueue(p, s);
+        }
+        s->reading = 1;
+        s->pos = 0;
+        c = &s->chunks[s->cur];
+        while (!c->full) {
+            pthread_cond_wait(&p->done, &p->lock);
+        }
+        pthread_mutex_unlock(&p->lock);
+
+        if (c->len == 0) {
+            return s->in.failed ? -1 : 0;
+        }
+    }
+}
+
+static int write_record (void *arg, const char *rec, size_t len) {
+    FILE *out = arg;
+
+    if (fwrite(rec, 1, len, out) != len || putc('\n', out) == EOF) {
+        return -1;
+    }
+    return 0;
+}
+
+static int usage (char *name) {
+    fprintf(stderr, "usage:\n%s [ --lag <seconds> ] [ --stitch ] [ --memory <MB> ] "
+            "[ -j <threads> ] [ -o <outfile> ] <file> ...\n", name);
+    fprintf(stderr, "where:\n"
+                "   <file> contains JSON or CBOR output of joy, such as that of one\n"
+                "   context, or one file that an output was rotated into; \"-\" is\n"
+                "   standard input.  The records of all the files are written as JSON\n"
+                "   lines, in order of time_start\n"
+                "   --lag <seconds> is how far out of time order a file may be, which\n"
+                "     is about the longest timeout of its flows; it is %g by default,\n"
+                "     and 0 interleaves the files without reordering them\n"
+                "   --stitch joins the parts of each flow, which were written separately\n"
+                "     because of the active timeout or by different contexts, as sleuth\n"
+                "     does; parts are joined when one starts within <seconds> of the\n"
+                "     end of the other\n"
+                "   --memory <MB> is how much memory the records held for reordering\n"
+                "     may take, beyond which they are written early; %d by default\n"
+                "   -j <threads> is the number of threads that decompress the files;\n"
+                "     it is the number of CPUs by default\n"
+                "   -o <outfile> is where the output goes, instead of standard output\n\n",
+            MERGE_DEFAULT_LAG, MERGE_DEFAULT_MEMORY);
+    return 1;
+}
+
+/**
+ \fn int main (int argc, char *argv[])
+ \brief main entry point for joy-merge
+ \param argc command line argument count
+ \param argv command line arguments
+ \return 1 usage
+ \return EXIT_FAILURE a file could not be read, or the output written
+ \return 0 success
+ */
+int main (int argc, char *argv[]) {
+    double lag = MERGE_DEFAULT_LAG;
+    long memory = MERGE_DEFAULT_MEMORY;
+    long num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    const char *outfile = NULL;
+    FILE *output = stdout;
+    unsigned int num_sources, j;
+    source_t *sources;
+    merge_stats_t stats;
+    merge_t *m;
+    pool_t pool;
+    char *end;
+    int i, stitch = 0, rc = 0;
+
+    for (i = 1; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; i++) {
+        if (strcmp(argv[i], "--stitch") == 0) {
+            stitch = 1;
+        } else if (i + 1 == argc) {
+            return usage(argv[0]);
+        } else if (strcmp(argv[i], "--lag") == 0) {
+            lag = strtod(argv[++i], &end);
+            if (*end != '\0' || lag < 0) {
+                return usage(argv[0]);
+            }
+        } else if (strcmp(argv[i], "--memory") == 0) {
+            memory = atol(argv[++i]);
+            if (memory < 1) {
+                return usage(argv[0]);
+            }
+        } else if (strcmp(argv[i], "-j") == 0) {
+            num_threads = atol(argv[++i]);
+            if (num_threads < 1) {
+                return usage(argv[0]);
+            }
+        } else if (strcmp(argv[i], "-o") == 0) {
+            outfile = argv[++i];
+        } else {
+            return usage(argv[0]);
+        }
+    }
+    if (i == argc) {
+        return usage(argv[0]);
+    }
+    if (num_threads < 1) {
+        num_threads = 1;
+    }
+    if (num_threads > MERGE_MAX_THREADS) {
+        num_threads = MERGE_MAX_THREADS;
+    }
+    num_sources = argc - i;
+
+    if (outfile) {
+        output = fopen(outfile, "wb");
+        if (output == NULL) {
+            fprintf(stderr, "error: could not write to file %s\n", outfile);
+            return EXIT_FAILURE;
+        }
+    }
+    setvbuf(output, NULL, _IOFBF, 1024 * 1024);
+
+    sources = calloc(num_sources, sizeof(source_t));
+    m = merge_new(lag, (size_t)memory * 1024 * 1024, stitch);
+    memset(&pool, 0, sizeof(pool));
+    if (sources == NULL || m == NULL) {
+        fprintf(stderr, "error: out of memory\n");
+        return EXIT_FAILURE;
+    }
+    if (pool_start(&pool, (unsigned int)num_threads, num_sources) != 0) {
+        fprintf(stderr, "error: could not start %ld threads\n", num_threads);
+        pool_stop(&pool);
+        return EXIT_FAILURE;
+    }
+
+    /* every file is read ahead from the start */
+    pthread_mutex_lock(&pool.lock);
+    for (j = 0; j < num_sources; j++) {
+        source_t *s = &sources[j];
+
+        s->pool = &pool;
+        if (strcmp(argv[i + j], "-") != 0) {
+            s->fname = argv[i + j];
+        }
+        s->in.name = s->fname ? s->fname : "standard input";
+        enqueue(&pool, s);
+        if (merge_add_source(m, source_read, s) != 0) {
+            fprintf(stderr, "error: out of memory\n");
+            rc = EXIT_FAILURE;
+        }
+    }
+    pthread_mutex_unlock(&pool.lock);
+
+    if (rc == 0 && merge_run(m, write_record, output) != 0) {
+        merge_get_stats(m, &stats);
+        if (stats.failed_sources == 0 && !ferror(output)) {
+            /* the files that could not be read were reported as they were */
+            fprintf(stderr, "error: out of memory\n");
+        }
+        rc = EXIT_FAILURE;
+    }
+    if (fflush(output) != 0 || ferror(output)) {
+        fprintf(stderr, "error: could not write the output\n");
+        rc = EXIT_FAILURE;
+    }
+    merge_get_stats(m, &stats);
+    if (stats.late) {
+        fprintf(stderr, "warning: %lu of %lu records were written after records that start later; "
+                "a larger --lag or --memory keeps them in order\n",
+                stats.late, stats.records_out);
+    }
+
+    pool_stop(&pool);
+    merge_free(m);
+    for (j = 0; j < num_sources; j++) {
+        if (sources[j].opened) {
+            input_close(&sources[j].in);
+        }
+        free(sources[j].chunks[0].data);
+        free(sources[j].chunks[1].data);
+    }
+    free(sources);
+    if (output != stdout) {
+        fclose(output);
+    }
+    return rc;
+}
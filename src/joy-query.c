@@ -0,0 +1,1037 @@
+/*
+ *
+ * Copyright (c) 2018 Cisco Systems, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ *
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file joy-query.c
+ *
+ * \brief filters and selects records of joy output, with the --where,
+ *        --select and --groupby expressions of sleuth, on all CPUs
+ *
+ ** \verbatim
+  joy-query [ --where <expr> ] [ --select <fields> ] [ --groupby <fields> ]
+            [ --dist ] [ -j <threads> ] [ <file> ... ]
+     <file> is JSON or CBOR output of joy, compressed as joy compresses it;
+     standard input is read when no file is given
+ \endverbatim
+ *
+ * The Arrow output of joy (arrow_output=1) is not read: it is meant for
+ * pyarrow and the like, and joy-query only reports it, compressed or
+ * not, as an input that it cannot read.
+ *
+ * The input is cut into chunks of a few megabytes, that a pool of
+ * threads filters and selects from; the main thread only reads the
+ * input, splits it between records, and writes the output of each
+ * chunk in turn, so that the output is in the order of the input.
+ *
+ * Output written in compressed blocks by joy (compress_threads) is
+ * decompressed by the pool too: zstd frames carry their size, and so
+ * do the gzip members that joy writes, in an extra field of their
+ * header, as BGZF does.  Other compressed input is decompressed by the
+ * main thread as it is read.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "output.h"
+#include "cbor_output.h"
+#include "query.h"
+
+#if defined(USE_ZSTD)
+#include <zstd.h>
+#elif defined(USE_GZIP)
+#include <zlib.h>
+#endif
+
+/* decompressed bytes in a chunk */
+#define QUERY_CHUNK_SIZE (4 * 1024 * 1024)
+
+/* largest number of threads */
+#define QUERY_MAX_THREADS 64
+
+/* what is done to a chunk next */
+typedef enum chunk_task_e_ {
+    chunk_decompress,             /* raw holds whole compressed blocks */
+    chunk_scan                    /* data holds text, cut between records */
+} chunk_task_e;
+
+/* a piece of the input, on its way through the pool */
+typedef struct chunk_ {
+    chunk_task_e task;
+    int busy;                     /* queued for, or being worked on by, the pool */
+    int failed;                   /* could not be decompressed */
+    char *raw;                    /* compressed blocks */
+    size_t raw_len;
+    size_t raw_size;
+    char *data;                   /* decompressed input */
+    size_t len;
+    size_t size;
+    size_t expected;              /* size of raw, decompressed */
+    query_buf_t head;             /* the record that started in earlier chunks */
+    size_t start;                 /* whole records in data */
+    size_t end;
+    query_buf_t out;              /* output, or entries to aggregate */
+    unsigned long records;
+    unsigned long malformed;
+} chunk_t;
+
+struct pipeline_;
+
+/* a thread of the pool */
+typedef struct worker_ {
+    pthread_t thread;
+    struct pipeline_ *pl;
+    zfile json;                   /* CBOR records are converted into */
+    query_buf_t text;
+    query_buf_t group;
+#if defined(USE_ZSTD)
+    ZSTD_DCtx *dctx;
+#elif defined(USE_GZIP)
+    z_stream zs;
+    int zs_ready;
+#endif
+} worker_t;
+
+/* an input file */
+typedef struct input_ {
+    zreader r;
+    const char *name;
+    int blocks;                   /* compressed blocks are decompressed by the pool */
+    int failed;                   /* an error was reported, and nothing more is read */
+} input_t;
+
+/* records that --dist or --groupby gather */
+typedef struct agg_entry_ {
+    uint64_t hash;
+    size_t off;                   /* text, in the arena */
+    size_t len;
+    unsigned int group;
+    unsigned long count;
+} agg_entry_t;
+
+typedef struct agg_table_ {
+    agg_entry_t *entries;
+    size_t num;
+    size_t size;
+    uint32_t *slots;              /* index of an entry plus one, or 0 */
+    size_t num_slots;
+} agg_table_t;
+
+typedef struct pipeline_ {
+    query_t *q;
+    int dist;
+    int aggregate;                /* output is gathered, and written at the end */
+    int cbor;                     /* the current file is CBOR */
+    unsigned int num_workers;
+    worker_t *workers;
+    unsigned int window;          /* number of chunks */
+    chunk_t *chunks;
+    chunk_t **queue;              /* chunks waiting for the pool */
+    unsigned int queue_head;
+    unsigned int queue_len;
+    int stop;
+    pthread_mutex_t lock;
+    pthread_cond_t work;          /* a chunk was queued */
+    pthread_cond_t done;          /* a chunk is no longer busy */
+    query_buf_t arena;            /* text of the aggregated records */
+    agg_table_t groups;
+    agg_table_t records;
+    unsigned long num_records;
+    unsigned long num_malformed;
+} pipeline_t;
+
+/*
+ * -------------------------------------------------------
+ * Aggregation
+ * -------------------------------------------------------
+ */
+
+static uint64_t agg_hash (unsigned int group, const char *s, size_t len) {
+    uint64_t h = 14695981039346656037ULL ^ group;
+
+    while (len--) {
+        h = (h ^ (unsigned char)*s++) * 1099511628211ULL;
+    }
+    return h;
+}
+
+static int agg_grow (agg_table_t *t) {
+    size_t num_slots = t->num_slots ? t->num_slots * 2 : 1024, i, j;
+    uint32_t *slots = calloc(num_slots, sizeof(uint32_t));
+
+    if (slots == NULL) {
+        return -1;
+    }
+    for (i = 0; i < t->num; i++) {
+        for (j = t->entries[i].hash & (num_slots - 1); slots[j]; j = (j + 1) & (num_slots - 1)) {
+            ;
+        }
+        slots[j] = (uint32_t)(i + 1);
+    }
+    free(t->slots);
+    t->slots = slots;
+    t->num_slots = num_slots;
+    return 0;
+}
+
+/* appends an entry; its text is appended to the arena */
+static agg_entry_t *agg_push (agg_table_t *t, query_buf_t *arena, unsigned int group,
+                              const char *s, size_t len) {
+    agg_entry_t *e;
+
+    if (t->num == t->size) {
+        size_t size = t->size ? t->size * 2 : 1024;
+
+        e = realloc(t->entries, size * sizeof(agg_entry_t));
+        if (e == NULL) {
+            return NULL;
+        }
+        t->entries = e;
+        t->size = size;
+    }
+    e = &t->entries[t->num];
+    e->off = arena->len;
+    e->len = len;
+    e->group = group;
+    e->count = 0;
+    if (query_buf_append(arena, s, len) != 0) {
+        return NULL;
+    }
+    t->num++;
+    return e;
+}
+
+/* the entry for (group, s), added if it is new */
+static agg_entry_t *agg_find (agg_table_t *t, query_buf_t *arena, unsigned int group,
+                              const char *s, size_t len) {
+    uint64_t h = agg_hash(group, s, len);
+    agg_entry_t *e;
+    size_t i;
+
+    if (4 * (t->num + 1) > 3 * t->num_slots && agg_grow(t) != 0) {
+        return NULL;
+    }
+    for (i = h & (t->num_slots - 1); t->slots[i]; i = (i + 1) & (t->num_slots - 1)) {
+        e = &t->entries[t->slots[i] - 1];
+        if (e->hash == h && e->group == group && e->len == len &&
+            memcmp(arena->data + e->off, s, len) == 0) {
+            return e;
+        }
+    }
+    e = agg_push(t, arena, group, s, len);
+    if (e != NULL) {
+        e->hash = h;
+        t->slots[i] = (uint32_t)t->num;
+    }
+    return e;
+}
+
+static void agg_free (agg_table_t *t) {
+    free(t->entries);
+    free(t->slots);
+    memset(t, 0, sizeof(*t));
+}
+
+/* gathers the entries that a chunk put out */
+static int agg_add (pipeline_t *pl, const query_buf_t *out) {
+    const char *p = out->data, *end = out->data + out->len, *key, *text;
+    uint32_t key_len, text_len;
+    agg_entry_t *g, *e;
+
+    while (p < end) {
+        memcpy(&key_len, p, sizeof(key_len));
+        key = p + sizeof(key_len);
+        memcpy(&text_len, key + key_len, sizeof(text_len));
+        text = key + key_len + sizeof(text_len);
+        p = text + text_len;
+
+        g = agg_find(&pl->groups, &pl->arena, 0, key, key_len);
+        if (g == NULL) {
+            return -1;
+        }
+        g->count++;
+        if (pl->dist) {
+            e = agg_find(&pl->records, &pl->arena, (unsigned int)(g - pl->groups.entries),
+                         text, text_len);
+        } else {
+            e = agg_push(&pl->records, &pl->arena, (unsigned int)(g - pl->groups.entries),
+                         text, text_len);
+        }
+        if (e == NULL) {
+            return -1;
+        }
+        e->count++;
+    }
+    return 0;
+}
+
+static const agg_entry_t *agg_sort_entries;
+
+/* by group, then most frequent first, then in the order first seen */
+static int agg_compare (const void *a, const void *b) {
+    const agg_entry_t *x = &agg_sort_entries[*(const size_t *)a];
+    const agg_entry_t *y = &agg_sort_entries[*(const size_t *)b];
+
+    if (x->group != y->group) {
+        return x->group < y->group ? -1 : 1;
+    }
+    if (x->count != y->count) {
+        return x->count > y->count ? -1 : 1;
+    }
+    return *(const size_t *)a < *(const size_t *)b ? -1 : 1;
+}
+
+/* writes what was gathered, group by group */
+static int agg_write (pipeline_t *pl, FILE *out) {
+    size_t *order, i;
+    const agg_entry_t *e;
+
+    if (pl->records.num == 0) {
+        return 0;
+    }
+    order = malloc(pl->records.num * sizeof(size_t));
+    if (order == NULL) {
+        return -1;
+    }
+    for (i = 0; i < pl->records.num; i++) {
+        order[i] = i;
+        if (!pl->dist) {
+            pl->records.entries[i].count = 0; /* only the order matters */
+        }
+    }
+    agg_sort_entries = pl->records.entries;
+    qsort(order, pl->records.num, sizeof(size_t), agg_compare);
+
+    for (i = 0; i < pl->records.num; i++) {
+        e = &pl->records.entries[order[i]];
+        if (pl->dist) {
+            fwrite(pl->arena.data + e->off, 1, e->len - 1, out);
+            fprintf(out, ",\"count\":%lu,\"total\":%lu}\n",
+                    e->count, pl->groups.entries[e->group].count);
+        } else {
+            fwrite(pl->arena.data + e->off, 1, e->len, out);
+            fputc('\n', out);
+        }
+    }
+    free(order);
+    return 0;
+}
+
+/*
+ * -------------------------------------------------------
+ * The pool
+ * -------------------------------------------------------
+ */
+
+/* runs the query on one record, and adds what it puts out to the chunk */
+static void scan_record (worker_t *w, chunk_t *c, const char *rec, size_t len) {
+    pipeline_t *pl = w->pl;
+    uint32_t n;
+    int rc;
+
+    if (len == 0 || (len == 1 && rec[0] == '\r')) {
+        return;
+    }
+    c->records++;
+    if (!pl->aggregate) {
+        rc = query_record(pl->q, rec, len, &c->out, NULL);
+        if (rc == query_matched) {
+            query_buf_append(&c->out, "\n", 1);
+        }
+    } else {
+        w->text.len = 0;
+        rc = query_record(pl->q, rec, len, &w->text, &w->group);
+        if (rc == query_matched) {
+            n = (uint32_t)w->group.len;
+            query_buf_append(&c->out, &n, sizeof(n));
+            query_buf_append(&c->out, w->group.data, w->group.len);
+            n = (uint32_t)w->text.len;
+            query_buf_append(&c->out, &n, sizeof(n));
+            query_buf_append(&c->out, w->text.data, w->text.len);
+        }
+    }
+    if (rc == query_malformed) {
+        c->malformed++;
+    }
+}
+
+/* runs the query on every record in data */
+static void scan_records (worker_t *w, chunk_t *c, const char *data, size_t len) {
+    const char *p = data, *end = data + len, *nl, *line;
+    size_t line_len;
+    long n;
+
+    if (w->pl->cbor) {
+        while (p < end) {
+            n = cbor_item_size(p, end - p);
+            if (n <= 0) {
+                c->malformed++;
+                return;
+            }
+            zmemory_clear(w->json);
+            if (cbor_to_json(p, n, w->json) == 0) {
+                line = zmemory(w->json, &line_len);
+                scan_record(w, c, line, line_len ? line_len - 1 : 0);
+            } else {
+                c->records++;
+                c->malformed++;
+            }
+            p += n;
+        }
+        return;
+    }
+    while (p < end) {
+        nl = memchr(p, '\n', end - p);
+        if (nl == NULL) {
+            nl = end;
+        }
+        scan_record(w, c, p, nl - p);
+        p = nl + 1;
+    }
+}
+
+/* decompresses the blocks in raw into data */
+static int decompress (worker_t *w, chunk_t *c) {
+    if (c->size < c->expected) {
+        free(c->data);
+        c->size = c->expected;
+        c->data = malloc(c->size ? c->size : 1);
+        if (c->data == NULL) {
+            c->size = 0;
+            return -1;
+        }
+    }
+#if defined(USE_ZSTD)
+    {
+        size_t n = ZSTD_decompressDCtx(w->dctx, c->data, c->expected, c->raw, c->raw_len);
+
+        if (ZSTD_isError(n) || n != c->expected) {
+            return -1;
+        }
+        c->len = n;
+    }
+#elif defined(USE_GZIP)
+    {
+        int rc;
+
+        if (!w->zs_ready) {
+            if (inflateInit2(&w->zs, 15 + 16) != Z_OK) {
+                return -1;
+            }
+            w->zs_ready = 1;
+        }
+        w->zs.next_in = (Bytef *)c->raw;
+        w->zs.avail_in = (uInt)c->raw_len;
+        w->zs.next_out = (Bytef *)c->data;
+        w->zs.avail_out = (uInt)c->expected;
+        while (w->zs.avail_in) {
+            if (inflateReset(&w->zs) != Z_OK) {
+                return -1;
+            }
+            rc = inflate(&w->zs, Z_FINISH);
+            if (rc != Z_STREAM_END) {
+                return -1;
+            }
+        }
+        c->len = c->expected - w->zs.avail_out;
+        if (w->zs.avail_out != 0) {
+            return -1;
+        }
+    }
+#else
+    (void)w;
+    return -1;
+#endif
+    return 0;
+}
+
+static void *worker_main (void *arg) {
+    worker_t *w = arg;
+    pipeline_t *pl = w->pl;
+    chunk_t *c;
+
+    for (;;) {
+        pthread_mutex_lock(&pl->lock);
+        while (pl->queue_len == 0 && !pl->stop) {
+            pthread_cond_wait(&pl->work, &pl->lock);
+        }
+        if (pl->queue_len == 0) {
+            pthread_mutex_unlock(&pl->lock);
+            return NULL;
+        }
+        c = pl->queue[pl->queue_head];
+        pl->queue_head = (pl->queue_head + 1) % pl->window;
+        pl->queue_len--;
+        pthread_mutex_unlock(&pl->lock);
+
+        if (c->task == chunk_decompress) {
+            c->failed = (decompress(w, c) != 0);
+        } else {
+            if (c->head.len) {
+                scan_records(w, c, c->head.data, c->head.len);
+            }
+            scan_records(w, c, c->data + c->start, c->end - c->start);
+        }
+
+        pthread_mutex_lock(&pl->lock);
+        c->busy = 0;
+        pthread_cond_broadcast(&pl->done);
+        pthread_mutex_unlock(&pl->lock);
+    }
+}
+
+/* hands a chunk to the pool */
+static void submit (pipeline_t *pl, chunk_t *c, chunk_task_e task) {
+    pthread_mutex_lock(&pl->lock);
+    c->task = task;
+    c->busy = 1;
+    pl->queue[(pl->queue_head + pl->queue_len) % pl->window] = c;
+    pl->queue_len++;
+    pthread_cond_signal(&pl->work);
+    pthread_mutex_unlock(&pl->lock);
+}
+
+/* waits until the pool is done with a chunk */
+static void wait_chunk (pipeline_t *pl, chunk_t *c) {
+    pthread_mutex_lock(&pl->lock);
+    while (c->busy) {
+        pthread_cond_wait(&pl->done, &pl->lock);
+    }
+    pthread_mutex_unlock(&pl->lock);
+}
+
+static int chunk_ready (pipeline_t *pl, chunk_t *c) {
+    int busy;
+
+    pthread_mutex_lock(&pl->lock);
+    busy = c->busy;
+    pthread_mutex_unlock(&pl->lock);
+    return !busy;
+}
+
+static int pipeline_start (pipeline_t *pl, unsigned int num_workers) {
+    unsigned int i;
+
+    pl->num_workers = num_workers;
+    pl->window = 2 * num_workers + 2;
+    pl->chunks = calloc(pl->window, sizeof(chunk_t));
+    pl->queue = calloc(pl->window, sizeof(chunk_t *));
+    pl->workers = calloc(num_workers, sizeof(worker_t));
+    if (pl->chunks == NULL || pl->queue == NULL || pl->workers == NULL) {
+        return -1;
+    }
+    pthread_mutex_init(&pl->lock, NULL);
+    pthread_cond_init(&pl->work, NULL);
+    pthread_cond_init(&pl->done, NULL);
+    for (i = 0; i < num_workers; i++) {
+        worker_t *w = &pl->workers[i];
+
+        w->pl = pl;
+        w->json = zopen_memory();
+#if defined(USE_ZSTD)
+        w->dctx = ZSTD_createDCtx();
+        if (w->dctx == NULL) {
+            return -1;
+        }
+#endif
+        if (w->json == NULL || pthread_create(&w->thread, NULL, worker_main, w) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void pipeline_stop (pipeline_t *pl) {
+    unsigned int i;
+
+    pthread_mutex_lock(&pl->lock);
+    pl->stop = 1;
+    pthread_cond_broadcast(&pl->work);
+    pthread_mutex_unlock(&pl->lock);
+    for (i = 0; i < pl->num_workers; i++) {
+        worker_t *w = &pl->workers[i];
+
+        pthread_join(w->thread, NULL);
+        zclose(w->json);
+        query_buf_free(&w->text);
+        query_buf_free(&w->group);
+#if defined(USE_ZSTD)
+        ZSTD_freeDCtx(w->dctx);
+#elif defined(USE_GZIP)
+        if (w->zs_ready) {
+            inflateEnd(&w->zs);
+        }
+#endif
+    }
+    for (i = 0; i < pl->window; i++) {
+        free(pl->chunks[i].raw);
+        free(pl->chunks[i].data);
+        query_buf_free(&pl->chunks[i].head);
+        query_buf_free(&pl->chunks[i].out);
+    }
+    free(pl->workers);
+    free(pl->chunks);
+    free(pl->queue);
+}
+
+/*
+ * -------------------------------------------------------
+ * Input
+ * -------------------------------------------------------
+ */
+
+/* reports an error in the input; what was read before it is still used */
+static void input_error (input_t *in, const char *problem) {
+    if (!in->failed && !zreader_failed(in->r)) {
+        fprintf(stderr, "error: %s %s\n", in->name, problem);
+    }
+    in->failed = 1;
+}
+
+/* decompresses, or just reads, up to QUERY_CHUNK_SIZE bytes into c */
+static long input_stream_read (input_t *in, chunk_t *c) {
+    size_t want = QUERY_CHUNK_SIZE;
+    long n;
+
+    if (c->size < want) {
+        free(c->data);
+        c->data = malloc(want);
+        c->size = c->data ? want : 0;
+        if (c->data == NULL) {
+            input_error(in, "could not be read: out of memory");
+            return -1;
+        }
+    }
+    c->len = 0;
+    if (in->failed) {
+        return -1;
+    }
+    n = zread(in->r, c->data, want);
+    if (n < 0) {
+        in->failed = 1;
+        return -1;
+    }
+    c->len = n;
+    return n;
+}
+
+/*
+ * fills c with the next part of the input; returns 1, 0 at the end of
+ * the input, or -1 on failure
+ */
+static int input_next (input_t *in, chunk_t *c) {
+    const char *block;
+    size_t size, expected;
+    int rc;
+
+    c->raw_len = 0;
+    c->expected = 0;
+    c->failed = 0;
+    c->len = 0;
+    c->head.len = 0;
+    c->out.len = 0;
+    c->records = c->malformed = 0;
+
+    /* gather compressed blocks until they make a chunk */
+    while (in->blocks && c->expected < QUERY_CHUNK_SIZE) {
+        rc = zread_block(in->r, &block, &size, &expected);
+        if (rc == 0) {
+            break;
+        }
+        if (rc < 0) {
+            /* the rest is decompressed here, after the blocks gathered so far */
+            in->blocks = 0;
+            break;
+        }
+        if (c->raw_size < c->raw_len + size) {
+            char *tmp = realloc(c->raw, c->raw_len + size + QUERY_CHUNK_SIZE / 4);
+
+            if (tmp == NULL) {
+                input_error(in, "could not be read: out of memory");
+                return -1;
+            }
+            c->raw = tmp;
+            c->raw_size = c->raw_len + size + QUERY_CHUNK_SIZE / 4;
+        }
+        memcpy(c->raw + c->raw_len, block, size);
+        c->raw_len += size;
+        c->expected += expected;
+    }
+    if (c->raw_len) {
+        c->task = chunk_decompress;
+        return 1;
+    }
+    if (in->blocks) {
+        return 0;
+    }
+
+    c->task = chunk_scan;
+    rc = (int)input_stream_read(in, c);
+    return rc > 0 ? 1 : rc;
+}
+
+/*
+ * -------------------------------------------------------
+ * Cutting the input between records
+ * -------------------------------------------------------
+ */
+
+/*
+ * splits the decompressed input of c: the record that started in
+ * earlier chunks (carry) is completed in head, the whole records that
+ * follow are between start and end, and what is left of the last
+ * record is carried over to the next chunk
+ */
+static int cut (pipeline_t *pl, chunk_t *c, query_buf_t *carry, const char *name) {
+    const char *nl, *last;
+    size_t off, k;
+    long n;
+
+    c->head.len = 0;
+    c->start = c->end = 0;
+
+    if (!pl->cbor) {
+        nl = memchr(c->data, '\n', c->len);
+        if (nl == NULL) {
+            return query_buf_append(carry, c->data, c->len);
+        }
+        if (query_buf_append(&c->head, carry->data, carry->len) != 0 ||
+            query_buf_append(&c->head, c->data, nl - c->data) != 0) {
+            return -1;
+        }
+        carry->len = 0;
+        last = c->data + c->len - 1;
+        while (*last != '\n') {
+            last--;
+        }
+        c->start = nl + 1 - c->data;
+        c->end = last - c->data;
+        if (c->end < c->start) {
+            c->end = c->start;
+        }
+        return query_buf_append(carry, last + 1, c->data + c->len - last - 1);
+    }
+
+    /* complete the item that started in earlier chunks */
+    off = 0;
+    if (carry->len) {
+        for (k = 4096; ; k *= 2) {
+            if (k > c->len) {
+                k = c->len;
+            }
+            c->head.len = 0;
+            if (query_buf_append(&c->head, carry->data, carry->len) != 0 ||
+                query_buf_append(&c->head, c->data, k) != 0) {
+                return -1;
+            }
+            n = cbor_item_size(c->head.data, c->head.len);
+            if (n < 0) {
+                goto malformed;
+            }
+            if (n > 0) {
+                c->head.len = n;
+                off = n - carry->len;
+                carry->len = 0;
+                break;
+            }
+            if (k == c->len) {
+                c->head.len = 0;
+                return query_buf_append(carry, c->data, c->len);
+            }
+        }
+    }
+    c->start = off;
+    while (off < c->len) {
+        n = cbor_item_size(c->data + off, c->len - off);
+        if (n == 0) {
+            break;
+        }
+        if (n < 0) {
+            goto malformed;
+        }
+        off += n;
+    }
+    c->end = off;
+    return query_buf_append(carry, c->data + off, c->len - off);
+
+ malformed:
+    fprintf(stderr, "error: %s is not valid CBOR\n", name);
+    return -1;
+}
+
+/* writes the output of a chunk, or gathers it */
+static int emit (pipeline_t *pl, chunk_t *c, FILE *out) {
+    pl->num_records += c->records;
+    pl->num_malformed += c->malformed;
+    if (pl->aggregate) {
+        return agg_add(pl, &c->out);
+    }
+    if (c->out.len && fwrite(c->out.data, 1, c->out.len, out) != c->out.len) {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * \brief Run the query on every record of one input.
+ *
+ * \param pl the pipeline
+ * \param fname name of the input, or NULL for standard input
+ * \param out where the output goes
+ *
+ * \return 0 on success, or -1 if the input could not be read to its end
+ */
+static int query_file (pipeline_t *pl, const char *fname, FILE *out) {
+    unsigned long next_read = 0, next_cut = 0, next_emit = 0;
+    query_buf_t carry = { NULL, 0, 0 };
+    int eof = 0, rc = 0, first = 1;
+    chunk_t *c;
+    input_t in;
+
+    memset(&in, 0, sizeof(in));
+    in.r = zreader_open(fname);
+    if (in.r == NULL) {
+        return -1;
+    }
+    in.name = zreader_name(in.r);
+    in.blocks = 1;
+    pl->cbor = 0;
+
+    for (;;) {
+        /* read ahead, as far as there are chunks */
+        while (!eof && rc == 0 && next_read - next_emit < pl->window) {
+            c = &pl->chunks[next_read % pl->window];
+            switch (input_next(&in, c)) {
+            case 1:
+                if (c->task == chunk_decompress) {
+                    submit(pl, c, chunk_decompress);
+                }
+                next_read++;
+                break;
+            default:
+                eof = 1;
+            }
+        }
+
+        if (next_cut < next_read && rc == 0) {
+            /* cut the oldest chunk that is not cut yet, and have it scanned */
+            c = &pl->chunks[next_cut % pl->window];
+            wait_chunk(pl, c);
+            if (c->failed) {
+                input_error(&in, "could not be decompressed");
+                rc = -1;
+                continue;
+            }
+            if (first && c->len) {
+                /* what the input is, once it is decompressed */
+                if (c->len >= 4 && (unsigned char)c->data[0] == 0xff &&
+                    (unsigned char)c->data[1] == 0xff && (unsigned char)c->data[2] == 0xff &&
+                    (unsigned char)c->data[3] == 0xff) {
+                    input_error(&in, "is Arrow output, which joy-query does not read");
+                    rc = -1;
+                    continue;
+                }
+                pl->cbor = (c->len >= 3 && (unsigned char)c->data[0] == 0xd9 &&
+                            (unsigned char)c->data[1] == 0xd9 && (unsigned char)c->data[2] == 0xf7);
+                first = 0;
+            }
+            if (cut(pl, c, &carry, in.name) != 0) {
+                rc = -1;
+                continue;
+            }
+            submit(pl, c, chunk_scan);
+            next_cut++;
+            while (next_emit < next_cut && chunk_ready(pl, &pl->chunks[next_emit % pl->window])) {
+                if (emit(pl, &pl->chunks[next_emit++ % pl->window], out) != 0) {
+                    rc = -1;
+                }
+            }
+        } else if (next_emit < next_cut) {
+            c = &pl->chunks[next_emit++ % pl->window];
+            wait_chunk(pl, c);
+            if (emit(pl, c, out) != 0) {
+                rc = -1;
+            }
+        } else {
+            break;
+        }
+    }
+    /* chunks that were read but not cut */
+    for (; next_cut < next_read; next_cut++) {
+        wait_chunk(pl, &pl->chunks[next_cut % pl->window]);
+    }
+
+    if (in.failed || zreader_failed(in.r)) {
+        rc = -1;
+    }
+
+    /* the last record, if it does not end in a newline */
+    if (rc == 0 && carry.len) {
+        c = &pl->chunks[0];
+        if (pl->cbor) {
+            fprintf(stderr, "error: %s ends in the middle of a record\n", in.name);
+            rc = -1;
+        } else {
+            c->len = c->start = c->end = 0;
+            c->head.len = 0;
+            c->out.len = 0;
+            c->records = c->malformed = 0;
+            query_buf_append(&c->head, carry.data, carry.len);
+            submit(pl, c, chunk_scan);
+            wait_chunk(pl, c);
+            rc = emit(pl, c, out);
+        }
+    }
+
+    query_buf_free(&carry);
+    zreader_close(in.r);
+    return rc;
+}
+
+static int usage (char *name) {
+    fprintf(stderr, "usage:\n%s [ --where <expr> ] [ --select <fields> ] [ --groupby <fields> ] "
+            "[ --dist ] [ -j <threads> ] [ <file> ... ]\n", name);
+    fprintf(stderr, "where:\n"
+                "   <file> contains JSON or CBOR output of joy (not Arrow output);\n"
+                "   standard input is read if no file is given, and matching records\n"
+                "   are written to standard output as JSON lines, in the order they\n"
+                "   were read\n"
+                "   --where <expr> keeps the records that match <expr>, which combines\n"
+                "     tests such as dp=443, da~10.*, bytes_out>1000 or tls{cs}=c02f\n"
+                "     with , (and), | (or, which binds more tightly) and parentheses\n"
+                "   --select <fields> keeps only those fields, for example\n"
+                "     \"sa,da,tls{scs},packets[b]\"\n"
+                "   --groupby <fields> writes the records that have the same values\n"
+                "     of <fields> together\n"
+                "   --dist writes each distinct record once, with how many times it\n"
+                "     occurred (\"count\") out of all the records (or all those of its\n"
+                "     group) that were selected (\"total\"), most frequent first\n"
+                "   -j <threads> is the number of threads that filter and decompress\n"
+                "     the input; it is the number of CPUs by default\n\n");
+    return 1;
+}
+
+/**
+ \fn int main (int argc, char *argv[])
+ \brief main entry point for joy-query
+ \param argc command line argument count
+ \param argv command line arguments
+ \return 1 usage
+ \return EXIT_FAILURE an input could not be read, or none of the records parsed
+ \return 0 success
+ */
+int main (int argc, char *argv[]) {
+    const char *where = NULL, *select = NULL, *groupby = NULL;
+    long num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    pipeline_t pl;
+    char err[256];
+    int i, rc = 0;
+
+    memset(&pl, 0, sizeof(pl));
+    for (i = 1; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; i++) {
+        if (strcmp(argv[i], "--dist") == 0) {
+            pl.dist = 1;
+        } else if (i + 1 == argc) {
+            return usage(argv[0]);
+        } else if (strcmp(argv[i], "--where") == 0) {
+            where = argv[++i];
+        } else if (strcmp(argv[i], "--select") == 0) {
+            select = argv[++i];
+        } else if (strcmp(argv[i], "--groupby") == 0) {
+            groupby = argv[++i];
+        } else if (strcmp(argv[i], "-j") == 0) {
+            num_threads = atol(argv[++i]);
+            if (num_threads < 1) {
+                return usage(argv[0]);
+            }
+        } else {
+            return usage(argv[0]);
+        }
+    }
+    if (num_threads < 1) {
+        num_threads = 1;
+    }
+    if (num_threads > QUERY_MAX_THREADS) {
+        num_threads = QUERY_MAX_THREADS;
+    }
+
+    pl.q = query_new(where, select, groupby, err, sizeof(err));
+    if (pl.q == NULL) {
+        fprintf(stderr, "error: %s\n", err);
+        return 1;
+    }
+    pl.aggregate = pl.dist || query_grouped(pl.q);
+    if (pipeline_start(&pl, (unsigned int)num_threads) != 0) {
+        fprintf(stderr, "error: could not start %ld threads\n", num_threads);
+        return EXIT_FAILURE;
+    }
+    setvbuf(stdout, NULL, _IOFBF, 1024 * 1024);
+
+    do {
+        const char *fname = NULL;
+
+        if (i < argc && strcmp(argv[i], "-") != 0) {
+            fname = argv[i];
+        }
+        if (query_file(&pl, fname, stdout) != 0) {
+            rc = EXIT_FAILURE;
+        }
+    } while (++i < argc);
+
+    if (pl.aggregate && agg_write(&pl, stdout) != 0) {
+        fprintf(stderr, "error: out of memory\n");
+        rc = EXIT_FAILURE;
+    }
+    if (fflush(stdout) != 0) {
+        rc = EXIT_FAILURE;
+    }
+    if (pl.num_records && pl.num_malformed == pl.num_records) {
+        fprintf(stderr, "error: could not parse any of %lu records\n", pl.num_records);
+        rc = EXIT_FAILURE;
+    } else if (pl.num_malformed) {
+        fprintf(stderr, "warning: could not parse %lu of %lu records\n",
+                pl.num_malformed, pl.num_records);
+    }
+
+    pipeline_stop(&pl);
+    query_buf_free(&pl.arena);
+    agg_free(&pl.groups);
+    agg_free(&pl.records);
+    query_free(pl.q);
+    return rc;
+}
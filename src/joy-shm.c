@@ -0,0 +1,197 @@
+/*
+ *
+ * Copyright (c) 2018 Cisco Systems, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ *
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file joy-shm.c
+ *
+ * \brief reads the records that joy publishes to a shared memory ring
+ *        (shm_output=NAME), and writes them to standard output
+ *
+ ** \verbatim
+  joy-shm [ -o ] [ -f ] [ -s ] <name>
+     -o starts with the oldest record still in the ring
+     -f follows the ring across restarts of joy, instead of exiting
+        once joy has closed it
+     -s reports what was read, and lost, on exit
+     <name> is the name of the ring
+ \endverbatim
+ *
+ * The records are written as they were published: JSON lines, or CBOR
+ * items that joy-convert turns into JSON lines.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include "shm_output.h"
+
+/* longest wait between two looks at an idle ring, in microseconds */
+#define JOY_SHM_MAX_WAIT 10000
+
+static volatile sig_atomic_t done = 0;
+
+static void sig_done (int signal_arg) {
+    (void)signal_arg;
+    done = 1;
+}
+
+static void report (const shm_reader_t *r) {
+    shm_reader_stats_t stats;
+
+    shm_reader_stats(r, &stats);
+    fprintf(stderr, "read %lu messages, lost %lu (overtaken %lu times), %lu bytes behind\n",
+            (unsigned long)stats.messages, (unsigned long)stats.messages_lost,
+            (unsigned long)stats.overflows, (unsigned long)stats.lag);
+}
+
+static int usage (char *name) {
+    fprintf(stderr, "usage:\n%s [-o][-f][-s] <name>\n", name);
+    fprintf(stderr, "where:\n"
+                "   <name> is the shared memory ring that joy publishes to\n\n"
+                "   -o starts with the oldest record still in the ring\n"
+                "   -f follows the ring across restarts of joy\n"
+                "   -s reports what was read and lost on exit\n\n");
+    return 1;
+}
+
+/**
+ \fn int main (int argc, char *argv[])
+ \brief main entry point for joy-shm
+ \param argc command line argument count
+ \param argv command line arguments
+ \return 1 usage
+ \return EXIT_FAILURE the ring could not be read
+ \return 0 success
+ */
+int main (int argc, char *argv[]) {
+    int from_oldest = 0, follow = 0, report_stats = 0, restarted = 0;
+    size_t size = 64 * 1024, len;
+    unsigned int wait = 0;
+    shm_reader_t *r = NULL;
+    char *buf, *tmp;
+    int opt, rc;
+
+    while ((opt = getopt(argc, argv, "ofs")) != -1) {
+        switch (opt) {
+            case 'o':
+                from_oldest = 1;
+                break;
+            case 'f':
+                follow = 1;
+                break;
+            case 's':
+                report_stats = 1;
+                break;
+            default:
+                return usage(argv[0]);
+        }
+    }
+    if (optind != argc - 1) {
+        return usage(argv[0]);
+    }
+
+    buf = malloc(size);
+    if (buf == NULL) {
+        return EXIT_FAILURE;
+    }
+    signal(SIGINT, sig_done);
+    signal(SIGTERM, sig_done);
+
+    while (!done) {
+        if (r == NULL) {
+            r = shm_reader_open(argv[optind], from_oldest);
+            if (r == NULL) {
+                if (!follow) {
+                    fprintf(stderr, "error: could not open ring %s (%s)\n", argv[optind], strerror(errno));
+                    free(buf);
+                    return EXIT_FAILURE;
+                }
+                usleep(100000);
+                continue;
+            }
+            if (restarted && shm_reader_closed(r)) {
+                /* still the ring that was read; joy has not restarted yet */
+                shm_reader_close(r);
+                r = NULL;
+                usleep(100000);
+                continue;
+            }
+        }
+
+        rc = shm_reader_next(r, buf, size, &len);
+        if (rc == 1) {
+            fwrite(buf, 1, len, stdout);
+            wait = 0;
+        } else if (rc < 0) {
+            tmp = realloc(buf, len);
+            if (tmp == NULL) {
+                break;
+            }
+            buf = tmp;
+            size = len;
+        } else if (shm_reader_closed(r)) {
+            /* joy is gone, and everything it published has been read */
+            if (report_stats) {
+                report(r);
+            }
+            shm_reader_close(r);
+            r = NULL;
+            if (!follow) {
+                break;
+            }
+            /* the ring that joy creates when it restarts is read from its start */
+            from_oldest = 1;
+            restarted = 1;
+        } else {
+            /* idle; wait a little longer each time */
+            fflush(stdout);
+            wait = wait ? (wait * 2 > JOY_SHM_MAX_WAIT ? JOY_SHM_MAX_WAIT : wait * 2) : 50;
+            usleep(wait);
+        }
+    }
+
+    fflush(stdout);
+    if (r != NULL) {
+        if (report_stats) {
+            report(r);
+        }
+        shm_reader_close(r);
+    }
+    free(buf);
+    return 0;
+}
@@ -87,9 +87,13 @@
 #include "procwatch.h"  /* process to flow mapping       */
 #include "radix_trie.h" /* trie for subnet labels        */
 #include "output.h"     /* compressed output             */
+#include "shm_output.h" /* shared memory ring output       */
 #include "updater.h"    /* updater thread for classifer and label subnets */
+#include "upload.h"     /* upload of rotated output files */
 #include "ipfix.h"    /* IPFIX cleanup */
 #include "proto_identify.h"
+#include "arena.h"
+#include "snapshot.h"
 #include "pcap.h"
 #include "joy_api_private.h"
 
@@ -124,6 +128,7 @@ static joy_operating_mode_e joy_mode = MODE_NONE;
 static pcap_t *handle = NULL;
 static char *filter_exp = "ip or vlan";
 static char dir_output[MAX_FILENAME_LEN];
+static shm_ring_t *shm_ring = NULL;
 
 struct joy_ctx_data main_ctx;
 
@@ -421,6 +426,7 @@ static void sig_close (int signal_arg) {
      */
     flow_record_list_print_json(&main_ctx, JOY_ALL_FLOWS);
     zclose(main_ctx.output);
+    shm_ring_close(shm_ring);
 
     if (glb_config->ipfix_export_port) {
         /* Flush any unsent exporter messages in Ipfix module */
@@ -432,6 +438,16 @@ static void sig_close (int signal_arg) {
     /* Cleanup protocol identification module */
     proto_identify_cleanup();
 
+    /* Cleanup the TLS certificate cache */
+    tls_certificate_cache_cleanup();
+
+    /* Free the chunks pooled for the protocol parser arenas */
+    joy_arena_pool_cleanup();
+
+    /* Free the labels and parameters replaced by the updater */
+    joy_snapshot_unregister(&main_ctx.snapshot_reader);
+    joy_snapshot_cleanup();
+
     fprintf(info, "got signal %d, shutting down\n", signal_arg); 
     exit(EXIT_SUCCESS);
 }
@@ -463,8 +479,21 @@ static int usage (char *s) {
            "  output=F                   write output to file F (otherwise stdout is used)\n"
            "  logfile=F                  write secondary output to file F (otherwise stderr is used)\n" 
            "  count=C                    rotate output files so each has about C records\n" 
-           "  upload=user@server:path    upload to user@server:path with scp after file rotation\n" 
+           "  async_output=N             compress and write output on a separate thread, with N buffers\n" 
+           "  compress_level=L           compress output at level L (0 = library default)\n" 
+           "  compress_threads=T         compress output in independent blocks on T threads per file\n" 
+           "  arrow_output=1             write flow records as an Arrow IPC stream instead of JSON\n" 
+           "  cbor_output=1              write flow records in compact binary (CBOR) instead of JSON\n" 
+           "  shm_output=NAME            also publish records to the shared memory ring NAME\n" 
+           "  shm_size=M                 make that ring M megabytes (default 64)\n" 
+           "  upload=user@server:path    upload to user@server:path with scp after file rotation;\n"
+           "                             rsync:[user@server:]path uses rsync, dir:path copies to a directory\n"
            "  keyfile=F                  use SSH identity (private key) in file F for upload\n" 
+           "  upload_workers=N           upload up to N files at a time (default 2)\n"
+           "  upload_retries=N           retry a failed upload N times, with growing delays (default 5)\n"
+           "  upload_bwlimit=K           limit each upload to K kilobytes per second\n"
+           "  upload_queue=F             keep the queue of files to upload in file F\n"
+           "                             (default: joy-upload.queue in the output directory)\n"
            "  anon=F                     anonymize addresses matching the subnets listed in file F\n" 
            "  retain=1                   retain a local copy of file after upload\n" 
            "  preemptive_timeout=1       For active flows, look at incoming packets timestamp to decide if\n"
@@ -496,6 +525,8 @@ static int usage (char *s) {
            "                             Default=\"joy\"\n"
            "Data feature options\n"
            "  bpf=\"expression\"           only process packets matching BPF \"expression\"\n" 
+           "  sample_rate=N              keep 1-in-N flows, selected by flow key hash (1 <= N <= %d)\n"
+           "  adaptive_sample=1          raise the sampling rate while the capture is dropping packets\n"
            "  zeros=1                    include zero-length data (e.g. ACKs) in packet list\n" 
            "  retrans=1                  include TCP retransmissions in packet list\n"
            "  bidir=1                    merge unidirectional flows into bidirectional ones\n" 
@@ -503,6 +534,7 @@ static int usage (char *s) {
            "  cdist=F                    include compact byte distribution array using the mapping file, F\n" 
            "  entropy=1                  include byte entropy\n" 
            "  http=1                     include HTTP data\n" 
+           "  http_headers=H,H,...       report only the HTTP headers named (default: all)\n"
            "  exe=1                      include information about host process associated with flow\n" 
            "  classify=1                 include results of post-collection classification\n" 
            "  num_pkts=N                 report on at most N packets per flow (0 <= N < %d)\n" 
@@ -511,10 +543,15 @@ static int usage (char *s) {
            "  label=L:F                  add label L to addresses that match the subnets in file F\n"
            "  URLmodel=URL               URL to be used to retrieve classisifer updates\n" 
            "  model=F1:F2                change classifier parameters, SPLT in file F1 and SPLT+BD in file F2\n"
+           "  ensemble=F                 classify with the tree ensemble in file F instead\n"
            "  hd=1                       include header description\n" 
+           "  inspect_bytes=N            inspect at most the first N payload bytes of each flow direction\n"
+           "  inspect_pkts=N             inspect at most the first N payload packets of each flow direction\n"
+           "  fingerprint_hash=N         report client fingerprint hashes: 1=with the fields, 2=in place of them\n"
+           "  fingerprint_match=P        label TLS clients whose fingerprint is P%% that of a known one (default 100)\n"
            "  URLlabel=URL               Full URL including filename to be used to retrieve label updates\n" 
        get_usage_all_features(feature_list),
-       MAX_NUM_PKT_LEN); 
+       MAX_SAMPLE_RATE, MAX_NUM_PKT_LEN); 
     printf("RETURN VALUE                 0 if no errors; nonzero otherwise\n"); 
     return -1;
 }
@@ -645,19 +682,38 @@ static int initial_setup(char *config_file, unsigned int num_cmds) {
     /* Initialize the protocol identification module */
     if (proto_identify_init()) return 1;
 
+    /* Compression level and threads for the output files */
+    zconfigure(glb_config->compress_level, glb_config->compress_threads);
+
+    /* Publish the records to a shared memory ring as well */
+    if (glb_config->shm_output) {
+        if (glb_config->arrow_output) {
+            joy_log_warn("shm_output is not used with arrow_output");
+        } else {
+            size_t size = glb_config->shm_size ? (size_t)glb_config->shm_size << 20 : SHM_RING_DEFAULT_SIZE;
+
+            shm_ring = shm_ring_create(glb_config->shm_output, size,
+                                       glb_config->cbor_output ? shm_format_cbor : shm_format_json);
+            if (shm_ring == NULL) {
+                joy_log_crit("could not create shared memory ring %s (%s)",
+                             glb_config->shm_output, strerror(errno));
+                return 1;
+            }
+            zpublish(shm_ring);
+        }
+    }
+
     if (glb_config->show_config) {
         /* Print running configuration */
         config_print(info, glb_config);
     }
 
-#if 0
-    if (glb_config->report_tls) {
+    if (glb_config->report_tls && glb_config->fingerprint_match) {
         /* Load the TLS fingerprints into memory */
         if (tls_load_fingerprints()) {
             joy_log_warn("could not load tls_fingerprint.json file");
         }
     }
-#endif
 
     if (joy_mode == MODE_ONLINE) {
         /* Get interface list */
@@ -711,6 +767,31 @@ static int get_splt_bd_params() {
     return 0;
 }
 
+/**
+ * \brief Load the tree ensemble classifier if given.
+ *
+ * \return 0 success, 1 failure
+ */
+static int get_ensemble() {
+    if (!glb_config->ensemble_file) {
+        return 0;
+    }
+
+    /*
+     * as with the splt and bd parameters, a URL means that the
+     * updater process will download and load the ensemble
+     */
+    if (glb_config->params_url == NULL) {
+        fprintf(info, "updating classifier from supplied ensemble(%s)\n", glb_config->ensemble_file);
+        if (update_ensemble(glb_config->ensemble_file) != ok) {
+            joy_log_err("could not load ensemble %s", glb_config->ensemble_file);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
 /**
  * \brief Read in the compact bd parameters if given.
  *
@@ -755,6 +836,7 @@ static int get_compact_bd() {
  * \return 0 success, 1 failure
  */
 static int get_labeled_subnets() {
+    radix_trie_t rt = NULL;
     attr_flags subnet_flag;
     joy_status_e err;
     int i = 0;
@@ -763,13 +845,13 @@ static int get_labeled_subnets() {
         return 0;
     }
 
-    glb_config->rt = radix_trie_alloc();
-    if (glb_config->rt == NULL) {
+    rt = radix_trie_alloc();
+    if (rt == NULL) {
         joy_log_err("could not allocate memory");
         return 1;
     }
 
-    err = radix_trie_init(glb_config->rt);
+    err = radix_trie_init(rt);
     if (err != ok) {
         joy_log_err("could not initialize subnet labels (radix_trie)");
         return 1;
@@ -785,19 +867,26 @@ static int get_labeled_subnets() {
               return 1;
         }
 
-        subnet_flag = radix_trie_add_attr_label(glb_config->rt, label);
+        subnet_flag = radix_trie_add_attr_label(rt, label);
         if (subnet_flag == 0) {
               joy_log_err("could not add subnet label %s to radix_trie", label);
               return 1;
         }
 
-        err = radix_trie_add_subnets_from_file(glb_config->rt, subnet_file, subnet_flag, info);
+        err = radix_trie_add_subnets_from_file(rt, subnet_file, subnet_flag, info);
         if (err != ok) {
               joy_log_err("could not add labeled subnets from file %s", subnet_file);
               return 1;
         }
     }
 
+    err = radix_trie_compile(rt);
+    if (err != ok) {
+          joy_log_err("could not compile labeled subnets");
+          return 1;
+    }
+    joy_snapshot_publish(&glb_config->labels, rt, NULL);
+
     joy_log_info("configured labeled subnets (radix_trie)");
 
     return 0;
@@ -878,6 +967,50 @@ static int open_interface (char **capture_if, char **capture_mac) {
     return 0;
 }
 
+/**
+ * \brief Hand a rotated output file to the uploader, if there is one.
+ *
+ * \param fname Name of the closed output file
+ *
+ * \return none
+ */
+static void output_file_closed (const char *fname) {
+    if (glb_config->upload_servername) {
+        upload_file(fname);
+    }
+}
+
+/**
+ * \brief Start uploading the rotated output files, and those that were
+ * left in the upload queue by an earlier run.
+ *
+ * \return 0 success, 1 failure
+ */
+static int start_uploader (void) {
+    char queue_file[MAX_FILENAME_LEN];
+    upload_options_t opt;
+
+    if (glb_config->upload_queue) {
+        snprintf(queue_file, MAX_FILENAME_LEN, "%s", glb_config->upload_queue);
+    } else {
+        snprintf(queue_file, MAX_FILENAME_LEN, "%s/%s",
+                 glb_config->outputdir ? glb_config->outputdir : ".", UPLOAD_QUEUE_FILE);
+    }
+
+    memset(&opt, 0, sizeof(opt));
+    opt.destination = glb_config->upload_servername;
+    opt.key = glb_config->upload_key;
+    opt.queue_file = queue_file;
+    opt.workers = glb_config->upload_workers;
+    opt.retries = glb_config->upload_retries;
+    opt.retry_delay = UPLOAD_RETRY_DELAY;
+    opt.max_retry_delay = UPLOAD_MAX_RETRY_DELAY;
+    opt.bwlimit = (unsigned long)glb_config->upload_bwlimit * 1024;
+    opt.retain = glb_config->retain_local;
+
+    return upload_start(&opt) == ok ? 0 : 1;
+}
+
 /**
  * \brief Set the data output to desired target.
  *
@@ -1244,7 +1377,6 @@ int main (int argc, char **argv) {
     char *capture_mac = NULL;
     struct stat sb;
     pthread_t upd_thread;
-    pthread_t uploader_thread;
     int upd_rc;
     pthread_t ipfix_cts_monitor_thread;
     int cts_monitor_thread_rc;
@@ -1258,6 +1390,7 @@ int main (int argc, char **argv) {
     memset(&main_ctx, 0x00, sizeof(struct joy_ctx_data));
     memset(&active_config, 0x00, sizeof(struct configuration));
     glb_config = &active_config;
+    joy_snapshot_register(&main_ctx.snapshot_reader);
 
     /* Sanity check sizeof() expectations */
     if (data_sanity_check() != ok) {
@@ -1344,6 +1477,9 @@ int main (int argc, char **argv) {
      */
     if (get_splt_bd_params()) exit(EXIT_FAILURE);
 
+    /* Load the tree ensemble classifier if supplied */
+    if (get_ensemble()) exit(EXIT_FAILURE);
+
     /* Retrieve the compact byte distribution if supplied */
     if (get_compact_bd()) exit(EXIT_FAILURE);
 
@@ -1460,6 +1596,13 @@ int main (int argc, char **argv) {
             }
         }
 
+        /* compress and write the output on a thread of its own */
+        if (glb_config->async_output && main_ctx.output) {
+            if (zasync(main_ctx.output, glb_config->async_output) != 0) {
+                joy_log_warn("could not start the output writer thread, writing inline");
+            }
+        }
+
         /*
          * start up the updater thread
          *   updater is only active during live capture runs
@@ -1471,13 +1614,12 @@ int main (int argc, char **argv) {
          }
 
         /*
-         * start up the uploader thread
+         * start up the uploader threads
          *   uploader is only active during live capture runs
          */
          if (glb_config->upload_servername) {
-             upd_rc = pthread_create(&uploader_thread, NULL, uploader_main, (void*)glb_config);
-             if (upd_rc) {
-                 fprintf(info, "error: could not start uploader thread pthread_create() rc: %d\n", upd_rc);
+             if (start_uploader() != 0) {
+                 fprintf(info, "error: could not start the uploader\n");
                  return -7;
              }
          }
@@ -1500,6 +1642,18 @@ int main (int argc, char **argv) {
       
             joy_log_info("PCAP processing loop done");
 
+            if (glb_config->adaptive_sample) {
+                  /*
+                   * shed load by raising the sampling rate when the
+                   * capture is dropping packets
+                   */
+                  struct pcap_stat ps;
+
+                  if (pcap_stats(handle, &ps) == 0) {
+                      flow_sampling_update(&main_ctx, ps.ps_drop);
+                  }
+            }
+
             if (glb_config->report_exe) {
                   /*
                    * periodically obtain host/process flow data
@@ -1523,19 +1677,15 @@ int main (int argc, char **argv) {
                   if (glb_config->max_records && (main_ctx.records_in_file > glb_config->max_records)) {
 
                       /*
-                       * write JSON postamble
+                       * continue in a new file; the old one is closed
+                       * and handed to the uploader after the records
+                       * written so far (by the writer thread, if any)
                        */
-                      zclose(main_ctx.output);
-                      if (glb_config->upload_servername) {
-                          upload_file(output_filename);
-                      }
-
                       // printf("records: %d\tmax_records: %d\n", glb_config->records_in_file, glb_config->max_records);
                       if (glb_config->max_records != 0) {
                           set_data_output_file(output_filename, capture_if, capture_mac);
                       }
-                      main_ctx.output = zopen(output_filename, "w");
-                      if (main_ctx.output == NULL) {
+                      if (zrotate(main_ctx.output, output_filename, output_file_closed) != 0) {
                           perror("error: could not open output file");
                           return -1;
                       }
@@ -1671,10 +1821,22 @@ int main (int argc, char **argv) {
     /* Cleanup protocol identification module */
     proto_identify_cleanup();
 
+    /* Cleanup the TLS certificate cache */
+    tls_certificate_cache_cleanup();
+
+    /* Free the chunks pooled for the protocol parser arenas */
+    joy_arena_pool_cleanup();
+
+    /* Free the labels and parameters replaced by the updater */
+    joy_snapshot_unregister(&main_ctx.snapshot_reader);
+    joy_snapshot_cleanup();
+
     /* close the output file if it is still open */
     if (main_ctx.output) {
         zclose(main_ctx.output);
     }
+    shm_ring_close(shm_ring);
+    upload_stop();
 
     return 0;
 }
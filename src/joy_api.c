@@ -60,6 +60,9 @@
 #include "joy_api_private.h"
 #include "pthread.h"
 #include "proto_identify.h"
+#include "tls.h"
+#include "arena.h"
+#include "snapshot.h"
 #include "output.h"
 #include "ipfix.h"
 #include "pkt_proc.h"
@@ -224,6 +227,8 @@ int joy_initialize(joy_init_t *init_data,
     glb_config->report_entropy = ((init_data->bitmask & JOY_ENTROPY_ON) ? 1 : 0);
     glb_config->report_hd = ((init_data->bitmask & JOY_HEADER_ON) ? 1 : 0);
     glb_config->preemptive_timeout = ((init_data->bitmask & JOY_PREMPTIVE_TMO_ON) ? 1 : 0);
+    glb_config->async_output = ((init_data->bitmask & JOY_ASYNC_OUTPUT_ON) ? ZFILE_ASYNC_DEFAULT_BUFFERS : 0);
+    glb_config->adaptive_sample = ((init_data->bitmask & JOY_ADAPTIVE_SAMPLE_ON) ? 1 : 0);
 
     /* check for IPFix simple export option and setup template */
     if (init_data->bitmask & JOY_IPFIX_SIMPLE_EXPORT_ON) {
@@ -259,6 +264,14 @@ int joy_initialize(joy_init_t *init_data,
         ipfix_exporter_init(glb_config->ipfix_export_remote_host);
     }
 
+    /* label TLS clients with exact fingerprint matches */
+    if (glb_config->report_tls) {
+        glb_config->fingerprint_match = 100;
+        if (tls_load_fingerprints()) {
+            joy_log_warn("could not load tls_fingerprint.json file");
+        }
+    }
+
     /* initialize the protocol identification dictionary */
     if (proto_identify_init()) {
         joy_log_err("could not initialize the protocol identification dictionary");
@@ -311,8 +324,16 @@ int joy_initialize(joy_init_t *init_data,
             return failure;
         }
 
+        /* each context compresses and writes on a thread of its own */
+        if (glb_config->async_output) {
+            if (zasync(this->output, glb_config->async_output) != 0) {
+                joy_log_warn("could not start the output writer thread for context %d", i);
+            }
+        }
+
         flow_record_list_init(this);
         flocap_stats_timer_init(this);
+        joy_snapshot_register(&this->snapshot_reader);
     }
 
     /* set library init flag */
@@ -564,6 +585,7 @@ int joy_get_compact_bd(char *filename)
  */
 int joy_label_subnets(char *label, int type, char *subnet_str)
 {
+    radix_trie_t rt = NULL;
     attr_flags subnet_flag;
     joy_status_e err;
     char single_addr[64];
@@ -574,24 +596,29 @@ int joy_label_subnets(char *label, int type, char *subnet_str)
         return failure;
     }
 
-    /* see if we need a new radix_trie */
-    if (glb_config->rt == NULL) {
-        glb_config->rt = radix_trie_alloc();
-        if (glb_config->rt == NULL) {
+    /*
+     * see if we need a new radix_trie; labels are configured before
+     * packets are processed, so the published trie is extended in place
+     */
+    rt = joy_snapshot_get(&glb_config->labels);
+    if (rt == NULL) {
+        rt = radix_trie_alloc();
+        if (rt == NULL) {
             joy_log_err("could not allocate memory for labeled subnets");
             return failure;
         }
 
         /* initialize our new radix_trie */
-        err = radix_trie_init(glb_config->rt);
+        err = radix_trie_init(rt);
         if (err != ok) {
             joy_log_err("could not initialize subnet labels (radix_trie)");
             return failure;
         }
+        joy_snapshot_publish(&glb_config->labels, rt, NULL);
     }
 
     /* add the label to the radix_trie */
-    subnet_flag = radix_trie_add_attr_label(glb_config->rt, label);
+    subnet_flag = radix_trie_add_attr_label(rt, label);
     if (subnet_flag == 0) {
           joy_log_err("could not add subnet label %s to radix_trie", label);
           return failure;
@@ -602,20 +629,27 @@ int joy_label_subnets(char *label, int type, char *subnet_str)
         /* processing just a single subnet address */
         memset(single_addr,0x00,64);
         strncpy(single_addr,subnet_str,63);
-        err = radix_trie_add_subnet_from_string(glb_config->rt, single_addr, subnet_flag, info);
+        err = radix_trie_add_subnet_from_string(rt, single_addr, subnet_flag, info);
         if (err != ok) {
             joy_log_err("could not add labeled subnet for %s", single_addr);
             return failure;
         }
     } else {
         /* processing the subnet file now */
-        err = radix_trie_add_subnets_from_file(glb_config->rt, subnet_str, subnet_flag, info);
+        err = radix_trie_add_subnets_from_file(rt, subnet_str, subnet_flag, info);
         if (err != ok) {
             joy_log_err("could not add labeled subnets from file %s", subnet_str);
             return failure;
         }
     }
 
+    /* rebuild the lookup tables to include the new subnets */
+    err = radix_trie_compile(rt);
+    if (err != ok) {
+        joy_log_err("could not compile labeled subnets");
+        return failure;
+    }
+
     /* increment the number of subnets we have configured */
     glb_config->subnet[glb_config->num_subnets] = strdup(label);
     ++glb_config->num_subnets;
@@ -666,6 +700,41 @@ void joy_process_packet(unsigned char *ctx_index,
     process_packet((unsigned char*)ctx, header, packet);
 }
 
+/*
+ * Function: joy_update_capture_drops
+ *
+ * Description: This function records how many packets the capture
+ *      of the application has dropped so far, for the adaptive
+ *      sampling that joy_print_flow_data does.
+ *
+ * Parameters:
+ *      index - index of the context to use
+ *      num_drops - cumulative count of packets dropped by the capture
+ *
+ * Returns:
+ *      none
+ *
+ */
+void joy_update_capture_drops(unsigned int index, unsigned long int num_drops)
+{
+    joy_ctx_data *ctx = NULL;
+
+    /* check library initialization */
+    if (!joy_library_initialized) {
+        joy_log_crit("Joy Library has not been initialized!");
+        return;
+    }
+
+    /* sanity check the index value */
+    if (index >= joy_num_contexts ) {
+        joy_log_crit("Joy Library invalid context (%d) for capture drops!", index);
+        return;
+    }
+
+    ctx = JOY_CTX_AT_INDEX(ctx_data,index)
+    ctx->capture_drops = num_drops;
+}
+
 /*
  * Function: joy_print_flow_data
  *
@@ -710,6 +779,9 @@ void joy_print_flow_data(unsigned int index, int type)
         }
     }
 
+    /* shed load while the capture of the application is dropping packets */
+    flow_sampling_update(ctx, ctx->capture_drops);
+
     /* print the flow records */
     flow_record_list_print_json(ctx, type);
 
@@ -718,13 +790,11 @@ void joy_print_flow_data(unsigned int index, int type)
         if (ctx->records_in_file >= glb_config->max_records) {
             char output_filename[MAX_FILENAME_LEN];
 
-            zclose(ctx->output);
             ctx->records_in_file = 0;
             memset(output_filename, 0x00, MAX_FILENAME_LEN);
             format_output_filename(ctx->output_file_basename, output_filename);
             printf("Rolling Context :%d Output:%s\n",index,output_filename);
-            ctx->output = zopen(output_filename, "w");
-            if (ctx->output == NULL) {
+            if (zrotate(ctx->output, output_filename, NULL) != 0) {
                 joy_log_err("could not open output file %s (%s)", output_filename, strerror(errno));
                 joy_log_err("Rolling the output file failed!");
                 return;
@@ -899,6 +969,8 @@ void joy_context_cleanup(unsigned int index)
  */
 void joy_shutdown(void)
 {
+    unsigned int i;
+
     /* check library initialization */
     if (!joy_library_initialized) {
         joy_log_crit("Joy Library has not been initialized!");
@@ -908,9 +980,22 @@ void joy_shutdown(void)
     /* clean up the protocol idenitfication dictionary */
     proto_identify_cleanup();
 
+    /* clean up the TLS certificate cache */
+    tls_certificate_cache_cleanup();
+
+    /* the contexts no longer read the labels and parameters */
+    for (i = 0; i < joy_num_contexts; i++) {
+        struct joy_ctx_data *this = JOY_CTX_AT_INDEX(ctx_data,i)
+        joy_snapshot_unregister(&this->snapshot_reader);
+    }
+    joy_snapshot_cleanup();
+
     /* free up the memory for the contexts */
     JOY_API_FREE_CONTEXT(ctx_data)
 
+    /* free the chunks pooled for the protocol parser arenas */
+    joy_arena_pool_cleanup();
+
     /* clear out the configuration structure */
     memset(&active_config, 0x00, sizeof(struct configuration));
     glb_config = NULL;
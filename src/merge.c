@@ -0,0 +1,1021 @@
+/*
+ *
+ * Copyright (c) 2018 Cisco Systems, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ *
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file merge.c
+ *
+ * \brief Time-ordered merge of the flow records of several outputs,
+ *        optionally stitching flows that were split between records
+ *
+ * The sources are kept in a heap ordered by the time_start of their
+ * next record, and the records taken from them in a second heap,
+ * ordered by time_start and then by the order they were read in; the
+ * records are scanned, and stitched, as text, with the iterator of
+ * query.c, so that what is not changed is written as it was read.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "merge.h"
+#include "query.h"
+
+/* members that identify a flow */
+#define MERGE_TUPLE_LEN 5
+
+static const char *const tuple_names[MERGE_TUPLE_LEN] = { "sa", "da", "sp", "dp", "pr" };
+
+/* where each member of the tuple is, for the flow the other way round */
+static const unsigned int tuple_reverse[MERGE_TUPLE_LEN] = { 1, 0, 3, 2, 4 };
+
+/* counts that are added up, and their names in the other direction */
+#define MERGE_NUM_COUNTS 4
+
+static const char *const count_names[MERGE_NUM_COUNTS] = {
+    "bytes_out", "num_pkts_out", "bytes_in", "num_pkts_in"
+};
+static const int count_reverse[MERGE_NUM_COUNTS] = { 2, 3, 0, 1 };
+
+/* what the merge looks at in a record */
+typedef struct fields_ {
+    int timed;                    /* it has a time_start */
+    double start;
+    double end;
+    int has_tuple;                /* it has every member of the tuple */
+    const char *tuple[MERGE_TUPLE_LEN];
+    size_t tuple_len[MERGE_TUPLE_LEN];
+} fields_t;
+
+/* a record waiting to be written */
+typedef struct held_ {
+    query_buf_t text;
+    double start;
+    double end;                   /* latest time_end of its parts */
+    unsigned long seq;            /* order it was read in */
+    size_t pos;                   /* in the heap */
+    uint64_t hash;                /* of key */
+    query_buf_t key;              /* tuple, if it can be stitched to */
+    struct held_ *next;           /* in its bucket of the stitch table */
+    int in_table;
+} held_t;
+
+typedef struct source_ {
+    merge_read_func read;
+    void *arg;
+    const char *rec;              /* next record */
+    size_t len;
+    fields_t f;
+    int done;
+} source_t;
+
+struct merge_ {
+    double lag;
+    size_t max_held;
+    int stitch;
+    source_t *sources;
+    unsigned int num_sources;
+    unsigned int *order;          /* heap of sources that are not done */
+    unsigned int order_len;
+    held_t **heap;                /* heap of records held */
+    size_t heap_len;
+    size_t heap_size;
+    size_t held_bytes;
+    held_t **table;               /* flows that can be stitched to, by tuple */
+    size_t table_size;
+    size_t table_count;
+    double watermark;             /* latest time_start read */
+    double last_out;              /* latest time_start written */
+    int have_out;
+    unsigned long seq;
+    query_buf_t key;
+    query_buf_t text;
+    merge_write_func write;
+    void *write_arg;
+    int failed;                   /* a record could not be written */
+    merge_stats_t stats;
+};
+
+/*
+ * -------------------------------------------------------
+ * Records
+ * -------------------------------------------------------
+ */
+
+static const char *merge_ws (const char *p, const char *end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) {
+        p++;
+    }
+    return p;
+}
+
+static int key_is (const char *key, size_t len, const char *name) {
+    return strlen(name) == len && memcmp(key, name, len) == 0;
+}
+
+/* a number that is the whole of the value */
+static int parse_double (const char *v, const char *end, double *x) {
+    char *e;
+
+    if (v == end || *v == '"') {
+        return 0;
+    }
+    *x = strtod(v, &e);
+    return e == end;
+}
+
+static int parse_uint (const char *v, const char *end, uint64_t *x) {
+    uint64_t n = 0;
+
+    if (v == end) {
+        return 0;
+    }
+    for (; v < end; v++) {
+        if (*v < '0' || *v > '9') {
+            return 0;
+        }
+        n = n * 10 + (*v - '0');
+    }
+    *x = n;
+    return 1;
+}
+
+/* finds the times of rec, and its tuple if want_tuple */
+static void merge_parse (const char *rec, size_t len, fields_t *f, int want_tuple) {
+    const char *end = rec + len, *p = merge_ws(rec, end);
+    const char *key, *value, *value_end;
+    unsigned int found = 0, wanted, i;
+    int has_end = 0;
+    size_t key_len;
+    query_iter_t it;
+
+    f->timed = 0;
+    f->has_tuple = 0;
+    if (p >= end || *p != '{') {
+        return;
+    }
+    wanted = want_tuple ? MERGE_TUPLE_LEN + 2 : 2;
+    query_iter_init(&it, p, end);
+    while (found < wanted && query_next_member(&it, &key, &key_len, &value, &value_end) == 1) {
+        if (key_is(key, key_len, "time_start")) {
+            if (!f->timed) {
+                f->timed = parse_double(value, value_end, &f->start);
+                found++;
+            }
+        } else if (key_is(key, key_len, "time_end")) {
+            if (!has_end) {
+                has_end = parse_double(value, value_end, &f->end);
+                found++;
+            }
+        } else if (want_tuple && key_len == 2) {
+            for (i = 0; i < MERGE_TUPLE_LEN; i++) {
+                if (memcmp(key, tuple_names[i], 2) == 0) {
+                    if (!(f->has_tuple & (1 << i))) {
+                        f->tuple[i] = value;
+                        f->tuple_len[i] = value_end - value;
+                        f->has_tuple |= 1 << i;
+                        found++;
+                    }
+                    break;
+                }
+            }
+        }
+    }
+    f->has_tuple = (f->has_tuple == (1 << MERGE_TUPLE_LEN) - 1);
+    if (f->timed && !has_end) {
+        f->end = f->start;
+    }
+}
+
+/* the tuple of f, either way round, as one string */
+static uint64_t merge_key (query_buf_t *key, const fields_t *f, int reverse) {
+    uint64_t h = 14695981039346656037ULL;
+    unsigned int i, j;
+    size_t k;
+
+    key->len = 0;
+    for (i = 0; i < MERGE_TUPLE_LEN; i++) {
+        j = reverse ? tuple_reverse[i] : i;
+        query_buf_append(key, f->tuple[j], f->tuple_len[j]);
+        query_buf_append(key, "\n", 1);   /* which a JSON value cannot hold */
+    }
+    for (k = 0; k < key->len; k++) {
+        h = (h ^ (unsigned char)key->data[k]) * 1099511628211ULL;
+    }
+    return h;
+}
+
+/* the value of the member name of the object rec, or NULL */
+static const char *find_member (const char *rec, size_t len, const char *name, size_t name_len,
+                                const char **value_end) {
+    const char *end = rec + len;
+    const char *key, *value;
+    size_t key_len;
+    query_iter_t it;
+
+    query_iter_init(&it, merge_ws(rec, end), end);
+    while (query_next_member(&it, &key, &key_len, &value, value_end) == 1) {
+        if (key_len == name_len && memcmp(key, name, name_len) == 0) {
+            return value;
+        }
+    }
+    return NULL;
+}
+
+static void append_uint (query_buf_t *b, uint64_t x) {
+    char tmp[32];
+
+    query_buf_append(b, tmp, snprintf(tmp, sizeof(tmp), "%llu", (unsigned long long)x));
+}
+
+/* adds up two arrays of counts, element by element */
+static int add_arrays (query_buf_t *b, const char *v1, const char *end1,
+                       const char *v2, const char *end2) {
+    const char *e1, *e1_end, *e2, *e2_end;
+    query_iter_t it1, it2;
+    int rc1, rc2, first = 1;
+    uint64_t x1, x2;
+    size_t mark = b->len;
+
+    if (*v1 != '[' || *v2 != '[') {
+        return 0;
+    }
+    query_iter_init(&it1, v1, end1);
+    query_iter_init(&it2, v2, end2);
+    query_buf_append(b, "[", 1);
+    for (;;) {
+        rc1 = query_next_element(&it1, &e1, &e1_end);
+        rc2 = query_next_element(&it2, &e2, &e2_end);
+        if (rc1 <= 0 && rc2 <= 0) {
+            break;
+        }
+        if (!first) {
+            query_buf_append(b, ",", 1);
+        }
+        first = 0;
+        if (rc1 == 1 && rc2 == 1) {
+            if (!parse_uint(e1, e1_end, &x1) || !parse_uint(e2, e2_end, &x2)) {
+                b->len = mark;
+                return 0;
+            }
+            append_uint(b, x1 + x2);
+        } else if (rc1 == 1) {
+            query_buf_append(b, e1, e1_end - e1);
+        } else {
+            query_buf_append(b, e2, e2_end - e2);
+        }
+    }
+    if (rc1 < 0 || rc2 < 0) {
+        b->len = mark;
+        return 0;
+    }
+    query_buf_append(b, "]", 1);
+    return 1;
+}
+
+/* the index of the count named key, or -1 */
+static int count_index (const char *key, size_t key_len) {
+    int i;
+
+    for (i = 0; i < MERGE_NUM_COUNTS; i++) {
+        if (key_is(key, key_len, count_names[i])) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/*
+ * joins the part rec to the flow f1, into out: the members of f1 come
+ * first, in their order, and then those that only the part has; the
+ * counts of a part the other way round are added to the opposite ones
+ */
+static void stitch_text (query_buf_t *out, const char *f1, size_t len1,
+                         const char *rec, size_t len, int reverse) {
+    const char *end1 = f1 + len1, *end2 = rec + len;
+    const char *key, *value, *value_end, *v2, *v2_end, *name;
+    size_t key_len, name_len;
+    query_iter_t it;
+    int first = 1, c, later;
+    uint64_t x1, x2;
+    double d1, d2;
+
+    out->len = 0;
+    query_buf_append(out, "{", 1);
+    query_iter_init(&it, merge_ws(f1, end1), end1);
+    while (query_next_member(&it, &key, &key_len, &value, &value_end) == 1) {
+        if (!first) {
+            query_buf_append(out, ",", 1);
+        }
+        first = 0;
+        query_buf_append(out, key - 1, value - key + 1);
+
+        /* the member of the part that this one is joined with */
+        c = count_index(key, key_len);
+        if (c >= 0) {
+            name = count_names[reverse ? count_reverse[c] : c];
+            name_len = strlen(name);
+        } else if (key_is(key, key_len, "time_start") || key_is(key, key_len, "time_end") ||
+                   key_is(key, key_len, "byte_dist")) {
+            name = key;
+            name_len = key_len;
+        } else {
+            name = NULL;
+            name_len = 0;
+        }
+        v2 = name ? find_member(rec, len, name, name_len, &v2_end) : NULL;
+
+        if (v2 == NULL) {
+            query_buf_append(out, value, value_end - value);
+        } else if (c >= 0) {
+            if (parse_uint(value, value_end, &x1) && parse_uint(v2, v2_end, &x2)) {
+                append_uint(out, x1 + x2);
+            } else {
+                query_buf_append(out, value, value_end - value);
+            }
+        } else if (key_is(key, key_len, "byte_dist")) {
+            if (!add_arrays(out, value, value_end, v2, v2_end)) {
+                query_buf_append(out, value, value_end - value);
+            }
+        } else {
+            /* the earlier start, and the later end, as they were written */
+            later = parse_double(value, value_end, &d1) && parse_double(v2, v2_end, &d2) &&
+                    (key_is(key, key_len, "time_end") ? d2 > d1 : d2 < d1);
+            if (later) {
+                query_buf_append(out, v2, v2_end - v2);
+            } else {
+                query_buf_append(out, value, value_end - value);
+            }
+        }
+    }
+
+    /* members that only the part has */
+    query_iter_init(&it, merge_ws(rec, end2), end2);
+    while (query_next_member(&it, &key, &key_len, &value, &value_end) == 1) {
+        c = count_index(key, key_len);
+        if (c >= 0) {
+            name = count_names[reverse ? count_reverse[c] : c];
+            name_len = strlen(name);
+        } else {
+            name = key;
+            name_len = key_len;
+        }
+        if (find_member(f1, len1, name, name_len, &v2_end) != NULL) {
+            continue;
+        }
+        if (!first) {
+            query_buf_append(out, ",", 1);
+        }
+        first = 0;
+        query_buf_append(out, "\"", 1);
+        query_buf_append(out, name, name_len);
+        query_buf_append(out, "\":", 2);
+        query_buf_append(out, value, value_end - value);
+    }
+    query_buf_append(out, "}", 1);
+}
+
+/*
+ * -------------------------------------------------------
+ * Records held
+ * -------------------------------------------------------
+ */
+
+static int held_before (const held_t *a, const held_t *b) {
+    return a->start < b->start || (a->start == b->start && a->seq < b->seq);
+}
+
+static void heap_set (merge_t *m, size_t i, held_t *h) {
+    m->heap[i] = h;
+    h->pos = i;
+}
+
+static void heap_up (merge_t *m, size_t i) {
+    held_t *h = m->heap[i];
+
+    while (i > 0 && held_before(h, m->heap[(i - 1) / 2])) {
+        heap_set(m, i, m->heap[(i - 1) / 2]);
+        i = (i - 1) / 2;
+    }
+    heap_set(m, i, h);
+}
+
+static void heap_down (merge_t *m, size_t i) {
+    held_t *h = m->heap[i];
+    size_t child;
+
+    while ((child = 2 * i + 1) < m->heap_len) {
+        if (child + 1 < m->heap_len && held_before(m->heap[child + 1], m->heap[child])) {
+            child++;
+        }
+        if (!held_before(m->heap[child], h)) {
+            break;
+        }
+        heap_set(m, i, m->heap[child]);
+        i = child;
+    }
+    heap_set(m, i, h);
+}
+
+static int table_grow (merge_t *m) {
+    size_t size = m->table_size ? 2 * m->table_size : 1024, i;
+    held_t **table = calloc(size, sizeof(held_t *));
+    held_t *h, *next;
+
+    if (table == NULL) {
+        return -1;
+    }
+    for (i = 0; i < m->table_size; i++) {
+        for (h = m->table[i]; h != NULL; h = next) {
+            next = h->next;
+            h->next = table[h->hash & (size - 1)];
+            table[h->hash & (size - 1)] = h;
+        }
+    }
+    free(m->table);
+    m->table = table;
+    m->table_size = size;
+    return 0;
+}
+
+static held_t *table_find (merge_t *m, uint64_t hash, const query_buf_t *key) {
+    held_t *h;
+
+    if (m->table_size == 0) {
+        return NULL;
+    }
+    for (h = m->table[hash & (m->table_size - 1)]; h != NULL; h = h->next) {
+        if (h->hash == hash && h->key.len == key->len &&
+            memcmp(h->key.data, key->data, key->len) == 0) {
+            return h;
+        }
+    }
+    return NULL;
+}
+
+static void table_remove (merge_t *m, held_t *h) {
+    held_t **p = &m->table[h->hash & (m->table_size - 1)];
+
+    while (*p != h) {
+        p = &(*p)->next;
+    }
+    *p = h->next;
+    h->in_table = 0;
+    m->table_count--;
+}
+
+static int table_insert (merge_t *m, held_t *h) {
+    held_t *old = table_find(m, h->hash, &h->key);
+
+    if (old != NULL) {
+        /* the older flow can no longer be continued */
+        table_remove(m, old);
+    }
+    if (m->table_count >= m->table_size && table_grow(m) != 0) {
+        return -1;
+    }
+    h->next = m->table[h->hash & (m->table_size - 1)];
+    m->table[h->hash & (m->table_size - 1)] = h;
+    h->in_table = 1;
+    m->table_count++;
+    return 0;
+}
+
+/* copies a record into b, taking no more memory than it needs */
+static int held_copy (query_buf_t *b, const char *data, size_t len) {
+    b->data = malloc(len ? len : 1);
+    if (b->data == NULL) {
+        return -1;
+    }
+    memcpy(b->data, data, len);
+    b->len = b->size = len;
+    return 0;
+}
+
+/* memory that a held record takes */
+static size_t held_bytes (const held_t *h) {
+    return sizeof(held_t) + h->text.size + h->key.size;
+}
+
+static void held_free (held_t *h) {
+    query_buf_free(&h->text);
+    query_buf_free(&h->key);
+    free(h);
+}
+
+static void merge_write (merge_t *m, const char *rec, size_t len) {
+    if (!m->failed && m->write(m->write_arg, rec, len) != 0) {
+        m->failed = 1;
+    }
+    m->stats.records_out++;
+}
+
+/* writes a timed record, noting whether it is out of order */
+static void merge_write_timed (merge_t *m, const char *rec, size_t len, double start) {
+    if (m->have_out && start < m->last_out) {
+        m->stats.late++;
+    } else {
+        m->last_out = start;
+        m->have_out = 1;
+    }
+    merge_write(m, rec, len);
+}
+
+/* writes the records that can no longer be overtaken, or all of them */
+static void merge_emit (merge_t *m, int all) {
+    held_t *h;
+    double due;
+
+    while (m->heap_len) {
+        h = m->heap[0];
+
+        /* a flow that may be continued waits for its continuation, too */
+        due = m->stitch && h->key.len ? h->end + m->lag : h->start;
+        if (!all && m->held_bytes <= m->max_held && due + m->lag >= m->watermark) {
+            break;
+        }
+        if (--m->heap_len) {
+            heap_set(m, 0, m->heap[m->heap_len]);
+            heap_down(m, 0);
+        }
+        if (h->in_table) {
+            table_remove(m, h);
+        }
+        m->held_bytes -= held_bytes(h);
+        merge_write_timed(m, h->text.data, h->text.len, h->start);
+        held_free(h);
+    }
+}
+
+/* joins the part rec to the flow h */
+static void merge_stitch (merge_t *m, held_t *h, const char *rec, size_t len,
+                          const fields_t *f, int reverse) {
+    query_buf_t tmp;
+
+    stitch_text(&m->text, h->text.data, h->text.len, rec, len, reverse);
+    m->held_bytes -= held_bytes(h);
+    tmp = h->text;
+    h->text = m->text;
+    m->text = tmp;
+    m->held_bytes += held_bytes(h);
+    if (f->end > h->end) {
+        h->end = f->end;
+    }
+    if (f->start < h->start) {
+        h->start = f->start;
+        heap_up(m, h->pos);
+    }
+    m->stats.stitched++;
+}
+
+/* takes the next record of a source */
+static int merge_take (merge_t *m, const source_t *s) {
+    const fields_t *f = &s->f;
+    held_t *h;
+    uint64_t hash = 0;
+    int reverse;
+
+    m->stats.records_in++;
+    if (!f->timed) {
+        m->stats.untimed++;
+        merge_write(m, s->rec, s->len);
+        return 0;
+    }
+    if (f->start > m->watermark) {
+        m->watermark = f->start;
+    }
+    if (m->lag <= 0 && !m->stitch) {
+        /* nothing is held, so the sources are just interleaved */
+        merge_write_timed(m, s->rec, s->len, f->start);
+        return 0;
+    }
+
+    if (m->stitch && f->has_tuple) {
+        for (reverse = 0; reverse < 2; reverse++) {
+            hash = merge_key(&m->key, f, reverse);
+            h = table_find(m, hash, &m->key);
+            if (h != NULL && f->start <= h->end + m->lag) {
+                merge_stitch(m, h, s->rec, s->len, f, reverse);
+                return 0;
+            }
+        }
+        hash = merge_key(&m->key, f, 0);
+    }
+
+    h = calloc(1, sizeof(held_t));
+    if (h == NULL || held_copy(&h->text, s->rec, s->len) != 0) {
+        free(h);
+        return -1;
+    }
+    h->start = f->start;
+    h->end = f->end;
+    h->seq = m->seq++;
+    if (m->stitch && f->has_tuple) {
+        h->hash = hash;
+        if (held_copy(&h->key, m->key.data, m->key.len) != 0 || table_insert(m, h) != 0) {
+            held_free(h);
+            return -1;
+        }
+    }
+    if (m->heap_len == m->heap_size) {
+        size_t size = m->heap_size ? 2 * m->heap_size : 1024;
+        held_t **heap = realloc(m->heap, size * sizeof(held_t *));
+
+        if (heap == NULL) {
+            if (h->in_table) {
+                table_remove(m, h);
+            }
+            held_free(h);
+            return -1;
+        }
+        m->heap = heap;
+        m->heap_size = size;
+    }
+    m->heap_len++;
+    heap_set(m, m->heap_len - 1, h);
+    heap_up(m, m->heap_len - 1);
+    m->held_bytes += held_bytes(h);
+    return 0;
+}
+
+/*
+ * -------------------------------------------------------
+ * Sources
+ * -------------------------------------------------------
+ */
+
+/* the sources are taken from in the order of their next time_start */
+static int source_before (const merge_t *m, unsigned int a, unsigned int b) {
+    const source_t *sa = &m->sources[a], *sb = &m->sources[b];
+
+    if (!sa->f.timed || !sb->f.timed) {
+        return !sa->f.timed && (sb->f.timed || a < b);
+    }
+    return sa->f.start < sb->f.start || (sa->f.start == sb->f.start && a < b);
+}
+
+static void order_down (merge_t *m, unsigned int i) {
+    unsigned int s = m->order[i], child;
+
+    while ((child = 2 * i + 1) < m->order_len) {
+        if (child + 1 < m->order_len && source_before(m, m->order[child + 1], m->order[child])) {
+            child++;
+        }
+        if (!source_before(m, m->order[child], s)) {
+            break;
+        }
+        m->order[i] = m->order[child];
+        i = child;
+    }
+    m->order[i] = s;
+}
+
+/* reads the next record of a source, skipping empty lines */
+static void source_advance (merge_t *m, source_t *s) {
+    const char *p;
+    int rc;
+
+    do {
+        rc = s->read(s->arg, &s->rec, &s->len);
+        if (rc <= 0) {
+            if (rc < 0) {
+                m->stats.failed_sources++;
+            }
+            s->done = 1;
+            return;
+        }
+        p = merge_ws(s->rec, s->rec + s->len);
+    } while (p == s->rec + s->len);
+    merge_parse(s->rec, s->len, &s->f, m->stitch);
+}
+
+/*
+ * -------------------------------------------------------
+ * Interface
+ * -------------------------------------------------------
+ */
+
+/**
+ * \fn merge_t *merge_new (double lag, size_t max_held, int stitch)
+ * \brief Create a merge.
+ * \param lag seconds that a source may be out of time order by; 0
+ *        interleaves the sources without reordering anything
+ * \param max_held bytes of records that may be held at once
+ * \param stitch nonzero to join the parts of flows
+ * \return the merge, or NULL if out of memory
+ */
+merge_t *merge_new (double lag, size_t max_held, int stitch) {
+    merge_t *m = calloc(1, sizeof(merge_t));
+
+    if (m == NULL) {
+        return NULL;
+    }
+    m->lag = lag < 0 ? 0 : lag;
+    m->max_held = max_held;
+    m->stitch = stitch;
+    m->watermark = -1e300;
+    return m;
+}
+
+/**
+ * \fn int merge_add_source (merge_t *m, merge_read_func read, void *source)
+ * \brief Add a source of records to the merge, before merge_run().
+ * \param m merge
+ * \param read reads the next record of the source
+ * \param source handed to read
+ * \return 0, or -1 if out of memory
+ */
+int merge_add_source (merge_t *m, merge_read_func read, void *source) {
+    source_t *sources = realloc(m->sources, (m->num_sources + 1) * sizeof(source_t));
+
+    if (sources == NULL) {
+        return -1;
+    }
+    m->sources = sources;
+    memset(&sources[m->num_sources], 0, sizeof(source_t));
+    sources[m->num_sources].read = read;
+    sources[m->num_sources].arg = source;
+    m->num_sources++;
+    return 0;
+}
+
+/**
+ * \fn int merge_run (merge_t *m, merge_write_func write, void *arg)
+ * \brief Read every source to its end, and write their records in
+ *        order of time_start.
+ * \param m merge
+ * \param write takes each record of the output
+ * \param arg handed to write
+ * \return 0, or -1 if out of memory, a source could not be read to its
+ *         end, or a record could not be written
+ */
+int merge_run (merge_t *m, merge_write_func write, void *arg) {
+    unsigned int i;
+    source_t *s;
+    int rc = 0;
+
+    m->write = write;
+    m->write_arg = arg;
+    m->order = malloc((m->num_sources + 1) * sizeof(unsigned int));
+    if (m->order == NULL) {
+        return -1;
+    }
+    m->order_len = 0;
+    for (i = 0; i < m->num_sources; i++) {
+        source_advance(m, &m->sources[i]);
+        if (!m->sources[i].done) {
+            m->order[m->order_len++] = i;
+        }
+    }
+    for (i = m->order_len / 2; i-- > 0; ) {
+        order_down(m, i);
+    }
+
+    while (m->order_len && rc == 0 && !m->failed) {
+        s = &m->sources[m->order[0]];
+        rc = merge_take(m, s);
+        source_advance(m, s);
+        if (s->done) {
+            m->order[0] = m->order[--m->order_len];
+        }
+        if (m->order_len) {
+            order_down(m, 0);
+        }
+        merge_emit(m, 0);
+    }
+    merge_emit(m, 1);
+
+    if (rc != 0 || m->failed || m->stats.failed_sources) {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * \fn void merge_get_stats (const merge_t *m, merge_stats_t *stats)
+ * \brief The counters of a merge.
+ * \param m merge
+ * \param stats where the counters are copied to
+ * \return none
+ */
+void merge_get_stats (const merge_t *m, merge_stats_t *stats) {
+    *stats = m->stats;
+}
+
+/**
+ * \fn void merge_free (merge_t *m)
+ * \brief Free a merge, and the records it still holds.
+ * \param m merge
+ * \return none
+ */
+void merge_free (merge_t *m) {
+    size_t i;
+
+    if (m == NULL) {
+        return;
+    }
+    for (i = 0; i < m->heap_len; i++) {
+        held_free(m->heap[i]);
+    }
+    free(m->heap);
+    free(m->table);
+    free(m->order);
+    free(m->sources);
+    query_buf_free(&m->key);
+    query_buf_free(&m->text);
+    free(m);
+}
+
+/*
+ * -------------------------------------------------------
+ * Unit test
+ * -------------------------------------------------------
+ */
+
+typedef struct test_source_ {
+    const char *const *recs;
+    unsigned int next;
+} test_source_t;
+
+static int test_read (void *source, const char **rec, size_t *len) {
+    test_source_t *t = source;
+
+    if (t->recs[t->next] == NULL) {
+        return 0;
+    }
+    *rec = t->recs[t->next++];
+    *len = strlen(*rec);
+    return 1;
+}
+
+static int test_write (void *arg, const char *rec, size_t len) {
+    query_buf_t *out = arg;
+
+    if (query_buf_append(out, rec, len) != 0 || query_buf_append(out, "\n", 1) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/* merges the lists of records, and checks the output and the counts */
+static int merge_test_expect (double lag, size_t max_held, int stitch,
+                              const char *const *a, const char *const *b,
+                              const char *expected, unsigned long stitched,
+                              unsigned long late) {
+    test_source_t sa = { a, 0 }, sb = { b, 0 };
+    query_buf_t out = { NULL, 0, 0 };
+    merge_stats_t stats;
+    merge_t *m;
+    int fails = 0;
+
+    m = merge_new(lag, max_held, stitch);
+    if (m == NULL || merge_add_source(m, test_read, &sa) != 0 ||
+        merge_add_source(m, test_read, &sb) != 0 || merge_run(m, test_write, &out) != 0) {
+        fprintf(stderr, "merge_unit_test: merge failed\n");
+        merge_free(m);
+        query_buf_free(&out);
+        return 1;
+    }
+    merge_get_stats(m, &stats);
+    if (out.len != strlen(expected) || (out.len && memcmp(out.data, expected, out.len) != 0)) {
+        fprintf(stderr, "merge_unit_test: expected\n%sbut got\n%.*s", expected, (int)out.len,
+                out.data ? out.data : "");
+        fails++;
+    }
+    if (stats.stitched != stitched || stats.late != late) {
+        fprintf(stderr, "merge_unit_test: %lu stitched and %lu late, expected %lu and %lu\n",
+                stats.stitched, stats.late, stitched, late);
+        fails++;
+    }
+    merge_free(m);
+    query_buf_free(&out);
+    return fails;
+}
+
+/**
+ * \fn int merge_unit_test (void)
+ * \brief Test the merge.
+ * \return the number of failures
+ */
+int merge_unit_test (void) {
+    static const char *const a[] = {
+        "{\"version\":\"a\"}",
+        "{\"sa\":\"10.0.0.1\",\"da\":\"10.0.0.2\",\"sp\":1,\"dp\":2,\"pr\":6,\"time_start\":1,\"time_end\":5}",
+        "{\"sa\":\"10.0.0.1\",\"da\":\"10.0.0.3\",\"sp\":1,\"dp\":2,\"pr\":6,\"time_start\":4,\"time_end\":4}",
+        "{\"sa\":\"10.0.0.1\",\"da\":\"10.0.0.4\",\"sp\":1,\"dp\":2,\"pr\":6,\"time_start\":3,\"time_end\":9}",
+        NULL
+    };
+    static const char *const b[] = {
+        "{\"version\":\"b\"}",
+        "",
+        "{\"sa\":\"10.0.0.5\",\"da\":\"10.0.0.6\",\"sp\":1,\"dp\":2,\"pr\":17,\"time_start\":2,\"time_end\":2}",
+        "{\"sa\":\"10.0.0.5\",\"da\":\"10.0.0.6\",\"sp\":1,\"dp\":2,\"pr\":17,\"time_start\":6,\"time_end\":6}",
+        NULL
+    };
+    static const char *const split1[] = {
+        "{\"sa\":\"10.0.0.1\",\"da\":\"10.0.0.2\",\"sp\":1,\"dp\":2,\"pr\":6,\"bytes_out\":10,"
+        "\"num_pkts_out\":1,\"time_start\":100.5,\"time_end\":110.25,\"byte_dist\":[1,2]}",
+        NULL
+    };
+    static const char *const split2[] = {
+        "{\"sa\":\"10.0.0.2\",\"da\":\"10.0.0.1\",\"sp\":2,\"dp\":1,\"pr\":6,\"bytes_out\":5,"
+        "\"num_pkts_out\":2,\"time_start\":111,\"time_end\":120.75,\"byte_dist\":[1,1,4],\"x\":[1]}",
+        "{\"sa\":\"10.0.0.1\",\"da\":\"10.0.0.2\",\"sp\":1,\"dp\":2,\"pr\":6,\"bytes_out\":7,"
+        "\"time_start\":121,\"time_end\":122}",
+        "{\"sa\":\"10.0.0.1\",\"da\":\"10.0.0.2\",\"sp\":1,\"dp\":2,\"pr\":6,\"bytes_out\":1,"
+        "\"time_start\":200,\"time_end\":200}",
+        NULL
+    };
+    static const char *const none[] = { NULL };
+    int num_fails = 0;
+
+    /* interleaved by time_start, with the lines without one first */
+    num_fails += merge_test_expect(10, 1 << 20, 0, a, b,
+        "{\"version\":\"a\"}\n"
+        "{\"version\":\"b\"}\n"
+        "{\"sa\":\"10.0.0.1\",\"da\":\"10.0.0.2\",\"sp\":1,\"dp\":2,\"pr\":6,\"time_start\":1,\"time_end\":5}\n"
+        "{\"sa\":\"10.0.0.5\",\"da\":\"10.0.0.6\",\"sp\":1,\"dp\":2,\"pr\":17,\"time_start\":2,\"time_end\":2}\n"
+        "{\"sa\":\"10.0.0.1\",\"da\":\"10.0.0.4\",\"sp\":1,\"dp\":2,\"pr\":6,\"time_start\":3,\"time_end\":9}\n"
+        "{\"sa\":\"10.0.0.1\",\"da\":\"10.0.0.3\",\"sp\":1,\"dp\":2,\"pr\":6,\"time_start\":4,\"time_end\":4}\n"
+        "{\"sa\":\"10.0.0.5\",\"da\":\"10.0.0.6\",\"sp\":1,\"dp\":2,\"pr\":17,\"time_start\":6,\"time_end\":6}\n",
+        0, 0);
+
+    /* without a lag, the sources are only interleaved */
+    num_fails += merge_test_expect(0, 1 << 20, 0, a, b,
+        "{\"version\":\"a\"}\n"
+        "{\"version\":\"b\"}\n"
+        "{\"sa\":\"10.0.0.1\",\"da\":\"10.0.0.2\",\"sp\":1,\"dp\":2,\"pr\":6,\"time_start\":1,\"time_end\":5}\n"
+        "{\"sa\":\"10.0.0.5\",\"da\":\"10.0.0.6\",\"sp\":1,\"dp\":2,\"pr\":17,\"time_start\":2,\"time_end\":2}\n"
+        "{\"sa\":\"10.0.0.1\",\"da\":\"10.0.0.3\",\"sp\":1,\"dp\":2,\"pr\":6,\"time_start\":4,\"time_end\":4}\n"
+        "{\"sa\":\"10.0.0.1\",\"da\":\"10.0.0.4\",\"sp\":1,\"dp\":2,\"pr\":6,\"time_start\":3,\"time_end\":9}\n"
+        "{\"sa\":\"10.0.0.5\",\"da\":\"10.0.0.6\",\"sp\":1,\"dp\":2,\"pr\":17,\"time_start\":6,\"time_end\":6}\n",
+        0, 1);
+
+    /* with no room to hold records, the same */
+    num_fails += merge_test_expect(10, 0, 0, a, b,
+        "{\"version\":\"a\"}\n"
+        "{\"version\":\"b\"}\n"
+        "{\"sa\":\"10.0.0.1\",\"da\":\"10.0.0.2\",\"sp\":1,\"dp\":2,\"pr\":6,\"time_start\":1,\"time_end\":5}\n"
+        "{\"sa\":\"10.0.0.5\",\"da\":\"10.0.0.6\",\"sp\":1,\"dp\":2,\"pr\":17,\"time_start\":2,\"time_end\":2}\n"
+        "{\"sa\":\"10.0.0.1\",\"da\":\"10.0.0.3\",\"sp\":1,\"dp\":2,\"pr\":6,\"time_start\":4,\"time_end\":4}\n"
+        "{\"sa\":\"10.0.0.1\",\"da\":\"10.0.0.4\",\"sp\":1,\"dp\":2,\"pr\":6,\"time_start\":3,\"time_end\":9}\n"
+        "{\"sa\":\"10.0.0.5\",\"da\":\"10.0.0.6\",\"sp\":1,\"dp\":2,\"pr\":17,\"time_start\":6,\"time_end\":6}\n",
+        0, 1);
+
+    /* the parts of a flow, either way round, and a later flow with the same tuple */
+    num_fails += merge_test_expect(5, 1 << 20, 1, split1, split2,
+        "{\"sa\":\"10.0.0.1\",\"da\":\"10.0.0.2\",\"sp\":1,\"dp\":2,\"pr\":6,\"bytes_out\":17,"
+        "\"num_pkts_out\":1,\"time_start\":100.5,\"time_end\":122,\"byte_dist\":[2,3,4],"
+        "\"bytes_in\":5,\"num_pkts_in\":2,\"x\":[1]}\n"
+        "{\"sa\":\"10.0.0.1\",\"da\":\"10.0.0.2\",\"sp\":1,\"dp\":2,\"pr\":6,\"bytes_out\":1,"
+        "\"time_start\":200,\"time_end\":200}\n",
+        2, 0);
+
+    /* too far apart to be stitched */
+    num_fails += merge_test_expect(0.5, 1 << 20, 1, split1, split2,
+        "{\"sa\":\"10.0.0.1\",\"da\":\"10.0.0.2\",\"sp\":1,\"dp\":2,\"pr\":6,\"bytes_out\":10,"
+        "\"num_pkts_out\":1,\"time_start\":100.5,\"time_end\":110.25,\"byte_dist\":[1,2]}\n"
+        "{\"sa\":\"10.0.0.2\",\"da\":\"10.0.0.1\",\"sp\":2,\"dp\":1,\"pr\":6,\"bytes_out\":5,"
+        "\"num_pkts_out\":2,\"time_start\":111,\"time_end\":122,\"byte_dist\":[1,1,4],\"x\":[1],"
+        "\"bytes_in\":7}\n"
+        "{\"sa\":\"10.0.0.1\",\"da\":\"10.0.0.2\",\"sp\":1,\"dp\":2,\"pr\":6,\"bytes_out\":1,"
+        "\"time_start\":200,\"time_end\":200}\n",
+        1, 0);
+
+    num_fails += merge_test_expect(10, 1 << 20, 1, none, none, "", 0, 0);
+
+    return num_fails;
+}
@@ -0,0 +1,2668 @@
+/*
+ *
+ * Copyright (c) 2018 Cisco Systems, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ *
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file output.c
+ *
+ * \brief buffered, optionally compressed, output
+ *
+ * Every zprintf() used to be a separate gzprintf() call, so each
+ * field of each flow record paid for a trip through the compressor's
+ * printf and input buffering.  The zfile now collects output in its
+ * own large buffer and hands it to the underlying file in whole
+ * blocks; the formatters below append the common values directly.
+ * When the buffers are queued to a writer thread instead (zasync),
+ * the thread producing the records never waits on the compressor or
+ * the disk.  Written as independent blocks, the output can also be
+ * compressed by several threads at once (zconfigure).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include "pthread.h"
+#include "output.h"
+#include "shm_output.h"
+
+#ifdef WIN32
+#include <windows.h>
+#include "ws2tcpip.h"
+#define fileno _fileno
+#else
+#include <unistd.h>
+#include <arpa/inet.h>
+#endif
+
+/* atomic operations, for the counters shared between threads */
+#ifdef WIN32
+#define zfile_load(p) InterlockedCompareExchange((LONG volatile *)(p), 0, 0)
+#define zfile_store(p, v) InterlockedExchange((LONG volatile *)(p), (v))
+#define zfile_add(p, v) InterlockedExchangeAdd((LONG volatile *)(p), (v))
+#else
+#define zfile_load(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define zfile_store(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define zfile_add(p, v) __atomic_add_fetch((p), (v), __ATOMIC_RELAXED)
+#endif
+
+/*
+ * The underlying file, selected at compile time
+ */
+#if (COMPRESSED_OUTPUT == 0) || defined(USE_ZSTD)
+
+#define raw_open(fname, mode)      fopen(fname, mode)
+#define raw_attach(fp, mode)       (fp)
+#define raw_close(raw)             fclose(raw)
+
+static int raw_write (zfile_raw raw, const char *data, size_t len) {
+    return fwrite(data, 1, len, raw) == len ? 0 : -1;
+}
+
+static int raw_flush (zfile_raw raw) {
+    return fflush(raw);
+}
+
+#elif defined(USE_BZIP2)
+
+#define raw_open(fname, mode)      BZ2_bzopen(fname, mode)
+#define raw_attach(fp, mode)       BZ2_bzdopen(fileno(fp), mode)
+
+static int raw_write (zfile_raw raw, const char *data, size_t len) {
+    return BZ2_bzwrite(raw, (void *)data, (int)len) == (int)len ? 0 : -1;
+}
+
+static int raw_flush (zfile_raw raw) {
+    return BZ2_bzflush(raw);
+}
+
+static int raw_close (zfile_raw raw) {
+    BZ2_bzclose(raw);
+    return 0;
+}
+
+#else
+
+#define raw_open(fname, mode)      gzopen(fname, mode)
+#define raw_attach(fp, mode)       gzdopen(fileno(fp), mode)
+#define raw_close(raw)             gzclose(raw)
+
+static int raw_write (zfile_raw raw, const char *data, size_t len) {
+    return gzwrite(raw, data, (unsigned int)len) == (int)len ? 0 : -1;
+}
+
+static int raw_flush (zfile_raw raw) {
+    return gzflush(raw, Z_SYNC_FLUSH) == Z_OK ? 0 : -1;
+}
+
+#endif
+
+/*
+ * Block compression
+ *
+ * Instead of one compressed stream, the file can be a sequence of
+ * independently compressed blocks, one per buffer: gzip members, or
+ * zstd frames.  Decompressors read such a sequence as if it were one
+ * stream, and the blocks can be compressed in parallel.  bzip2 is left
+ * out, as the Python bz2 module (and thus sleuth) stops reading after
+ * the first stream.
+ *
+ * Each gzip member carries its own size in an extra field of its
+ * header (subfield 'J' 'B', four bytes, little-endian), as BGZF does,
+ * so that a reader such as joy-query can find the members without
+ * decompressing them, and decompress them in parallel too.
+ * Decompressors skip the extra field.
+ *
+ * The block codec (zcodec) is also built without COMPRESSED_OUTPUT,
+ * for the tools that read and write joy output; zblock_size() is the
+ * reading side of the same format.
+ */
+static long zfile_last_id = 0;         /* the id of the newest file */
+static int zfile_level = 0;            /* 0 is the library default */
+static unsigned int zfile_threads = 0; /* compression threads per file */
+static shm_ring_t *zfile_shm = NULL;    /* ring that files publish records to */
+
+#if defined(USE_ZSTD)
+#define ZFILE_CODEC_ZSTD 1
+#elif defined(USE_GZIP) || ((COMPRESSED_OUTPUT != 0) && !defined(USE_BZIP2))
+#define ZFILE_CODEC_GZIP 1
+#endif
+
+#if (COMPRESSED_OUTPUT == 0) || (defined(USE_BZIP2) && !defined(USE_ZSTD))
+#define zfile_block_mode() 0
+#elif defined(USE_ZSTD)
+#define zfile_block_mode() 1
+#else
+#define zfile_block_mode() (zfile_threads > 0)
+#endif
+
+#define ZFILE_COMPRESSED_SIZE zfile_codec_bound(ZFILE_BUFFER_SIZE)
+
+#if defined(ZFILE_CODEC_ZSTD)
+
+#include <zstd.h>
+
+struct zfile_codec_ {
+    ZSTD_CCtx *cctx;
+    int level;
+    char *out;                    /* ZFILE_COMPRESSED_SIZE bytes, or NULL */
+};
+
+static struct zfile_codec_ *zfile_codec_new (int level, size_t out_size) {
+    struct zfile_codec_ *c = calloc(1, sizeof(struct zfile_codec_));
+
+    if (c == NULL) {
+        return NULL;
+    }
+    c->level = level;
+    c->cctx = ZSTD_createCCtx();
+    if (out_size) {
+        c->out = malloc(out_size);
+    }
+    if (c->cctx == NULL || (out_size && c->out == NULL)) {
+        ZSTD_freeCCtx(c->cctx);
+        free(c->out);
+        free(c);
+        return NULL;
+    }
+    return c;
+}
+
+/* returns the size of the frame, or 0 on failure */
+static size_t zfile_compress (struct zfile_codec_ *c, const char *in, size_t len,
+                              char *out, size_t size) {
+    size_t n = ZSTD_compressCCtx(c->cctx, out, size, in, len, c->level);
+
+    return ZSTD_isError(n) ? 0 : n;
+}
+
+static void zfile_codec_free (struct zfile_codec_ *c) {
+    if (c != NULL) {
+        ZSTD_freeCCtx(c->cctx);
+        free(c->out);
+        free(c);
+    }
+}
+
+static size_t zfile_codec_bound (size_t len) {
+    return ZSTD_compressBound(len);
+}
+
+static int zfile_block_size (const char *data, size_t len, size_t *size, size_t *expected) {
+    unsigned long long n = ZSTD_getFrameContentSize(data, len);
+    size_t frame;
+
+    if (n == ZSTD_CONTENTSIZE_ERROR) {
+        /* shorter than the largest frame header, or not a frame */
+        return len < 18 ? 0 : -1;
+    }
+    if (n == ZSTD_CONTENTSIZE_UNKNOWN) {
+        return -1;
+    }
+    frame = ZSTD_findFrameCompressedSize(data, len);
+    if (ZSTD_isError(frame)) {
+        return 0;
+    }
+    *size = frame;
+    *expected = (size_t)n;
+    return 1;
+}
+
+#elif defined(ZFILE_CODEC_GZIP)
+
+#include <zlib.h>
+
+/* where the size of a member is, in its header */
+#define ZFILE_MEMBER_SIZE_OFFSET 16
+
+struct zfile_codec_ {
+    z_stream zs;
+    gz_header header;
+    unsigned char extra[8];       /* 'J' 'B', length 4, size of the member */
+    char *out;                    /* ZFILE_COMPRESSED_SIZE bytes, or NULL */
+};
+
+static struct zfile_codec_ *zfile_codec_new (int level, size_t out_size) {
+    struct zfile_codec_ *c = calloc(1, sizeof(struct zfile_codec_));
+
+    if (level > 9) {
+        level = 9;
+    }
+    if (c == NULL) {
+        return NULL;
+    }
+    /* a window of 15 bits, plus 16 for a gzip header and trailer */
+    if (deflateInit2(&c->zs, level ? level : Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                     15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        free(c);
+        return NULL;
+    }
+    c->extra[0] = 'J';
+    c->extra[1] = 'B';
+    c->extra[2] = 4;
+    c->header.extra = c->extra;
+    c->header.extra_len = sizeof(c->extra);
+    c->header.os = 3;             /* unix, as gzdopen() writes */
+    if (out_size) {
+        c->out = malloc(out_size);
+        if (c->out == NULL) {
+            deflateEnd(&c->zs);
+            free(c);
+            return NULL;
+        }
+    }
+    return c;
+}
+
+/* returns the size of the gzip member, or 0 on failure */
+static size_t zfile_compress (struct zfile_codec_ *c, const char *in, size_t len,
+                              char *out, size_t size) {
+    size_t n;
+
+    if (deflateReset(&c->zs) != Z_OK || deflateSetHeader(&c->zs, &c->header) != Z_OK) {
+        return 0;
+    }
+    c->zs.next_in = (Bytef *)in;
+    c->zs.avail_in = (uInt)len;
+    c->zs.next_out = (Bytef *)out;
+    c->zs.avail_out = (uInt)size;
+    if (deflate(&c->zs, Z_FINISH) != Z_STREAM_END) {
+        return 0;
+    }
+    n = size - c->zs.avail_out;
+
+    /* the header has no CRC, so the size can be filled in afterwards */
+    out[ZFILE_MEMBER_SIZE_OFFSET] = (char)(n & 0xff);
+    out[ZFILE_MEMBER_SIZE_OFFSET + 1] = (char)((n >> 8) & 0xff);
+    out[ZFILE_MEMBER_SIZE_OFFSET + 2] = (char)((n >> 16) & 0xff);
+    out[ZFILE_MEMBER_SIZE_OFFSET + 3] = (char)((n >> 24) & 0xff);
+    return n;
+}
+
+static void zfile_codec_free (struct zfile_codec_ *c) {
+    if (c != NULL) {
+        deflateEnd(&c->zs);
+        free(c->out);
+        free(c);
+    }
+}
+
+static size_t zfile_codec_bound (size_t len) {
+    /* deflate's worst case, plus the header with its extra field */
+    return len + len / 8 + 1024;
+}
+
+static int zfile_block_size (const char *data, size_t len, size_t *size, size_t *expected) {
+    const unsigned char *b = (const unsigned char *)data, *x;
+    size_t xlen, i, n = 0;
+
+    if (len < 12) {
+        return 0;
+    }
+    if (b[0] != 0x1f || b[1] != 0x8b || b[2] != 8 || !(b[3] & 4)) {
+        return -1;
+    }
+    xlen = b[10] | (b[11] << 8);
+    if (len < 12 + xlen) {
+        return 0;
+    }
+    for (i = 0; i + 4 <= xlen; i += 4 + (x[2] | (x[3] << 8))) {
+        x = b + 12 + i;
+        if (x[0] == 'J' && x[1] == 'B' && x[2] == 4 && x[3] == 0 && i + 8 <= xlen) {
+            n = x[4] | (x[5] << 8) | (x[6] << 16) | ((size_t)x[7] << 24);
+            break;
+        }
+    }
+    if (n < 12 + xlen + 8) {
+        return -1;
+    }
+    if (len < n) {
+        return 0;
+    }
+    /* the trailer ends with the size of the data, modulo 2^32 */
+    b += n - 4;
+    *size = n;
+    *expected = b[0] | (b[1] << 8) | (b[2] << 16) | ((size_t)b[3] << 24);
+    return 1;
+}
+
+#else
+
+struct zfile_codec_ {
+    char *out;
+};
+
+static struct zfile_codec_ *zfile_codec_new (int level, size_t out_size) {
+    return NULL;
+}
+
+static size_t zfile_compress (struct zfile_codec_ *c, const char *in, size_t len,
+                              char *out, size_t size) {
+    return 0;
+}
+
+static void zfile_codec_free (struct zfile_codec_ *c) {
+    free(c);
+}
+
+static size_t zfile_codec_bound (size_t len) {
+    return 0;
+}
+
+static int zfile_block_size (const char *data, size_t len, size_t *size, size_t *expected) {
+    return -1;
+}
+
+#endif
+
+/**
+ * \fn zcodec zcodec_new (int level)
+ * \brief Make a compressor of independent blocks, in the format of the
+ * blocks that zfiles write (see zconfigure()).
+ * \param level compression level, 0 for the library default
+ * \return the compressor, or NULL on failure or when there is no block
+ *         format (bzip2, or no compression library)
+ */
+zcodec zcodec_new (int level) {
+    return zfile_codec_new(level, 0);
+}
+
+/**
+ * \fn size_t zcodec_compress (zcodec c, const char *in, size_t len, char *out, size_t size)
+ * \brief Compress \p len bytes into one block.
+ * \param out where the block goes
+ * \param size size of \p out, which should be zcodec_bound(len)
+ * \return the size of the block, or 0 on failure
+ */
+size_t zcodec_compress (zcodec c, const char *in, size_t len, char *out, size_t size) {
+    return zfile_compress(c, in, len, out, size);
+}
+
+/**
+ * \fn void zcodec_free (zcodec c)
+ * \brief Free a compressor from zcodec_new().
+ */
+void zcodec_free (zcodec c) {
+    zfile_codec_free(c);
+}
+
+/**
+ * \fn size_t zcodec_bound (size_t len)
+ * \brief The largest block that \p len bytes compress into.
+ */
+size_t zcodec_bound (size_t len) {
+    return zfile_codec_bound(len);
+}
+
+/**
+ * \fn int zblock_size (const char *data, size_t len, size_t *size, size_t *expected)
+ * \brief Find the size of the block that \p data starts with, as
+ * zcodec_compress() writes it, without decompressing it.
+ *
+ * \param data start of a block
+ * \param len bytes available at \p data
+ * \param size set to the size of the block
+ * \param expected set to the size of the data in the block, which for
+ *        gzip is only known modulo 2^32
+ * \return 1 when the whole block is in \p data, 0 when more bytes are
+ *         needed to tell, or -1 when \p data does not start with a
+ *         block that records its size
+ */
+int zblock_size (const char *data, size_t len, size_t *size, size_t *expected) {
+    return zfile_block_size(data, len, size, expected);
+}
+
+/*
+ * the mode for opening a compressed stream, with the compression
+ * level appended
+ */
+static const char *zfile_mode (const char *mode, char *buf, size_t size) {
+#if (COMPRESSED_OUTPUT == 0) || defined(USE_ZSTD)
+    return mode;
+#else
+    int level = zfile_level > 9 ? 9 : zfile_level;
+
+    if (level == 0 || strlen(mode) + 2 > size) {
+        return mode;
+    }
+    snprintf(buf, size, "%s%d", mode, level);
+    return buf;
+#endif
+}
+
+/*
+ * The file underneath a zfile is either a stream (raw), or a plain
+ * file (fp) that compressed blocks are appended to (codec != NULL).
+ */
+static int zfile_is_open (zfile f) {
+    if (f->memory != NULL) {
+        return 1;
+    }
+    return f->codec != NULL ? f->fp != NULL : f->raw != NULL;
+}
+
+/* output kept in memory, grown as needed */
+struct zfile_memory_ {
+    char *data;
+    size_t len;
+    size_t size;
+};
+
+static int zfile_memory_write (struct zfile_memory_ *m, const char *buf, size_t len) {
+    char *tmp;
+    size_t size = m->size ? m->size : ZFILE_BUFFER_SIZE;
+
+    while (size - m->len < len) {
+        size *= 2;
+    }
+    if (size != m->size) {
+        tmp = realloc(m->data, size);
+        if (tmp == NULL) {
+            return -1;
+        }
+        m->data = tmp;
+        m->size = size;
+    }
+    memcpy(m->data + m->len, buf, len);
+    m->len += len;
+    return 0;
+}
+
+static int zfile_open_file (zfile f, const char *fname) {
+    char mode[8];
+
+    if (f->codec != NULL) {
+        f->fp = fopen(fname, "wb");
+    } else {
+        f->raw = raw_open(fname, zfile_mode("w", mode, sizeof(mode)));
+    }
+    return zfile_is_open(f) ? 0 : -1;
+}
+
+/* writes len bytes of output, compressing them into one block if need be */
+static int zfile_write_file (zfile f, const char *buf, size_t len) {
+    size_t n;
+
+    if (!zfile_is_open(f)) {
+        return -1;
+    }
+    if (f->memory != NULL) {
+        return zfile_memory_write(f->memory, buf, len);
+    }
+    if (f->codec == NULL) {
+        return raw_write(f->raw, buf, len);
+    }
+    n = zfile_compress(f->codec, buf, len, f->codec->out, ZFILE_COMPRESSED_SIZE);
+    if (n == 0) {
+        return -1;
+    }
+    return fwrite(f->codec->out, 1, n, f->fp) == n ? 0 : -1;
+}
+
+/* writes an already compressed block */
+static int zfile_write_block (zfile f, const char *block, size_t len) {
+    if (f->fp == NULL || len == 0) {
+        return -1;
+    }
+    return fwrite(block, 1, len, f->fp) == len ? 0 : -1;
+}
+
+static int zfile_flush_file (zfile f) {
+    if (!zfile_is_open(f)) {
+        return -1;
+    }
+    if (f->memory != NULL) {
+        return 0;
+    }
+    return f->codec != NULL ? fflush(f->fp) : raw_flush(f->raw);
+}
+
+static int zfile_close_file (zfile f) {
+    int rc = 0;
+
+    if (f->fp != NULL && fclose(f->fp) != 0) {
+        rc = -1;
+    }
+    if (f->raw != NULL && raw_close(f->raw) != 0) {
+        rc = -1;
+    }
+    f->fp = NULL;
+    f->raw = NULL;
+    return rc;
+}
+
+/*
+ * wraps the file underneath, which is either the stream raw or the
+ * plain file fp; it is closed if that fails
+ */
+static zfile zfile_alloc (zfile_raw raw, FILE *fp, const char *fname) {
+    zfile f;
+
+    if (raw == NULL && fp == NULL) {
+        return NULL;
+    }
+    f = calloc(1, sizeof(struct zfile_));
+    if (f != NULL) {
+        f->raw = raw;
+        f->fp = fp;
+        f->id = zfile_add(&zfile_last_id, 1);
+        f->buf = malloc(ZFILE_BUFFER_SIZE);
+        f->shm = zfile_shm;
+        if (fname != NULL) {
+            f->fname = strdup(fname);
+        }
+        if (fp != NULL) {
+            f->codec = zfile_codec_new(zfile_level, ZFILE_COMPRESSED_SIZE);
+        }
+    }
+    if (f == NULL || f->buf == NULL || (fname != NULL && f->fname == NULL) ||
+        (fp != NULL && f->codec == NULL)) {
+        if (f != NULL) {
+            zfile_codec_free(f->codec);
+            free(f->buf);
+            free(f->fname);
+            free(f);
+        }
+        if (raw != NULL) {
+            raw_close(raw);
+        }
+        if (fp != NULL) {
+            fclose(fp);
+        }
+        return NULL;
+    }
+    return f;
+}
+
+/*
+ * closes the file underneath f, reports it closed, and opens fname
+ * in its place
+ */
+static int zfile_reopen (zfile f, const char *fname, zfile_closed_func closed) {
+    int rc = zfile_close_file(f);
+
+    if (closed != NULL && f->fname != NULL) {
+        closed(f->fname);
+    }
+    free(f->fname);
+    f->fname = strdup(fname);
+    if (zfile_open_file(f, fname) != 0 || f->fname == NULL) {
+        rc = -1;
+    }
+    return rc;
+}
+
+/*
+ * Asynchronous output
+ *
+ * The producer fills the buffer of one block while the writer thread
+ * works through the blocks queued before it.  Two single-producer,
+ * single-consumer rings connect them: "full" carries blocks to the
+ * writer, and "empty" returns their buffers.  Neither side takes a
+ * lock to pass a block; the mutex and condition variable are only
+ * used to sleep when there is nothing to do.
+ *
+ * With compression workers, each data block is also put on the "work"
+ * ring, which the workers share under the mutex.  A worker compresses
+ * the block into its out buffer and marks it ready; the writer takes
+ * blocks from "full" as before, so they are written in order, and
+ * waits for each to be ready.
+ */
+enum zfile_block_type {
+    zfile_block_data = 0,
+    zfile_block_flush = 1,
+    zfile_block_rotate = 2
+};
+
+typedef struct zfile_block_ {
+    enum zfile_block_type type;
+    char *buf;                    /* data: the output */
+    size_t len;
+    char *out;                    /* data: the output compressed by a worker */
+    size_t out_len;               /* 0 if compression failed */
+    int ready;                    /* out is filled in; guarded by the lock */
+    char *fname;                  /* rotate: the next file */
+    zfile_closed_func closed;     /* rotate: called with the old file name */
+} zfile_block_t;
+
+typedef struct zfile_ring_ {
+    zfile_block_t **slot;
+    long size;                    /* a power of two */
+    long head;                    /* next slot to fill; written by the producer */
+    long tail;                    /* next slot to take; written by the consumer */
+} zfile_ring_t;
+
+struct zfile_async_ {
+    zfile_ring_t full;            /* blocks for the writer */
+    zfile_ring_t empty;           /* buffers the writer has finished with */
+    zfile_ring_t work;            /* blocks for the workers; guarded by the lock */
+    zfile_block_t *blocks;        /* num_buffers data blocks */
+    unsigned int num_buffers;
+    zfile_block_t *current;       /* the block whose buffer the producer fills */
+    int partial;                  /* the last queued buffer ended inside a record */
+    int drop;                     /* drop records rather than wait for a buffer */
+    int done;                     /* no more blocks will be queued */
+    pthread_t thread;
+    pthread_t *workers;           /* num_workers compression threads */
+    unsigned int num_workers;
+    int level;                    /* compression level of the workers */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;          /* broadcast whenever a ring changes */
+    pthread_cond_t work_cond;     /* signalled when work is queued */
+    zfile_stats_t stats;
+};
+
+static int zfile_ring_init (zfile_ring_t *r, unsigned int min_size) {
+    r->size = 1;
+    while (r->size < (long)min_size) {
+        r->size <<= 1;
+    }
+    r->head = r->tail = 0;
+    r->slot = calloc(r->size, sizeof(zfile_block_t *));
+    return r->slot == NULL ? -1 : 0;
+}
+
+/* called by the producer of r only */
+static int zfile_ring_push (zfile_ring_t *r, zfile_block_t *b) {
+    long head = r->head;
+
+    if (head - zfile_load(&r->tail) == r->size) {
+        return 0;
+    }
+    r->slot[head & (r->size - 1)] = b;
+    zfile_store(&r->head, head + 1);
+    return 1;
+}
+
+/* called by the consumer of r only */
+static zfile_block_t *zfile_ring_pop (zfile_ring_t *r) {
+    long tail = r->tail;
+    zfile_block_t *b;
+
+    if (tail == zfile_load(&r->head)) {
+        return NULL;
+    }
+    b = r->slot[tail & (r->size - 1)];
+    zfile_store(&r->tail, tail + 1);
+    return b;
+}
+
+static void zfile_async_wake (struct zfile_async_ *a) {
+    pthread_mutex_lock(&a->lock);
+    pthread_cond_broadcast(&a->cond);
+    pthread_mutex_unlock(&a->lock);
+}
+
+static void *zfile_worker_main (void *arg) {
+    struct zfile_async_ *a = arg;
+    struct zfile_codec_ *codec = zfile_codec_new(a->level, 0);
+    zfile_block_t *b;
+    size_t n;
+
+    while (1) {
+        pthread_mutex_lock(&a->lock);
+        while ((b = zfile_ring_pop(&a->work)) == NULL && !a->done) {
+            pthread_cond_wait(&a->work_cond, &a->lock);
+        }
+        pthread_mutex_unlock(&a->lock);
+        if (b == NULL) {
+            break;
+        }
+
+        n = 0;
+        if (codec != NULL) {
+            n = zfile_compress(codec, b->buf, b->len, b->out, ZFILE_COMPRESSED_SIZE);
+        }
+        pthread_mutex_lock(&a->lock);
+        b->out_len = n;
+        b->ready = 1;
+        pthread_cond_broadcast(&a->cond);
+        pthread_mutex_unlock(&a->lock);
+    }
+    zfile_codec_free(codec);
+    return NULL;
+}
+
+static void *zfile_writer_main (void *arg) {
+    zfile f = arg;
+    struct zfile_async_ *a = f->async;
+    zfile_block_t *b;
+    int rc;
+
+    while (1) {
+        b = zfile_ring_pop(&a->full);
+        if (b == NULL) {
+            pthread_mutex_lock(&a->lock);
+            while ((b = zfile_ring_pop(&a->full)) == NULL && !a->done) {
+                pthread_cond_wait(&a->cond, &a->lock);
+            }
+            pthread_mutex_unlock(&a->lock);
+            if (b == NULL) {
+                break;
+            }
+        }
+
+        switch (b->type) {
+        case zfile_block_data:
+            if (a->num_workers) {
+                pthread_mutex_lock(&a->lock);
+                while (!b->ready) {
+                    pthread_cond_wait(&a->cond, &a->lock);
+                }
+                pthread_mutex_unlock(&a->lock);
+                rc = zfile_write_block(f, b->out, b->out_len);
+            } else {
+                rc = zfile_write_file(f, b->buf, b->len);
+            }
+            if (rc != 0) {
+                zfile_add(&a->stats.write_errors, 1);
+            } else {
+                zfile_add(&a->stats.blocks_written, 1);
+                zfile_add(&a->stats.bytes_written, b->len);
+            }
+            b->len = 0;
+            zfile_ring_push(&a->empty, b);
+            break;
+        case zfile_block_flush:
+            zfile_flush_file(f);
+            free(b);
+            break;
+        case zfile_block_rotate:
+            if (zfile_reopen(f, b->fname, b->closed) != 0) {
+                zfile_add(&a->stats.write_errors, 1);
+            }
+            free(b->fname);
+            free(b);
+            break;
+        }
+        zfile_async_wake(a);
+    }
+    return NULL;
+}
+
+/*
+ * hands a block to the writer; the producer waits only if the ring
+ * is taken up by flush and rotate requests
+ */
+static void zfile_async_queue (struct zfile_async_ *a, zfile_block_t *b) {
+    unsigned long depth;
+
+    if (!zfile_ring_push(&a->full, b)) {
+        a->stats.stalls++;
+        pthread_mutex_lock(&a->lock);
+        while (!zfile_ring_push(&a->full, b)) {
+            pthread_cond_wait(&a->cond, &a->lock);
+        }
+        pthread_mutex_unlock(&a->lock);
+    }
+    depth = a->full.head - zfile_load(&a->full.tail);
+    if (depth > a->stats.queue_depth_max) {
+        a->stats.queue_depth_max = depth;
+    }
+    zfile_async_wake(a);
+}
+
+/*
+ * hands a data block to the workers; there is always room, as the
+ * work ring holds every data block
+ */
+static void zfile_async_compress (struct zfile_async_ *a, zfile_block_t *b) {
+    pthread_mutex_lock(&a->lock);
+    b->ready = 0;
+    zfile_ring_push(&a->work, b);
+    pthread_cond_signal(&a->work_cond);
+    pthread_mutex_unlock(&a->lock);
+}
+
+/*
+ * Makes room in a full buffer that cannot be queued by dropping the
+ * complete records in it.  Output is newline-delimited, so what is
+ * kept is the end of a record whose start was already queued, and
+ * the start of the record being written.  Fails if that leaves less
+ * than half of the buffer free.
+ */
+/*
+ * hands the output after the last record boundary to the ring, before
+ * the buffer it is in is handed on; the ring holds it until zrecord()
+ */
+static void zfile_shm_pending (zfile f) {
+    if (f->shm != NULL && f->len > f->record_start) {
+        shm_ring_write(f->shm, f->buf + f->record_start, f->len - f->record_start);
+        f->record_start = f->len;
+    }
+}
+
+static int zfile_async_drop (zfile f) {
+    struct zfile_async_ *a = f->async;
+    char *end = f->buf + f->len;
+    char *first = f->buf;
+    char *last = end;
+    char *p;
+    unsigned long records = 0;
+
+    if (f->binary) {
+        return -1;
+    }
+    if (a->partial) {
+        first = memchr(f->buf, '\n', f->len);
+        if (first == NULL) {
+            return -1;
+        }
+        first++;
+    }
+    while (last > first && last[-1] != '\n') {
+        last--;
+    }
+    if (last == first || (first - f->buf) + (end - last) > ZFILE_BUFFER_SIZE / 2) {
+        return -1;
+    }
+
+    for (p = first; p < last && (p = memchr(p, '\n', last - p)) != NULL; p++) {
+        records++;
+    }
+    a->stats.records_dropped += records;
+    a->stats.bytes_dropped += last - first;
+    memmove(first, last, end - last);
+    f->len -= last - first;
+    return 0;
+}
+
+/*
+ * queues the buffer of f to the writer and takes an empty one; if
+ * there is none, records are dropped when may_drop is set, and
+ * otherwise (or if nothing can be dropped) the producer waits
+ */
+static int zfile_async_drain (zfile f, int may_drop) {
+    struct zfile_async_ *a = f->async;
+    zfile_block_t *next;
+
+    if (f->len == 0) {
+        return 0;
+    }
+    zfile_shm_pending(f);
+    next = zfile_ring_pop(&a->empty);
+    if (next == NULL) {
+        if (may_drop && zfile_async_drop(f) == 0) {
+            f->record_start = f->len;
+            return 0;
+        }
+        a->stats.stalls++;
+        pthread_mutex_lock(&a->lock);
+        while ((next = zfile_ring_pop(&a->empty)) == NULL) {
+            pthread_cond_wait(&a->cond, &a->lock);
+        }
+        pthread_mutex_unlock(&a->lock);
+    }
+
+    a->current->len = f->len;
+    a->partial = (f->buf[f->len - 1] != '\n');
+    if (a->num_workers) {
+        zfile_async_compress(a, a->current);
+    }
+    zfile_async_queue(a, a->current);
+    a->current = next;
+    f->buf = next->buf;
+    f->len = 0;
+    f->record_start = 0;
+    return 0;
+}
+
+
+/*
+ * queues a flush or rotate request after the output so far
+ */
+static int zfile_async_request (zfile f, enum zfile_block_type type,
+                                const char *fname, zfile_closed_func closed) {
+    zfile_block_t *b;
+
+    zfile_async_drain(f, f->async->drop);
+    b = calloc(1, sizeof(zfile_block_t));
+    if (b == NULL) {
+        return -1;
+    }
+    b->type = type;
+    b->closed = closed;
+    if (fname != NULL) {
+        b->fname = strdup(fname);
+        if (b->fname == NULL) {
+            free(b);
+            return -1;
+        }
+    }
+    zfile_async_queue(f->async, b);
+    return 0;
+}
+
+static void zfile_async_free (struct zfile_async_ *a) {
+    unsigned int i;
+
+    for (i = 0; i < a->num_buffers; i++) {
+        free(a->blocks[i].buf);
+        free(a->blocks[i].out);
+    }
+    free(a->blocks);
+    free(a->workers);
+    free(a->full.slot);
+    free(a->empty.slot);
+    free(a->work.slot);
+    pthread_mutex_destroy(&a->lock);
+    pthread_cond_destroy(&a->cond);
+    pthread_cond_destroy(&a->work_cond);
+    free(a);
+}
+
+/*
+ * tells the threads of a to finish once the queued blocks are written,
+ * and waits for the writer (if started) and the first num_workers workers
+ */
+static void zfile_async_stop (struct zfile_async_ *a, unsigned int num_workers,
+                              int writer) {
+    unsigned int i;
+
+    pthread_mutex_lock(&a->lock);
+    a->done = 1;
+    pthread_cond_broadcast(&a->cond);
+    pthread_cond_broadcast(&a->work_cond);
+    pthread_mutex_unlock(&a->lock);
+    if (writer) {
+        pthread_join(a->thread, NULL);
+    }
+    for (i = 0; i < num_workers; i++) {
+        pthread_join(a->workers[i], NULL);
+    }
+}
+
+/*
+ * moves the writing of f to a writer thread, with num_workers threads
+ * compressing blocks for it when f is written in blocks
+ */
+static int zfile_async_start (zfile f, unsigned int num_buffers,
+                              unsigned int num_workers, int drop) {
+    struct zfile_async_ *a;
+    unsigned int i;
+
+    if (num_buffers < 2) {
+        num_buffers = 2;
+    } else if (num_buffers > ZFILE_ASYNC_MAX_BUFFERS) {
+        num_buffers = ZFILE_ASYNC_MAX_BUFFERS;
+    }
+    if (f->codec == NULL) {
+        num_workers = 0;
+    }
+
+    a = calloc(1, sizeof(struct zfile_async_));
+    if (a == NULL) {
+        return -1;
+    }
+    pthread_mutex_init(&a->lock, NULL);
+    pthread_cond_init(&a->cond, NULL);
+    pthread_cond_init(&a->work_cond, NULL);
+    a->num_buffers = num_buffers;
+    a->drop = drop;
+    a->level = zfile_level;
+    a->blocks = calloc(num_buffers, sizeof(zfile_block_t));
+    if (a->blocks == NULL ||
+        zfile_ring_init(&a->full, 2 * num_buffers) != 0 ||
+        zfile_ring_init(&a->empty, num_buffers) != 0 ||
+        zfile_ring_init(&a->work, num_buffers) != 0) {
+        a->num_buffers = 0;
+        zfile_async_free(a);
+        return -1;
+    }
+    for (i = 0; i < num_buffers; i++) {
+        if (i > 0) {
+            a->blocks[i].buf = malloc(ZFILE_BUFFER_SIZE);
+        }
+        if (num_workers) {
+            a->blocks[i].out = malloc(ZFILE_COMPRESSED_SIZE);
+        }
+        if ((i > 0 && a->blocks[i].buf == NULL) ||
+            (num_workers && a->blocks[i].out == NULL)) {
+            zfile_async_free(a);
+            return -1;
+        }
+        if (i > 0) {
+            zfile_ring_push(&a->empty, &a->blocks[i]);
+        }
+    }
+    if (num_workers) {
+        a->workers = calloc(num_workers, sizeof(pthread_t));
+        if (a->workers == NULL) {
+            zfile_async_free(a);
+            return -1;
+        }
+    }
+
+    /* the output pending now is the first block */
+    a->blocks[0].buf = f->buf;
+    a->current = &a->blocks[0];
+    f->async = a;
+    for (i = 0; i < num_workers; i++) {
+        if (pthread_create(&a->workers[i], NULL, zfile_worker_main, a) != 0) {
+            break;
+        }
+    }
+    if (i == num_workers && pthread_create(&a->thread, NULL, zfile_writer_main, f) == 0) {
+        a->num_workers = num_workers;
+        return 0;
+    }
+
+    /* nothing has been queued yet, so the threads that did start just exit */
+    zfile_async_stop(a, i, 0);
+    f->async = NULL;
+    a->blocks[0].buf = NULL;
+    zfile_async_free(a);
+    return -1;
+}
+
+/**
+ * \fn int zasync (zfile f, unsigned int num_buffers)
+ * \brief Move the writing of \p f to a thread of its own.
+ *
+ * From then on, filled buffers are queued to the writer thread, which
+ * compresses and writes them, and carries out zflush() and zrotate()
+ * in order with the output.  At most \p num_buffers buffers are in
+ * use; when all of them are waiting for the writer, complete records
+ * are dropped (and counted, see zstats()) instead of waiting.  The
+ * output must be newline-delimited records for that.
+ *
+ * A zfile that compression threads made asynchronous already keeps
+ * its buffers, and just starts dropping records.
+ *
+ * \param f output file
+ * \param num_buffers number of buffers, from 2 to ZFILE_ASYNC_MAX_BUFFERS
+ * \return 0 on success, -1 on failure, in which case \p f stays synchronous
+ */
+int zasync (zfile f, unsigned int num_buffers) {
+    if (f->async != NULL) {
+        f->async->drop = 1;
+        return 0;
+    }
+    return zfile_async_start(f, num_buffers, zfile_threads, 1);
+}
+
+/**
+ * \fn void zstats (zfile f, zfile_stats_t *stats)
+ * \brief Get the counters of an asynchronous zfile; they are all zero
+ *        for a synchronous one.
+ * \param f output file
+ * \param stats filled in with the counters
+ * \return none
+ */
+void zstats (zfile f, zfile_stats_t *stats) {
+    struct zfile_async_ *a = f->async;
+
+    memset(stats, 0, sizeof(zfile_stats_t));
+    if (a != NULL) {
+        /* the producer's counters are read directly, the writer's atomically */
+        stats->queue_depth_max = a->stats.queue_depth_max;
+        stats->records_dropped = a->stats.records_dropped;
+        stats->bytes_dropped = a->stats.bytes_dropped;
+        stats->stalls = a->stats.stalls;
+        stats->blocks_written = zfile_load(&a->stats.blocks_written);
+        stats->bytes_written = zfile_load(&a->stats.bytes_written);
+        stats->write_errors = zfile_load(&a->stats.write_errors);
+        stats->queue_depth = zfile_load(&a->full.head) - zfile_load(&a->full.tail);
+    }
+}
+
+/**
+ * \fn void zconfigure (int level, unsigned int threads)
+ * \brief Set the compression of the zfiles opened from now on.
+ *
+ * With \p threads above zero, output is compressed in independent
+ * blocks (gzip members, or zstd frames), by that many threads per
+ * file, and each file gets a writer thread that waits rather than
+ * dropping records (unless zasync() is called too).  zstd output is
+ * always written in blocks, and compressed by the writer thread, or
+ * inline, when there are no compression threads.  bzip2 and
+ * uncompressed output ignore \p threads.
+ *
+ * \param level compression level, 0 for the library default; zlib
+ *        and bzip2 use at most 9
+ * \param threads compression threads per file, at most ZFILE_MAX_THREADS
+ * \return none
+ */
+void zconfigure (int level, unsigned int threads) {
+    zfile_level = level < 0 ? 0 : level;
+    zfile_threads = threads > ZFILE_MAX_THREADS ? ZFILE_MAX_THREADS : threads;
+}
+
+/*
+ * hands the compression of a newly opened block-mode file to threads
+ */
+static zfile zfile_start (zfile f) {
+    if (f != NULL && f->codec != NULL && zfile_threads > 0) {
+        /* enough buffers to keep every worker and the writer busy */
+        zfile_async_start(f, 2 * zfile_threads + 2, zfile_threads, 0);
+    }
+    return f;
+}
+
+/**
+ * \fn zfile zopen (const char *fname, const char *mode)
+ * \brief Open the file \p fname for buffered output.
+ * \param fname name of the file
+ * \param mode mode, as for fopen()
+ * \return the zfile, or NULL on failure
+ */
+zfile zopen (const char *fname, const char *mode) {
+    char level_mode[8];
+
+    if (zfile_block_mode()) {
+        return zfile_start(zfile_alloc(NULL, fopen(fname, "wb"), fname));
+    }
+    return zfile_alloc(raw_open(fname, zfile_mode(mode, level_mode, sizeof(level_mode))),
+                       NULL, fname);
+}
+
+/**
+ * \fn zfile zattach (FILE *fp, const char *mode)
+ * \brief Attach a buffered output zfile to the open file \p fp.
+ * \param fp open file, such as stdout
+ * \param mode mode, as for fopen()
+ * \return the zfile, or NULL on failure
+ */
+zfile zattach (FILE *fp, const char *mode) {
+    char level_mode[8];
+
+    if (zfile_block_mode()) {
+        return zfile_start(zfile_alloc(NULL, fp, NULL));
+    }
+    mode = zfile_mode(mode, level_mode, sizeof(level_mode));
+    return zfile_alloc(raw_attach(fp, mode), NULL, NULL);
+}
+
+/**
+ * \fn zfile zopen_memory (void)
+ * \brief Open a zfile that keeps its output in memory, for zmemory().
+ * \return the zfile, or NULL on failure
+ */
+zfile zopen_memory (void) {
+    zfile f;
+
+    f = calloc(1, sizeof(struct zfile_));
+    if (f == NULL) {
+        return NULL;
+    }
+    f->id = zfile_add(&zfile_last_id, 1);
+    f->buf = malloc(ZFILE_BUFFER_SIZE);
+    f->memory = calloc(1, sizeof(struct zfile_memory_));
+    if (f->buf == NULL || f->memory == NULL) {
+        free(f->buf);
+        free(f->memory);
+        free(f);
+        return NULL;
+    }
+    return f;
+}
+
+/**
+ * \fn const char *zmemory (zfile f, size_t *len)
+ * \brief The output written to the zfile \p f from zopen_memory() so far.
+ * \param f output file
+ * \param len set to the number of bytes
+ * \return the output, valid until more is written, or NULL on failure
+ */
+const char *zmemory (zfile f, size_t *len) {
+    struct zfile_memory_ *m = f->memory;
+
+    if (m == NULL) {
+        return NULL;
+    }
+    if (m->len == 0) {
+        /* all of it is still in the buffer */
+        *len = f->len;
+        return f->buf;
+    }
+    if (f->len) {
+        if (zfile_memory_write(m, f->buf, f->len) != 0) {
+            return NULL;
+        }
+        f->len = 0;
+    }
+    *len = m->len;
+    return m->data;
+}
+
+/**
+ * \fn void zmemory_clear (zfile f)
+ * \brief Discard the output of the zfile \p f from zopen_memory().
+ * \param f output file
+ * \return none
+ */
+void zmemory_clear (zfile f) {
+    f->len = 0;
+    if (f->memory != NULL) {
+        f->memory->len = 0;
+    }
+}
+
+/**
+ * \fn void zbinary (zfile f)
+ * \brief Mark the output of \p f as binary.
+ *
+ * Binary output is not newline-delimited, so a writer thread that
+ * falls behind makes the producer wait instead of dropping records.
+ *
+ * \param f output file
+ * \return none
+ */
+void zbinary (zfile f) {
+    f->binary = 1;
+}
+
+/**
+ * \fn void zpublish (shm_ring_t *ring)
+ * \brief Publish the records written to the files opened from now on
+ *        (with zopen() or zattach()) to \p ring as well, uncompressed.
+ *
+ * The ring has a single writer, so only one such file should be
+ * written at a time.
+ *
+ * \param ring the ring, or NULL to stop publishing
+ * \return none
+ */
+void zpublish (shm_ring_t *ring) {
+    zfile_shm = ring;
+}
+
+/**
+ * \fn void zrecord (zfile f)
+ * \brief Mark the end of a record: the output since the last mark is
+ *        published as one message, if \p f publishes to a ring.
+ * \param f output file
+ * \return none
+ */
+void zrecord (zfile f) {
+    if (f->shm != NULL) {
+        zfile_shm_pending(f);
+        shm_ring_commit(f->shm);
+    }
+}
+
+/*
+ * hands the buffered output of f on, however little there is
+ */
+static int zfile_drain (zfile f) {
+    int rc = 0;
+
+    if (f->async != NULL) {
+        return zfile_async_drain(f, f->async->drop);
+    }
+    if (f->len) {
+        zfile_shm_pending(f);
+        /* after a failed zrotate() there is no file to write to */
+        rc = zfile_write_file(f, f->buf, f->len);
+        f->len = 0;
+        f->record_start = 0;
+    }
+    return rc;
+}
+
+/**
+ * \fn int zdrain (zfile f)
+ * \brief Hand the buffered output of \p f to the underlying file (or
+ *        to the writer thread), without flushing that file.
+ *
+ * Output written in compressed blocks is held back until the buffer
+ * is at least half full, as every block starts the compression over.
+ *
+ * \param f output file
+ * \return 0 on success, -1 if the write failed
+ */
+int zdrain (zfile f) {
+    if (f->codec != NULL && f->len < ZFILE_BUFFER_SIZE / 2) {
+        return 0;
+    }
+    return zfile_drain(f);
+}
+
+/**
+ * \fn int zflush (zfile f)
+ * \brief Write out the buffered output of \p f and flush the underlying file.
+ * \param f output file
+ * \return 0 on success, -1 on failure
+ */
+int zflush (zfile f) {
+    int rc;
+
+    if (f->async != NULL) {
+        return zfile_async_request(f, zfile_block_flush, NULL, NULL);
+    }
+    rc = zfile_drain(f);
+    if (zfile_flush_file(f) != 0) {
+        rc = -1;
+    }
+    return rc;
+}
+
+/**
+ * \fn int zrotate (zfile f, const char *fname, zfile_closed_func closed)
+ * \brief Continue the output of \p f in the new file \p fname.
+ *
+ * The current file is closed once the output so far is written, and
+ * then \p closed (if not NULL) is called with its name, which is the
+ * place to hand it to the uploader.
+ *
+ * \param f output file
+ * \param fname name of the next file
+ * \param closed function to call with the name of the closed file
+ * \return 0 on success, -1 on failure; an asynchronous zfile counts
+ *         failures as write errors instead
+ */
+int zrotate (zfile f, const char *fname, zfile_closed_func closed) {
+    int rc;
+
+    f->id = zfile_add(&zfile_last_id, 1);
+    if (f->async != NULL) {
+        return zfile_async_request(f, zfile_block_rotate, fname, closed);
+    }
+    rc = zfile_drain(f);
+    if (zfile_reopen(f, fname, closed) != 0) {
+        rc = -1;
+    }
+    return rc;
+}
+
+/**
+ * \fn int zclose (zfile f)
+ * \brief Write out the buffered output of \p f, close the underlying
+ *        file and free \p f.
+ *
+ * An asynchronous zfile waits for its writer thread to finish.
+ *
+ * \param f output file
+ * \return 0 on success, -1 on failure
+ */
+int zclose (zfile f) {
+    struct zfile_async_ *a;
+    int rc = 0;
+
+    if (f == NULL) {
+        return -1;
+    }
+    a = f->async;
+    if (a != NULL) {
+        zfile_async_drain(f, 0);
+        zfile_async_stop(a, a->num_workers, 1);
+        if (a->stats.write_errors) {
+            rc = -1;
+        }
+        f->buf = NULL;
+        zfile_async_free(a);
+    } else {
+        rc = zfile_drain(f);
+    }
+    if (zfile_close_file(f) != 0) {
+        rc = -1;
+    }
+    if (f->shm != NULL) {
+        /* whatever follows the last record is not a whole one */
+        shm_ring_abort(f->shm);
+    }
+    zfile_codec_free(f->codec);
+    if (f->memory != NULL) {
+        free(f->memory->data);
+        free(f->memory);
+    }
+    free(f->buf);
+    free(f->fname);
+    free(f);
+    return rc;
+}
+
+/**
+ * \fn int zwrite (zfile f, const void *data, size_t len)
+ * \brief Append \p len bytes to the output.
+ * \param f output file
+ * \param data bytes to append
+ * \param len number of bytes
+ * \return \p len on success, -1 if a write to the underlying file failed
+ */
+int zwrite (zfile f, const void *data, size_t len) {
+    const char *p = data;
+    size_t n;
+    int rc = (int)len;
+
+    if (f->len + len > ZFILE_BUFFER_SIZE && zdrain(f) != 0) {
+        return -1;
+    }
+    while (f->len + len > ZFILE_BUFFER_SIZE) {
+        /* bigger than the buffer, so it goes through in pieces */
+        n = ZFILE_BUFFER_SIZE - f->len;
+        memcpy(f->buf + f->len, p, n);
+        f->len += n;
+        p += n;
+        len -= n;
+        if (zdrain(f) != 0) {
+            return -1;
+        }
+    }
+    memcpy(f->buf + f->len, p, len);
+    f->len += len;
+    return rc;
+}
+
+/**
+ * \fn int zprintf (zfile f, const char *format, ...)
+ * \brief Append formatted output, as for printf().
+ * \param f output file
+ * \param format printf format
+ * \return number of bytes appended, or a negative value on failure
+ */
+int zprintf (zfile f, const char *format, ...) {
+    va_list arg;
+    size_t room = ZFILE_BUFFER_SIZE - f->len;
+    char *tmp;
+    int n;
+
+    /* format straight into the buffer, which almost always has room */
+    va_start(arg, format);
+    n = vsnprintf(f->buf + f->len, room, format, arg);
+    va_end(arg);
+    if (n < 0 || (size_t)n < room) {
+        if (n > 0) {
+            f->len += n;
+        }
+        return n;
+    }
+
+    if ((size_t)n < ZFILE_BUFFER_SIZE / 2) {
+        if (zdrain(f) != 0) {
+            return -1;
+        }
+        room = ZFILE_BUFFER_SIZE - f->len;
+        va_start(arg, format);
+        n = vsnprintf(f->buf + f->len, room, format, arg);
+        va_end(arg);
+        f->len += n;
+        return n;
+    }
+
+    /* too large to format in place */
+    tmp = malloc(n + 1);
+    if (tmp == NULL) {
+        return -1;
+    }
+    va_start(arg, format);
+    n = vsnprintf(tmp, n + 1, format, arg);
+    va_end(arg);
+    n = zwrite(f, tmp, n);
+    free(tmp);
+    return n;
+}
+
+/* the decimal representations of 0 through 99 */
+static const char zfile_digit_pairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+/*
+ * writes the decimal digits of value so that they end just before
+ * end, and returns a pointer to the first one
+ */
+static __inline char *zfile_format_uint (char *end, uint64_t value) {
+    char *p = end;
+
+    while (value >= 100) {
+        unsigned int pair = (unsigned int)(value % 100) * 2;
+
+        value /= 100;
+        p -= 2;
+        p[0] = zfile_digit_pairs[pair];
+        p[1] = zfile_digit_pairs[pair + 1];
+    }
+    if (value >= 10) {
+        p -= 2;
+        p[0] = zfile_digit_pairs[value * 2];
+        p[1] = zfile_digit_pairs[value * 2 + 1];
+    } else {
+        *--p = (char)('0' + value);
+    }
+    return p;
+}
+
+/**
+ * \fn void zprint_uint (zfile f, uint64_t value)
+ * \brief Append an unsigned integer in decimal, as "%u" would.
+ * \param f output file
+ * \param value the integer
+ * \return none
+ */
+void zprint_uint (zfile f, uint64_t value) {
+    char tmp[20];
+    char *p = zfile_format_uint(tmp + sizeof(tmp), value);
+    size_t len = tmp + sizeof(tmp) - p;
+
+    memcpy(zreserve(f, len), p, len);
+    f->len += len;
+}
+
+/**
+ * \fn void zprint_int (zfile f, int64_t value)
+ * \brief Append a signed integer in decimal, as "%d" would.
+ * \param f output file
+ * \param value the integer
+ * \return none
+ */
+void zprint_int (zfile f, int64_t value) {
+    if (value < 0) {
+        zputc(f, '-');
+        zprint_uint(f, 0 - (uint64_t)value);
+    } else {
+        zprint_uint(f, (uint64_t)value);
+    }
+}
+
+/**
+ * \fn void zprint_timeval (zfile f, const struct timeval *ts)
+ * \brief Append a timestamp as seconds with six decimal places.
+ * \param f output file
+ * \param ts the timestamp
+ * \return none
+ */
+void zprint_timeval (zfile f, const struct timeval *ts) {
+    long usec = (long)ts->tv_usec;
+    char *p;
+    int i;
+
+    zprint_int(f, (int64_t)ts->tv_sec);
+    if (usec < 0 || usec > 999999) {
+        /* not normalized; print it the way printf would */
+        zprintf(f, ".%06ld", usec);
+        return;
+    }
+    p = zreserve(f, 7);
+    p[0] = '.';
+    for (i = 6; i > 0; i--) {
+        p[i] = (char)('0' + usec % 10);
+        usec /= 10;
+    }
+    f->len += 7;
+}
+
+/**
+ * \fn void zprint_ipv4 (zfile f, const struct in_addr *addr)
+ * \brief Append an IPv4 address in dotted-quad notation, as inet_ntop() would.
+ * \param f output file
+ * \param addr the address, in network byte order
+ * \return none
+ */
+void zprint_ipv4 (zfile f, const struct in_addr *addr) {
+    const unsigned char *a = (const unsigned char *)addr;
+    char tmp[16];
+    char *p = tmp + sizeof(tmp);
+    int i;
+
+    for (i = 3; i >= 0; i--) {
+        p = zfile_format_uint(p, a[i]);
+        if (i) {
+            *--p = '.';
+        }
+    }
+    zwrite(f, p, tmp + sizeof(tmp) - p);
+}
+
+/**
+ * \fn void zprint_hex (zfile f, const unsigned char *data, size_t len)
+ * \brief Append bytes as lowercase hex, two digits per byte.
+ * \param f output file
+ * \param data the bytes
+ * \param len number of bytes
+ * \return none
+ */
+void zprint_hex (zfile f, const unsigned char *data, size_t len) {
+    static const char hex[] = "0123456789abcdef";
+
+    while (len) {
+        size_t n = len < ZFILE_BUFFER_SIZE / 4 ? len : ZFILE_BUFFER_SIZE / 4;
+        char *p = zreserve(f, 2 * n);
+        size_t i;
+
+        for (i = 0; i < n; i++) {
+            p[2*i] = hex[data[i] >> 4];
+            p[2*i+1] = hex[data[i] & 0x0f];
+        }
+        f->len += 2 * n;
+        data += n;
+        len -= n;
+    }
+}
+
+/*
+ * bytes that may appear in a JSON string as they are; quotes,
+ * backslashes and slashes are left out, as in
+ * joy_utils_convert_to_json_string()
+ */
+#define zfile_json_safe(c) ((c) >= 0x20 && (c) < 0x7f && (c) != '"' && (c) != '\\' && (c) != '/')
+
+/**
+ * \fn void zprint_json_string (zfile f, const char *s, size_t len)
+ * \brief Append at most \p len bytes of the string \p s, stopping at a
+ *        NULL, with each byte that is not JSON-safe printed as a period.
+ * \param f output file
+ * \param s the string
+ * \param len maximum number of bytes
+ * \return none
+ */
+void zprint_json_string (zfile f, const char *s, size_t len) {
+    const unsigned char *p = (const unsigned char *)s;
+    const unsigned char *end = p + len;
+
+    while (p < end && *p) {
+        const unsigned char *run = p;
+
+        /* copy runs of safe bytes in one go */
+        while (p < end && zfile_json_safe(*p)) {
+            p++;
+        }
+        if (p > run) {
+            zwrite(f, run, p - run);
+        }
+        if (p < end && *p) {
+            zputc(f, '.');
+            p++;
+        }
+    }
+}
+
+/*
+ * Reading output back
+ *
+ * The tools that read the output of joy (joy-query, joy-merge and
+ * jfd-anon) open it with zreader_open(), which tells from its first
+ * bytes whether it is plain or compressed, and decompress it as they
+ * read it with zread().  Output written in blocks can instead be taken
+ * a whole block at a time with zread_block(), still compressed, so
+ * that other threads decompress it.
+ */
+
+/* compressed bytes read at once */
+#define ZREADER_READ_SIZE (1024 * 1024)
+
+/* a compressed block larger than this is read as a stream */
+#define ZREADER_MAX_BLOCK (64 * 1024 * 1024)
+
+#if defined(USE_BZIP2) && !defined(ZFILE_CODEC_ZSTD)
+#include <bzlib.h>
+#endif
+
+typedef enum zreader_format_e_ {
+    zreader_plain,
+    zreader_zstd,
+    zreader_gzip,
+    zreader_bzip2
+} zreader_format_e;
+
+struct zreader_ {
+    char *name;
+    FILE *fp;
+    zreader_format_e format;
+    int eof;                      /* fp has been read to its end */
+    int done;                     /* the compressed stream has ended */
+    int failed;                   /* an error was reported, and nothing more is read */
+    int in_block;                 /* part way through a gzip member or zstd frame */
+    char *buf;                    /* bytes read, from off to len */
+    size_t off;
+    size_t len;
+    size_t size;
+#if defined(ZFILE_CODEC_ZSTD)
+    ZSTD_DCtx *dctx;
+#elif defined(USE_BZIP2)
+    BZFILE *bz;
+#elif defined(ZFILE_CODEC_GZIP)
+    z_stream zs;
+    int zs_ready;
+#endif
+};
+
+static void zreader_error (zreader r, const char *problem) {
+    if (!r->failed) {
+        fprintf(stderr, "error: %s %s\n", r->name, problem);
+    }
+    r->failed = 1;
+}
+
+/* reads more of the file after what is buffered; returns the bytes read, or -1 */
+static long zreader_fill (zreader r) {
+    size_t n;
+
+    if (r->off > 0) {
+        memmove(r->buf, r->buf + r->off, r->len - r->off);
+        r->len -= r->off;
+        r->off = 0;
+    }
+    if (r->size - r->len < ZREADER_READ_SIZE) {
+        char *tmp = realloc(r->buf, r->len + ZREADER_READ_SIZE);
+
+        if (tmp == NULL) {
+            zreader_error(r, "could not be read: out of memory");
+            return -1;
+        }
+        r->buf = tmp;
+        r->size = r->len + ZREADER_READ_SIZE;
+    }
+    if (r->eof) {
+        return 0;
+    }
+    n = fread(r->buf + r->len, 1, r->size - r->len, r->fp);
+    if (n == 0) {
+        if (ferror(r->fp)) {
+            zreader_error(r, "could not be read");
+            return -1;
+        }
+        r->eof = 1;
+    }
+    r->len += n;
+    return (long)n;
+}
+
+/**
+ * \fn zreader zreader_open (const char *fname)
+ * \brief Open output of joy to read it back, plain or compressed as
+ * joy compresses it.
+ *
+ * Errors are reported on standard error, with the name of the file.
+ *
+ * \param fname the file, or NULL for standard input
+ * \return the reader, or NULL if the file could not be opened, or is
+ *         compressed in a way that this build does not read
+ */
+zreader zreader_open (const char *fname) {
+    const unsigned char *b;
+    zreader r = calloc(1, sizeof(struct zreader_));
+
+    if (r == NULL) {
+        fprintf(stderr, "error: %s could not be read: out of memory\n",
+                fname ? fname : "standard input");
+        return NULL;
+    }
+    r->name = strdup(fname ? fname : "standard input");
+    r->buf = malloc(ZREADER_READ_SIZE);
+    if (r->name == NULL || r->buf == NULL) {
+        fprintf(stderr, "error: %s could not be read: out of memory\n",
+                fname ? fname : "standard input");
+        zreader_close(r);
+        return NULL;
+    }
+    r->size = ZREADER_READ_SIZE;
+    r->fp = fname ? fopen(fname, "rb") : stdin;
+    if (r->fp == NULL) {
+        fprintf(stderr, "error: could not open %s\n", r->name);
+        zreader_close(r);
+        return NULL;
+    }
+
+    /* only as much as tells the format, which bzip2 can be handed back */
+    r->len = fread(r->buf, 1, 4, r->fp);
+    if (r->len < 4) {
+        if (ferror(r->fp)) {
+            fprintf(stderr, "error: %s could not be read\n", r->name);
+            zreader_close(r);
+            return NULL;
+        }
+        r->eof = 1;
+    }
+    b = (const unsigned char *)r->buf;
+    if (r->len >= 4 && b[0] == 0x28 && b[1] == 0xb5 && b[2] == 0x2f && b[3] == 0xfd) {
+        r->format = zreader_zstd;
+    } else if (r->len >= 3 && b[0] == 'B' && b[1] == 'Z' && b[2] == 'h') {
+        r->format = zreader_bzip2;
+    } else if (r->len >= 2 && b[0] == 0x1f && b[1] == 0x8b) {
+        r->format = zreader_gzip;
+    } else {
+        r->format = zreader_plain;
+    }
+
+#if defined(ZFILE_CODEC_ZSTD)
+    if (r->format == zreader_zstd) {
+        r->dctx = ZSTD_createDCtx();
+        if (r->dctx == NULL) {
+            fprintf(stderr, "error: %s could not be read: out of memory\n", r->name);
+            zreader_close(r);
+            return NULL;
+        }
+        return r;
+    }
+#elif defined(USE_BZIP2)
+    if (r->format == zreader_bzip2) {
+        int err;
+
+        r->bz = BZ2_bzReadOpen(&err, r->fp, 0, 0, r->buf, (int)r->len);
+        r->len = 0;
+        if (r->bz == NULL) {
+            fprintf(stderr, "error: %s is not valid bzip2\n", r->name);
+            zreader_close(r);
+            return NULL;
+        }
+        return r;
+    }
+#elif defined(ZFILE_CODEC_GZIP)
+    if (r->format == zreader_gzip) {
+        /* a window of 15 bits, plus 16 for a gzip header and trailer */
+        if (inflateInit2(&r->zs, 15 + 16) != Z_OK) {
+            fprintf(stderr, "error: %s could not be read: out of memory\n", r->name);
+            zreader_close(r);
+            return NULL;
+        }
+        r->zs_ready = 1;
+        return r;
+    }
+#endif
+    if (r->format != zreader_plain) {
+        fprintf(stderr, "error: %s is compressed with %s, which is not built in\n", r->name,
+                r->format == zreader_zstd ? "zstd" : r->format == zreader_gzip ? "gzip" : "bzip2");
+        zreader_close(r);
+        return NULL;
+    }
+    return r;
+}
+
+/**
+ * \fn const char *zreader_name (zreader r)
+ * \brief The name of the file that \p r reads, for messages.
+ */
+const char *zreader_name (zreader r) {
+    return r->name;
+}
+
+/**
+ * \fn int zreader_failed (zreader r)
+ * \brief Whether an error was reported while reading \p r.
+ */
+int zreader_failed (zreader r) {
+    return r->failed;
+}
+
+/**
+ * \fn int zread_block (zreader r, const char **block, size_t *size, size_t *expected)
+ * \brief Take the next compressed block of \p r, as zcodec_compress()
+ * writes it, without decompressing it.
+ *
+ * \param r reader
+ * \param block set to the block, which is only valid until \p r is
+ *        read again
+ * \param size set to the size of the block
+ * \param expected set to the size of the data in the block
+ * \return 1, 0 at the end of the file, or -1 if what follows is not a
+ *         block that records its size; the rest of the file can then
+ *         still be read with zread()
+ */
+int zread_block (zreader r, const char **block, size_t *size, size_t *expected) {
+    int rc;
+
+    if (r->failed || (r->format != zreader_zstd && r->format != zreader_gzip) || r->in_block) {
+        return -1;
+    }
+    if (r->off == r->len && zreader_fill(r) < 0) {
+        return -1;
+    }
+    if (r->off == r->len) {
+        return 0;
+    }
+    while ((rc = zblock_size(r->buf + r->off, r->len - r->off, size, expected)) == 0) {
+        if (r->eof || r->len - r->off > ZREADER_MAX_BLOCK || zreader_fill(r) < 0) {
+            return -1;
+        }
+    }
+    if (rc < 0 || *size > ZREADER_MAX_BLOCK || *expected > ZREADER_MAX_BLOCK) {
+        return -1;
+    }
+    *block = r->buf + r->off;
+    r->off += *size;
+    return 1;
+}
+
+/**
+ * \fn long zread (zreader r, char *buf, size_t len)
+ * \brief Read up to \p len bytes of the decompressed file; fewer are
+ * read only at its end.
+ * \return the bytes read, 0 at the end of the file, or -1 on an error,
+ *         which has been reported
+ */
+long zread (zreader r, char *buf, size_t len) {
+    size_t n = 0;
+
+    if (r->failed) {
+        return -1;
+    }
+    if (r->format == zreader_plain) {
+        n = r->len - r->off;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(buf, r->buf + r->off, n);
+        r->off += n;
+        if (n < len && !r->eof) {
+            size_t m = fread(buf + n, 1, len - n, r->fp);
+
+            if (m < len - n) {
+                if (ferror(r->fp)) {
+                    zreader_error(r, "could not be read");
+                }
+                r->eof = 1;
+            }
+            n += m;
+        }
+    } else {
+#if defined(ZFILE_CODEC_ZSTD)
+        ZSTD_outBuffer out = { buf, len, 0 };
+        ZSTD_inBuffer in;
+        size_t rc;
+
+        while (!r->failed && out.pos < out.size) {
+            if (r->off == r->len && zreader_fill(r) < 0) {
+                break;
+            }
+            if (r->off == r->len) {
+                if (r->in_block) {
+                    zreader_error(r, "ends in the middle of a zstd frame");
+                }
+                break;
+            }
+            in.src = r->buf + r->off;
+            in.size = r->len - r->off;
+            in.pos = 0;
+            rc = ZSTD_decompressStream(r->dctx, &out, &in);
+            r->off += in.pos;
+            if (ZSTD_isError(rc)) {
+                zreader_error(r, "is not valid zstd");
+            }
+            r->in_block = (rc != 0);
+        }
+        n = out.pos;
+#elif defined(USE_BZIP2)
+        int err, rc;
+
+        while (n < len && !r->done) {
+            rc = BZ2_bzRead(&err, r->bz, buf + n, (int)(len - n));
+            if (err != BZ_OK && err != BZ_STREAM_END) {
+                zreader_error(r, "is not valid bzip2");
+                break;
+            }
+            n += rc;
+            if (err == BZ_STREAM_END) {
+                r->done = 1;
+            }
+        }
+#elif defined(ZFILE_CODEC_GZIP)
+        int rc;
+
+        r->zs.next_out = (Bytef *)buf;
+        r->zs.avail_out = (uInt)len;
+        while (r->zs.avail_out) {
+            if (r->off == r->len && zreader_fill(r) < 0) {
+                break;
+            }
+            if (r->off == r->len) {
+                if (r->in_block) {
+                    zreader_error(r, "ends in the middle of a gzip member");
+                }
+                break;
+            }
+            r->zs.next_in = (Bytef *)r->buf + r->off;
+            r->zs.avail_in = (uInt)(r->len - r->off);
+            r->in_block = 1;
+            rc = inflate(&r->zs, Z_NO_FLUSH);
+            r->off = r->len - r->zs.avail_in;
+            if (rc == Z_STREAM_END) {
+                /* another member may follow */
+                r->in_block = 0;
+                inflateReset(&r->zs);
+            } else if (rc != Z_OK && rc != Z_BUF_ERROR) {
+                zreader_error(r, "is not valid gzip");
+                break;
+            }
+        }
+        n = len - r->zs.avail_out;
+#endif
+    }
+    if (n == 0 && r->failed) {
+        return -1;
+    }
+    return (long)n;
+}
+
+/**
+ * \fn void zreader_close (zreader r)
+ * \brief Close a reader from zreader_open().
+ */
+void zreader_close (zreader r) {
+    if (r == NULL) {
+        return;
+    }
+    if (r->fp != NULL && r->fp != stdin) {
+        fclose(r->fp);
+    }
+#if defined(ZFILE_CODEC_ZSTD)
+    ZSTD_freeDCtx(r->dctx);
+#elif defined(USE_BZIP2)
+    if (r->bz != NULL) {
+        int err;
+
+        BZ2_bzReadClose(&err, r->bz);
+    }
+#elif defined(ZFILE_CODEC_GZIP)
+    if (r->zs_ready) {
+        inflateEnd(&r->zs);
+    }
+#endif
+    free(r->buf);
+    free(r->name);
+    free(r);
+}
+
+/*
+ * checks that the pending output of f is expected, then discards it
+ */
+static int output_test_expect (zfile f, const char *expected, const char *what) {
+    int rc = 0;
+
+    if (f->len != strlen(expected) || memcmp(f->buf, expected, f->len) != 0) {
+        fprintf(stderr, "output_unit_test: %s: got \"%.*s\", expected \"%s\"\n",
+                what, (int)f->len, f->buf, expected);
+        rc = 1;
+    }
+    f->len = 0;
+    return rc;
+}
+
+/* reading back the test output; bzip2 has no line reader */
+#if (COMPRESSED_OUTPUT == 0)
+#define OUTPUT_TEST_READ_BACK        1
+#define output_test_reader           FILE *
+#define output_test_open(name)       fopen(name, "r")
+#define output_test_gets(in, s, n)   fgets(s, n, in)
+#define output_test_close(in)        fclose(in)
+#elif defined(USE_ZSTD)
+#define OUTPUT_TEST_READ_BACK        1
+
+/* reads the lines of a file of zstd frames, as gzgets() does */
+typedef struct output_test_zstd_ {
+    FILE *fp;
+    ZSTD_DCtx *dctx;
+    ZSTD_inBuffer in;
+    char inbuf[4096];
+    char out[4096];
+    size_t out_pos;
+    size_t out_len;
+} *output_test_reader;
+
+static output_test_reader output_test_open (const char *name) {
+    output_test_reader r = calloc(1, sizeof(struct output_test_zstd_));
+
+    if (r == NULL) {
+        return NULL;
+    }
+    r->fp = fopen(name, "rb");
+    r->dctx = ZSTD_createDCtx();
+    if (r->fp == NULL || r->dctx == NULL) {
+        if (r->fp != NULL) {
+            fclose(r->fp);
+        }
+        ZSTD_freeDCtx(r->dctx);
+        free(r);
+        return NULL;
+    }
+    r->in.src = r->inbuf;
+    return r;
+}
+
+static char *output_test_gets (output_test_reader r, char *s, int n) {
+    int len = 0;
+
+    while (len < n - 1) {
+        if (r->out_pos == r->out_len) {
+            ZSTD_outBuffer out = { r->out, sizeof(r->out), 0 };
+
+            /* decompress until there is output, or the file ends */
+            while (out.pos == 0) {
+                if (r->in.pos == r->in.size) {
+                    r->in.size = fread(r->inbuf, 1, sizeof(r->inbuf), r->fp);
+                    r->in.pos = 0;
+                    if (r->in.size == 0) {
+                        break;
+                    }
+                }
+                if (ZSTD_isError(ZSTD_decompressStream(r->dctx, &out, &r->in))) {
+                    return NULL;
+                }
+            }
+            if (out.pos == 0) {
+                break;
+            }
+            r->out_pos = 0;
+            r->out_len = out.pos;
+        }
+        s[len++] = r->out[r->out_pos++];
+        if (s[len - 1] == '\n') {
+            break;
+        }
+    }
+    s[len] = '\0';
+    return len ? s : NULL;
+}
+
+static void output_test_close (output_test_reader r) {
+    fclose(r->fp);
+    ZSTD_freeDCtx(r->dctx);
+    free(r);
+}
+
+#elif !defined(USE_BZIP2)
+#define OUTPUT_TEST_READ_BACK        1
+#define output_test_reader           gzFile
+#define output_test_open(name)       gzopen(name, "r")
+#define output_test_gets(in, s, n)   gzgets(in, s, n)
+#define output_test_close(in)        gzclose(in)
+#endif
+
+#if (COMPRESSED_OUTPUT == 1) && !defined(USE_BZIP2) && !defined(USE_ZSTD)
+/*
+ * checks that every gzip member of a file written in blocks carries
+ * its size in the 'J' 'B' field of its header, which readers use to
+ * step from one member to the next
+ */
+static int output_test_members (const char *name) {
+    unsigned char header[ZFILE_MEMBER_SIZE_OFFSET + 4];
+    unsigned long size, total = 0, members = 0;
+    long file_size;
+    FILE *fp;
+    int num_fails = 0;
+
+    fp = fopen(name, "rb");
+    if (fp == NULL || fseek(fp, 0, SEEK_END) != 0 || (file_size = ftell(fp)) < 0) {
+        fprintf(stderr, "output_unit_test: could not read back %s\n", name);
+        if (fp != NULL) {
+            fclose(fp);
+        }
+        return 1;
+    }
+    while (total < (unsigned long)file_size) {
+        if (fseek(fp, (long)total, SEEK_SET) != 0 ||
+            fread(header, 1, sizeof(header), fp) != sizeof(header) ||
+            header[0] != 0x1f || header[1] != 0x8b || !(header[3] & 0x04) ||
+            header[10] != 8 || header[11] != 0 || header[12] != 'J' || header[13] != 'B' ||
+            header[14] != 4 || header[15] != 0) {
+            fprintf(stderr, "output_unit_test: gzip member %lu has no size field\n", members);
+            num_fails++;
+            break;
+        }
+        size = header[16] | (header[17] << 8) | ((unsigned long)header[18] << 16) |
+            ((unsigned long)header[19] << 24);
+        if (size <= sizeof(header)) {
+            fprintf(stderr, "output_unit_test: gzip member %lu has size %lu\n", members, size);
+            num_fails++;
+            break;
+        }
+        total += size;
+        members++;
+    }
+    if (num_fails == 0 && (total != (unsigned long)file_size || members < 2)) {
+        fprintf(stderr, "output_unit_test: %lu gzip members add up to %lu of %ld bytes\n",
+                members, total, file_size);
+        num_fails++;
+    }
+    fclose(fp);
+    return num_fails;
+}
+#endif
+
+/*
+ * a block from zcodec_compress() is found again by zblock_size(),
+ * which asks for more of it when it is cut short
+ */
+static int output_test_codec (void) {
+    static const char text[] = "{\"sa\":\"10.0.0.1\",\"da\":\"10.0.0.2\"}\n";
+    zcodec c = zcodec_new(0);
+    size_t bound = zcodec_bound(sizeof(text)), n, size = 0, expected = 0;
+    char *block = malloc(bound);
+    int num_fails = 0;
+
+    if (c == NULL) {
+        free(block);
+        return 0;                 /* no block format in this build */
+    }
+    if (block == NULL || (n = zcodec_compress(c, text, sizeof(text), block, bound)) == 0) {
+        fprintf(stderr, "output_unit_test: zcodec_compress failed\n");
+        num_fails++;
+    } else if (zblock_size(block, n, &size, &expected) != 1 || size != n ||
+               expected != sizeof(text)) {
+        fprintf(stderr, "output_unit_test: zblock_size did not find the block\n");
+        num_fails++;
+    } else if (zblock_size(block, n - 1, &size, &expected) != 0 ||
+               zblock_size(text, sizeof(text), &size, &expected) != -1) {
+        fprintf(stderr, "output_unit_test: zblock_size took a partial block or text\n");
+        num_fails++;
+    }
+    zcodec_free(c);
+    free(block);
+    return num_fails;
+}
+
+/*
+ * a file of two blocks is read back whole by zread(), and block by
+ * block by zread_block()
+ */
+static int output_test_zreader (void) {
+    static const char text[] = "{\"sa\":\"10.0.0.1\"}\n{\"sa\":\"10.0.0.2\"}\n";
+    char name[] = "output_test_XXXXXX";
+    char back[2 * sizeof(text)];
+    const char *block;
+    size_t n, size, expected, half = sizeof(text) / 2;
+    zcodec c = zcodec_new(0);
+    char *packed = malloc(zcodec_bound(sizeof(text)));
+    int num_fails = 0, blocks = 0;
+    zreader r;
+    FILE *fp;
+
+#ifdef WIN32
+    if (_mktemp_s(name, sizeof(name)) != 0) {
+#else
+    int fd = mkstemp(name);
+
+    if (fd >= 0) {
+        close(fd);
+    } else {
+#endif
+        zcodec_free(c);
+        free(packed);
+        return 0;
+    }
+    fp = fopen(name, "wb");
+    if (fp != NULL) {
+        if (c == NULL) {
+            fwrite(text, 1, sizeof(text), fp);
+        } else if (packed != NULL) {
+            n = zcodec_compress(c, text, half, packed, zcodec_bound(sizeof(text)));
+            fwrite(packed, 1, n, fp);
+            n = zcodec_compress(c, text + half, sizeof(text) - half, packed,
+                                zcodec_bound(sizeof(text)));
+            fwrite(packed, 1, n, fp);
+        }
+        fclose(fp);
+    }
+
+    r = zreader_open(name);
+    if (r == NULL || zread(r, back, sizeof(back)) != sizeof(text) ||
+        memcmp(back, text, sizeof(text)) != 0 || zread(r, back, sizeof(back)) != 0) {
+        fprintf(stderr, "output_unit_test: zread did not read the file back\n");
+        num_fails++;
+    }
+    zreader_close(r);
+
+    r = zreader_open(name);
+    while (r != NULL && c != NULL && zread_block(r, &block, &size, &expected) == 1) {
+        blocks++;
+    }
+    if (c != NULL && blocks != 2) {
+        fprintf(stderr, "output_unit_test: zread_block found %d blocks\n", blocks);
+        num_fails++;
+    }
+    zreader_close(r);
+
+    remove(name);
+    zcodec_free(c);
+    free(packed);
+    return num_fails;
+}
+
+/*
+ * binary output (zbinary) through an asynchronous zfile with a short
+ * queue is never cut: the producer waits rather than dropping
+ */
+static int output_test_binary (void) {
+    enum { num_records = 100000 };
+    /* binary data may hold newlines, which must not be taken for record ends */
+    static const char record[] = "\xff\xff\xff\xff" "0123456789abcdef\n0123456789abcdef";
+    char name[] = "output_test_XXXXXX";
+    char back[4096];
+    zfile_stats_t stats;
+    unsigned long i, total = 0;
+    int num_fails = 0;
+    zreader r;
+    zfile f;
+    long n;
+
+#ifdef WIN32
+    if (_mktemp_s(name, sizeof(name)) != 0) {
+#else
+    int fd = mkstemp(name);
+
+    if (fd >= 0) {
+        close(fd);
+    } else {
+#endif
+        fprintf(stderr, "output_unit_test: could not create a temporary file\n");
+        return 1;
+    }
+
+    f = zopen(name, "w");
+    if (f == NULL || zasync(f, 2) != 0) {
+        fprintf(stderr, "output_unit_test: could not start the writer thread\n");
+        if (f != NULL) {
+            zclose(f);
+        }
+        remove(name);
+        return 1;
+    }
+    zbinary(f);
+    for (i = 0; i < num_records; i++) {
+        zwrite(f, record, sizeof(record) - 1);
+    }
+    zstats(f, &stats);
+    zclose(f);
+
+    r = zreader_open(name);
+    while (r != NULL && (n = zread(r, back, sizeof(back))) > 0) {
+        total += n;
+    }
+    zreader_close(r);
+    if (stats.records_dropped != 0 || total != num_records * (sizeof(record) - 1)) {
+        fprintf(stderr, "output_unit_test: binary output read back as %lu bytes, %lu dropped\n",
+                total, stats.bytes_dropped);
+        num_fails++;
+    }
+    remove(name);
+    return num_fails;
+}
+
+/*
+ * writes numbered records through a writer thread with too few
+ * buffers to keep up, and checks that what reaches the file is whole
+ * records, in order, ending with the last one; with compression
+ * threads, nothing may be dropped
+ */
+static int output_test_async (unsigned int threads) {
+    enum { num_records = 200000 };
+    char name[] = "output_test_XXXXXX";
+    zfile_stats_t stats;
+    unsigned long i;
+    int num_fails = 0;
+    zfile f;
+
+#ifdef WIN32
+    if (_mktemp_s(name, sizeof(name)) != 0) {
+#else
+    int fd = mkstemp(name);
+
+    if (fd >= 0) {
+        close(fd);
+    } else {
+#endif
+        fprintf(stderr, "output_unit_test: could not create a temporary file\n");
+        return 1;
+    }
+
+    zconfigure(1, threads);
+    f = zopen(name, "w");
+    zconfigure(0, 0);
+    if (f == NULL || (threads == 0 && zasync(f, 2) != 0) ||
+        (f->codec != NULL && threads > 0 && f->async == NULL)) {
+        fprintf(stderr, "output_unit_test: could not start the writer thread\n");
+        if (f != NULL) {
+            zclose(f);
+        }
+        remove(name);
+        return 1;
+    }
+    for (i = 0; i < num_records; i++) {
+        zputs(f, "{\"record\":");
+        zprint_uint(f, i);
+        zputs(f, ",\"padding\":\"");
+        zprint_hex(f, (const unsigned char *)name, sizeof(name));
+        zputs(f, "\"}\n");
+        if (i % 1000 == 0) {
+            zdrain(f);
+        }
+    }
+    /* nothing is dropped after this; zclose() waits for the writer */
+    zstats(f, &stats);
+    if (zclose(f) != 0) {
+        fprintf(stderr, "output_unit_test: asynchronous close failed\n");
+        num_fails++;
+    }
+
+#if (COMPRESSED_OUTPUT == 1) && !defined(USE_BZIP2) && !defined(USE_ZSTD)
+    if (threads > 0) {
+        num_fails += output_test_members(name);
+    }
+#endif
+
+#ifdef OUTPUT_TEST_READ_BACK
+    {
+        output_test_reader in;
+        char line[128];
+        unsigned long n, next = 0, lines = 0;
+
+        in = output_test_open(name);
+        if (in == NULL) {
+            fprintf(stderr, "output_unit_test: could not read back %s\n", name);
+            remove(name);
+            return num_fails + 1;
+        }
+        while (output_test_gets(in, line, sizeof(line)) != NULL) {
+            if (sscanf(line, "{\"record\":%lu,", &n) != 1 || n < next ||
+                line[strlen(line) - 1] != '\n') {
+                fprintf(stderr, "output_unit_test: broken record \"%s\" after %lu\n", line, next);
+                num_fails++;
+                break;
+            }
+            next = n + 1;
+            lines++;
+        }
+        output_test_close(in);
+
+        if (next != num_records || lines != num_records - stats.records_dropped ||
+            (threads > 0 && stats.records_dropped > 0)) {
+            fprintf(stderr, "output_unit_test: %lu of %u records read back, %lu dropped\n",
+                    lines, num_records, stats.records_dropped);
+            num_fails++;
+        }
+    }
+#endif
+    remove(name);
+
+    return num_fails;
+}
+
+/*
+ * checks that a memory zfile keeps all of its output, including what
+ * does not fit in its buffer, and that it can be cleared
+ */
+static int output_test_memory (void) {
+    unsigned long i, n = 3 * ZFILE_BUFFER_SIZE / 8;
+    const char *data;
+    size_t len = 0;
+    int num_fails = 0;
+    zfile f;
+
+    f = zopen_memory();
+    if (f == NULL) {
+        fprintf(stderr, "output_unit_test: could not open a memory zfile\n");
+        return 1;
+    }
+    zputs(f, "head");
+    data = zmemory(f, &len);
+    if (data == NULL || len != 4 || memcmp(data, "head", 4) != 0) {
+        fprintf(stderr, "output_unit_test: memory zfile lost \"head\"\n");
+        num_fails++;
+    }
+    zmemory_clear(f);
+    for (i = 0; i < n; i++) {
+        zprint_hex(f, (const unsigned char *)&i, 4);
+    }
+    data = zmemory(f, &len);
+    if (data == NULL || len != n * 8) {
+        fprintf(stderr, "output_unit_test: memory zfile holds %lu bytes, expected %lu\n",
+                (unsigned long)len, n * 8);
+        num_fails++;
+    } else {
+        for (i = 0; i < n; i++) {
+            char expected[9];
+            const unsigned char *b = (const unsigned char *)&i;
+
+            snprintf(expected, sizeof(expected), "%02x%02x%02x%02x", b[0], b[1], b[2], b[3]);
+            if (memcmp(data + 8 * i, expected, 8) != 0) {
+                fprintf(stderr, "output_unit_test: memory zfile broken at value %lu\n", i);
+                num_fails++;
+                break;
+            }
+        }
+    }
+    zmemory_clear(f);
+    data = zmemory(f, &len);
+    if (data == NULL || len != 0) {
+        fprintf(stderr, "output_unit_test: memory zfile was not cleared\n");
+        num_fails++;
+    }
+    zclose(f);
+
+    return num_fails;
+}
+
+/**
+ * \fn int output_unit_test (void)
+ * \brief check the formatters against printf and inet_ntop, and the
+ *        buffering of output that does not fit
+ * \return number of failures
+ */
+int output_unit_test (void) {
+    static const uint64_t values[] = {
+        0, 1, 9, 10, 99, 100, 101, 999, 1000, 65535, 65536, 1234567,
+        4294967295U, 4294967296ULL, 18446744073709551615ULL
+    };
+    static const unsigned char bytes[] = { 0x00, 0x7f, 0x80, 0xab, 0xff };
+    char expected[64];
+    struct timeval ts;
+    struct in_addr addr;
+    FILE *fp;
+    zfile f;
+    char *big;
+    size_t held;
+    unsigned int i;
+    int num_fails = 0;
+
+    fp = tmpfile();
+    if (fp == NULL || (f = zattach(fp, "w")) == NULL) {
+        fprintf(stderr, "output_unit_test: could not open a temporary file\n");
+        return 1;
+    }
+
+    for (i = 0; i < sizeof(values)/sizeof(values[0]); i++) {
+        zprint_uint(f, values[i]);
+        snprintf(expected, sizeof(expected), "%llu", (unsigned long long)values[i]);
+        num_fails += output_test_expect(f, expected, "zprint_uint");
+
+        zprint_int(f, -(int64_t)(values[i] >> 1));
+        snprintf(expected, sizeof(expected), "%lld", -(long long)(values[i] >> 1));
+        num_fails += output_test_expect(f, expected, "zprint_int");
+    }
+
+    ts.tv_sec = 1514764800;
+    ts.tv_usec = 42;
+    zprint_timeval(f, &ts);
+    num_fails += output_test_expect(f, "1514764800.000042", "zprint_timeval");
+    ts.tv_sec = 0;
+    ts.tv_usec = 999999;
+    zprint_timeval(f, &ts);
+    num_fails += output_test_expect(f, "0.999999", "zprint_timeval");
+
+    for (i = 0; i < sizeof(values)/sizeof(values[0]); i++) {
+        addr.s_addr = (uint32_t)(values[i] * 2654435761U);
+        zprint_ipv4(f, &addr);
+        inet_ntop(AF_INET, &addr, expected, sizeof(expected));
+        num_fails += output_test_expect(f, expected, "zprint_ipv4");
+    }
+
+    zprint_hex(f, bytes, sizeof(bytes));
+    num_fails += output_test_expect(f, "007f80abff", "zprint_hex");
+
+    zprint_json_string(f, "a\"b/c\\d\te\x80" "f", 32);
+    num_fails += output_test_expect(f, "a.b.c.d.e.f", "zprint_json_string");
+    zprint_json_string(f, "abcdef", 3);
+    num_fails += output_test_expect(f, "abc", "zprint_json_string");
+    zprint_json_string(f, "ab\0cd", 5);
+    num_fails += output_test_expect(f, "ab", "zprint_json_string");
+
+    /*
+     * output that does not fit goes through in pieces, and the buffer
+     * is reused; a file written in compressed blocks (as zstd files
+     * always are) keeps the "{" in the buffer, as it is not half full
+     */
+    held = f->codec != NULL ? 1 : 0;
+    big = malloc(ZFILE_BUFFER_SIZE + 1);
+    if (big != NULL) {
+        memset(big, 'x', ZFILE_BUFFER_SIZE);
+        big[ZFILE_BUFFER_SIZE] = 0;
+        zputs(f, "{");
+        if (zprintf(f, "%s", big) != ZFILE_BUFFER_SIZE ||
+            f->len != (held ? held : ZFILE_BUFFER_SIZE)) {
+            fprintf(stderr, "output_unit_test: oversized zprintf was not buffered whole\n");
+            num_fails++;
+        }
+        zprintf(f, "%s", big + 4);
+        if (f->len != ZFILE_BUFFER_SIZE - 4 + held) {
+            fprintf(stderr, "output_unit_test: zprintf did not buffer\n");
+            num_fails++;
+        }
+        zprintf(f, "%u}", 12345678);
+        num_fails += output_test_expect(f, "12345678}", "zprintf after a full buffer");
+        free(big);
+    }
+
+    if (zclose(f) != 0) {
+        fprintf(stderr, "output_unit_test: close failed\n");
+        num_fails++;
+    }
+
+    num_fails += output_test_memory();
+    num_fails += output_test_codec();
+    num_fails += output_test_zreader();
+    num_fails += output_test_async(0);
+    num_fails += output_test_async(3);
+    num_fails += output_test_binary();
+
+    return num_fails;
+}
@@ -62,6 +62,8 @@
 #include "radix_trie.h" /* trie for subnet labels        */
 #include "config.h"     /* configuration                 */
 #include "output.h"     /* compressed output             */
+#include "cbor_output.h" /* binary output                */
+#include "upload.h"     /* upload of rotated files       */
 #include "salt.h"  // Because Windows!
 #include "ipfix.h" /* ipfix protocol */
 #include "proto_identify.h"
@@ -105,6 +107,8 @@ static const int include_os = 1;
  */
 static void flow_record_delete(joy_ctx_data *ctx, flow_record_t *r);
 static void flow_record_print_and_delete(joy_ctx_data *ctx, flow_record_t *record);
+static void flow_record_write_arrow(joy_ctx_data *ctx);
+static zfile flow_record_json_scratch(joy_ctx_data *ctx);
 
 /* ***********************************************
  * -----------------------------------------------
@@ -145,6 +149,36 @@ void flocap_stats_output (joy_ctx_data *ctx, FILE *f) {
 #endif
     fprintf(f, "%s info: %lu packets, %lu active records, %lu records output, %lu alloc fails, %.4e bytes/sec, %.4e packets/sec, %.4e records/sec\n",
               time_str, ctx->stats.num_packets, ctx->stats.num_records_in_table, ctx->stats.num_records_output, ctx->stats.malloc_fail, bps, pps, rps);
+    if (glb_config->sample_rate > 1 || glb_config->adaptive_sample) {
+        fprintf(f, "%s info: sampling 1-in-%u flows now (configured 1-in-%u), %lu packets skipped by sampling\n",
+                time_str, flow_sampling_get_rate(ctx), glb_config->sample_rate ? glb_config->sample_rate : 1,
+                ctx->stats.num_packets_unsampled);
+    }
+    if (glb_config->report_tls) {
+        unsigned long cert_hits, cert_misses;
+        unsigned int cert_entries;
+
+        tls_certificate_cache_stats(&cert_hits, &cert_misses, &cert_entries);
+        fprintf(f, "%s info: certificate cache %u entries, %lu hits, %lu misses\n",
+                time_str, cert_entries, cert_hits, cert_misses);
+    }
+    if (glb_config->async_output && ctx->output) {
+        zfile_stats_t out;
+
+        zstats(ctx->output, &out);
+        fprintf(f, "%s info: output queue %lu buffers (max %lu), %lu bytes written, %lu records dropped, %lu stalls, %lu write errors\n",
+                time_str, out.queue_depth, out.queue_depth_max, out.bytes_written,
+                out.records_dropped, out.stalls, out.write_errors);
+    }
+    if (glb_config->upload_servername) {
+        upload_stats_t up;
+
+        upload_stats(&up);
+        fprintf(f, "%s info: upload queue %lu files, %lu transfers, %lu files uploaded (%lu bytes, %.4e bytes/sec per transfer), %lu retries, %lu failed\n",
+                time_str, up.queue_depth, up.active, up.files_uploaded, up.bytes_uploaded,
+                up.transfer_seconds > 0 ? up.bytes_uploaded / up.transfer_seconds : 0.0,
+                up.retries, up.failures);
+    }
     fflush(f);
 
     ctx->last_stats_output_time = now;
@@ -153,6 +187,7 @@ void flocap_stats_output (joy_ctx_data *ctx, FILE *f) {
     ctx->last_stats.num_records_in_table = ctx->stats.num_records_in_table;
     ctx->last_stats.num_records_output = ctx->stats.num_records_output;
     ctx->last_stats.malloc_fail = ctx->stats.malloc_fail;
+    ctx->last_stats.num_packets_unsampled = ctx->stats.num_packets_unsampled;
 }
 
 /**
@@ -203,6 +238,189 @@ static unsigned int flow_key_hash (const flow_key_t *f) {
     }
 }
 
+/*
+ * in adaptive mode, the sampling rate is changed at most once per
+ * SAMPLE_ADAPT_INTERVAL seconds; it is relaxed back towards the
+ * configured rate after SAMPLE_RELAX_INTERVAL seconds without drops
+ */
+#define SAMPLE_ADAPT_INTERVAL 1
+#define SAMPLE_RELAX_INTERVAL 60
+
+/**
+ * \brief Calculate the sampling hash of a given flow_key.
+ *
+ * Unlike flow_key_hash(), this hash is symmetric, so that a flow and
+ * its twin have the same value; as with flow_key_hash(), addresses are
+ * omitted when NAT'ed twins are being matched.
+ *
+ * \param f The flow_key to hash
+ * \return Hash of \p f
+ */
+static unsigned int flow_key_sample_hash (const flow_key_t *f) {
+    unsigned int h, addrs = 0;
+
+    if (glb_config->flow_key_match_method == EXACT_MATCH) {
+        addrs = (unsigned int)f->sa.s_addr ^ (unsigned int)f->da.s_addr;
+    }
+    h = addrs * 0x9e3779b1;
+    h ^= (((unsigned int)f->sp ^ (unsigned int)f->dp)
+          | ((unsigned int)(f->sp + f->dp) << 16)) * 0x85ebca6b;
+    h ^= (unsigned int)f->prot * 0xc2b2ae35;
+
+    /* final avalanche, so that low-order bits depend on the whole key */
+    h ^= h >> 16;
+    h *= 0x7feb352d;
+    h ^= h >> 15;
+    h *= 0x846ca68b;
+    h ^= h >> 16;
+
+    return h;
+}
+
+/**
+ * \brief Get the flow sampling rate that is in effect for a context.
+ * \param ctx The joy context
+ * \return N, where 1-in-N flows are kept
+ */
+unsigned int flow_sampling_get_rate (const joy_ctx_data *ctx) {
+    if (ctx->sample_rate) {
+        return ctx->sample_rate;
+    }
+    return glb_config->sample_rate ? glb_config->sample_rate : 1;
+}
+
+/* the index of a sampling rate in ctx->sample_records: log2 of the rate */
+static unsigned int flow_sampling_shift (unsigned int rate) {
+    unsigned int shift = 0;
+
+    while (rate > 1 && shift < MAX_SAMPLE_SHIFT) {
+        rate >>= 1;
+        shift++;
+    }
+    return shift;
+}
+
+/**
+ * \brief Get the sampling rate that a new record of a flow is kept at.
+ *
+ * This is the current rate, unless the flow is kept only because it
+ * already has records, in which case it is the highest of the rates
+ * that the flow passes (the rates in use are the configured rate times
+ * powers of two).
+ *
+ * \param ctx The joy context
+ * \param key The flow_key of the record
+ * \return N, where the flow is one of 1-in-N flows
+ */
+static unsigned int flow_sampling_record_rate (const joy_ctx_data *ctx, const flow_key_t *key) {
+    unsigned int rate = flow_sampling_get_rate(ctx);
+    unsigned int floor = glb_config->sample_rate ? glb_config->sample_rate : 1;
+    unsigned int h;
+
+    if (!glb_config->adaptive_sample || rate <= floor) {
+        return rate;
+    }
+    h = flow_key_sample_hash(key);
+    while (rate > floor && (h % rate) != 0) {
+        rate >>= 1;
+    }
+    return rate;
+}
+
+/*
+ * flow_sampling_may_have_record(ctx, h, rate) returns zero if no
+ * record can exist for a flow with sampling hash h that is not kept at
+ * rate: that is so if h does not pass the lowest rate of the records
+ * that are in the table, since every lower rate divides the higher ones
+ */
+static int flow_sampling_may_have_record (const joy_ctx_data *ctx, unsigned int h, unsigned int rate) {
+    unsigned int top = flow_sampling_shift(rate);
+    unsigned int i;
+
+    for (i = 0; i < top; i++) {
+        if (ctx->sample_records[i]) {
+            return (h % (rate >> (top - i))) == 0;
+        }
+    }
+    return 0;
+}
+
+/**
+ * \brief Decide whether a flow is kept under the current sampling rate.
+ *
+ * A flow is kept when its sampling hash is divisible by the rate.  The
+ * adaptive mode only ever doubles or halves the rate, so the flows that
+ * are kept at rate 2N are a subset of those kept at rate N; flows that
+ * already have a record are always kept, so that a rate change does not
+ * cut existing flows short.
+ *
+ * \param ctx The joy context
+ * \param key The flow_key of the packet (ports included)
+ * \return 1 if the packet should be processed, 0 otherwise
+ */
+unsigned int flow_key_is_sampled (joy_ctx_data *ctx, const flow_key_t *key) {
+    unsigned int rate = flow_sampling_get_rate(ctx);
+    unsigned int h;
+
+    if (rate <= 1) {
+        return 1;
+    }
+    h = flow_key_sample_hash(key);
+    if ((h % rate) == 0) {
+        return 1;
+    }
+    if (glb_config->adaptive_sample &&
+        flow_sampling_may_have_record(ctx, h, rate) &&
+        flow_key_get_record(ctx, key, DONT_CREATE_RECORDS, NULL) != NULL) {
+        return 1;
+    }
+
+    flocap_stats_incr_packets_unsampled(ctx);
+    return 0;
+}
+
+/**
+ * \brief Adapt the flow sampling rate to the capture drop counter.
+ *
+ * If the number of packets dropped by the capture ring has grown since
+ * the last call, the sampling rate is doubled (up to MAX_SAMPLE_RATE);
+ * after a quiet period without drops, it is halved, but never below the
+ * configured sample_rate.  This function does nothing unless
+ * adaptive_sample is configured.
+ *
+ * \param ctx The joy context
+ * \param num_drops Cumulative count of packets dropped by the capture
+ * \return none
+ */
+void flow_sampling_update (joy_ctx_data *ctx, unsigned long int num_drops) {
+    unsigned int rate, floor;
+    struct timeval elapsed;
+
+    if (!glb_config->adaptive_sample) {
+        return;
+    }
+
+    floor = glb_config->sample_rate ? glb_config->sample_rate : 1;
+    rate = flow_sampling_get_rate(ctx);
+    joy_timer_sub(&ctx->global_time, &ctx->sample_last_change, &elapsed);
+
+    if (num_drops > ctx->sample_last_drops) {
+        if (elapsed.tv_sec >= SAMPLE_ADAPT_INTERVAL && rate < MAX_SAMPLE_RATE) {
+            rate = (rate * 2 > MAX_SAMPLE_RATE) ? MAX_SAMPLE_RATE : rate * 2;
+            joy_log_warn("capture dropped %lu packets; sampling 1-in-%u flows",
+                         num_drops - ctx->sample_last_drops, rate);
+            ctx->sample_last_change = ctx->global_time;
+        }
+        ctx->sample_last_drops = num_drops;
+    } else if (rate > floor && elapsed.tv_sec >= SAMPLE_RELAX_INTERVAL) {
+        rate = (rate / 2 < floor) ? floor : rate / 2;
+        joy_log_info("no capture drops; sampling 1-in-%u flows", rate);
+        ctx->sample_last_change = ctx->global_time;
+    }
+
+    ctx->sample_rate = rate;
+}
+
 /**
  * \brief Initialize the flow_record_list.
  * \param none
@@ -238,6 +456,18 @@ void flow_record_list_free (joy_ctx_data *ctx) {
     }
     ctx->flow_record_chrono_first = NULL;
     ctx->flow_record_chrono_last = NULL;
+
+    if (ctx->flow_batch != NULL) {
+        if (ctx->output != NULL) {
+            flow_record_write_arrow(ctx);
+        }
+        arrow_batch_free(ctx->flow_batch);
+        ctx->flow_batch = NULL;
+    }
+    if (ctx->json_scratch != NULL) {
+        zclose(ctx->json_scratch);
+        ctx->json_scratch = NULL;
+    }
 }
 
 /**
@@ -351,6 +581,8 @@ static void flow_record_init (joy_ctx_data *ctx,
     /* Set the flow_key and TTL */
     flow_key_copy(&record->key, key);
     record->ip.ttl = MAX_TTL;
+    record->sample_rate = flow_sampling_record_rate(ctx, key);
+    ctx->sample_records[flow_sampling_shift(record->sample_rate)]++;
 }
 
 /**
@@ -721,6 +953,7 @@ static void flow_record_delete (joy_ctx_data *ctx, flow_record_t *r) {
     }
 
     flocap_stats_decr_records_in_table(ctx);
+    ctx->sample_records[flow_sampling_shift(r->sample_rate)]--;
 
     /*
      * free the memory allocated inside of flow record
@@ -747,6 +980,9 @@ static void flow_record_delete (joy_ctx_data *ctx, flow_record_t *r) {
 
     delete_all_features(feature_list);
 
+    /* the features allocate from the arena of the record */
+    joy_arena_release(&r->arena);
+
     /*
      * zeroize memory (this is defensive coding; pointers to deleted
      * records will result in crashes rather than silent errors)
@@ -875,16 +1111,24 @@ static float flow_record_get_byte_count_entropy (const unsigned int byte_count[2
 
 static void print_bytes_dir_time (joy_ctx_data *ctx,
                                   unsigned short int pkt_len,
-                                  char *dir,
+                                  const char *dir,
                                   struct timeval ts,
                                   char *term) {
+    zfile f = ctx->output;
+
     if (pkt_len < 32768) {
-        zprintf(ctx->output, "{\"b\":%u,\"dir\":\"%s\",\"ipt\":%u}%s",
-                    pkt_len, dir, joy_timeval_to_milliseconds(ts), term);
+        zputs(f, "{\"b\":");
+        zprint_uint(f, pkt_len);
     } else {
-        zprintf(ctx->output, "{\"rep\":%u,\"dir\":\"%s\",\"ipt\":%u}%s",
-                    65536-pkt_len, dir, joy_timeval_to_milliseconds(ts), term);
-    }
+        zputs(f, "{\"rep\":");
+        zprint_uint(f, 65536-pkt_len);
+    }
+    zputs(f, ",\"dir\":\"");
+    zputs(f, dir);
+    zputs(f, "\",\"ipt\":");
+    zprint_uint(f, joy_timeval_to_milliseconds(ts));
+    zputc(f, '}');
+    zputs(f, term);
 }
 
 /**
@@ -897,14 +1141,9 @@ static void print_bytes_dir_time (joy_ctx_data *ctx,
 void zprintf_raw_as_hex (zfile f,
                          const unsigned char *data,
                          unsigned int len) {
-    const unsigned char *x = data;
-    const unsigned char *end = data + len;
-
-    zprintf(f, "\"");   /* quotes needed for JSON */
-    while (x < end) {
-        zprintf(f, "%02x", *x++);
-    }
-    zprintf(f, "\"");
+    zputc(f, '"');   /* quotes needed for JSON */
+    zprint_hex(f, data, len);
+    zputc(f, '"');
 }
 
 static void reduce_bd_bits (unsigned int *bd,
@@ -1111,27 +1350,31 @@ static void print_ip_json (zfile f, const flow_record_t *rec) {
 
     zprintf(f, ",\"ip\":{");
 
-    zprintf(f, "\"out\":{");
-    zprintf(f, "\"ttl\":%u", rec->ip.ttl);
+    zputs(f, "\"out\":{\"ttl\":");
+    zprint_uint(f, rec->ip.ttl);
     if (rec->ip.num_id) {
         zprintf(f, ",\"id\":[");
         for (k = 0; k < rec->ip.num_id - 1; k++) {
-            zprintf(f, "%u,", rec->ip.id[k]);
+            zprint_uint(f, rec->ip.id[k]);
+            zputc(f, ',');
         }
-        zprintf(f, "%u]", rec->ip.id[k]);
+        zprint_uint(f, rec->ip.id[k]);
+        zputc(f, ']');
     }
     /* End out object */
     zprintf(f, "}");
 
     if (rec->twin) {
-        zprintf(f, ",\"in\":{");
-        zprintf(f, "\"ttl\":%u", rec->twin->ip.ttl);
+        zputs(f, ",\"in\":{\"ttl\":");
+        zprint_uint(f, rec->twin->ip.ttl);
         if (rec->twin->ip.num_id) {
             zprintf(f, ",\"id\":[");
             for (k = 0; k < rec->twin->ip.num_id - 1; k++) {
-                zprintf(f, "%u,", rec->twin->ip.id[k]);
+                zprint_uint(f, rec->twin->ip.id[k]);
+                zputc(f, ',');
             }
-            zprintf(f, "%u]", rec->twin->ip.id[k]);
+            zprint_uint(f, rec->twin->ip.id[k]);
+            zputc(f, ']');
         }
         /* End in object */
         zprintf(f, "}");
@@ -1204,23 +1447,18 @@ static const flow_record_t *get_client_flow(const flow_record_t *a,
 #define IN  ">"
 
 /**
- * \brief Print a flow record to the JSON output.
+ * \brief Put the two halves of a flow record in output order.
  *
  * \param record Flow record to print
+ * \param ts_start Start time of the flow (both directions)
+ * \param ts_end End time of the flow (both directions)
  *
- * \return none
+ * \return the half of the flow that is reported as outbound
  */
-static void flow_record_print_json
- (joy_ctx_data *ctx, const flow_record_t *record) {
-    unsigned int i, j, imax, jmax;
-    struct timeval ts, ts_last, ts_start, ts_end, tmp;
+static const flow_record_t *flow_record_orient (const flow_record_t *record,
+                                                struct timeval *ts_start,
+                                                struct timeval *ts_end) {
     const flow_record_t *rec = NULL;
-    unsigned int pkt_len;
-    char *dir;
-    char ipv4_addr[INET_ADDRSTRLEN];
-
-    flocap_stats_incr_records_output(ctx);
-    ctx->records_in_file++;
 
     if (record->twin != NULL) {
         /*
@@ -1237,7 +1475,7 @@ static void flow_record_print_json
             rec = get_client_flow(record, record->twin);
             if (rec != NULL) {
                 compare_start_times = 0;
-                ts_start = rec->start;
+                *ts_start = rec->start;
             }
         }
 
@@ -1247,10 +1485,10 @@ static void flow_record_print_json
              * Use the smaller of the 2 time values.
              */
             if (joy_timer_lt(&record->start, &record->twin->start)) {
-                ts_start = record->start;
+                *ts_start = record->start;
                 rec = record;
             } else {
-                ts_start = record->twin->start;
+                *ts_start = record->twin->start;
                 rec = record->twin;
             }
         }
@@ -1260,287 +1498,223 @@ static void flow_record_print_json
          * Use the larger of the 2 time values.
          */
         if (joy_timer_lt(&record->end, &record->twin->end)) {
-            ts_end = record->twin->end;
+            *ts_end = record->twin->end;
         } else {
-            ts_end = record->end;
+            *ts_end = record->end;
         }
     } else {
         /*
          * The flow is unidirectional. Easy enough.
          */
-        ts_start = record->start;
-        ts_end = record->end;
+        *ts_start = record->start;
+        *ts_end = record->end;
         rec = record;
     }
 
-    /*****************************************************************
-     * ---------------------------------------------------------------
-     * Flow Record object start
-     * ---------------------------------------------------------------
-     *****************************************************************
-     */
-    zprintf(ctx->output, "{");
-
-    if (ipv4_addr_needs_anonymization(&rec->key.sa)) {
-        zprintf(ctx->output, "\"sa\":\"%s\",", addr_get_anon_hexstring(&rec->key.sa));
-    } else {
-        inet_ntop(AF_INET, &rec->key.sa, ipv4_addr, INET_ADDRSTRLEN);
-        zprintf(ctx->output, "\"sa\":\"%s\",", ipv4_addr);
-    }
-    if (ipv4_addr_needs_anonymization(&rec->key.da)) {
-        zprintf(ctx->output, "\"da\":\"%s\",", addr_get_anon_hexstring(&rec->key.da));
-    } else {
-        inet_ntop(AF_INET, &rec->key.da, ipv4_addr, INET_ADDRSTRLEN);
-        zprintf(ctx->output, "\"da\":\"%s\",", ipv4_addr);
-    }
-    zprintf(ctx->output, "\"pr\":%u,", rec->key.prot);
-
-    if (rec->key.prot == 6 || rec->key.prot == 17) {
-        zprintf(ctx->output, "\"sp\":%u,", rec->key.sp);
-        zprintf(ctx->output, "\"dp\":%u,", rec->key.dp);
-    } else {
-        /* Make dp/sp null so that they can still be compared */
-        zprintf(ctx->output, "\"sp\":null,");
-        zprintf(ctx->output, "\"dp\":null,");
-    }
-
-    /*
-     * if src or dst address matches a subnets associated with labels,
-     * then print out those labels
-     */
-    if (glb_config->num_subnets) {
-        attr_flags flag;
+    return rec;
+}
 
-        flag = radix_trie_lookup_addr(glb_config->rt, rec->key.sa);
-        attr_flags_json_print_labels(glb_config->rt, flag, "sa_labels", ctx->output);
-        flag = radix_trie_lookup_addr(glb_config->rt, rec->key.da);
-        attr_flags_json_print_labels(glb_config->rt, flag, "da_labels", ctx->output);
-    }
+/** packet lengths, directions and inter-packet times of a flow, in time order */
+typedef struct flow_splt_ {
+    unsigned int num;
+    unsigned short int len[2 * NUM_PKT_LEN];
+    unsigned char in[2 * NUM_PKT_LEN];   /* 1 for IN, the packets of rec; 0 for OUT, those of its twin */
+    struct timeval ipt[2 * NUM_PKT_LEN];
+} flow_splt_t;
 
-    /*
-     * Flow stats
-     */
-    zprintf(ctx->output, "\"bytes_out\":%u,", rec->ob);
-    zprintf(ctx->output, "\"num_pkts_out\":%u,", rec->np); /* not just packets with data */
-    if (rec->twin != NULL) {
-        zprintf(ctx->output, "\"bytes_in\":%u,", rec->twin->ob);
-        zprintf(ctx->output, "\"num_pkts_in\":%u,", rec->twin->np);
-    }
-#ifdef WIN32
-        zprintf(ctx->output, "\"time_start\":%i.%06i,", ts_start.tv_sec, ts_start.tv_usec);
-        zprintf(ctx->output, "\"time_end\":%i.%06i,", ts_end.tv_sec, ts_end.tv_usec);
-#else
-    zprintf(ctx->output, "\"time_start\":%zd.%06zd,", ts_start.tv_sec, (long)ts_start.tv_usec);
-    zprintf(ctx->output, "\"time_end\":%zd.%06zd,", ts_end.tv_sec, (long)ts_end.tv_usec);
-#endif
+/**
+ * \brief Merge the packet lengths and times of both halves of a flow.
+ *
+ * \param rec Flow record, as returned by flow_record_orient()
+ * \param ts_start Start time of the flow
+ * \param splt Filled in with the packets of the flow
+ *
+ * \return none
+ */
+static void flow_record_get_splt (const flow_record_t *rec,
+                                  const struct timeval *ts_start,
+                                  flow_splt_t *splt) {
+    unsigned int i, j, imax, jmax;
+    struct timeval ts, ts_last;
 
-    /*****************************************************************
-     * Packet length and time array
-     *****************************************************************
-     */
-    zprintf(ctx->output, "\"packets\":[");
+    splt->num = 0;
+    imax = rec->op > NUM_PKT_LEN ? NUM_PKT_LEN : rec->op;
 
     if (rec->twin == NULL) {
-
-        imax = rec->op > NUM_PKT_LEN ? NUM_PKT_LEN : rec->op;
-        if (imax == 0) {
-            ; /* no packets had data, so we print out nothing */
-        } else {
-            for (i = 0; i < imax-1; i++) {
-                if (i > 0) {
-                    joy_timer_sub(&rec->pkt_time[i], &rec->pkt_time[i-1], &ts);
-                } else {
-                    joy_timer_clear(&ts);
-                }
-                print_bytes_dir_time(ctx, rec->pkt_len[i], OUT, ts, ",");
-            }
-            if (i == 0) {        /* TODO this code could be simplified */
-                joy_timer_clear(&ts);
-            } else {
-                joy_timer_sub(&rec->pkt_time[i], &rec->pkt_time[i-1], &ts);
-            }
-            print_bytes_dir_time(ctx, rec->pkt_len[i], OUT, ts, "");
-        }
-        zprintf(ctx->output, "]");
-    } else {
-        imax = rec->op > NUM_PKT_LEN ? NUM_PKT_LEN : rec->op;
-        jmax = rec->twin->op > NUM_PKT_LEN ? NUM_PKT_LEN : rec->twin->op;
-        i = j = 0;
-        ts_last = ts_start;
-
-        while ((i < imax) || (j < jmax)) {
-            if (i >= imax) {
-                /* record list is exhausted, so use twin */
-                    dir = OUT;
-                    ts = rec->twin->pkt_time[j];
-                    pkt_len = rec->twin->pkt_len[j];
-                    j++;
-            } else if (j >= jmax) {
-                /* twin list is exhausted, so use record */
-                dir = IN;
-                    ts = rec->pkt_time[i];
-                    pkt_len = rec->pkt_len[i];
-                    i++;
+        for (i = 0; i < imax; i++) {
+            if (i > 0) {
+                joy_timer_sub(&rec->pkt_time[i], &rec->pkt_time[i-1], &splt->ipt[i]);
             } else {
-                /* Neither list is exhausted, so use list with lowest time */
-                if (joy_timer_lt(&rec->pkt_time[i], &rec->twin->pkt_time[j])) {
-                    ts = rec->pkt_time[i];
-                    pkt_len = rec->pkt_len[i];
-                    dir = IN;
-                    if (i < imax) i++;
-                } else {
-                    ts = rec->twin->pkt_time[j];
-                    pkt_len = rec->twin->pkt_len[j];
-                    dir = OUT;
-                    if (j < jmax) j++;
-                }
-            }
-
-            joy_timer_sub(&ts, &ts_last, &tmp);
-            print_bytes_dir_time(ctx, pkt_len, dir, tmp, "");
-            ts_last = ts;
-
-            if (!((i == imax) & (j == jmax))) {
-                /* Done */
-                zprintf(ctx->output, ",");
+                joy_timer_clear(&splt->ipt[i]);
             }
+            splt->len[i] = rec->pkt_len[i];
+            splt->in[i] = 0;
         }
-        zprintf(ctx->output, "]");
+        splt->num = imax;
+        return;
     }
 
-    if (glb_config->byte_distribution || glb_config->report_entropy || glb_config->compact_byte_distribution) {
-        const unsigned int *array = NULL;
-        const unsigned int *compact_array = NULL;
-        unsigned int tmp[256];
-        unsigned int compact_tmp[16];
-        unsigned int num_bytes;
-        double mean = 0.0, variance = 0.0;
-
-        /*
-         * Sum up the byte_count array for outbound and inbound flows,
-         * if this flow is bidirectional
-         */
-        if (rec->twin == NULL) {
-            array = rec->byte_count;
-            //compact_array = rec->compact_byte_count; //overwritten below fixme
-            num_bytes = rec->ob;
-
-            for (i=0; i<256; i++) {
-                      tmp[i] = rec->byte_count[i];
-            }
-            for (i=0; i<16; i++) {
-                      compact_tmp[i] = rec->compact_byte_count[i];
-            }
-
-            if (rec->num_bytes != 0) {
-                mean = rec->bd_mean;
-                variance = rec->bd_variance/(rec->num_bytes - 1);
-                variance = sqrt(variance);
-
-                if (rec->num_bytes == 1) {
-                    variance = 0.0;
-                }
-            }
+    jmax = rec->twin->op > NUM_PKT_LEN ? NUM_PKT_LEN : rec->twin->op;
+    i = j = 0;
+    ts_last = *ts_start;
+
+    while ((i < imax) || (j < jmax)) {
+        unsigned int n = splt->num++;
+
+        if (i >= imax) {
+            /* record list is exhausted, so use twin */
+            splt->in[n] = 0;
+            ts = rec->twin->pkt_time[j];
+            splt->len[n] = rec->twin->pkt_len[j];
+            j++;
+        } else if (j >= jmax) {
+            /* twin list is exhausted, so use record */
+            splt->in[n] = 1;
+            ts = rec->pkt_time[i];
+            splt->len[n] = rec->pkt_len[i];
+            i++;
+        } else if (joy_timer_lt(&rec->pkt_time[i], &rec->twin->pkt_time[j])) {
+            /* Neither list is exhausted, so use list with lowest time */
+            ts = rec->pkt_time[i];
+            splt->len[n] = rec->pkt_len[i];
+            splt->in[n] = 1;
+            i++;
         } else {
-            for (i=0; i<256; i++) {
-                      tmp[i] = rec->byte_count[i] + rec->twin->byte_count[i];
-            }
-            for (i=0; i<16; i++) {
-                      compact_tmp[i] = rec->compact_byte_count[i] + rec->twin->compact_byte_count[i];
-            }
-            array = tmp;
-            compact_array = compact_tmp;
-            num_bytes = rec->ob + rec->twin->ob;
-
-            if (rec->num_bytes + rec->twin->num_bytes != 0) {
-                mean = ((double)rec->num_bytes)/((double)(rec->num_bytes+rec->twin->num_bytes))*rec->bd_mean +
-                           ((double)rec->twin->num_bytes)/((double)(rec->num_bytes+rec->twin->num_bytes))*rec->twin->bd_mean;
-
-                    variance = ((double)rec->num_bytes)/((double)(rec->num_bytes+rec->twin->num_bytes))*rec->bd_variance +
-                               ((double)rec->twin->num_bytes)/((double)(rec->num_bytes+rec->twin->num_bytes))*rec->twin->bd_variance;
-
-                    variance = variance/((double)(rec->num_bytes + rec->twin->num_bytes - 1));
-                    variance = sqrt(variance);
-                    if (rec->num_bytes + rec->twin->num_bytes == 1) {
-                        variance = 0.0;
-                    }
-            }
+            ts = rec->twin->pkt_time[j];
+            splt->len[n] = rec->twin->pkt_len[j];
+            splt->in[n] = 0;
+            j++;
         }
 
-        if (glb_config->byte_distribution) {
-            reduce_bd_bits(tmp, 256);
-            array = tmp;
+        joy_timer_sub(&ts, &ts_last, &splt->ipt[n]);
+        ts_last = ts;
+    }
+}
 
-            zprintf(ctx->output, ",\"byte_dist\":[");
-            for (i = 0; i < 255; i++) {
-                zprintf(ctx->output, "%u,", (unsigned char)array[i]);
-            }
-            zprintf(ctx->output, "%u]", (unsigned char)array[i]);
+/**
+ * \brief Sum up the byte distributions of both halves of a flow.
+ *
+ * \param rec Flow record, as returned by flow_record_orient()
+ * \param bd Filled in with the byte distribution
+ * \param compact_bd Filled in with the compact byte distribution
+ * \param mean Set to the mean byte value, if any bytes were counted
+ * \param std Set to the standard deviation of the byte values
+ *
+ * \return the number of bytes in the flow
+ */
+static unsigned int flow_record_byte_dist (const flow_record_t *rec,
+                                           unsigned int bd[256],
+                                           unsigned int compact_bd[16],
+                                           double *mean,
+                                           double *std) {
+    unsigned int i;
+    double variance = 0.0;
 
-            /* Output the mean */
-            if (num_bytes != 0) {
-                zprintf(ctx->output, ",\"byte_dist_mean\":%f", mean);
-                zprintf(ctx->output, ",\"byte_dist_std\":%f", variance);
-            }
+    *mean = 0.0;
 
+    if (rec->twin == NULL) {
+        for (i=0; i<256; i++) {
+            bd[i] = rec->byte_count[i];
         }
-
-        if (glb_config->compact_byte_distribution) {
-            reduce_bd_bits(compact_tmp, 16);
-            compact_array = compact_tmp;
-
-            zprintf(ctx->output, ",\"compact_byte_dist\":[");
-            for (i = 0; i < 15; i++) {
-                zprintf(ctx->output, "%u,", (unsigned char)compact_array[i]);
-            }
-            zprintf(ctx->output, "%u]", (unsigned char)compact_array[i]);
+        for (i=0; i<16; i++) {
+            compact_bd[i] = rec->compact_byte_count[i];
         }
 
-        if (glb_config->report_entropy) {
-            if (num_bytes != 0) {
-                double entropy = flow_record_get_byte_count_entropy(array, num_bytes);
+        if (rec->num_bytes != 0) {
+            *mean = rec->bd_mean;
+            variance = rec->bd_variance/(rec->num_bytes - 1);
+            variance = sqrt(variance);
 
-                zprintf(ctx->output, ",\"entropy\":%f", entropy);
-                zprintf(ctx->output, ",\"total_entropy\":%f", entropy * num_bytes);
+            if (rec->num_bytes == 1) {
+                variance = 0.0;
             }
         }
+        *std = variance;
+        return rec->ob;
     }
 
-    /*
-     * Inline classification of flows
-     */
-    if (glb_config->include_classifier) {
-        float score = 0.0;
+    for (i=0; i<256; i++) {
+        bd[i] = rec->byte_count[i] + rec->twin->byte_count[i];
+    }
+    for (i=0; i<16; i++) {
+        compact_bd[i] = rec->compact_byte_count[i] + rec->twin->compact_byte_count[i];
+    }
 
-        if (rec->twin) {
-            score = classify(rec->pkt_len, rec->pkt_time, rec->twin->pkt_len, rec->twin->pkt_time,
-                                     rec->start, rec->twin->start,
-                                     NUM_PKT_LEN, rec->key.sp, rec->key.dp, rec->np, rec->twin->np, rec->op, rec->twin->op,
-                                     rec->ob, rec->twin->ob, glb_config->byte_distribution,
-                                     rec->byte_count, rec->twin->byte_count);
-        } else {
-            score = classify(rec->pkt_len, rec->pkt_time, NULL, NULL,   rec->start, rec->start,
-                                     NUM_PKT_LEN, rec->key.sp, rec->key.dp, rec->np, 0, rec->op, 0,
-                                     rec->ob, 0, glb_config->byte_distribution,
-                                     rec->byte_count, NULL);
+    if (rec->num_bytes + rec->twin->num_bytes != 0) {
+        *mean = ((double)rec->num_bytes)/((double)(rec->num_bytes+rec->twin->num_bytes))*rec->bd_mean +
+                ((double)rec->twin->num_bytes)/((double)(rec->num_bytes+rec->twin->num_bytes))*rec->twin->bd_mean;
+
+        variance = ((double)rec->num_bytes)/((double)(rec->num_bytes+rec->twin->num_bytes))*rec->bd_variance +
+                   ((double)rec->twin->num_bytes)/((double)(rec->num_bytes+rec->twin->num_bytes))*rec->twin->bd_variance;
+
+        variance = variance/((double)(rec->num_bytes + rec->twin->num_bytes - 1));
+        variance = sqrt(variance);
+        if (rec->num_bytes + rec->twin->num_bytes == 1) {
+            variance = 0.0;
         }
+    }
+    *std = variance;
+    return rec->ob + rec->twin->ob;
+}
 
-        zprintf(ctx->output, ",\"p_malware\":%f", score);
+/**
+ * \brief Score a flow record with the inline classifier.
+ *
+ * \param rec Flow record, as returned by flow_record_orient()
+ *
+ * \return the probability that the flow is malware
+ */
+static float flow_record_score (joy_ctx_data *ctx, const flow_record_t *rec) {
+    float score = 0.0;
+
+    if (classifier_batch_get(&ctx->classifier_batch, rec, &score) == ok) {
+        /* scored with the rest of its batch */
+    } else if (rec->twin) {
+        score = classify(rec->pkt_len, rec->pkt_time, rec->twin->pkt_len, rec->twin->pkt_time,
+                                 rec->start, rec->twin->start,
+                                 NUM_PKT_LEN, rec->key.sp, rec->key.dp, rec->np, rec->twin->np, rec->op, rec->twin->op,
+                                 rec->ob, rec->twin->ob, glb_config->byte_distribution,
+                                 rec->byte_count, rec->twin->byte_count);
+    } else {
+        score = classify(rec->pkt_len, rec->pkt_time, NULL, NULL,   rec->start, rec->start,
+                                 NUM_PKT_LEN, rec->key.sp, rec->key.dp, rec->np, 0, rec->op, 0,
+                                 rec->ob, 0, glb_config->byte_distribution,
+                                 rec->byte_count, NULL);
     }
+    return score;
+}
 
-    /* IP object */
-    print_ip_json(ctx->output, rec);
+/**
+ * \brief Print the subnet labels that the addresses of a flow match.
+ *
+ * \param rec Flow record, as returned by flow_record_orient()
+ * \param f Output file
+ *
+ * \return none
+ */
+static void flow_record_print_labels (const flow_record_t *rec, zfile f) {
+    if (glb_config->num_subnets) {
+        radix_trie_t rt = joy_snapshot_get(&glb_config->labels);
+        struct in_addr addr[2];
+        attr_flags flag[2];
 
-    if (rec->key.prot == 6) {
-        /* TCP object */
-        print_tcp_json(ctx->output, rec);
+        addr[0] = rec->key.sa;
+        addr[1] = rec->key.da;
+        radix_trie_lookup_addrs(rt, addr, flag, 2);
+        attr_flags_json_print_labels(rt, flag[0], "sa_labels", f);
+        attr_flags_json_print_labels(rt, flag[1], "da_labels", f);
     }
+}
 
-    /*
-     * All of the feature modules
-     */
-    print_all_features(feature_list);
-
+/**
+ * \brief Print the part of a flow record that follows the feature
+ *        modules, up to the expiration type.
+ *
+ * \param rec Flow record, as returned by flow_record_orient()
+ *
+ * \return none
+ */
+static void flow_record_print_json_rest (joy_ctx_data *ctx, const flow_record_t *rec) {
     /*
      * Host executable
      */
@@ -1610,36 +1784,814 @@ static void flow_record_print_json
         }
 
     }
-
-    if (rec->exp_type) {
-        zprintf(ctx->output, ",\"expire_type\":\"%c\"", rec->exp_type);
-    }
-
-    /*****************************************************************
-     * Flow Record object end
-     *****************************************************************
-     */
-    zprintf(ctx->output, "}\n");
 }
 
-
-
 /**
- * \brief Print a flow record to output and delete.
+ * \brief Print the part of a flow record that follows the IP object:
+ *        TCP, the feature modules, and the rest, up to the expiration
+ *        type.
  *
- * After printing the flow \p record, it will first be removed
- * from the chrono list and then deleted. If IPFIX export is enabled,
- * the record will be exported before deletion.
+ * \param rec Flow record, as returned by flow_record_orient()
+ * \param e Emitter, opened on ctx->output
  *
- * \param record Flow record to print and delete 
+ * \return none
+ */
+static void flow_record_print_tail (joy_ctx_data *ctx, const flow_record_t *rec, emitter_t *e) {
+    zfile f = ctx->output;
+
+    if (rec->key.prot == 6) {
+        /* TCP object */
+        print_tcp_json(emit_text(e), rec);
+    }
+
+    /*
+     * All of the feature modules
+     */
+    emit_all_features(feature_list);
+
+    ctx->output = emit_text(e);
+    flow_record_print_json_rest(ctx, rec);
+    ctx->output = f;
+}
+
+/**
+ * \brief Print a flow record to the JSON output.
+ *
+ * \param record Flow record to print
+ *
+ * \return none
+ */
+static void flow_record_print_json
+ (joy_ctx_data *ctx, const flow_record_t *record) {
+    unsigned int i;
+    struct timeval ts_start, ts_end;
+    const flow_record_t *rec = NULL;
+    flow_splt_t splt;
+    char anon_hex[ANON_HEXSTRING_LEN];
+    zfile f = ctx->output;
+    emitter_t e;
+
+    flocap_stats_incr_records_output(ctx);
+    ctx->records_in_file++;
+
+    rec = flow_record_orient(record, &ts_start, &ts_end);
+
+    /*****************************************************************
+     * ---------------------------------------------------------------
+     * Flow Record object start
+     * ---------------------------------------------------------------
+     *****************************************************************
+     */
+    zputc(f, '{');
+
+    if (ipv4_addr_needs_anonymization(&rec->key.sa)) {
+        zprintf(ctx->output, "\"sa\":\"%s\",", addr_get_anon_hexstring(&rec->key.sa, &ctx->anon_cache, anon_hex));
+    } else {
+        zputs(f, "\"sa\":\"");
+        zprint_ipv4(f, &rec->key.sa);
+        zputs(f, "\",");
+    }
+    if (ipv4_addr_needs_anonymization(&rec->key.da)) {
+        zprintf(ctx->output, "\"da\":\"%s\",", addr_get_anon_hexstring(&rec->key.da, &ctx->anon_cache, anon_hex));
+    } else {
+        zputs(f, "\"da\":\"");
+        zprint_ipv4(f, &rec->key.da);
+        zputs(f, "\",");
+    }
+    zputs(f, "\"pr\":");
+    zprint_uint(f, rec->key.prot);
+
+    if (rec->key.prot == 6 || rec->key.prot == 17) {
+        zputs(f, ",\"sp\":");
+        zprint_uint(f, rec->key.sp);
+        zputs(f, ",\"dp\":");
+        zprint_uint(f, rec->key.dp);
+        zputc(f, ',');
+    } else {
+        /* Make dp/sp null so that they can still be compared */
+        zputs(f, ",\"sp\":null,\"dp\":null,");
+    }
+
+    /*
+     * if src or dst address matches a subnets associated with labels,
+     * then print out those labels
+     */
+    flow_record_print_labels(rec, ctx->output);
+
+    /*
+     * Flow stats
+     */
+    zputs(f, "\"bytes_out\":");
+    zprint_uint(f, rec->ob);
+    zputs(f, ",\"num_pkts_out\":");
+    zprint_uint(f, rec->np); /* not just packets with data */
+    if (rec->twin != NULL) {
+        zputs(f, ",\"bytes_in\":");
+        zprint_uint(f, rec->twin->ob);
+        zputs(f, ",\"num_pkts_in\":");
+        zprint_uint(f, rec->twin->np);
+    }
+    zputs(f, ",\"time_start\":");
+    zprint_timeval(f, &ts_start);
+    zputs(f, ",\"time_end\":");
+    zprint_timeval(f, &ts_end);
+    if (glb_config->sample_rate > 1 || glb_config->adaptive_sample) {
+        zputs(f, ",\"sample_rate\":");
+        zprint_uint(f, rec->sample_rate);
+    }
+
+    /*****************************************************************
+     * Packet length and time array
+     *****************************************************************
+     */
+    zputs(f, ",\"packets\":[");
+    flow_record_get_splt(rec, &ts_start, &splt);
+    for (i = 0; i < splt.num; i++) {
+        print_bytes_dir_time(ctx, splt.len[i], splt.in[i] ? IN : OUT, splt.ipt[i],
+                             i + 1 < splt.num ? "," : "");
+    }
+    zputc(f, ']');
+
+    if (glb_config->byte_distribution || glb_config->report_entropy || glb_config->compact_byte_distribution) {
+        unsigned int tmp[256];
+        unsigned int compact_tmp[16];
+        unsigned int num_bytes;
+        double mean, variance;
+
+        num_bytes = flow_record_byte_dist(rec, tmp, compact_tmp, &mean, &variance);
+
+        if (glb_config->byte_distribution) {
+            reduce_bd_bits(tmp, 256);
+
+            zputs(f, ",\"byte_dist\":[");
+            for (i = 0; i < 255; i++) {
+                zprint_uint(f, (unsigned char)tmp[i]);
+                zputc(f, ',');
+            }
+            zprint_uint(f, (unsigned char)tmp[i]);
+            zputc(f, ']');
+
+            /* Output the mean */
+            if (num_bytes != 0) {
+                zprintf(ctx->output, ",\"byte_dist_mean\":%f", mean);
+                zprintf(ctx->output, ",\"byte_dist_std\":%f", variance);
+            }
+
+        }
+
+        if (glb_config->compact_byte_distribution) {
+            reduce_bd_bits(compact_tmp, 16);
+
+            zputs(f, ",\"compact_byte_dist\":[");
+            for (i = 0; i < 15; i++) {
+                zprint_uint(f, (unsigned char)compact_tmp[i]);
+                zputc(f, ',');
+            }
+            zprint_uint(f, (unsigned char)compact_tmp[i]);
+            zputc(f, ']');
+        }
+
+        if (glb_config->report_entropy) {
+            if (num_bytes != 0) {
+                double entropy = flow_record_get_byte_count_entropy(tmp, num_bytes);
+
+                zprintf(ctx->output, ",\"entropy\":%f", entropy);
+                zprintf(ctx->output, ",\"total_entropy\":%f", entropy * num_bytes);
+            }
+        }
+    }
+
+    /*
+     * Inline classification of flows
+     */
+    if (glb_config->include_classifier) {
+        zprintf(ctx->output, ",\"p_malware\":%f", flow_record_score(ctx, rec));
+    }
+
+    /* IP object */
+    print_ip_json(ctx->output, rec);
+
+    emit_open(&e, ctx->output, emit_json, NULL);
+    flow_record_print_tail(ctx, rec, &e);
+    emit_close(&e);
+
+    if (rec->exp_type) {
+        zprintf(ctx->output, ",\"expire_type\":\"%c\"", rec->exp_type);
+    }
+
+    /*****************************************************************
+     * Flow Record object end
+     *****************************************************************
+     */
+    zputs(f, "}\n");
+}
+
+
+
+/*
+ * Columns of the Arrow output, in the order of the JSON output.  The
+ * labels, TCP, each feature module and the rest of the record (json)
+ * only print JSON, so their columns hold the JSON object of what they
+ * print, or a null if they print nothing.
+ */
+#define flow_col_feature(f) flow_col_##f,
+#define flow_feature_field(f) { #f, arrow_utf8, 0, NULL },
+
+enum flow_column {
+    flow_col_sa, flow_col_da, flow_col_pr, flow_col_sp, flow_col_dp, flow_col_labels,
+    flow_col_bytes_out, flow_col_num_pkts_out, flow_col_bytes_in, flow_col_num_pkts_in,
+    flow_col_time_start, flow_col_time_end, flow_col_sample_rate,
+    flow_col_packets, flow_col_byte_dist, flow_col_byte_dist_mean, flow_col_byte_dist_std,
+    flow_col_compact_byte_dist, flow_col_entropy, flow_col_total_entropy,
+    flow_col_p_malware, flow_col_ip, flow_col_tcp,
+    MAP(flow_col_feature, feature_list)
+    flow_col_json, flow_col_expire_type,
+    flow_col_max
+};
+
+static const arrow_field_t flow_packet_fields[] = {
+    { "b", arrow_uint16, 0, NULL },
+    { "rep", arrow_uint16, 0, NULL },
+    { "dir", arrow_utf8, 0, NULL },
+    { "ipt", arrow_uint32, 0, NULL }
+};
+static const arrow_field_t flow_packet_field = { "item", arrow_struct, 4, flow_packet_fields };
+static const arrow_field_t flow_byte_field = { "item", arrow_uint8, 0, NULL };
+static const arrow_field_t flow_ip_id_field = { "item", arrow_uint16, 0, NULL };
+static const arrow_field_t flow_ip_dir_fields[] = {
+    { "ttl", arrow_uint8, 0, NULL },
+    { "id", arrow_list, 1, &flow_ip_id_field }
+};
+static const arrow_field_t flow_ip_fields[] = {
+    { "out", arrow_struct, 2, flow_ip_dir_fields },
+    { "in", arrow_struct, 2, flow_ip_dir_fields }
+};
+
+static const arrow_field_t flow_columns[flow_col_max] = {
+    { "sa", arrow_utf8, 0, NULL },
+    { "da", arrow_utf8, 0, NULL },
+    { "pr", arrow_uint8, 0, NULL },
+    { "sp", arrow_uint16, 0, NULL },
+    { "dp", arrow_uint16, 0, NULL },
+    { "labels", arrow_utf8, 0, NULL },
+    { "bytes_out", arrow_uint64, 0, NULL },
+    { "num_pkts_out", arrow_uint64, 0, NULL },
+    { "bytes_in", arrow_uint64, 0, NULL },
+    { "num_pkts_in", arrow_uint64, 0, NULL },
+    { "time_start", arrow_timestamp, 0, NULL },
+    { "time_end", arrow_timestamp, 0, NULL },
+    { "sample_rate", arrow_uint32, 0, NULL },
+    { "packets", arrow_list, 1, &flow_packet_field },
+    { "byte_dist", arrow_list, 1, &flow_byte_field },
+    { "byte_dist_mean", arrow_float64, 0, NULL },
+    { "byte_dist_std", arrow_float64, 0, NULL },
+    { "compact_byte_dist", arrow_list, 1, &flow_byte_field },
+    { "entropy", arrow_float64, 0, NULL },
+    { "total_entropy", arrow_float64, 0, NULL },
+    { "p_malware", arrow_float64, 0, NULL },
+    { "ip", arrow_struct, 2, flow_ip_fields },
+    { "tcp", arrow_utf8, 0, NULL },
+    MAP(flow_feature_field, feature_list)
+    { "json", arrow_utf8, 0, NULL },
+    { "expire_type", arrow_utf8, 0, NULL }
+};
+
+static const arrow_field_t flow_schema = { "flow", arrow_struct, flow_col_max, flow_columns };
+
+/*
+ * largest number of flow records in one Arrow record batch; each pass
+ * of flow_record_list_print_json() writes its records as one batch,
+ * and this only splits a pass that expires more of them than that
+ */
+#define FLOW_ARROW_BATCH_ROWS 16384
+
+/**
+ * \brief Write the flow records added to the Arrow batch so far to the
+ *        output, as one record batch.
+ *
+ * \return none
+ */
+static void flow_record_write_arrow (joy_ctx_data *ctx) {
+    if (ctx->flow_batch == NULL || arrow_batch_rows(ctx->flow_batch) == 0) {
+        return;
+    }
+    if (arrow_batch_write(ctx->flow_batch, ctx->output) != ok) {
+        joy_log_err("could not write Arrow record batch");
+    }
+}
+
+/**
+ * \brief Append an address to a column of the Arrow output, anonymized
+ *        if it needs to be.
+ */
+static void flow_append_addr (joy_ctx_data *ctx, arrow_column_t *c, const struct in_addr *addr) {
+    char buf[ANON_HEXSTRING_LEN > INET_ADDRSTRLEN ? ANON_HEXSTRING_LEN : INET_ADDRSTRLEN];
+
+    if (ipv4_addr_needs_anonymization(addr)) {
+        addr_get_anon_hexstring(addr, &ctx->anon_cache, buf);
+    } else {
+        inet_ntop(AF_INET, addr, buf, sizeof(buf));
+    }
+    arrow_append_string(c, buf, strlen(buf));
+}
+
+/**
+ * \brief Append the IP data of one direction of a flow to the Arrow output.
+ */
+static void flow_append_ip (arrow_column_t *c, const flow_record_t *rec) {
+    arrow_column_t *ids = &c->children[1];
+    unsigned int k;
+
+    arrow_append_uint(&c->children[0], rec->ip.ttl);
+    if (rec->ip.num_id) {
+        for (k = 0; k < rec->ip.num_id; k++) {
+            arrow_append_uint(&ids->children[0], rec->ip.id[k]);
+        }
+        arrow_end_list(ids);
+    } else {
+        arrow_append_null(ids);
+    }
+    arrow_end_struct(c);
+}
+
+/**
+ * \brief Append a byte distribution to the Arrow output.
+ */
+static void flow_append_byte_dist (arrow_column_t *c, unsigned int *bd, unsigned int len) {
+    unsigned int i;
+
+    reduce_bd_bits(bd, len);
+    for (i = 0; i < len; i++) {
+        arrow_append_uint(&c->children[0], (unsigned char)bd[i]);
+    }
+    arrow_end_list(c);
+}
+
+/**
+ * \brief Append the JSON captured in \p scratch to a column of the
+ *        Arrow output, as an object, or a null if nothing was captured.
+ */
+static void flow_append_json (arrow_column_t *c, zfile scratch) {
+    const char *json = NULL;
+    size_t len = 0;
+
+    if (scratch != NULL) {
+        json = zmemory(scratch, &len);
+    }
+    arrow_append_json_members(c, json, len);
+}
+
+/* captures the JSON of feature f of rec, and appends it to its column */
+#define flow_append_feature(f) \
+    if (scratch != NULL) { \
+        zmemory_clear(scratch); \
+        if (rec->f != NULL) { \
+            f##_print_json(rec->f, (rec->twin ? rec->twin->f : NULL), scratch); \
+        } \
+    } \
+    flow_append_json(arrow_column(b, flow_col_##f), scratch);
+
+/**
+ * \brief Append a flow record to the batch of the Arrow output, as one
+ *        row holding the same values as the JSON output.
+ *
+ * \param record Flow record to append
+ *
+ * \return none
+ */
+static void flow_record_append_arrow
+ (joy_ctx_data *ctx, const flow_record_t *record) {
+    unsigned int i;
+    struct timeval ts_start, ts_end;
+    const flow_record_t *rec = NULL;
+    flow_splt_t splt;
+    arrow_batch_t *b = ctx->flow_batch;
+    arrow_column_t *c;
+    zfile f = ctx->output;
+    zfile scratch;
+
+    if (b == NULL) {
+        b = ctx->flow_batch = arrow_batch_new(&flow_schema);
+        if (b == NULL) {
+            joy_log_err("could not allocate Arrow batch");
+            return;
+        }
+    }
+
+    flocap_stats_incr_records_output(ctx);
+    ctx->records_in_file++;
+
+    rec = flow_record_orient(record, &ts_start, &ts_end);
+
+    flow_append_addr(ctx, arrow_column(b, flow_col_sa), &rec->key.sa);
+    flow_append_addr(ctx, arrow_column(b, flow_col_da), &rec->key.da);
+    arrow_append_uint(arrow_column(b, flow_col_pr), rec->key.prot);
+    if (rec->key.prot == 6 || rec->key.prot == 17) {
+        arrow_append_uint(arrow_column(b, flow_col_sp), rec->key.sp);
+        arrow_append_uint(arrow_column(b, flow_col_dp), rec->key.dp);
+    } else {
+        arrow_append_null(arrow_column(b, flow_col_sp));
+        arrow_append_null(arrow_column(b, flow_col_dp));
+    }
+
+    scratch = flow_record_json_scratch(ctx);
+    if (scratch != NULL) {
+        flow_record_print_labels(rec, scratch);
+    }
+    flow_append_json(arrow_column(b, flow_col_labels), scratch);
+
+    /*
+     * Flow stats
+     */
+    arrow_append_uint(arrow_column(b, flow_col_bytes_out), rec->ob);
+    arrow_append_uint(arrow_column(b, flow_col_num_pkts_out), rec->np);
+    if (rec->twin != NULL) {
+        arrow_append_uint(arrow_column(b, flow_col_bytes_in), rec->twin->ob);
+        arrow_append_uint(arrow_column(b, flow_col_num_pkts_in), rec->twin->np);
+    } else {
+        arrow_append_null(arrow_column(b, flow_col_bytes_in));
+        arrow_append_null(arrow_column(b, flow_col_num_pkts_in));
+    }
+    arrow_append_timeval(arrow_column(b, flow_col_time_start), &ts_start);
+    arrow_append_timeval(arrow_column(b, flow_col_time_end), &ts_end);
+    if (glb_config->sample_rate > 1 || glb_config->adaptive_sample) {
+        arrow_append_uint(arrow_column(b, flow_col_sample_rate), rec->sample_rate);
+    } else {
+        arrow_append_null(arrow_column(b, flow_col_sample_rate));
+    }
+
+    /*
+     * Packet length and time array
+     */
+    c = arrow_column(b, flow_col_packets);
+    flow_record_get_splt(rec, &ts_start, &splt);
+    for (i = 0; i < splt.num; i++) {
+        arrow_column_t *pkt = &c->children[0];
+
+        if (splt.len[i] < 32768) {
+            arrow_append_uint(&pkt->children[0], splt.len[i]);
+            arrow_append_null(&pkt->children[1]);
+        } else {
+            arrow_append_null(&pkt->children[0]);
+            arrow_append_uint(&pkt->children[1], 65536 - splt.len[i]);
+        }
+        arrow_append_string(&pkt->children[2], splt.in[i] ? IN : OUT, 1);
+        arrow_append_uint(&pkt->children[3], joy_timeval_to_milliseconds(splt.ipt[i]));
+        arrow_end_struct(pkt);
+    }
+    arrow_end_list(c);
+
+    if (glb_config->byte_distribution || glb_config->report_entropy || glb_config->compact_byte_distribution) {
+        unsigned int tmp[256];
+        unsigned int compact_tmp[16];
+        unsigned int num_bytes;
+        double mean, variance;
+
+        num_bytes = flow_record_byte_dist(rec, tmp, compact_tmp, &mean, &variance);
+
+        if (glb_config->byte_distribution) {
+            flow_append_byte_dist(arrow_column(b, flow_col_byte_dist), tmp, 256);
+        } else {
+            arrow_append_null(arrow_column(b, flow_col_byte_dist));
+        }
+        if (glb_config->byte_distribution && num_bytes != 0) {
+            arrow_append_double(arrow_column(b, flow_col_byte_dist_mean), mean);
+            arrow_append_double(arrow_column(b, flow_col_byte_dist_std), variance);
+        } else {
+            arrow_append_null(arrow_column(b, flow_col_byte_dist_mean));
+            arrow_append_null(arrow_column(b, flow_col_byte_dist_std));
+        }
+        if (glb_config->compact_byte_distribution) {
+            flow_append_byte_dist(arrow_column(b, flow_col_compact_byte_dist), compact_tmp, 16);
+        } else {
+            arrow_append_null(arrow_column(b, flow_col_compact_byte_dist));
+        }
+        if (glb_config->report_entropy && num_bytes != 0) {
+            double entropy = flow_record_get_byte_count_entropy(tmp, num_bytes);
+
+            arrow_append_double(arrow_column(b, flow_col_entropy), entropy);
+            arrow_append_double(arrow_column(b, flow_col_total_entropy), entropy * num_bytes);
+        } else {
+            arrow_append_null(arrow_column(b, flow_col_entropy));
+            arrow_append_null(arrow_column(b, flow_col_total_entropy));
+        }
+    } else {
+        for (i = flow_col_byte_dist; i <= flow_col_total_entropy; i++) {
+            arrow_append_null(arrow_column(b, i));
+        }
+    }
+
+    /*
+     * Inline classification of flows
+     */
+    if (glb_config->include_classifier) {
+        arrow_append_double(arrow_column(b, flow_col_p_malware), flow_record_score(ctx, rec));
+    } else {
+        arrow_append_null(arrow_column(b, flow_col_p_malware));
+    }
+
+    /* IP object */
+    c = arrow_column(b, flow_col_ip);
+    flow_append_ip(&c->children[0], rec);
+    if (rec->twin) {
+        flow_append_ip(&c->children[1], rec->twin);
+    } else {
+        arrow_append_null(&c->children[1]);
+    }
+    arrow_end_struct(c);
+
+    /*
+     * TCP, the feature modules and the rest only print JSON, which
+     * is carried as text
+     */
+    if (scratch != NULL) {
+        zmemory_clear(scratch);
+        if (rec->key.prot == 6) {
+            print_tcp_json(scratch, rec);
+        }
+    }
+    flow_append_json(arrow_column(b, flow_col_tcp), scratch);
+
+    MAP(flow_append_feature, feature_list)
+
+    if (scratch != NULL) {
+        zmemory_clear(scratch);
+        ctx->output = scratch;
+        flow_record_print_json_rest(ctx, rec);
+        ctx->output = f;
+    }
+    flow_append_json(arrow_column(b, flow_col_json), scratch);
+
+    if (rec->exp_type) {
+        char exp_type = rec->exp_type;
+
+        arrow_append_string(arrow_column(b, flow_col_expire_type), &exp_type, 1);
+    } else {
+        arrow_append_null(arrow_column(b, flow_col_expire_type));
+    }
+
+    /* complete the row */
+    arrow_end_struct(&b->root);
+
+    if (arrow_batch_rows(b) >= FLOW_ARROW_BATCH_ROWS) {
+        flow_record_write_arrow(ctx);
+    }
+}
+
+
+/**
+ * \brief Return the memory zfile that JSON is captured in, emptied.
+ *
+ * \return the zfile, or NULL if it could not be allocated
+ */
+static zfile flow_record_json_scratch (joy_ctx_data *ctx) {
+    if (ctx->json_scratch == NULL) {
+        ctx->json_scratch = zopen_memory();
+        if (ctx->json_scratch == NULL) {
+            joy_log_err("could not allocate JSON scratch output");
+        }
+    } else {
+        zmemory_clear(ctx->json_scratch);
+    }
+    return ctx->json_scratch;
+}
+
+/**
+ * \brief Write the JSON captured in \p scratch to the CBOR output as
+ *        the value of \p key, unless nothing was captured.
+ */
+static void flow_cbor_put_json (zfile f, cbor_flow_key_e key, zfile scratch) {
+    const char *json;
+    size_t len;
+
+    json = zmemory(scratch, &len);
+    if (json != NULL && len) {
+        cbor_put_uint(f, key);
+        cbor_put_text(f, json, len);
+    }
+}
+
+/**
+ * \brief Write an address to the CBOR output, as a number in host
+ *        order, or as text if it is anonymized.
+ */
+static void flow_cbor_put_addr (joy_ctx_data *ctx, cbor_flow_key_e key, const struct in_addr *addr) {
+    char anon_hex[ANON_HEXSTRING_LEN];
+
+    cbor_put_uint(ctx->output, key);
+    if (ipv4_addr_needs_anonymization(addr)) {
+        addr_get_anon_hexstring(addr, &ctx->anon_cache, anon_hex);
+        cbor_put_text(ctx->output, anon_hex, strlen(anon_hex));
+    } else {
+        cbor_put_uint(ctx->output, ntohl(addr->s_addr));
+    }
+}
+
+/**
+ * \brief Write a byte distribution to the CBOR output, as a byte string.
+ */
+static void flow_cbor_put_byte_dist (zfile f, cbor_flow_key_e key, unsigned int *bd, unsigned int len) {
+    unsigned char bytes[256];
+    unsigned int i;
+
+    reduce_bd_bits(bd, len);
+    for (i = 0; i < len; i++) {
+        bytes[i] = (unsigned char)bd[i];
+    }
+    cbor_put_uint(f, key);
+    cbor_put_bytes(f, bytes, len);
+}
+
+/**
+ * \brief Write the TTL and IP ids of one direction of a flow to the
+ *        CBOR output.
+ */
+static void flow_cbor_put_ip (zfile f, const flow_record_t *rec) {
+    unsigned int k;
+
+    cbor_put_uint(f, rec->ip.ttl);
+    cbor_put_head(f, CBOR_ARRAY, rec->ip.num_id);
+    for (k = 0; k < rec->ip.num_id; k++) {
+        cbor_put_uint(f, rec->ip.id[k]);
+    }
+}
+
+/**
+ * \brief Print a flow record to the CBOR output, as a map holding the
+ *        fields that the JSON output would (see cbor_flow_key_e).
+ *
+ * \param record Flow record to print
+ *
+ * \return none
+ */
+static void flow_record_print_cbor
+ (joy_ctx_data *ctx, const flow_record_t *record) {
+    unsigned int i;
+    struct timeval ts_start, ts_end;
+    const flow_record_t *rec = NULL;
+    flow_splt_t splt;
+    zfile f = ctx->output;
+    zfile scratch;
+    emitter_t e;
+
+    zbinary(f);
+    flocap_stats_incr_records_output(ctx);
+    ctx->records_in_file++;
+
+    rec = flow_record_orient(record, &ts_start, &ts_end);
+
+    cbor_put_head(f, CBOR_TAG, CBOR_SELF_DESCRIBE);
+    cbor_put_indefinite(f, CBOR_MAP);
+    cbor_put_uint(f, cbor_flow_version);
+    cbor_put_uint(f, CBOR_FLOW_VERSION);
+
+    flow_cbor_put_addr(ctx, cbor_flow_sa, &rec->key.sa);
+    flow_cbor_put_addr(ctx, cbor_flow_da, &rec->key.da);
+    cbor_put_uint(f, cbor_flow_pr);
+    cbor_put_uint(f, rec->key.prot);
+    if (rec->key.prot == 6 || rec->key.prot == 17) {
+        cbor_put_uint(f, cbor_flow_sp);
+        cbor_put_uint(f, rec->key.sp);
+        cbor_put_uint(f, cbor_flow_dp);
+        cbor_put_uint(f, rec->key.dp);
+    }
+
+    scratch = flow_record_json_scratch(ctx);
+    if (scratch != NULL) {
+        flow_record_print_labels(rec, scratch);
+        flow_cbor_put_json(f, cbor_flow_labels, scratch);
+    }
+
+    /*
+     * Flow stats
+     */
+    cbor_put_uint(f, cbor_flow_bytes_out);
+    cbor_put_uint(f, rec->ob);
+    cbor_put_uint(f, cbor_flow_num_pkts_out);
+    cbor_put_uint(f, rec->np);
+    if (rec->twin != NULL) {
+        cbor_put_uint(f, cbor_flow_bytes_in);
+        cbor_put_uint(f, rec->twin->ob);
+        cbor_put_uint(f, cbor_flow_num_pkts_in);
+        cbor_put_uint(f, rec->twin->np);
+    }
+    cbor_put_uint(f, cbor_flow_time_start);
+    cbor_put_head(f, CBOR_ARRAY, 2);
+    cbor_put_uint(f, ts_start.tv_sec);
+    cbor_put_uint(f, ts_start.tv_usec);
+    cbor_put_uint(f, cbor_flow_time_end);
+    cbor_put_head(f, CBOR_ARRAY, 2);
+    cbor_put_uint(f, ts_end.tv_sec);
+    cbor_put_uint(f, ts_end.tv_usec);
+    if (glb_config->sample_rate > 1 || glb_config->adaptive_sample) {
+        cbor_put_uint(f, cbor_flow_sample_rate);
+        cbor_put_uint(f, rec->sample_rate);
+    }
+
+    /*
+     * Packet length and time array
+     */
+    flow_record_get_splt(rec, &ts_start, &splt);
+    cbor_put_uint(f, cbor_flow_packets);
+    cbor_put_head(f, CBOR_ARRAY, 3 * splt.num);
+    for (i = 0; i < splt.num; i++) {
+        cbor_put_uint(f, splt.len[i]);
+        cbor_put_uint(f, splt.in[i]);
+        cbor_put_uint(f, joy_timeval_to_milliseconds(splt.ipt[i]));
+    }
+
+    if (glb_config->byte_distribution || glb_config->report_entropy || glb_config->compact_byte_distribution) {
+        unsigned int tmp[256];
+        unsigned int compact_tmp[16];
+        unsigned int num_bytes;
+        double mean, variance;
+
+        num_bytes = flow_record_byte_dist(rec, tmp, compact_tmp, &mean, &variance);
+
+        if (glb_config->byte_distribution) {
+            flow_cbor_put_byte_dist(f, cbor_flow_byte_dist, tmp, 256);
+            if (num_bytes != 0) {
+                cbor_put_uint(f, cbor_flow_byte_dist_mean);
+                cbor_put_double(f, mean);
+                cbor_put_uint(f, cbor_flow_byte_dist_std);
+                cbor_put_double(f, variance);
+            }
+        }
+        if (glb_config->compact_byte_distribution) {
+            flow_cbor_put_byte_dist(f, cbor_flow_compact_byte_dist, compact_tmp, 16);
+        }
+        if (glb_config->report_entropy && num_bytes != 0) {
+            double entropy = flow_record_get_byte_count_entropy(tmp, num_bytes);
+
+            cbor_put_uint(f, cbor_flow_entropy);
+            cbor_put_double(f, entropy);
+            cbor_put_uint(f, cbor_flow_total_entropy);
+            cbor_put_double(f, entropy * num_bytes);
+        }
+    }
+
+    /*
+     * Inline classification of flows
+     */
+    if (glb_config->include_classifier) {
+        cbor_put_uint(f, cbor_flow_p_malware);
+        cbor_put_double(f, flow_record_score(ctx, rec));
+    }
+
+    /* IP object */
+    cbor_put_uint(f, cbor_flow_ip);
+    cbor_put_head(f, CBOR_ARRAY, rec->twin ? 4 : 2);
+    flow_cbor_put_ip(f, rec);
+    if (rec->twin) {
+        flow_cbor_put_ip(f, rec->twin);
+    }
+
+    /*
+     * TCP, the feature modules and the rest; the modules that print
+     * through an emitter are written as CBOR, and the JSON of the
+     * others is carried as text
+     */
+    if (scratch != NULL) {
+        cbor_put_uint(f, cbor_flow_json);
+        emit_open(&e, f, emit_cbor, scratch);
+        flow_record_print_tail(ctx, rec, &e);
+        emit_close(&e);
+    }
+
+    if (rec->exp_type) {
+        cbor_put_uint(f, cbor_flow_expire_type);
+        cbor_put_uint(f, (unsigned char)rec->exp_type);
+    }
+
+    cbor_put_simple(f, CBOR_INDEFINITE);
+}
+
+
+/**
+ * \brief Print a flow record to output and delete.
+ *
+ * After printing the flow \p record, it will first be removed
+ * from the chrono list and then deleted. If IPFIX export is enabled,
+ * the record will be exported before deletion.
+ *
+ * \param record Flow record to print and delete 
  *
  * \return none
  */
 static void flow_record_print_and_delete (joy_ctx_data *ctx, flow_record_t *record) {
     /*
-     * Print the record to JSON output
+     * Print the record to JSON or CBOR output, or add it to the Arrow batch
      */
-    flow_record_print_json(ctx, record);
+    if (glb_config->arrow_output) {
+        flow_record_append_arrow(ctx, record);
+    } else {
+        if (glb_config->cbor_output) {
+            flow_record_print_cbor(ctx, record);
+        } else {
+            flow_record_print_json(ctx, record);
+        }
+        zrecord(ctx->output);
+    }
 
 #ifndef JOY_LIB_API
     /*
@@ -1711,6 +2663,52 @@ void flow_record_export_as_ipfix (joy_ctx_data *ctx, unsigned int export_type) {
     }
 }
 
+/**
+ * \brief Queues the flows about to be printed for classification.
+ *
+ * Starting at \p record, up to CLASSIFIER_BATCH_SIZE flows of the
+ * chrono list that flow_record_list_print_json() will print next are
+ * added to the classifier batch of the context, which is then scored.
+ *
+ * \param ctx the joy context
+ * \param record first record to classify
+ * \param print_type JOY_EXPIRED_FLOWS or JOY_ALL_FLOWS
+ *
+ * \return none
+ */
+static void flow_record_list_classify (joy_ctx_data *ctx, flow_record_t *record, unsigned int print_type) {
+    classifier_batch_t *batch = &ctx->classifier_batch;
+    joy_status_e rc;
+
+    classifier_batch_reset(batch);
+    while (record != NULL) {
+        if (print_type == JOY_EXPIRED_FLOWS && !flow_record_is_expired(ctx, record)) {
+            break;
+        }
+        if (record->twin) {
+            rc = classifier_batch_add(batch, record, record->pkt_len, record->pkt_time,
+                                      record->twin->pkt_len, record->twin->pkt_time,
+                                      record->start, record->twin->start,
+                                      NUM_PKT_LEN, record->key.sp, record->key.dp, record->np, record->twin->np,
+                                      record->op, record->twin->op, record->ob, record->twin->ob,
+                                      glb_config->byte_distribution,
+                                      record->byte_count, record->twin->byte_count);
+        } else {
+            rc = classifier_batch_add(batch, record, record->pkt_len, record->pkt_time, NULL, NULL,
+                                      record->start, record->start,
+                                      NUM_PKT_LEN, record->key.sp, record->key.dp, record->np, 0,
+                                      record->op, 0, record->ob, 0,
+                                      glb_config->byte_distribution,
+                                      record->byte_count, NULL);
+        }
+        if (rc != ok) {
+            break;
+        }
+        record = record->time_next;
+    }
+    classifier_batch_score(batch);
+}
+
 /**
  * \brief Prints out the flow record list in JSON format.
  *
@@ -1734,15 +2732,29 @@ void flow_record_list_print_json (joy_ctx_data *ctx, unsigned int print_type) {
             }
         }
 
+        /* classify the flows to be printed a batch at a time */
+        if (glb_config->include_classifier &&
+            ctx->classifier_batch.next == ctx->classifier_batch.num_flows) {
+            flow_record_list_classify(ctx, record, print_type);
+        }
+
         /* print and remove the record */
         flow_record_print_and_delete(ctx, record);
 
         /* Advance to next record on chrono list */
         record = ctx->flow_record_chrono_first;
     }
+    classifier_batch_reset(&ctx->classifier_batch);
 
-    // note: we might need to call flush in the future
-    // zflush(ctx->output);
+    /*
+     * hand the records printed in this pass to the (compressed) file
+     * as one block; it is flushed only when the file is closed
+     */
+    if (ctx->output != NULL) {
+        /* and the Arrow records of this pass as one record batch */
+        flow_record_write_arrow(ctx);
+        zdrain(ctx->output);
+    }
 }
 
 /**
@@ -1890,6 +2902,138 @@ static int p2f_test_flow_record_list(joy_ctx_data *ctx) {
     return num_fails;
 }
 
+/* a key whose sampling hash is divisible by pass but not by fail */
+static void p2f_test_sampling_key(flow_key_t *key, unsigned int pass, unsigned int fail) {
+    unsigned int h;
+
+    memset(key, 0, sizeof(flow_key_t));
+    key->sa.s_addr = htonl(0x0a000001);
+    key->da.s_addr = htonl(0x0a000002);
+    key->dp = 443;
+    key->prot = 6;
+    for (key->sp = 1024; key->sp < 65535; key->sp++) {
+        h = flow_key_sample_hash(key);
+        if ((h % pass) == 0 && (h % fail) != 0) {
+            return;
+        }
+    }
+}
+
+static int p2f_test_sampling(joy_ctx_data *ctx) {
+    unsigned int sample_rate = glb_config->sample_rate;
+    unsigned int adaptive_sample = glb_config->adaptive_sample;
+    static const struct { long sec; unsigned long drops; unsigned int rate; } steps[] = {
+        { 100, 10, 4 },   /* drops: the rate is doubled */
+        { 101, 20, 8 },
+        { 101, 30, 8 },   /* at most once per SAMPLE_ADAPT_INTERVAL */
+        { 102, 30, 8 },   /* no drops, but not yet quiet for long */
+        { 161, 30, 4 },   /* quiet for SAMPLE_RELAX_INTERVAL: halved */
+        { 221, 30, 2 },
+        { 400, 30, 2 },   /* never below sample_rate */
+        { 401, 31, 4 }
+    };
+    struct pcap_pkthdr header;
+    flow_key_t key, twin, other;
+    flow_record_t *record, *record_twin;
+    unsigned int i, j, kept = 0, sampled;
+    int num_fails = 0;
+
+    /* sampling keeps or skips whole flows, in both directions */
+    glb_config->sample_rate = 4;
+    glb_config->adaptive_sample = 0;
+    memset(&key, 0, sizeof(key));
+    key.da.s_addr = htonl(0x0a000100);
+    key.dp = 443;
+    key.prot = 6;
+    for (i = 0; i < 1024; i++) {
+        key.sa.s_addr = htonl(0x0a000001 + i);
+        key.sp = 1024 + i;
+        flow_key_copy(&twin, &key);
+        twin.sa = key.da;
+        twin.da = key.sa;
+        twin.sp = key.dp;
+        twin.dp = key.sp;
+        sampled = flow_key_is_sampled(ctx, &key);
+        for (j = 0; j < 4; j++) {
+            if (flow_key_is_sampled(ctx, &key) != sampled || flow_key_is_sampled(ctx, &twin) != sampled) {
+                joy_log_err("flow %u was not sampled as a whole", i);
+                num_fails++;
+                break;
+            }
+        }
+        kept += sampled;
+    }
+    if (kept < 1024 / 8 || kept > 1024 / 2) {
+        joy_log_err("kept %u of 1024 flows at 1-in-4", kept);
+        num_fails++;
+    }
+
+    /* the adaptive rate steps up with drops, and back down when quiet */
+    glb_config->sample_rate = 2;
+    glb_config->adaptive_sample = 1;
+    for (i = 0; i < sizeof(steps) / sizeof(steps[0]); i++) {
+        ctx->global_time.tv_sec = steps[i].sec;
+        flow_sampling_update(ctx, steps[i].drops);
+        if (flow_sampling_get_rate(ctx) != steps[i].rate) {
+            joy_log_err("step %u: rate %u, expected %u", i, flow_sampling_get_rate(ctx), steps[i].rate);
+            num_fails++;
+        }
+    }
+
+    /*
+     * a flow that has a record is kept after the rate goes up, and so
+     * is its twin, which is counted at the rate that the flow passes;
+     * flows that cannot have a record are not looked up
+     */
+    memset(&header, 0, sizeof(header));
+    ctx->sample_rate = 2;
+    p2f_test_sampling_key(&key, 2, 4);
+    p2f_test_sampling_key(&other, 4, 8);
+    record = flow_key_get_record(ctx, &key, CREATE_RECORDS, &header);
+    ctx->sample_rate = 8;
+    flow_key_copy(&twin, &key);
+    twin.sa = key.da;
+    twin.da = key.sa;
+    twin.sp = key.dp;
+    twin.dp = key.sp;
+    record_twin = flow_key_get_record(ctx, &twin, CREATE_RECORDS, &header);
+    if (record == NULL || record_twin == NULL) {
+        joy_log_err("could not create records");
+        num_fails++;
+    } else {
+        if (!flow_key_is_sampled(ctx, &key) || flow_key_is_sampled(ctx, &other)) {
+            joy_log_err("records were not kept across a rate change");
+            num_fails++;
+        }
+        if (record->sample_rate != 2 || record_twin->sample_rate != 2 || ctx->sample_records[1] != 2) {
+            joy_log_err("records counted at rates %u and %u", record->sample_rate, record_twin->sample_rate);
+            num_fails++;
+        }
+        if (!flow_sampling_may_have_record(ctx, flow_key_sample_hash(&other), 8) ||
+            flow_sampling_may_have_record(ctx, flow_key_sample_hash(&other) + 1, 8)) {
+            joy_log_err("flows were looked up that cannot have records");
+            num_fails++;
+        }
+        for (i = 0; i < 2; i++) {
+            flow_record_t *r = i ? record_twin : record;
+
+            if (flow_record_is_in_chrono_list(ctx, r)) {
+                flow_record_chrono_list_remove(ctx, r);
+            }
+            flow_record_delete(ctx, r);
+        }
+        if (flow_sampling_may_have_record(ctx, flow_key_sample_hash(&key), 8)) {
+            joy_log_err("deleted records are still counted");
+            num_fails++;
+        }
+    }
+
+    glb_config->sample_rate = sample_rate;
+    glb_config->adaptive_sample = adaptive_sample;
+    ctx->sample_rate = 0;
+    return num_fails;
+}
+
 void p2f_unit_test() {
     int num_fails = 0;
     joy_ctx_data *main_ctx = NULL;
@@ -1904,6 +3048,8 @@ void p2f_unit_test() {
     fprintf(info, "P2F Unit Test starting...\n");
 
     num_fails += p2f_test_flow_record_list(main_ctx);
+    memset(main_ctx, 0, sizeof(joy_ctx_data));
+    num_fails += p2f_test_sampling(main_ctx);
 
     if (num_fails) {
         fprintf(info, "Finished - failures: %d\n", num_fails);
@@ -1914,125 +3060,3 @@ void p2f_unit_test() {
     free(main_ctx);
     main_ctx = NULL;
 }
-
-/*********************************************************
- * -------------------------------------------------------
- * Uploader functions
- * -------------------------------------------------------
- *********************************************************
- */
-
-/** maxiumum lengnth of the upload URL string */
-#define MAX_UPLOAD_CMD_LENGTH 512
-
-/** maximum length of the upload file name */
-#define MAX_FILENAME_LENGTH 1024
-
-/** thread mutex for locking */
-pthread_mutex_t upload_in_process = PTHREAD_MUTEX_INITIALIZER;
-
-/** thread condition to wait for */
-pthread_cond_t upload_run_cond = PTHREAD_COND_INITIALIZER;
-
-/** thread signal for execution */
-int upload_can_run = 0;
-
-/** filename to be uploaded */
-char upload_filename[MAX_FILENAME_LENGTH];
-
-static int uploader_send_file (char *filename, char *servername,
-                               char *key, unsigned int retain) {
-    int rc = 0;
-    char cmd[MAX_UPLOAD_CMD_LENGTH];
-
-    snprintf(cmd,MAX_UPLOAD_CMD_LENGTH,"scp -q -C -i %s %s %s",key,filename,servername);
-    rc = system(cmd);
-
-    /* see if the command was successful */
-    if (rc == 0) {
-       joy_log_info("transfer of file [%s] successful!", filename);
-       /* see if we are allowed to delete the file after upload */
-       if (retain == 0) {
-            snprintf(cmd, MAX_UPLOAD_CMD_LENGTH, "rm %s", filename);
-            joy_log_info("removing file [%s]", filename);
- 	    rc = remove(filename);
-            if (rc != 0) {
-                joy_log_err("removing file [%s] failed!", filename);
-            }
-        }
-    } else {
-        joy_log_warn("transfer of file [%s] failed!", filename);
-    }
-
-    return 0;
-}
-
-/**
- * \fn void *uploader_main (void *ptr)
- * \brief Runs as a thread off of joy.
- *        Uploader is only active during live processing runs.
- *        Uploader terminates automatically when joy exits due to the nature of
- *        how pthreads work.
- * \param ptr always a pointer to the config structure
- * \return never return and the thread terminates when joy exits
- */
-void *uploader_main(void *ptr)
-{
-    struct configuration *config = ptr;
-
-    /* initialize the uploader filename container */
-    memset(upload_filename, 0x00, MAX_FILENAME_LENGTH);
-
-    /* uploader stays alive until joy exists */
-    while (1) {
-
-        /* wait until we are signaled to do work */
-        pthread_mutex_lock(&upload_in_process);
-        while (!upload_can_run) {
-            joy_log_info("waiting on signal...");
-            pthread_cond_wait(&upload_run_cond, &upload_in_process);
-        }
-
-        /* upload file now */
-        if (strlen(upload_filename) > 0) {
-            joy_log_info("uploading file [%s] ...", upload_filename);
-            uploader_send_file(upload_filename, config->upload_servername,
-                               config->upload_key, config->retain_local);
-        }
-
-        /* we are done uploading the file, go back to sleep */
-        memset(upload_filename, 0x00, MAX_FILENAME_LENGTH);
-        upload_can_run = 0;
-        pthread_mutex_unlock(&upload_in_process);
-    }
-    return NULL;
-}
-
-/*
- * file uploading after rotation
- */
-/**
- * \fn int upload_file (char *filename
- * \brief upload file to the storage server
- * \param filename file to upload
- * \return failure/EXIT_FAILURE
- * \return 0 success
- */
-int upload_file (char *filename) {
-
-    /* sanity check we were passed in a file to upload */
-    if (filename == NULL) {
-        joy_log_err("could not upload file (output file not set)");
-        return failure;
-    }
-
-    /* wake up the uploader thread so it can do its work */
-    pthread_mutex_lock(&upload_in_process);
-    memcpy(upload_filename, filename, (MAX_FILENAME_LENGTH-1));
-    upload_can_run = 1;
-    pthread_cond_signal(&upload_run_cond);
-    pthread_mutex_unlock(&upload_in_process);
-
-    return 0;
-}
-
@@ -54,10 +54,11 @@
  * \brief Initialize the memory of the payload struct.
  *
  * \param payload_handle contains payload structure to init
+ * \param arena arena of the flow record (unused)
  *
  * \return none
  */
-__inline void payload_init (struct payload **payload_handle) {
+__inline void payload_init (struct payload **payload_handle, joy_arena_t *arena) {
    if (*payload_handle != NULL) {
         payload_delete(payload_handle);
     }
@@ -128,6 +129,9 @@ void payload_print_json (const struct payload *x1, const struct payload *x2, zfi
     }
 }
 
+/* the JSON of payload is carried as text in CBOR output */
+define_print_text(payload)
+
 /**
  * \brief Delete the memory of Payload struct.
  *
@@ -154,6 +158,7 @@ void payload_delete (struct payload **payload_handle) {
  */
 void payload_unit_test () {
     struct payload *payload1 = NULL;
+    joy_arena_t arena;
     struct payload *payload2 = NULL;
     const struct pcap_pkthdr *header = NULL; 
     unsigned char data1[16] = {
@@ -167,14 +172,16 @@ void payload_unit_test () {
     };
 
     fprintf(stdout, "running unit test for payload feature...");
-    payload_init(&payload1);
-    payload_init(&payload2);
+    memset(&arena, 0, sizeof(arena));
+    payload_init(&payload1, &arena);
+    payload_init(&payload2, &arena);
     payload_update(payload1, header, data1, sizeof(data1), 1);
     payload_update(payload2, header, data2, sizeof(data2), 1);
     // no print test yet 
     // payload_print_json (payload1, NULL, f);    
     payload_delete(&payload1);
     payload_delete(&payload2);
+    joy_arena_release(&arena);
     fprintf(stdout, "done (success)\n");
 } 
 
@@ -45,6 +45,7 @@
 #include <ctype.h>
 #include <string.h>
 #include <assert.h>
+#include <limits.h>
 #include "pkt_proc.h"
 #include "p2f.h"
 #include "pkt.h"
@@ -535,6 +536,42 @@ static joy_status_e process_nfv9 (joy_ctx_data *ctx,
     return ok;
 }
 
+/**
+ * \brief Check a packet against the deep-inspection budget of its flow.
+ *
+ * The byte distribution, protocol identification, protocol parsers and
+ * header description only need to see the start of a flow, so they are
+ * applied to at most the first inspect_pkts payload packets and the
+ * first inspect_bytes payload bytes in each direction; past that, only
+ * the counters and timestamps of the record are updated.  The packet
+ * that crosses the byte budget is still inspected in full.
+ *
+ * \param record The flow record (one direction of a flow)
+ * \param size_payload The number of payload bytes in the packet
+ * \return 1 if the payload should be inspected, 0 otherwise
+ */
+static unsigned int flow_record_within_inspect_budget (flow_record_t *record,
+                                                       unsigned int size_payload) {
+
+    if (glb_config->inspect_pkts && record->inspected_pkts >= glb_config->inspect_pkts) {
+        return 0;
+    }
+    if (glb_config->inspect_bytes && record->inspected_bytes >= glb_config->inspect_bytes) {
+        return 0;
+    }
+
+    if (size_payload > 0) {
+        record->inspected_pkts++;
+        if (record->inspected_bytes > UINT_MAX - size_payload) {
+            record->inspected_bytes = UINT_MAX;
+        } else {
+            record->inspected_bytes += size_payload;
+        }
+    }
+
+    return 1;
+}
+
 static flow_record_t *
 process_tcp (joy_ctx_data *ctx, const struct pcap_pkthdr *header, const char *tcp_start, int tcp_len, flow_key_t *key) {
     unsigned int tcp_hdr_len;
@@ -638,6 +675,10 @@ process_tcp (joy_ctx_data *ctx, const struct pcap_pkthdr *header, const char *tc
 
     record->ob += size_payload;
 
+    if (!flow_record_within_inspect_budget(record, size_payload)) {
+        return record;
+    }
+
     flow_record_update_byte_count(record, payload, size_payload);
     flow_record_update_compact_byte_count(record, payload, size_payload);
     flow_record_update_byte_dist_mean_var(record, payload, size_payload);
@@ -721,26 +762,28 @@ process_udp (joy_ctx_data *ctx, const struct pcap_pkthdr *header, const char *ud
     }
     record->ob += size_payload;
 
-    flow_record_update_byte_count(record, payload, size_payload);
-    flow_record_update_compact_byte_count(record, payload, size_payload);
-    flow_record_update_byte_dist_mean_var(record, payload, size_payload);
+    if (flow_record_within_inspect_budget(record, size_payload)) {
+        flow_record_update_byte_count(record, payload, size_payload);
+        flow_record_update_compact_byte_count(record, payload, size_payload);
+        flow_record_update_byte_dist_mean_var(record, payload, size_payload);
 
-    /*
-     * Estimate the UDP application protocol
-     * Optimization: stop after first 2 packets that have non-zero payload
-     */
-    if ((!record->app) && record->op <= 2) {
-        const struct pi_container *pi = proto_identify_udp(payload, size_payload);
-        if (pi != NULL) {
-            record->app = pi->app;
-            record->dir = pi->dir;
+        /*
+         * Estimate the UDP application protocol
+         * Optimization: stop after first 2 packets that have non-zero payload
+         */
+        if ((!record->app) && record->op <= 2) {
+            const struct pi_container *pi = proto_identify_udp(payload, size_payload);
+            if (pi != NULL) {
+                record->app = pi->app;
+                record->dir = pi->dir;
+            }
         }
-    }
 
-    /*
-     * Run protocol modules!
-     */
-    update_all_features(payload_feature_list);
+        /*
+         * Run protocol modules!
+         */
+        update_all_features(payload_feature_list);
+    }
 
     if (glb_config->nfv9_capture_port && (key->dp == glb_config->nfv9_capture_port)) {
         pthread_mutex_lock(&nfv9_lock);
@@ -811,6 +854,10 @@ process_icmp (joy_ctx_data *ctx, const struct pcap_pkthdr *header, const char *s
     }
     record->ob += size_payload;
 
+    if (!flow_record_within_inspect_budget(record, size_payload)) {
+        return record;
+    }
+
     flow_record_update_byte_count(record, payload, size_payload);
     flow_record_update_compact_byte_count(record, payload, size_payload);
     flow_record_update_byte_dist_mean_var(record, payload, size_payload);
@@ -856,6 +903,10 @@ process_ip (joy_ctx_data *ctx, const struct pcap_pkthdr *header, const void *ip_
     }
     record->ob += size_payload;
 
+    if (!flow_record_within_inspect_budget(record, size_payload)) {
+        return record;
+    }
+
     flow_record_update_byte_count(record, payload, size_payload);
     flow_record_update_compact_byte_count(record, payload, size_payload);
     flow_record_update_byte_dist_mean_var(record, payload, size_payload);
@@ -898,6 +949,9 @@ void process_packet (unsigned char *ctx_ptr, const struct pcap_pkthdr *pkt_heade
     
     memset(&key, 0x00, sizeof(flow_key_t));
 
+    /* the context holds no labels or parameters between packets */
+    joy_snapshot_quiescent(&ctx->snapshot_reader);
+
     flocap_stats_incr_num_packets(ctx);
     joy_log_info("++++++++++ Packet %lu ++++++++++", ctx->stats.num_packets);
     //  packet_count++;
@@ -1007,6 +1061,27 @@ void process_packet (unsigned char *ctx_ptr, const struct pcap_pkthdr *pkt_heade
     /* determine transport protocol and handle appropriately */
 
     transport_start = (char *)ip + ip_hdr_len;
+
+    /*
+     * flow sampling: drop the packet before any per-flow work is done
+     * unless its flow is selected; the ports are peeked here, since the
+     * transport processing functions fill them in later
+     */
+    if (glb_config->sample_rate > 1 || glb_config->adaptive_sample) {
+        flow_key_t sample_key = key;
+
+        if ((proto == IPPROTO_TCP || proto == IPPROTO_UDP) && transport_len >= 4) {
+            const unsigned short *ports = (const unsigned short *)transport_start;
+            sample_key.sp = ntohs(ports[0]);
+            sample_key.dp = ntohs(ports[1]);
+        }
+        if (!flow_key_is_sampled(ctx, &sample_key)) {
+            if (allocated_packet_header)
+                free(header);
+            return;
+        }
+    }
+
     switch(proto) {
         case IPPROTO_TCP:
             record = process_tcp(ctx, header, transport_start, transport_len, &key);
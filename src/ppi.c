@@ -66,10 +66,11 @@ static void pkt_info_print_interleaved(zfile f,
  * \brief Initialize the memory of PPI struct.
  *
  * \param ppi_handle contains ppi structure to init
+ * \param arena arena of the flow record (unused)
  *
  * \return none
  */
-void ppi_init (struct ppi **ppi_handle) {
+void ppi_init (struct ppi **ppi_handle, joy_arena_t *arena) {
     if (*ppi_handle != NULL) {
         ppi_delete(ppi_handle);
     }
@@ -152,6 +153,9 @@ void ppi_print_json (const struct ppi *x1, const struct ppi *x2, zfile f) {
 
 }
 
+/* the JSON of ppi is carried as text in CBOR output */
+define_print_text(ppi)
+
 /**
  * \brief Delete the memory of PPI struct.
  *
@@ -48,6 +48,8 @@
 #include "proto_identify.h"
 #include "config.h"
 #include "err.h"
+#include "utils.h"
+#include "parson.h"
 
 extern struct configuration *glb_config;
 extern FILE *info;
@@ -59,7 +61,12 @@ extern FILE *info;
  * --------------------------------------------------
  */
 
-#define MAX_VAL_LEN 32
+/*
+ * keywords are matched with fixed-width compares of PI_MATCH_LEN bytes,
+ * so that is also the longest keyword that can be expressed
+ */
+#define PI_MATCH_LEN 16
+#define MAX_VAL_LEN PI_MATCH_LEN
 #define MAX_VAL_BYTES (2 * MAX_VAL_LEN)
 
 /**
@@ -411,6 +418,110 @@ static int populate_udp_keyword_identifiers(void) {
     return 0;
 }
 
+/*
+ * \brief Add the keyword identifiers listed in a resource file array.
+ *
+ * Each element of \p identifiers is an object holding the "app" number,
+ * the "dir" ("client", "server" or "unknown") and the "pattern", which
+ * is a string of hex byte values in which "??" matches any byte.
+ *
+ * \param[in] wordlist The list of keywords
+ * \param[in] identifiers The JSON array of identifiers
+ *
+ * \return 0 for success, 1 for failure
+ */
+static int add_resource_identifiers(struct keyword_list *wordlist,
+                                    const JSON_Array *identifiers) {
+    size_t i = 0;
+
+    for (i = 0; i < json_array_get_count(identifiers); i++) {
+        const JSON_Object *ident = json_array_get_object(identifiers, i);
+        const char *pattern = json_object_get_string(ident, "pattern");
+        const char *dir = json_object_get_string(ident, "dir");
+        uint16_t string[MAX_VAL_LEN];
+        unsigned int len = 0;
+        struct pi_container pi;
+
+        if (pattern == NULL || strlen(pattern) % 2 || strlen(pattern) / 2 > MAX_VAL_LEN) {
+            joy_log_err("bad pattern in identifier %zu", i);
+            return 1;
+        }
+
+        for (len = 0; pattern[2 * len] != 0; len++) {
+            unsigned int byte = 0;
+
+            if (pattern[2 * len] == '?' && pattern[2 * len + 1] == '?') {
+                string[len] = WILDCARD;
+            } else if (sscanf(pattern + 2 * len, "%2x", &byte) == 1) {
+                string[len] = (uint16_t)byte;
+            } else {
+                joy_log_err("bad pattern in identifier %zu", i);
+                return 1;
+            }
+        }
+
+        pi.app = (uint16_t)json_object_get_number(ident, "app");
+        if (pi.app == 0 || len == 0) {
+            joy_log_err("identifier %zu needs a pattern and nonzero app", i);
+            return 1;
+        }
+        if (dir && !strcmp(dir, "client")) {
+            pi.dir = DIR_CLIENT;
+        } else if (dir && !strcmp(dir, "server")) {
+            pi.dir = DIR_SERVER;
+        } else {
+            pi.dir = DIR_UNKNOWN;
+        }
+
+        if (add_keyword(wordlist, string, len * sizeof(uint16_t), &pi)) {
+            joy_log_err("problem adding keyword");
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * \brief Add the keyword identifiers from the proto_identify.json resource.
+ *
+ * The resource is optional; the built-in identifiers are used alone if
+ * it cannot be found.
+ *
+ * \param none
+ *
+ * \return 0 for success, 1 for failure
+ */
+static int populate_resource_keyword_identifiers(void) {
+    JSON_Value *root_value = NULL;
+    JSON_Object *data_obj = NULL;
+    int missing = 0;
+    int rc = 0;
+
+    root_value = joy_utils_open_optional_resource_parson("proto_identify.json", &missing);
+    if (root_value == NULL) {
+        if (missing) {
+            joy_log_info("no proto_identify.json; using built-in protocol identifiers only");
+        } else {
+            joy_log_warn("using built-in protocol identifiers only");
+        }
+        return 0;
+    }
+
+    data_obj = json_object_get_object(json_value_get_object(root_value), "data");
+    if (data_obj == NULL) {
+        joy_log_err("expected \"data\" object in proto_identify.json");
+        rc = 1;
+    } else if (add_resource_identifiers(&tcp_keywords, json_object_get_array(data_obj, "tcp")) ||
+               add_resource_identifiers(&udp_keywords, json_object_get_array(data_obj, "udp"))) {
+        joy_log_err("problem populating resource keywords");
+        rc = 1;
+    }
+
+    json_value_free(root_value);
+    return rc;
+}
+
 /*
  * \brief Initialize and setup the keywords lists.
  *
@@ -421,340 +532,218 @@ static int populate_udp_keyword_identifiers(void) {
 static int init_keywords(void) {
     int rc = 0;
 
-    /* Populate the TCP keywords array */
-    if (tcp_keywords.count == 0) {
-        rc = populate_tcp_keyword_identifiers();
-        if (rc == 1) return 1;
+    if (tcp_keywords.count || udp_keywords.count) {
+        /* Already populated */
+        return 0;
     }
 
+    /* Populate the TCP keywords array */
+    rc = populate_tcp_keyword_identifiers();
+    if (rc == 1) return 1;
+
     /* Populate the UDP keywords array */
-    if (udp_keywords.count == 0) {
-        rc = populate_udp_keyword_identifiers();
-        if (rc == 1) return 1;
-    }
+    rc = populate_udp_keyword_identifiers();
+    if (rc == 1) return 1;
+
+    /* Extra identifiers for either transport */
+    rc = populate_resource_keyword_identifiers();
+    if (rc == 1) return 1;
 
     return 0;
 }
 
 /* --------------------------------------------------
  * --------------------------------------------------
- * KEYWORD DICTIONARY MATCHING
+ * FIRST-BYTE DISPATCH TABLE
  * --------------------------------------------------
  * --------------------------------------------------
  */
 
-#define MAX_CHILDREN 257 /**< Full range of 1 byte, plus an extra slot for "wildcard" */
 /**
- * \brief Node of the keyword_dict tree.
+ * \brief A keyword compiled for a masked, fixed-width compare.
+ *
+ * Bytes past the end of the keyword, and wildcard bytes, have a zero
+ * mask, so a candidate is checked with two 8-byte loads and compares.
  */
-struct keyword_dict_node {
-    uint16_t edge[MAX_CHILDREN]; /**< 16bit value, so that it can hold "wildcard"
-                                      in addition to full-range of single byte (0-255) */
-    struct keyword_dict_node *child; /* Pointer to first child */
-    struct keyword_dict_node *sibling; /* Pointer to next sibling */
-    uint16_t num_children; /* Number of children under this node */
-    struct pi_container pi; /* Protocol inference */
+struct pi_rule {
+    uint64_t value[PI_MATCH_LEN / sizeof(uint64_t)];
+    uint64_t mask[PI_MATCH_LEN / sizeof(uint64_t)];
+    unsigned int len; /**< Minimum data length for a match */
+    struct pi_container pi;
 };
 
-/*
- * Root of the keyword_dict trees
- */
-struct keyword_dict_node *kd_tcp_root = NULL;
-struct keyword_dict_node *kd_udp_root = NULL;
-
 /**
- * \brief Allocate memory for a keyword_dict_node
- *
- * \param none
+ * \brief Keywords indexed by the first byte of the data.
  *
- * \return Pointer to newly allocated keyword_dict_node
+ * The candidates for first byte b are rule[cand[first[b]]] through
+ * rule[cand[first[b+1] - 1]], in the order the keywords were added;
+ * a keyword that starts with a wildcard is a candidate for every byte.
  */
-static struct keyword_dict_node *alloc_kdn(void) {
+struct pi_dispatch {
+    struct pi_rule rule[MAX_KEYWORDS];
+    uint32_t first[256 + 1];
+    uint16_t *cand;
+};
 
-    return calloc(1, sizeof(struct keyword_dict_node));
-}
+static struct pi_dispatch *pd_tcp = NULL;
+static struct pi_dispatch *pd_udp = NULL;
 
 /**
- * \brief Free the node, and all children nodes underneath.
+ * \brief Compile a keyword into a masked compare rule.
  *
- * \param[in] node Pointer to the root keyword_dict_node
+ * \param[out] rule The rule
+ * \param[in] kc Pointer to the keyword_container, representing the keyword
  *
  * \return none
  */
-static void destroy_kdn(struct keyword_dict_node *node) {
+static void pi_rule_compile(struct pi_rule *rule,
+                            const struct keyword_container *kc) {
+    unsigned char value[PI_MATCH_LEN] = {0};
+    unsigned char mask[PI_MATCH_LEN] = {0};
+    unsigned int i = 0;
 
-    struct keyword_dict_node *child = NULL;
-    struct keyword_dict_node *sibling = NULL;
-
-    if (node == NULL) {
-        return;
-    }
-
-    if (node->child == NULL || node->num_children == 0) {
-        free(node);
-        node = NULL;
-        return;
-    }
-
-    /* The first child */
-    child = node->child;
-
-    while (child != NULL) {
-        /* Get the next child node before deleting this one */
-        sibling = child->sibling;
-
-        /* Recurse */
-        destroy_kdn(child);
-
-        /* Tee up the next one */
-        child = sibling;
+    for (i = 0; i < kc->value_len; i++) {
+        if (kc->value[i] != WILDCARD) {
+            value[i] = (unsigned char)kc->value[i];
+            mask[i] = 0xff;
+        }
     }
 
-    /* Now delete the parent */
-    free(node);
-    node = NULL;
-    return;
+    /* byte order does not matter, since data is loaded the same way */
+    memcpy(rule->value, value, PI_MATCH_LEN);
+    memcpy(rule->mask, mask, PI_MATCH_LEN);
+    rule->len = kc->value_len;
+    rule->pi = kc->pi;
 }
 
 /**
- * \brief Create a child node under the parent \p node.
- *
- * This function should only be used to generate the first child.
- * Use kdn_create_sibling for making more children.
+ * \brief Test whether a keyword is a candidate for a given first byte.
  *
- * \param[in] parent Pointer to the parent node
- * \param[in] edge Integer value representing the child node
+ * \param[in] kc Pointer to the keyword_container
+ * \param[in] byte The first byte of the data
  *
- * \return Pointer to child, or NULL
+ * \return 1 if the keyword could match, 0 otherwise
  */
-static struct keyword_dict_node *kdn_create_child(struct keyword_dict_node *parent,
-                                                  uint16_t edge) {
-    if (parent == NULL) {
-        return NULL;
-    }
-
-    if (parent->child || (parent->num_children != 0)) {
-        joy_log_err("child already exists");
-        return NULL;
-    }
-
-    parent->child = alloc_kdn();
+static int pi_rule_first_byte(const struct keyword_container *kc,
+                              unsigned int byte) {
 
-    /* Set the edge value corresponding to this child */
-    parent->edge[parent->num_children] = edge;
-
-    /* Increment household count */
-    parent->num_children++;
-
-    return parent->child;
+    return (kc->value[0] == WILDCARD) || (kc->value[0] == byte);
 }
 
 /**
- * \brief Create a sibling node, parallel to the \p child, under the \p parent.
+ * \brief Build the dispatch table for a keyword list.
  *
- * \param[in] parent Pointer to the parent node
- * \param[in] child Pointer to the child node
- * \param[in] edge Integer value representing the sibling node
+ * \param[out] pd Handle to the dispatch table
+ * \param[in] wordlist The list of keywords
  *
- * \return Pointer to sibling, or NULL
+ * \return 0 for success, 1 for failure
  */
-static struct keyword_dict_node *kdn_create_sibling(struct keyword_dict_node *parent,
-                                                    struct keyword_dict_node *child,
-                                                    uint16_t edge) {
-    if (parent == NULL || child == NULL) {
-        return NULL;
-    }
+static int pi_dispatch_build(struct pi_dispatch **pd,
+                             const struct keyword_list *wordlist) {
+    struct pi_dispatch *d = NULL;
+    unsigned int b, i, n = 0;
 
-    if (child->sibling != NULL) {
-        joy_log_err("child already has a sibling");
+    if (pd == NULL || *pd != NULL || wordlist == NULL) {
+        return 1;
     }
 
-    if (parent->num_children == (MAX_CHILDREN - 1)) {
-        joy_log_err("already at MAX_CHILDREN(%d)", MAX_CHILDREN);
-        return NULL;
+    d = calloc(1, sizeof(struct pi_dispatch));
+    if (d == NULL) {
+        joy_log_err("out of memory");
+        return 1;
     }
 
-    /* The first one! */
-    child->sibling = alloc_kdn();
-
-    /* Set the edge value corresponding to this child */
-    parent->edge[parent->num_children] = edge;
-
-    /* Increment household count */
-    parent->num_children++;
-
-    return child->sibling;
-}
-
-/**
- * \brief Add a keyword to the keyword_dictionary tree.
- *
- * \param[in] root Pointer to the root node of the dictionary tree
- * \param[in] kc Pointer to the keyword_container, representing the keyword
- *
- * \return 0 for success, 1 for failure
- */
-static int keyword_dict_add_keyword(struct keyword_dict_node *root,
-                                    const struct keyword_container *kc) {
-
-    struct keyword_dict_node *node = NULL;
-    int i = 0;
-
-    if (root == NULL || kc == NULL) {
-        return 0;
+    /* count the candidates, to size the index array */
+    for (i = 0; i < wordlist->count; i++) {
+        pi_rule_compile(&d->rule[i], &wordlist->keyword[i]);
+        n += (wordlist->keyword[i].value[0] == WILDCARD) ? 256 : 1;
     }
 
-    /* The root node of the tree */
-    node = root;
-
-    for (i = 0; i < kc->value_len; i++) {
-        /* Grab the next value of string for comparison */
-        uint16_t val = *(kc->value + i);
-
-        if (node->child) {
-            struct keyword_dict_node *child = node->child;
-            int match = 0;
-            int k = 0;
-
-            for (k = 0; k < node->num_children; k++) {
-                /*
-                 * Compare this character to all the children edges
-                 */
-                if (val == node->edge[k]) {
-                    /* Matches the edge to this child */
-                    match = 1;
-                    break;
-                }
-
-                if (child->sibling != NULL) {
-                    /* Point to the next child */
-                    child = child->sibling;
-                }
-            }
+    d->cand = calloc(n ? n : 1, sizeof(uint16_t));
+    if (d->cand == NULL) {
+        joy_log_err("out of memory");
+        free(d);
+        return 1;
+    }
 
-            if (match) {
-                node = child;
-            } else {
-                /* Make a new sibling node/edge */
-                node = kdn_create_sibling(node, child, val);
+    n = 0;
+    for (b = 0; b < 256; b++) {
+        d->first[b] = n;
+        for (i = 0; i < wordlist->count; i++) {
+            if (pi_rule_first_byte(&wordlist->keyword[i], b)) {
+                d->cand[n++] = i;
             }
-        } else {
-            /*
-             * No existing children.
-             * Make a new child node/edge.
-             */
-            node = kdn_create_child(node, val);
         }
     }
+    d->first[256] = n;
 
-    /*
-     * This is the end node for the keyword.
-     * Set the protocol inference information.
-     */
-    node->pi = kc->pi;
-
+    *pd = d;
     return 0;
 }
 
 /**
- * \brief Construct the keyword dictionary tree, adding all keywords in the list.
+ * \brief Free a dispatch table.
  *
- * \param[in] root Handle to the root node of the dictionary tree
- * \param[in] wordlist The list of keywords
+ * \param[in] pd Pointer to the dispatch table
  *
- * \return 0 for success, 1 for failure
+ * \return none
  */
-static int construct_keyword_dict(struct keyword_dict_node **root,
-                                  struct keyword_list *wordlist) {
+static void pi_dispatch_destroy(struct pi_dispatch *pd) {
 
-    int i = 0;
-
-    if (root == NULL || *root != NULL) {
-        return 1;
-    }
-
-    if (wordlist == NULL) {
-        return 1;
-    }
-
-    *root = alloc_kdn();
-
-    /*
-     * Looping over the list of keywords,
-     * construct the keyword_dictionary tree.
-     */
-    for (i = 0; i < wordlist->count; i++) {
-        /* Pointer to the latest keyword */
-        struct keyword_container *kc = &wordlist->keyword[i];
-
-        if (keyword_dict_add_keyword(*root, kc)) {
-            joy_log_err("couldn't add keywords[%d]", i);
-        }
+    if (pd == NULL) {
+        return;
     }
-
-    return 0;
+    free(pd->cand);
+    free(pd);
 }
 
 /**
- * \brief Search the tree, beginning at \p root, for any keywords that match the \p data.
+ * \brief Find the first keyword that is a prefix of the \p data.
  *
- * \param[in] root Pointer to the root node of the dictionary tree
+ * \param[in] pd Pointer to the dispatch table
  * \param[in] data Pointer to the data
  * \param[in] data_len Length of the data in bytes
  *
  * \return Pointer to protocol inference container, or NULL
  */
-static const struct pi_container *search_keyword_dict(const struct keyword_dict_node *root,
-                                                      const char *data,
-                                                      unsigned int data_len) {
+static const struct pi_container *pi_dispatch_search(const struct pi_dispatch *pd,
+                                                     const char *data,
+                                                     unsigned int data_len) {
+    uint64_t w[PI_MATCH_LEN / sizeof(uint64_t)];
+    unsigned int b, i;
 
-    const struct keyword_dict_node *node = root;
-    const struct keyword_dict_node *child = NULL;
-    int i = 0;
+    if (pd == NULL || data == NULL || data_len == 0) {
+        return NULL;
+    }
 
-    if (root == NULL || data == NULL || data_len == 0) {
+    b = (unsigned char)data[0];
+    if (pd->first[b] == pd->first[b + 1]) {
+        /* the common case: no keyword can match */
         return NULL;
     }
 
-    /* The first child (may be null) */
-    child = node->child;
+    if (data_len >= PI_MATCH_LEN) {
+        memcpy(w, data, PI_MATCH_LEN);
+    } else {
+        memset(w, 0, PI_MATCH_LEN);
+        memcpy(w, data, data_len);
+    }
 
-    /*
-     * Check to see if any children are an "end" node.
-     * If no children exist, this loop will be skipped.
-     */
-    for (i = 0; i < node->num_children; i++) {
-        if ((node->edge[i] == WILDCARD) || (*data == node->edge[i])) {
-            if (child->pi.app) {
-                /*
-                 * Match!
-                 * We've reached a node that contains
-                 * protocol inference information.
-                 */
-                return &child->pi;
-            } else {
-                /*
-                 * Compare next layer node
-                 */
-                if (data_len == 1) {
-                    /* No more data to compare */
-                    return NULL;
-                }
-
-                return search_keyword_dict(child, (data + 1), (data_len - 1));
-            }
-        }
+    for (i = pd->first[b]; i < pd->first[b + 1]; i++) {
+        const struct pi_rule *r = &pd->rule[pd->cand[i]];
 
-        /* Get the next child */
-        child = child->sibling;
+        if (r->len <= data_len &&
+            (w[0] & r->mask[0]) == r->value[0] &&
+            (w[1] & r->mask[1]) == r->value[1]) {
+            return &r->pi;
+        }
     }
 
-    /* No more children */
     return NULL;
 }
 
 /**
- * \brief Initialize and setup the proto_identify keyword dictionary.
+ * \brief Initialize and setup the proto_identify dispatch tables.
  *
  * \param none
  *
@@ -767,35 +756,39 @@ int proto_identify_init(void) {
         return 1;
     }
 
-    /* Create the TCP tree graph */
-    if (kd_tcp_root == NULL) {
-        construct_keyword_dict(&kd_tcp_root, &tcp_keywords);
+    /* Create the TCP dispatch table */
+    if (pd_tcp == NULL) {
+        if (pi_dispatch_build(&pd_tcp, &tcp_keywords)) {
+            return 1;
+        }
     }
 
-    /* Create the UDP tree graph */
-    if (kd_udp_root == NULL) {
-        construct_keyword_dict(&kd_udp_root, &udp_keywords);
+    /* Create the UDP dispatch table */
+    if (pd_udp == NULL) {
+        if (pi_dispatch_build(&pd_udp, &udp_keywords)) {
+            return 1;
+        }
     }
 
     return 0;
 }
 
 /**
- * \brief Teardown the proto_identify keyword dictionary(s), and all associated memory.
+ * \brief Teardown the proto_identify dispatch tables, and all associated memory.
  *
  * \param none
  *
  * \return none
  */
 void proto_identify_cleanup(void) {
-    if (kd_tcp_root) {
-        destroy_kdn(kd_tcp_root);
-        kd_tcp_root = NULL;
+    if (pd_tcp) {
+        pi_dispatch_destroy(pd_tcp);
+        pd_tcp = NULL;
     }
 
-    if (kd_udp_root) {
-        destroy_kdn(kd_udp_root);
-        kd_udp_root = NULL;
+    if (pd_udp) {
+        pi_dispatch_destroy(pd_udp);
+        pd_udp = NULL;
     }
 }
 
@@ -810,20 +803,16 @@ void proto_identify_cleanup(void) {
 const struct pi_container *proto_identify_tcp(const char *tcp_data,
                                               unsigned int len) {
 
-    const struct pi_container *pi = NULL;
-
     if (len == 0) {
         return NULL;
     }
 
-    if (kd_tcp_root == NULL) {
+    if (pd_tcp == NULL) {
         joy_log_err("Protocol identification for TCP was not initialized");
         return NULL;
     }
 
-    pi = search_keyword_dict(kd_tcp_root, tcp_data, len);
-
-    return pi;
+    return pi_dispatch_search(pd_tcp, tcp_data, len);
 }
 
 /**
@@ -837,19 +826,82 @@ const struct pi_container *proto_identify_tcp(const char *tcp_data,
 const struct pi_container *proto_identify_udp(const char *udp_data,
                                               unsigned int len) {
 
-    const struct pi_container *pi = NULL;
-
     if (len == 0) {
         return NULL;
     }
 
-    if (kd_udp_root == NULL) {
+    if (pd_udp == NULL) {
         joy_log_err("Protocol identification for UDP was not initialized");
         return NULL;
     }
 
-    pi = search_keyword_dict(kd_udp_root, udp_data, len);
-
-    return pi;
+    return pi_dispatch_search(pd_udp, udp_data, len);
 }
 
+/**
+ * \brief Run the protocol identification unit tests.
+ *
+ * \param none
+ *
+ * \return none
+ */
+void proto_identify_unit_test(void) {
+    const struct pi_container *pi = NULL;
+    int num_fails = 0;
+
+    const char client_hello[] = { 0x16, 0x03, 0x03, 0x00, 0xc8, 0x01, 0x00 };
+    const char server_hello[] = { 0x16, 0x03, 0x01, 0x12, 0x34, 0x02 };
+    const char dns_reply[] = { 0x7a, 0x1c, 0x01, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00 };
+    const char *http_get = "GET /index.html HTTP/1.1\r\n";
+
+    fprintf(info, "\n******************************\n");
+    fprintf(info, "Protocol Identification Unit Test starting...\n");
+
+    if (proto_identify_init()) {
+        fprintf(info, "error: could not initialize\n");
+        num_fails++;
+    }
+
+    pi = proto_identify_tcp(client_hello, sizeof(client_hello));
+    if (pi == NULL || pi->app != 443 || pi->dir != DIR_CLIENT) {
+        fprintf(info, "error: tls client hello not identified\n");
+        num_fails++;
+    }
+
+    pi = proto_identify_tcp(server_hello, sizeof(server_hello));
+    if (pi == NULL || pi->app != 443 || pi->dir != DIR_SERVER) {
+        fprintf(info, "error: tls server hello not identified\n");
+        num_fails++;
+    }
+
+    pi = proto_identify_tcp(http_get, strlen(http_get));
+    if (pi == NULL || pi->app != 80 || pi->dir != DIR_CLIENT) {
+        fprintf(info, "error: http get not identified\n");
+        num_fails++;
+    }
+
+    /* keyword longer than the data */
+    if (proto_identify_tcp(http_get, 3) != NULL) {
+        fprintf(info, "error: matched truncated http get\n");
+        num_fails++;
+    }
+
+    pi = proto_identify_udp(dns_reply, sizeof(dns_reply));
+    if (pi == NULL || pi->app != 53) {
+        fprintf(info, "error: dns not identified\n");
+        num_fails++;
+    }
+
+    /* dns keyword starts with wildcards, but must not match tcp */
+    if (proto_identify_tcp(dns_reply, sizeof(dns_reply)) != NULL) {
+        fprintf(info, "error: dns matched over tcp\n");
+        num_fails++;
+    }
+
+    if (num_fails) {
+        fprintf(info, "Finished - failures: %d\n", num_fails);
+    } else {
+        fprintf(info, "Finished - success\n");
+    }
+    fprintf(info, "******************************\n\n");
+}
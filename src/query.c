@@ -0,0 +1,1361 @@
+/*
+ *
+ * Copyright (c) 2018 Cisco Systems, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ *
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file query.c
+ *
+ * \brief Filtering and selection of JSON flow records, with the
+ *        --where, --select and --groupby expressions of sleuth
+ *
+ * A record is scanned once at its top level.  The members that the
+ * query names are noted where they are found; every other value is
+ * skipped by looking only for the characters that can end it - quotes
+ * and backslashes in a string, and also brackets and braces in an
+ * object or an array - sixteen bytes at a time where SSE2 is
+ * available.  The tests and the selection then look into the noted
+ * values only, the same way.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "query.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* what a field list entry selects */
+typedef enum tmpl_kind_e_ {
+    tmpl_value,                   /* the value, whatever it is */
+    tmpl_object,                  /* name{...}: members of an object */
+    tmpl_list                     /* name[...]: members of the objects in a list */
+} tmpl_kind_e;
+
+/* an entry of a field list */
+typedef struct tmpl_ {
+    char *name;
+    size_t len;
+    tmpl_kind_e kind;
+    int id;                       /* at the top level, the index of the key */
+    struct tmpl_ *child;          /* entries inside {} or [], NULL for name[] */
+    struct tmpl_ *next;
+} tmpl_t;
+
+typedef enum pred_type_e_ {
+    pred_and,
+    pred_or,
+    pred_test
+} pred_type_e;
+
+/* a node of a --where expression */
+typedef struct pred_ {
+    pred_type_e type;
+    struct pred_ *left;
+    struct pred_ *right;
+    tmpl_t *path;                 /* field tested */
+    char op;                      /* one of = ~ < > */
+    char *arg;                    /* value or pattern it is tested against */
+    int numeric;                  /* arg is a number, compared as one */
+    double num;
+    int star;                     /* arg is "*", so the test is for presence */
+} pred_t;
+
+struct query_ {
+    tmpl_t *select;
+    tmpl_t *groupby;
+    pred_t *where;
+    unsigned int num_keys;
+    const char *key[QUERY_MAX_KEYS];      /* top-level members named */
+    size_t key_len[QUERY_MAX_KEYS];
+    const tmpl_t *select_top[QUERY_MAX_KEYS]; /* entry of select for each key, or NULL */
+    const tmpl_t *group_top[QUERY_MAX_KEYS];
+    int version;                  /* key that marks the configuration line */
+};
+
+/* the members of a record that the query names */
+typedef struct record_ {
+    const char *value[QUERY_MAX_KEYS];
+    const char *value_end[QUERY_MAX_KEYS];
+    unsigned char order[QUERY_MAX_KEYS]; /* keys in the order they were found */
+    unsigned int count;
+} record_t;
+
+/*
+ * -------------------------------------------------------
+ * Buffers
+ * -------------------------------------------------------
+ */
+
+/**
+ * \fn int query_buf_append (query_buf_t *b, const void *data, size_t len)
+ * \brief Append \p len bytes to \p b.
+ * \param b buffer
+ * \param data bytes to append
+ * \param len number of bytes
+ * \return 0 on success, -1 if out of memory
+ */
+int query_buf_append (query_buf_t *b, const void *data, size_t len) {
+    if (len == 0) {
+        return 0;
+    }
+    if (b->len + len > b->size) {
+        size_t size = b->size ? b->size : 4096;
+        char *tmp;
+
+        while (size < b->len + len) {
+            size *= 2;
+        }
+        tmp = realloc(b->data, size);
+        if (tmp == NULL) {
+            return -1;
+        }
+        b->data = tmp;
+        b->size = size;
+    }
+    memcpy(b->data + b->len, data, len);
+    b->len += len;
+    return 0;
+}
+
+/**
+ * \fn void query_buf_free (query_buf_t *b)
+ * \brief Free the memory of \p b, and empty it.
+ * \param b buffer
+ */
+void query_buf_free (query_buf_t *b) {
+    free(b->data);
+    memset(b, 0, sizeof(*b));
+}
+
+/*
+ * -------------------------------------------------------
+ * Scanning
+ * -------------------------------------------------------
+ */
+
+static const char *json_ws (const char *p, const char *end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) {
+        p++;
+    }
+    return p;
+}
+
+/* p is just after the opening quote; returns just after the closing one */
+static const char *json_string_end (const char *p, const char *end) {
+#ifdef __SSE2__
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+
+    while (end - p >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        unsigned int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, quote),
+                                                           _mm_cmpeq_epi8(v, backslash)));
+        if (mask == 0) {
+            p += 16;
+            continue;
+        }
+        p += __builtin_ctz(mask);
+        if (*p == '"') {
+            return p + 1;
+        }
+        p += 2;                   /* the escaped character */
+    }
+#endif
+    while (p < end) {
+        if (*p == '"') {
+            return p + 1;
+        }
+        if (*p == '\\') {
+            p++;
+        }
+        p++;
+    }
+    return NULL;
+}
+
+/* p is at the opening brace or bracket; returns just after the closing one */
+static const char *json_container_end (const char *p, const char *end) {
+    unsigned int depth = 0;
+
+#ifdef __SSE2__
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i open_brace = _mm_set1_epi8('{');
+    const __m128i close_brace = _mm_set1_epi8('}');
+    const __m128i open_bracket = _mm_set1_epi8('[');
+    const __m128i close_bracket = _mm_set1_epi8(']');
+
+    while (end - p >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        unsigned int mask = _mm_movemask_epi8(
+            _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, open_brace)),
+                         _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, close_brace),
+                                                   _mm_cmpeq_epi8(v, open_bracket)),
+                                      _mm_cmpeq_epi8(v, close_bracket))));
+        const char *next = p + 16;
+
+        while (mask) {
+            const char *c = p + __builtin_ctz(mask);
+
+            if (*c == '"') {
+                /* carry on after the string, from wherever it ends */
+                next = json_string_end(c + 1, end);
+                if (next == NULL) {
+                    return NULL;
+                }
+                break;
+            }
+            if (*c == '{' || *c == '[') {
+                depth++;
+            } else if (--depth == 0) {
+                return c + 1;
+            }
+            mask &= mask - 1;
+        }
+        p = next;
+    }
+#endif
+    while (p < end) {
+        switch (*p) {
+        case '"':
+            p = json_string_end(p + 1, end);
+            if (p == NULL) {
+                return NULL;
+            }
+            continue;
+        case '{':
+        case '[':
+            depth++;
+            break;
+        case '}':
+        case ']':
+            if (--depth == 0) {
+                return p + 1;
+            }
+            break;
+        }
+        p++;
+    }
+    return NULL;
+}
+
+/* p is at the start of a value; returns just after it, or NULL */
+static const char *json_value_end (const char *p, const char *end) {
+    const char *start = p;
+
+    if (p >= end) {
+        return NULL;
+    }
+    switch (*p) {
+    case '"':
+        return json_string_end(p + 1, end);
+    case '{':
+    case '[':
+        return json_container_end(p, end);
+    }
+    while (p < end && *p != ',' && *p != '}' && *p != ']' && *p != ':' &&
+           *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n') {
+        p++;
+    }
+    return p > start ? p : NULL;
+}
+
+/**
+ * \fn void query_iter_init (query_iter_t *it, const char *v, const char *end)
+ * \brief Start iterating over the members of an object, or the
+ *        elements of an array.
+ * \param it iterator
+ * \param v the opening brace or bracket of the value
+ * \param end end of the text that holds the value
+ * \return none
+ */
+void query_iter_init (query_iter_t *it, const char *v, const char *end) {
+    it->p = v + 1;
+    it->end = end;
+    it->first = 1;
+}
+
+/**
+ * \fn int query_next_member (query_iter_t *it, const char **key, size_t *key_len,
+ *                            const char **value, const char **value_end)
+ * \brief The next member of an object.
+ * \param it iterator
+ * \param key set to the name of the member, without its quotes
+ * \param key_len set to the length of the name
+ * \param value set to where the value starts
+ * \param value_end set to just after the value
+ * \return 1, 0 at the end of the object, or -1 if it is malformed
+ */
+int query_next_member (query_iter_t *it, const char **key, size_t *key_len,
+                       const char **value, const char **value_end) {
+    const char *p = json_ws(it->p, it->end);
+
+    if (p < it->end && *p == '}') {
+        return 0;
+    }
+    if (!it->first) {
+        if (p >= it->end || *p != ',') {
+            return -1;
+        }
+        p = json_ws(p + 1, it->end);
+    }
+    it->first = 0;
+    if (p >= it->end || *p != '"') {
+        return -1;
+    }
+    *key = p + 1;
+    p = json_string_end(p + 1, it->end);
+    if (p == NULL) {
+        return -1;
+    }
+    *key_len = p - 1 - *key;
+    p = json_ws(p, it->end);
+    if (p >= it->end || *p != ':') {
+        return -1;
+    }
+    *value = json_ws(p + 1, it->end);
+    *value_end = json_value_end(*value, it->end);
+    if (*value_end == NULL) {
+        return -1;
+    }
+    it->p = *value_end;
+    return 1;
+}
+
+/**
+ * \fn int query_next_element (query_iter_t *it, const char **value, const char **value_end)
+ * \brief The next element of an array.
+ * \param it iterator
+ * \param value set to where the element starts
+ * \param value_end set to just after the element
+ * \return 1, 0 at the end of the array, or -1 if it is malformed
+ */
+int query_next_element (query_iter_t *it, const char **value, const char **value_end) {
+    const char *p = json_ws(it->p, it->end);
+
+    if (p < it->end && *p == ']') {
+        return 0;
+    }
+    if (!it->first) {
+        if (p >= it->end || *p != ',') {
+            return -1;
+        }
+        p = json_ws(p + 1, it->end);
+    }
+    it->first = 0;
+    *value = p;
+    *value_end = json_value_end(p, it->end);
+    if (*value_end == NULL) {
+        return -1;
+    }
+    it->p = *value_end;
+    return 1;
+}
+
+/*
+ * -------------------------------------------------------
+ * Field lists
+ * -------------------------------------------------------
+ */
+
+static void tmpl_free (tmpl_t *t) {
+    tmpl_t *next;
+
+    for (; t; t = next) {
+        next = t->next;
+        tmpl_free(t->child);
+        free(t->name);
+        free(t);
+    }
+}
+
+/* parses entries up to close, or to the end of the string if close is 0 */
+static tmpl_t *tmpl_parse (const char **s, char close, int *failed) {
+    tmpl_t *head = NULL, **tail = &head, *t;
+    const char *name;
+
+    for (;;) {
+        name = *s;
+        while (**s && !strchr("{}[],", **s)) {
+            (*s)++;
+        }
+        if (*s == name || (t = calloc(1, sizeof(tmpl_t))) == NULL) {
+            goto fail;
+        }
+        *tail = t;
+        tail = &t->next;
+        t->len = *s - name;
+        t->name = malloc(t->len + 1);
+        if (t->name == NULL) {
+            goto fail;
+        }
+        memcpy(t->name, name, t->len);
+        t->name[t->len] = '\0';
+
+        if (**s == '{' || **s == '[') {
+            char end = (**s == '{') ? '}' : ']';
+
+            t->kind = (end == '}') ? tmpl_object : tmpl_list;
+            (*s)++;
+            if (end == ']' && **s == ']') {
+                t->child = NULL;
+            } else {
+                t->child = tmpl_parse(s, end, failed);
+                if (*failed) {
+                    goto fail;
+                }
+            }
+            if (**s != end) {
+                goto fail;
+            }
+            (*s)++;
+        }
+        if (**s == ',') {
+            (*s)++;
+            continue;
+        }
+        if (**s == close) {
+            return head;
+        }
+        goto fail;
+    }
+
+ fail:
+    *failed = 1;
+    tmpl_free(head);
+    return NULL;
+}
+
+/* the entry of list named key, or NULL */
+static const tmpl_t *tmpl_find (const tmpl_t *t, const char *key, size_t len) {
+    for (; t; t = t->next) {
+        if (t->len == len && memcmp(t->name, key, len) == 0) {
+            return t;
+        }
+    }
+    return NULL;
+}
+
+/* copies s without its whitespace */
+static char *strip_spaces (const char *s) {
+    char *copy = malloc(strlen(s) + 1), *d = copy;
+
+    if (copy == NULL) {
+        return NULL;
+    }
+    for (; *s; s++) {
+        if (*s != ' ' && *s != '\t' && *s != '\n' && *s != '\r') {
+            *d++ = *s;
+        }
+    }
+    *d = '\0';
+    return copy;
+}
+
+static tmpl_t *tmpl_new (const char *fields) {
+    char *s = strip_spaces(fields);
+    const char *p = s;
+    int failed = 0;
+    tmpl_t *t = NULL;
+
+    if (s != NULL) {
+        t = tmpl_parse(&p, '\0', &failed);
+        free(s);
+    }
+    return failed ? NULL : t;
+}
+
+/* the index of the top-level key named key, added if it is new */
+static int query_add_key (query_t *q, const char *key, size_t len) {
+    unsigned int i;
+
+    for (i = 0; i < q->num_keys; i++) {
+        if (q->key_len[i] == len && memcmp(q->key[i], key, len) == 0) {
+            return i;
+        }
+    }
+    if (q->num_keys == QUERY_MAX_KEYS) {
+        return -1;
+    }
+    q->key[q->num_keys] = key;
+    q->key_len[q->num_keys] = len;
+    return q->num_keys++;
+}
+
+/* gives the top-level entries of t their keys, and notes them in top */
+static int query_add_keys (query_t *q, tmpl_t *t, const tmpl_t **top) {
+    for (; t; t = t->next) {
+        t->id = query_add_key(q, t->name, t->len);
+        if (t->id < 0) {
+            return -1;
+        }
+        if (top) {
+            top[t->id] = t;
+        }
+    }
+    return 0;
+}
+
+/*
+ * -------------------------------------------------------
+ * Tests
+ * -------------------------------------------------------
+ */
+
+static void pred_free (pred_t *p) {
+    if (p) {
+        pred_free(p->left);
+        pred_free(p->right);
+        tmpl_free(p->path);
+        free(p->arg);
+        free(p);
+    }
+}
+
+/* parses "field op value" */
+static pred_t *pred_test_new (const char *s, size_t len) {
+    size_t i = strcspn(s, "=~<>");
+    pred_t *p;
+    char *path, *end;
+
+    if (i == 0 || i >= len || (p = calloc(1, sizeof(pred_t))) == NULL) {
+        return NULL;
+    }
+    p->type = pred_test;
+    p->op = s[i];
+    p->arg = malloc(len - i);
+    path = malloc(i + 1);
+    if (p->arg == NULL || path == NULL) {
+        free(path);
+        pred_free(p);
+        return NULL;
+    }
+    memcpy(p->arg, s + i + 1, len - i - 1);
+    p->arg[len - i - 1] = '\0';
+    memcpy(path, s, i);
+    path[i] = '\0';
+    p->path = tmpl_new(path);
+    free(path);
+    if (p->path == NULL) {
+        pred_free(p);
+        return NULL;
+    }
+
+    p->star = (strcmp(p->arg, "*") == 0);
+    if (p->arg[0] != '\0') {
+        p->num = strtod(p->arg, &end);
+        p->numeric = (*end == '\0');
+    }
+    return p;
+}
+
+/* precedence of the operators, as sleuth has it: | binds more tightly than , */
+static int pred_prec (char op) {
+    switch (op) {
+    case '|':
+        return 3;
+    case ',':
+        return 2;
+    default:
+        return 1;
+    }
+}
+
+/* combines the top two operands with op */
+static int pred_apply (pred_t **operand, unsigned int *n, char op) {
+    pred_t *p;
+
+    if (*n < 2 || (p = calloc(1, sizeof(pred_t))) == NULL) {
+        return -1;
+    }
+    p->type = (op == '|') ? pred_or : pred_and;
+    p->right = operand[--*n];
+    p->left = operand[--*n];
+    operand[(*n)++] = p;
+    return 0;
+}
+
+#define PRED_MAX_TOKENS 256
+
+static pred_t *pred_new (const char *expr) {
+    pred_t *operand[PRED_MAX_TOKENS];
+    char op[PRED_MAX_TOKENS];
+    unsigned int num_operands = 0, num_ops = 0, i;
+    char *s = strip_spaces(expr);
+    const char *p = s;
+    size_t len;
+
+    if (s == NULL) {
+        return NULL;
+    }
+    while (*p) {
+        if (num_operands == PRED_MAX_TOKENS || num_ops == PRED_MAX_TOKENS) {
+            goto fail;
+        }
+        switch (*p) {
+        case '(':
+            op[num_ops++] = *p++;
+            break;
+        case ')':
+            while (num_ops && op[num_ops - 1] != '(') {
+                if (pred_apply(operand, &num_operands, op[--num_ops]) != 0) {
+                    goto fail;
+                }
+            }
+            if (num_ops == 0) {
+                goto fail;
+            }
+            num_ops--;
+            p++;
+            break;
+        case ',':
+        case '|':
+            while (num_ops && pred_prec(op[num_ops - 1]) >= pred_prec(*p)) {
+                if (pred_apply(operand, &num_operands, op[--num_ops]) != 0) {
+                    goto fail;
+                }
+            }
+            op[num_ops++] = *p++;
+            break;
+        default:
+            len = strcspn(p, "(),|");
+            operand[num_operands] = pred_test_new(p, len);
+            if (operand[num_operands] == NULL) {
+                goto fail;
+            }
+            num_operands++;
+            p += len;
+        }
+    }
+    while (num_ops) {
+        if (op[num_ops - 1] == '(' || pred_apply(operand, &num_operands, op[--num_ops]) != 0) {
+            goto fail;
+        }
+    }
+    if (num_operands != 1) {
+        goto fail;
+    }
+    free(s);
+    return operand[0];
+
+ fail:
+    for (i = 0; i < num_operands; i++) {
+        pred_free(operand[i]);
+    }
+    free(s);
+    return NULL;
+}
+
+static int pred_add_keys (query_t *q, pred_t *p) {
+    if (p == NULL) {
+        return 0;
+    }
+    if (p->type == pred_test) {
+        return query_add_keys(q, p->path, NULL);
+    }
+    if (pred_add_keys(q, p->left) != 0) {
+        return -1;
+    }
+    return pred_add_keys(q, p->right);
+}
+
+/* matches s against a pattern with *, ? and [...] */
+static int query_glob (const char *pat, const char *s) {
+    const char *star_pat = NULL, *star_s = NULL;
+
+    while (*s) {
+        const char *p = pat;
+        int match = 0;
+
+        if (*p == '*') {
+            star_pat = ++pat;
+            star_s = s;
+            continue;
+        }
+        if (*p == '?') {
+            match = 1;
+            p++;
+        } else if (*p == '[' && strchr(p + 2, ']')) {
+            int negate = (p[1] == '!');
+            const char *c = p + 1 + negate;
+
+            /* a ] straight after the [ is part of the set */
+            do {
+                if (c[1] == '-' && c[2] != ']' && c[2] != '\0') {
+                    match |= (*s >= c[0] && *s <= c[2]);
+                    c += 3;
+                } else {
+                    match |= (*s == *c);
+                    c++;
+                }
+            } while (*c && *c != ']');
+            match ^= negate;
+            p = *c ? c + 1 : c;
+        } else if (*p != '\0' && *p == *s) {
+            match = 1;
+            p++;
+        }
+
+        if (match) {
+            pat = p;
+            s++;
+        } else if (star_pat) {
+            pat = star_pat;
+            s = ++star_s;
+        } else {
+            return 0;
+        }
+    }
+    while (*pat == '*') {
+        pat++;
+    }
+    return *pat == '\0';
+}
+
+/* decodes the JSON string that starts just after v, into d */
+static void json_unescape (const char *v, const char *end, char *d) {
+    unsigned int c, i;
+
+    while (v < end) {
+        if (*v != '\\' || v + 1 >= end) {
+            *d++ = *v++;
+            continue;
+        }
+        v++;
+        switch (*v) {
+        case 'b': *d++ = '\b'; break;
+        case 'f': *d++ = '\f'; break;
+        case 'n': *d++ = '\n'; break;
+        case 'r': *d++ = '\r'; break;
+        case 't': *d++ = '\t'; break;
+        case 'u':
+            for (c = 0, i = 1; i <= 4 && v + i < end; i++) {
+                char h = v[i];
+
+                c = c * 16 + (h <= '9' ? h - '0' : (h | 0x20) - 'a' + 10);
+            }
+            if (c < 0x80) {
+                *d++ = (char)c;
+            } else if (c < 0x800) {
+                *d++ = (char)(0xc0 | (c >> 6));
+                *d++ = (char)(0x80 | (c & 0x3f));
+            } else {
+                *d++ = (char)(0xe0 | (c >> 12));
+                *d++ = (char)(0x80 | ((c >> 6) & 0x3f));
+                *d++ = (char)(0x80 | (c & 0x3f));
+            }
+            v += 4;
+            break;
+        default:
+            *d++ = *v;
+        }
+        v++;
+    }
+    *d = '\0';
+}
+
+/* tests a value that is not an object or an array */
+static int pred_compare (const pred_t *p, const char *v, const char *end) {
+    char small[256], *text = small, *num_end;
+    size_t len = end - v;
+    int is_string = (*v == '"'), is_number, rc = 0;
+    double num = 0;
+
+    if (len >= sizeof(small) && (text = malloc(len + 1)) == NULL) {
+        return 0;
+    }
+    if (is_string) {
+        json_unescape(v + 1, end - 1, text);
+    } else {
+        memcpy(text, v, len);
+        text[len] = '\0';
+    }
+    is_number = !is_string && text[0] != '\0' && (num = strtod(text, &num_end), *num_end == '\0');
+
+    switch (p->op) {
+    case '=':
+        if (p->star) {
+            rc = 1;
+        } else if (p->numeric) {
+            rc = is_number && num == p->num;
+        } else {
+            rc = query_glob(p->arg, text);
+        }
+        break;
+    case '~':
+        if (p->star) {
+            rc = 0;
+        } else if (p->numeric) {
+            rc = !(is_number && num == p->num);
+        } else {
+            rc = !query_glob(p->arg, text);
+        }
+        break;
+    case '>':
+    case '<':
+        if (p->numeric && is_number) {
+            rc = (p->op == '>') ? num > p->num : num < p->num;
+        } else if (!p->numeric && is_string) {
+            rc = (p->op == '>') ? strcmp(text, p->arg) > 0 : strcmp(text, p->arg) < 0;
+        }
+        break;
+    }
+
+    if (text != small) {
+        free(text);
+    }
+    return rc;
+}
+
+/*
+ * tests a selected value: a list matches if any of its elements
+ * does, and an object by its first member
+ */
+static int pred_eval (const pred_t *p, const char *v, const char *end) {
+    const char *key, *e, *e_end;
+    size_t key_len;
+    query_iter_t it;
+
+    if (*v == '[') {
+        query_iter_init(&it, v, end);
+        while (query_next_element(&it, &e, &e_end) == 1) {
+            if (pred_eval(p, e, e_end)) {
+                return 1;
+            }
+        }
+        return 0;
+    }
+    if (*v == '{') {
+        query_iter_init(&it, v, end);
+        if (query_next_member(&it, &key, &key_len, &e, &e_end) == 1) {
+            return pred_eval(p, e, e_end);
+        }
+        return 0;
+    }
+    return pred_compare(p, v, end);
+}
+
+/* tests the members of the object at v that the entries t select */
+static int pred_walk_members (const pred_t *p, const tmpl_t *t, const char *v,
+                              const char *end, int *found);
+
+/* tests the value selected by the entry t; sets *found if there is one */
+static int pred_walk (const pred_t *p, const tmpl_t *t, const char *v, const char *end,
+                      int *found) {
+    const char *e, *e_end;
+    query_iter_t it;
+
+    switch (t->kind) {
+    case tmpl_value:
+        *found = 1;
+        return pred_eval(p, v, end);
+    case tmpl_object:
+        return *v == '{' && pred_walk_members(p, t->child, v, end, found);
+    case tmpl_list:
+        if (t->child == NULL) {
+            if (end - v == 2 && v[0] == '[') {
+                return 0;         /* an empty list selects nothing */
+            }
+            *found = 1;
+            return pred_eval(p, v, end);
+        }
+        if (*v != '[') {
+            return 0;
+        }
+        query_iter_init(&it, v, end);
+        while (query_next_element(&it, &e, &e_end) == 1) {
+            if (*e == '{' && pred_walk_members(p, t->child, e, e_end, found)) {
+                return 1;
+            }
+        }
+        return 0;
+    }
+    return 0;
+}
+
+static int pred_walk_members (const pred_t *p, const tmpl_t *t, const char *v,
+                              const char *end, int *found) {
+    const char *key, *e, *e_end;
+    const tmpl_t *c;
+    size_t key_len;
+    query_iter_t it;
+
+    query_iter_init(&it, v, end);
+    while (query_next_member(&it, &key, &key_len, &e, &e_end) == 1) {
+        c = tmpl_find(t, key, key_len);
+        if (c && pred_walk(p, c, e, e_end, found)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int pred_match (const pred_t *p, const record_t *r) {
+    const tmpl_t *t;
+    int found = 0;
+
+    switch (p->type) {
+    case pred_and:
+        return pred_match(p->left, r) && pred_match(p->right, r);
+    case pred_or:
+        return pred_match(p->left, r) || pred_match(p->right, r);
+    case pred_test:
+        for (t = p->path; t; t = t->next) {
+            if (r->value[t->id] && pred_walk(p, t, r->value[t->id], r->value_end[t->id], &found)) {
+                return 1;
+            }
+        }
+        /* a field that is absent only satisfies "field~*" */
+        return !found && p->op == '~' && p->star;
+    }
+    return 0;
+}
+
+/*
+ * -------------------------------------------------------
+ * Selection
+ * -------------------------------------------------------
+ */
+
+static int select_object (const tmpl_t *t, const char *v, const char *end, query_buf_t *out);
+
+/*
+ * appends the member key of value v, as far as the entry t selects
+ * it; returns 1 if something was appended, 0 if not, and -1 if a list
+ * had nothing selected in it, which empties the whole object (as it
+ * does in sleuth)
+ */
+static int select_member (const tmpl_t *t, const char *key, size_t key_len,
+                          const char *v, const char *end, int first, query_buf_t *out) {
+    size_t mark = out->len, elem;
+    const char *e, *e_end;
+    query_iter_t it;
+    int n = 0;
+
+    if (!first) {
+        query_buf_append(out, ",", 1);
+    }
+    query_buf_append(out, "\"", 1);
+    query_buf_append(out, key, key_len);
+    query_buf_append(out, "\":", 2);
+
+    switch (t->kind) {
+    case tmpl_value:
+        query_buf_append(out, v, end - v);
+        return 1;
+
+    case tmpl_object:
+        if (*v == '{' && select_object(t->child, v, end, out)) {
+            return 1;
+        }
+        break;
+
+    case tmpl_list:
+        if (*v != '[' || json_ws(v + 1, end)[0] == ']') {
+            break;
+        }
+        if (t->child == NULL) {
+            query_buf_append(out, v, end - v);
+            return 1;
+        }
+        query_buf_append(out, "[", 1);
+        query_iter_init(&it, v, end);
+        while (query_next_element(&it, &e, &e_end) == 1) {
+            if (*e != '{') {
+                continue;
+            }
+            elem = out->len;
+            if (n) {
+                query_buf_append(out, ",", 1);
+            }
+            if (select_object(t->child, e, e_end, out)) {
+                n++;
+            } else {
+                out->len = elem;
+            }
+        }
+        if (n) {
+            query_buf_append(out, "]", 1);
+            return 1;
+        }
+        out->len = mark;
+        return -1;
+    }
+    out->len = mark;
+    return 0;
+}
+
+/* appends the members of the object at v that the entries t select */
+static int select_object (const tmpl_t *t, const char *v, const char *end, query_buf_t *out) {
+    size_t start = out->len, key_len;
+    const char *key, *e, *e_end;
+    const tmpl_t *c;
+    query_iter_t it;
+    int n = 0, rc;
+
+    query_buf_append(out, "{", 1);
+    query_iter_init(&it, v, end);
+    while (query_next_member(&it, &key, &key_len, &e, &e_end) == 1) {
+        if ((c = tmpl_find(t, key, key_len)) == NULL) {
+            continue;
+        }
+        rc = select_member(c, key, key_len, e, e_end, n == 0, out);
+        if (rc > 0) {
+            n++;
+        } else if (rc < 0) {
+            out->len = start + 1;
+            n = 0;
+        }
+    }
+    if (n == 0) {
+        out->len = start;
+        return 0;
+    }
+    query_buf_append(out, "}", 1);
+    return 1;
+}
+
+/* the same as select_object(), for the top level of a record */
+static int select_record (const query_t *q, const tmpl_t *const *top, const record_t *r,
+                          query_buf_t *out) {
+    size_t start = out->len;
+    unsigned int i, id;
+    int n = 0, rc;
+
+    query_buf_append(out, "{", 1);
+    for (i = 0; i < r->count; i++) {
+        id = r->order[i];
+        if (top[id] == NULL) {
+            continue;
+        }
+        rc = select_member(top[id], q->key[id], q->key_len[id], r->value[id], r->value_end[id],
+                           n == 0, out);
+        if (rc > 0) {
+            n++;
+        } else if (rc < 0) {
+            out->len = start + 1;
+            n = 0;
+        }
+    }
+    if (n == 0) {
+        out->len = start;
+        return 0;
+    }
+    query_buf_append(out, "}", 1);
+    return 1;
+}
+
+/*
+ * -------------------------------------------------------
+ * Queries
+ * -------------------------------------------------------
+ */
+
+/**
+ * \fn query_t *query_new (const char *where, const char *select, const char *groupby, char *err, size_t err_len)
+ * \brief Compile a query.
+ * \param where --where expression, or NULL to match every record
+ * \param select --select field list, or NULL to keep whole records
+ * \param groupby --groupby field list, or NULL
+ * \param err where a message goes if the query is not valid
+ * \param err_len size of \p err
+ * \return the query, or NULL
+ */
+query_t *query_new (const char *where, const char *select, const char *groupby,
+                    char *err, size_t err_len) {
+    query_t *q = calloc(1, sizeof(query_t));
+
+    if (q == NULL) {
+        snprintf(err, err_len, "out of memory");
+        return NULL;
+    }
+    if (where && (q->where = pred_new(where)) == NULL) {
+        snprintf(err, err_len, "could not parse --where \"%s\"", where);
+        goto fail;
+    }
+    if (select && (q->select = tmpl_new(select)) == NULL) {
+        snprintf(err, err_len, "could not parse --select \"%s\"", select);
+        goto fail;
+    }
+    if (groupby && (q->groupby = tmpl_new(groupby)) == NULL) {
+        snprintf(err, err_len, "could not parse --groupby \"%s\"", groupby);
+        goto fail;
+    }
+    q->version = query_add_key(q, "version", strlen("version"));
+    if (query_add_keys(q, q->select, q->select_top) != 0 ||
+        query_add_keys(q, q->groupby, q->group_top) != 0 ||
+        pred_add_keys(q, q->where) != 0) {
+        snprintf(err, err_len, "the query names more than %u fields", QUERY_MAX_KEYS - 1);
+        goto fail;
+    }
+    return q;
+
+ fail:
+    query_free(q);
+    return NULL;
+}
+
+/**
+ * \fn void query_free (query_t *q)
+ * \brief Free a query.
+ * \param q query, or NULL
+ */
+void query_free (query_t *q) {
+    if (q) {
+        pred_free(q->where);
+        tmpl_free(q->select);
+        tmpl_free(q->groupby);
+        free(q);
+    }
+}
+
+/**
+ * \fn int query_grouped (const query_t *q)
+ * \brief Find out whether \p q has a --groupby field list.
+ * \param q query
+ * \return 1 if it does, 0 otherwise
+ */
+int query_grouped (const query_t *q) {
+    return q->groupby != NULL;
+}
+
+/**
+ * \fn int query_record (const query_t *q, const char *rec, size_t len, query_buf_t *out, query_buf_t *group)
+ * \brief Run a query on one record.
+ *
+ * If the record matches, what is selected from it (the whole record,
+ * without a --select) is appended to \p out, without a newline.  The
+ * fields that the --groupby list selects are put in \p group, which
+ * is left empty if the record has none of them.
+ *
+ * \param q query
+ * \param rec a JSON object, on one line
+ * \param len its length
+ * \param out where the output is appended
+ * \param group where the group of the record goes, or NULL
+ * \return a query_result_e
+ */
+int query_record (const query_t *q, const char *rec, size_t len,
+                  query_buf_t *out, query_buf_t *group) {
+    const char *p = json_ws(rec, rec + len), *end = rec + len;
+    const char *key, *value, *value_end;
+    size_t key_len;
+    unsigned int i;
+    query_iter_t it;
+    record_t r;
+    int rc;
+
+    /* note where the members that the query names are */
+    if (p >= end || *p != '{') {
+        return query_malformed;
+    }
+    for (i = 0; i < q->num_keys; i++) {
+        r.value[i] = NULL;
+    }
+    r.count = 0;
+    query_iter_init(&it, p, end);
+    while ((rc = query_next_member(&it, &key, &key_len, &value, &value_end)) == 1) {
+        for (i = 0; i < q->num_keys; i++) {
+            if (q->key_len[i] == key_len && memcmp(q->key[i], key, key_len) == 0) {
+                if (r.value[i] == NULL) {
+                    r.order[r.count++] = i;
+                }
+                r.value[i] = value;
+                r.value_end[i] = value_end;
+                break;
+            }
+        }
+    }
+    if (rc < 0) {
+        return query_malformed;
+    }
+
+    if (r.value[q->version]) {
+        return query_header;
+    }
+    if (q->where && !pred_match(q->where, &r)) {
+        return query_skipped;
+    }
+    if (q->select) {
+        if (!select_record(q, q->select_top, &r, out)) {
+            return query_skipped;
+        }
+    } else {
+        /* the whole record, up to its closing brace */
+        query_buf_append(out, p, json_ws(it.p, end) - p + 1);
+    }
+    if (group) {
+        group->len = 0;
+        if (q->groupby) {
+            select_record(q, q->group_top, &r, group);
+        }
+    }
+    return query_matched;
+}
+
+/*
+ * -------------------------------------------------------
+ * Unit test
+ * -------------------------------------------------------
+ */
+
+/* runs a query on rec and checks the result and the output */
+static int query_test_expect (const char *where, const char *select, const char *groupby,
+                              const char *rec, int result, const char *expected,
+                              const char *expected_group) {
+    query_buf_t out = { NULL, 0, 0 }, group = { NULL, 0, 0 };
+    char err[256];
+    query_t *q;
+    int rc, num_fails = 0;
+
+    q = query_new(where, select, groupby, err, sizeof(err));
+    if (q == NULL) {
+        fprintf(stderr, "query_unit_test: %s\n", err);
+        return 1;
+    }
+    rc = query_record(q, rec, strlen(rec), &out, &group);
+    if (rc != result ||
+        (expected && (out.len != strlen(expected) ||
+                      (out.len && memcmp(out.data, expected, out.len) != 0))) ||
+        (expected_group && (group.len != strlen(expected_group) ||
+                            (group.len && memcmp(group.data, expected_group, group.len) != 0)))) {
+        fprintf(stderr, "query_unit_test: where \"%s\" select \"%s\" returned %d \"%.*s\" \"%.*s\"\n",
+                where ? where : "", select ? select : "", rc,
+                (int)out.len, out.data ? out.data : "", (int)group.len, group.data ? group.data : "");
+        num_fails++;
+    }
+    query_buf_free(&out);
+    query_buf_free(&group);
+    query_free(q);
+    return num_fails;
+}
+
+/**
+ * \fn int query_unit_test (void)
+ * \brief check the parsing of queries, the tests and the selection
+ * \return number of failures
+ */
+int query_unit_test (void) {
+    static const char rec[] =
+        "{\"sa\":\"10.0.0.1\",\"da\":\"192.168.1.1\",\"pr\":6,\"sp\":40000,\"dp\":443,"
+        "\"bytes_out\":100,\"s\":\"a\\\"}{[\\\\\","
+        "\"tls\":{\"scs\":\"c02f\",\"cs\":[\"c02f\",\"c030\"],"
+        "\"c_extensions\":[{\"server_name\":\"example.com\"},{\"ec_point_formats\":\"00\"}]},"
+        "\"packets\":[{\"b\":10,\"dir\":\">\"},{\"b\":20,\"dir\":\"<\"}],\"empty\":[]}";
+    static const char *invalid[] = {
+        "dp", "dp=1,", "(dp=1", "dp=1)", "a{b=1", "=1", "dp=1||sp=2"
+    };
+    char long_rec[256], nested[64], expected[32];
+    unsigned int i;
+    int num_fails = 0;
+    query_t *q;
+    char err[256];
+
+    /* selection */
+    num_fails += query_test_expect(NULL, "dp, da", NULL, rec, query_matched,
+                                   "{\"da\":\"192.168.1.1\",\"dp\":443}", NULL);
+    num_fails += query_test_expect(NULL, "tls{scs}", NULL, rec, query_matched,
+                                   "{\"tls\":{\"scs\":\"c02f\"}}", NULL);
+    num_fails += query_test_expect(NULL, "packets[b]", NULL, rec, query_matched,
+                                   "{\"packets\":[{\"b\":10},{\"b\":20}]}", NULL);
+    num_fails += query_test_expect(NULL, "packets[]", NULL, rec, query_matched,
+                                   "{\"packets\":[{\"b\":10,\"dir\":\">\"},{\"b\":20,\"dir\":\"<\"}]}", NULL);
+    num_fails += query_test_expect(NULL, "tls{c_extensions[server_name]}", NULL, rec, query_matched,
+                                   "{\"tls\":{\"c_extensions\":[{\"server_name\":\"example.com\"}]}}", NULL);
+    num_fails += query_test_expect(NULL, "nothere,empty[],tls{nothere}", NULL, rec, query_skipped, "", NULL);
+    num_fails += query_test_expect(NULL, "s", NULL, rec, query_matched, "{\"s\":\"a\\\"}{[\\\\\"}", NULL);
+    num_fails += query_test_expect(NULL, NULL, NULL, rec, query_matched, rec, NULL);
+
+    /* tests */
+    num_fails += query_test_expect("dp=443", "dp", NULL, rec, query_matched, "{\"dp\":443}", NULL);
+    num_fails += query_test_expect("dp=80", NULL, NULL, rec, query_skipped, "", NULL);
+    num_fails += query_test_expect("dp>400,sp<50000", NULL, NULL, rec, query_matched, NULL, NULL);
+    num_fails += query_test_expect("dp=80|sp=40000", NULL, NULL, rec, query_matched, NULL, NULL);
+    num_fails += query_test_expect("da=192.168.*", NULL, NULL, rec, query_matched, NULL, NULL);
+    num_fails += query_test_expect("da=192.168.1.[0-9]", NULL, NULL, rec, query_matched, NULL, NULL);
+    num_fails += query_test_expect("da~192.*", NULL, NULL, rec, query_skipped, NULL, NULL);
+    num_fails += query_test_expect("da>192.0.0", NULL, NULL, rec, query_matched, NULL, NULL);
+    num_fails += query_test_expect("tls{cs}=c030", NULL, NULL, rec, query_matched, NULL, NULL);
+    num_fails += query_test_expect("tls{c_extensions[server_name]}=*.com", NULL, NULL, rec,
+                                   query_matched, NULL, NULL);
+    num_fails += query_test_expect("s=a\"}{[\\", NULL, NULL, rec, query_matched, NULL, NULL);
+    num_fails += query_test_expect("x~*", NULL, NULL, rec, query_matched, NULL, NULL);
+    num_fails += query_test_expect("x=*", NULL, NULL, rec, query_skipped, NULL, NULL);
+    num_fails += query_test_expect("x~1", NULL, NULL, rec, query_skipped, NULL, NULL);
+    num_fails += query_test_expect("dp=80,(sp=1|pr=6)", NULL, NULL, rec, query_skipped, NULL, NULL);
+    /* | binds more tightly than , so this is dp=80 and (sp=1 or pr=6) */
+    num_fails += query_test_expect("dp=80,sp=1|pr=6", NULL, NULL, rec, query_skipped, NULL, NULL);
+    num_fails += query_test_expect("(dp=80,sp=1)|pr=6", NULL, NULL, rec, query_matched, NULL, NULL);
+
+    /* groups, and other kinds of record */
+    num_fails += query_test_expect(NULL, "sa", "dp,pr", rec, query_matched,
+                                   "{\"sa\":\"10.0.0.1\"}", "{\"pr\":6,\"dp\":443}");
+    num_fails += query_test_expect(NULL, "sa", "nothere", rec, query_matched, NULL, "");
+    num_fails += query_test_expect(NULL, "sa", NULL, "{\"version\":\"test\",\"sa\":1}",
+                                   query_header, "", NULL);
+    num_fails += query_test_expect(NULL, NULL, NULL, " {\"sa\":\"1", query_malformed, "", NULL);
+    num_fails += query_test_expect(NULL, NULL, NULL, "not json", query_malformed, "", NULL);
+    num_fails += query_test_expect(NULL, NULL, NULL, "{\"a\":1 \"b\":2}", query_malformed, "", NULL);
+
+    /* values long enough to be skipped sixteen bytes at a time */
+    for (i = 0; i < 40; i++) {
+        memset(nested, '[', i % 20);
+        memset(nested + i % 20, ']', i % 20);
+        nested[2 * (i % 20)] = '\0';
+        snprintf(long_rec, sizeof(long_rec),
+                 "{\"s\":\"%.*s\\\\\\\"}]\",\"o\":{\"a\":[%s\"}\",{}]},\"dp\":%u}",
+                 (int)i, "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa", nested, i);
+        snprintf(expected, sizeof(expected), "{\"dp\":%u}", i);
+        num_fails += query_test_expect(NULL, "dp", NULL, long_rec, query_matched, expected, NULL);
+    }
+
+    for (i = 0; i < sizeof(invalid)/sizeof(invalid[0]); i++) {
+        q = query_new(invalid[i], NULL, NULL, err, sizeof(err));
+        if (q != NULL) {
+            fprintf(stderr, "query_unit_test: \"%s\" was accepted\n", invalid[i]);
+            query_free(q);
+            num_fails++;
+        }
+    }
+    if ((q = query_new(NULL, "a{b", NULL, err, sizeof(err))) != NULL ||
+        (q = query_new(NULL, "a,,b", NULL, err, sizeof(err))) != NULL) {
+        fprintf(stderr, "query_unit_test: an invalid field list was accepted\n");
+        query_free(q);
+        num_fails++;
+    }
+
+    return num_fails;
+}
@@ -34,51 +34,43 @@
  *
  */
 
-/** 
+
+/**
  * \file radix_trie.c
  *
- * \brief a radix trie implementation for efficient matching of addresses
- * against one or more subnets
- *
- ** A radix_trie contains two types of nodes: internal and leaf.  An
- * internal node contains a 256-entry table that indicates how
- * branching is done based on the digit of the current level of the
- * tree.  That is, table[key[i]] is the pointer to the next node where
- * i is the level and key[i] is the ith digit of the key.
- * 
- ** A leaf (terminal) node contains a flags value, which is a bitmask
- * that indicates the set of labels associated with the key value.
- *
- ** Example 1: start with an empty trie, and set flag(0xcafebabe) = 1;
- ** then the following nodes will be created:
- *
- **    level 0: table[0xca] = next node
- *
- **    level 1: table[0xfe] = next node
- *
- **    level 2: table[0xba] = next node
- *
- **    level 3: table[0xbe] = next node
- *
- **    level 4: leaf.value = 1
- *
- **  Example 2: after Example 1, set flag(0xcafe) = 2; then the
- ** following nodes will be in the tree:
+ * \brief compiled lookup tables for efficient matching of addresses
+ * against one or more labeled subnets
  *
- **    level 0: table[0xca] = next node; all other table entries NULL
+ ** Subnets are first collected in a flat list, each with the flags of
+ * its labels.  radix_trie_compile() then builds read-only lookup
+ * tables from that list, so that the cost of building them is paid
+ * once at configuration time, rather than while flows are printed.
+ * A lookup returns the bitwise-OR of the flags of every subnet that
+ * contains the address.
  *
- **    level 1: table[0xfe] = next node; all other table entries NULL
+ ** IPv4 subnets are compiled into a DIR-24-8 table.  The first table
+ * (tbl24) has one entry for every /24; an entry holds the flags for
+ * that /24, unless some subnet longer than /24 falls inside it.  In
+ * that case the entry holds the index of a 256-entry group in the
+ * second table (tbl8), which holds the flags of each address in the
+ * /24.  A lookup is one or two memory accesses.
  *
- **    level 2: table[0xba] = next node; all other entries leaf.value = 2
+ ** IPv6 subnets are compiled into a poptrie: a multibit trie that
+ * branches on six address bits at each level.  Each node has a 64-bit
+ * vector marking which branches have child nodes, and a second one
+ * marking where a run of equal leaf values starts.  Children and
+ * leaves are stored contiguously, so a population count of the
+ * vectors locates the next node or the leaf.
  *
- **    level 3: table[0xbe] = next node
- *
- **    level 4: leaf.value = 1 & 2
- *    
+ ** Example: add 202.254.0.0/16 with flag 1 and 202.254.186.190/32
+ * with flag 2.  Then tbl24 entries 0xcafe00 through 0xcafeff hold 1,
+ * except for 0xcafeba, which refers to a tbl8 group whose entries
+ * hold 1, except for entry 0xbe, which holds 1|2.
  */
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <ctype.h>
 #include "radix_trie.h"
 #include "addr.h"
@@ -100,31 +92,59 @@ extern FILE *info;
 #define MAX_LABEL_LEN 256
 #define TMP_BUFF_256_LEN 256
 
-/** reutrn maximum between two values */
-#define MAX(x,y) (x > y ? x : y)
+/** number of entries in tbl24 */
+#define RT_TBL24_SIZE (1 << 24)
+
+/** a tbl24 entry with this bit set holds the index of a tbl8 group */
+#define RT_TBL8_GROUP 0x80000000u
+
+/** number of address bits examined at each level of the IPv6 trie */
+#define RT_STRIDE6 6
 
-/** values for node types */
-enum radix_trie_node_type {
-    reservd = 0,
-    internal = 1,
-    leaf = 2
+/** IPv4 subnet, as added to the trie */
+struct radix_trie_prefix4 {
+    uint32_t addr;              /* masked, in host byte order */
+    unsigned int len;
+    attr_flags flags;
 };
 
-/** node definition for radix trie */
-struct radix_trie_node {
-    enum radix_trie_node_type type;    /** internal */
-    struct radix_trie_node *table[256];
+/** IPv6 subnet, as added to the trie */
+struct radix_trie_prefix6 {
+    unsigned char addr[16];     /* masked */
+    unsigned int len;
+    attr_flags flags;
 };
 
-/** leaf node definition for radix trie */
-struct radix_trie_leaf {
-    enum radix_trie_node_type type;   /** leaf */
-    attr_flags value;
+/** IPv6 trie node */
+struct radix_trie_node6 {
+    uint64_t vector;            /* bit i set: branch i has a child node */
+    uint64_t leafvec;           /* bit i set: a run of equal leaves starts at branch i */
+    uint32_t base0;             /* index of the first leaf of this node */
+    uint32_t base1;             /* index of the first child of this node */
 };
 
 /** main radix trie structure definition */
 struct radix_trie {
-    struct radix_trie_node *root;
+    struct radix_trie_prefix4 *prefix4;
+    unsigned int num_prefix4;
+    unsigned int max_prefix4;
+    struct radix_trie_prefix6 *prefix6;
+    unsigned int num_prefix6;
+    unsigned int max_prefix6;
+
+    /* compiled tables; valid only while compiled is set */
+    unsigned int compiled;
+    uint32_t *tbl24;
+    attr_flags *tbl8;
+    unsigned int num_tbl8;      /* in groups of 256 entries */
+    unsigned int max_tbl8;
+    struct radix_trie_node6 *node6;
+    unsigned int num_node6;
+    unsigned int max_node6;
+    attr_flags *leaf6;
+    unsigned int num_leaf6;
+    unsigned int max_leaf6;
+
     unsigned int num_flags;
     char *flag[MAX_NUM_FLAGS];
 };
@@ -139,7 +159,7 @@ static struct in_addr hex2addr (unsigned int x) {
 /** mutex used to ensure the radix_trie isn't being accessed by another thread */
 pthread_mutex_t radix_trie_lock = PTHREAD_MUTEX_INITIALIZER;
 
-/* 
+/*
  * radix trie memory allocation function
  * returns pointer to memory allocated
  * returns NULL on failure
@@ -153,7 +173,7 @@ static __inline void *rt_malloc (size_t s) {
     return (p);
 }
 
-/* 
+/*
  * radix trie memory free function
  *     sets pointer p to NULL after free
  */
@@ -165,6 +185,86 @@ static __inline void rt_free (void *p) {
     p = NULL;
 }
 
+/*
+ * grows the array *p of elements of the given size so that it holds
+ * at least need elements
+ * returns ok
+ * returns failure
+ */
+static joy_status_e rt_grow (void **p, unsigned int *max, unsigned int need, size_t size) {
+    unsigned int n = *max ? *max : 64;
+    void *tmp;
+
+    if (need <= *max) {
+        return ok;
+    }
+    while (n < need) {
+        n *= 2;
+    }
+    tmp = realloc(*p, (size_t)n * size);
+    if (tmp == NULL) {
+        return failure;
+    }
+    *p = tmp;
+    *max = n;
+    return ok;
+}
+
+/*
+ * counts the bits that are set in x
+ */
+static __inline unsigned int rt_popcount64 (uint64_t x) {
+#if defined(__GNUC__)
+    return __builtin_popcountll(x);
+#else
+    x = x - ((x >> 1) & 0x5555555555555555ULL);
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+    return (unsigned int)((x * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+/** number of bits set in the vector v at positions 0 through i */
+#define RT_RANK(v, i) rt_popcount64((v) & ((2ULL << (i)) - 1))
+
+/** netmask of length len, in host byte order */
+static __inline uint32_t rt_mask4 (unsigned int len) {
+    return len ? 0xffffffffu << (32 - len) : 0;
+}
+
+/*
+ * returns the RT_STRIDE6 bits of the IPv6 address a that start at
+ * bit offset off; bits past the end of the address read as zero
+ */
+static __inline unsigned int rt_addr6_bits (const unsigned char *a, unsigned int off) {
+    unsigned int i = off >> 3;
+    unsigned int w = a[i] << 8;
+
+    if (i < 15) {
+        w |= a[i+1];
+    }
+    return (w >> (16 - RT_STRIDE6 - (off & 7))) & ((1 << RT_STRIDE6) - 1);
+}
+
+/*
+ * returns 1 if the IPv6 address a is in the subnet p, 0 otherwise
+ */
+static int rt_addr6_in_prefix (const unsigned char *a, const struct radix_trie_prefix6 *p) {
+    unsigned int bytes = p->len / 8;
+    unsigned int bits = p->len % 8;
+
+    if (memcmp(a, p->addr, bytes) != 0) {
+        return 0;
+    }
+    if (bits) {
+        unsigned char mask = 0xff << (8 - bits);
+        if ((a[bytes] & mask) != p->addr[bytes]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
 /**
  * \fn struct radix_trie *radix_trie_alloc()
  * \params none
@@ -175,108 +275,166 @@ struct radix_trie *radix_trie_alloc () {
 }
 
 /*
- * main entry for allocating a new radix trie node and initializing
- * returns radix_trie_node pointer
- * returns NULL on failure
+ * frees the compiled tables of a trie, leaving its subnets in place
  */
-static struct radix_trie_node *radix_trie_node_init () {
-    struct radix_trie_node *rt_node = NULL;
-  
-    rt_node = rt_malloc(sizeof(struct radix_trie_node));
-    if (rt_node != NULL) {
-        rt_node->type = internal;
+static void radix_trie_tables_free (struct radix_trie *rt) {
+    rt->compiled = 0;
+    rt_free(rt->tbl24);
+    rt->tbl24 = NULL;
+    rt_free(rt->tbl8);
+    rt->tbl8 = NULL;
+    rt->num_tbl8 = rt->max_tbl8 = 0;
+    rt_free(rt->node6);
+    rt->node6 = NULL;
+    rt->num_node6 = rt->max_node6 = 0;
+    rt_free(rt->leaf6);
+    rt->leaf6 = NULL;
+    rt->num_leaf6 = rt->max_leaf6 = 0;
+}
 
-        /* initialize table entries to NULL */
-        memset(rt_node->table, 0, sizeof(rt_node->table));
+/*
+ * looks up an IPv4 address (host byte order) in the compiled tables
+ */
+static __inline attr_flags radix_trie_lookup4 (const struct radix_trie *rt, uint32_t x) {
+    uint32_t e = rt->tbl24[x >> 8];
+
+    if (e & RT_TBL8_GROUP) {
+        return rt->tbl8[((size_t)(e & ~RT_TBL8_GROUP) << 8) | (x & 0xff)];
     }
+    return e;
+}
 
-    return rt_node;  /* could be NULL */
+/*
+ * looks up an IPv4 address (host byte order) in the list of subnets;
+ * used before the trie is compiled
+ */
+static attr_flags radix_trie_scan4 (const struct radix_trie *rt, uint32_t x) {
+    attr_flags flags = 0;
+    unsigned int i;
+
+    for (i=0; i < rt->num_prefix4; i++) {
+        if ((x & rt_mask4(rt->prefix4[i].len)) == rt->prefix4[i].addr) {
+            flags |= rt->prefix4[i].flags;
+        }
+    }
+    return flags;
 }
 
 /*
- * main entry for allocating a new radix trie leaf node and initializing
- * returns radix_trie_leaf pointer
- * returns NULL on failure
+ * looks up an IPv6 address in the compiled trie
  */
-static struct radix_trie_leaf *radix_trie_leaf_init (attr_flags value) {
-    struct radix_trie_leaf *rt_leaf = NULL;
-  
-    rt_leaf = rt_malloc(sizeof(struct radix_trie_leaf));
-    if (rt_leaf != NULL) {
-        rt_leaf->type = leaf;
-        rt_leaf->value = value;
+static attr_flags radix_trie_lookup6 (const struct radix_trie *rt, const unsigned char *a) {
+    const struct radix_trie_node6 *n = rt->node6;
+    unsigned int off = 0;
+    unsigned int b;
+
+    for (;;) {
+        b = rt_addr6_bits(a, off);
+        if (!((n->vector >> b) & 1)) {
+            return rt->leaf6[n->base0 + RT_RANK(n->leafvec, b) - 1];
+        }
+        n = rt->node6 + n->base1 + RT_RANK(n->vector, b) - 1;
+        off += RT_STRIDE6;
     }
+}
+
+/*
+ * looks up an IPv6 address in the list of subnets; used before the
+ * trie is compiled
+ */
+static attr_flags radix_trie_scan6 (const struct radix_trie *rt, const unsigned char *a) {
+    attr_flags flags = 0;
+    unsigned int i;
 
-    return rt_leaf;   /* could be NULL */
+    for (i=0; i < rt->num_prefix6; i++) {
+        if (rt_addr6_in_prefix(a, &rt->prefix6[i])) {
+            flags |= rt->prefix6[i].flags;
+        }
+    }
+    return flags;
 }
 
 /**
  * \fn attr_flags radix_trie_lookup_addr (struct radix_trie *trie, struct in_addr addr)
  * \param trie radix_trie pointer
  * \param addr address to lookup in the radix_trie
- * \return flags of the node found
+ * \return flags of all subnets containing the address
  */
 attr_flags radix_trie_lookup_addr (struct radix_trie *trie, struct in_addr addr) {
-    unsigned int i = 0;
-    attr_flags rc_flags = 0;
-    unsigned char *a = (void *) &addr.s_addr;
-    struct radix_trie_node *rt = trie->root;
-  
+    uint32_t x = ntohl(addr.s_addr);
+
     /* sanity check */
-    if (rt == NULL) {
+    if (trie == NULL) {
         debug_printf("%s:radix_trie is NULL\n", __FUNCTION__);
-        return failure;
+        return 0;
     }
 
-    for (i=0; i<4; i++) {
-        debug_printf("%s:a[%d]: %x\n", __FUNCTION__, i, a[i]); 
-        rt = rt->table[a[i]];
-        if (rt == NULL) {
-            return 0;  /* indicate that no match occured */
-        } 
-        if (rt->type == leaf) {
-            break;
+    if (!trie->compiled) {
+        return radix_trie_scan4(trie, x);
+    }
+    if (trie->tbl24 == NULL) {
+        return 0;  /* no IPv4 subnets */
+    }
+    return radix_trie_lookup4(trie, x);
+}
+
+/**
+ * \fn void radix_trie_lookup_addrs (const struct radix_trie *trie, const struct in_addr *addr, attr_flags *flags, unsigned int num)
+ * \brief looks up several addresses at once
+ *
+ * The tbl24 entries of all of the addresses are loaded before any of
+ * the tbl8 groups, so that the cache misses of the first accesses
+ * overlap rather than follow one another.
+ *
+ * \param trie radix_trie pointer
+ * \param addr array of addresses to lookup
+ * \param flags array receiving the flags of each address
+ * \param num number of addresses
+ * \return none
+ */
+void radix_trie_lookup_addrs (const struct radix_trie *trie, const struct in_addr *addr,
+                              attr_flags *flags, unsigned int num) {
+    unsigned int i;
+
+    if (trie == NULL || !trie->compiled || trie->tbl24 == NULL) {
+        for (i=0; i < num; i++) {
+            flags[i] = trie ? radix_trie_scan4(trie, ntohl(addr[i].s_addr)) : 0;
         }
-    }  
-    if (rt->type == leaf) {
-        struct radix_trie_leaf *leaf = (struct radix_trie_leaf *)rt;
-        debug_printf("%s:found leaf (value: %x)\n", __FUNCTION__, leaf->value);
-        rc_flags = leaf->value;
-        return rc_flags; /* indicate success by returning flags  */
+        return;
     }
 
-    return 0;  /* indicate that no match occured */
+    for (i=0; i < num; i++) {
+        flags[i] = trie->tbl24[ntohl(addr[i].s_addr) >> 8];
+    }
+    for (i=0; i < num; i++) {
+        if (flags[i] & RT_TBL8_GROUP) {
+            flags[i] = trie->tbl8[((size_t)(flags[i] & ~RT_TBL8_GROUP) << 8)
+                                  | (ntohl(addr[i].s_addr) & 0xff)];
+        }
+    }
 }
 
-/*
- * fucntion add flags to all leaf nodes 
+/**
+ * \fn attr_flags radix_trie_lookup_addr6 (struct radix_trie *trie, const struct in6_addr *addr)
+ * \param trie radix_trie pointer
+ * \param addr IPv6 address to lookup in the radix_trie
+ * \return flags of all subnets containing the address
  */
-static void radix_trie_node_add_flag_to_all_leaves (const struct radix_trie_node *rt, attr_flags flags) {
-    unsigned int i = 0;
-  
+attr_flags radix_trie_lookup_addr6 (struct radix_trie *trie, const struct in6_addr *addr) {
+    const unsigned char *a = (const unsigned char *)addr->s6_addr;
+
     /* sanity check */
-    if (rt == NULL) {
-        debug_printf("%s:radix trie node is NULL\n", __FUNCTION__);
-        return;
+    if (trie == NULL) {
+        return 0;
     }
 
-    switch(rt->type) {
-        case leaf:
-            ((struct radix_trie_leaf *)rt)->value |= flags;
-            debug_printf("%s:adding flag %x to leaf (current value: %x)\n", __FUNCTION__,
-                        flags, ((struct radix_trie_leaf *)rt)->value);
-            break;
-        case internal:
-            /* look through the table of this node */
-            for (i=0; i<256; i++) {    
-                debug_printf("%s:adding flags %x to leaves at %x\n", __FUNCTION__, flags, i);
-                radix_trie_node_add_flag_to_all_leaves(rt->table[i], flags);
-            }
-            break;
-        default:
-            break;
+    if (!trie->compiled) {
+        return radix_trie_scan6(trie, a);
+    }
+    if (trie->node6 == NULL) {
+        return 0;  /* no IPv6 subnets */
     }
-    return;
+    return radix_trie_lookup6(trie, a);
 }
 
 /**
@@ -284,99 +442,325 @@ static void radix_trie_node_add_flag_to_all_leaves (const struct radix_trie_node
  * \param trie radix_trie to use for the addition
  * \param addr address to add into the trie
  * \param netmasklen network mask length of the address to add
- * \param flags flags that are to be assigned to node when added to the trie
+ * \param flags flags that are to be assigned to the subnet
  * \return success
  * \return failure
  */
 joy_status_e radix_trie_add_subnet (struct radix_trie *trie, struct in_addr addr, unsigned int netmasklen, attr_flags flags) {
-    unsigned int i, x, bits, bytes, max, num_internal_nodes = 0;
-    unsigned char *a = (void *) &addr.s_addr;
-    struct radix_trie_node *tmp = NULL;
-    struct radix_trie_node *rt = NULL;
+    struct radix_trie_prefix4 *p;
 
     /* sanity checks */
     if (!trie || (netmasklen > 32)) {
         debug_printf("%s:sanity checks failed\n", __FUNCTION__);
         return failure;   /* no null pointers or giant netmasks allowed */
     }
-    if (!flags) {
-        debug_printf("%s:flags present are 0, flags must be nonzero\n", __FUNCTION__);
-        return failure;   /* flags must be nonzero; 0 value indicates the absence of flags */
+    if (!flags || (flags & RT_TBL8_GROUP)) {
+        debug_printf("%s:flags present are %x, flags must be nonzero\n", __FUNCTION__, flags);
+        return failure;   /* 0 value indicates the absence of flags; the top bit is reserved */
     }
-    rt = trie->root;
-  
+
     /* get mutex for radix trie operations */
     pthread_mutex_lock(&radix_trie_lock);
 
-    bytes = netmasklen / 8;
-    bits = netmasklen - (bytes * 8);
-    //num_internal_nodes = MAX(bytes-1,1);
-    num_internal_nodes = (netmasklen-1)/8;
-    max = 1 << (8-bits);
-
-    debug_printf("%s:add\tflags: %x\tnetmask: %u\tbytes: %u\tbits: %u\tloops: %u\tmax: %u\n",
-                __FUNCTION__, flags, netmasklen, bytes, bits, num_internal_nodes, max);
-
-    /* loop over bytes, creating internal nodes where needed */
-    for (i=0; i < num_internal_nodes; i++) {
-        debug_printf("%s:I: a[%d]: %x\n", __FUNCTION__, i, a[i]); 
-        tmp = rt->table[a[i]];
-        if (tmp == NULL) {
-            tmp = radix_trie_node_init();
-            if (tmp == NULL) {
-                        return failure;
-            }
-            rt->table[a[i]] = tmp;
+    if (rt_grow((void **)&trie->prefix4, &trie->max_prefix4, trie->num_prefix4 + 1,
+                sizeof(struct radix_trie_prefix4)) != ok) {
+        pthread_mutex_unlock(&radix_trie_lock);
+        return failure;
+    }
+    p = &trie->prefix4[trie->num_prefix4++];
+    p->len = netmasklen;
+    p->addr = ntohl(addr.s_addr) & rt_mask4(netmasklen);
+    p->flags = flags;
+
+    /* the compiled tables no longer reflect the subnets */
+    trie->compiled = 0;
+
+    pthread_mutex_unlock(&radix_trie_lock);
+    return ok;
+}
+
+/**
+ * \fn joy_status_e radix_trie_add_subnet6 (struct radix_trie *trie, const struct in6_addr *addr, unsigned int netmasklen, attr_flags flags)
+ * \param trie radix_trie to use for the addition
+ * \param addr IPv6 address to add into the trie
+ * \param netmasklen network mask length of the address to add
+ * \param flags flags that are to be assigned to the subnet
+ * \return success
+ * \return failure
+ */
+joy_status_e radix_trie_add_subnet6 (struct radix_trie *trie, const struct in6_addr *addr, unsigned int netmasklen, attr_flags flags) {
+    struct radix_trie_prefix6 *p;
+    unsigned int i;
+
+    /* sanity checks */
+    if (!trie || !addr || (netmasklen > 128)) {
+        debug_printf("%s:sanity checks failed\n", __FUNCTION__);
+        return failure;
+    }
+    if (!flags || (flags & RT_TBL8_GROUP)) {
+        debug_printf("%s:flags present are %x, flags must be nonzero\n", __FUNCTION__, flags);
+        return failure;
+    }
+
+    pthread_mutex_lock(&radix_trie_lock);
+
+    if (rt_grow((void **)&trie->prefix6, &trie->max_prefix6, trie->num_prefix6 + 1,
+                sizeof(struct radix_trie_prefix6)) != ok) {
+        pthread_mutex_unlock(&radix_trie_lock);
+        return failure;
+    }
+    p = &trie->prefix6[trie->num_prefix6++];
+    p->len = netmasklen;
+    p->flags = flags;
+    memcpy(p->addr, addr->s6_addr, sizeof(p->addr));
+    for (i=0; i < 16; i++) {
+        if (i * 8 >= netmasklen) {
+            p->addr[i] = 0;
+        } else if (i * 8 + 8 > netmasklen) {
+            p->addr[i] &= 0xff << (8 - (netmasklen - i * 8));
         }
-        if (tmp->type == leaf) {
-            debug_printf("%s:warning: found a leaf during creation\n", __FUNCTION__);
-            break;
+    }
+
+    trie->compiled = 0;
+
+    pthread_mutex_unlock(&radix_trie_lock);
+    return ok;
+}
+
+/*
+ * builds the DIR-24-8 tables from the IPv4 subnets
+ * returns ok
+ * returns failure
+ */
+static joy_status_e radix_trie_compile4 (struct radix_trie *rt) {
+    unsigned int i, k;
+    uint32_t j, first, last;
+    attr_flags *group;
+
+    if (rt->num_prefix4 == 0) {
+        return ok;
+    }
+
+    rt->tbl24 = rt_malloc(RT_TBL24_SIZE * sizeof(uint32_t));
+    if (rt->tbl24 == NULL) {
+        return failure;
+    }
+
+    /*
+     * since the flags of overlapping subnets are combined with OR,
+     * the subnets can be applied in any order, as long as a new tbl8
+     * group starts out with the flags of its /24
+     */
+    for (i=0; i < rt->num_prefix4; i++) {
+        const struct radix_trie_prefix4 *p = &rt->prefix4[i];
+
+        if (p->len <= 24) {
+            first = p->addr >> 8;
+            last = first + (1u << (24 - p->len)) - 1;
+            for (j = first; j <= last; j++) {
+                if (rt->tbl24[j] & RT_TBL8_GROUP) {
+                    group = rt->tbl8 + ((size_t)(rt->tbl24[j] & ~RT_TBL8_GROUP) << 8);
+                    for (k=0; k < 256; k++) {
+                        group[k] |= p->flags;
+                    }
+                } else {
+                    rt->tbl24[j] |= p->flags;
+                }
+            }
+        } else {
+            j = p->addr >> 8;
+            if (!(rt->tbl24[j] & RT_TBL8_GROUP)) {
+                if (rt_grow((void **)&rt->tbl8, &rt->max_tbl8, rt->num_tbl8 + 1,
+                            256 * sizeof(attr_flags)) != ok) {
+                    return failure;
+                }
+                group = rt->tbl8 + ((size_t)rt->num_tbl8 << 8);
+                for (k=0; k < 256; k++) {
+                    group[k] = rt->tbl24[j];
+                }
+                rt->tbl24[j] = RT_TBL8_GROUP | rt->num_tbl8++;
+            }
+            group = rt->tbl8 + ((size_t)(rt->tbl24[j] & ~RT_TBL8_GROUP) << 8);
+            first = p->addr & 0xff;
+            last = first + (1u << (32 - p->len)) - 1;
+            for (k = first; k <= last; k++) {
+                group[k] |= p->flags;
+            }
         }
-        rt = tmp;
-    }  
+    }
+
+    return ok;
+}
+
+/*
+ * orders IPv6 subnets by address, so that the subnets below any node
+ * of the trie are contiguous
+ */
+static int rt_prefix6_cmp (const void *a, const void *b) {
+    const struct radix_trie_prefix6 *x = a, *y = b;
+    int c = memcmp(x->addr, y->addr, sizeof(x->addr));
+
+    if (c) {
+        return c;
+    }
+    return (x->len > y->len) - (x->len < y->len);
+}
+
+/*
+ * fills in the IPv6 trie node at index node from the sorted subnets
+ * start through end-1, all of which agree with the node on their
+ * first off bits; inherited holds the flags of the shorter subnets
+ * that contain the node
+ * returns ok
+ * returns failure
+ */
+static joy_status_e radix_trie_compile6_node (struct radix_trie *rt, uint32_t node,
+        unsigned int start, unsigned int end, unsigned int off, attr_flags inherited) {
+    attr_flags leaf[1 << RT_STRIDE6];
+    unsigned int first[1 << RT_STRIDE6], last[1 << RT_STRIDE6];
+    uint64_t vector = 0, leafvec = 0;
+    uint32_t base0, base1;
+    unsigned int i, b, k, n, have_leaf = 0;
+    attr_flags prev = 0;
 
-    /* create leaf node(s) */
-    if (bits == 0) {
-        debug_printf("%s:L: a[%d]: %x\n", __FUNCTION__, i, a[i]); 
+    for (b=0; b < (1 << RT_STRIDE6); b++) {
+        leaf[b] = inherited;
+    }
+
+    /*
+     * subnets that end within this level set a range of leaves;
+     * longer ones need a child node, which covers a contiguous run of
+     * the sorted subnets
+     */
+    for (i=start; i < end; i++) {
+        const struct radix_trie_prefix6 *p = &rt->prefix6[i];
 
-        if (rt->table[a[i]] != NULL) {
-            radix_trie_node_add_flag_to_all_leaves(rt->table[a[i]], flags);
+        if (p->len <= off) {
+            continue;  /* included in inherited */
+        }
+        b = rt_addr6_bits(p->addr, off);
+        if (p->len <= off + RT_STRIDE6) {
+            n = 1 << (off + RT_STRIDE6 - p->len);
+            for (k=b; k < b + n; k++) {
+                leaf[k] |= p->flags;
+            }
         } else {
-            tmp = (struct radix_trie_node *)radix_trie_leaf_init(flags);
-            if (tmp == NULL) {
-                              return failure;
+            if (!((vector >> b) & 1)) {
+                vector |= 1ULL << b;
+                first[b] = i;
             }
-            rt->table[a[i]] = tmp;
+            last[b] = i + 1;
         }
-    } else {
-        unsigned char mask = 0xff << (8-bits);
-        unsigned int prefix = a[i] & mask;
-
-        /* loop over all bytes with common prefix */
-        for (x=0; x<max; x++) {
-            debug_printf("%s:L: a[%u]: %x\n", __FUNCTION__, i, prefix|x); 
-
-            /* if table entry exists, then add flag into all leaves */
-            if (rt->table[prefix|x] != NULL) {
-                radix_trie_node_add_flag_to_all_leaves(rt->table[prefix|x], flags);
-            } else { 
-                              tmp = (struct radix_trie_node *)radix_trie_leaf_init(flags);
-                              if (tmp == NULL) {
-                    pthread_mutex_unlock(&radix_trie_lock);
-                                  return failure;
-                              }
-                              rt->table[prefix|x] = tmp;
+    }
+
+    /* store one leaf per run of equal values among the branches without children */
+    base0 = rt->num_leaf6;
+    for (b=0; b < (1 << RT_STRIDE6); b++) {
+        if ((vector >> b) & 1) {
+            continue;
+        }
+        if (!have_leaf || leaf[b] != prev) {
+            if (rt_grow((void **)&rt->leaf6, &rt->max_leaf6, rt->num_leaf6 + 1,
+                        sizeof(attr_flags)) != ok) {
+                return failure;
             }
-        } 
+            rt->leaf6[rt->num_leaf6++] = leaf[b];
+            leafvec |= 1ULL << b;
+            prev = leaf[b];
+            have_leaf = 1;
+        }
+    }
+
+    /* reserve the children contiguously before filling them in */
+    base1 = rt->num_node6;
+    n = rt_popcount64(vector);
+    if (rt_grow((void **)&rt->node6, &rt->max_node6, rt->num_node6 + n,
+                sizeof(struct radix_trie_node6)) != ok) {
+        return failure;
+    }
+    rt->num_node6 += n;
+    rt->node6[node].vector = vector;
+    rt->node6[node].leafvec = leafvec;
+    rt->node6[node].base0 = base0;
+    rt->node6[node].base1 = base1;
+
+    k = 0;
+    for (b=0; b < (1 << RT_STRIDE6); b++) {
+        if ((vector >> b) & 1) {
+            if (radix_trie_compile6_node(rt, base1 + k++, first[b], last[b],
+                                         off + RT_STRIDE6, leaf[b]) != ok) {
+                return failure;
+            }
+        }
+    }
+
+    return ok;
+}
+
+/*
+ * builds the IPv6 trie from the IPv6 subnets
+ * returns ok
+ * returns failure
+ */
+static joy_status_e radix_trie_compile6 (struct radix_trie *rt) {
+    attr_flags inherited = 0;
+    unsigned int i;
+
+    if (rt->num_prefix6 == 0) {
+        return ok;
+    }
+
+    qsort(rt->prefix6, rt->num_prefix6, sizeof(struct radix_trie_prefix6), rt_prefix6_cmp);
+    for (i=0; i < rt->num_prefix6; i++) {
+        if (rt->prefix6[i].len == 0) {
+            inherited |= rt->prefix6[i].flags;
+        }
+    }
+
+    if (rt_grow((void **)&rt->node6, &rt->max_node6, 1, sizeof(struct radix_trie_node6)) != ok) {
+        return failure;
+    }
+    rt->num_node6 = 1;
+    return radix_trie_compile6_node(rt, 0, 0, rt->num_prefix6, 0, inherited);
+}
+
+/**
+ * \fn joy_status_e radix_trie_compile (struct radix_trie *rt)
+ * \brief builds the lookup tables from the subnets added so far
+ *
+ * Until a trie is compiled, and after subnets are added to it,
+ * lookups fall back to a scan of all of its subnets.  The trie must
+ * not be looked up by another thread while it is being compiled.
+ *
+ * \param rt radix_trie pointer
+ * \return ok
+ * \return failure
+ */
+joy_status_e radix_trie_compile (struct radix_trie *rt) {
+    if (rt == NULL) {
+        return failure;
+    }
+
+    pthread_mutex_lock(&radix_trie_lock);
+    radix_trie_tables_free(rt);
+    if (radix_trie_compile4(rt) != ok || radix_trie_compile6(rt) != ok) {
+        radix_trie_tables_free(rt);
+        pthread_mutex_unlock(&radix_trie_lock);
+        joy_log_err("could not allocate memory for labeled subnet tables");
+        return failure;
     }
+    rt->compiled = 1;
     pthread_mutex_unlock(&radix_trie_lock);
+
+    joy_log_debug("compiled %u IPv4 subnets (%u tbl8 groups) and %u IPv6 subnets (%u nodes, %u leaves)",
+                  rt->num_prefix4, rt->num_tbl8, rt->num_prefix6, rt->num_node6, rt->num_leaf6);
     return ok;
 }
 
 /*
  * convert an index into a flag
  * returns flag
- */ 
+ */
 static unsigned int index_to_flag (unsigned int x) {
     unsigned int flag = 0;
 
@@ -395,7 +779,7 @@ static unsigned int index_to_flag (unsigned int x) {
  */
 static unsigned int flag_to_index (unsigned int y) {
     unsigned int i = 0;
-  
+
     while (y > 0 && y < 32) {
         y = y >> 1;
         i++;
@@ -404,7 +788,7 @@ static unsigned int flag_to_index (unsigned int y) {
 }
 
 /**
- * \fn attr_flags radix_trie_add_attr_label (struct radix_trie *rt, const char *attr_label) 
+ * \fn attr_flags radix_trie_add_attr_label (struct radix_trie *rt, const char *attr_label)
  * \brief  function to add a label to the radix trie
  *
  * adds a labeled flag with the name "label" to a radix_trie, and returns the attribute flag
@@ -416,14 +800,14 @@ static unsigned int flag_to_index (unsigned int y) {
  */
 attr_flags radix_trie_add_attr_label (struct radix_trie *rt, const char *attr_label) {
     unsigned int rc_flag = 0;
-  
+
     /* sanity check */
     if (!attr_label) {
         return 0;     /* NULL is an error */
     }
 
     /* ensure label will fit into the trie */
-    if (strlen(attr_label) > MAX_LABEL_LEN-1) { 
+    if (strlen(attr_label) > MAX_LABEL_LEN-1) {
         return 0;     /* not enough room for label and null terminator */
     }
 
@@ -436,7 +820,7 @@ attr_flags radix_trie_add_attr_label (struct radix_trie *rt, const char *attr_la
     if ((rt->flag[rt->num_flags] = strdup(attr_label)) == NULL) {
         return 0;     /* failure */
     }
-  
+
     pthread_mutex_lock(&radix_trie_lock);
     rc_flag = index_to_flag(rt->num_flags++);
     pthread_mutex_unlock(&radix_trie_lock);
@@ -500,9 +884,7 @@ void attr_flags_json_print_labels (const struct radix_trie *rt, attr_flags f, ch
 joy_status_e radix_trie_init (struct radix_trie *rt) {
     pthread_mutex_lock(&radix_trie_lock);
     if (rt != NULL) {
-        rt->root = radix_trie_node_init();
-        rt->num_flags = 0;
-        memset(rt->flag, 0, sizeof(rt->flag));
+        memset(rt, 0, sizeof(struct radix_trie));
         pthread_mutex_unlock(&radix_trie_lock);
         return ok;
     } else {
@@ -511,34 +893,6 @@ joy_status_e radix_trie_init (struct radix_trie *rt) {
     }
 }
 
-/*
- * Function to free up the memory for leaf and internal nodes
- * returns ok
- */
-static joy_status_e radix_trie_deep_free (const struct radix_trie_node *rt) {
-    int i = 0;
-
-    switch (rt->type) {
-        case leaf:
-           /* found a leaf free up the memory */
-           rt_free((void*)rt);
-           break;
-        case internal:
-           /* follow deeper */
-           for (i=0; i<256; i++) {
-               if (rt->table[i] != NULL) {
-                   radix_trie_deep_free(rt->table[i]);
-               }
-           }
-           /* now free the internal node */
-           rt_free((void*)rt);
-           break;
-        default:
-           break;
-    }
-    return ok;
-}
-
 /**
  * \fn joy_status_e radix_trie_free (struct radix_trie *r)
  * \param r radix_trie pointer to free up
@@ -560,15 +914,9 @@ joy_status_e radix_trie_free (struct radix_trie *r) {
         }
     }
 
-    /* sanity check the root node */
-    if (r->root == NULL) {
-        /* no root node, just free radix_trie structure */
-        rt_free(r);
-        return ok;
-    }
-
-    /* perform deep free of radix_trie starting at the root */
-    radix_trie_deep_free(r->root);
+    radix_trie_tables_free(r);
+    rt_free(r->prefix4);
+    rt_free(r->prefix6);
 
     /* now free the radix_trie structure */
     rt_free((void*)r);
@@ -577,14 +925,16 @@ joy_status_e radix_trie_free (struct radix_trie *r) {
 }
 
 /*
- * Function to add a subnet to a radix trie from a string
+ * Function to add a subnet to a radix trie from a string; addresses
+ * that contain a colon are taken as IPv6
  * returns success
  * returns failure
  */
 joy_status_e radix_trie_add_subnet_from_string (struct radix_trie *rt, char *addr, attr_flags attr, FILE *loginfo) {
-    int i, masklen = 0;
+    int i, masklen = 0, maxlen = 32, is_ipv6 = 0;
     char *mask = NULL;
     struct in_addr a;
+    struct in6_addr a6;
 
     debug_printf("%s:adding subnet %s\n", __FUNCTION__, addr);
     for (i=0; i<80; i++) {
@@ -597,6 +947,15 @@ joy_status_e radix_trie_add_subnet_from_string (struct radix_trie *rt, char *add
             addr[i] = 0;
             break;
         }
+        if (addr[i] == 0) {
+            break;
+        }
+        if (addr[i] == ':') {
+            is_ipv6 = 1;
+        }
+    }
+    if (is_ipv6) {
+        maxlen = 128;
     }
 
     debug_printf("%s:address: %s\n", __FUNCTION__, addr);
@@ -611,19 +970,34 @@ joy_status_e radix_trie_add_subnet_from_string (struct radix_trie *rt, char *add
                        mask[i] = 0;   /* null terminate */
                        break;
             }
-        }    
+        }
         masklen = atoi(mask);
-        if (masklen < 1 || masklen > 32) {
+        if (masklen < 1 || masklen > maxlen) {
             fprintf(loginfo, "%s: error: cannot parse subnet; netmask is %d bits\n",
                        __FUNCTION__, masklen);
             return failure;
         }
         debug_printf("%s:masklen: %d\n", __FUNCTION__,  masklen);
-        
+
     } else {
-        masklen = 32;   /* no netmask, so match entire address */
+        masklen = maxlen;   /* no netmask, so match entire address */
     }
-  
+
+    if (is_ipv6) {
+        /* trim trailing characters that cannot be part of the address */
+        for (i=0; addr[i] != 0; i++) {
+            if (!isxdigit(addr[i]) && addr[i] != ':' && addr[i] != '.') {
+                addr[i] = 0;
+                break;
+            }
+        }
+        if (inet_pton(AF_INET6, addr, &a6) != 1) {
+            fprintf(loginfo, "%s: error: cannot parse IPv6 address %s\n", __FUNCTION__, addr);
+            return failure;
+        }
+        return radix_trie_add_subnet6(rt, &a6, masklen, attr);
+    }
+
 #ifdef WIN32
         inet_pton(AF_INET,addr, &a);
 #else
@@ -686,96 +1060,39 @@ joy_status_e radix_trie_add_subnets_from_file (struct radix_trie *rt,
                        if (radix_trie_add_subnet_from_string(rt, addr, attr, logfile) != ok) {
                            fprintf(logfile, "%s: error: could not add subnet %s to radix_trie\n",
                             __FUNCTION__, line);
+                           free(line);
+                           fclose(fp);
                            return failure;
                        }
             }
         }
-      
+
         free(line);
-    
+
         fclose(fp);
-    } 
+    }
     return s;
 }
 
 /*
- * function to print out the contents of a node
+ * Main entry point for print out a radix trie
  */
-static void radix_trie_node_print (const struct radix_trie *r, 
-                                   const struct radix_trie_node *rt, char *string) {
-    uint32_t i = 0;
-    char tmp[TMP_BUFF_256_LEN];
-    char *ptr = NULL;
-    int len = 0;
-
-    /* sanity checks */
-    if ((r == NULL) || (rt == NULL) || (string == NULL)) {
-        return;
-    }
-
-    /*
-     * Verify the string isn't too long
-     */
-    len = strnlen(string, TMP_BUFF_256_LEN);
-    if (len >= TMP_BUFF_256_LEN) {
-	return;
-    }
-
+static void radix_trie_print (const struct radix_trie *rt) {
+    char addr_string[INET6_ADDRSTRLEN];
+    struct in_addr a;
+    unsigned int i;
 
-#if 0
-    // Wow this code is totally unsafe
-    strcpy(tmp, string);
-    ptr = index(tmp, 0);
-    *ptr++ = ' ';
-    *ptr++ = ' ';
-    *ptr++ = ' ';
-    *ptr = 0;
-#endif
-    //safe copy of string into tmp buffer
-    strncpy(tmp, string, TMP_BUFF_256_LEN-1);
-    tmp[TMP_BUFF_256_LEN-1] = '\0'; // make sure string is terminated
-    //replacement for index function
-    for (i = 0; i < TMP_BUFF_256_LEN; ++i) {
-        //find first occurance of NULL in tmp
-        if (tmp[i] == '\0') {
-            ptr = &tmp[i];
-            break;
-        }
+    for (i=0; i < rt->num_prefix4; i++) {
+        a.s_addr = htonl(rt->prefix4[i].addr);
+        inet_ntop(AF_INET, &a, addr_string, sizeof(addr_string));
+        printf(" %s/%u flags: ", addr_string, rt->prefix4[i].len);
+        attr_flags_print_labels(rt, rt->prefix4[i].flags);
     }
-    //let's make sure we don't write past the end of the tmp buffer;
-    if (i <= 252) {
-	ptr = &tmp[i];//reset pointer to eliminate coverity error
-        *ptr++ = ' ';
-        *ptr++ = ' ';
-        *ptr++ = ' ';
-        *ptr = '\0';
-    }
-    
-    switch(rt->type) {
-        case leaf:
-            //printf("%s flags: %x\n", string, ((struct radix_trie_leaf *)rt)->value);
-            printf("%s flags: ", string);
-            attr_flags_print_labels(r, ((struct radix_trie_leaf *)rt)->value);
-            break;
-        case internal:
-            for (i=0; i<TMP_BUFF_256_LEN; i++) {    
-                if (rt->table[i] != NULL) {
-                    printf("%s [%x]\n", string, i);
-                    radix_trie_node_print(r, rt->table[i], tmp);
-                }
-            }
-            break;
-        default:
-            break;
+    for (i=0; i < rt->num_prefix6; i++) {
+        inet_ntop(AF_INET6, rt->prefix6[i].addr, addr_string, sizeof(addr_string));
+        printf(" %s/%u flags: ", addr_string, rt->prefix6[i].len);
+        attr_flags_print_labels(rt, rt->prefix6[i].flags);
     }
-    return; 
-}
-
-/*
- * Main entry point for print out a radix trie
- */
-static void radix_trie_print (const struct radix_trie *rt) {
-    radix_trie_node_print(rt, rt->root, "");
 }
 
 /*
@@ -856,6 +1173,139 @@ static int radix_trie_high_level_unit_test () {
     return test_failed; /* 0 on success, 1 otherwise */
 }
 
+/*
+ * pseudo-random numbers for the unit tests
+ */
+static uint32_t rt_test_rand (uint32_t *seed) {
+    *seed = *seed * 1103515245 + 12345;
+    return *seed >> 8;
+}
+
+/*
+ * checks the compiled tables against a scan of the subnets, for
+ * pseudo-randomly chosen, overlapping subnets and addresses
+ * returns 0 on success
+ * returns 1 on failure
+ */
+static int radix_trie_compiled_unit_test () {
+    struct radix_trie *rt = NULL;
+    uint32_t seed = 0x2545f491, x;
+    unsigned int i, j, test_failed = 0;
+    struct in_addr a[4];
+    attr_flags f[4];
+    struct in6_addr a6;
+    char subnet[80];
+    attr_flags label;
+
+    rt = radix_trie_alloc();
+    if (rt == NULL || radix_trie_init(rt) != ok) {
+        joy_log_err("could not initialize radix_trie");
+        return 1;
+    }
+
+    /* IPv4 subnets of /8 through /32 within a few /8s */
+    for (i=0; i < 2000; i++) {
+        a[0].s_addr = htonl(((10 + rt_test_rand(&seed) % 4) << 24) | (rt_test_rand(&seed) & 0xffffff));
+        if (radix_trie_add_subnet(rt, a[0], 8 + rt_test_rand(&seed) % 25,
+                                  2 << (rt_test_rand(&seed) % 8)) != ok) {
+            test_failed = 1;
+        }
+    }
+
+    /* IPv6 subnets of any length, with few distinct byte values so that they overlap */
+    for (i=0; i < 2000; i++) {
+        a6.s6_addr[0] = 0x20;
+        a6.s6_addr[1] = 0x01;
+        for (j=2; j < 16; j++) {
+            a6.s6_addr[j] = rt_test_rand(&seed) % 3;
+        }
+        if (radix_trie_add_subnet6(rt, &a6, rt_test_rand(&seed) % 129,
+                                   2 << (rt_test_rand(&seed) % 8)) != ok) {
+            test_failed = 1;
+        }
+    }
+
+    /* labeled subnets from strings; the flags above leave out this label */
+    label = radix_trie_add_attr_label(rt, "test");
+    strncpy(subnet, "2001:db8::/32\n", sizeof(subnet));
+    if (radix_trie_add_subnet_from_string(rt, subnet, label, stderr) != ok) {
+        joy_log_err("could not add subnet 2001:db8::/32");
+        test_failed = 1;
+    }
+    strncpy(subnet, "192.0.2.128/25", sizeof(subnet));
+    if (radix_trie_add_subnet_from_string(rt, subnet, label, stderr) != ok) {
+        joy_log_err("could not add subnet 192.0.2.128/25");
+        test_failed = 1;
+    }
+
+    if (radix_trie_compile(rt) != ok) {
+        joy_log_err("could not compile radix_trie");
+        radix_trie_free(rt);
+        return 1;
+    }
+
+    inet_pton(AF_INET6, "2001:db8:1::1", &a6);
+    if ((radix_trie_lookup_addr6(rt, &a6) & label) == 0) {
+        joy_log_err("lookup of 2001:db8:1::1 failed");
+        test_failed = 1;
+    }
+    inet_pton(AF_INET6, "2001:db9::1", &a6);
+    if (radix_trie_lookup_addr6(rt, &a6) & label) {
+        joy_log_err("false positive lookup of 2001:db9::1");
+        test_failed = 1;
+    }
+    inet_pton(AF_INET, "192.0.2.200", &a[0]);
+    inet_pton(AF_INET, "192.0.2.100", &a[1]);
+    if ((radix_trie_lookup_addr(rt, a[0]) & label) == 0 || (radix_trie_lookup_addr(rt, a[1]) & label)) {
+        joy_log_err("lookup in 192.0.2.128/25 failed");
+        test_failed = 1;
+    }
+
+    /* addresses near the subnets, looked up one at a time and in batches */
+    for (i=0; i < 20000 && !test_failed; i++) {
+        const struct radix_trie_prefix4 *p = &rt->prefix4[rt_test_rand(&seed) % rt->num_prefix4];
+        const struct radix_trie_prefix6 *p6 = &rt->prefix6[rt_test_rand(&seed) % rt->num_prefix6];
+
+        /* flip some of the low bits of a subnet address */
+        x = (rt_test_rand(&seed) << 8) ^ rt_test_rand(&seed);
+        a[i % 4].s_addr = htonl(p->addr ^ (x & ~rt_mask4(rt_test_rand(&seed) % 33)));
+        if (radix_trie_lookup_addr(rt, a[i % 4]) != radix_trie_scan4(rt, ntohl(a[i % 4].s_addr))) {
+            inet_ntop(AF_INET, &a[i % 4], subnet, sizeof(subnet));
+            joy_log_err("compiled lookup of %s differs from scan", subnet);
+            test_failed = 1;
+        }
+        if (i % 4 == 3) {
+            radix_trie_lookup_addrs(rt, a, f, 4);
+            for (j=0; j < 4; j++) {
+                if (f[j] != radix_trie_lookup_addr(rt, a[j])) {
+                    joy_log_err("batch lookup differs from single lookup");
+                    test_failed = 1;
+                }
+            }
+        }
+
+        memcpy(a6.s6_addr, p6->addr, sizeof(a6.s6_addr));
+        for (j = rt_test_rand(&seed) % 16; j < 16; j++) {
+            a6.s6_addr[j] = rt_test_rand(&seed) % 3;
+        }
+        if (radix_trie_lookup_addr6(rt, &a6) != radix_trie_scan6(rt, a6.s6_addr)) {
+            inet_ntop(AF_INET6, &a6, subnet, sizeof(subnet));
+            joy_log_err("compiled lookup of %s differs from scan", subnet);
+            test_failed = 1;
+        }
+    }
+
+    radix_trie_free(rt);
+
+    if (test_failed) {
+        printf("FAILURE; compiled lookup tests failed\n");
+    } else {
+        printf("all compiled lookup tests passed\n");
+    }
+
+    return test_failed;
+}
+
 /** 
  * \fn int radix_trie_unit_test()
  * \params none
@@ -1081,6 +1531,10 @@ int radix_trie_unit_test () {
 
     printf("-----------------------------------\n");
 
+    if (radix_trie_compiled_unit_test() != 0) {
+        test_failed = 1;
+    }
+
     if (radix_trie_high_level_unit_test() != ok) {
         test_failed = 1;
     }
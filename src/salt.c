@@ -58,10 +58,11 @@ extern FILE *info;
  * \brief Initialize the memory of SALT struct.
  *
  * \param salt_handle contains salt structure to init
+ * \param arena arena of the flow record (unused)
  *
  * \return none
  */
-void salt_init(struct salt **salt_handle) {
+void salt_init(struct salt **salt_handle, joy_arena_t *arena) {
     if (*salt_handle != NULL) {
         salt_delete(salt_handle);
     }
@@ -196,6 +197,9 @@ void salt_print_json (const struct salt *x1, const struct salt *x2, zfile f) {
 
 }
 
+/* the JSON of salt is carried as text in CBOR output */
+define_print_text(salt)
+
 /**
  * \brief Delete the memory of SALT struct.
  *
@@ -0,0 +1,695 @@
+/*
+ *
+ * Copyright (c) 2018 Cisco Systems, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ *
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file shm_output.c
+ *
+ * \brief Publication of records into a named shared memory ring, and
+ *        the reader library for it
+ *
+ * The data area is addressed by positions that only ever grow; a
+ * position is taken modulo the size of the area, and a message may
+ * wrap around its end.  Every message starts with a shm_message_t,
+ * and is padded to eight bytes.  head is the position after the last
+ * message published, and tail that of the oldest message that is
+ * still whole.  The writer moves tail past the messages it is about to
+ * overwrite before it writes, so a reader copies a message out and
+ * then checks that tail has not passed it in the meantime.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "shm_output.h"
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#endif
+
+#ifdef WIN32
+#define shm_load(p) (*(p))
+#else
+#define shm_load(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define shm_store(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#endif
+
+/* the start of every message in the data area */
+typedef struct shm_message_ {
+    uint32_t len;                 /* bytes of records that follow */
+    uint32_t reserved;
+    uint64_t seq;                 /* number of the message, from 0 */
+} shm_message_t;
+
+/* bytes taken by a message of len bytes */
+#define shm_message_size(len) (sizeof(shm_message_t) + (((uint64_t)(len) + 7) & ~(uint64_t)7))
+
+/* where the data area starts in the shared memory object */
+#define SHM_DATA_OFFSET ((sizeof(shm_ring_header_t) + 63) & ~(size_t)63)
+
+/* smallest data area */
+#define SHM_RING_MIN_SIZE (64 * 1024)
+
+/* the seq of the next message is not known yet */
+#define SHM_SEQ_UNKNOWN UINT64_MAX
+
+struct shm_ring_ {
+    shm_ring_header_t *hdr;
+    unsigned char *data;
+    size_t map_len;
+    uint64_t start;               /* position of the message being written */
+    uint64_t pos;                 /* where its next byte goes */
+    int oversize;                 /* it has outgrown the ring */
+};
+
+struct shm_reader_ {
+    shm_ring_header_t *hdr;
+    const unsigned char *data;
+    size_t map_len;
+    uint64_t cursor;
+    uint64_t next_seq;
+    shm_reader_slot_t *slot;      /* NULL if every slot was taken */
+    shm_reader_slot_t counts;     /* what is kept in the slot */
+};
+
+/* copies len bytes into the data area at pos, wrapping around its end */
+static void shm_copy_in (unsigned char *data, uint64_t size, uint64_t pos,
+                         const void *src, size_t len) {
+    size_t off = (size_t)(pos & (size - 1));
+    size_t n = size - off < len ? (size_t)(size - off) : len;
+
+    memcpy(data + off, src, n);
+    memcpy(data, (const unsigned char *)src + n, len - n);
+}
+
+/* copies len bytes out of the data area at pos */
+static void shm_copy_out (const unsigned char *data, uint64_t size, uint64_t pos,
+                          void *dst, size_t len) {
+    size_t off = (size_t)(pos & (size - 1));
+    size_t n = size - off < len ? (size_t)(size - off) : len;
+
+    memcpy(dst, data + off, n);
+    memcpy((unsigned char *)dst + n, data, len - n);
+}
+
+/* prefixes name with a slash, as shm_open() wants */
+static int shm_path (const char *name, char *path, size_t size) {
+    int n;
+
+    if (name == NULL || *name == '\0') {
+        return -1;
+    }
+    n = snprintf(path, size, "%s%s", name[0] == '/' ? "" : "/", name);
+    return (n < 0 || (size_t)n >= size) ? -1 : 0;
+}
+
+#ifndef WIN32
+
+/**
+ * \fn shm_ring_t *shm_ring_create (const char *name, size_t size, shm_format_e format)
+ * \brief Create the ring \p name for writing, in place of any ring of
+ *        that name; readers still attached to the old one see it closed.
+ * \param name name of the shared memory object
+ * \param size bytes in the data area, rounded up to a power of two
+ * \param format format of the records that will be published
+ * \return the writer, or NULL on failure (with errno set)
+ */
+shm_ring_t *shm_ring_create (const char *name, size_t size, shm_format_e format) {
+    shm_ring_t *r;
+    shm_ring_header_t *h;
+    char path[256];
+    uint64_t data_size = SHM_RING_MIN_SIZE;
+    void *map;
+    int fd;
+
+    if (shm_path(name, path, sizeof(path)) != 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    while (data_size < size) {
+        data_size *= 2;
+    }
+    r = calloc(1, sizeof(shm_ring_t));
+    if (r == NULL) {
+        return NULL;
+    }
+    r->map_len = SHM_DATA_OFFSET + (size_t)data_size;
+
+    shm_unlink(path);
+    fd = shm_open(path, O_RDWR | O_CREAT | O_EXCL, 0666);
+    if (fd < 0) {
+        free(r);
+        return NULL;
+    }
+    if (ftruncate(fd, r->map_len) != 0) {
+        close(fd);
+        shm_unlink(path);
+        free(r);
+        return NULL;
+    }
+    map = mmap(NULL, r->map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        shm_unlink(path);
+        free(r);
+        return NULL;
+    }
+
+    h = r->hdr = map;
+    r->data = (unsigned char *)map + SHM_DATA_OFFSET;
+    h->version = SHM_RING_VERSION;
+    h->size = data_size;
+    h->format = format;
+    r->pos = sizeof(shm_message_t);
+
+    /* readers wait for the magic, which says that the rest is there */
+    shm_store(&h->magic, SHM_RING_MAGIC);
+    return r;
+}
+
+/*
+ * makes room for the message being written to reach end, by moving
+ * tail past the oldest messages
+ */
+static int shm_ring_reserve (shm_ring_t *r, uint64_t end) {
+    shm_ring_header_t *h = r->hdr;
+    uint64_t tail = h->tail;
+    shm_message_t m;
+
+    if (end - r->start > h->size) {
+        return -1;
+    }
+    if (end - tail <= h->size) {
+        return 0;
+    }
+    while (end - tail > h->size) {
+        shm_copy_out(r->data, h->size, tail, &m, sizeof(m));
+        tail += shm_message_size(m.len);
+    }
+    shm_store(&h->tail, tail);
+
+    /* readers must see the new tail before they can see the new data */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    return 0;
+}
+
+/**
+ * \fn void shm_ring_write (shm_ring_t *r, const void *data, size_t len)
+ * \brief Append \p len bytes to the message being written, which
+ *        readers see once it is committed.
+ * \param r the ring
+ * \param data the bytes
+ * \param len the number of bytes
+ * \return none
+ */
+void shm_ring_write (shm_ring_t *r, const void *data, size_t len) {
+    if (r->oversize || len == 0) {
+        return;
+    }
+    if (shm_ring_reserve(r, r->pos + len) != 0) {
+        r->oversize = 1;
+        return;
+    }
+    shm_copy_in(r->data, r->hdr->size, r->pos, data, len);
+    r->pos += len;
+}
+
+/**
+ * \fn void shm_ring_commit (shm_ring_t *r)
+ * \brief Publish the message written so far, unless it is empty; it
+ *        should end with a whole record.
+ * \param r the ring
+ * \return none
+ */
+void shm_ring_commit (shm_ring_t *r) {
+    shm_ring_header_t *h = r->hdr;
+    shm_message_t m;
+    uint64_t len = r->pos - r->start - sizeof(shm_message_t);
+    uint64_t end = r->start + shm_message_size(len);
+
+    if (!r->oversize && len == 0) {
+        return;
+    }
+    if (r->oversize || len > UINT32_MAX || shm_ring_reserve(r, end) != 0) {
+        h->oversize++;
+        shm_ring_abort(r);
+        return;
+    }
+    m.len = (uint32_t)len;
+    m.reserved = 0;
+    m.seq = h->messages;
+    shm_copy_in(r->data, h->size, r->start, &m, sizeof(m));
+
+    shm_store(&h->messages, h->messages + 1);
+    shm_store(&h->bytes, h->bytes + len);
+    shm_store(&h->head, end);
+    r->start = end;
+    r->pos = end + sizeof(shm_message_t);
+}
+
+/**
+ * \fn void shm_ring_abort (shm_ring_t *r)
+ * \brief Drop the message written so far, without publishing it.
+ * \param r the ring
+ * \return none
+ */
+void shm_ring_abort (shm_ring_t *r) {
+    r->pos = r->start + sizeof(shm_message_t);
+    r->oversize = 0;
+}
+
+/**
+ * \fn void shm_ring_close (shm_ring_t *r)
+ * \brief Mark the ring closed, and let go of it; the shared memory
+ *        object is left for the readers to drain.
+ * \param r the ring
+ * \return none
+ */
+void shm_ring_close (shm_ring_t *r) {
+    if (r == NULL) {
+        return;
+    }
+    shm_store(&r->hdr->closed, 1);
+    munmap(r->hdr, r->map_len);
+    free(r);
+}
+
+/* copies the counts of r to its slot, for the world to see */
+static void shm_reader_account (shm_reader_t *r) {
+    if (r->slot != NULL) {
+        shm_store(&r->slot->cursor, r->counts.cursor);
+        shm_store(&r->slot->messages, r->counts.messages);
+        shm_store(&r->slot->overflows, r->counts.overflows);
+        shm_store(&r->slot->messages_lost, r->counts.messages_lost);
+    }
+}
+
+/* takes a slot that is free, or whose reader has gone */
+static shm_reader_slot_t *shm_reader_claim (shm_ring_header_t *h) {
+    uint64_t pid = (uint64_t)getpid();
+    uint64_t owner;
+    unsigned int i;
+
+    for (i = 0; i < SHM_RING_MAX_READERS; i++) {
+        owner = shm_load(&h->readers[i].pid);
+        if (owner != 0 && (kill((pid_t)owner, 0) == 0 || errno != ESRCH)) {
+            continue;
+        }
+        if (__atomic_compare_exchange_n(&h->readers[i].pid, &owner, pid, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            return &h->readers[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * \fn shm_reader_t *shm_reader_open (const char *name, int from_oldest)
+ * \brief Attach a reader to the ring \p name; a reader that may only
+ *        read it goes unaccounted for in the ring.
+ * \param name name of the shared memory object
+ * \param from_oldest start with the oldest message still in the ring,
+ *        rather than with the next one published
+ * \return the reader, or NULL on failure (with errno set)
+ */
+shm_reader_t *shm_reader_open (const char *name, int from_oldest) {
+    shm_reader_t *r;
+    shm_ring_header_t *h;
+    struct stat st;
+    char path[256];
+    void *map;
+    int fd, readonly = 0;
+
+    if (shm_path(name, path, sizeof(path)) != 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    fd = shm_open(path, O_RDWR, 0);
+    if (fd < 0 && errno == EACCES) {
+        /* a reader that may not write goes without a slot */
+        readonly = 1;
+        fd = shm_open(path, O_RDONLY, 0);
+    }
+    if (fd < 0) {
+        return NULL;
+    }
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < SHM_DATA_OFFSET + SHM_RING_MIN_SIZE) {
+        close(fd);
+        errno = EINVAL;
+        return NULL;
+    }
+    map = mmap(NULL, st.st_size, readonly ? PROT_READ : PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+    h = map;
+    if (shm_load(&h->magic) != SHM_RING_MAGIC || h->version != SHM_RING_VERSION ||
+        (h->size & (h->size - 1)) != 0 || SHM_DATA_OFFSET + h->size != (uint64_t)st.st_size) {
+        munmap(map, st.st_size);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    r = calloc(1, sizeof(shm_reader_t));
+    if (r == NULL) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    r->hdr = h;
+    r->data = (const unsigned char *)map + SHM_DATA_OFFSET;
+    r->map_len = st.st_size;
+    r->cursor = shm_load(from_oldest ? &h->tail : &h->head);
+    r->next_seq = SHM_SEQ_UNKNOWN;
+    if (r->cursor == shm_load(&h->head)) {
+        /* loaded after head, so that it cannot be behind the cursor */
+        r->next_seq = shm_load(&h->messages);
+    }
+    r->counts.pid = (uint64_t)getpid();
+    r->counts.cursor = r->cursor;
+    r->slot = readonly ? NULL : shm_reader_claim(h);
+    shm_reader_account(r);
+    return r;
+}
+
+/**
+ * \fn int shm_reader_next (shm_reader_t *r, void *buf, size_t size, size_t *len)
+ * \brief Copy the next message into \p buf, if there is one.
+ *
+ * Messages that the writer overwrote before they could be read are
+ * skipped, and counted as lost.
+ *
+ * \param r the reader
+ * \param buf where the message goes
+ * \param size size of buf
+ * \param len set to the length of the message
+ * \return 1 if a message was read, 0 if there is none yet, or -1 if it
+ *         does not fit in \p buf, in which case \p len is set to the
+ *         size needed
+ */
+int shm_reader_next (shm_reader_t *r, void *buf, size_t size, size_t *len) {
+    shm_ring_header_t *h = r->hdr;
+    shm_message_t m;
+    uint64_t head, tail;
+
+    for (;;) {
+        head = shm_load(&h->head);
+        if (r->cursor == head) {
+            return 0;
+        }
+        tail = shm_load(&h->tail);
+        if (r->cursor < tail) {
+            /* overtaken; the messages in between are counted by seq */
+            r->cursor = tail;
+            r->counts.overflows++;
+            continue;
+        }
+        shm_copy_out(r->data, h->size, r->cursor, &m, sizeof(m));
+        if (m.len <= size) {
+            shm_copy_out(r->data, h->size, r->cursor + sizeof(m), buf, m.len);
+        }
+
+        /* the copy is good only if the writer has not reached it since */
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (r->cursor < shm_load(&h->tail)) {
+            continue;
+        }
+        if (m.len > size) {
+            *len = m.len;
+            return -1;
+        }
+        break;
+    }
+
+    if (r->next_seq != SHM_SEQ_UNKNOWN && m.seq > r->next_seq) {
+        r->counts.messages_lost += m.seq - r->next_seq;
+    }
+    r->next_seq = m.seq + 1;
+    r->cursor += shm_message_size(m.len);
+    r->counts.cursor = r->cursor;
+    r->counts.messages++;
+    shm_reader_account(r);
+    *len = m.len;
+    return 1;
+}
+
+/**
+ * \fn void shm_reader_close (shm_reader_t *r)
+ * \brief Detach the reader, and give up its slot.
+ * \param r the reader
+ * \return none
+ */
+void shm_reader_close (shm_reader_t *r) {
+    if (r == NULL) {
+        return;
+    }
+    if (r->slot != NULL) {
+        shm_store(&r->slot->pid, 0);
+    }
+    munmap(r->hdr, r->map_len);
+    free(r);
+}
+
+#else /* WIN32 */
+
+shm_ring_t *shm_ring_create (const char *name, size_t size, shm_format_e format) {
+    errno = ENOSYS;
+    return NULL;
+}
+
+void shm_ring_write (shm_ring_t *r, const void *data, size_t len) {
+}
+
+void shm_ring_commit (shm_ring_t *r) {
+}
+
+void shm_ring_abort (shm_ring_t *r) {
+}
+
+void shm_ring_close (shm_ring_t *r) {
+}
+
+shm_reader_t *shm_reader_open (const char *name, int from_oldest) {
+    errno = ENOSYS;
+    return NULL;
+}
+
+int shm_reader_next (shm_reader_t *r, void *buf, size_t size, size_t *len) {
+    return 0;
+}
+
+void shm_reader_close (shm_reader_t *r) {
+}
+
+#endif /* WIN32 */
+
+/**
+ * \fn shm_format_e shm_reader_format (const shm_reader_t *r)
+ * \brief The format of the records in the messages of the ring.
+ */
+shm_format_e shm_reader_format (const shm_reader_t *r) {
+    return (shm_format_e)r->hdr->format;
+}
+
+/**
+ * \fn int shm_reader_closed (const shm_reader_t *r)
+ * \brief Whether the writer has gone; the messages left can still be read.
+ */
+int shm_reader_closed (const shm_reader_t *r) {
+    return shm_load(&r->hdr->closed) != 0;
+}
+
+/**
+ * \fn void shm_reader_stats (const shm_reader_t *r, shm_reader_stats_t *stats)
+ * \brief Report what the reader has read, and how far behind it is.
+ * \param r the reader
+ * \param stats filled in
+ * \return none
+ */
+void shm_reader_stats (const shm_reader_t *r, shm_reader_stats_t *stats) {
+    stats->messages = r->counts.messages;
+    stats->overflows = r->counts.overflows;
+    stats->messages_lost = r->counts.messages_lost;
+    stats->lag = shm_load(&r->hdr->head) - r->cursor;
+    stats->published = shm_load(&r->hdr->messages);
+}
+
+#ifndef WIN32
+
+/* reads the next message of r, and checks that it is expected */
+static int shm_test_expect (shm_reader_t *r, const char *expected, const char *what) {
+    char buf[512];
+    size_t len = 0;
+
+    if (shm_reader_next(r, buf, sizeof(buf), &len) != 1 ||
+        len != strlen(expected) || memcmp(buf, expected, len) != 0) {
+        fprintf(stderr, "shm_unit_test: %s: got \"%.*s\", expected \"%s\"\n",
+                what, (int)len, buf, expected);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * \fn int shm_unit_test (void)
+ * \brief check that readers get what is published, in order, and
+ *        account for what they miss
+ * \return number of failures
+ */
+int shm_unit_test (void) {
+    char name[64], msg[512], buf[512];
+    shm_ring_t *w;
+    shm_reader_t *a, *b;
+    shm_reader_stats_t stats;
+    unsigned int i, read_b = 0, num_msgs = 2000;
+    size_t len;
+    char *big;
+    int num_fails = 0;
+
+    snprintf(name, sizeof(name), "joy-unit-test-%lu", (unsigned long)getpid());
+    w = shm_ring_create(name, SHM_RING_MIN_SIZE, shm_format_json);
+    if (w == NULL) {
+        fprintf(stderr, "shm_unit_test: could not create ring (%s)\n", strerror(errno));
+        return 1;
+    }
+    a = shm_reader_open(name, 0);
+    b = shm_reader_open(name, 1);
+    if (a == NULL || b == NULL) {
+        fprintf(stderr, "shm_unit_test: could not open ring (%s)\n", strerror(errno));
+        shm_reader_close(a);
+        shm_ring_close(w);
+        snprintf(buf, sizeof(buf), "/%s", name);
+        shm_unlink(buf);
+        return 1;
+    }
+
+    /* a message written in pieces, an empty one, and an aborted one */
+    if (shm_reader_next(a, buf, sizeof(buf), &len) != 0) {
+        fprintf(stderr, "shm_unit_test: message read from an empty ring\n");
+        num_fails++;
+    }
+    shm_ring_write(w, "{\"a\":", 5);
+    shm_ring_write(w, "1}\n", 3);
+    shm_ring_commit(w);
+    shm_ring_commit(w);
+    shm_ring_write(w, "{\"partial", 9);
+    shm_ring_abort(w);
+    shm_ring_write(w, "{\"b\":2}\n", 8);
+    shm_ring_commit(w);
+    num_fails += shm_test_expect(a, "{\"a\":1}\n", "first message");
+    num_fails += shm_test_expect(a, "{\"b\":2}\n", "second message");
+
+    /* a message that does not fit in the buffer given */
+    memset(msg, 'x', 300);
+    shm_ring_write(w, msg, 300);
+    shm_ring_commit(w);
+    if (shm_reader_next(a, buf, 100, &len) != -1 || len != 300 ||
+        shm_reader_next(a, buf, sizeof(buf), &len) != 1 || len != 300) {
+        fprintf(stderr, "shm_unit_test: large message not read\n");
+        num_fails++;
+    }
+
+    /* a message too large for the ring is not published */
+    big = calloc(1, 2 * SHM_RING_MIN_SIZE);
+    if (big != NULL) {
+        shm_ring_write(w, big, SHM_RING_MIN_SIZE / 2);
+        shm_ring_write(w, big, SHM_RING_MIN_SIZE);
+        shm_ring_commit(w);
+        free(big);
+    }
+    shm_ring_write(w, "{\"c\":3}\n", 8);
+    shm_ring_commit(w);
+    num_fails += shm_test_expect(a, "{\"c\":3}\n", "message after an oversize one");
+
+    /*
+     * many messages, which wrap around the ring several times; a
+     * keeps up, and b falls behind and is overtaken
+     */
+    for (i = 0; i < num_msgs; i++) {
+        snprintf(msg, sizeof(msg), "{\"n\":%u,\"pad\":\"%0*u\"}\n", i, (int)(i % 97) + 1, i);
+        shm_ring_write(w, msg, strlen(msg));
+        shm_ring_commit(w);
+        num_fails += shm_test_expect(a, msg, "wrapped message");
+        if (num_fails > 8) {
+            break;
+        }
+    }
+    while (shm_reader_next(b, buf, sizeof(buf), &len) == 1) {
+        read_b++;
+    }
+    shm_reader_stats(b, &stats);
+    if (stats.overflows == 0 || read_b == 0 ||
+        read_b + stats.messages_lost != stats.published ||
+        stats.lag != 0 || memcmp(buf, msg, len) != 0) {
+        fprintf(stderr, "shm_unit_test: reader that fell behind read %u, lost %lu of %lu\n",
+                read_b, (unsigned long)stats.messages_lost, (unsigned long)stats.published);
+        num_fails++;
+    }
+    shm_reader_stats(a, &stats);
+    if (stats.messages_lost != 0 || stats.overflows != 0 || stats.messages != stats.published) {
+        fprintf(stderr, "shm_unit_test: reader that kept up lost messages\n");
+        num_fails++;
+    }
+
+    if (shm_reader_closed(a)) {
+        fprintf(stderr, "shm_unit_test: ring closed too early\n");
+        num_fails++;
+    }
+    shm_ring_close(w);
+    if (!shm_reader_closed(a)) {
+        fprintf(stderr, "shm_unit_test: closed ring not seen closed\n");
+        num_fails++;
+    }
+    shm_reader_close(a);
+    shm_reader_close(b);
+    snprintf(buf, sizeof(buf), "/%s", name);
+    shm_unlink(buf);
+
+    return num_fails;
+}
+
+#else
+
+int shm_unit_test (void) {
+    return 0;
+}
+
+#endif /* WIN32 */
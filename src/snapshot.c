@@ -0,0 +1,376 @@
+/*
+ *
+ * Copyright (c) 2018 Cisco Systems, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ *
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file snapshot.c
+ *
+ * \brief Immutable snapshots of reloadable data, published without locks
+ *
+ * Data that the updater reloads while packets are processed (labeled
+ * subnets, classifier parameters) is never modified in place.  A new
+ * copy is built off to the side and published with one atomic pointer
+ * exchange, so readers take no locks.  The old copy is retired, and
+ * freed once every registered reader has passed a quiescent point
+ * after the exchange; readers report one before each packet, at which
+ * point they hold no snapshot data.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "pthread.h"
+#include "snapshot.h"
+#include "config.h"
+#include "err.h"
+
+/*
+ * External objects, defined in joy.c
+ */
+extern FILE *info;
+
+/** data waiting for the readers to pass a quiescent point */
+typedef struct joy_snapshot_retired_ {
+    void *data;
+    joy_snapshot_free_fn free_fn;
+    long epoch;                 /* freed once every reader has seen this epoch */
+    struct joy_snapshot_retired_ *next;
+} joy_snapshot_retired_t;
+
+long joy_snapshot_epoch = 1;
+
+static joy_snapshot_reader_t *joy_snapshot_readers = NULL;
+static joy_snapshot_retired_t *joy_snapshot_retired = NULL;
+
+/* guards the reader and retired lists; never taken by readers */
+static pthread_mutex_t joy_snapshot_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#ifdef WIN32
+#define joy_snapshot_exchange_ptr(p, v) InterlockedExchangePointer((PVOID volatile *)(p), (v))
+#define joy_snapshot_increment(p) InterlockedIncrement((LONG volatile *)(p))
+#else
+#define joy_snapshot_exchange_ptr(p, v) __atomic_exchange_n((p), (v), __ATOMIC_SEQ_CST)
+#define joy_snapshot_increment(p) __atomic_add_fetch((p), 1, __ATOMIC_SEQ_CST)
+#endif
+
+/**
+ * \fn void joy_snapshot_register (joy_snapshot_reader_t *r)
+ * \brief Adds a reader, whose quiescent points then gate the freeing
+ * of retired data.
+ * \param r reader to add
+ * \return none
+ */
+void joy_snapshot_register (joy_snapshot_reader_t *r) {
+    pthread_mutex_lock(&joy_snapshot_lock);
+    joy_snapshot_quiescent(r);
+    r->next = joy_snapshot_readers;
+    joy_snapshot_readers = r;
+    pthread_mutex_unlock(&joy_snapshot_lock);
+}
+
+/**
+ * \fn void joy_snapshot_unregister (joy_snapshot_reader_t *r)
+ * \brief Removes a reader that no longer loads snapshots.
+ * \param r reader to remove
+ * \return none
+ */
+void joy_snapshot_unregister (joy_snapshot_reader_t *r) {
+    joy_snapshot_reader_t **p;
+
+    pthread_mutex_lock(&joy_snapshot_lock);
+    for (p = &joy_snapshot_readers; *p != NULL; p = &(*p)->next) {
+        if (*p == r) {
+            *p = r->next;
+            r->next = NULL;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&joy_snapshot_lock);
+}
+
+/*
+ * frees the retired data that no reader can still hold; called with
+ * joy_snapshot_lock held
+ */
+static unsigned int joy_snapshot_reclaim_locked (void) {
+    joy_snapshot_retired_t **p = &joy_snapshot_retired;
+    joy_snapshot_retired_t *old = NULL;
+    joy_snapshot_reader_t *r = NULL;
+    long min_epoch = joy_snapshot_load_long(&joy_snapshot_epoch);
+    unsigned int num_freed = 0;
+
+    for (r = joy_snapshot_readers; r != NULL; r = r->next) {
+        long e = joy_snapshot_load_long(&r->epoch);
+        if (e < min_epoch) {
+            min_epoch = e;
+        }
+    }
+
+    while (*p != NULL) {
+        old = *p;
+        if (old->epoch <= min_epoch) {
+            *p = old->next;
+            if (old->free_fn != NULL) {
+                old->free_fn(old->data);
+            }
+            free(old);
+            num_freed++;
+        } else {
+            p = &old->next;
+        }
+    }
+
+    return num_freed;
+}
+
+/**
+ * \fn long joy_snapshot_publish (joy_snapshot_t *s, void *data, joy_snapshot_free_fn free_fn)
+ * \brief Replaces the data of a snapshot.
+ *
+ * The data must not be modified after it is published.  The previous
+ * data is freed with free_fn once no reader can still hold it.
+ * Publishes to the same snapshot must not run concurrently.
+ *
+ * \param s snapshot to update
+ * \param data new data
+ * \param free_fn function that frees the previous data, or NULL
+ * \return version of the snapshot that holds the new data
+ */
+long joy_snapshot_publish (joy_snapshot_t *s, void *data, joy_snapshot_free_fn free_fn) {
+    joy_snapshot_retired_t *retired = NULL;
+    void *old = NULL;
+    long version;
+
+    old = joy_snapshot_exchange_ptr(&s->data, data);
+    version = joy_snapshot_increment(&s->version);
+
+    pthread_mutex_lock(&joy_snapshot_lock);
+    if (old != NULL) {
+        retired = malloc(sizeof(joy_snapshot_retired_t));
+        if (retired == NULL) {
+            /* better to leak the old data than to free it under a reader */
+            joy_log_err("could not retire snapshot data");
+        } else {
+            retired->data = old;
+            retired->free_fn = free_fn;
+            retired->epoch = joy_snapshot_increment(&joy_snapshot_epoch);
+            retired->next = joy_snapshot_retired;
+            joy_snapshot_retired = retired;
+        }
+    }
+    joy_snapshot_reclaim_locked();
+    pthread_mutex_unlock(&joy_snapshot_lock);
+
+    return version;
+}
+
+/**
+ * \fn unsigned int joy_snapshot_reclaim (void)
+ * \brief Frees the retired data that no reader can still hold.
+ * \return number of retired snapshots freed
+ */
+unsigned int joy_snapshot_reclaim (void) {
+    unsigned int num_freed;
+
+    pthread_mutex_lock(&joy_snapshot_lock);
+    num_freed = joy_snapshot_reclaim_locked();
+    pthread_mutex_unlock(&joy_snapshot_lock);
+
+    return num_freed;
+}
+
+/**
+ * \fn void joy_snapshot_cleanup (void)
+ * \brief Frees all retired data; called once no readers are left.
+ * \return none
+ */
+void joy_snapshot_cleanup (void) {
+    joy_snapshot_retired_t *old = NULL;
+
+    pthread_mutex_lock(&joy_snapshot_lock);
+    joy_snapshot_readers = NULL;
+    while (joy_snapshot_retired != NULL) {
+        old = joy_snapshot_retired;
+        joy_snapshot_retired = old->next;
+        if (old->free_fn != NULL) {
+            old->free_fn(old->data);
+        }
+        free(old);
+    }
+    pthread_mutex_unlock(&joy_snapshot_lock);
+}
+
+/*
+ * Unit test objects: data that records when it is freed, and a reader
+ * thread that checks it never sees freed data.
+ */
+typedef struct joy_snapshot_test_data_ {
+    unsigned int value;
+    unsigned int freed;
+} joy_snapshot_test_data_t;
+
+static joy_snapshot_test_data_t joy_snapshot_test_pool[2001];
+
+static void joy_snapshot_test_free (void *data) {
+    ((joy_snapshot_test_data_t *)data)->freed = 1;
+}
+
+typedef struct joy_snapshot_test_thread_ {
+    joy_snapshot_t *snapshot;
+    joy_snapshot_reader_t reader;
+    long stop;
+    unsigned int num_errors;
+} joy_snapshot_test_thread_t;
+
+static void *joy_snapshot_test_reader (void *arg) {
+    joy_snapshot_test_thread_t *t = arg;
+    const joy_snapshot_test_data_t *d = NULL;
+    unsigned int value = 0;
+
+    while (!joy_snapshot_load_long(&t->stop)) {
+        d = joy_snapshot_get(t->snapshot);
+        if (d != NULL) {
+            if (d->freed || d->value < value) {
+                t->num_errors++;
+            }
+            value = d->value;
+        }
+        joy_snapshot_quiescent(&t->reader);
+    }
+    return NULL;
+}
+
+/**
+ * \fn void joy_snapshot_unit_test (void)
+ * \brief Tests that retired data is freed only after every reader's
+ * quiescent point, and never while a reader thread holds it.
+ * \return none
+ */
+void joy_snapshot_unit_test (void) {
+    joy_snapshot_t snapshot;
+    joy_snapshot_reader_t r1, r2;
+    joy_snapshot_reader_t *saved_readers = NULL;
+    joy_snapshot_test_thread_t thread_data;
+    pthread_t thread;
+    unsigned int i;
+    int num_fails = 0;
+
+    fprintf(info, "\n******************************\n");
+    fprintf(info, "Snapshot Unit Test starting...\n");
+
+    /* set aside the readers registered by the library */
+    pthread_mutex_lock(&joy_snapshot_lock);
+    saved_readers = joy_snapshot_readers;
+    joy_snapshot_readers = NULL;
+    pthread_mutex_unlock(&joy_snapshot_lock);
+
+    memset(&snapshot, 0, sizeof(snapshot));
+    memset(joy_snapshot_test_pool, 0, sizeof(joy_snapshot_test_pool));
+    for (i = 0; i < sizeof(joy_snapshot_test_pool)/sizeof(joy_snapshot_test_data_t); i++) {
+        joy_snapshot_test_pool[i].value = i;
+    }
+
+    /* Retired data waits for every registered reader */
+    joy_snapshot_register(&r1);
+    joy_snapshot_register(&r2);
+    joy_snapshot_publish(&snapshot, &joy_snapshot_test_pool[0], joy_snapshot_test_free);
+    if (joy_snapshot_publish(&snapshot, &joy_snapshot_test_pool[1], joy_snapshot_test_free) != 2 ||
+        joy_snapshot_get(&snapshot) != &joy_snapshot_test_pool[1]) {
+        fprintf(info, "error: publish\n");
+        num_fails++;
+    }
+    if (joy_snapshot_reclaim() != 0 || joy_snapshot_test_pool[0].freed) {
+        fprintf(info, "error: freed before the readers were quiescent\n");
+        num_fails++;
+    }
+    joy_snapshot_quiescent(&r1);
+    if (joy_snapshot_reclaim() != 0) {
+        fprintf(info, "error: freed before the second reader was quiescent\n");
+        num_fails++;
+    }
+    joy_snapshot_quiescent(&r2);
+    if (joy_snapshot_reclaim() != 1 || !joy_snapshot_test_pool[0].freed ||
+        joy_snapshot_test_pool[1].freed) {
+        fprintf(info, "error: not freed after the readers were quiescent\n");
+        num_fails++;
+    }
+
+    /* An unregistered reader no longer holds up reclamation */
+    joy_snapshot_publish(&snapshot, &joy_snapshot_test_pool[2], joy_snapshot_test_free);
+    joy_snapshot_quiescent(&r1);
+    joy_snapshot_unregister(&r2);
+    if (joy_snapshot_reclaim() != 1 || !joy_snapshot_test_pool[1].freed) {
+        fprintf(info, "error: unregistered reader held up reclamation\n");
+        num_fails++;
+    }
+    joy_snapshot_unregister(&r1);
+
+    /* A reader thread never sees freed data while the writer publishes */
+    memset(&thread_data, 0, sizeof(thread_data));
+    thread_data.snapshot = &snapshot;
+    joy_snapshot_register(&thread_data.reader);
+    if (pthread_create(&thread, NULL, joy_snapshot_test_reader, &thread_data) != 0) {
+        fprintf(info, "error: could not start reader thread\n");
+        num_fails++;
+        joy_snapshot_unregister(&thread_data.reader);
+    } else {
+        for (i = 3; i < sizeof(joy_snapshot_test_pool)/sizeof(joy_snapshot_test_data_t); i++) {
+            joy_snapshot_publish(&snapshot, &joy_snapshot_test_pool[i], joy_snapshot_test_free);
+        }
+        joy_snapshot_store_long(&thread_data.stop, 1);
+        pthread_join(thread, NULL);
+        joy_snapshot_unregister(&thread_data.reader);
+        if (thread_data.num_errors) {
+            fprintf(info, "error: reader saw freed or stale data %u times\n", thread_data.num_errors);
+            num_fails++;
+        }
+    }
+    joy_snapshot_reclaim();
+    if (joy_snapshot_test_pool[i-1].freed || !joy_snapshot_test_pool[i-2].freed) {
+        fprintf(info, "error: reclaim after the reader exited\n");
+        num_fails++;
+    }
+
+    pthread_mutex_lock(&joy_snapshot_lock);
+    joy_snapshot_readers = saved_readers;
+    pthread_mutex_unlock(&joy_snapshot_lock);
+
+    if (num_fails) {
+        fprintf(info, "Finished - failures: %d\n", num_fails);
+    } else {
+        fprintf(info, "Finished - success\n");
+    }
+    fprintf(info, "******************************\n\n");
+}
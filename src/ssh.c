@@ -53,10 +53,12 @@
 #endif
 
 #include <string.h>
+#include <openssl/md5.h>
 #include "ssh.h"
 #include "utils.h"      /* for enum role */
 #include "p2f.h"        /* for zprintf_ ...        */
 #include "err.h"        /* for logging             */
+#include "config.h"     /* for glb_config          */
 
 /*
  *
@@ -116,84 +118,77 @@ static const char * memsearch(const char *buf,
     return NULL;
 }
 
-/*
- * A vector is contains a pointer to a string of bytes of a specified length.
- */
-struct vector {
-    unsigned int len;
-    char *bytes;
-};
-
 /*
  *
- * \brief Initialize vector struct.
+ * \brief Empty a vector, keeping its memory for reuse.
  *
- * \param vector Pointer to the vector to be initialized.
+ * \param vector Pointer to the vector to empty.
  *
  */
-static void vector_init(struct vector *vector) {
+static void vector_clear(struct vector *vector) {
     vector->len = 0;
-    vector->bytes = NULL;
 }
 
 /*
  *
- * \brief Free a vector, setting it to the state just after a call to vector_init.
- *
- * \param vector Pointer to the vector to free.
- *
- */
-static void vector_free(struct vector *vector) {
-    if (vector->bytes != NULL) {
-        free(vector->bytes);
-    }
-    vector_init(vector);
-}
-
-/*
- *
- * \brief Set the vector contents to the specified data, freeing the previous
- * vector contents. If the previous vector contents overlap in memory with the
- * new vector contents, the behavior is still defined since the free occurs
- * after the copy.
+ * \brief Set the vector contents to the specified data. The vector memory is
+ * reused when it is large enough; the data may overlap the current contents.
  *
+ * \param arena Arena to allocate from.
  * \param vector Pointer to the vector to be set.
  * \param data Pointer to byte array to be copied.
  * \param len Length of the byte array to be copied.
  *
  */
-static void vector_set(struct vector *vector,
+static void vector_set(joy_arena_t *arena,
+                       struct vector *vector,
                        const char *data,
                        unsigned int len) {
     char *tmpptr = NULL;
 
-    tmpptr = malloc(len);
-    if (tmpptr == NULL) {
-        return;
+    if (len > vector->size) {
+        tmpptr = joy_arena_alloc(arena, len);
+        if (tmpptr == NULL) {
+            return;
+        }
+        memcpy(tmpptr, data, len);
+        vector->bytes = tmpptr;
+        vector->size = len;
+    } else if (len > 0) {
+        memmove(vector->bytes, data, len);
     }
-    memcpy(tmpptr, data, len);
-    vector_free(vector); /* does nothing if already empty */
-    vector->bytes = tmpptr;
     vector->len = len;
 }
 
 /*
  *
  * \brief Append the specified data to the current vector contents, even if the
- * vector is currently empty.
+ * vector is currently empty. The vector memory grows geometrically, so that
+ * appending packet after packet to a reassembly buffer stays cheap.
  *
+ * \param arena Arena to allocate from.
  * \param vector Pointer to the vector to be appended to.
  * \param data Pointer to byte array to be appended.
  * \param len Length of the byte array to be appended.
  *
  */
-static void vector_append(struct vector *vector,
+static void vector_append(joy_arena_t *arena,
+                          struct vector *vector,
                           const char *data,
                           unsigned int len) {
+    unsigned int size = vector->size ? vector->size : 256;
+    char *tmpptr = NULL;
 
-    vector->bytes = realloc(vector->bytes, vector->len + len);
-    if (vector->bytes == NULL) {
-        return;
+    if (vector->len + len > vector->size) {
+        while (size < vector->len + len) {
+            size *= 2;
+        }
+        tmpptr = joy_arena_realloc(arena, vector->bytes, vector->size, size);
+        if (tmpptr == NULL) {
+            return;
+        }
+        vector->bytes = tmpptr;
+        vector->size = size;
     }
     memcpy(vector->bytes + vector->len, data, len);
     vector->len += len;
@@ -326,7 +321,8 @@ static unsigned int decode_uint32(const char *data) {
     return ntohl(*x);
 }
 
-static joy_status_e decode_ssh_vector(const char **dataptr,
+static joy_status_e decode_ssh_vector(joy_arena_t *arena,
+                                     const char **dataptr,
                                      unsigned int *datalen,
                                      struct vector *vector,
                                      unsigned int maxlen) {
@@ -353,7 +349,7 @@ static joy_status_e decode_ssh_vector(const char **dataptr,
         return failure;
     }
 
-    vector_set(vector, data, length);
+    vector_set(arena, vector, data, length);
 
     data += length;
     *datalen -= length;
@@ -382,11 +378,45 @@ static joy_status_e decode_ssh_vector(const char **dataptr,
  *    uint32       0 (reserved for future extension)
  *
  */
+/*
+ * HASSH fingerprints of a KEXINIT message: the MD5 of
+ * "kex;enc;mac;comp", using the client-to-server lists for the
+ * client (hassh) and the server-to-client lists for the server
+ * (hassh_server); which one applies depends on the role, which is
+ * not yet known when KEXINIT is parsed
+ */
+static void ssh_hassh_list(MD5_CTX *ctx, const struct vector *v, int last) {
+    MD5_Update(ctx, v->bytes, v->len);
+    if (!last) {
+        MD5_Update(ctx, ";", 1);
+    }
+}
+
+static void ssh_get_hassh(struct ssh *ssh) {
+    MD5_CTX ctx;
+
+    MD5_Init(&ctx);
+    ssh_hassh_list(&ctx, &ssh->kex_algos, 0);
+    ssh_hassh_list(&ctx, &ssh->c_encryption_algos, 0);
+    ssh_hassh_list(&ctx, &ssh->c_mac_algos, 0);
+    ssh_hassh_list(&ctx, &ssh->c_comp_algos, 1);
+    MD5_Final(ssh->hassh, &ctx);
+
+    MD5_Init(&ctx);
+    ssh_hassh_list(&ctx, &ssh->kex_algos, 0);
+    ssh_hassh_list(&ctx, &ssh->s_encryption_algos, 0);
+    ssh_hassh_list(&ctx, &ssh->s_mac_algos, 0);
+    ssh_hassh_list(&ctx, &ssh->s_comp_algos, 1);
+    MD5_Final(ssh->hassh_server, &ctx);
+
+    ssh->have_hassh = 1;
+}
+
 static void ssh_parse_kexinit(struct ssh *ssh,
                               const char *data,
                               unsigned int datalen) {
     /* robustness check */
-    if (ssh->kex_algos->len != 0) {
+    if (ssh->kex_algos.len != 0) {
         return;
     }
 
@@ -399,36 +429,40 @@ static void ssh_parse_kexinit(struct ssh *ssh,
     datalen -= 16;
 
     /* copy all name-list strings */
-    if (decode_ssh_vector(&data, &datalen, ssh->kex_algos, MAX_SSH_STRING_LEN) == failure) {
+    if (decode_ssh_vector(ssh->arena, &data, &datalen, &ssh->kex_algos, MAX_SSH_STRING_LEN) == failure) {
         return;
     }
-    if (decode_ssh_vector(&data, &datalen, ssh->s_host_key_algos, MAX_SSH_STRING_LEN) == failure) {
+    if (decode_ssh_vector(ssh->arena, &data, &datalen, &ssh->s_host_key_algos, MAX_SSH_STRING_LEN) == failure) {
         return;
     }
-    if (decode_ssh_vector(&data, &datalen, ssh->c_encryption_algos, MAX_SSH_STRING_LEN) == failure) {
+    if (decode_ssh_vector(ssh->arena, &data, &datalen, &ssh->c_encryption_algos, MAX_SSH_STRING_LEN) == failure) {
         return;
     }
-    if (decode_ssh_vector(&data, &datalen, ssh->s_encryption_algos, MAX_SSH_STRING_LEN) == failure) {
+    if (decode_ssh_vector(ssh->arena, &data, &datalen, &ssh->s_encryption_algos, MAX_SSH_STRING_LEN) == failure) {
         return;
     }
-    if (decode_ssh_vector(&data, &datalen, ssh->c_mac_algos, MAX_SSH_STRING_LEN) == failure) {
+    if (decode_ssh_vector(ssh->arena, &data, &datalen, &ssh->c_mac_algos, MAX_SSH_STRING_LEN) == failure) {
         return;
     }
-    if (decode_ssh_vector(&data, &datalen, ssh->s_mac_algos, MAX_SSH_STRING_LEN) == failure) {
+    if (decode_ssh_vector(ssh->arena, &data, &datalen, &ssh->s_mac_algos, MAX_SSH_STRING_LEN) == failure) {
         return;
     }
-    if (decode_ssh_vector(&data, &datalen, ssh->c_comp_algos, MAX_SSH_STRING_LEN) == failure) {
+    if (decode_ssh_vector(ssh->arena, &data, &datalen, &ssh->c_comp_algos, MAX_SSH_STRING_LEN) == failure) {
         return;
     }
-    if (decode_ssh_vector(&data, &datalen, ssh->s_comp_algos, MAX_SSH_STRING_LEN) == failure) {
+    if (decode_ssh_vector(ssh->arena, &data, &datalen, &ssh->s_comp_algos, MAX_SSH_STRING_LEN) == failure) {
         return;
     }
-    if (decode_ssh_vector(&data, &datalen, ssh->c_languages, MAX_SSH_STRING_LEN) == failure) {
+    if (decode_ssh_vector(ssh->arena, &data, &datalen, &ssh->c_languages, MAX_SSH_STRING_LEN) == failure) {
         return;
     }
-    if (decode_ssh_vector(&data, &datalen, ssh->s_languages, MAX_SSH_STRING_LEN) == failure) {
+    if (decode_ssh_vector(ssh->arena, &data, &datalen, &ssh->s_languages, MAX_SSH_STRING_LEN) == failure) {
         return;
     }
+
+    if (glb_config->fingerprint_hash) {
+        ssh_get_hassh(ssh);
+    }
 }
 
 static void ssh_get_kex_algo(struct ssh *cli,
@@ -440,8 +474,8 @@ static void ssh_get_kex_algo(struct ssh *cli,
     unsigned len;
     int found = 0;
 
-    cli_copy = vector_string(cli->kex_algos);
-    srv_copy = vector_string(srv->kex_algos);
+    cli_copy = vector_string(&cli->kex_algos);
+    srv_copy = vector_string(&srv->kex_algos);
 
     for(cli_algo = strtok_r(cli_copy, sep, &cli_ptr); cli_algo && !found; cli_algo = strtok_r(NULL, sep, &cli_ptr)) {
         for(srv_algo = strtok_r(srv_copy, sep, &srv_ptr); srv_algo && !found; srv_algo = strtok_r(NULL, sep, &srv_ptr)) {
@@ -459,10 +493,14 @@ static void ssh_get_kex_algo(struct ssh *cli,
     }
 
     len = strlen(cli_algo);
-    cli->kex_algo = malloc(len+1);
-    strncpy(cli->kex_algo, cli_algo, len+1); /* strncpy will null-terminate the string */
-    srv->kex_algo = malloc(len+1);
-    strncpy(srv->kex_algo, cli_algo, len+1); /* strncpy will null-terminate the string */
+    cli->kex_algo = joy_arena_alloc(cli->arena, len+1);
+    if (cli->kex_algo != NULL) {
+        memcpy(cli->kex_algo, cli_algo, len+1);
+    }
+    srv->kex_algo = joy_arena_alloc(srv->arena, len+1);
+    if (srv->kex_algo != NULL) {
+        memcpy(srv->kex_algo, cli_algo, len+1);
+    }
 
     free(cli_copy);
     free(srv_copy);
@@ -476,7 +514,7 @@ static void ssh_parse_kexdh_init(struct ssh *ssh,
                                  const char *data,
                                  unsigned int datalen) {
     /* copy client key exchange value */
-    if (decode_ssh_vector(&data, &datalen, ssh->c_kex, MAX_SSH_PAYLOAD_LEN) == failure) {
+    if (decode_ssh_vector(ssh->arena, &data, &datalen, &ssh->c_kex, MAX_SSH_PAYLOAD_LEN) == failure) {
         return;
     }
 
@@ -490,29 +528,29 @@ static void ssh_parse_kexdh_reply(struct ssh *ssh,
     unsigned int tmplen;
 
     /* copy server public host key and certificates (K_S) */
-    if (decode_ssh_vector(&data, &datalen, ssh->s_hostkey, MAX_SSH_PAYLOAD_LEN) == failure) {
+    if (decode_ssh_vector(ssh->arena, &data, &datalen, &ssh->s_hostkey, MAX_SSH_PAYLOAD_LEN) == failure) {
         return;
     }
 
     /* copy host key type */
-    tmpptr = ssh->s_hostkey->bytes;
-    tmplen = ssh->s_hostkey->len;
-    if (decode_ssh_vector(&tmpptr, &tmplen, ssh->s_hostkey_type, MAX_SSH_STRING_LEN) == failure) {
+    tmpptr = ssh->s_hostkey.bytes;
+    tmplen = ssh->s_hostkey.len;
+    if (decode_ssh_vector(ssh->arena, &tmpptr, &tmplen, &ssh->s_hostkey_type, MAX_SSH_STRING_LEN) == failure) {
         return;
     }
     /* copy server key exchange value */
-    if (decode_ssh_vector(&data, &datalen, ssh->s_kex, MAX_SSH_PAYLOAD_LEN) == failure) {
+    if (decode_ssh_vector(ssh->arena, &data, &datalen, &ssh->s_kex, MAX_SSH_PAYLOAD_LEN) == failure) {
         return;
     }
     /* copy signature */
-    if (decode_ssh_vector(&data, &datalen, ssh->s_signature, MAX_SSH_PAYLOAD_LEN) == failure) {
+    if (decode_ssh_vector(ssh->arena, &data, &datalen, &ssh->s_signature, MAX_SSH_PAYLOAD_LEN) == failure) {
         return;
     }
 
     /* copy signature type */
-    tmpptr = ssh->s_signature->bytes;
-    tmplen = ssh->s_signature->len;
-    if (decode_ssh_vector(&tmpptr, &tmplen, ssh->s_signature_type, MAX_SSH_STRING_LEN) == failure) {
+    tmpptr = ssh->s_signature.bytes;
+    tmplen = ssh->s_signature.len;
+    if (decode_ssh_vector(ssh->arena, &tmpptr, &tmplen, &ssh->s_signature_type, MAX_SSH_STRING_LEN) == failure) {
         return;
     }
 
@@ -539,12 +577,12 @@ static void ssh_parse_kex_dh_gex_group(struct ssh *ssh,
                                        const char *data,
                                        unsigned int datalen) {
     /* copy safe prime p */
-    if (decode_ssh_vector(&data, &datalen, ssh->s_gex_p, MAX_SSH_PAYLOAD_LEN) == failure) {
+    if (decode_ssh_vector(ssh->arena, &data, &datalen, &ssh->s_gex_p, MAX_SSH_PAYLOAD_LEN) == failure) {
         return;
     }
 
     /* copy generator g */
-    if (decode_ssh_vector(&data, &datalen, ssh->s_gex_g, MAX_SSH_PAYLOAD_LEN) == failure) {
+    if (decode_ssh_vector(ssh->arena, &data, &datalen, &ssh->s_gex_g, MAX_SSH_PAYLOAD_LEN) == failure) {
         return;
     }
 }
@@ -559,18 +597,18 @@ static void ssh_parse_kexrsa_pubkey(struct ssh *ssh,
     unsigned int tmplen;
 
     /* copy server public host key and certificates (K_S) */
-    if (decode_ssh_vector(&data, &datalen, ssh->s_hostkey, MAX_SSH_PAYLOAD_LEN) == failure) {
+    if (decode_ssh_vector(ssh->arena, &data, &datalen, &ssh->s_hostkey, MAX_SSH_PAYLOAD_LEN) == failure) {
         return;
     }
 
     /* copy host key type */
-    tmpptr = ssh->s_hostkey->bytes;
-    tmplen = ssh->s_hostkey->len;
-    if (decode_ssh_vector(&tmpptr, &tmplen, ssh->s_hostkey_type, MAX_SSH_STRING_LEN) == failure) {
+    tmpptr = ssh->s_hostkey.bytes;
+    tmplen = ssh->s_hostkey.len;
+    if (decode_ssh_vector(ssh->arena, &tmpptr, &tmplen, &ssh->s_hostkey_type, MAX_SSH_STRING_LEN) == failure) {
         return;
     }
     /* copy K_T, the transient RSA public key */
-    if (decode_ssh_vector(&data, &datalen, ssh->s_kex, MAX_SSH_PAYLOAD_LEN) == failure) {
+    if (decode_ssh_vector(ssh->arena, &data, &datalen, &ssh->s_kex, MAX_SSH_PAYLOAD_LEN) == failure) {
         return;
     }
 
@@ -581,7 +619,7 @@ static void ssh_parse_kexrsa_secret(struct ssh *ssh,
                                     const char *data,
                                     unsigned int datalen) {
     /* copy RSA-encrypted secret */
-    if (decode_ssh_vector(&data, &datalen, ssh->c_kex, MAX_SSH_PAYLOAD_LEN) == failure) {
+    if (decode_ssh_vector(ssh->arena, &data, &datalen, &ssh->c_kex, MAX_SSH_PAYLOAD_LEN) == failure) {
         return;
     }
 
@@ -595,13 +633,13 @@ static void ssh_parse_kexrsa_done(struct ssh *ssh,
     unsigned int tmplen;
 
     /* copy signature */
-    if (decode_ssh_vector(&data, &datalen, ssh->s_signature, MAX_SSH_PAYLOAD_LEN) == failure) {
+    if (decode_ssh_vector(ssh->arena, &data, &datalen, &ssh->s_signature, MAX_SSH_PAYLOAD_LEN) == failure) {
         return;
     }
     /* copy signature type */
-    tmpptr = ssh->s_signature->bytes;
-    tmplen = ssh->s_signature->len;
-    if (decode_ssh_vector(&tmpptr, &tmplen, ssh->s_signature_type, MAX_SSH_STRING_LEN) == failure) {
+    tmpptr = ssh->s_signature.bytes;
+    tmplen = ssh->s_signature.len;
+    if (decode_ssh_vector(ssh->arena, &tmpptr, &tmplen, &ssh->s_signature_type, MAX_SSH_STRING_LEN) == failure) {
         return;
     }
 
@@ -623,16 +661,16 @@ static void ssh_gex_kex(struct ssh *cli,
 
     if (cli->kex_msgs_len > 0 && (cli->kex_msgs[0].msg_code == SSH_MSG_KEX_DH_GEX_REQUEST_OLD
                 || cli->kex_msgs[0].msg_code == SSH_MSG_KEX_DH_GEX_REQUEST)) {
-        ssh_parse_kex_dh_gex_request(cli, cli->kex_msgs[0].data->bytes, cli->kex_msgs[0].data->len);
+        ssh_parse_kex_dh_gex_request(cli, cli->kex_msgs[0].data.bytes, cli->kex_msgs[0].data.len);
     }
     if (srv->kex_msgs_len > 0 && srv->kex_msgs[0].msg_code == SSH_MSG_KEX_DH_GEX_GROUP) {
-        ssh_parse_kex_dh_gex_group(srv, srv->kex_msgs[0].data->bytes, srv->kex_msgs[0].data->len);
+        ssh_parse_kex_dh_gex_group(srv, srv->kex_msgs[0].data.bytes, srv->kex_msgs[0].data.len);
     }
     if (cli->kex_msgs_len > 1 && cli->kex_msgs[1].msg_code == SSH_MSG_KEX_DH_GEX_INIT) {
-        ssh_parse_kex_dh_gex_init(cli, cli->kex_msgs[1].data->bytes, cli->kex_msgs[1].data->len);
+        ssh_parse_kex_dh_gex_init(cli, cli->kex_msgs[1].data.bytes, cli->kex_msgs[1].data.len);
     }
     if (srv->kex_msgs_len > 1 && srv->kex_msgs[1].msg_code == SSH_MSG_KEX_DH_GEX_REPLY) {
-        ssh_parse_kex_dh_gex_reply(srv, srv->kex_msgs[1].data->bytes, srv->kex_msgs[1].data->len);
+        ssh_parse_kex_dh_gex_reply(srv, srv->kex_msgs[1].data.bytes, srv->kex_msgs[1].data.len);
     }
 }
 
@@ -645,10 +683,10 @@ static void ssh_dh_kex(struct ssh *cli,
                        struct ssh *srv) {
 
     if (cli->kex_msgs_len > 0 && cli->kex_msgs[0].msg_code == SSH_MSG_KEXDH_INIT) {
-        ssh_parse_kexdh_init(cli, cli->kex_msgs[0].data->bytes, cli->kex_msgs[0].data->len);
+        ssh_parse_kexdh_init(cli, cli->kex_msgs[0].data.bytes, cli->kex_msgs[0].data.len);
     }
     if (srv->kex_msgs_len > 0 && srv->kex_msgs[0].msg_code == SSH_MSG_KEXDH_REPLY) {
-        ssh_parse_kexdh_reply(srv, srv->kex_msgs[0].data->bytes, srv->kex_msgs[0].data->len);
+        ssh_parse_kexdh_reply(srv, srv->kex_msgs[0].data.bytes, srv->kex_msgs[0].data.len);
     }
 }
 
@@ -684,13 +722,13 @@ static void ssh_rsa_kex(struct ssh *cli,
                         struct ssh *srv) {
 
     if (srv->kex_msgs_len > 0 && srv->kex_msgs[0].msg_code == SSH_MSG_KEXRSA_PUBKEY) {
-        ssh_parse_kexrsa_pubkey(srv, srv->kex_msgs[0].data->bytes, srv->kex_msgs[0].data->len);
+        ssh_parse_kexrsa_pubkey(srv, srv->kex_msgs[0].data.bytes, srv->kex_msgs[0].data.len);
     }
     if (cli->kex_msgs_len > 0 && cli->kex_msgs[0].msg_code == SSH_MSG_KEXRSA_SECRET) {
-        ssh_parse_kexrsa_secret(cli, cli->kex_msgs[0].data->bytes, cli->kex_msgs[0].data->len);
+        ssh_parse_kexrsa_secret(cli, cli->kex_msgs[0].data.bytes, cli->kex_msgs[0].data.len);
     }
     if (srv->kex_msgs_len > 1 && srv->kex_msgs[1].msg_code == SSH_MSG_KEXRSA_DONE) {
-        ssh_parse_kexrsa_done(srv, srv->kex_msgs[1].data->bytes, srv->kex_msgs[1].data->len);
+        ssh_parse_kexrsa_done(srv, srv->kex_msgs[1].data.bytes, srv->kex_msgs[1].data.len);
     }
 }
 
@@ -734,12 +772,11 @@ static void ssh_process(struct ssh *cli,
  * \brief Initialize the memory of SSH struct.
  *
  * \param ssh_handle contains ssh structure to initialize
+ * \param arena arena of the flow record, backing the data of the structure
  *
  * \return none
  */
-inline void ssh_init(struct ssh **ssh_handle) {
-    int i;
-
+inline void ssh_init(struct ssh **ssh_handle, joy_arena_t *arena) {
     if (*ssh_handle != NULL) {
         ssh_delete(ssh_handle);
     }
@@ -750,29 +787,8 @@ inline void ssh_init(struct ssh **ssh_handle) {
         joy_log_err("malloc failed");
         return;
     }
+    (*ssh_handle)->arena = arena;
 
-    (*ssh_handle)->buffer                 = malloc(sizeof(struct vector)); vector_init((*ssh_handle)->buffer);
-    (*ssh_handle)->kex_algos              = malloc(sizeof(struct vector)); vector_init((*ssh_handle)->kex_algos);
-    (*ssh_handle)->s_host_key_algos       = malloc(sizeof(struct vector)); vector_init((*ssh_handle)->s_host_key_algos);
-    (*ssh_handle)->c_encryption_algos     = malloc(sizeof(struct vector)); vector_init((*ssh_handle)->c_encryption_algos);
-    (*ssh_handle)->s_encryption_algos     = malloc(sizeof(struct vector)); vector_init((*ssh_handle)->s_encryption_algos);
-    (*ssh_handle)->c_mac_algos            = malloc(sizeof(struct vector)); vector_init((*ssh_handle)->c_mac_algos);
-    (*ssh_handle)->s_mac_algos            = malloc(sizeof(struct vector)); vector_init((*ssh_handle)->s_mac_algos);
-    (*ssh_handle)->c_comp_algos           = malloc(sizeof(struct vector)); vector_init((*ssh_handle)->c_comp_algos);
-    (*ssh_handle)->s_comp_algos           = malloc(sizeof(struct vector)); vector_init((*ssh_handle)->s_comp_algos);
-    (*ssh_handle)->c_languages            = malloc(sizeof(struct vector)); vector_init((*ssh_handle)->c_languages);
-    (*ssh_handle)->s_languages            = malloc(sizeof(struct vector)); vector_init((*ssh_handle)->s_languages);
-    (*ssh_handle)->s_hostkey_type         = malloc(sizeof(struct vector)); vector_init((*ssh_handle)->s_hostkey_type);
-    (*ssh_handle)->s_signature_type       = malloc(sizeof(struct vector)); vector_init((*ssh_handle)->s_signature_type);
-    (*ssh_handle)->c_kex                  = malloc(sizeof(struct vector)); vector_init((*ssh_handle)->c_kex);
-    (*ssh_handle)->s_kex                  = malloc(sizeof(struct vector)); vector_init((*ssh_handle)->s_kex);
-    (*ssh_handle)->s_hostkey              = malloc(sizeof(struct vector)); vector_init((*ssh_handle)->s_hostkey);
-    (*ssh_handle)->s_signature            = malloc(sizeof(struct vector)); vector_init((*ssh_handle)->s_signature);
-    (*ssh_handle)->s_gex_p                = malloc(sizeof(struct vector)); vector_init((*ssh_handle)->s_gex_p);
-    (*ssh_handle)->s_gex_g                = malloc(sizeof(struct vector)); vector_init((*ssh_handle)->s_gex_g);
-    for (i = 0; i < MAX_SSH_KEX_MESSAGES; ++i) {
-        (*ssh_handle)->kex_msgs[i].data   = malloc(sizeof(struct vector)); vector_init((*ssh_handle)->kex_msgs[i].data);
-    }
 }
 
 void ssh_update(struct ssh *ssh,
@@ -799,9 +815,9 @@ void ssh_update(struct ssh *ssh,
     }
 
     /* append application-layer data to buffer */
-    vector_append(ssh->buffer, data_ptr, len);
-    data_ptr = ssh->buffer->bytes;
-    len = ssh->buffer->len;
+    vector_append(ssh->arena, &ssh->buffer, data_ptr, len);
+    data_ptr = ssh->buffer.bytes;
+    len = ssh->buffer.len;
 
     if (ssh->role == role_unknown) {
         /*
@@ -852,7 +868,7 @@ void ssh_update(struct ssh *ssh,
             if (msg_code >= 30 && msg_code <= 49) {
                 if (ssh->kex_msgs_len < MAX_SSH_KEX_MESSAGES) {
                     ssh->kex_msgs[ssh->kex_msgs_len].msg_code = msg_code;
-                    vector_set(ssh->kex_msgs[ssh->kex_msgs_len].data, data_ptr + sizeof(struct ssh_packet), length);
+                    vector_set(ssh->arena, &ssh->kex_msgs[ssh->kex_msgs_len].data, data_ptr + sizeof(struct ssh_packet), length);
                     ssh->kex_msgs_len++;
                 }
             }
@@ -866,9 +882,9 @@ void ssh_update(struct ssh *ssh,
 
     /* update or free buffer */
     if (len > 0) {
-        vector_set(ssh->buffer, data_ptr, len);
+        vector_set(ssh->arena, &ssh->buffer, data_ptr, len);
     } else {
-        vector_free(ssh->buffer);
+        vector_clear(&ssh->buffer);
     }
 
     }
@@ -880,6 +896,7 @@ void ssh_print_json(const struct ssh *x1,
                     zfile f) {
 
     struct ssh *cli = NULL, *srv = NULL;
+    int hash_only = (glb_config->fingerprint_hash == fingerprint_hash_only);
     char *ptr;
 
     if (x1->role == role_unknown) {
@@ -900,22 +917,34 @@ void ssh_print_json(const struct ssh *x1,
             zprintf(f, ",\"cookie\":");
             zprintf_raw_as_hex(f, cli->cookie, sizeof(cli->cookie));
         }
-        ptr = vector_string(cli->kex_algos); zprintf(f, ",\"kex_algos\":\"%s\"", ptr); free(ptr);
-        ptr = vector_string(cli->s_host_key_algos); zprintf(f, ",\"s_host_key_algos\":\"%s\"", ptr); free(ptr);
-        ptr = vector_string(cli->c_encryption_algos); zprintf(f, ",\"c_encryption_algos\":\"%s\"", ptr); free(ptr);
-        ptr = vector_string(cli->s_encryption_algos); zprintf(f, ",\"s_encryption_algos\":\"%s\"", ptr); free(ptr);
-        ptr = vector_string(cli->c_mac_algos); zprintf(f, ",\"c_mac_algos\":\"%s\"", ptr); free(ptr);
-        ptr = vector_string(cli->s_mac_algos); zprintf(f, ",\"s_mac_algos\":\"%s\"", ptr); free(ptr);
-        ptr = vector_string(cli->c_comp_algos); zprintf(f, ",\"c_comp_algos\":\"%s\"", ptr); free(ptr);
-        ptr = vector_string(cli->s_comp_algos); zprintf(f, ",\"s_comp_algos\":\"%s\"", ptr); free(ptr);
-        ptr = vector_string(cli->c_languages); zprintf(f, ",\"c_languages\":\"%s\"", ptr); free(ptr);
-        ptr = vector_string(cli->s_languages); zprintf(f, ",\"s_languages\":\"%s\"", ptr); free(ptr);
+        if (cli->have_hassh) {
+            zprintf(f, ",\"hassh\":");
+            zprintf_raw_as_hex(f, cli->hassh, sizeof(cli->hassh));
+        }
+        if (!(hash_only && cli->have_hassh)) {
+            ptr = vector_string(&cli->kex_algos); zprintf(f, ",\"kex_algos\":\"%s\"", ptr); free(ptr);
+        }
+        ptr = vector_string(&cli->s_host_key_algos); zprintf(f, ",\"s_host_key_algos\":\"%s\"", ptr); free(ptr);
+        if (!(hash_only && cli->have_hassh)) {
+            ptr = vector_string(&cli->c_encryption_algos); zprintf(f, ",\"c_encryption_algos\":\"%s\"", ptr); free(ptr);
+        }
+        ptr = vector_string(&cli->s_encryption_algos); zprintf(f, ",\"s_encryption_algos\":\"%s\"", ptr); free(ptr);
+        if (!(hash_only && cli->have_hassh)) {
+            ptr = vector_string(&cli->c_mac_algos); zprintf(f, ",\"c_mac_algos\":\"%s\"", ptr); free(ptr);
+        }
+        ptr = vector_string(&cli->s_mac_algos); zprintf(f, ",\"s_mac_algos\":\"%s\"", ptr); free(ptr);
+        if (!(hash_only && cli->have_hassh)) {
+            ptr = vector_string(&cli->c_comp_algos); zprintf(f, ",\"c_comp_algos\":\"%s\"", ptr); free(ptr);
+        }
+        ptr = vector_string(&cli->s_comp_algos); zprintf(f, ",\"s_comp_algos\":\"%s\"", ptr); free(ptr);
+        ptr = vector_string(&cli->c_languages); zprintf(f, ",\"c_languages\":\"%s\"", ptr); free(ptr);
+        ptr = vector_string(&cli->s_languages); zprintf(f, ",\"s_languages\":\"%s\"", ptr); free(ptr);
         if (cli->kex_algo != NULL) {
         zprintf(f, ",\"kex_algo\":\"%s\"", cli->kex_algo);
         }
-        if (cli->c_kex->len > 0) {
+        if (cli->c_kex.len > 0) {
         zprintf(f, ",\"c_kex\":");
-        zprintf_raw_as_hex(f, (unsigned char*)cli->c_kex->bytes, cli->c_kex->len);
+        zprintf_raw_as_hex(f, (unsigned char*)cli->c_kex.bytes, cli->c_kex.len);
         }
         zprintf(f, ",\"newkeys\":\"%s\"", cli->newkeys? "true": "false");
         zprintf(f, ",\"unencrypted\":%d", cli->unencrypted);
@@ -931,38 +960,50 @@ void ssh_print_json(const struct ssh *x1,
             zprintf(f, ",\"cookie\":");
             zprintf_raw_as_hex(f, srv->cookie, sizeof(srv->cookie));
         }
-        ptr = vector_string(srv->kex_algos); zprintf(f, ",\"kex_algos\":\"%s\"", ptr); free(ptr);
-        ptr = vector_string(srv->s_host_key_algos); zprintf(f, ",\"s_host_key_algos\":\"%s\"", ptr); free(ptr);
-        ptr = vector_string(srv->c_encryption_algos); zprintf(f, ",\"c_encryption_algos\":\"%s\"", ptr); free(ptr);
-        ptr = vector_string(srv->s_encryption_algos); zprintf(f, ",\"s_encryption_algos\":\"%s\"", ptr); free(ptr);
-        ptr = vector_string(srv->c_mac_algos); zprintf(f, ",\"c_mac_algos\":\"%s\"", ptr); free(ptr);
-        ptr = vector_string(srv->s_mac_algos); zprintf(f, ",\"s_mac_algos\":\"%s\"", ptr); free(ptr);
-        ptr = vector_string(srv->c_comp_algos); zprintf(f, ",\"c_comp_algos\":\"%s\"", ptr); free(ptr);
-        ptr = vector_string(srv->s_comp_algos); zprintf(f, ",\"s_comp_algos\":\"%s\"", ptr); free(ptr);
-        ptr = vector_string(srv->c_languages); zprintf(f, ",\"c_languages\":\"%s\"", ptr); free(ptr);
-        ptr = vector_string(srv->s_languages); zprintf(f, ",\"s_languages\":\"%s\"", ptr); free(ptr);
-        if (srv->s_hostkey->len > 0) {
-        ptr = vector_string(srv->s_hostkey_type); zprintf(f, ",\"s_hostkey_type\":\"%s\"", ptr); free(ptr);
+        if (srv->have_hassh) {
+            zprintf(f, ",\"hassh_server\":");
+            zprintf_raw_as_hex(f, srv->hassh_server, sizeof(srv->hassh_server));
+        }
+        if (!(hash_only && srv->have_hassh)) {
+            ptr = vector_string(&srv->kex_algos); zprintf(f, ",\"kex_algos\":\"%s\"", ptr); free(ptr);
+        }
+        ptr = vector_string(&srv->s_host_key_algos); zprintf(f, ",\"s_host_key_algos\":\"%s\"", ptr); free(ptr);
+        ptr = vector_string(&srv->c_encryption_algos); zprintf(f, ",\"c_encryption_algos\":\"%s\"", ptr); free(ptr);
+        if (!(hash_only && srv->have_hassh)) {
+            ptr = vector_string(&srv->s_encryption_algos); zprintf(f, ",\"s_encryption_algos\":\"%s\"", ptr); free(ptr);
+        }
+        ptr = vector_string(&srv->c_mac_algos); zprintf(f, ",\"c_mac_algos\":\"%s\"", ptr); free(ptr);
+        if (!(hash_only && srv->have_hassh)) {
+            ptr = vector_string(&srv->s_mac_algos); zprintf(f, ",\"s_mac_algos\":\"%s\"", ptr); free(ptr);
+        }
+        ptr = vector_string(&srv->c_comp_algos); zprintf(f, ",\"c_comp_algos\":\"%s\"", ptr); free(ptr);
+        if (!(hash_only && srv->have_hassh)) {
+            ptr = vector_string(&srv->s_comp_algos); zprintf(f, ",\"s_comp_algos\":\"%s\"", ptr); free(ptr);
+        }
+        ptr = vector_string(&srv->c_languages); zprintf(f, ",\"c_languages\":\"%s\"", ptr); free(ptr);
+        ptr = vector_string(&srv->s_languages); zprintf(f, ",\"s_languages\":\"%s\"", ptr); free(ptr);
+        if (srv->s_hostkey.len > 0) {
+        ptr = vector_string(&srv->s_hostkey_type); zprintf(f, ",\"s_hostkey_type\":\"%s\"", ptr); free(ptr);
         zprintf(f, ",\"s_hostkey\":");
-        zprintf_raw_as_hex(f, (unsigned char*)srv->s_hostkey->bytes, srv->s_hostkey->len);
+        zprintf_raw_as_hex(f, (unsigned char*)srv->s_hostkey.bytes, srv->s_hostkey.len);
         }
-        if (srv->s_signature->len > 0) {
-        ptr = vector_string(srv->s_signature_type); zprintf(f, ",\"s_signature_type\":\"%s\"", ptr); free(ptr);
+        if (srv->s_signature.len > 0) {
+        ptr = vector_string(&srv->s_signature_type); zprintf(f, ",\"s_signature_type\":\"%s\"", ptr); free(ptr);
         zprintf(f, ",\"s_signature\":");
-        zprintf_raw_as_hex(f, (unsigned char*)srv->s_signature->bytes, srv->s_signature->len);
+        zprintf_raw_as_hex(f, (unsigned char*)srv->s_signature.bytes, srv->s_signature.len);
         }
         if (srv->kex_algo != NULL) {
         zprintf(f, ",\"kex_algo\":\"%s\"", srv->kex_algo);
         }
-        if (srv->s_kex->len > 0) {
+        if (srv->s_kex.len > 0) {
         zprintf(f, ",\"s_kex\":");
-        zprintf_raw_as_hex(f, (unsigned char*)srv->s_kex->bytes, srv->s_kex->len);
+        zprintf_raw_as_hex(f, (unsigned char*)srv->s_kex.bytes, srv->s_kex.len);
         }
-        if (srv->s_gex_p->len > 0 && srv->s_gex_g->len > 0) {
+        if (srv->s_gex_p.len > 0 && srv->s_gex_g.len > 0) {
         zprintf(f, ",\"s_gex_p\":");
-        zprintf_raw_as_hex(f, (unsigned char*)srv->s_gex_p->bytes, srv->s_gex_p->len);
+        zprintf_raw_as_hex(f, (unsigned char*)srv->s_gex_p.bytes, srv->s_gex_p.len);
         zprintf(f, ",\"s_gex_g\":");
-        zprintf_raw_as_hex(f, (unsigned char*)srv->s_gex_g->bytes, srv->s_gex_g->len);
+        zprintf_raw_as_hex(f, (unsigned char*)srv->s_gex_g.bytes, srv->s_gex_g.len);
         }
         zprintf(f, ",\"newkeys\":\"%s\"", srv->newkeys? "true": "false");
         zprintf(f, ",\"unencrypted\":%d", srv->unencrypted);
@@ -971,6 +1012,9 @@ void ssh_print_json(const struct ssh *x1,
     zprintf(f, "}");
 }
 
+/* the JSON of ssh is carried as text in CBOR output */
+define_print_text(ssh)
+
 /**
  *
  * \brief Delete the memory of SSH struct.
@@ -980,39 +1024,12 @@ void ssh_print_json(const struct ssh *x1,
  * \return none
  */
 void ssh_delete(struct ssh **ssh_handle) {
-    int i;
     struct ssh *ssh = *ssh_handle;
 
     if (ssh == NULL) {
         return;
     }
 
-    if (ssh->kex_algo != NULL) {
-        free(ssh->kex_algo);
-    }
-    vector_free(ssh->buffer);             free(ssh->buffer);
-    vector_free(ssh->kex_algos);          free(ssh->kex_algos);
-    vector_free(ssh->s_host_key_algos);   free(ssh->s_host_key_algos);
-    vector_free(ssh->c_encryption_algos); free(ssh->c_encryption_algos);
-    vector_free(ssh->s_encryption_algos); free(ssh->s_encryption_algos);
-    vector_free(ssh->c_mac_algos);        free(ssh->c_mac_algos);
-    vector_free(ssh->s_mac_algos);        free(ssh->s_mac_algos);
-    vector_free(ssh->c_comp_algos);       free(ssh->c_comp_algos);
-    vector_free(ssh->s_comp_algos);       free(ssh->s_comp_algos);
-    vector_free(ssh->c_languages);        free(ssh->c_languages);
-    vector_free(ssh->s_languages);        free(ssh->s_languages);
-    vector_free(ssh->s_hostkey_type);     free(ssh->s_hostkey_type);
-    vector_free(ssh->s_signature_type);   free(ssh->s_signature_type);
-    vector_free(ssh->c_kex);              free(ssh->c_kex);
-    vector_free(ssh->s_kex);              free(ssh->s_kex);
-    vector_free(ssh->s_hostkey);          free(ssh->s_hostkey);
-    vector_free(ssh->s_signature);        free(ssh->s_signature);
-    vector_free(ssh->s_gex_p);            free(ssh->s_gex_p);
-    vector_free(ssh->s_gex_g);            free(ssh->s_gex_g);
-    for (i = 0; i < MAX_SSH_KEX_MESSAGES; ++i) {
-        vector_free(ssh->kex_msgs[i].data); free(ssh->kex_msgs[i].data);
-    }
-
     /* Free the memory and set to NULL */
     free(ssh);
     *ssh_handle = NULL;
@@ -1020,6 +1037,7 @@ void ssh_delete(struct ssh **ssh_handle) {
 
 static int ssh_test_handshake() {
     struct ssh *cli = NULL;
+    joy_arena_t arena;
     struct ssh *srv = NULL;
     int num_fails = 0;
 
@@ -1470,17 +1488,29 @@ static int ssh_test_handshake() {
         0x00, 0x00, 0x00, 0x0c, 0x0a, 0x15, 0x00, 0x00,
         0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
 
-    ssh_init(&cli);
+    const unsigned char c_hassh[16] = { /* md5 of the client kex;enc;mac;comp lists */
+        0x0d, 0xf0, 0xd5, 0x6b, 0xb5, 0x0c, 0x6b, 0x24,
+        0x26, 0xd8, 0xd4, 0x02, 0x34, 0xbf, 0x18, 0x26 };
+    const unsigned char s_hassh[16] = { /* md5 of the server kex;enc;mac;comp lists */
+        0xba, 0x6d, 0x3d, 0x2a, 0xec, 0xbd, 0x0d, 0x91,
+        0xb0, 0x1d, 0xfa, 0x78, 0x28, 0x11, 0x0d, 0x70 };
+    unsigned int fingerprint_hash = glb_config->fingerprint_hash;
+
+    glb_config->fingerprint_hash = fingerprint_hash_add;
+
+    memset(&arena, 0, sizeof(arena));
+    ssh_init(&cli, &arena);
     ssh_update(cli, NULL, c_protocol, sizeof(c_protocol), 1);
     ssh_update(cli, NULL, c_kexinit, sizeof(c_kexinit), 1);
     ssh_update(cli, NULL, c_dhkex, sizeof(c_dhkex), 1);
     ssh_update(cli, NULL, c_newkeys, sizeof(c_newkeys), 1);
 
-    ssh_init(&srv);
+    ssh_init(&srv, &arena);
     ssh_update(srv, NULL, s_protocol, sizeof(s_protocol), 1);
     ssh_update(srv, NULL, s_kexinit, sizeof(s_kexinit), 1);
     ssh_update(srv, NULL, s_dhkex_newkeys, sizeof(s_dhkex_newkeys), 1);
     ssh_process(cli, srv);
+    glb_config->fingerprint_hash = fingerprint_hash;
 
     if (strcmp(cli->protocol, "SSH-2.0-OpenSSH_7.4p1 Debian-10") != 0) {
         joy_log_err("failure: cli protocol");
@@ -1512,8 +1542,19 @@ static int ssh_test_handshake() {
         num_fails++;
     }
 
+    if ( ! cli->have_hassh || memcmp(cli->hassh, c_hassh, sizeof(c_hassh)) != 0) {
+        joy_log_err("failure: cli hassh");
+        num_fails++;
+    }
+
+    if ( ! srv->have_hassh || memcmp(srv->hassh_server, s_hassh, sizeof(s_hassh)) != 0) {
+        joy_log_err("failure: srv hassh_server");
+        num_fails++;
+    }
+
     ssh_delete(&cli);
     ssh_delete(&srv);
+    joy_arena_release(&arena);
     return num_fails;
 }
 
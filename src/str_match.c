@@ -86,6 +86,147 @@ static void matches_add (struct matches *matches, size_t stop, size_t length) {
     // printf("adding match with start[%d]: %zu\tstop[%d]: %zu\tcount: %u\n", 
     //   i, start, i, stop, matches->count);
 }
+/**
+ * \fn str_match_ctx str_match_ctx_alloc (void)
+ * \return pointer to an empty, case insensitive string matching context
+ * \return NULL if the allocation failed
+ */
+str_match_ctx str_match_ctx_alloc (void) {
+    str_match_ctx ctx;
+
+    ctx = calloc(1, sizeof(struct str_match_ctx_));
+    if (ctx == NULL) {
+        return NULL;
+    }
+    ctx->acsm = acsm_alloc(NO_CASE);
+    if (ctx->acsm == NULL) {
+        free(ctx);
+        return NULL;
+    }
+    ctx->no_case = ctx->acsm->no_case;
+
+    return ctx;
+}
+
+/**
+ * \fn void str_match_ctx_free (str_match_ctx ctx)
+ * \param ctx matching context to free
+ * \return none
+ */
+void str_match_ctx_free (str_match_ctx ctx) {
+    if (ctx == NULL) {
+        return;
+    }
+    if (ctx->acsm != NULL) {
+        acsm_free(ctx->acsm);
+    }
+    free(ctx->next_state);
+    free(ctx->match_index);
+    free(ctx->match_len);
+    free(ctx);
+}
+
+/*
+ * str_match_ctx_compile() builds the Aho-Corasick automaton for the
+ * patterns added to the context, then flattens it into a dense DFA over
+ * byte classes.  The sparse automaton is freed afterwards; it needs one
+ * kilobyte per state, while the DFA needs four bytes per state and byte
+ * class.
+ */
+static int str_match_ctx_compile (str_match_ctx ctx) {
+    acsm_context_t *acsm = ctx->acsm;
+    acsm_pattern_t *p;
+    unsigned char used[256];
+    unsigned char rep[256];
+    unsigned int num_used = 0;
+    unsigned int num_matches = 0;
+    unsigned int i, c, s;
+    int t;
+    size_t k;
+
+    if (acsm == NULL || acsm_compile(acsm) != 0) {
+        return -1;
+    }
+
+    /*
+     * Bytes that occur in some pattern get their own class; all other
+     * bytes lead back to the root from every state, so they share
+     * class 0
+     */
+    memset(used, 0, sizeof(used));
+    memset(ctx->first_byte, 0, sizeof(ctx->first_byte));
+    for (p = acsm->patterns; p != NULL; p = p->next) {
+        for (k = 0; k < p->len; k++) {
+            used[p->string[k]] = 1;
+        }
+        if (p->len > 0) {
+            ctx->first_byte[p->string[0]] = 1;
+        }
+    }
+    for (i = 0; i < 256; i++) {
+        num_used += used[i];
+    }
+    ctx->num_classes = (num_used < 256) ? 1 : 0;
+    memset(ctx->byte_class, 0, sizeof(ctx->byte_class));
+    for (i = 0; i < 256; i++) {
+        if (used[i]) {
+            rep[ctx->num_classes] = (unsigned char)i;
+            ctx->byte_class[i] = (unsigned char)ctx->num_classes++;
+        }
+    }
+    if (ctx->no_case) {
+        /* the patterns are stored in lower case */
+        for (i = 'A'; i <= 'Z'; i++) {
+            ctx->byte_class[i] = ctx->byte_class[i | 0x20];
+            ctx->first_byte[i] = ctx->first_byte[i | 0x20];
+        }
+    }
+
+    /* resolve every transition, following fail links once, here */
+    ctx->num_states = acsm->num_state + 1;
+    ctx->next_state = calloc((size_t)ctx->num_states * ctx->num_classes, sizeof(uint32_t));
+    if (ctx->next_state == NULL) {
+        return -1;
+    }
+    for (s = 0; s < ctx->num_states; s++) {
+        for (c = (num_used < 256) ? 1 : 0; c < ctx->num_classes; c++) {
+            t = s;
+            while (acsm->state_table[t].next_state[rep[c]] == ACSM_FAIL_STATE) {
+                t = acsm->state_table[t].fail_state;
+            }
+            ctx->next_state[s * ctx->num_classes + c] = acsm->state_table[t].next_state[rep[c]];
+        }
+        for (p = acsm->state_table[s].match_list; p != NULL; p = p->next) {
+            num_matches++;
+        }
+    }
+
+    /* pattern lengths per state, in match list order */
+    ctx->match_index = calloc(ctx->num_states + 1, sizeof(uint32_t));
+    ctx->match_len = calloc(num_matches + 1, sizeof(size_t));
+    if (ctx->match_index == NULL || ctx->match_len == NULL) {
+        return -1;
+    }
+    num_matches = 0;
+    for (s = 0; s < ctx->num_states; s++) {
+        ctx->match_index[s] = num_matches;
+        for (p = acsm->state_table[s].match_list; p != NULL; p = p->next) {
+            ctx->match_len[num_matches++] = p->len;
+        }
+    }
+    ctx->match_index[ctx->num_states] = num_matches;
+
+    if (ctx->match_index[1] != 0) {
+        /* an empty pattern matches at the root, so no byte can be skipped */
+        memset(ctx->first_byte, 1, sizeof(ctx->first_byte));
+    }
+
+    acsm_free(acsm);
+    ctx->acsm = NULL;
+
+    return 0;
+}
+
 /**
  * \fn void str_match_ctx_find_all_longest (const str_match_ctx ctx, 
     const unsigned char *text, size_t len, struct matches *matches)
@@ -97,34 +238,37 @@ static void matches_add (struct matches *matches, size_t stop, size_t length) {
  */
 void str_match_ctx_find_all_longest (const str_match_ctx ctx, 
     const unsigned char *text, size_t len, struct matches *matches) {
-    static int state = 0;
+    const uint32_t *next_state = ctx->next_state;
+    unsigned int num_classes = ctx->num_classes;
+    uint32_t state = 0;
+    uint32_t i;
     const unsigned char *p;
     const unsigned char *last;
-    unsigned char ch;
   
     matches_init(matches);
+
+    if (next_state == NULL) {
+        return;   /* context has not been compiled */
+    }
   
     p = text;
     last = text + len;
   
     while (p < last) {
-        ch = ctx->no_case ? acsm_tolower((*p)) : (*p);
-    
-        while (ctx->state_table[state].next_state[ch] == ACSM_FAIL_STATE) {
-            state = ctx->state_table[state].fail_state;
+        if (state == 0) {
+            /* at the root, skip to the next byte that can start a pattern */
+            while (p < last && !ctx->first_byte[*p]) {
+                p++;
+            }
+            if (p == last) {
+                break;
+            }
         }
-    
-        state = ctx->state_table[state].next_state[ch];
-      
-        if (ctx->state_table[state].match_list) {      
-            acsm_pattern_t *pattern = ctx->state_table[state].match_list;
 
-            do {
-                    // printf("\nMATCH: %s\n", pattern->string);
-                    matches_add(matches, p - text, pattern->len);
-
-            } while ((pattern = pattern->next) != NULL);
+        state = next_state[state * num_classes + ctx->byte_class[*p]];
 
+        for (i = ctx->match_index[state]; i < ctx->match_index[state + 1]; i++) {
+            matches_add(matches, p - text, ctx->match_len[i]);
         }
     
         p++;
@@ -164,6 +308,11 @@ int str_match_ctx_init_from_file (str_match_ctx ctx,
     size_t len = 0;
     ssize_t read;
     joy_status_e err;
+
+    if (ctx->acsm == NULL) {
+        fprintf(stderr, "error: string matching context is already compiled\n");
+        return -1;
+    }
   
     fp = fopen(filename, "r");
     if (fp == NULL) {
@@ -191,7 +340,7 @@ int str_match_ctx_init_from_file (str_match_ctx ctx,
             }
       
             // printf("adding pattern \"%s\"\n", string);
-            if (acsm_add_pattern(ctx, (unsigned char *)string, acsm_strlen(string)) != 0) {
+            if (acsm_add_pattern(ctx->acsm, (unsigned char *)string, acsm_strlen(string)) != 0) {
                       fprintf(stderr, "acsm_add_pattern() with pattern \"%s\" error.\n", line);
                       return -1;
             }  
@@ -199,10 +348,127 @@ int str_match_ctx_init_from_file (str_match_ctx ctx,
     }
     free(line);
   
-    if (acsm_compile(ctx) != 0) {
-        fprintf(stderr, "acsm_compile() error.\n");
+    if (str_match_ctx_compile(ctx) != 0) {
+        fprintf(stderr, "str_match_ctx_compile() error.\n");
         return -1;
     }
 
     return 0;
 }
+
+/*
+ * unit test functions
+ */
+
+/*
+ * str_match_reference_find() runs the sparse Aho-Corasick automaton
+ * with its fail transitions, the way the matcher worked before the
+ * DFA; the unit test checks that both agree
+ */
+static void str_match_reference_find (acsm_context_t *acsm,
+    const unsigned char *text, size_t len, struct matches *matches) {
+    int state = 0;
+    size_t i;
+    unsigned char ch;
+    acsm_pattern_t *pattern;
+
+    matches_init(matches);
+    for (i = 0; i < len; i++) {
+        ch = acsm->no_case ? acsm_tolower(text[i]) : text[i];
+        while (acsm->state_table[state].next_state[ch] == ACSM_FAIL_STATE) {
+            state = acsm->state_table[state].fail_state;
+        }
+        state = acsm->state_table[state].next_state[ch];
+        for (pattern = acsm->state_table[state].match_list; pattern != NULL; pattern = pattern->next) {
+            matches_add(matches, i, pattern->len);
+        }
+    }
+}
+
+static int str_match_matches_equal (const struct matches *a, const struct matches *b) {
+    unsigned int i;
+
+    if (a->count != b->count) {
+        return 0;
+    }
+    for (i = 0; i < a->count; i++) {
+        if (a->start[i] != b->start[i] || a->stop[i] != b->stop[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * \fn int str_match_unit_test (void)
+ * \return 0 on success
+ * \return number of failures otherwise
+ */
+int str_match_unit_test (void) {
+    static const char *patterns[] = {
+        "scooby", "shaggy", "velma", "fred", "daphne", "rogers", "frogers",
+        "frogers2", "velmad", "vdinkey", "he", "she", "his", "hers", NULL
+    };
+    static const char *texts[] = {
+        "/root/shaggy/blahvelmablah/query?username=fred;subject=daphne;docname=blahscooby;alt=scoobyblah;path=velma",
+        "EXAMPLE TEXT WITH FROGERS2 BLAHvelmadBLAH BLAHvdinkey EXCELSIOR",
+        "ushers and his heirs; she hershe",
+        "no usernames in here at all, just bytes \x01\xff\x80",
+        "",
+        NULL
+    };
+    str_match_ctx ctx = NULL;
+    acsm_context_t *ref = NULL;
+    struct matches m1, m2;
+    const char **pp;
+    int num_fails = 0;
+
+    ctx = str_match_ctx_alloc();
+    ref = acsm_alloc(NO_CASE);
+    if (ctx == NULL || ref == NULL) {
+        fprintf(stderr, "str_match_unit_test: allocation failed\n");
+        num_fails++;
+        goto end;
+    }
+    for (pp = patterns; *pp != NULL; pp++) {
+        acsm_add_pattern(ctx->acsm, (u_char *)*pp, acsm_strlen(*pp));
+        acsm_add_pattern(ref, (u_char *)*pp, acsm_strlen(*pp));
+    }
+    if (str_match_ctx_compile(ctx) != 0 || acsm_compile(ref) != 0) {
+        fprintf(stderr, "str_match_unit_test: compile failed\n");
+        num_fails++;
+        goto end;
+    }
+
+    /* the DFA finds the same matches as the automaton it was built from */
+    for (pp = texts; *pp != NULL; pp++) {
+        str_match_ctx_find_all_longest(ctx, (const unsigned char *)*pp, strlen(*pp), &m1);
+        str_match_reference_find(ref, (const unsigned char *)*pp, strlen(*pp), &m2);
+        if (!str_match_matches_equal(&m1, &m2)) {
+            fprintf(stderr, "str_match_unit_test: DFA and automaton disagree on \"%s\"\n", *pp);
+            num_fails++;
+        }
+    }
+
+    /* known answer: "frogers2" is found case insensitively */
+    str_match_ctx_find_all_longest(ctx, (const unsigned char *)texts[1], strlen(texts[1]), &m1);
+    if (m1.count != 3 || m1.start[0] != 18 || m1.stop[0] != 25) {
+        fprintf(stderr, "str_match_unit_test: unexpected matches in \"%s\"\n", texts[1]);
+        num_fails++;
+    }
+
+    /* no state carries over from one search to the next */
+    str_match_ctx_find_all_longest(ctx, (const unsigned char *)"xxsh", 4, &m1);
+    str_match_ctx_find_all_longest(ctx, (const unsigned char *)"aggy", 4, &m1);
+    if (m1.count != 0) {
+        fprintf(stderr, "str_match_unit_test: match state leaked between searches\n");
+        num_fails++;
+    }
+
+ end:
+    str_match_ctx_free(ctx);
+    if (ref != NULL) {
+        acsm_free(ref);
+    }
+    return num_fails;
+}
@@ -58,6 +58,8 @@
 #include <openssl/asn1.h>
 #include <openssl/pem.h>
 #include <openssl/bio.h>
+#include <openssl/sha.h>
+#include <openssl/md5.h>
 #include "tls.h"
 #include "parson.h"
 #include "fingerprint.h"
@@ -82,29 +84,262 @@
 /* TLS mutex lock */
 pthread_mutex_t tls_lock = PTHREAD_MUTEX_INITIALIZER;
 
+/*
+ * Parsed certificates are kept in a bounded LRU cache keyed by the
+ * SHA-256 digest of their DER encoding, and shared by reference between
+ * flows; servers present the same chains over and over.  The cache and
+ * the certificate reference counts are protected by tls_lock.
+ */
+#define TLS_CERT_CACHE_SIZE 1024
+#define TLS_CERT_CACHE_BUCKETS 2048
+
+typedef struct tls_cert_cache_entry_ {
+    unsigned char digest[SHA256_DIGEST_LENGTH];
+    tls_certificate_t *cert;
+    struct tls_cert_cache_entry_ *chain; /**< Next entry in the hash bucket */
+    struct tls_cert_cache_entry_ *prev;  /**< More recently used */
+    struct tls_cert_cache_entry_ *next;  /**< Less recently used */
+} tls_cert_cache_entry_t;
+
+static struct {
+    tls_cert_cache_entry_t *bucket[TLS_CERT_CACHE_BUCKETS];
+    tls_cert_cache_entry_t *head; /**< Most recently used */
+    tls_cert_cache_entry_t *tail; /**< Least recently used */
+    unsigned int num_entries;
+    unsigned long hits;
+    unsigned long misses;
+} tls_cert_cache;
+
 /*
  * External objects, defined in joy.c
  */
 extern FILE *info;
 
-#if 0
 /* Store the tls_fingerprint.json data */
 static fingerprint_db_t tls_fingerprint_db;
 static int tls_fingerprint_db_loaded = 0;
-#endif
+
+/* Free list of scratch space for partial matches; protected by tls_lock */
+static fingerprint_scratch_t *tls_fingerprint_scratch = NULL;
 
 /* Local prototypes */
 static int tls_header_version_capture(tls_t *tls_info, const tls_header_t*tls_hdr);
-static void tls_certificate_print_json(const tls_certificate_t *data, zfile f);
+static void tls_certificate_print(const tls_certificate_t *data, emitter_t *e);
+
+/**
+ * \brief Drop a reference to a certificate, freeing it with the last one.
+ *
+ * \param cert certificate to release, may be NULL
+ *
+ * \note The caller holds tls_lock.
+ *
+ * \return
+ */
+static void tls_certificate_release (tls_certificate_t *cert) {
+    int j = 0;
+
+    if (cert == NULL || --cert->refcount) {
+        return;
+    }
+
+    if (cert->signature) {
+        /* Free the signature */
+        free(cert->signature);
+    }
+    if (cert->serial_number) {
+        /* Free the serial number */
+        free(cert->serial_number);
+    }
+    for (j = 0; j < cert->num_issuer_items; j++) {
+        /*
+         * Iterate over all the issuer entries.
+         */
+        tls_item_entry_t *entry = &cert->issuer[j];
+
+        if (entry->data) {
+            /* Free the entry data */
+                free(entry->data);
+        }
+    }
+    for (j = 0; j < cert->num_subject_items; j++) {
+        /*
+         * Iterate over all the subject entries.
+         */
+        tls_item_entry_t *entry = &cert->subject[j];
+
+        if (entry->data) {
+            /* Free the entry data */
+                free(entry->data);
+        }
+    }
+    for (j = 0; j < cert->num_extension_items; j++) {
+        /*
+         * Iterate over all the subject entries.
+         */
+        tls_item_entry_t *entry = &cert->extensions[j];
+
+        if (entry->data) {
+            /* Free the entry data */
+                free(entry->data);
+        }
+    }
+    if (cert->validity_not_before) {
+        free(cert->validity_not_before);
+    }
+    if (cert->validity_not_after) {
+        free(cert->validity_not_after);
+    }
+
+    free(cert);
+}
+
+/*
+ * Certificate cache; the caller holds tls_lock.
+ */
+
+static unsigned int tls_cert_cache_bucket (const unsigned char *digest) {
+    return (digest[0] | (digest[1] << 8) | (digest[2] << 16)) % TLS_CERT_CACHE_BUCKETS;
+}
+
+static void tls_cert_cache_unlink (tls_cert_cache_entry_t *e) {
+    if (e->prev) {
+        e->prev->next = e->next;
+    } else {
+        tls_cert_cache.head = e->next;
+    }
+    if (e->next) {
+        e->next->prev = e->prev;
+    } else {
+        tls_cert_cache.tail = e->prev;
+    }
+    e->prev = e->next = NULL;
+}
+
+static void tls_cert_cache_push_front (tls_cert_cache_entry_t *e) {
+    e->prev = NULL;
+    e->next = tls_cert_cache.head;
+    if (tls_cert_cache.head) {
+        tls_cert_cache.head->prev = e;
+    } else {
+        tls_cert_cache.tail = e;
+    }
+    tls_cert_cache.head = e;
+}
+
+static void tls_cert_cache_remove (tls_cert_cache_entry_t *e) {
+    tls_cert_cache_entry_t **link = &tls_cert_cache.bucket[tls_cert_cache_bucket(e->digest)];
+
+    while (*link != e) {
+        link = &(*link)->chain;
+    }
+    *link = e->chain;
+    tls_cert_cache_unlink(e);
+    tls_certificate_release(e->cert);
+    free(e);
+    tls_cert_cache.num_entries--;
+}
+
+/**
+ * \brief Find a parsed certificate in the cache.
+ *
+ * \param digest SHA-256 digest of the DER encoding
+ *
+ * \return the certificate with a reference added for the caller, or NULL
+ */
+static tls_certificate_t *tls_cert_cache_lookup (const unsigned char *digest) {
+    tls_cert_cache_entry_t *e = tls_cert_cache.bucket[tls_cert_cache_bucket(digest)];
+
+    for (; e; e = e->chain) {
+        if (memcmp(e->digest, digest, SHA256_DIGEST_LENGTH) == 0) {
+            if (e != tls_cert_cache.head) {
+                tls_cert_cache_unlink(e);
+                tls_cert_cache_push_front(e);
+            }
+            e->cert->refcount++;
+            tls_cert_cache.hits++;
+            return e->cert;
+        }
+    }
+    tls_cert_cache.misses++;
+    return NULL;
+}
+
+/**
+ * \brief Add a parsed certificate to the cache, evicting the least recently used.
+ *
+ * \param digest SHA-256 digest of the DER encoding
+ * \param cert certificate, which gains a reference held by the cache
+ *
+ * \return
+ */
+static void tls_cert_cache_insert (const unsigned char *digest, tls_certificate_t *cert) {
+    tls_cert_cache_entry_t *e = NULL;
+    unsigned int b = tls_cert_cache_bucket(digest);
+
+    e = calloc(1, sizeof(tls_cert_cache_entry_t));
+    if (e == NULL) {
+        joy_log_err("malloc failed");
+        return;
+    }
+    if (tls_cert_cache.num_entries >= TLS_CERT_CACHE_SIZE) {
+        tls_cert_cache_remove(tls_cert_cache.tail);
+    }
+
+    memcpy(e->digest, digest, SHA256_DIGEST_LENGTH);
+    e->cert = cert;
+    cert->refcount++;
+    e->chain = tls_cert_cache.bucket[b];
+    tls_cert_cache.bucket[b] = e;
+    tls_cert_cache_push_front(e);
+    tls_cert_cache.num_entries++;
+}
+
+/**
+ * \brief Report the certificate cache counters.
+ *
+ * \param hits number of certificates found in the cache
+ * \param misses number of certificates that were parsed
+ * \param entries number of certificates in the cache
+ *
+ * \return
+ */
+void tls_certificate_cache_stats (unsigned long *hits,
+                                  unsigned long *misses,
+                                  unsigned int *entries) {
+    pthread_mutex_lock(&tls_lock);
+    *hits = tls_cert_cache.hits;
+    *misses = tls_cert_cache.misses;
+    *entries = tls_cert_cache.num_entries;
+    pthread_mutex_unlock(&tls_lock);
+}
+
+/**
+ * \brief Empty the certificate cache.
+ *
+ * Certificates still referenced by flows stay valid until those flows
+ * are deleted.
+ *
+ * \return
+ */
+void tls_certificate_cache_cleanup (void) {
+    pthread_mutex_lock(&tls_lock);
+    while (tls_cert_cache.head) {
+        tls_cert_cache_remove(tls_cert_cache.head);
+    }
+    tls_cert_cache.hits = 0;
+    tls_cert_cache.misses = 0;
+    pthread_mutex_unlock(&tls_lock);
+}
 
 /**
  * \brief Initialize the memory of TLS struct.
  *
  * \param tls_handle contains tls structure to initialize
+ * \param arena arena of the flow record, backing the data of the structure
  *
  * \return
  */
-void tls_init (tls_t **tls_handle) {
+void tls_init (tls_t **tls_handle, joy_arena_t *arena) {
     if (*tls_handle != NULL) {
         tls_delete(tls_handle);
     }
@@ -115,6 +350,7 @@ void tls_init (tls_t **tls_handle) {
         joy_log_err("malloc failed");
         return;
     }
+    (*tls_handle)->arena = arena;
 }
 
 /**
@@ -125,80 +361,23 @@ void tls_init (tls_t **tls_handle) {
  * \return
  */
 void tls_delete (tls_t **tls_handle) {
-    int i, j = 0;
+    int i = 0;
     tls_t *r = *tls_handle;
 
     if (r == NULL) {
       return;
     }
 
-    if (r->sni) {
-        free(r->sni);
-    }
     if (r->handshake_buffer) {
         free(r->handshake_buffer);
     }
-    for (i=0; i<r->num_extensions; i++) {
-        if (r->extensions[i].data) {
-            free(r->extensions[i].data);
-        }
-    }
-    for (i=0; i<r->num_server_extensions; i++) {
-        if (r->server_extensions[i].data) {
-            free(r->server_extensions[i].data);
-        }
-    }
-
-    for (i = 0; i < r->num_certificates; i++) {
-        tls_certificate_t *cert = &r->certificates[i];
 
-        if (cert->signature) {
-            /* Free the signature */
-            free(cert->signature);
-        }
-        if (cert->serial_number) {
-            /* Free the serial number */
-            free(cert->serial_number);
-        }
-        for (j = 0; j < cert->num_issuer_items; j++) {
-            /*
-             * Iterate over all the issuer entries.
-             */
-            tls_item_entry_t *entry = &cert->issuer[j];
-
-            if (entry->data) {
-                /* Free the entry data */
-                    free(entry->data);
-            }
-        }
-        for (j = 0; j < cert->num_subject_items; j++) {
-            /*
-             * Iterate over all the subject entries.
-             */
-            tls_item_entry_t *entry = &cert->subject[j];
-
-            if (entry->data) {
-                /* Free the entry data */
-                    free(entry->data);
-            }
-        }
-        for (j = 0; j < cert->num_extension_items; j++) {
-            /*
-             * Iterate over all the subject entries.
-             */
-            tls_item_entry_t *entry = &cert->extensions[j];
-
-            if (entry->data) {
-                /* Free the entry data */
-                    free(entry->data);
-            }
-        }
-        if (cert->validity_not_before) {
-            free(cert->validity_not_before);
-        }
-        if (cert->validity_not_after) {
-            free(cert->validity_not_after);
+    if (r->num_certificates) {
+        pthread_mutex_lock(&tls_lock);
+        for (i = 0; i < r->num_certificates; i++) {
+            tls_certificate_release(r->certificates[i]);
         }
+        pthread_mutex_unlock(&tls_lock);
     }
 
     /* Free the memory and set to NULL */
@@ -389,17 +568,14 @@ static void tls_client_hello_get_extensions (const unsigned char *y,
     i = 0;
     while (len > 0) {
         if (raw_to_uint16(y) == 0) {
-            if (r->sni != NULL) {
-                free(r->sni);
-            }
             r->sni_length = raw_to_uint16(y+7)+1;
-            r->sni = malloc(r->sni_length);
+            r->sni = joy_arena_alloc(r->arena, r->sni_length);
             memset(r->sni, '\0', r->sni_length);
             memcpy(r->sni, y+9, r->sni_length-1);
 
             r->extensions[i].type = raw_to_uint16(y);
             r->extensions[i].length = raw_to_uint16(y+2);
-            r->extensions[i].data = malloc(r->extensions[i].length);
+            r->extensions[i].data = joy_arena_alloc(r->arena, r->extensions[i].length);
             memcpy(r->extensions[i].data, y+4, r->extensions[i].length);  
             r->num_extensions += 1;
             i += 1;
@@ -411,13 +587,10 @@ static void tls_client_hello_get_extensions (const unsigned char *y,
             continue;
         }
 
-        if (r->extensions[i].data != NULL) {
-            free(r->extensions[i].data);
-        }
         r->extensions[i].type = raw_to_uint16(y);
         r->extensions[i].length = raw_to_uint16(y+2);
         // should check if length is reasonable?
-        r->extensions[i].data = malloc(r->extensions[i].length);
+        r->extensions[i].data = joy_arena_alloc(r->arena, r->extensions[i].length);
         memcpy(r->extensions[i].data, y+4, r->extensions[i].length);
   
         r->num_extensions += 1;
@@ -429,6 +602,111 @@ static void tls_client_hello_get_extensions (const unsigned char *y,
     }
 }
 
+/** GREASE values (RFC 8701) are not part of the JA3 string */
+#define TLS_IS_GREASE(v) ((((v) & 0x0f0f) == 0x0a0a) && (((v) >> 8) == ((v) & 0xff)))
+
+/**
+ * \brief Feed one decimal value of a dash separated JA3 list to the hash.
+ */
+static void tls_ja3_update_value (MD5_CTX *ctx, unsigned int v, int *first) {
+    char buf[8];
+    int n;
+
+    n = snprintf(buf, sizeof(buf), *first ? "%u" : "-%u", v);
+    MD5_Update(ctx, buf, n);
+    *first = 0;
+}
+
+/**
+ * \brief Compute the JA3 hash of a ClientHello.
+ *
+ * The JA3 string is the decimal ClientHello version, ciphersuites,
+ * extension types, supported groups and EC point formats, with the
+ * lists joined by '-', the fields by ',', and GREASE values left out.
+ * It is hashed as it is produced, from the ciphersuites and extensions
+ * already extracted into \p r, so it is never materialized.
+ *
+ * \param y Pointer to the hello message body data.
+ * \param r tls structure that will be written into.
+ *
+ * \return
+ *
+ */
+static void tls_client_hello_get_ja3 (const unsigned char *y,
+                                      tls_t *r) {
+    const tls_extension_t *groups = NULL;
+    const tls_extension_t *formats = NULL;
+    MD5_CTX ctx;
+    char buf[8];
+    unsigned int i, len;
+    int first, n;
+
+    if (r->have_ja3 || !r->num_ciphersuites) {
+        return;
+    }
+
+    MD5_Init(&ctx);
+
+    n = snprintf(buf, sizeof(buf), "%u,", raw_to_uint16(y));
+    MD5_Update(&ctx, buf, n);
+
+    first = 1;
+    for (i = 0; i < r->num_ciphersuites; i++) {
+        if (!TLS_IS_GREASE(r->ciphersuites[i])) {
+            tls_ja3_update_value(&ctx, r->ciphersuites[i], &first);
+        }
+    }
+    MD5_Update(&ctx, ",", 1);
+
+    first = 1;
+    for (i = 0; i < r->num_extensions; i++) {
+        const tls_extension_t *ext = &r->extensions[i];
+
+        if (TLS_IS_GREASE(ext->type)) {
+            continue;
+        }
+        tls_ja3_update_value(&ctx, ext->type, &first);
+        if (ext->type == 10) {
+            groups = ext;
+        } else if (ext->type == 11) {
+            formats = ext;
+        }
+    }
+    MD5_Update(&ctx, ",", 1);
+
+    /* supported_groups: 2-byte list length, then 2-byte group ids */
+    first = 1;
+    if (groups && groups->length >= 2) {
+        len = raw_to_uint16(groups->data);
+        if (len > groups->length - 2u) {
+            len = groups->length - 2;
+        }
+        for (i = 0; i + 1 < len; i += 2) {
+            uint16_t group = raw_to_uint16(groups->data + 2 + i);
+
+            if (!TLS_IS_GREASE(group)) {
+                tls_ja3_update_value(&ctx, group, &first);
+            }
+        }
+    }
+    MD5_Update(&ctx, ",", 1);
+
+    /* ec_point_formats: 1-byte list length, then 1-byte formats */
+    first = 1;
+    if (formats && formats->length >= 1) {
+        len = formats->data[0];
+        if (len > formats->length - 1u) {
+            len = formats->length - 1;
+        }
+        for (i = 0; i < len; i++) {
+            tls_ja3_update_value(&ctx, formats->data[1 + i], &first);
+        }
+    }
+
+    MD5_Final(r->ja3, &ctx);
+    r->have_ja3 = 1;
+}
+
 static void tls_handshake_get_client_key_exchange (const tls_handshake_t *h,
                                                    int len,
                                                    tls_t *r) {
@@ -1097,9 +1375,73 @@ static int tls_x509_get_extensions(X509 *cert,
     return 0;
 }
 
+/**
+ * \brief Parse a single DER encoded certificate.
+ *
+ * \param data Pointer to the DER encoding.
+ * \param cert_len Length of the encoding in bytes.
+ *
+ * \return new certificate holding one reference, or NULL on allocation failure
+ *
+ */
+static tls_certificate_t *tls_certificate_parse_der(const unsigned char *data,
+                                                    uint16_t cert_len) {
+    tls_certificate_t *certificate = NULL;
+    const unsigned char *ptr_openssl = data;
+    X509 *x509_cert = NULL;
+
+    certificate = calloc(1, sizeof(tls_certificate_t));
+    if (certificate == NULL) {
+        joy_log_err("malloc failed");
+        return NULL;
+    }
+    certificate->refcount = 1;
+    certificate->length = cert_len;
+
+    /* Convert to OpenSSL X509 object */
+    x509_cert = d2i_X509(NULL, &ptr_openssl, (size_t)cert_len);
+
+    if (x509_cert == NULL) {
+        joy_log_warn("Failed cert conversion");
+        return certificate;
+    }
+
+    /* Get subject */
+    tls_x509_get_subject(x509_cert, certificate);
+
+    /* Get issuer */
+    tls_x509_get_issuer(x509_cert, certificate);
+
+    /* Get the validity notBefore and notAfter */
+    tls_x509_get_validity_period(x509_cert, certificate);
+
+    /* Get serial */
+    tls_x509_get_serial(x509_cert, certificate);
+
+    /* Get extensions */
+    tls_x509_get_extensions(x509_cert, certificate);
+
+    /* Get signature and signature algorithm*/
+    tls_x509_get_signature(x509_cert, certificate);
+
+    /* Get public-key info */
+    tls_x509_get_subject_pubkey_algorithm(x509_cert, certificate);
+
+    /*
+     * Cleanup
+     */
+    X509_free(x509_cert);
+    CRYPTO_cleanup_all_ex_data();
+
+    return certificate;
+}
+
 /**
  * \brief Parse a certificate chain.
  *
+ * Each certificate is looked up in the certificate cache by the digest
+ * of its DER encoding, and only parsed when it is not there.
+ *
  * \param data Pointer to the certificate message payload data.
  * \param data_len Length of the data in bytes.
  * \param r tls structure that will be written into.
@@ -1112,7 +1454,8 @@ static void tls_certificate_parse(const unsigned char *data,
                                   tls_t *r) {
 
     uint16_t total_certs_len = 0, remaining_certs_len,
-        cert_len, index_cert = 0;
+        cert_len = 0;
+    unsigned char digest[SHA256_DIGEST_LENGTH];
 
     /* Move past the all_certs_len */
     total_certs_len = raw_to_uint16(data + 1);
@@ -1133,8 +1476,6 @@ static void tls_certificate_parse(const unsigned char *data,
 
     while (0 < remaining_certs_len && remaining_certs_len <= total_certs_len) {
         tls_certificate_t *certificate = NULL;
-        const unsigned char *ptr_openssl = NULL;
-        X509 *x509_cert = NULL;
 
         if (r->num_certificates >= MAX_CERTIFICATES) {
             /*
@@ -1154,62 +1495,31 @@ static void tls_certificate_parse(const unsigned char *data,
             return;
         }
 
-        /* The index to retrieve the proper certificate record */
-        index_cert = r->num_certificates;
-        r->num_certificates += 1;
-
-        /* Point to the current certificate record */
-        certificate = &r->certificates[index_cert];
-        certificate->length = cert_len;
-
         /* Move past the cert_len */
         data += 3;
         remaining_certs_len -= 3;
 
         joy_log_debug("current certificate length: %d", cert_len);
 
-        ptr_openssl = data;
-        /* Convert to OpenSSL X509 object */
-        x509_cert = d2i_X509(NULL, &ptr_openssl, (size_t)cert_len);
-
-        if (x509_cert == NULL) {
-            joy_log_warn("Failed cert conversion");
-        } else {
-            /* Get subject */
-            tls_x509_get_subject(x509_cert, certificate);
-
-            /* Get issuer */
-            tls_x509_get_issuer(x509_cert, certificate);
-
-            /* Get the validity notBefore and notAfter */
-            tls_x509_get_validity_period(x509_cert, certificate);
-
-            /* Get serial */
-            tls_x509_get_serial(x509_cert, certificate);
-
-            /* Get extensions */
-            tls_x509_get_extensions(x509_cert, certificate);
-
-            /* Get signature and signature algorithm*/
-            tls_x509_get_signature(x509_cert, certificate);
-
-            /* Get public-key info */
-            tls_x509_get_subject_pubkey_algorithm(x509_cert, certificate);
+        SHA256(data, cert_len, digest);
+        certificate = tls_cert_cache_lookup(digest);
+        if (certificate == NULL) {
+            certificate = tls_certificate_parse_der(data, cert_len);
+            if (certificate == NULL) {
+                return;
+            }
+            tls_cert_cache_insert(digest, certificate);
         }
 
+        /* Hand the reference to the TLS record */
+        r->certificates[r->num_certificates] = certificate;
+        r->num_certificates += 1;
+
         /*
          * Skip to the next certificate
          */
         data += cert_len;
         remaining_certs_len -= cert_len;
-
-        /*
-         * Cleanup
-         */
-        if (x509_cert) {
-            X509_free(x509_cert);
-            CRYPTO_cleanup_all_ex_data();
-        }
     }
 }
 
@@ -1355,7 +1665,7 @@ static void tls_server_hello_get_extensions (const unsigned char *y,
         r->server_extensions[i].type = raw_to_uint16(y);
         r->server_extensions[i].length = raw_to_uint16(y+2);
         // should check if length is reasonable?
-        r->server_extensions[i].data = malloc(r->server_extensions[i].length);
+        r->server_extensions[i].data = joy_arena_alloc(r->arena, r->server_extensions[i].length);
         memcpy(r->server_extensions[i].data, y+4, r->server_extensions[i].length);
 
         r->num_server_extensions += 1;
@@ -1367,7 +1677,6 @@ static void tls_server_hello_get_extensions (const unsigned char *y,
     }
 }
 
-#if 0
 /*
  * @brief Load the tls_fingerprint.json data into the running process.
  *
@@ -1375,6 +1684,9 @@ static void tls_server_hello_get_extensions (const unsigned char *y,
  * which contains a known dataset that is used for TLS connection
  * fingerprinting.
  *
+ * Loading is done once per process; a missing file is not an error,
+ * it just leaves the fingerprint labels out of the output.
+ *
  * return 0 for success, 1 for failure
  */
 int tls_load_fingerprints(void) {
@@ -1390,10 +1702,19 @@ int tls_load_fingerprints(void) {
     const char *cipher_suite_str = NULL;
     const char *extension_str = NULL;
     size_t i = 0;
+    int missing = 0;
     int rc = 1;
 
+    if (tls_fingerprint_db_loaded) {
+        return 0;
+    }
+
     /* Parse the Json file and validate */
-    root_value = joy_utils_open_resource_parson("tls_fingerprint.json");
+    root_value = joy_utils_open_optional_resource_parson("tls_fingerprint.json", &missing);
+    if (missing) {
+        joy_log_info("no tls_fingerprint.json; TLS clients will not be labeled");
+        return 0;
+    }
     if (json_value_get_type(root_value) != JSONObject) {
         fprintf(stderr, "error: expected JSON object\n");
         goto cleanup;
@@ -1412,8 +1733,8 @@ int tls_load_fingerprints(void) {
      * Iterate through each individual library
      */
     for (i = 0; i < json_array_get_count(tls_libraries); i++) {
-        fingerprint_t fp_local;
-        fingerprint_t *fp_match = NULL;
+        unsigned char fp_local[MAX_FINGERPRINT_LEN];
+        uint16_t fp_len = 0;
         uint16_t cs_val = 0;
         uint16_t ext_val = 0;
         size_t cs_count = 0;
@@ -1437,67 +1758,27 @@ int tls_load_fingerprints(void) {
             goto cleanup;
         }
 
-        /* Prepare the local fingerprint for use */
-        memset(&fp_local, 0, sizeof(fingerprint_t));
-
-        /* Fill the local fingerprint buffer */
+        /* Fill the local fingerprint buffer, in network byte order */
         for (k = 0; k < cs_count; k++) {
             cipher_suite_str = json_value_get_string(json_array_get_value(cipher_suites, k));
             /* Convert the current hex string to a 2-byte value */
             sscanf(cipher_suite_str, "%hx", &cs_val);
-            /* Copy into the functions local fingerprint */
-            fp_local.fingerprint[fp_local.fingerprint_len] = cs_val;
-            fp_local.fingerprint_len += sizeof(uint16_t);
+            fp_local[fp_len++] = cs_val >> 8;
+            fp_local[fp_len++] = cs_val & 0xff;
         }
         for (k = 0; k < ext_count; k++) {
             extension_str = json_value_get_string(json_array_get_value(extensions, k));
             /* Convert the current hex string to a 2-byte value */
             sscanf(extension_str, "%hx", &ext_val);
-            /* Copy into the functions local fingerprint */
-            fp_local.fingerprint[fp_local.fingerprint_len] = ext_val;
-            fp_local.fingerprint_len += sizeof(uint16_t);
+            fp_local[fp_len++] = ext_val >> 8;
+            fp_local[fp_len++] = ext_val & 0xff;
         }
 
         /*
-         * Check if the fingerprint already exists in the database.
+         * Add the fingerprint, or the library name to the existing entry.
          */
-        fp_match = fingerprint_db_match_exact(&tls_fingerprint_db, &fp_local); 
-
-        if (fp_match != NULL) {
-            /*
-             * Found an existing fingerprint entry.
-             */
-            uint16_t label_count = fp_match->label_count;
-
-            if (label_count == (MAX_FINGERPRINT_LABELS - 1)) {
-                fprintf(stderr, "warning: tls_fingerprint_t is at max label capacity");
-            } else {
-                strncpy(fp_match->labels[label_count], lib_name_str,
-                        MAX_FINGERPRINT_LABEL_LEN);
-                fp_match->labels[label_count][MAX_FINGERPRINT_LABEL_LEN - 1] = '\0';
-                fp_match->label_count += 1;
-            }
-        } else {
-            /*
-             * This is a new fingerprint database entry.
-             */
-            uint16_t db_count = tls_fingerprint_db.fingerprint_count;
-            if (db_count < MAX_FINGERPRINT_DB) {
-                /* Copy the library name label into local fingerprint */
-                strncpy(fp_local.labels[0], lib_name_str,
-                        MAX_FINGERPRINT_LABEL_LEN);
-                fp_local.labels[0][MAX_FINGERPRINT_LABEL_LEN - 1] = '\0';
-                fp_local.label_count += 1;
-
-                /* Copy local fingerprint to the database */
-                fingerprint_copy(&tls_fingerprint_db.fingerprints[db_count],
-                                 &fp_local);
-
-                /* Increment database count */
-                tls_fingerprint_db.fingerprint_count += 1;
-            } else {
-                fprintf(stderr, "warning: tls_fingerprint_store is at max capacity");
-            }
+        if (fingerprint_db_add(&tls_fingerprint_db, fp_local, fp_len, lib_name_str) == NULL) {
+            goto cleanup;
         }
     }
 
@@ -1512,9 +1793,7 @@ cleanup:
 
     return rc;
 }
-#endif
 
-#if 0
 /*
  * @brief Find a client TLS fingerprint match.
  *
@@ -1534,11 +1813,12 @@ cleanup:
  */
 static int tls_client_fingerprint_match(tls_t *tls_info,
                                         unsigned int percent) {
-    fingerprint_t fp;
+    unsigned char fp[MAX_FINGERPRINT_LEN];
+    uint16_t fp_len = 0;
     fingerprint_t *db_fingerprint = NULL;
     uint16_t cs_count = 0;
     uint16_t ext_count = 0;
-    int i, k = 0;
+    int i = 0;
 
     if (!tls_fingerprint_db_loaded) {
         /* The fingerprint database is empty, bail out */
@@ -1549,56 +1829,51 @@ static int tls_client_fingerprint_match(tls_t *tls_info,
     cs_count = tls_info->num_ciphersuites;
     ext_count = tls_info->num_extensions;
 
-    /* Zero the temporary fp */
-    memset(&fp, 0, sizeof(fingerprint_t));
-
-    fp.fingerprint_len = (cs_count + ext_count) * sizeof(uint16_t);
-
-    if (fp.fingerprint_len > MAX_FINGERPRINT_LEN) {
+    if ((cs_count + ext_count) * sizeof(uint16_t) > MAX_FINGERPRINT_LEN) {
         joy_log_err("fingerprint too large, aborting");
         return 1;
     }
 
     /*
-     * Copy data into temporary fingerprint.
+     * Copy data into temporary fingerprint, in network byte order.
      */
-    if (cs_count) {
-        k = 0;
-        for (i = 0; i < cs_count; i++) {
-            /*
-             * Kinda weird because we're copying 2 bytes
-             * at a time into a raw byte buffer
-             */
-            memcpy(&fp.fingerprint[k],
-                   (unsigned char *)&tls_info->ciphersuites[i],
-                   sizeof(uint16_t));
-
-            k += sizeof(uint16_t);
-        }
+    for (i = 0; i < cs_count; i++) {
+        fp[fp_len++] = tls_info->ciphersuites[i] >> 8;
+        fp[fp_len++] = tls_info->ciphersuites[i] & 0xff;
     }
-    if (ext_count) {
-        /* Start just beyond the cs data */
-        int start_pos = cs_count * 2;
-        k = 0;
-        for (i = 0; i < ext_count; i ++) {
-            /*
-             * Kinda weird because we're copying 2 bytes
-             * at a time into a raw byte buffer
-             */
-            memcpy(&fp.fingerprint[k + start_pos],
-                   (unsigned char *)&tls_info->extensions[i].type,
-                   sizeof(uint16_t));
-
-            k += sizeof(uint16_t);
-        }
+    for (i = 0; i < ext_count; i++) {
+        fp[fp_len++] = tls_info->extensions[i].type >> 8;
+        fp[fp_len++] = tls_info->extensions[i].type & 0xff;
     }
 
     if (percent == 100) {
         /* Find an exact database fingerprint match */
-        db_fingerprint = fingerprint_db_match_exact(&tls_fingerprint_db, &fp);
+        db_fingerprint = fingerprint_db_match_exact(&tls_fingerprint_db, fp, fp_len);
     } else {
-        joy_log_err("partial matching not supported yet");
-        return 1;
+        /* Take a scratch from the free list, so that lookups do not allocate */
+        fingerprint_scratch_t *scratch = NULL;
+
+        pthread_mutex_lock(&tls_lock);
+        scratch = tls_fingerprint_scratch;
+        if (scratch) {
+            tls_fingerprint_scratch = scratch->next;
+        }
+        pthread_mutex_unlock(&tls_lock);
+        if (scratch == NULL) {
+            scratch = calloc(1, sizeof(fingerprint_scratch_t));
+            if (scratch == NULL) {
+                joy_log_err("malloc failed");
+                return 1;
+            }
+        }
+
+        /* Find the closest database fingerprint */
+        db_fingerprint = fingerprint_db_match_partial(&tls_fingerprint_db, scratch, fp, fp_len, percent);
+
+        pthread_mutex_lock(&tls_lock);
+        scratch->next = tls_fingerprint_scratch;
+        tls_fingerprint_scratch = scratch;
+        pthread_mutex_unlock(&tls_lock);
     }
 
     if (db_fingerprint != NULL) {
@@ -1608,7 +1883,6 @@ static int tls_client_fingerprint_match(tls_t *tls_info,
 
     return 0;
 }
-#endif
 
 static int tls_version_to_internal(unsigned char major,
                                    unsigned char minor) {
@@ -1797,12 +2071,13 @@ static void tls_handshake_buffer_parse(tls_t *r) {
                 r->role = role_client;
                 tls_client_hello_get_ciphersuites(&handshake->body, body_len, r);
                 tls_client_hello_get_extensions(&handshake->body, body_len, r);
+                if (glb_config->fingerprint_hash) {
+                    tls_client_hello_get_ja3(&handshake->body, r);
+                }
 
-#if 0
-                if (r->tls_fingerprint == NULL) {
-                    tls_client_fingerprint_match(r, 100);
+                if (glb_config->fingerprint_match && r->tls_fingerprint == NULL) {
+                    tls_client_fingerprint_match(r, glb_config->fingerprint_match);
                 }
-#endif
             }
             else if (handshake->msg_type == TLS_HANDSHAKE_SERVER_HELLO) {
                 /*
@@ -2047,99 +2322,71 @@ static int tls_header_version_capture (tls_t *tls_info,
     return 0;
 }
 
-static void zprintf_raw_as_hex_tls (zfile f, const unsigned char *data, unsigned int len) {
-    const unsigned char *x = data;
-    const unsigned char *end = data + len;
-
-    if (len > 1024) {
-        zprintf(f, "\"");   /* quotes needed for JSON */
-        zprintf(f, "\"");
+static void emit_hex_tls (emitter_t *e, const char *key, const unsigned char *data, unsigned int len) {
+    if (len > 1024 || data == NULL) { /* NULL is a special case for nfv9 TLS export */
+        emit_hex(e, key, NULL, 0);
         return;
     }
-
-    if (data == NULL) { /* special case for nfv9 TLS export */
-        zprintf(f, "\"");   /* quotes needed for JSON */
-        zprintf(f, "\"");
-        return ;
-    }
-  
-    zprintf(f, "\"");   /* quotes needed for JSON */
-    while (x < end) {
-        zprintf(f, "%02x", *x++);
-    }
-    zprintf(f, "\"");
+    emit_hex(e, key, data, len);
 }
 
 static void print_bytes_dir_time_tls(unsigned short int pkt_len, char *dir,
                                      struct timeval ts, tls_message_stat_t m,
-                                     char *term, zfile f) {
+                                     emitter_t *e) {
     int i = 0;
 
-    zprintf(f, "{\"b\":%u,\"dir\":\"%s\",\"ipt\":%u,\"tp\":%u",
-            pkt_len, dir, joy_timeval_to_milliseconds(ts), m.content_type);
+    emit_map_begin(e, NULL);
+    emit_uint(e, "b", pkt_len);
+    emit_string(e, "dir", dir, strlen(dir));
+    emit_uint(e, "ipt", joy_timeval_to_milliseconds(ts));
+    emit_uint(e, "tp", m.content_type);
 
     if (m.num_handshakes) {
         /*
          * Print handshake information
          */
-        zprintf(f, ",\"hs_types\":[");
+        emit_array_begin(e, "hs_types");
         for (i = 0; i < m.num_handshakes; i++) {
-            if (i == (m.num_handshakes - 1)) {
-                zprintf(f, "%u]", m.handshake_types[i]);
-            } else {
-                zprintf(f, "%u,", m.handshake_types[i]);
-            }
+            emit_uint(e, NULL, m.handshake_types[i]);
         }
-        zprintf(f, ",\"hs_lens\":[");
+        emit_array_end(e);
+        emit_array_begin(e, "hs_lens");
         for (i = 0; i < m.num_handshakes; i++) {
-            if (i == (m.num_handshakes - 1)) {
-                zprintf(f, "%u]", m.handshake_lens[i]);
-            } else {
-                zprintf(f, "%u,", m.handshake_lens[i]);
-            }
+            emit_uint(e, NULL, m.handshake_lens[i]);
         }
+        emit_array_end(e);
     }
 
     /* Close the object */
-    zprintf(f, "}%s", term);
+    emit_map_end(e);
 }
 
 static void len_time_print_interleaved_tls (unsigned int op, const unsigned short *len, 
     const struct timeval *time, const tls_message_stat_t *msg_stat,
     unsigned int op2, const unsigned short *len2, 
-    const struct timeval *time2, const tls_message_stat_t *msg_stat2, zfile f) {
+    const struct timeval *time2, const tls_message_stat_t *msg_stat2, emitter_t *e) {
     unsigned int i, j, imax, jmax;
     struct timeval ts, ts_last, ts_start, tmp;
     unsigned int pkt_len;
     char *dir;
     tls_message_stat_t stat;
 
-    zprintf(f, ",\"srlt\":[");
+    emit_array_begin(e, "srlt");
 
     if (len2 == NULL) {
       
         ts_start = *time;
 
         imax = op > NUM_PKT_LEN_TLS ? NUM_PKT_LEN_TLS : op;
-        if (imax == 0) { 
-            ; /* no packets had data, so we print out nothing */
-        } else {
-            for (i = 0; i < imax-1; i++) {
-                    if (i > 0) {
-                        joy_timer_sub(&time[i], &time[i-1], &ts);
-                    } else {
-                        joy_timer_clear(&ts);
-                    }
-                    print_bytes_dir_time_tls(len[i], OUT, ts, msg_stat[i], ",", f);
-            }
-            if (i == 0) {        /* this code could be simplified */    
-                    joy_timer_clear(&ts);  
+        /* if no packets had data, we print out nothing */
+        for (i = 0; i < imax; i++) {
+            if (i > 0) {
+                joy_timer_sub(&time[i], &time[i-1], &ts);
             } else {
-                    joy_timer_sub(&time[i], &time[i-1], &ts);
+                joy_timer_clear(&ts);
             }
-            print_bytes_dir_time_tls(len[i], OUT, ts, msg_stat[i], "", f);
+            print_bytes_dir_time_tls(len[i], OUT, ts, msg_stat[i], e);
         }
-        zprintf(f, "]"); 
     } else {
 
         if (joy_timer_lt(time, time2)) {
@@ -2187,14 +2434,11 @@ static void len_time_print_interleaved_tls (unsigned int op, const unsigned shor
                     }
             }
             joy_timer_sub(&ts, &ts_last, &tmp);
-            print_bytes_dir_time_tls(pkt_len, dir, tmp, stat, "", f);
+            print_bytes_dir_time_tls(pkt_len, dir, tmp, stat, e);
             ts_last = ts;
-            if (!((i == imax) & (j == jmax))) { /* we are done */
-                    zprintf(f, ",");
-            }
         }
-        zprintf(f, "]");
     }
+    emit_array_end(e);
 }
 
 /**
@@ -2237,13 +2481,13 @@ static const char *tls_extension_lookup(const unsigned short int type)
 static void tls_print_extensions(const tls_extension_t *extensions,
                                  unsigned short int count,
                                  joy_role_e role,
-                                 zfile f) {
+                                 emitter_t *e) {
     int i = 0;
 
     if (role == role_client) {
-        zprintf(f, ",\"c_extensions\":[");
+        emit_array_begin(e, "c_extensions");
     } else if (role == role_server) {
-        zprintf(f, ",\"s_extensions\":[");
+        emit_array_begin(e, "s_extensions");
     } else {
         joy_log_err("unknown role is not permitted");
         return;
@@ -2252,39 +2496,46 @@ static void tls_print_extensions(const tls_extension_t *extensions,
     for (i = 0; i < count; i++) {
         const char *type_str = NULL;
 
+        emit_map_begin(e, NULL);
         type_str = tls_extension_lookup(extensions[i].type);
         if (type_str) {
-            zprintf(f, "{\"%s\":", type_str);
-            zprintf_raw_as_hex_tls(f, extensions[i].data, extensions[i].length);
-            zprintf(f, "}");
+            emit_hex_tls(e, type_str, extensions[i].data, extensions[i].length);
         } else {
             /* The type is unknown */
-            zprintf(f, "{\"kind\":%u", extensions[i].type);
-                zprintf(f, ",\"data\":");
-            zprintf_raw_as_hex_tls(f, extensions[i].data, extensions[i].length);
-            zprintf(f, "}");
+            emit_uint(e, "kind", extensions[i].type);
+            emit_hex_tls(e, "data", extensions[i].data, extensions[i].length);
         }
+        emit_map_end(e);
+    }
+    emit_array_end(e);
+}
 
-        if (i == (count - 1)) {
-            zprintf(f, "]");
-        } else {
-            zprintf(f, ",");
-        }
+/* the certificates of one side, as an array named key */
+static void tls_print_certificates(const tls_t *data, const char *key, emitter_t *e) {
+    int i = 0;
+
+    emit_array_begin(e, key);
+    for (i = 0; i < data->num_certificates; i++) {
+        tls_certificate_print(data->certificates[i], e);
     }
+    emit_array_end(e);
 }
 
 /**
- * \brief Print the TLS struct to JSON output file \p f.
+ * \brief Print the TLS struct through the emitter \p e.
  *
  * \param data pointer to TLS information structure
  * \param data_twin pointer to twin TLS information structure
- * \param f destination file for the output
+ * \param e emitter that the output goes to
  *
  * \return none
  */
-void tls_print_json (const tls_t *data,
-                     const tls_t *data_twin,
-                     zfile f) {
+void tls_print (const tls_t *data,
+                const tls_t *data_twin,
+                emitter_t *e) {
+    char hex[8];
+    const tls_t *client = NULL;
+    int hash_only = 0;
     int i = 0;
 
     if (data == NULL) {
@@ -2301,7 +2552,7 @@ void tls_print_json (const tls_t *data,
         return;
     }
 
-    zprintf(f, ",\"tls\":{");
+    emit_map_begin(e, "tls");
 
     /*
      * Assign the versions according to role.
@@ -2309,25 +2560,28 @@ void tls_print_json (const tls_t *data,
      * i.e. both client or both server
      */
     if (data->role == role_client) {
-        zprintf(f, "\"c_version\":%u", data->version);
+        emit_uint(e, "c_version", data->version);
         if (data_twin && data_twin->version) {
             if (data_twin->role == role_client) {
-                zprintf(f, ",\"error\":\"twin clients\"}");
+                emit_string(e, "error", "twin clients", 12);
+                emit_map_end(e);
                 return;
             }
-            zprintf(f, ",\"s_version\":%u", data->version);
+            emit_uint(e, "s_version", data->version);
         }
     } else if (data->role == role_server) {
-        zprintf(f, "\"s_version\":%u", data->version);
+        emit_uint(e, "s_version", data->version);
         if (data_twin && data_twin->version) {
             if (data_twin->role == role_server) {
-                zprintf(f, ",\"error\":\"twin servers\"}");
+                emit_string(e, "error", "twin servers", 12);
+                emit_map_end(e);
                 return;
             }
-            zprintf(f, ",\"c_version\":%u", data->version);
+            emit_uint(e, "c_version", data->version);
         }
     } else {
-        zprintf(f, "\"error\":\"no role\"}");
+        emit_string(e, "error", "no role", 7);
+        emit_map_end(e);
         return;
     }
 
@@ -2335,32 +2589,26 @@ void tls_print_json (const tls_t *data,
      * Client key length
      */
     if (data->client_key_length) {
-        zprintf(f, ",\"c_key_length\":%u", data->client_key_length);
-        zprintf(f, ",\"c_key_exchange\":");
-        zprintf_raw_as_hex_tls(f, data->clientKeyExchange, data->client_key_length/8);
+        emit_uint(e, "c_key_length", data->client_key_length);
+        emit_hex_tls(e, "c_key_exchange", data->clientKeyExchange, data->client_key_length/8);
     } else if (data_twin && data_twin->client_key_length) {
-        zprintf(f, ",\"c_key_length\":%u", data_twin->client_key_length);
-        zprintf(f, ",\"c_key_exchange\":");
-        zprintf_raw_as_hex_tls(f, data_twin->clientKeyExchange, data_twin->client_key_length/8);
+        emit_uint(e, "c_key_length", data_twin->client_key_length);
+        emit_hex_tls(e, "c_key_exchange", data_twin->clientKeyExchange, data_twin->client_key_length/8);
     }
 
     /*
      * TLS Random
      */
     if (data->role == role_client) {
-        zprintf(f, ",\"c_random\":");
-        zprintf_raw_as_hex_tls(f, data->random, 32);
+        emit_hex_tls(e, "c_random", data->random, 32);
         if (data_twin) {
-            zprintf(f, ",\"s_random\":");
-            zprintf_raw_as_hex_tls(f, data_twin->random, 32);
+            emit_hex_tls(e, "s_random", data_twin->random, 32);
         }
     }
     else {
-        zprintf(f, ",\"s_random\":");
-        zprintf_raw_as_hex_tls(f, data->random, 32);
+        emit_hex_tls(e, "s_random", data->random, 32);
         if (data_twin) {
-            zprintf(f, ",\"c_random\":");
-            zprintf_raw_as_hex_tls(f, data_twin->random, 32);
+            emit_hex_tls(e, "c_random", data_twin->random, 32);
         }
     }
 
@@ -2369,18 +2617,14 @@ void tls_print_json (const tls_t *data,
      */
     if (data->sid_len) {
         if (data->role == role_client) {
-            zprintf(f, ",\"c_sid\":");
-            zprintf_raw_as_hex_tls(f, data->sid, data->sid_len);
+            emit_hex_tls(e, "c_sid", data->sid, data->sid_len);
             if (data_twin && data_twin->sid_len) {
-                zprintf(f, ",\"s_sid\":");
-                zprintf_raw_as_hex_tls(f, data_twin->sid, data_twin->sid_len);
+                emit_hex_tls(e, "s_sid", data_twin->sid, data_twin->sid_len);
             }
         } else {
-            zprintf(f, ",\"s_sid\":");
-            zprintf_raw_as_hex_tls(f, data->sid, data->sid_len);
+            emit_hex_tls(e, "s_sid", data->sid, data->sid_len);
             if (data_twin && data_twin->sid_len) {
-                zprintf(f, ",\"c_sid\":");
-                zprintf_raw_as_hex_tls(f, data_twin->sid, data_twin->sid_len);
+                emit_hex_tls(e, "c_sid", data_twin->sid, data_twin->sid_len);
             }
         }
     }
@@ -2389,10 +2633,28 @@ void tls_print_json (const tls_t *data,
      * Server Name Indicator
      */
     if (data->sni_length) {
-        zprintf(f, ",\"sni\":[\"%s\"]", (char *)data->sni);
+        emit_array_begin(e, "sni");
+        emit_string(e, NULL, (char *)data->sni, strlen((char *)data->sni));
+        emit_array_end(e);
     }
     else if (data_twin && data_twin->sni_length) {
-        zprintf(f, ",\"sni\":[\"%s\"]", (char *)data_twin->sni);
+        emit_array_begin(e, "sni");
+        emit_string(e, NULL, (char *)data_twin->sni, strlen((char *)data_twin->sni));
+        emit_array_end(e);
+    }
+
+    /*
+     * Client fingerprint hash; in hash-only mode it stands in for the
+     * offered ciphersuites and extensions
+     */
+    if (data->role == role_client) {
+        client = data;
+    } else if (data_twin && data_twin->role == role_client) {
+        client = data_twin;
+    }
+    if (client && client->have_ja3) {
+        emit_hex_tls(e, "ja3", client->ja3, sizeof(client->ja3));
+        hash_only = (glb_config->fingerprint_hash == fingerprint_hash_only);
     }
 
     /*
@@ -2400,105 +2662,81 @@ void tls_print_json (const tls_t *data,
      */
     if (data->role == role_client) {
         if (data_twin && data_twin->num_ciphersuites == 1) {
-            zprintf(f, ",\"scs\":\"%04x\"", data_twin->ciphersuites[0]);
+            emit_string(e, "scs", hex, snprintf(hex, sizeof(hex), "%04x", data_twin->ciphersuites[0]));
         }
 
-        if (data->num_ciphersuites) {
-            zprintf(f, ",\"cs\":[");
-            for (i = 0; i < data->num_ciphersuites-1; i++) {
-                zprintf(f, "\"%04x\",", data->ciphersuites[i]);
+        if (data->num_ciphersuites && !hash_only) {
+            emit_array_begin(e, "cs");
+            for (i = 0; i < data->num_ciphersuites; i++) {
+                emit_string(e, NULL, hex, snprintf(hex, sizeof(hex), "%04x", data->ciphersuites[i]));
             }
-            zprintf(f, "\"%04x\"]", data->ciphersuites[i]);
+            emit_array_end(e);
         }
     } else {
         if (data->num_ciphersuites == 1) {
-            zprintf(f, ",\"scs\":\"%04x\"", data->ciphersuites[0]);
+            emit_string(e, "scs", hex, snprintf(hex, sizeof(hex), "%04x", data->ciphersuites[0]));
         }
 
-        if (data_twin && data_twin->num_ciphersuites) {
-            zprintf(f, ",\"cs\":[");
-            for (i = 0; i < data_twin->num_ciphersuites-1; i++) {
-                zprintf(f, "\"%04x\",", data_twin->ciphersuites[i]);
+        if (data_twin && data_twin->num_ciphersuites && !hash_only) {
+            emit_array_begin(e, "cs");
+            for (i = 0; i < data_twin->num_ciphersuites; i++) {
+                emit_string(e, NULL, hex, snprintf(hex, sizeof(hex), "%04x", data_twin->ciphersuites[i]));
             }
-            zprintf(f, "\"%04x\"]", data_twin->ciphersuites[i]);
+            emit_array_end(e);
         }
     }
   
     /*
      * Extensions
      */
-    if (data->num_extensions && data->role == role_client) {
+    if (hash_only) {
+        /* the client extensions are covered by ja3 */
+    } else if (data->num_extensions && data->role == role_client) {
         tls_print_extensions(data->extensions,
                              data->num_extensions,
-                             role_client, f);
+                             role_client, e);
     }  
     else if (data_twin && data_twin->num_extensions && data_twin->role == role_client) {
         tls_print_extensions(data_twin->extensions,
                              data_twin->num_extensions,
-                             role_client, f);
+                             role_client, e);
     }
   
     if (data->num_server_extensions && data->role == role_server) {
         tls_print_extensions(data->server_extensions,
                              data->num_server_extensions,
-                             role_server, f);
+                             role_server, e);
     }  
     else if (data_twin && data_twin->num_server_extensions && data_twin->role == role_server) {
         tls_print_extensions(data_twin->server_extensions,
                              data_twin->num_server_extensions,
-                             role_server, f);
+                             role_server, e);
 
     }
 
     if (data->tls_fingerprint) {
-        zprintf(f, ",\"fingerprint_labels\":[");
+        emit_array_begin(e, "fingerprint_labels");
         for (i = 0; i < data->tls_fingerprint->label_count; i++) {
-                zprintf(f, "\"%s\"", data->tls_fingerprint->labels[i]);
-            if (i == (data->tls_fingerprint->label_count - 1)) {
-                zprintf(f, "]");
-            } else {
-                zprintf(f, ", ");
-            }
+            const char *label = data->tls_fingerprint->labels[i];
+
+            emit_string(e, NULL, label, strlen(label));
         }
+        emit_array_end(e);
     }
 
     if (data->role == role_client) {
         if (data->num_certificates) {
-            zprintf(f, ",\"c_cert\":[");
-            for (i = 0; i < data->num_certificates-1; i++) {
-                tls_certificate_print_json(&data->certificates[i], f);
-                zprintf(f, "},");
-            }
-            tls_certificate_print_json(&data->certificates[i], f);
-            zprintf(f, "}]");
+            tls_print_certificates(data, "c_cert", e);
         }
         if (data_twin && data_twin->num_certificates) {
-            zprintf(f, ",\"s_cert\":[");
-            for (i = 0; i < data_twin->num_certificates-1; i++) {
-                tls_certificate_print_json(&data_twin->certificates[i], f);
-                zprintf(f, "},");
-            }
-            tls_certificate_print_json(&data_twin->certificates[i], f);
-            zprintf(f, "}]");
+            tls_print_certificates(data_twin, "s_cert", e);
         }
     } else {
         if (data->num_certificates) {
-            zprintf(f, ",\"s_cert\":[");
-            for (i = 0; i < data->num_certificates-1; i++) {
-                tls_certificate_print_json(&data->certificates[i], f);
-                zprintf(f, "},");
-            }
-            tls_certificate_print_json(&data->certificates[i], f);
-            zprintf(f, "}]");
+            tls_print_certificates(data, "s_cert", e);
         }
         if (data_twin && data_twin->num_certificates) {
-            zprintf(f, ",\"c_cert\":[");
-            for (i = 0; i < data_twin->num_certificates-1; i++) {
-                tls_certificate_print_json(&data_twin->certificates[i], f);
-                zprintf(f, "},");
-            }
-            tls_certificate_print_json(&data_twin->certificates[i], f);
-            zprintf(f, "}]");
+            tls_print_certificates(data_twin, "c_cert", e);
         }
     }
 
@@ -2506,103 +2744,107 @@ void tls_print_json (const tls_t *data,
     if (data->op) {
         if (data_twin) {
                 len_time_print_interleaved_tls(data->op, data->lengths, data->times, data->msg_stats,
-                                       data_twin->op, data_twin->lengths, data_twin->times, data_twin->msg_stats, f);
+                                       data_twin->op, data_twin->lengths, data_twin->times, data_twin->msg_stats, e);
         } else {
             /*
              * unidirectional TLS does not typically happen, but if it
              * does, we need to pass in zero/NULLs, since there is no twin
              */
-                len_time_print_interleaved_tls(data->op, data->lengths, data->times, data->msg_stats, 0, NULL, NULL, NULL, f);
+                len_time_print_interleaved_tls(data->op, data->lengths, data->times, data->msg_stats, 0, NULL, NULL, NULL, e);
         }
     }
 
-    zprintf(f, "}");
+    emit_map_end(e);
 }
 
 /**
- * \brief Print the contents of a TLS certificate to compressed JSON output.
+ * \brief Print the TLS struct to JSON output file \p f.
  *
- * \param data pointer to TLS certificate structure
+ * \param data pointer to TLS information structure
+ * \param data_twin pointer to twin TLS information structure
  * \param f destination file for the output
  *
- * \return
- *
+ * \return none
  */
-static void tls_certificate_print_json(const tls_certificate_t *data, zfile f) {
+define_print_json(tls)
+
+/* the items of a certificate name or of its extensions, as an array named key */
+static void tls_certificate_print_items(const char *key,
+                                        const tls_item_entry_t *items,
+                                        unsigned short int count,
+                                        emitter_t *e) {
     int j = 0;
 
-    zprintf(f, "{\"length\":%i", data->length);
+    emit_array_begin(e, key);
+    for (j = 0; j < count; j++) {
+        emit_map_begin(e, NULL);
+        emit_key(e, items[j].id, strlen(items[j].id));
+        emit_string(e, NULL, (char *)items[j].data, strlen((char *)items[j].data));
+        emit_map_end(e);
+    }
+    emit_array_end(e);
+}
+
+/**
+ * \brief Print the contents of a TLS certificate through an emitter.
+ *
+ * \param data pointer to TLS certificate structure
+ * \param e emitter that the output goes to
+ *
+ * \return
+ *
+ */
+static void tls_certificate_print(const tls_certificate_t *data, emitter_t *e) {
+    emit_map_begin(e, NULL);
+    emit_int(e, "length", data->length);
     if (data->serial_number) {
-        zprintf(f, ",\"serial_number\":");
-        zprintf_raw_as_hex_tls(f, data->serial_number, data->serial_number_length);
+        emit_hex_tls(e, "serial_number", data->serial_number, data->serial_number_length);
     }
     
     if (data->signature) {
-        zprintf(f, ",\"signature\":");
-        zprintf_raw_as_hex_tls(f, data->signature, data->signature_length);
+        emit_hex_tls(e, "signature", data->signature, data->signature_length);
     }
 
     if (*data->signature_algorithm) {
-        zprintf(f, ",\"signature_algo\":\"%s\"", data->signature_algorithm);
+        emit_string(e, "signature_algo", data->signature_algorithm, strlen(data->signature_algorithm));
     }
 
     if (data->signature_key_size) {
-        zprintf(f, ",\"signature_key_size\":%i", data->signature_key_size);
+        emit_int(e, "signature_key_size", data->signature_key_size);
     }
     
     if (data->num_issuer_items) {
-        zprintf(f, ",\"issuer\":[");
-        for (j = 0; j < data->num_issuer_items; j++) {
-                zprintf(f, "{\"%s\":\"%s\"}", data->issuer[j].id, (char *)data->issuer[j].data);
-            if (j == (data->num_issuer_items - 1)) {
-                zprintf(f, "]");
-            } else {
-                zprintf(f, ",");
-            }
-        }
+        tls_certificate_print_items("issuer", data->issuer, data->num_issuer_items, e);
     }
 
     if (data->num_subject_items) {
-        zprintf(f, ",\"subject\":[");
-        for (j = 0; j < data->num_subject_items; j++) {
-                zprintf(f, "{\"%s\":\"%s\"}", data->subject[j].id, (char *)data->subject[j].data);
-            if (j == (data->num_subject_items - 1)) {
-                zprintf(f, "]");
-            } else {
-                zprintf(f, ",");
-            }
-        }
+        tls_certificate_print_items("subject", data->subject, data->num_subject_items, e);
     }
 
     if (data->num_extension_items) {
-        zprintf(f, ",\"extensions\":[");
-        for (j = 0; j < data->num_extension_items; j++) {
-            zprintf(f, "{\"%s\":\"%s\"}", data->extensions[j].id, (char *)data->extensions[j].data);
-            if (j == (data->num_extension_items - 1)) {
-                zprintf(f, "]");
-            } else {
-                zprintf(f, ",");
-            }
-        }
+        tls_certificate_print_items("extensions", data->extensions, data->num_extension_items, e);
     }
     
     if (data->validity_not_before) {
-        zprintf(f, ",\"validity_not_before\":\"%s\"", data->validity_not_before);
+        emit_string(e, "validity_not_before", (char *)data->validity_not_before,
+                    strlen((char *)data->validity_not_before));
     }
     if (data->validity_not_after) {
-        zprintf(f, ",\"validity_not_after\":\"%s\"", data->validity_not_after);
+        emit_string(e, "validity_not_after", (char *)data->validity_not_after,
+                    strlen((char *)data->validity_not_after));
     }
     
     if (*data->subject_public_key_algorithm) {
-        zprintf(f, ",\"subject_public_key_algo\":\"%s\"", data->subject_public_key_algorithm);
+        emit_string(e, "subject_public_key_algo", data->subject_public_key_algorithm,
+                    strlen(data->subject_public_key_algorithm));
     }
     
     if (data->subject_public_key_size) {
-        zprintf(f, ",\"subject_public_key_size\":%i", data->subject_public_key_size);
+        emit_int(e, "subject_public_key_size", data->subject_public_key_size);
     }
+    emit_map_end(e);
 }
 
-#if 0
 /*
  * \brief Unit test for ts_client_fingerprint_match().
  *
@@ -2610,9 +2852,11 @@ static void tls_certificate_print_json(const tls_certificate_t *data, zfile f) {
  */
 static int tls_test_client_fingerprint_match() {
     tls_t *record = NULL;
+    joy_arena_t arena;
     int num_fails = 0;
 
-    tls_init(&record);
+    memset(&arena, 0, sizeof(arena));
+    tls_init(&record, &arena);
 
     record->num_ciphersuites = 20;
     record->num_extensions = 1;
@@ -2648,11 +2892,20 @@ static int tls_test_client_fingerprint_match() {
         num_fails++;
     }
 
+    /* Without the extension, 20 of the 21 values are shared */
+    record->tls_fingerprint = NULL;
+    record->num_extensions = 0;
+    tls_client_fingerprint_match(record, 90);
+    if (record->tls_fingerprint == NULL) {
+        joy_log_err("could not partially match known fingerprint");
+        num_fails++;
+    }
+
     tls_delete(&record);
+    joy_arena_release(&arena);
 
     return num_fails;
 }
-#endif
 
 /*
  * \brief Test the internal TLS X509 certificate parsing api.
@@ -2670,12 +2923,16 @@ static int tls_test_certificate_parsing() {
         FILE *fp = NULL;
         X509 *cert = NULL;
         tls_t *tmp_tls_record = NULL;
+        joy_arena_t arena;
         tls_certificate_t *cert_record = NULL;
         const char *filename = test_cert_filenames[i];
 
         /* Preprare the temporary record */
-        tls_init(&tmp_tls_record);
-        cert_record = &tmp_tls_record->certificates[0];
+        memset(&arena, 0, sizeof(arena));
+        tls_init(&tmp_tls_record, &arena);
+        cert_record = calloc(1, sizeof(tls_certificate_t));
+        cert_record->refcount = 1;
+        tmp_tls_record->certificates[0] = cert_record;
         tmp_tls_record->num_certificates++;
 
         fp = joy_utils_open_test_file(filename);
@@ -3157,6 +3414,7 @@ end_loop:
             fclose(fp);
         }
         tls_delete(&tmp_tls_record);
+        joy_arena_release(&arena);
     }
 
     return num_fails;
@@ -3206,12 +3464,14 @@ static int tls_test_extract_client_hello(const unsigned char *data,
                                          unsigned int data_len,
                                          char *filename) {
     tls_t *record = NULL;
+    joy_arena_t arena;
     const tls_header_t*tls_hdr = NULL;
     const unsigned char *body = NULL;
     unsigned int body_len = 0;
     int num_fails = 0;
 
-    tls_init(&record);
+    memset(&arena, 0, sizeof(arena));
+    tls_init(&record, &arena);
 
     tls_hdr = (const tls_header_t*)data;
     body_len = tls_handshake_get_length(&tls_hdr->handshake);
@@ -3238,6 +3498,9 @@ static int tls_test_extract_client_hello(const unsigned char *data,
 
         uint16_t known_ciphersuites[] = {49195, 49199, 52393, 52392, 49196, 49200, 49162, 49161,
                                                49171, 49172, 51, 57, 47, 53, 10};
+        /* md5 of "771,49195-...-10,0-23-65281-10-11-35-16-5-18-65283-13,29-23-24-25,0" */
+        unsigned char known_ja3[] = {0x4e, 0x66, 0xf5, 0xad, 0x78, 0xf3, 0xd9, 0xad,
+                                     0x8d, 0x5c, 0x7c, 0x88, 0xd1, 0x38, 0xdb, 0x43};
 
         unsigned char kat_data_0[] = {0x00, 0x13, 0x00, 0x00, 0x10, 0x77, 0x77, 0x77,
                                       0x2e, 0x66, 0x61, 0x63, 0x65, 0x62, 0x6f, 0x6f,
@@ -3344,6 +3607,12 @@ static int tls_test_extract_client_hello(const unsigned char *data,
             }
         }
 
+        tls_client_hello_get_ja3(body, record);
+        if (!record->have_ja3 || memcmp(known_ja3, record->ja3, sizeof(known_ja3))) {
+            joy_log_err("ja3 does not match")
+            failed = 1;
+        }
+
         if (failed) {
             joy_log_err("fail, tls_test_extract_client_hello - %s", filename);
             num_fails++;
@@ -3353,6 +3622,7 @@ static int tls_test_extract_client_hello(const unsigned char *data,
 end:
     /* Cleanup */
     tls_delete(&record);
+    joy_arena_release(&arena);
 
     return num_fails;
 }
@@ -3361,12 +3631,14 @@ static int tls_test_extract_server_hello(const unsigned char *data,
                                          unsigned int data_len,
                                          const char *filename) {
     tls_t *record = NULL;
+    joy_arena_t arena;
     const tls_header_t*tls_hdr = NULL;
     const unsigned char *body = NULL;
     unsigned int body_len = 0;
     int num_fails = 0;
 
-    tls_init(&record);
+    memset(&arena, 0, sizeof(arena));
+    tls_init(&record, &arena);
 
     tls_hdr = (const tls_header_t*)data;
     body_len = tls_handshake_get_length(&tls_hdr->handshake);
@@ -3462,6 +3734,7 @@ static int tls_test_extract_server_hello(const unsigned char *data,
 end:
     /* Cleanup */
     tls_delete(&record);
+    joy_arena_release(&arena);
 
     return num_fails;
 }
@@ -3511,6 +3784,7 @@ end:
  */
 static int tls_test_handshake_hello_get_version() {
     tls_t *record = NULL;
+    joy_arena_t arena;
     unsigned char ssl_v3[] = {0x03, 0x00};
     unsigned char tls_1_0[] = {0x03, 0x01};
     unsigned char tls_1_1[] = {0x03, 0x02};
@@ -3518,7 +3792,8 @@ static int tls_test_handshake_hello_get_version() {
     unsigned char tls_1_3[] = {0x03, 0x04};
     int num_fails = 0;
 
-    tls_init(&record);
+    memset(&arena, 0, sizeof(arena));
+    tls_init(&record, &arena);
 
     tls_handshake_hello_get_version(record, ssl_v3);
     if (record->version != TLS_VERSION_SSLV3) {
@@ -3551,6 +3826,7 @@ static int tls_test_handshake_hello_get_version() {
     }
 
     tls_delete(&record);
+    joy_arena_release(&arena);
 
     return num_fails;
 }
@@ -3599,15 +3875,107 @@ static int tls_test_calculate_handshake_length() {
     return num_fails;
 }
 
+/*
+ * \brief Unit test for the certificate cache.
+ *
+ * The same certificate is parsed twice in one chain and again in a
+ * second record; all three must share one cached copy.
+ *
+ * \return 0 for success, otherwise number of failures
+ */
+static int tls_test_certificate_cache() {
+    const char *filename = "dummy_cert_rsa2048.pem";
+    unsigned char msg[8192];
+    unsigned char *der = NULL;
+    unsigned long hits, misses, hits_before, misses_before;
+    unsigned int entries, msg_len, total;
+    tls_t *r1 = NULL, *r2 = NULL;
+    joy_arena_t arena;
+    X509 *cert = NULL;
+    FILE *fp = NULL;
+    int der_len = 0;
+    int num_fails = 0;
+    int i = 0;
+
+    fp = joy_utils_open_test_file(filename);
+    if (!fp) {
+        joy_log_err("unable to open %s", filename);
+        return 1;
+    }
+    cert = PEM_read_X509(fp, NULL, NULL, NULL);
+    fclose(fp);
+    if (!cert) {
+        joy_log_err("could not convert %s PEM into X509", filename);
+        return 1;
+    }
+    der_len = i2d_X509(cert, &der);
+    X509_free(cert);
+    if (der_len <= 0 || 3 + 2 * (3 + der_len) > sizeof(msg)) {
+        joy_log_err("could not encode %s as DER", filename);
+        OPENSSL_free(der);
+        return 1;
+    }
+
+    /* Certificate message with the same certificate twice */
+    total = 2 * (3 + der_len);
+    msg[0] = 0;
+    msg[1] = total >> 8;
+    msg[2] = total & 0xff;
+    msg_len = 3;
+    for (i = 0; i < 2; i++) {
+        msg[msg_len++] = 0;
+        msg[msg_len++] = der_len >> 8;
+        msg[msg_len++] = der_len & 0xff;
+        memcpy(msg + msg_len, der, der_len);
+        msg_len += der_len;
+    }
+    OPENSSL_free(der);
+
+    memset(&arena, 0, sizeof(arena));
+    tls_init(&r1, &arena);
+    tls_init(&r2, &arena);
+    tls_certificate_cache_stats(&hits_before, &misses_before, &entries);
+
+    pthread_mutex_lock(&tls_lock);
+    tls_certificate_parse(msg, msg_len, r1);
+    tls_certificate_parse(msg, msg_len, r2);
+    pthread_mutex_unlock(&tls_lock);
+
+    tls_certificate_cache_stats(&hits, &misses, &entries);
+
+    if (r1->num_certificates != 2 || r2->num_certificates != 2) {
+        joy_log_err("fail, expected 2 certificates per record");
+        num_fails++;
+    } else if (r1->certificates[0] != r1->certificates[1] ||
+               r1->certificates[0] != r2->certificates[0]) {
+        joy_log_err("fail, certificates not shared through the cache");
+        num_fails++;
+    } else if (r1->certificates[0]->refcount != 5 ||
+               r1->certificates[0]->num_subject_items == 0) {
+        joy_log_err("fail, cached certificate refcount %u",
+                    r1->certificates[0]->refcount);
+        num_fails++;
+    }
+    if (misses - misses_before != 1 || hits - hits_before != 3) {
+        joy_log_err("fail, cache hits %lu misses %lu (expected 3, 1)",
+                    hits - hits_before, misses - misses_before);
+        num_fails++;
+    }
+
+    tls_delete(&r1);
+    joy_arena_release(&arena);
+    tls_delete(&r2);
+
+    return num_fails;
+}
+
 void tls_unit_test() {
     int num_fails = 0;
 
-#if 0
     if (tls_fingerprint_db_loaded == 0) {
         /* Attempt to load in the TLS fingerprints for testing */
         tls_load_fingerprints();
     }
-#endif
 
     fprintf(info, "\n******************************\n");
     fprintf(info, "TLS Unit Test starting...\n");
@@ -3616,14 +3984,14 @@ void tls_unit_test() {
 
     num_fails += tls_test_calculate_handshake_length();
 
-#if 0
     num_fails += tls_test_client_fingerprint_match();
-#endif
 
     num_fails += tls_test_initial_handshake();
 
     num_fails += tls_test_certificate_parsing();
 
+    num_fails += tls_test_certificate_cache();
+
     if (num_fails) {
         fprintf(info, "Finished - # of failures: %d\n", num_fails);
     } else {
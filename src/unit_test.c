@@ -48,6 +48,22 @@
 #include "config.h"
 #include "err.h"
 #include "joy_api.h"
+#include "proto_identify.h"
+#include "fingerprint.h"
+#include "arena.h"
+#include "snapshot.h"
+#include "classify.h"
+#include "ensemble.h"
+#include "str_match.h"
+#include "anon.h"
+#include "output.h"
+#include "arrow_output.h"
+#include "cbor_output.h"
+#include "emitter.h"
+#include "shm_output.h"
+#include "query.h"
+#include "merge.h"
+#include "upload.h"
 
 /**
  * \fn int main (int argc, char *argv[]) 
@@ -83,6 +99,86 @@ int main (int argc, char *argv[]) {
     /* Test p2f.c */
     p2f_unit_test();
 
+    /* Test proto_identify.c */
+    proto_identify_unit_test();
+
+    /* Test fingerprint.c */
+    fingerprint_unit_test();
+
+    /* Test arena.c */
+    joy_arena_unit_test();
+
+    /* Test snapshot.c */
+    joy_snapshot_unit_test();
+
+    /* Test classify.c */
+    classify_unit_test();
+
+    /* Test ensemble.c */
+    ensemble_unit_test();
+
+    /* Test str_match.c */
+    if (str_match_unit_test() != 0) {
+        printf("error: str_match test failed\n");
+    } else {
+        printf("str_match tests passed\n");
+    }
+
+    /* Test anon.c */
+    if (anon_unit_test() != 0) {
+        printf("error: anon test failed\n");
+    } else {
+        printf("anon tests passed\n");
+    }
+
+    /* Test output.c */
+    if (output_unit_test() != 0) {
+        printf("error: output test failed\n");
+    } else {
+        printf("output tests passed\n");
+    }
+
+    /* Test arrow_output.c */
+    arrow_unit_test();
+
+    /* Test cbor_output.c */
+    if (cbor_unit_test() != 0) {
+        printf("error: cbor test failed\n");
+    } else {
+        printf("cbor tests passed\n");
+    }
+
+    /* Test emitter.c */
+    if (emitter_unit_test() != 0) {
+        printf("error: emitter test failed\n");
+    } else {
+        printf("emitter tests passed\n");
+    }
+
+    /* Test shm_output.c */
+    if (shm_unit_test() != 0) {
+        printf("error: shm test failed\n");
+    } else {
+        printf("shm tests passed\n");
+    }
+
+    /* Test query.c */
+    if (query_unit_test() != 0) {
+        printf("error: query test failed\n");
+    } else {
+        printf("query tests passed\n");
+    }
+
+    /* Test merge.c */
+    if (merge_unit_test() != 0) {
+        printf("error: merge test failed\n");
+    } else {
+        printf("merge tests passed\n");
+    }
+
+    /* Test upload.c */
+    upload_unit_test();
+
     /* Test all feature modules */
     unit_test_all_features(feature_list);
   
@@ -95,6 +95,9 @@ static unsigned char splt_classifier_md5[MD5_DIGEST_LENGTH];
 /** Classifier digest of the BD values */
 static unsigned char bd_classifier_md5[MD5_DIGEST_LENGTH];
 
+/** Classifier digest of the tree ensemble */
+static unsigned char ensemble_md5[MD5_DIGEST_LENGTH];
+
 /** Most recent MD5 digest computed */
 static unsigned char md5_digest_result[MD5_DIGEST_LENGTH];
 
@@ -311,16 +314,23 @@ static upd_return_codes_e dnload_classifier_file (char *url, char *filename) {
     }
 }
 
+/*
+ * Frees a radix trie that is no longer published.
+ */
+static void updater_trie_free (void *rt) {
+    radix_trie_free(rt);
+}
+
 /*
  * Main radix trie updating function.
  *    Reads in new subnet addresses and creates a new radix trie.
- *    Locks the mutex and swaps the pointers on the active radix trie.
- *    Release the mutex and then frees up the old radix trie.
+ *    Publishes it as the labeled subnets snapshot; the old radix trie
+ *    is freed once no packet processing context can still hold it.
  */
 static upd_return_codes_e update_radix_trie ()
 {
-    radix_trie_t tmp_rt;
     attr_flags flag_malware;
+    long version;
     char *configfile = BLACKLIST_FILE_NAME;
     joy_status_e err;
 
@@ -354,21 +364,24 @@ static upd_return_codes_e update_radix_trie ()
         radix_trie_free(updater_trie);
         return upd_failure;
     }
+
+    /* build the lookup tables before the trie goes live */
+    err = radix_trie_compile(updater_trie);
+    if (err != ok) {
+        loginfo("error: could not compile radix_trie\n");
+        radix_trie_free(updater_trie);
+        return upd_failure;
+    }
  
     /* ok we have fully built new radix trie, let's put it into action */
 
-    /* swap tree pointers */
-    pthread_mutex_lock(&radix_trie_lock);
-    tmp_rt = glb_config->rt;
-    glb_config->rt = updater_trie;
+    /*
+     * publish the new trie; the old one is freed once the packet
+     * processing contexts no longer hold it
+     */
+    version = joy_snapshot_publish(&glb_config->labels, updater_trie, updater_trie_free);
     updater_trie = NULL;
-    pthread_mutex_unlock(&radix_trie_lock);
-
-    /* now free up the old radix_trie */
-    err = radix_trie_free(tmp_rt);
-    if (err != ok) {
-        loginfo("error: could not free memory for old radix_trie. Potential memory leak.\n");
-    }
+    loginfo("published labeled subnets version %ld\n", version);
   
     /* successful update */
     return upd_success;
@@ -389,6 +402,7 @@ void *updater_main (void *ptr)
     char params_bd[LINEMAX];
     int num = 0;
     int update_classifiers = 0;
+    int update_ensemble_file = 0;
     int update_labels = 0;
     struct configuration *config = ptr;
 
@@ -396,6 +410,7 @@ void *updater_main (void *ptr)
     memset(blacklist_md5, 0x00, MD5_DIGEST_LENGTH);
     memset(splt_classifier_md5, 0x00, MD5_DIGEST_LENGTH);
     memset(bd_classifier_md5, 0x00, MD5_DIGEST_LENGTH);
+    memset(ensemble_md5, 0x00, MD5_DIGEST_LENGTH);
 
     /* check for labeling */
     if (config->label_url) {
@@ -419,6 +434,12 @@ void *updater_main (void *ptr)
             loginfo("Classifiers are not configured for continous updating!\n");
     }
 
+    /* check for remote tree ensemble updates */
+    if (config->params_url && config->ensemble_file) {
+        loginfo("Ensemble is configured for continous updating!\n");
+        update_ensemble_file = 1;
+    }
+
     /* initialize the curl library as we need it for downloading updates */
     if (curl_global_init(CURL_GLOBAL_ALL)) {
         loginfo("error: curl init failed\n");
@@ -474,6 +495,27 @@ void *updater_main (void *ptr)
             }
         }
 
+        /* check for tree ensemble updates */
+        if (update_ensemble_file) {
+            if (dnload_classifier_file(config->params_url, config->ensemble_file) == upd_success) {
+                if (!is_digest_same(md5_digest_result, ensemble_md5)) {
+                   loginfo("Ensemble is different, updating\n");
+                   if (update_ensemble(config->ensemble_file) == ok) {
+                       save_new_md5(md5_digest_result, ensemble_md5);
+                   } else {
+                       loginfo("error: could not load ensemble, keeping the one in use\n");
+                   }
+                } else {
+                   loginfo("Ensemble is the same, no work to do\n");
+                }
+            } else {
+                loginfo("error: Ensemble download failed, no work to do\n");
+            }
+        }
+
+        /* free the data of earlier updates that the contexts have let go of */
+        joy_snapshot_reclaim();
+
         pthread_mutex_unlock(&work_in_process);
 #ifdef WIN32
 		Sleep(UPDATER_WORK_INTERVAL);
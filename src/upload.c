@@ -0,0 +1,1095 @@
+/*
+ *
+ * Copyright (c) 2018 Cisco Systems, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ *
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file upload.c
+ *
+ * \brief Upload of the rotated output files to a storage server
+ *
+ * The queue is a list of jobs, guarded by one lock, from which each
+ * worker takes the first job that is not waiting for a retry.  The
+ * journal records a line "+ name" when a file is queued and "- name"
+ * once it is done with, whether it was sent or given up on; it is
+ * rewritten with only the files still waiting when the uploader
+ * starts, and emptied whenever the queue runs dry.  A file that was
+ * being sent when joy stopped has no "-" line, and so is sent again.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "upload.h"
+#include "config.h"
+#include "err.h"
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#endif
+
+/*
+ * External objects, defined in joy.c
+ */
+extern FILE *info;
+
+#ifndef WIN32
+extern char **environ;
+#endif
+
+/** largest number of transports that can be registered */
+#define UPLOAD_MAX_TRANSPORTS 8
+
+/** bytes copied at a time by the dir transport */
+#define UPLOAD_COPY_SIZE (256 * 1024)
+
+/** longest line in the journal */
+#define UPLOAD_MAX_LINE 4096
+
+/* a file in the queue */
+typedef struct upload_job_ {
+    struct upload_job_ *next;
+    char *filename;
+    unsigned int attempts;        /* failed attempts so far */
+    time_t not_before;            /* when it may be tried again */
+} upload_job_t;
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int running;
+    int stopping;
+    upload_options_t opt;         /* strings owned by the uploader */
+    const upload_transport_t *transport;
+    const char *target;           /* opt.destination without the prefix */
+    FILE *journal;
+    upload_job_t *head;
+    upload_job_t *tail;
+    unsigned int num_workers;
+    pthread_t worker[UPLOAD_MAX_WORKERS];
+    upload_transfer_t *transfer[UPLOAD_MAX_WORKERS]; /* NULL when idle */
+    upload_stats_t stats;
+} uploader = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+static int upload_scp_send(upload_transfer_t *x);
+static int upload_rsync_send(upload_transfer_t *x);
+static int upload_dir_send(upload_transfer_t *x);
+
+static const upload_transport_t upload_scp = { "scp", upload_scp_send };
+static const upload_transport_t upload_rsync = { "rsync", upload_rsync_send };
+static const upload_transport_t upload_dir = { "dir", upload_dir_send };
+
+static const upload_transport_t *transports[UPLOAD_MAX_TRANSPORTS] = {
+    &upload_scp, &upload_rsync, &upload_dir
+};
+
+/**
+ * \brief Add a transport, or replace the one with the same name.
+ *
+ * \param transport Transport, which has to outlive the uploader
+ *
+ * \return ok, or failure when there is no room for it
+ */
+int upload_register_transport (const upload_transport_t *transport) {
+    unsigned int i;
+
+    for (i = 0; i < UPLOAD_MAX_TRANSPORTS; i++) {
+        if (transports[i] == NULL || !strcmp(transports[i]->name, transport->name)) {
+            transports[i] = transport;
+            return ok;
+        }
+    }
+    return failure;
+}
+
+/* the transport for destination, and in *target what follows its prefix */
+static const upload_transport_t *upload_find_transport (const char *destination,
+                                                        const char **target) {
+    const char *colon = strchr(destination, ':');
+    unsigned int i;
+
+    if (colon != NULL) {
+        for (i = 0; i < UPLOAD_MAX_TRANSPORTS && transports[i]; i++) {
+            if (strlen(transports[i]->name) == (size_t)(colon - destination) &&
+                !strncmp(transports[i]->name, destination, colon - destination)) {
+                *target = colon + 1;
+                return transports[i];
+            }
+        }
+    }
+    *target = destination;
+    return &upload_scp;
+}
+
+/* seconds to wait after the attempts-th failure */
+static unsigned int upload_retry_delay (const upload_options_t *opt, unsigned int attempts) {
+    unsigned long delay = opt->retry_delay;
+
+    while (--attempts && delay < opt->max_retry_delay) {
+        delay *= 2;
+    }
+    return delay < opt->max_retry_delay ? delay : opt->max_retry_delay;
+}
+
+static double upload_now (void) {
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/*
+ * -------------------------------------------------------
+ * Transports
+ * -------------------------------------------------------
+ */
+
+/**
+ * \brief Run a command that performs a transfer, and wait for it.
+ *
+ * The command is run directly, not by a shell, with its standard
+ * input on /dev/null.  It is terminated when the uploader stops.
+ *
+ * \param transfer Transfer the command is for
+ * \param argv Arguments, ending with NULL; argv[0] is looked up in PATH
+ *
+ * \return ok if the command succeeded, failure otherwise
+ */
+int upload_run_command (upload_transfer_t *transfer, char *const argv[]) {
+#ifdef WIN32
+    char cmd[UPLOAD_MAX_LINE];
+    size_t len = 0;
+    unsigned int i;
+
+    for (i = 0; argv[i] && len < sizeof(cmd); i++) {
+        len += snprintf(cmd + len, sizeof(cmd) - len, i ? " \"%s\"" : "%s", argv[i]);
+    }
+    if (len >= sizeof(cmd)) {
+        return failure;
+    }
+    return system(cmd) == 0 ? ok : failure;
+#else
+    posix_spawn_file_actions_t actions;
+    pid_t pid;
+    int status, rc;
+
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, 0, "/dev/null", O_RDONLY, 0);
+    rc = posix_spawnp(&pid, argv[0], &actions, NULL, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    if (rc != 0) {
+        joy_log_err("could not run %s (%s)", argv[0], strerror(rc));
+        return failure;
+    }
+
+    /* upload_stop() sets stop before it looks at child */
+    __atomic_store_n(&transfer->child, pid, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&transfer->stop, __ATOMIC_SEQ_CST)) {
+        kill(pid, SIGTERM);
+    }
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) {
+            status = -1;
+            break;
+        }
+    }
+    __atomic_store_n(&transfer->child, 0, __ATOMIC_SEQ_CST);
+
+    if (status == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        return failure;
+    }
+    return ok;
+#endif
+}
+
+/* scp: bwlimit is given to scp -l, in kbit/s */
+static int upload_scp_send (upload_transfer_t *x) {
+    char limit[32];
+    char *argv[16];
+    unsigned int n = 0;
+
+    argv[n++] = "scp";
+    argv[n++] = "-q";
+    argv[n++] = "-C";
+    argv[n++] = "-o";
+    argv[n++] = "BatchMode=yes";
+    if (x->key) {
+        argv[n++] = "-i";
+        argv[n++] = (char *)x->key;
+    }
+    if (x->bwlimit) {
+        snprintf(limit, sizeof(limit), "%lu", x->bwlimit * 8 / 1000 ? x->bwlimit * 8 / 1000 : 1);
+        argv[n++] = "-l";
+        argv[n++] = limit;
+    }
+    argv[n++] = (char *)x->filename;
+    argv[n++] = (char *)x->target;
+    argv[n] = NULL;
+
+    return upload_run_command(x, argv);
+}
+
+/* rsync: keeps partial files, so that a retry resumes where it stopped */
+static int upload_rsync_send (upload_transfer_t *x) {
+    char limit[32];
+    char shell[UPLOAD_MAX_LINE];
+    char *argv[16];
+    unsigned int n = 0;
+
+    argv[n++] = "rsync";
+    argv[n++] = "-q";
+    argv[n++] = "--partial";
+    argv[n++] = "--timeout=60";
+    /* rsync splits the shell command, so the key is single-quoted */
+    if (x->key) {
+        snprintf(shell, sizeof(shell), "ssh -o BatchMode=yes -i '%s'", x->key);
+    } else {
+        snprintf(shell, sizeof(shell), "ssh -o BatchMode=yes");
+    }
+    argv[n++] = "-e";
+    argv[n++] = shell;
+    if (x->bwlimit) {
+        snprintf(limit, sizeof(limit), "--bwlimit=%lu", x->bwlimit / 1024 ? x->bwlimit / 1024 : 1);
+        argv[n++] = limit;
+    }
+    argv[n++] = (char *)x->filename;
+    argv[n++] = (char *)x->target;
+    argv[n] = NULL;
+
+    return upload_run_command(x, argv);
+}
+
+/* the stop flag, as upload_stop() sets it */
+static int upload_transfer_stopped (upload_transfer_t *x) {
+#ifdef WIN32
+    return x->stop;
+#else
+    return __atomic_load_n(&x->stop, __ATOMIC_SEQ_CST);
+#endif
+}
+
+/* dir: copies into the directory target, pacing itself to bwlimit */
+static int upload_dir_send (upload_transfer_t *x) {
+    const char *base = strrchr(x->filename, '/');
+    char dest[UPLOAD_MAX_LINE], part[UPLOAD_MAX_LINE + 8];
+    FILE *in = NULL, *out = NULL;
+    char *buf = NULL;
+    unsigned long total = 0;
+    double start = upload_now(), ahead;
+    size_t n;
+    int rc = failure;
+
+#ifdef WIN32
+    if (strrchr(x->filename, '\\') > base) {
+        base = strrchr(x->filename, '\\');
+    }
+#endif
+    base = base ? base + 1 : x->filename;
+    snprintf(dest, sizeof(dest), "%s/%s", x->target, base);
+    snprintf(part, sizeof(part), "%s.part", dest);
+
+    buf = malloc(UPLOAD_COPY_SIZE);
+    in = fopen(x->filename, "rb");
+    out = fopen(part, "wb");
+    if (buf == NULL || in == NULL || out == NULL) {
+        joy_log_warn("could not copy %s to %s (%s)", x->filename, part, strerror(errno));
+        goto end;
+    }
+
+    while ((n = fread(buf, 1, UPLOAD_COPY_SIZE, in)) > 0) {
+        if (fwrite(buf, 1, n, out) != n || upload_transfer_stopped(x)) {
+            goto end;
+        }
+        total += n;
+        /* sleep off any lead over bwlimit, a slice at a time */
+        while (x->bwlimit && !upload_transfer_stopped(x) &&
+               (ahead = (double)total / x->bwlimit - (upload_now() - start)) > 0) {
+            if (ahead > 0.1) {
+                ahead = 0.1;
+            }
+#ifdef WIN32
+            Sleep((DWORD)(ahead * 1000));
+#else
+            usleep((useconds_t)(ahead * 1e6));
+#endif
+        }
+    }
+    if (ferror(in) || fflush(out) != 0) {
+        goto end;
+    }
+#ifndef WIN32
+    fsync(fileno(out));
+#endif
+    if (fclose(out) != 0) {
+        out = NULL;
+        goto end;
+    }
+    out = NULL;
+    if (rename(part, dest) == 0) {
+        rc = ok;
+    }
+
+ end:
+    if (out) {
+        fclose(out);
+    }
+    if (in) {
+        fclose(in);
+    }
+    if (rc != ok) {
+        remove(part);
+    }
+    free(buf);
+    return rc;
+}
+
+/*
+ * -------------------------------------------------------
+ * Queue and journal, called with uploader.lock held
+ * -------------------------------------------------------
+ */
+
+static void upload_journal_note (char op, const char *filename) {
+    if (uploader.journal) {
+        fprintf(uploader.journal, "%c %s\n", op, filename);
+        fflush(uploader.journal);
+#ifndef WIN32
+        fsync(fileno(uploader.journal));
+#endif
+    }
+}
+
+static upload_job_t *upload_job_new (const char *filename) {
+    upload_job_t *job = calloc(1, sizeof(upload_job_t));
+
+    if (job) {
+        job->filename = strdup(filename);
+        if (job->filename == NULL) {
+            free(job);
+            job = NULL;
+        }
+    }
+    return job;
+}
+
+static void upload_job_free (upload_job_t *job) {
+    free(job->filename);
+    free(job);
+}
+
+static void upload_queue_append (upload_job_t *job) {
+    job->next = NULL;
+    if (uploader.tail) {
+        uploader.tail->next = job;
+    } else {
+        uploader.head = job;
+    }
+    uploader.tail = job;
+    uploader.stats.queue_depth++;
+}
+
+static void upload_queue_push (upload_job_t *job) {
+    job->next = uploader.head;
+    uploader.head = job;
+    if (uploader.tail == NULL) {
+        uploader.tail = job;
+    }
+    uploader.stats.queue_depth++;
+}
+
+/*
+ * takes the first job that may be tried now off the queue; if there
+ * is none, *wake is when the next one may be, or 0
+ */
+static upload_job_t *upload_queue_take (time_t now, time_t *wake) {
+    upload_job_t *job, *prev = NULL;
+
+    *wake = 0;
+    for (job = uploader.head; job; prev = job, job = job->next) {
+        if (job->not_before <= now) {
+            if (prev) {
+                prev->next = job->next;
+            } else {
+                uploader.head = job->next;
+            }
+            if (uploader.tail == job) {
+                uploader.tail = prev;
+            }
+            uploader.stats.queue_depth--;
+            return job;
+        }
+        if (*wake == 0 || job->not_before < *wake) {
+            *wake = job->not_before;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * reads the files left in the journal into the queue, and rewrites
+ * it with only those
+ */
+static int upload_journal_load (const char *path) {
+    char line[UPLOAD_MAX_LINE];
+    char tmp[UPLOAD_MAX_LINE + 8];
+    upload_job_t *job, *prev, *next;
+    struct stat sb;
+    FILE *f;
+    size_t len;
+
+    f = fopen(path, "r");
+    if (f) {
+        while (fgets(line, sizeof(line), f)) {
+            len = strlen(line);
+            if (len < 3 || line[len - 1] != '\n' || line[1] != ' ') {
+                continue;
+            }
+            line[len - 1] = '\0';
+            for (prev = NULL, job = uploader.head; job; prev = job, job = job->next) {
+                if (!strcmp(job->filename, line + 2)) {
+                    break;
+                }
+            }
+            if (line[0] == '+' && job == NULL) {
+                if ((job = upload_job_new(line + 2)) != NULL) {
+                    upload_queue_append(job);
+                }
+            } else if (line[0] == '-' && job != NULL) {
+                if (prev) {
+                    prev->next = job->next;
+                } else {
+                    uploader.head = job->next;
+                }
+                if (uploader.tail == job) {
+                    uploader.tail = prev;
+                }
+                uploader.stats.queue_depth--;
+                upload_job_free(job);
+            }
+        }
+        fclose(f);
+    }
+
+    /* files that have gone since cannot be sent */
+    for (prev = NULL, job = uploader.head; job; job = next) {
+        next = job->next;
+        if (stat(job->filename, &sb) != 0) {
+            joy_log_warn("queued file %s is gone", job->filename);
+            if (prev) {
+                prev->next = next;
+            } else {
+                uploader.head = next;
+            }
+            if (uploader.tail == job) {
+                uploader.tail = prev;
+            }
+            uploader.stats.queue_depth--;
+            upload_job_free(job);
+        } else {
+            prev = job;
+        }
+    }
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    f = fopen(tmp, "w");
+    if (f == NULL) {
+        joy_log_err("could not write upload queue %s (%s)", tmp, strerror(errno));
+        return failure;
+    }
+    for (job = uploader.head; job; job = job->next) {
+        fprintf(f, "+ %s\n", job->filename);
+    }
+    if (fclose(f) != 0 || rename(tmp, path) != 0) {
+        joy_log_err("could not write upload queue %s (%s)", path, strerror(errno));
+        remove(tmp);
+        return failure;
+    }
+
+    uploader.journal = fopen(path, "a");
+    if (uploader.journal == NULL) {
+        joy_log_err("could not open upload queue %s (%s)", path, strerror(errno));
+        return failure;
+    }
+    return ok;
+}
+
+/* empties the journal once nothing is queued or being sent */
+static void upload_journal_compact (void) {
+    unsigned int i;
+
+    if (uploader.journal == NULL || uploader.head != NULL) {
+        return;
+    }
+    for (i = 0; i < uploader.num_workers; i++) {
+        if (uploader.transfer[i]) {
+            return;
+        }
+    }
+    fclose(uploader.journal);
+    uploader.journal = fopen(uploader.opt.queue_file, "w");
+    if (uploader.journal == NULL) {
+        joy_log_err("could not reopen upload queue %s (%s)", uploader.opt.queue_file, strerror(errno));
+    }
+}
+
+/*
+ * -------------------------------------------------------
+ * Workers
+ * -------------------------------------------------------
+ */
+
+/* accounts for the attempt to send job, which took seconds */
+static void upload_job_done (upload_job_t *job, int rc, double seconds, unsigned long size) {
+    if (rc == ok) {
+        joy_log_info("transfer of file [%s] successful!", job->filename);
+        uploader.stats.files_uploaded++;
+        uploader.stats.bytes_uploaded += size;
+        uploader.stats.transfer_seconds += seconds;
+        upload_journal_note('-', job->filename);
+        if (!uploader.opt.retain) {
+            joy_log_info("removing file [%s]", job->filename);
+            if (remove(job->filename) != 0) {
+                joy_log_err("removing file [%s] failed!", job->filename);
+            }
+        }
+        upload_job_free(job);
+
+    } else if (uploader.stopping) {
+        /* still in the journal, so it is sent after a restart */
+        upload_queue_push(job);
+
+    } else if (job->attempts++ >= uploader.opt.retries) {
+        joy_log_err("giving up on file [%s] after %u attempts", job->filename, job->attempts);
+        uploader.stats.failures++;
+        upload_journal_note('-', job->filename);
+        upload_job_free(job);
+
+    } else {
+        unsigned int delay = upload_retry_delay(&uploader.opt, job->attempts);
+
+        joy_log_warn("transfer of file [%s] failed, retrying in %u seconds", job->filename, delay);
+        uploader.stats.retries++;
+        job->not_before = time(NULL) + delay;
+        upload_queue_append(job);
+    }
+}
+
+static void *upload_worker_main (void *arg) {
+    unsigned int id = (unsigned int)(size_t)arg;
+    upload_transfer_t transfer;
+    upload_job_t *job;
+    struct stat sb;
+    struct timespec ts;
+    time_t wake;
+    double start;
+    int rc;
+
+    pthread_mutex_lock(&uploader.lock);
+    while (!uploader.stopping) {
+        job = upload_queue_take(time(NULL), &wake);
+        if (job == NULL) {
+            if (wake) {
+                ts.tv_sec = wake;
+                ts.tv_nsec = 0;
+                pthread_cond_timedwait(&uploader.cond, &uploader.lock, &ts);
+            } else {
+                pthread_cond_wait(&uploader.cond, &uploader.lock);
+            }
+            continue;
+        }
+
+        if (stat(job->filename, &sb) != 0) {
+            joy_log_err("could not upload file [%s] (%s)", job->filename, strerror(errno));
+            uploader.stats.failures++;
+            upload_journal_note('-', job->filename);
+            upload_job_free(job);
+            upload_journal_compact();
+            continue;
+        }
+
+        memset(&transfer, 0, sizeof(transfer));
+        transfer.filename = job->filename;
+        transfer.target = uploader.target;
+        transfer.key = uploader.opt.key;
+        transfer.bwlimit = uploader.opt.bwlimit;
+        uploader.transfer[id] = &transfer;
+        uploader.stats.active++;
+        pthread_mutex_unlock(&uploader.lock);
+
+        joy_log_info("uploading file [%s] ...", job->filename);
+        start = upload_now();
+        rc = uploader.transport->send(&transfer);
+
+        pthread_mutex_lock(&uploader.lock);
+        uploader.transfer[id] = NULL;
+        uploader.stats.active--;
+        upload_job_done(job, rc, upload_now() - start, (unsigned long)sb.st_size);
+        upload_journal_compact();
+    }
+    pthread_mutex_unlock(&uploader.lock);
+    return NULL;
+}
+
+/*
+ * -------------------------------------------------------
+ * Interface
+ * -------------------------------------------------------
+ */
+
+static void upload_cleanup (void) {
+    upload_job_t *job;
+
+    while ((job = uploader.head) != NULL) {
+        uploader.head = job->next;
+        upload_job_free(job);
+    }
+    uploader.tail = NULL;
+    if (uploader.journal) {
+        fclose(uploader.journal);
+        uploader.journal = NULL;
+    }
+    free((char *)uploader.opt.destination);
+    free((char *)uploader.opt.key);
+    free((char *)uploader.opt.queue_file);
+    memset(&uploader.opt, 0, sizeof(uploader.opt));
+}
+
+/**
+ * \brief Start the uploader, and the files left in its queue.
+ *
+ * \param options How to upload; the strings are copied
+ *
+ * \return ok, or failure
+ */
+int upload_start (const upload_options_t *options) {
+    unsigned int i;
+    int rc;
+
+    if (uploader.running || options->destination == NULL) {
+        return failure;
+    }
+    if (options->key && strchr(options->key, '\'')) {
+        joy_log_err("ssh key %s cannot be passed to rsync (it contains a quote)", options->key);
+        return failure;
+    }
+
+    pthread_mutex_lock(&uploader.lock);
+    memset(&uploader.stats, 0, sizeof(uploader.stats));
+    uploader.opt = *options;
+    uploader.opt.destination = strdup(options->destination);
+    uploader.opt.key = options->key ? strdup(options->key) : NULL;
+    uploader.opt.queue_file = options->queue_file ? strdup(options->queue_file) : NULL;
+    if (uploader.opt.workers == 0) {
+        uploader.opt.workers = UPLOAD_DEFAULT_WORKERS;
+    } else if (uploader.opt.workers > UPLOAD_MAX_WORKERS) {
+        uploader.opt.workers = UPLOAD_MAX_WORKERS;
+    }
+    uploader.transport = upload_find_transport(uploader.opt.destination, &uploader.target);
+
+    if (uploader.opt.queue_file && upload_journal_load(uploader.opt.queue_file) != ok) {
+        upload_cleanup();
+        pthread_mutex_unlock(&uploader.lock);
+        return failure;
+    }
+    if (uploader.head) {
+        joy_log_info("%lu files left in the upload queue", uploader.stats.queue_depth);
+    }
+
+    uploader.stopping = 0;
+    uploader.num_workers = 0;
+    for (i = 0; i < uploader.opt.workers; i++) {
+        rc = pthread_create(&uploader.worker[i], NULL, upload_worker_main, (void *)(size_t)i);
+        if (rc != 0) {
+            joy_log_err("could not start upload worker (%s)", strerror(rc));
+            break;
+        }
+        uploader.num_workers++;
+    }
+    uploader.running = 1;
+    pthread_mutex_unlock(&uploader.lock);
+
+    if (uploader.num_workers == 0) {
+        upload_stop();
+        return failure;
+    }
+    return ok;
+}
+
+/**
+ * \brief Queue a file to be uploaded.
+ *
+ * \param filename File to upload
+ *
+ * \return ok, or failure
+ */
+int upload_file (const char *filename) {
+    upload_job_t *job;
+
+    /* sanity check we were passed in a file to upload */
+    if (filename == NULL) {
+        joy_log_err("could not upload file (output file not set)");
+        return failure;
+    }
+    if (strchr(filename, '\n')) {
+        joy_log_err("could not upload file (newline in its name)");
+        return failure;
+    }
+
+    pthread_mutex_lock(&uploader.lock);
+    if (!uploader.running || (job = upload_job_new(filename)) == NULL) {
+        pthread_mutex_unlock(&uploader.lock);
+        joy_log_err("could not queue file [%s] for upload", filename);
+        return failure;
+    }
+    upload_queue_append(job);
+    upload_journal_note('+', filename);
+    pthread_cond_signal(&uploader.cond);
+    pthread_mutex_unlock(&uploader.lock);
+
+    return ok;
+}
+
+/**
+ * \brief Read the counters of the uploader.
+ *
+ * \param stats Where the counters are copied to
+ */
+void upload_stats (upload_stats_t *stats) {
+    pthread_mutex_lock(&uploader.lock);
+    *stats = uploader.stats;
+    pthread_mutex_unlock(&uploader.lock);
+}
+
+/**
+ * \brief Stop the uploader.
+ *
+ * Transfers in progress are abandoned; they, and the files still
+ * queued, stay in the journal for the next time the uploader starts.
+ */
+void upload_stop (void) {
+    unsigned int i;
+#ifndef WIN32
+    pid_t child;
+#endif
+
+    pthread_mutex_lock(&uploader.lock);
+    if (!uploader.running) {
+        pthread_mutex_unlock(&uploader.lock);
+        return;
+    }
+    uploader.stopping = 1;
+    for (i = 0; i < uploader.num_workers; i++) {
+        upload_transfer_t *x = uploader.transfer[i];
+
+        if (x == NULL) {
+            continue;
+        }
+#ifdef WIN32
+        x->stop = 1;
+#else
+        __atomic_store_n(&x->stop, 1, __ATOMIC_SEQ_CST);
+        child = __atomic_load_n(&x->child, __ATOMIC_SEQ_CST);
+        if (child) {
+            kill(child, SIGTERM);
+        }
+#endif
+    }
+    pthread_cond_broadcast(&uploader.cond);
+    pthread_mutex_unlock(&uploader.lock);
+
+    for (i = 0; i < uploader.num_workers; i++) {
+        pthread_join(uploader.worker[i], NULL);
+    }
+
+    pthread_mutex_lock(&uploader.lock);
+    upload_cleanup();
+    uploader.num_workers = 0;
+    uploader.running = 0;
+    pthread_mutex_unlock(&uploader.lock);
+}
+
+/*
+ * -------------------------------------------------------
+ * Unit test
+ * -------------------------------------------------------
+ */
+
+#ifndef WIN32
+
+static int upload_test_fail_send (upload_transfer_t *x) {
+    (void)x;
+    return failure;
+}
+
+static const upload_transport_t upload_test_fail = { "fail", upload_test_fail_send };
+
+/* writes len bytes of a pattern that depends on seed */
+static int upload_test_write (const char *path, size_t len, unsigned int seed) {
+    FILE *f = fopen(path, "wb");
+    size_t i;
+
+    if (f == NULL) {
+        return failure;
+    }
+    for (i = 0; i < len; i++) {
+        fputc((int)((i * 31 + seed) & 0xff), f);
+    }
+    return fclose(f) == 0 ? ok : failure;
+}
+
+static int upload_test_check (const char *path, size_t len, unsigned int seed) {
+    FILE *f = fopen(path, "rb");
+    size_t i;
+    int c, rc = ok;
+
+    if (f == NULL) {
+        return failure;
+    }
+    for (i = 0; i < len; i++) {
+        if ((c = fgetc(f)) != (int)((i * 31 + seed) & 0xff)) {
+            rc = failure;
+            break;
+        }
+    }
+    if (fgetc(f) != EOF) {
+        rc = failure;
+    }
+    fclose(f);
+    return rc;
+}
+
+/* waits until done files have been sent or given up on */
+static void upload_test_wait (unsigned long done) {
+    upload_stats_t s;
+    unsigned int i;
+
+    for (i = 0; i < 1000; i++) {
+        upload_stats(&s);
+        if (s.files_uploaded + s.failures >= done && s.active == 0 && s.queue_depth == 0) {
+            return;
+        }
+        usleep(10000);
+    }
+}
+
+static long upload_test_size (const char *path) {
+    struct stat sb;
+
+    return stat(path, &sb) == 0 ? (long)sb.st_size : -1;
+}
+
+#endif
+
+/**
+ * \brief Unit test for the uploader, with the dir transport.
+ */
+void upload_unit_test (void) {
+    int num_fails = 0;
+#ifndef WIN32
+    char src[] = "/tmp/joy-upload-src-XXXXXX";
+    char dst[] = "/tmp/joy-upload-dst-XXXXXX";
+    char path[UPLOAD_MAX_LINE], copy[UPLOAD_MAX_LINE], dest[UPLOAD_MAX_LINE];
+    char queue[UPLOAD_MAX_LINE] = "";
+    const unsigned int num_files = 6;
+    upload_options_t opt;
+    upload_stats_t s;
+    unsigned long bytes = 0;
+    const char *target;
+    unsigned int i;
+#endif
+
+    fprintf(info, "\n******************************\n");
+    fprintf(info, "Upload Unit Test starting...\n");
+
+#ifndef WIN32
+    if (upload_find_transport("user@host:/data", &target) != &upload_scp || strcmp(target, "user@host:/data") ||
+        upload_find_transport("scp:user@host:/data", &target) != &upload_scp || strcmp(target, "user@host:/data") ||
+        upload_find_transport("rsync:host:/data", &target) != &upload_rsync || strcmp(target, "host:/data") ||
+        upload_find_transport("dir:/data", &target) != &upload_dir || strcmp(target, "/data")) {
+        fprintf(info, "error: transport chosen by the destination\n");
+        num_fails++;
+    }
+
+    memset(&opt, 0, sizeof(opt));
+    opt.retry_delay = 10;
+    opt.max_retry_delay = 60;
+    if (upload_retry_delay(&opt, 1) != 10 || upload_retry_delay(&opt, 2) != 20 ||
+        upload_retry_delay(&opt, 3) != 40 || upload_retry_delay(&opt, 4) != 60 ||
+        upload_retry_delay(&opt, 40) != 60) {
+        fprintf(info, "error: retry delays\n");
+        num_fails++;
+    }
+
+    if (mkdtemp(src) == NULL || mkdtemp(dst) == NULL) {
+        fprintf(info, "error: could not make temporary directories\n");
+        num_fails++;
+        goto end;
+    }
+    snprintf(queue, sizeof(queue), "%s/queue", src);
+    snprintf(dest, sizeof(dest), "dir:%s", dst);
+
+    /* files are sent by several workers, and removed once sent */
+    memset(&opt, 0, sizeof(opt));
+    opt.destination = dest;
+    opt.queue_file = queue;
+    opt.workers = 3;
+    if (upload_start(&opt) != ok) {
+        fprintf(info, "error: could not start the uploader\n");
+        num_fails++;
+        goto end;
+    }
+    for (i = 0; i < num_files; i++) {
+        snprintf(path, sizeof(path), "%s/file%u", src, i);
+        upload_test_write(path, i * 100000, i);
+        bytes += i * 100000;
+        upload_file(path);
+    }
+    upload_test_wait(num_files);
+    upload_stats(&s);
+    if (s.files_uploaded != num_files || s.bytes_uploaded != bytes || s.failures || s.retries) {
+        fprintf(info, "error: %lu files and %lu bytes uploaded, expected %u and %lu\n",
+                s.files_uploaded, s.bytes_uploaded, num_files, bytes);
+        num_fails++;
+    }
+    for (i = 0; i < num_files; i++) {
+        snprintf(path, sizeof(path), "%s/file%u", src, i);
+        snprintf(copy, sizeof(copy), "%s/file%u", dst, i);
+        if (upload_test_check(copy, i * 100000, i) != ok || upload_test_size(path) != -1) {
+            fprintf(info, "error: file%u was not moved intact\n", i);
+            num_fails++;
+        }
+        remove(copy);
+    }
+    if (upload_test_size(queue) != 0) {
+        fprintf(info, "error: the queue journal was not emptied\n");
+        num_fails++;
+    }
+    upload_stop();
+
+    /* a file that cannot be sent is retried, then given up on and kept */
+    opt.destination = "dir:/nonexistent/joy-upload";
+    opt.retries = 2;
+    opt.retain = 1;
+    upload_start(&opt);
+    snprintf(path, sizeof(path), "%s/file0", src);
+    upload_test_write(path, 1000, 7);
+    upload_file(path);
+    upload_test_wait(1);
+    upload_stats(&s);
+    if (s.files_uploaded != 0 || s.retries != 2 || s.failures != 1 || upload_test_size(path) != 1000) {
+        fprintf(info, "error: %lu retries and %lu failures, expected 2 and 1\n", s.retries, s.failures);
+        num_fails++;
+    }
+    upload_stop();
+
+    /* files still queued when the uploader stops are sent after a restart */
+    if (upload_register_transport(&upload_test_fail) != ok) {
+        fprintf(info, "error: could not register a transport\n");
+        num_fails++;
+    }
+    opt.destination = "fail:";
+    opt.retry_delay = 3600;
+    opt.max_retry_delay = 3600;
+    opt.retain = 0;
+    upload_start(&opt);
+    upload_file(path);
+    snprintf(copy, sizeof(copy), "%s/file1", src);
+    upload_test_write(copy, 2000, 8);
+    upload_file(copy);
+    for (i = 0; i < 1000; i++) {
+        upload_stats(&s);
+        if (s.retries == 2) {
+            break;
+        }
+        usleep(10000);
+    }
+    upload_stop();
+
+    opt.destination = dest;
+    upload_start(&opt);
+    upload_stats(&s);
+    if (s.queue_depth + s.active + s.files_uploaded != 2) {
+        fprintf(info, "error: %lu files reloaded from the queue, expected 2\n",
+                s.queue_depth + s.active + s.files_uploaded);
+        num_fails++;
+    }
+    upload_test_wait(2);
+    snprintf(path, sizeof(path), "%s/file0", dst);
+    snprintf(copy, sizeof(copy), "%s/file1", dst);
+    if (upload_test_check(path, 1000, 7) != ok || upload_test_check(copy, 2000, 8) != ok) {
+        fprintf(info, "error: reloaded files were not sent\n");
+        num_fails++;
+    }
+    remove(path);
+    remove(copy);
+    upload_stop();
+
+    /* bwlimit paces a transfer */
+    opt.bwlimit = 2000000;
+    upload_start(&opt);
+    snprintf(path, sizeof(path), "%s/file2", src);
+    upload_test_write(path, 600000, 9);
+    upload_file(path);
+    upload_test_wait(1);
+    upload_stats(&s);
+    if (s.files_uploaded != 1 || s.transfer_seconds < 0.25) {
+        fprintf(info, "error: limited transfer took %f seconds, expected 0.3\n", s.transfer_seconds);
+        num_fails++;
+    }
+    upload_stop();
+    snprintf(path, sizeof(path), "%s/file2", dst);
+    remove(path);
+
+ end:
+    remove(queue);
+    rmdir(src);
+    rmdir(dst);
+#endif
+
+    if (num_fails) {
+        fprintf(info, "Finished - failures: %d\n", num_fails);
+    } else {
+        fprintf(info, "Finished - success\n");
+    }
+    fprintf(info, "******************************\n\n");
+}
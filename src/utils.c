@@ -54,55 +54,39 @@
 extern struct configuration *glb_config;
 extern FILE *info;
 
-#ifdef USE_BZIP2
-
-#include <stdarg.h>
-#include <bzlib.h>
-
-/* This function is an API glue between zprintf and
- * the subsequent bzwrite to a compressed file. BZ2
- * doesn't have a printf interface, so an equivalent
- * interface needed to be written.
- * Note: this function can only output 4K chars at a time.
- *   if a string comes through bigger than 4K, it will
- *   dynamically allocate a buffer to hold the output and then
- *   print out the data.
+/*
+ * \brief Build the i-th place that a resource file is looked for in.
+ *
+ * \param filename Name of the resource file.
+ * \param i Which place, from 0.
+ * \param filepath Filled in with the path, of JOY_UTILS_MAX_FILEPATH bytes.
  *
+ * \return 1 if there is an i-th place, otherwise 0
  */
-#define BZ_MAX_SIZE 4096
-int BZ2_bzprintf(BZFILE *b, const char * format, ...)
-{
-    int BZ_sz; 
-    int BZ_errnum;
-    va_list arg;
-    char BZ_buff[BZ_MAX_SIZE];
-
-    va_start(arg, format);
-    BZ_sz = vsnprintf(BZ_buff, BZ_MAX_SIZE, format, arg);
-    va_end(arg);
-
-    /* check resulting size and perform output accordingly */
-    if (BZ_sz >= BZ_MAX_SIZE) {
-        char *BZ_dyn_buff = malloc(BZ_sz + 1);
-        if (BZ_dyn_buff != NULL) {
-            va_start(arg, format);
-            BZ_sz = vsnprintf(BZ_dyn_buff, (BZ_sz + 1), format, arg);
-            va_end(arg);
-            BZ2_bzwrite(b, BZ_dyn_buff, BZ_sz);
-            free(BZ_dyn_buff);
-        } else {
-            /* error scenario, can't print out all the data,
-             * let's just print what we can
-             */
-            BZ2_bzwrite(b, BZ_buff, (BZ_MAX_SIZE-1));
+static int joy_utils_resource_path(const char *filename, unsigned int i, char *filepath) {
+    memset(filepath, 0, JOY_UTILS_MAX_FILEPATH);
+    if (glb_config->aux_resource_path) {
+        /*
+         * Use the path that was given in Joy cli
+         */
+        if (i > 0) {
+            return 0;
         }
+        strncpy(filepath, glb_config->aux_resource_path, JOY_UTILS_MAX_FILEPATH - 1);
+        /* Place "/" before file name in case user left it out */
+        strncat(filepath, "/", JOY_UTILS_MAX_FILEPATH - 1 - strlen(filepath));
+    } else if (i == 0) {
+        /* Assume user CWD in root of Joy source package */
+        strncpy(filepath, "./resources/", JOY_UTILS_MAX_FILEPATH - 1);
+    } else if (i == 1) {
+        /* Assume user CWD one-level subdir of Joy source package */
+        strncpy(filepath, "../resources/", JOY_UTILS_MAX_FILEPATH - 1);
     } else {
-        BZ2_bzwrite(b, BZ_buff, BZ_sz);
+        return 0;
     }
-    BZ2_bzerror(b, &BZ_errnum);
-    return BZ_errnum;
+    strncat(filepath, filename, JOY_UTILS_MAX_FILEPATH - 1 - strlen(filepath));
+    return 1;
 }
-#endif
 
 /*
  *
@@ -117,6 +101,7 @@ int BZ2_bzprintf(BZFILE *b, const char * format, ...)
 JSON_Value* joy_utils_open_resource_parson(const char *filename) {
     JSON_Value *value = NULL;
     char *filepath = NULL;
+    unsigned int i;
 
     /* Allocate memory to store constructed file path */
     filepath = calloc(JOY_UTILS_MAX_FILEPATH, sizeof(char));
@@ -124,27 +109,8 @@ JSON_Value* joy_utils_open_resource_parson(const char *filename) {
 	return NULL;
     }
 
-    if (glb_config->aux_resource_path) {
-        /*
-         * Use the path that was given in Joy cli
-         */
-        strncpy(filepath, glb_config->aux_resource_path, JOY_UTILS_MAX_FILEPATH);
-        /* Place "/" before file name in case user left it out */
-        strncat(filepath, "/", JOY_UTILS_MAX_FILEPATH - 1);
-        strncat(filepath, filename, JOY_UTILS_MAX_FILEPATH - 1);
-        value = json_parse_file(filepath);
-    } else {
-        /* Assume user CWD in root of Joy source package */
-        strncpy(filepath, "./resources/", JOY_UTILS_MAX_FILEPATH);
-        strncat(filepath, filename, JOY_UTILS_MAX_FILEPATH - 1);
+    for (i = 0; !value && joy_utils_resource_path(filename, i, filepath); i++) {
         value = json_parse_file(filepath);
-        if (!value) {
-            /* Assume user CWD one-level subdir of Joy source package */
-            memset(filepath, 0, JOY_UTILS_MAX_FILEPATH);
-            strncpy(filepath, "../resources/", JOY_UTILS_MAX_FILEPATH);
-            strncat(filepath, filename, JOY_UTILS_MAX_FILEPATH - 1);
-            value = json_parse_file(filepath);
-        }
     }
 
     if (!value) {
@@ -154,10 +120,50 @@ JSON_Value* joy_utils_open_resource_parson(const char *filename) {
     /* Cleanup */
     free(filepath);
 
-
     return value;
 }
 
+/*
+ *
+ * \brief Use Parson to open a json file from the source resources/ directory,
+ *        as joy_utils_open_resource_parson() does, for a file that need not
+ *        be there; only a file that is there but cannot be parsed is an error.
+ *
+ * \param filename Name of the json file to be opened.
+ * \param missing Set to 1 if the file is not there, otherwise 0.
+ *
+ * \return JSON_Value pointer, otherwise NULL
+ */
+JSON_Value* joy_utils_open_optional_resource_parson(const char *filename, int *missing) {
+    JSON_Value *value = NULL;
+    char *filepath = NULL;
+    unsigned int i;
+    FILE *fp;
+
+    *missing = 0;
+    filepath = calloc(JOY_UTILS_MAX_FILEPATH, sizeof(char));
+    if (!filepath) {
+	return NULL;
+    }
+
+    for (i = 0; joy_utils_resource_path(filename, i, filepath); i++) {
+        fp = fopen(filepath, "r");
+        if (fp) {
+            fclose(fp);
+            value = json_parse_file(filepath);
+            if (!value) {
+                joy_log_err("could not parse %s", filepath);
+            }
+            free(filepath);
+            return value;
+        }
+    }
+
+    *missing = 1;
+    free(filepath);
+    return NULL;
+}
+
 /*
  * \brief Open a file from the source test/misc/ directory.
  *
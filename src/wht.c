@@ -55,10 +55,11 @@ extern FILE *info;
  * \brief Initialize the memory of WHT struct.
  *
  * \param wht_handle contains wht structure to init
+ * \param arena arena of the flow record (unused)
  *
  * \return none
  */
-__inline void wht_init (wht_t **wht_handle) {
+__inline void wht_init (wht_t **wht_handle, joy_arena_t *arena) {
     if (*wht_handle != NULL) {
         wht_delete(wht_handle);
     }
@@ -193,6 +194,9 @@ void wht_print_json (const wht_t *w1, const wht_t *w2, zfile f) {
 #endif 
 }
 
+/* the JSON of wht is carried as text in CBOR output */
+define_print_text(wht)
+
 /**
  * \brief Delete the memory of WHT struct.
  *
@@ -219,6 +223,7 @@ void wht_delete (wht_t **wht_handle) {
  */
 void wht_unit_test() {
     wht_t *wht = NULL;
+    joy_arena_t arena;
     wht_t *wht2 = NULL;
     const struct pcap_pkthdr *header = NULL;
 
@@ -236,22 +241,24 @@ void wht_unit_test() {
           255, 254, 253, 252
     };
 
-    wht_init(&wht);
+    memset(&arena, 0, sizeof(arena));
+    wht_init(&wht, &arena);
     wht_update(wht, header, buffer1, sizeof(buffer1), 1);
 
-    wht_init(&wht);
+    wht_init(&wht, &arena);
     wht_update(wht, header, buffer2, sizeof(buffer2), 1);
 
-    wht_init(&wht);
+    wht_init(&wht, &arena);
     wht_update(wht, header, buffer3, sizeof(buffer3), 1);
 
-    wht_init(&wht);
-    wht_init(&wht2);
+    wht_init(&wht, &arena);
+    wht_init(&wht2, &arena);
     wht_update(wht, header, buffer4, 1, 1); /* note: only reading first byte */
     wht_update(wht, header, buffer4, 1, 1); /* note: only reading first byte */
     wht_update(wht, header, buffer4, 1, 1); /* note: only reading first byte */
 
     wht_delete(&wht);
     wht_delete(&wht2);
+    joy_arena_release(&arena);
 } 
 